@@ -32,27 +32,60 @@
 #include <boost/algorithm/string.hpp>
 #include <iomanip>
 #include <random>
+#include <algorithm>
 
 using namespace std::chrono_literals;
 
 static auto random_seed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 static std::default_random_engine random_generator(random_seed);
 
+// The tester runs each --shares class through four phases of --duration
+// seconds and reports, per shard, phase and class, the achieved
+// bandwidth, the achieved-vs-requested share ratio and the latency
+// percentiles:
+//
+//   steady - every class issues at --parallelism
+//   burst  - class 0 quadruples its parallelism; shares should hold
+//   join   - an extra class (the shares of class 0) starts competing
+//   leave  - the extra class leaves again; shares should recover
+//
+// With --conformance the exit status reflects whether every backlogged
+// class achieved its share within --tolerance in every phase, giving
+// scheduler changes an objective acceptance criterion.
 class context {
     struct class_data {
         static int idgen();
 
         uint32_t _shares;
         io_priority_class _iop;
-        unsigned _final = 0;
+        bool _joiner;
 
+        // per-phase workload configuration and statistics
+        bool _active = true;
+        unsigned _parallelism_mult = 1;
         size_t _bytes = 0;
-        std::chrono::steady_clock::time_point _start = {};
+        std::vector<double> _latencies; // microseconds, one per request
 
-        class_data(uint32_t shares)
+        class_data(uint32_t shares, bool joiner = false)
             : _shares(shares)
             , _iop(engine().register_one_priority_class(sprint("test-class-%d", idgen()), shares))
+            , _joiner(joiner)
         {}
+
+        void reset_stats() {
+            _bytes = 0;
+            _latencies.clear();
+        }
+
+        // q in [0, 1]; sorts the samples, so call only when collecting
+        double latency_percentile(double q) {
+            if (_latencies.empty()) {
+                return 0;
+            }
+            std::sort(_latencies.begin(), _latencies.end());
+            auto idx = std::min(_latencies.size() - 1, size_t(std::ceil(q * _latencies.size())) - 1);
+            return _latencies[idx];
+        }
     };
     std::vector<class_data> _cl;
 
@@ -60,20 +93,25 @@ class context {
     unsigned _parallelism;
     std::chrono::seconds _duration;
     size_t _reqsize;
+    double _tolerance;
 
-    semaphore _finished;
     file _fq;
     std::uniform_int_distribution<uint32_t> _pos_distribution;
+    std::stringstream _report;
+    bool _conformant = true;
 public:
-    context(sstring dir, std::vector<uint32_t> shares, unsigned parallelism, unsigned duration, size_t reqsize)
+    context(sstring dir, std::vector<uint32_t> shares, unsigned parallelism, unsigned duration, size_t reqsize, double tolerance)
             : _cl(shares.begin(), shares.end())
             , _dir(dir)
             , _parallelism(parallelism)
             , _duration(duration)
             , _reqsize(align_up(reqsize, 4096ul))
-            , _finished(0)
+            , _tolerance(tolerance)
             , _pos_distribution(0, parallelism * shares.size() - 1)
     {
+        // the class that joins and leaves mid-test; competes with the
+        // same shares as class 0
+        _cl.emplace_back(_cl[0]._shares, true);
     }
 
     future<> stop() { return make_ready_future<>(); }
@@ -83,47 +121,104 @@ public:
         });
     }
 
-    future<> read_class(class_data& cl) {
+    bool conformant() const { return _conformant; }
+
+    future<> read_class(class_data& cl, std::chrono::steady_clock::time_point deadline) {
         auto bufptr = allocate_aligned_buffer<char>(_reqsize, 4096);
         auto buf = bufptr.get();
         auto pos = _pos_distribution(random_generator) * _reqsize;
-        return _fq.dma_read(pos, buf, _reqsize, cl._iop).then([bufptr = std::move(bufptr), &cl, this] (size_t size) {
+        auto start = std::chrono::steady_clock::now();
+        return _fq.dma_read(pos, buf, _reqsize, cl._iop).then([bufptr = std::move(bufptr), &cl, this, deadline, start] (size_t size) {
+            auto now = std::chrono::steady_clock::now();
             cl._bytes += size;
-            if ((std::chrono::steady_clock::now() - cl._start) < _duration) {
-                return this->read_class(cl);
+            cl._latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - start).count());
+            if (now < deadline) {
+                return this->read_class(cl, deadline);
             } else {
                 return make_ready_future<>();
             }
         });
     }
 
-    future<> issue_reads() {
-        return parallel_for_each(_cl.begin(), _cl.end(), [this] (class_data& cl) {
-            auto parallelism = boost::irange(0u, _parallelism);
-            cl._start = std::chrono::steady_clock::now();
-            return parallel_for_each(parallelism.begin(), parallelism.end(), [this, &cl] (auto dummy) {
-                return this->read_class(cl);
-            }).then([&cl, this] {
-                auto duration = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - cl._start).count();
-                cl._final = (cl._bytes / duration) >> 10;
-                _finished.signal(1);
+    void configure_phase(const sstring& phase) {
+        for (auto& cl : _cl) {
+            cl._active = !cl._joiner;
+            cl._parallelism_mult = 1;
+            cl.reset_stats();
+        }
+        if (phase == "burst") {
+            _cl[0]._parallelism_mult = 4;
+        } else if (phase == "join") {
+            _cl.back()._active = true;
+        }
+    }
+
+    future<> run_phase(sstring phase) {
+        configure_phase(phase);
+        auto started = std::chrono::steady_clock::now();
+        auto deadline = started + _duration;
+        return parallel_for_each(_cl.begin(), _cl.end(), [this, deadline] (class_data& cl) {
+            if (!cl._active) {
+                return make_ready_future<>();
+            }
+            auto fibers = boost::irange(0u, _parallelism * cl._parallelism_mult);
+            return parallel_for_each(fibers.begin(), fibers.end(), [this, &cl, deadline] (auto dummy) {
+                return this->read_class(cl, deadline);
             });
+        }).then([this, phase, started] {
+            this->collect(phase, started);
         });
     }
 
-    future<> print_stats() {
-        return _finished.wait(_cl.size()).then([this] {
-            std::stringstream ss;
-            ss << "Shard " << std::setw(2) << engine().cpu_id() << ":";
-            auto idx = 0;
-            for (auto& cl: _cl) {
-                ss << " Class " << idx++ << "(" << std::setw(2) << cl._shares << " shares): " << std::setw(8) << cl._final << " KB/s";
-            }
-            ss << std::endl;
-            std::cout << ss.str();
-            return make_ready_future<>();
+    future<> run_phases() {
+        auto phases = std::vector<sstring>{"steady", "burst", "join", "leave"};
+        return do_with(std::move(phases), [this] (std::vector<sstring>& phases) {
+            return do_for_each(phases, [this] (sstring& phase) {
+                return run_phase(phase);
+            });
         });
     }
+
+    void collect(const sstring& phase, std::chrono::steady_clock::time_point started) {
+        auto secs = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - started).count();
+        size_t total_bytes = 0;
+        uint32_t total_shares = 0;
+        for (auto& cl : _cl) {
+            if (cl._active) {
+                total_bytes += cl._bytes;
+                total_shares += cl._shares;
+            }
+        }
+        auto idx = 0;
+        for (auto& cl : _cl) {
+            if (!cl._active) {
+                idx++;
+                continue;
+            }
+            auto requested = double(cl._shares) / total_shares;
+            auto achieved = total_bytes ? double(cl._bytes) / total_bytes : 0;
+            auto ratio = achieved / requested;
+            auto pass = ratio >= 1 - _tolerance && ratio <= 1 + _tolerance;
+            _conformant = _conformant && pass;
+            _report << "Shard " << std::setw(2) << engine().cpu_id()
+                    << " phase " << std::setw(6) << phase
+                    << " class " << idx++ << (cl._joiner ? "j" : " ")
+                    << " (" << std::setw(3) << cl._shares << " shares):"
+                    << std::setw(9) << uint64_t(cl._bytes / secs) / 1024 << " KB/s"
+                    << " share " << std::fixed << std::setprecision(2) << achieved << "/" << requested
+                    << " ratio " << ratio
+                    << " lat(us) p50 " << std::setprecision(0) << cl.latency_percentile(0.5)
+                    << " p95 " << cl.latency_percentile(0.95)
+                    << " p99 " << cl.latency_percentile(0.99)
+                    << (pass ? "" : " FAIL")
+                    << std::endl;
+        }
+    }
+
+    future<> print_stats() {
+        std::cout << _report.str();
+        return make_ready_future<>();
+    }
 };
 
 int context::class_data::idgen() {
@@ -139,25 +234,29 @@ int main(int ac, char** av) {
     opt_add
         ("directory", bpo::value<sstring>()->default_value("."), "directory where to execute the test")
         ("parallelism", bpo::value<unsigned>()->default_value(10), "number of parallel requests per class")
-        ("duration", bpo::value<unsigned>()->default_value(10), "for how long (in seconds) to run the test")
+        ("duration", bpo::value<unsigned>()->default_value(10), "for how long (in seconds) to run each phase")
         ("reqsize", bpo::value<size_t>()->default_value(4096), "size of each read request")
         ("shares", bpo::value<sstring>()->default_value("10,10"), "comma-separated list of shares per each class (default: 10,10)")
+        ("tolerance", bpo::value<double>()->default_value(0.25), "allowed relative deviation of achieved from requested share")
+        ("conformance", "exit non-zero if any class misses its share beyond the tolerance")
     ;
 
 
     distributed<context> ctx;
-    return app.run(ac, av, [&] {
+    return app.run(ac, av, [&] () -> future<int> {
         auto& opts = app.configuration();
         auto& directory = opts["directory"].as<sstring>();
+        bool conformance_mode = opts.count("conformance");
         return file_system_at(directory).then([directory] (auto fs) {
             if (fs != fs_type::xfs) {
                 throw std::runtime_error(sprint("This is a performance test. %s is not on XFS", directory));
             }
-        }).then([&] {
+        }).then([&, conformance_mode] {
             auto& parallelism = opts["parallelism"].as<unsigned>();
             auto& share_list = opts["shares"].as<sstring>();
             auto& duration = opts["duration"].as<unsigned>();
             auto& reqsize = opts["reqsize"].as<size_t>();
+            auto& tolerance = opts["tolerance"].as<double>();
 
             std::vector<sstring> strs;
             boost::split(strs, share_list, boost::is_any_of(","));
@@ -176,18 +275,26 @@ int main(int ac, char** av) {
                     assert(s == size);
                     return make_ready_future<>();
                 });
-            }).then([directory, shares, parallelism, duration, reqsize, name, &ctx] {
-                return ctx.start(directory, std::move(shares), parallelism, duration, reqsize).then([&ctx, name = std::move(name)] {
+            }).then([directory, shares, parallelism, duration, reqsize, tolerance, name, &ctx, conformance_mode] {
+                return ctx.start(directory, std::move(shares), parallelism, duration, reqsize, tolerance).then([&ctx, name = std::move(name), conformance_mode] {
                     engine().at_exit([&ctx] {
                         return ctx.stop();
                     });
                     return ctx.invoke_on_all([name = std::move(name)] (auto& c) {
                         return c.start(name).then([&c] {
-                            return c.issue_reads();
+                            return c.run_phases();
                         }).then([&c] {
                             return c.print_stats();
                         });
-                    }).or_terminate();
+                    }).then([&ctx, conformance_mode] {
+                        return ctx.map_reduce0(std::mem_fn(&context::conformant), true, std::logical_and<bool>());
+                    }).then([conformance_mode] (bool conformant) {
+                        if (conformance_mode && !conformant) {
+                            std::cout << "FAIL: share conformance violated\n";
+                            return 1;
+                        }
+                        return 0;
+                    });
                 });
             });
         });
@@ -25,6 +25,9 @@
 #include "http/file_handler.hh"
 #include "apps/httpd/demo.json.hh"
 #include "http/api_docs.hh"
+#include "http/instrumentation_handler.hh"
+#include "http/benchmark_handlers.hh"
+#include "core/cpu_profiler.hh"
 
 namespace bpo = boost::program_options;
 
@@ -47,8 +50,37 @@ void set_routes(routes& r) {
     function_handler* h2 = new function_handler([](std::unique_ptr<request> req) {
         return make_ready_future<json::json_return_type>("json-future");
     });
+    function_handler* prof_start = new function_handler([](std::unique_ptr<request> req) {
+        auto period = std::chrono::microseconds(100);
+        auto it = req->query_parameters.find("period_us");
+        if (it != req->query_parameters.end()) {
+            period = std::chrono::microseconds(strtoul(it->second.c_str(), nullptr, 10));
+        }
+        return cpu_profiler::start_all(period).then([] {
+            return make_ready_future<json::json_return_type>("started");
+        });
+    });
+    function_handler* prof_stop = new function_handler([](std::unique_ptr<request> req) {
+        return cpu_profiler::stop_all().then([] {
+            return make_ready_future<json::json_return_type>("stopped");
+        });
+    });
+    function_handler* prof_dump = new function_handler([](std::unique_ptr<request> req) {
+        return cpu_profiler::dump_all().then([] (sstring stacks) {
+            return make_ready_future<json::json_return_type>(std::move(stacks));
+        });
+    });
     r.add(operation_type::GET, url("/"), h1);
     r.add(operation_type::GET, url("/jf"), h2);
+    r.add(operation_type::GET, url("/profiler/start"), prof_start);
+    r.add(operation_type::GET, url("/profiler/stop"), prof_stop);
+    r.add(operation_type::GET, url("/profiler/dump"), prof_dump);
+    r.add(operation_type::GET, url("/instrumentation"), new instrumentation_handler());
+    // synthetic endpoints for benchmarking the server itself; pair
+    // them with apps/seawreck --path=/bench/...
+    r.add(operation_type::GET, url("/bench/fixed"), new fixed_reply_handler());
+    r.add(operation_type::GET, url("/bench/stream"), new streamed_reply_handler());
+    r.add(operation_type::GET, url("/bench/json"), new json_reply_handler());
     r.add(operation_type::GET, url("/file").remainder("path"),
             new directory_handler("/"));
     demo_json::hello_world.set(r, [] (const_req req) {
@@ -66,12 +98,18 @@ int main(int ac, char** av) {
     app_template app;
     app.add_options()("port", bpo::value<uint16_t>()->default_value(10000),
             "HTTP Server port");
+    app.add_options()("connection-stats", "print per-connection request counts as connections end (benchmark aid)");
     return app.run_deprecated(ac, av, [&] {
         auto&& config = app.configuration();
         uint16_t port = config["port"].as<uint16_t>();
+        bool connection_stats = config.count("connection-stats");
         auto server = new http_server_control();
         auto rb = make_shared<api_registry_builder>("apps/httpd/");
-        server->start().then([server] {
+        server->start().then([server, connection_stats] {
+            return server->server().invoke_on_all([connection_stats] (http_server& s) {
+                s.set_log_connection_stats(connection_stats);
+            });
+        }).then([server] {
             return server->set_routes(set_routes);
         }).then([server, rb]{
             return server->set_routes([rb](routes& r){rb->set_api_doc(r);});
@@ -34,6 +34,8 @@
 #include <deque>
 #include <queue>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
 #include "core/sstring.hh"
 #include "core/posix.hh"
 #include "core/reactor.hh"
@@ -75,9 +77,12 @@ struct test_file {
 struct run_stats {
     uint64_t IOPS;
     uint64_t concurrency;
-    run_stats(uint64_t iops = 0, uint64_t conc = 0) : IOPS(iops), concurrency(conc) {}
+    uint64_t latency_us;
+    run_stats(uint64_t iops = 0, uint64_t conc = 0, uint64_t lat = 0) : IOPS(iops), concurrency(conc), latency_us(lat) {}
     run_stats& operator+=(const struct run_stats& stats) {
         if (stats.concurrency != 0) {
+            // Average latency, weighted by how many readers contributed to each side.
+            latency_us = (latency_us * concurrency + stats.latency_us * stats.concurrency) / (concurrency + stats.concurrency);
             IOPS += stats.IOPS;
             concurrency += stats.concurrency;
         }
@@ -85,6 +90,15 @@ struct run_stats {
     }
 };
 
+// One measured point of the device's throughput/latency curve, as recorded
+// in the configuration file so later runs can re-verify it cheaply.
+struct curve_point {
+    uint64_t request_size;
+    uint64_t concurrency;
+    uint64_t IOPS;
+    uint64_t latency_us;
+};
+
 class iotune_manager {
 public:
     enum class test_done { no, yes };
@@ -185,7 +199,10 @@ private:
     // We will now scan a region that is around the desired percentile, and we will run this
     // for the longest. Somewhere in that region, has to lie a concurrency level that puts us
     // at the desired percentile.
-    enum class test_phase { find_max_region, find_max_point, find_percentile };
+    // Verify-only runs measure a fixed list of concurrency points and do no
+    // searching at all; they exist so a previously written configuration can
+    // be re-checked in seconds instead of re-tuned in minutes.
+    enum class test_phase { find_max_region, find_max_point, find_percentile, verify_only };
     test_phase _current_test_phase = test_phase::find_max_region;
 
     // We have to have a zero-point here, otherwise the search may fail if the disk
@@ -196,6 +213,10 @@ private:
     // concurrency.
     std::map<uint64_t, uint64_t> _all_results = { {0ul, 0ul} };
 
+    // Full measurements (IOPS and latency) per concurrency point, kept
+    // alongside _all_results so the whole curve can be written out.
+    std::map<uint64_t, run_stats> _curve;
+
     template <typename Iterator>
     void refill_concurrency_queue(Iterator begin, Iterator end) {
         unsigned first = (*begin).first;
@@ -258,6 +279,10 @@ private:
     }
 
     void find_next_concurrency(const run_stats& result) {
+        if (_current_test_phase == test_phase::verify_only) {
+            // Just drain the requested points; no searching.
+            return;
+        }
         bool should_run_more = (clock::now() < _maximum_end_time);
         if (!should_run_more && _current_test_phase == test_phase::find_max_region) {
             throw iotune_timeout_exception("IOTune timed out before the end of first disk scan. Can't provide a meaningful result - Aborting");
@@ -317,7 +342,8 @@ private:
         }
     }
 public:
-    iotune_manager(size_t n, sstring dirname, std::chrono::seconds timeout)
+    iotune_manager(size_t n, sstring dirname, std::chrono::seconds timeout,
+                   std::vector<unsigned> verify_points = {}, uint64_t fsize = 10ull << 30)
         : _start_run_barrier(n)
         , _finish_run_barrier(n)
         , _results_barrier(n)
@@ -326,11 +352,19 @@ public:
         , _run_start_time(iotune_manager::clock::now())
         , _maximum_end_time(_run_start_time + timeout)
     {
+        file_size = fsize;
         _test_file.generate(*this, (timeout * 4) / 10);
 
-        // Initial exploratory run
-        for (auto initial: boost::irange<unsigned, unsigned>(4, 512, 4)) {
-            _concurrency_queue.push(initial);
+        if (!verify_points.empty()) {
+            _current_test_phase = test_phase::verify_only;
+            for (auto p : verify_points) {
+                _concurrency_queue.push(p);
+            }
+        } else {
+            // Initial exploratory run
+            for (auto initial: boost::irange<unsigned, unsigned>(4, 512, 4)) {
+                _concurrency_queue.push(initial);
+            }
         }
     }
     template <typename Func>
@@ -380,6 +414,7 @@ public:
         if (cpu_id == 0) {
             struct run_stats result = current_result(cpu_id);
             _all_results[result.concurrency] = result.IOPS;
+            _curve[result.concurrency] = result;
             find_next_concurrency(result);
             // Still empty, nothing else to do.
             if (_concurrency_queue.empty()) {
@@ -394,10 +429,22 @@ public:
         return _test_done;
     }
 
-    uint32_t finish_estimate() {
+    void join_threads() {
         for (auto&& t: _threads) {
             t.join();
         }
+    }
+
+    std::vector<curve_point> curve() const {
+        std::vector<curve_point> ret;
+        for (auto& p : _curve) {
+            ret.push_back({ rbuffer_size, p.first, p.second.IOPS, p.second.latency_us });
+        }
+        return ret;
+    }
+
+    uint32_t finish_estimate() {
+        join_threads();
 
         if (_best_critical_concurrency == 0) {
             std::cerr << "============= Cut here ===============" << std::endl;
@@ -444,6 +491,7 @@ class reader {
     iotune_manager::clock::time_point _start_time;
     iotune_manager::clock::time_point _tstamp;
     iotune_manager::clock::time_point _end_time;
+    std::chrono::microseconds _latency_sum{0};
     std::unique_ptr<char[], free_deleter> _buf;
 public:
     reader(file_desc f, uint64_t file_size, iotune_manager::clock::time_point start_time, iotune_manager::clock::time_point end_time)
@@ -466,6 +514,7 @@ public:
         auto now = std::chrono::steady_clock::now();
         if ((now > _start_time) && (now < _end_time)) {
             ++_opcount;
+            _latency_sum += std::chrono::duration_cast<std::chrono::microseconds>(now - _tstamp);
         }
 
         if (now < _end_time) {
@@ -477,7 +526,8 @@ public:
 
     struct run_stats get_stats() {
         float IOPS = _opcount / std::chrono::duration_cast<std::chrono::duration<double>>(_end_time - _start_time).count();
-        return { uint64_t(IOPS), 1 };
+        uint64_t latency = _opcount ? _latency_sum.count() / _opcount : 0;
+        return { uint64_t(IOPS), 1, latency };
     }
 };
 
@@ -636,9 +686,7 @@ void test_file::generate(iotune_manager& iotune_manager, std::chrono::seconds ti
               << " seconds" << std::endl;
 }
 
-uint32_t io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono::seconds timeout) {
-    iotune_manager iotune_manager(cpus.size(), dir, timeout);
-
+static void spawn_workers(iotune_manager& iotune_manager, std::vector<unsigned>& cpus) {
     for (auto i = 0ul; i < cpus.size(); ++i) {
         iotune_manager.spawn_new([&cpus, &iotune_manager, id = i] {
             pin_this_thread(cpus[id]);
@@ -648,16 +696,72 @@ uint32_t io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono
             } while (iotune_manager.analyze_results(id) == iotune_manager::test_done::no);
         });
     }
+}
+
+struct discovery_result {
+    uint32_t max_io_requests;
+    std::vector<curve_point> curve;
+};
 
-    return iotune_manager.finish_estimate();
+discovery_result io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono::seconds timeout) {
+    iotune_manager iotune_manager(cpus.size(), dir, timeout);
+    spawn_workers(iotune_manager, cpus);
+    auto max_io_requests = iotune_manager.finish_estimate();
+    return { max_io_requests, iotune_manager.curve() };
 }
 
-int write_configuration_file(std::string conf_file, std::string format, unsigned max_io_requests, std::experimental::optional<unsigned> num_io_queues = {}) {
-    std::cout << "Recommended --max-io-requests: " << max_io_requests << std::endl;
-    if (num_io_queues) {
-        std::cout << "Recommended --num-io-queues: " << *num_io_queues << std::endl;
+// Cheap re-check of an existing configuration: re-measure a couple of the
+// recorded curve points against a small file and see whether the device
+// still behaves like it did when it was tuned.  Takes seconds, so fleets
+// can run it on every boot and only pay for a full tuning run when the
+// numbers actually went stale.
+bool configuration_still_valid(sstring dir, std::vector<unsigned> cpus, unsigned max_io_requests, const std::vector<curve_point>& curve) {
+    auto relevant = std::vector<curve_point>{};
+    std::copy_if(curve.begin(), curve.end(), std::back_inserter(relevant), [] (const curve_point& p) {
+        return p.request_size == iotune_manager::rbuffer_size;
+    });
+    if (relevant.empty()) {
+        return false;
+    }
+    // Check the peak of the curve and the point closest to the concurrency
+    // the recommendation was derived from.
+    auto best = std::max_element(relevant.begin(), relevant.end(), [] (const curve_point& a, const curve_point& b) {
+        return a.IOPS < b.IOPS;
+    });
+    uint64_t critical = std::max<uint64_t>(max_io_requests / 3, 1);
+    auto closest = std::min_element(relevant.begin(), relevant.end(), [critical] (const curve_point& a, const curve_point& b) {
+        return std::abs(int64_t(a.concurrency - critical)) < std::abs(int64_t(b.concurrency - critical));
+    });
+    std::vector<unsigned> points = { unsigned(best->concurrency) };
+    if (closest->concurrency != best->concurrency) {
+        points.push_back(closest->concurrency);
+    }
+
+    iotune_manager iotune_manager(cpus.size(), dir, std::chrono::seconds(30), points, 1ull << 30);
+    spawn_workers(iotune_manager, cpus);
+    iotune_manager.join_threads();
+
+    auto measured = iotune_manager.curve();
+    for (auto p : points) {
+        auto is_point = [p] (const curve_point& c) { return c.concurrency == p; };
+        auto rec = std::find_if(relevant.begin(), relevant.end(), is_point);
+        auto meas = std::find_if(measured.begin(), measured.end(), is_point);
+        if (meas == measured.end()) {
+            return false;
+        }
+        // Allow generous slack: the verification file is much smaller than
+        // the tuning file, and we only want to catch real changes (different
+        // device, degraded media, changed RAID geometry), not noise.
+        if (meas->IOPS < (rec->IOPS * 2) / 3 || meas->IOPS > (rec->IOPS * 3) / 2) {
+            std::cout << "Concurrency " << p << ": measured " << meas->IOPS
+                      << " IOPS, recorded " << rec->IOPS << " IOPS" << std::endl;
+            return false;
+        }
     }
+    return true;
+}
 
+static boost::filesystem::path expand_conf_path(std::string conf_file) {
     wordexp_t k;
     // Do tilde expansion if needed, but since we get the directory from the user, it
     // can be anything. So just rely on posix for that.
@@ -665,6 +769,54 @@ int write_configuration_file(std::string conf_file, std::string format, unsigned
     assert(k.we_wordc == 1);
     boost::filesystem::path conf_path(k.we_wordv[0]);
     wordfree(&k);
+    return conf_path;
+}
+
+// A previously written configuration file, read back for --verify.
+struct previous_configuration {
+    unsigned max_io_requests = 0;
+    std::vector<curve_point> curve;
+};
+
+std::experimental::optional<previous_configuration> read_configuration_file(std::string conf_file) {
+    auto conf_path = expand_conf_path(conf_file);
+    std::ifstream ifs(conf_path.string());
+    if (!ifs) {
+        return {};
+    }
+    previous_configuration prev;
+    std::string line;
+    static const std::string curve_prefix = "# iotune-curve: ";
+    static const std::string requests_key = "max-io-requests=";
+    while (std::getline(ifs, line)) {
+        if (line.compare(0, curve_prefix.size(), curve_prefix) == 0) {
+            curve_point p;
+            std::istringstream is(line.substr(curve_prefix.size()));
+            if (is >> p.request_size >> p.concurrency >> p.IOPS >> p.latency_us) {
+                prev.curve.push_back(p);
+            }
+        } else {
+            // Covers both formats: "max-io-requests=N" and
+            // "SEASTAR_IO=\"--max-io-requests=N ...\"".
+            auto pos = line.find(requests_key);
+            if (pos != std::string::npos) {
+                prev.max_io_requests = std::atoi(line.c_str() + pos + requests_key.size());
+            }
+        }
+    }
+    if (prev.max_io_requests == 0) {
+        return {};
+    }
+    return prev;
+}
+
+int write_configuration_file(std::string conf_file, std::string format, unsigned max_io_requests, std::experimental::optional<unsigned> num_io_queues = {}, const std::vector<curve_point>& curve = {}) {
+    std::cout << "Recommended --max-io-requests: " << max_io_requests << std::endl;
+    if (num_io_queues) {
+        std::cout << "Recommended --num-io-queues: " << *num_io_queues << std::endl;
+    }
+
+    auto conf_path = expand_conf_path(conf_file);
 
     auto error_msg = " when writing configuration file. Please add them to your seastar command line";
     try {
@@ -673,6 +825,15 @@ int write_configuration_file(std::string conf_file, std::string format, unsigned
         ofs_io.exceptions(std::ofstream::failbit | std::ofstream::badbit);
         ofs_io.open(conf_path.string(), std::ofstream::trunc);
         if (ofs_io) {
+            // The measured curve rides along as comments, so the file stays
+            // loadable as-is while iotune --verify can read the points back.
+            if (!curve.empty()) {
+                ofs_io << "# iotune-curve format: <request-size> <concurrency> <IOPS> <latency-us>" << std::endl;
+                for (auto& p : curve) {
+                    ofs_io << "# iotune-curve: " << p.request_size << " " << p.concurrency
+                           << " " << p.IOPS << " " << p.latency_us << std::endl;
+                }
+            }
             if (format == "seastar") {
                 ofs_io << "max-io-requests=" << max_io_requests << std::endl;
                 if (num_io_queues) {
@@ -701,6 +862,7 @@ int write_configuration_file(std::string conf_file, std::string format, unsigned
 int main(int ac, char** av) {
     namespace bpo = boost::program_options;
     bool fs_check = false;
+    bool verify = false;
 
     bpo::options_description desc("Parameters for evaluation. This is intended to be ran with parameters that will match the desired use.");
     desc.add_options()
@@ -711,6 +873,7 @@ int main(int ac, char** av) {
         ("format", bpo::value<sstring>()->default_value("seastar"), "Configuration file format (seastar | envfile)")
         ("timeout", bpo::value<uint64_t>()->default_value(60 * 6), "Maximum time to wait for iotune to finish (seconds)")
         ("fs-check", bpo::bool_switch(&fs_check), "perform FS check only")
+        ("verify", bpo::bool_switch(&verify), "quickly re-check the existing configuration against the device, and only run the full tuning if it no longer matches")
     ;
 
     bpo::variables_map configuration;
@@ -757,8 +920,26 @@ int main(int ac, char** av) {
     }
     auto timeout = std::chrono::seconds(configuration["timeout"].as<uint64_t>());
 
+    if (verify) {
+        auto prev = read_configuration_file(conf_file);
+        if (!prev) {
+            std::cout << "No previous configuration with a curve found at " << conf_file << "; running full tuning." << std::endl;
+        } else {
+            try {
+                if (configuration_still_valid(directory, cpuvec, prev->max_io_requests, prev->curve)) {
+                    std::cout << "Existing configuration at " << conf_file << " still matches the device; not re-tuning." << std::endl;
+                    return 0;
+                }
+                std::cout << "Existing configuration no longer matches the device; re-tuning." << std::endl;
+            } catch (iotune_timeout_exception& e) {
+                std::cout << "Verification timed out (" << e.what() << "); re-tuning." << std::endl;
+            }
+        }
+    }
+
     try {
-        auto iodepth = io_queue_discovery(directory, cpuvec, timeout);
+        auto discovered = io_queue_discovery(directory, cpuvec, timeout);
+        auto iodepth = discovered.max_io_requests;
         auto num_io_queues = cpuvec.size();
         if (iodepth / num_io_queues < 4) {
             num_io_queues = iodepth / 4;
@@ -766,9 +947,9 @@ int main(int ac, char** av) {
 
         if (num_io_queues != cpuvec.size()) {
             iodepth = (iodepth / num_io_queues) * num_io_queues;
-            return write_configuration_file(conf_file, format, iodepth, num_io_queues);
+            return write_configuration_file(conf_file, format, iodepth, num_io_queues, discovered.curve);
         } else {
-            return write_configuration_file(conf_file, format, iodepth);
+            return write_configuration_file(conf_file, format, iodepth, {}, discovered.curve);
         }
     } catch (iotune_timeout_exception &e) {
         // Otherwise we'll coredump on the exception, but this can happen
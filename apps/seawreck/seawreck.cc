@@ -26,8 +26,9 @@
 #include "core/future-util.hh"
 #include "core/distributed.hh"
 #include "core/semaphore.hh"
-#include "core/future-util.hh"
+#include "core/sleep.hh"
 #include <chrono>
+#include <deque>
 
 template <typename... Args>
 void http_debug(const char* fmt, Args&&... args) {
@@ -36,25 +37,151 @@ void http_debug(const char* fmt, Args&&... args) {
 #endif
 }
 
+/**
+ * An hdr-style latency histogram: power-of-two buckets, each split
+ * into 32 linear sub-buckets, so values are recorded with ~3%
+ * resolution in constant time and percentiles come out of a single
+ * pass. Copyable, so per-core histograms merge with map_reduce.
+ */
+class latency_histogram {
+    static constexpr unsigned precision_bits = 5;
+    static constexpr unsigned nr_buckets = 32 << precision_bits;
+    std::vector<uint64_t> _buckets = std::vector<uint64_t>(nr_buckets);
+    uint64_t _count = 0;
+    uint64_t _max = 0;
+public:
+    void record(uint64_t usec) {
+        _buckets[index_of(usec)]++;
+        _count++;
+        _max = std::max(_max, usec);
+    }
+    uint64_t count() const {
+        return _count;
+    }
+    uint64_t max() const {
+        return _max;
+    }
+    void merge(const latency_histogram& other) {
+        for (unsigned i = 0; i < nr_buckets; i++) {
+            _buckets[i] += other._buckets[i];
+        }
+        _count += other._count;
+        _max = std::max(_max, other._max);
+    }
+    uint64_t percentile(double p) const {
+        if (!_count) {
+            return 0;
+        }
+        auto target = std::max<uint64_t>(1, uint64_t(_count * p / 100.0 + 0.5));
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < nr_buckets; i++) {
+            seen += _buckets[i];
+            if (seen >= target) {
+                return value_of(i);
+            }
+        }
+        return _max;
+    }
+private:
+    static unsigned index_of(uint64_t v) {
+        if (v < (1u << precision_bits)) {
+            return v;
+        }
+        unsigned msb = 63 - __builtin_clzll(v);
+        unsigned shift = msb - precision_bits;
+        auto index = ((shift + 1) << precision_bits)
+                | ((v >> shift) & ((1 << precision_bits) - 1));
+        return std::min<unsigned>(index, nr_buckets - 1);
+    }
+    static uint64_t value_of(unsigned index) {
+        if (index < (1u << precision_bits)) {
+            return index;
+        }
+        unsigned shift = (index >> precision_bits) - 1;
+        uint64_t base = (1u << precision_bits) | (index & ((1 << precision_bits) - 1));
+        return base << shift;
+    }
+};
+
 class http_client {
 private:
     unsigned _duration;
     unsigned _conn_per_core;
     unsigned _reqs_per_conn;
+    unsigned _depth;
+    unsigned _churn;
     std::vector<connected_socket> _sockets;
+    ipv4_addr _server_addr;
     semaphore _conn_connected{0};
     semaphore _conn_finished{0};
     timer<> _run_timer;
     bool _timer_based;
     bool _timer_done{false};
     uint64_t _total_reqs{0};
+    uint64_t _reqs_sent{0};
+    // open-loop pacing: when a rate is set every request has an
+    // intended send time on a fixed schedule, shared by all the
+    // core's connections
+    std::chrono::nanoseconds _period;
+    steady_clock_type::time_point _next_schedule;
+    latency_histogram _latencies;
+    // the serialized request, built once; --path selects the URL, so
+    // the httpd /bench/* endpoints can be driven directly
+    sstring _request;
 public:
-    http_client(unsigned duration, unsigned total_conn, unsigned reqs_per_conn)
+    http_client(unsigned duration, unsigned total_conn, unsigned reqs_per_conn,
+            unsigned rate, unsigned depth, unsigned churn, sstring server, sstring path)
         : _duration(duration)
         , _conn_per_core(total_conn / smp::count)
         , _reqs_per_conn(reqs_per_conn)
+        , _depth(depth)
+        , _churn(churn)
         , _run_timer([this] { _timer_done = true; })
-        , _timer_based(reqs_per_conn == 0) {
+        , _timer_based(reqs_per_conn == 0)
+        , _period(rate ? std::chrono::nanoseconds(
+                uint64_t(1000000000) * smp::count / rate) : std::chrono::nanoseconds(0))
+        , _request("GET " + path + " HTTP/1.1\r\nHost: " + server + "\r\n\r\n") {
+    }
+
+    /**
+     * Claims the next request to send: accounts it and hands back its
+     * intended send time - the schedule slot under paced load, now
+     * otherwise. An empty optional means the test is over.
+     */
+    std::experimental::optional<steady_clock_type::time_point> claim_request() {
+        if (done_sending()) {
+            return std::experimental::nullopt;
+        }
+        _reqs_sent++;
+        if (_period.count()) {
+            auto t = _next_schedule;
+            _next_schedule += _period;
+            return t;
+        }
+        return steady_clock_type::now();
+    }
+
+    bool done_sending() const {
+        if (_timer_based) {
+            return _timer_done;
+        }
+        return _reqs_sent >= uint64_t(_reqs_per_conn) * _conn_per_core;
+    }
+
+    unsigned depth() const {
+        return _depth;
+    }
+
+    unsigned churn() const {
+        return _churn;
+    }
+
+    const sstring& request() const {
+        return _request;
+    }
+
+    latency_histogram& latencies() {
+        return _latencies;
     }
 
     class connection {
@@ -65,46 +192,122 @@ public:
         http_response_parser _parser;
         http_client* _http_client;
         uint64_t _nr_done{0};
+        uint64_t _session_sent{0};
+        // in-flight requests, bounded by the pipeline depth
+        semaphore _pipeline;
+        semaphore _inflight{0};
+        // intended send times of in-flight requests; responses come
+        // back in order, so the front is always the oldest. Measuring
+        // from the intended time rather than the actual write keeps
+        // the numbers honest when the sender falls behind the
+        // schedule (coordinated omission).
+        std::deque<steady_clock_type::time_point> _scheduled;
+        bool _writer_done{false};
     public:
         connection(connected_socket&& fd, http_client* client)
             : _fd(std::move(fd))
             , _read_buf(_fd.input())
             , _write_buf(_fd.output())
-            , _http_client(client){
+            , _http_client(client)
+            , _pipeline(client->depth()) {
         }
 
         uint64_t nr_done() {
             return _nr_done;
         }
 
-        future<> do_req() {
-            return _write_buf.write("GET / HTTP/1.1\r\nHost: 127.0.0.1:10000\r\n\r\n").then([this] {
-                return _write_buf.flush();
-            }).then([this] {
-                _parser.init();
-                return _read_buf.consume(_parser).then([this] {
-                    // Read HTTP response header first
-                    if (_parser.eof()) {
-                        return make_ready_future<>();
-                    }
-                    auto _rsp = _parser.get_parsed_response();
-                    auto it = _rsp->_headers.find("Content-Length");
-                    if (it == _rsp->_headers.end()) {
-                        print("Error: HTTP response does not contain: Content-Length\n");
+        future<> process() {
+            return when_all(writer(), reader()).then(
+                    [] (std::tuple<future<>, future<>> joined) {
+                auto& w = std::get<0>(joined);
+                auto& r = std::get<1>(joined);
+                if (r.failed()) {
+                    w.ignore_ready_future();
+                    return std::move(r);
+                }
+                return std::move(w);
+            }).finally([this] {
+                return _write_buf.close();
+            }).finally([this] {
+                return _read_buf.close();
+            });
+        }
+    private:
+        bool session_over() {
+            return _http_client->churn()
+                    && _session_sent >= _http_client->churn();
+        }
+
+        future<> writer() {
+            return repeat([this] {
+                if (session_over()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                auto scheduled = _http_client->claim_request();
+                if (!scheduled) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                _session_sent++;
+                auto now = steady_clock_type::now();
+                auto pause = *scheduled > now
+                        ? sleep(*scheduled - now) : make_ready_future<>();
+                return pause.then([this] {
+                    return _pipeline.wait(1);
+                }).then([this, scheduled] {
+                    _scheduled.push_back(*scheduled);
+                    _inflight.signal();
+                    return _write_buf.write(_http_client->request());
+                }).then([this] {
+                    return _write_buf.flush();
+                }).then([] {
+                    return stop_iteration::no;
+                });
+            }).finally([this] {
+                _writer_done = true;
+                // one extra signal so the reader wakes up and notices
+                _inflight.signal();
+            });
+        }
+
+        future<> reader() {
+            return do_until([this] { return _writer_done && _scheduled.empty(); },
+                    [this] {
+                return _inflight.wait(1).then([this] {
+                    if (_scheduled.empty()) {
                         return make_ready_future<>();
                     }
-                    auto content_len = std::stoi(it->second);
-                    http_debug("Content-Length = %d\n", content_len);
-                    // Read HTTP response body
-                    return _read_buf.read_exactly(content_len).then([this] (temporary_buffer<char> buf) {
-                        _nr_done++;
-                        http_debug("%s\n", buf.get());
-                        if (_http_client->done(_nr_done)) {
-                            return make_ready_future();
-                        } else {
-                            return do_req();
-                        }
-                    });
+                    return read_one();
+                });
+            }).handle_exception([this] (std::exception_ptr ex) {
+                // unblock a writer stuck waiting for pipeline room
+                _pipeline.broken();
+                return make_exception_future<>(std::move(ex));
+            });
+        }
+
+        future<> read_one() {
+            _parser.init();
+            return _read_buf.consume(_parser).then([this] {
+                // Read HTTP response header first
+                if (_parser.eof()) {
+                    throw std::runtime_error("server closed connection");
+                }
+                auto _rsp = _parser.get_parsed_response();
+                auto it = _rsp->_headers.find("Content-Length");
+                if (it == _rsp->_headers.end()) {
+                    throw std::runtime_error("HTTP response does not contain: Content-Length");
+                }
+                auto content_len = std::stoi(it->second);
+                http_debug("Content-Length = %d\n", content_len);
+                // Read HTTP response body
+                return _read_buf.read_exactly(content_len).then([this] (temporary_buffer<char> buf) {
+                    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                            steady_clock_type::now() - _scheduled.front()).count();
+                    _scheduled.pop_front();
+                    _http_client->latencies().record(usec);
+                    _nr_done++;
+                    http_debug("%s\n", buf.get());
+                    _pipeline.signal();
                 });
             });
         }
@@ -115,15 +318,12 @@ public:
         return make_ready_future<uint64_t>(_total_reqs);
     }
 
-    bool done(uint64_t nr_done) {
-        if (_timer_based) {
-            return _timer_done;
-        } else {
-            return nr_done >= _reqs_per_conn;
-        }
+    future<latency_histogram> latency_histo() {
+        return make_ready_future<latency_histogram>(_latencies);
     }
 
     future<> connect(ipv4_addr server_addr) {
+        _server_addr = server_addr;
         // Establish all the TCP connections first
         for (unsigned i = 0; i < _conn_per_core; i++) {
             engine().net().connect(make_ipv4_address(server_addr)).then([this] (connected_socket fd) {
@@ -135,24 +335,40 @@ public:
         return _conn_connected.wait(_conn_per_core);
     }
 
+    // One connection slot: runs a connection until its session is
+    // over (churn) or the test ends, reconnecting as needed
+    future<> run_slot(connected_socket fd) {
+        auto conn = new connection(std::move(fd), this);
+        return conn->process().then_wrapped([this, conn] (auto&& f) {
+            _total_reqs += conn->nr_done();
+            delete conn;
+            try {
+                f.get();
+            } catch (std::exception& ex) {
+                print("http request error: %s\n", ex.what());
+            }
+        }).then([this] {
+            if (done_sending()) {
+                return make_ready_future<>();
+            }
+            return engine().net().connect(make_ipv4_address(_server_addr)).then(
+                    [this] (connected_socket fd) {
+                return run_slot(std::move(fd));
+            });
+        });
+    }
+
     future<> run() {
         // All connected, start HTTP request
         http_debug("Established all %6d tcp connections on cpu %3d\n", _conn_per_core, engine().cpu_id());
         if (_timer_based) {
             _run_timer.arm(std::chrono::seconds(_duration));
         }
+        _next_schedule = steady_clock_type::now();
         for (auto&& fd : _sockets) {
-            auto conn = new connection(std::move(fd), this);
-            conn->do_req().then_wrapped([this, conn] (auto&& f) {
+            run_slot(std::move(fd)).then([this] {
                 http_debug("Finished connection %6d on cpu %3d\n", _conn_finished.current(), engine().cpu_id());
-                _total_reqs += conn->nr_done();
                 _conn_finished.signal();
-                delete conn;
-                try {
-                    f.get();
-                } catch (std::exception& ex) {
-                    print("http request error: %s\n", ex.what());
-                }
             });
         }
 
@@ -164,6 +380,27 @@ public:
     }
 };
 
+// Implements @Reducer concept, merging per-core histograms
+class histogram_merger {
+    latency_histogram _result;
+public:
+    future<> operator()(const latency_histogram& h) {
+        _result.merge(h);
+        return make_ready_future<>();
+    }
+    latency_histogram get() && {
+        return std::move(_result);
+    }
+};
+
+static void print_percentiles(const latency_histogram& h) {
+    print("Latency (usec), %ld samples:\n", h.count());
+    for (auto p : { 50.0, 90.0, 95.0, 99.0, 99.9, 99.99 }) {
+        print("  %7.2f%%  %10ld\n", p, h.percentile(p));
+    }
+    print("  max       %10ld\n", h.max());
+}
+
 namespace bpo = boost::program_options;
 
 int main(int ac, char** av) {
@@ -172,6 +409,10 @@ int main(int ac, char** av) {
         ("server,s", bpo::value<std::string>()->default_value("192.168.66.100:10000"), "Server address")
         ("conn,c", bpo::value<unsigned>()->default_value(100), "total connections")
         ("reqs,r", bpo::value<unsigned>()->default_value(0), "reqs per connection")
+        ("rate", bpo::value<unsigned>()->default_value(0), "total requests/sec, open-loop with fixed schedule (0: as fast as possible)")
+        ("depth", bpo::value<unsigned>()->default_value(1), "pipeline depth: max in-flight requests per connection")
+        ("churn", bpo::value<unsigned>()->default_value(0), "reconnect a connection after this many requests (0: keep-alive forever)")
+        ("path", bpo::value<std::string>()->default_value("/"), "URL path to request; httpd's synthetic endpoints are /bench/fixed?size=N, /bench/stream?size=N&chunk=N and /bench/json")
         ("duration,d", bpo::value<unsigned>()->default_value(10), "duration of the test in seconds)");
 
     return app.run(ac, av, [&app] () -> future<int> {
@@ -179,12 +420,20 @@ int main(int ac, char** av) {
         auto server = config["server"].as<std::string>();
         auto reqs_per_conn = config["reqs"].as<unsigned>();
         auto total_conn= config["conn"].as<unsigned>();
+        auto rate = config["rate"].as<unsigned>();
+        auto depth = config["depth"].as<unsigned>();
+        auto churn = config["churn"].as<unsigned>();
+        auto path = config["path"].as<std::string>();
         auto duration = config["duration"].as<unsigned>();
 
         if (total_conn % smp::count != 0) {
             print("Error: conn needs to be n * cpu_nr\n");
             return make_ready_future<int>(-1);
         }
+        if (depth == 0) {
+            print("Error: depth needs to be at least 1\n");
+            return make_ready_future<int>(-1);
+        }
 
         auto http_clients = new distributed<http_client>;
 
@@ -192,9 +441,18 @@ int main(int ac, char** av) {
         auto started = steady_clock_type::now();
         print("========== http_client ============\n");
         print("Server: %s\n", server);
+        print("Path: %s\n", path);
         print("Connections: %u\n", total_conn);
         print("Requests/connection: %s\n", reqs_per_conn == 0 ? "dynamic (timer based)" : std::to_string(reqs_per_conn));
-        return http_clients->start(std::move(duration), std::move(total_conn), std::move(reqs_per_conn)).then([http_clients, started, server] {
+        if (rate) {
+            print("Rate: %u requests/sec (open loop)\n", rate);
+        }
+        print("Pipeline depth: %u\n", depth);
+        if (churn) {
+            print("Connection churn: every %u requests\n", churn);
+        }
+        return http_clients->start(std::move(duration), std::move(total_conn), std::move(reqs_per_conn),
+                std::move(rate), std::move(depth), std::move(churn), sstring(server), sstring(path)).then([http_clients, started, server] {
             return http_clients->invoke_on_all(&http_client::connect, ipv4_addr{server});
         }).then([http_clients] {
             return http_clients->invoke_on_all(&http_client::run);
@@ -209,6 +467,9 @@ int main(int ac, char** av) {
            print("Total requests: %u\n", total_reqs);
            print("Total time: %f\n", secs);
            print("Requests/sec: %f\n", static_cast<double>(total_reqs) / secs);
+           return http_clients->map_reduce(histogram_merger(), &http_client::latency_histo);
+        }).then([http_clients] (latency_histogram histo) {
+           print_percentiles(histo);
            print("==========     done     ============\n");
            return http_clients->stop().then([http_clients] {
                // FIXME: If we call engine().exit(0) here to exit when
@@ -187,6 +187,8 @@ tests = [
     'tests/memcached/test_ascii_parser',
     'tests/tcp_sctp_server',
     'tests/tcp_sctp_client',
+    'tests/netperf_server',
+    'tests/netperf_client',
     'tests/allocator_test',
     'tests/output_stream_test',
     'tests/udp_zero_copy',
@@ -194,16 +196,32 @@ tests = [
     'tests/slab_test',
     'tests/fstream_test',
     'tests/distributed_test',
+    'tests/pipeline_test',
     'tests/rpc',
     'tests/semaphore_test',
     'tests/packet_test',
     'tests/tls_test',
     'tests/fair_queue_test',
     'tests/rpc_test',
+    'tests/rpc_perf',
     'tests/connect_test',
     'tests/chunked_fifo_test',
+    'tests/circular_buffer_test',
+    'tests/mpsc_queue_test',
+    'tests/arena_test',
+    'tests/flat_hash_map_test',
     'tests/scollectd_test',
+    'tests/byteorder_test',
+    'tests/timer_wheel_test',
+    'tests/small_vector_test',
+    'tests/bitops_test',
+    'tests/histogram_test',
+    'tests/tracing_test',
+    'tests/flow_metrics_test',
+    'tests/instrumentation_test',
     'tests/perf/perf_fstream',
+    'tests/perf/perf_packed_hooks',
+    'tests/perf/perf_tests',
     ]
 
 apps = [
@@ -245,6 +263,7 @@ arg_parser.add_argument('--tests-debuginfo', action='store', dest='tests_debugin
 arg_parser.add_argument('--static-stdc++', dest = 'staticcxx', action = 'store_true',
                         help = 'Link libgcc and libstdc++ statically')
 add_tristate(arg_parser, name = 'hwloc', dest = 'hwloc', help = 'hwloc support')
+add_tristate(arg_parser, name = 'uring', dest = 'uring', help = 'io_uring reactor backend (--reactor-backend=io_uring)')
 add_tristate(arg_parser, name = 'xen', dest = 'xen', help = 'Xen support')
 args = arg_parser.parse_args()
 
@@ -265,6 +284,10 @@ libnet = [
 
 core = [
     'core/reactor.cc',
+    'core/cpu_profiler.cc',
+    'core/instrumentation.cc',
+    'core/perf_counters.cc',
+    'core/tracing.cc',
     'core/systemwide_memory_barrier.cc',
     'core/fstream.cc',
     'core/posix.cc',
@@ -278,10 +301,12 @@ core = [
     'util/log.cc',
     'net/packet.cc',
     'net/posix-stack.cc',
+    'net/flow_metrics.cc',
     'net/net.cc',
     'net/stack.cc',
     'rpc/rpc.cc',
     'rpc/lz4_compressor.cc',
+    'rpc/zstd_compressor.cc',
     ]
 
 protobuf = [
@@ -302,6 +327,7 @@ http = ['http/transformers.cc',
         'http/matcher.cc',
         'http/mime_types.cc',
         'http/httpd.cc',
+        'http/websocket.cc',
         'http/reply.cc',
         'http/request_parser.rl',
         'http/api_docs.cc',
@@ -313,7 +339,7 @@ boost_test_lib = [
 ]
 
 defines = ['FMT_HEADER_ONLY']
-libs = '-laio -lboost_program_options -lboost_system -lboost_filesystem -lstdc++ -lm -lboost_unit_test_framework -lboost_thread -lcryptopp -lrt -lgnutls -lgnutlsxx -llz4 -lprotobuf -ldl'
+libs = '-laio -lboost_program_options -lboost_system -lboost_filesystem -lstdc++ -lm -lboost_unit_test_framework -lboost_thread -lcryptopp -lrt -lgnutls -lgnutlsxx -llz4 -lzstd -lprotobuf -lz -ldl'
 hwloc_libs = '-lhwloc -lnuma -lpciaccess -lxml2 -lz'
 xen_used = False
 def have_xen():
@@ -378,6 +404,8 @@ deps = {
     'tests/udp_client': ['tests/udp_client.cc'] + core + libnet,
     'tests/tcp_sctp_server': ['tests/tcp_sctp_server.cc'] + core + libnet,
     'tests/tcp_sctp_client': ['tests/tcp_sctp_client.cc'] + core + libnet,
+    'tests/netperf_server': ['tests/netperf_server.cc'] + core + libnet,
+    'tests/netperf_client': ['tests/netperf_client.cc'] + core + libnet,
     'tests/tls_test': ['tests/tls_test.cc'] + core + libnet + boost_test_lib,
     'tests/fair_queue_test': ['tests/fair_queue_test.cc'] + core + boost_test_lib,
     'apps/seawreck/seawreck': ['apps/seawreck/seawreck.cc', 'http/http_response_parser.rl'] + core + libnet,
@@ -393,13 +421,30 @@ deps = {
     'tests/slab_test': ['tests/slab_test.cc'] + core,
     'tests/fstream_test': ['tests/fstream_test.cc'] + core + boost_test_lib,
     'tests/distributed_test': ['tests/distributed_test.cc'] + core,
+    'tests/pipeline_test': ['tests/pipeline_test.cc'] + core,
     'tests/rpc': ['tests/rpc.cc'] + core + libnet,
     'tests/rpc_test': ['tests/rpc_test.cc'] + core + libnet + boost_test_lib,
+    'tests/rpc_perf': ['tests/rpc_perf.cc'] + core + libnet,
     'tests/packet_test': ['tests/packet_test.cc'] + core + libnet,
     'tests/connect_test': ['tests/connect_test.cc'] + core + libnet + boost_test_lib,
     'tests/chunked_fifo_test': ['tests/chunked_fifo_test.cc'] + core,
+    'tests/circular_buffer_test': ['tests/circular_buffer_test.cc'] + core,
+    'tests/mpsc_queue_test': ['tests/mpsc_queue_test.cc'] + core,
+    'tests/arena_test': ['tests/arena_test.cc'] + core,
+    'tests/flat_hash_map_test': ['tests/flat_hash_map_test.cc'] + core,
     'tests/scollectd_test': ['tests/scollectd_test.cc'] + core + boost_test_lib,
+    'tests/byteorder_test': ['tests/byteorder_test.cc'] + core,
+    'tests/timer_wheel_test': ['tests/timer_wheel_test.cc'] + core,
+    'tests/small_vector_test': ['tests/small_vector_test.cc'] + core,
+    'tests/bitops_test': ['tests/bitops_test.cc'] + core,
+    'tests/histogram_test': ['tests/histogram_test.cc'] + core,
+    'tests/tracing_test': ['tests/tracing_test.cc'] + core,
+    'tests/flow_metrics_test': ['tests/flow_metrics_test.cc'] + core,
+    'tests/instrumentation_test': ['tests/instrumentation_test.cc'] + core,
     'tests/perf/perf_fstream': ['tests/perf/perf_fstream.cc'] + core,
+    'tests/perf/perf_packed_hooks': ['tests/perf/perf_packed_hooks.cc'] + core,
+    'tests/perf/perf_tests': ['tests/perf/perf_tests.cc', 'tests/perf/perf_future.cc',
+                              'tests/perf/perf_smp.cc', 'tests/perf/perf_memory.cc'] + core,
 }
 
 warnings = [
@@ -530,6 +575,19 @@ if apply_tristate(args.hwloc, test = have_hwloc,
     defines.append('HAVE_HWLOC')
     defines.append('HAVE_NUMA')
 
+def have_uring():
+    source  = '#include <linux/io_uring.h>\n'
+    source += '#include <sys/syscall.h>\n'
+    # we translate iocbs directly to IORING_OP_READ/IORING_OP_WRITE, so
+    # require headers recent enough to know about them (linux 5.6)
+    source += 'long x = __NR_io_uring_setup + __NR_io_uring_enter + IORING_OP_READ;'
+    return try_compile(compiler = args.cxx, source = source)
+
+if apply_tristate(args.uring, test = have_uring,
+                  note = 'Note: kernel headers have no io_uring support.  No io_uring backend.',
+                  missing = 'Error: kernel headers have no io_uring support.'):
+    defines.append('HAVE_URING')
+
 if args.so:
     args.pie = '-shared'
     args.fpie = '-fpic'
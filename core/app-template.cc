@@ -25,6 +25,7 @@
 #include "core/print.hh"
 #include <boost/program_options.hpp>
 #include <boost/make_shared.hpp>
+#include <chrono>
 #include <fstream>
 #include <cstdlib>
 
@@ -86,6 +87,7 @@ app_template::run_deprecated(int ac, char ** av, std::function<void ()>&& func)
 #ifdef DEBUG
     print("WARNING: debug mode. Not for benchmarking or production\n");
 #endif
+    auto run_started = std::chrono::steady_clock::now();
     bpo::variables_map configuration;
     try {
         bpo::store(bpo::command_line_parser(ac, av)
@@ -116,7 +118,11 @@ app_template::run_deprecated(int ac, char ** av, std::function<void ()>&& func)
     configuration.emplace("argv0", boost::program_options::variable_value(std::string(av[0]), false));
     smp::configure(configuration);
     _configuration = {std::move(configuration)};
-    engine().when_started().then([this] {
+    engine().when_started().then([this, run_started] {
+        if (this->configuration().count("startup-timings")) {
+            print("startup: reactor ready %10.3f ms after app_template::run\n",
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - run_started).count());
+        }
         scollectd::configure( this->configuration());
     }).then(
         std::move(func)
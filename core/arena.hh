@@ -0,0 +1,159 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB Ltd.
+ */
+
+#pragma once
+
+#include "align.hh"
+#include "memory.hh"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+// An arena (region) allocator for objects that are allocated piecemeal
+// and freed together, such as the temporary objects built up while
+// serving a single request.
+//
+// Allocation is a bump of a pointer within the current chunk; chunks are
+// multi-page spans obtained from the regular allocator, so with the
+// seastar allocator enabled they come straight off the cpu_pages span
+// lists.  Individual objects are never freed - reset() recycles the
+// whole arena in O(chunks), keeping the most recent chunk mapped so a
+// steady-state request pays no allocator calls at all.  Objects with
+// non-trivial destructors must be destroyed by the caller before
+// reset(); the arena only reclaims memory.
+//
+// arena_allocator<T> adapts an arena to the std allocator interface, so
+// std containers can live on the arena on the hot path; deallocation
+// through the adapter is a no-op.
+class arena {
+    struct chunk {
+        chunk* next;
+        size_t size;  // total allocation size, including this header
+    };
+    // Four pages: comfortably past the largest small-pool object, so
+    // every chunk is a span from the page allocator, yet small enough
+    // that a mostly-idle arena wastes little.
+    static constexpr size_t chunk_size = 4 * memory::page_size;
+    chunk* _chunks = nullptr;  // newest first
+    char* _pos = nullptr;
+    char* _end = nullptr;
+public:
+    arena() = default;
+    arena(const arena&) = delete;
+    arena(arena&& x) noexcept
+            : _chunks(std::exchange(x._chunks, nullptr))
+            , _pos(std::exchange(x._pos, nullptr))
+            , _end(std::exchange(x._end, nullptr)) {
+    }
+    arena& operator=(const arena&) = delete;
+    arena& operator=(arena&& x) noexcept {
+        if (this != &x) {
+            free_chunks(_chunks);
+            _chunks = std::exchange(x._chunks, nullptr);
+            _pos = std::exchange(x._pos, nullptr);
+            _end = std::exchange(x._end, nullptr);
+        }
+        return *this;
+    }
+    ~arena() {
+        free_chunks(_chunks);
+    }
+
+    // Allocates size bytes aligned to align.  Never returns nullptr;
+    // throws std::bad_alloc on exhaustion like the rest of the system.
+    void* alloc(size_t size, size_t align = alignof(std::max_align_t)) {
+        auto p = align_up(_pos, align);
+        if (p + size <= _end) {
+            _pos = p + size;
+            return p;
+        }
+        return alloc_new_chunk(size, align);
+    }
+
+    // Frees everything allocated from the arena in O(chunks), keeping
+    // the newest chunk for reuse.
+    void reset() {
+        if (!_chunks) {
+            return;
+        }
+        free_chunks(std::exchange(_chunks->next, nullptr));
+        _pos = reinterpret_cast<char*>(_chunks) + sizeof(chunk);
+        _end = reinterpret_cast<char*>(_chunks) + _chunks->size;
+    }
+private:
+    void* alloc_new_chunk(size_t size, size_t align) {
+        auto bytes = align_up(sizeof(chunk) + align + size, chunk_size);
+        auto c = static_cast<chunk*>(::operator new(bytes));
+        c->next = _chunks;
+        c->size = bytes;
+        _chunks = c;
+        _pos = reinterpret_cast<char*>(c) + sizeof(chunk);
+        _end = reinterpret_cast<char*>(c) + bytes;
+        auto p = align_up(_pos, align);
+        _pos = p + size;
+        return p;
+    }
+    static void free_chunks(chunk* c) {
+        while (c) {
+            auto n = c->next;
+            ::operator delete(c, c->size);
+            c = n;
+        }
+    }
+};
+
+// std-compatible allocator drawing from an arena.  The arena must
+// outlive all containers using it; deallocate() is a no-op, memory is
+// reclaimed by arena::reset().
+template <typename T>
+class arena_allocator {
+    arena* _arena;
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit arena_allocator(arena& a) : _arena(&a) {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& x) : _arena(x.backing_arena()) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(_arena->alloc(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T*, size_t) {
+        // bulk-freed by arena::reset()
+    }
+    arena* backing_arena() const { return _arena; }
+};
+
+template <typename T, typename U>
+inline
+bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) {
+    return a.backing_arena() == b.backing_arena();
+}
+
+template <typename T, typename U>
+inline
+bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) {
+    return !(a == b);
+}
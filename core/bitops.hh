@@ -22,6 +22,9 @@
 #ifndef BITOPS_HH_
 #define BITOPS_HH_
 
+#include <cstddef>
+#include <cstdint>
+
 inline
 constexpr unsigned count_leading_zeros(unsigned x) {
     return __builtin_clz(x);
@@ -52,4 +55,86 @@ constexpr unsigned count_trailing_zeros(unsigned long long x) {
     return __builtin_ctzll(x);
 }
 
+inline
+constexpr unsigned count_set_bits(unsigned x) {
+    return __builtin_popcount(x);
+}
+
+inline
+constexpr unsigned count_set_bits(unsigned long x) {
+    return __builtin_popcountl(x);
+}
+
+inline
+constexpr unsigned count_set_bits(unsigned long long x) {
+    return __builtin_popcountll(x);
+}
+
+// Multi-word bitmap scans, for free-list occupancy masks and page
+// bitmaps.  Bit i of the bitmap is bit (i % 64) of word (i / 64).
+
+// Returns the index of the first set bit at or after \c from, or
+// \c nbits if there is none.
+inline
+size_t bitmap_find_first_set(const uint64_t* bitmap, size_t nbits, size_t from = 0) {
+    if (from >= nbits) {
+        return nbits;
+    }
+    auto word = from / 64;
+    auto nr_words = (nbits + 63) / 64;
+    auto cur = bitmap[word] & (~uint64_t(0) << (from % 64));
+    while (!cur) {
+        if (++word == nr_words) {
+            return nbits;
+        }
+        cur = bitmap[word];
+    }
+    auto bit = word * 64 + count_trailing_zeros(cur);
+    return bit < nbits ? bit : nbits;
+}
+
+// Returns the index of the first clear bit at or after \c from, or
+// \c nbits if there is none.
+inline
+size_t bitmap_find_first_clear(const uint64_t* bitmap, size_t nbits, size_t from = 0) {
+    if (from >= nbits) {
+        return nbits;
+    }
+    auto word = from / 64;
+    auto nr_words = (nbits + 63) / 64;
+    auto cur = ~bitmap[word] & (~uint64_t(0) << (from % 64));
+    while (!cur) {
+        if (++word == nr_words) {
+            return nbits;
+        }
+        cur = ~bitmap[word];
+    }
+    auto bit = word * 64 + count_trailing_zeros(cur);
+    return bit < nbits ? bit : nbits;
+}
+
+// Returns the number of set bits in [\c from, \c to).
+inline
+size_t bitmap_count_set(const uint64_t* bitmap, size_t from, size_t to) {
+    size_t count = 0;
+    auto word = from / 64;
+    auto last_word = to / 64;
+    auto first_mask = ~uint64_t(0) << (from % 64);
+    auto last_mask = (to % 64) ? ~(~uint64_t(0) << (to % 64)) : uint64_t(0);
+    if (from >= to) {
+        return 0;
+    }
+    if (word == last_word) {
+        return count_set_bits(bitmap[word] & first_mask & last_mask);
+    }
+    count += count_set_bits(bitmap[word] & first_mask);
+    for (++word; word < last_word; ++word) {
+        count += count_set_bits(bitmap[word]);
+    }
+    if (last_mask) {
+        count += count_set_bits(bitmap[last_word] & last_mask);
+    }
+    return count;
+}
+
 #endif /* BITOPS_HH_ */
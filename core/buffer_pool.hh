@@ -0,0 +1,124 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB Ltd.
+ */
+
+#pragma once
+
+#include "deleter.hh"
+#include <malloc.h>
+#include <cstddef>
+#include <new>
+
+/// \cond internal
+
+// A per-shard pool of recycled buffers for the sizes the I/O paths
+// allocate constantly (one temporary_buffer per socket read, one per
+// dma-aligned disk read).  Buffers of a pooled size are handed out with
+// a deleter that returns them to the pool rather than freeing, so a
+// steady stream of reads recycles the same few buffers instead of
+// exercising the allocator's span machinery on every packet.
+//
+// All buffers are allocated 4096-aligned, so a pooled buffer also
+// satisfies any dma-style alignment request up to that.  Each size
+// class keeps at most max_free buffers (~4.75M per shard, all classes
+// full); beyond that, buffers are freed normally.
+namespace buffer_pool {
+
+static constexpr size_t buffer_alignment = 4096;
+static constexpr size_t buffer_sizes[] = { 4096, 8192, 65536 };
+static constexpr unsigned nr_classes = 3;
+static constexpr unsigned max_free = 64;
+
+struct free_buffer {
+    free_buffer* next;
+};
+
+struct size_class {
+    free_buffer* free = nullptr;
+    unsigned nr_free = 0;
+    ~size_class() {
+        while (free) {
+            auto n = free->next;
+            std::free(free);
+            free = n;
+        }
+    }
+};
+
+inline size_class* classes() {
+    static thread_local size_class c[nr_classes];
+    return c;
+}
+
+inline int class_of(size_t size, size_t alignment) {
+    if (alignment > buffer_alignment) {
+        return -1;
+    }
+    for (unsigned i = 0; i < nr_classes; ++i) {
+        if (size == buffer_sizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+inline void put(unsigned idx, void* buf) {
+    auto& c = classes()[idx];
+    if (c.nr_free >= max_free) {
+        std::free(buf);
+        return;
+    }
+    auto f = reinterpret_cast<free_buffer*>(buf);
+    f->next = c.free;
+    c.free = f;
+    ++c.nr_free;
+}
+
+struct allocation {
+    char* buf = nullptr;
+    deleter del;
+};
+
+// Returns a pooled buffer of exactly \c size bytes aligned to \c
+// alignment, or { nullptr, {} } if the size/alignment combination is
+// not pooled and the caller should allocate normally.
+inline allocation try_allocate(size_t size, size_t alignment = 1) {
+    auto idx = class_of(size, alignment);
+    if (idx < 0) {
+        return {};
+    }
+    auto& c = classes()[idx];
+    void* buf;
+    if (c.free) {
+        buf = c.free;
+        c.free = c.free->next;
+        --c.nr_free;
+    } else {
+        if (::posix_memalign(&buf, buffer_alignment, size) != 0) {
+            throw std::bad_alloc();
+        }
+    }
+    return { static_cast<char*>(buf),
+             make_deleter([buf, idx] { put(idx, buf); }) };
+}
+
+}
+
+/// \endcond
@@ -71,6 +71,125 @@ inline T le_to_cpu(const unaligned<T>& v) {
     return le_to_cpu(T(v));
 }
 
+// Batch conversion helpers.
+//
+// The *_inplace() forms take any number of fields and convert each in
+// place, so a frame decoder can list every header field in one call:
+//
+//     be_to_cpu_inplace(hdr.magic, hdr.version, hdr.len, hdr.crc);
+//
+// The generic cpu_to_be(x)/be_to_cpu(x) overloads accept any struct
+// exposing adjust_endianness(), the same protocol net::ntoh()/hton()
+// use, so a frame type enumerates its members once:
+//
+//     struct frame {
+//         uint32_t magic;
+//         uint16_t version;
+//         uint64_t len;
+//         template <typename Adjuster>
+//         void adjust_endianness(Adjuster a) { a(magic, version, len); }
+//     };
+//
+// The array forms convert n same-sized fields with a loop the
+// compiler's vectorizer turns into byte shuffles.
+
+inline void cpu_to_le_inplace() {}
+inline void le_to_cpu_inplace() {}
+inline void cpu_to_be_inplace() {}
+inline void be_to_cpu_inplace() {}
+
+template <typename First, typename... Rest>
+inline
+void cpu_to_le_inplace(First& first, Rest&... rest) {
+    first = cpu_to_le(first);
+    cpu_to_le_inplace(rest...);
+}
+
+template <typename First, typename... Rest>
+inline
+void le_to_cpu_inplace(First& first, Rest&... rest) {
+    first = le_to_cpu(first);
+    le_to_cpu_inplace(rest...);
+}
+
+template <typename First, typename... Rest>
+inline
+void cpu_to_be_inplace(First& first, Rest&... rest) {
+    first = cpu_to_be(first);
+    cpu_to_be_inplace(rest...);
+}
+
+template <typename First, typename... Rest>
+inline
+void be_to_cpu_inplace(First& first, Rest&... rest) {
+    first = be_to_cpu(first);
+    be_to_cpu_inplace(rest...);
+}
+
+template <typename T>
+inline
+T cpu_to_le(const T& x) {
+    T tmp = x;
+    tmp.adjust_endianness([] (auto&... what) { cpu_to_le_inplace(what...); });
+    return tmp;
+}
+
+template <typename T>
+inline
+T le_to_cpu(const T& x) {
+    T tmp = x;
+    tmp.adjust_endianness([] (auto&... what) { le_to_cpu_inplace(what...); });
+    return tmp;
+}
+
+template <typename T>
+inline
+T cpu_to_be(const T& x) {
+    T tmp = x;
+    tmp.adjust_endianness([] (auto&... what) { cpu_to_be_inplace(what...); });
+    return tmp;
+}
+
+template <typename T>
+inline
+T be_to_cpu(const T& x) {
+    T tmp = x;
+    tmp.adjust_endianness([] (auto&... what) { be_to_cpu_inplace(what...); });
+    return tmp;
+}
+
+template <typename T>
+inline
+void cpu_to_le(T* p, size_t n) {
+    for (size_t i = 0; i != n; i++) {
+        p[i] = cpu_to_le(p[i]);
+    }
+}
+
+template <typename T>
+inline
+void le_to_cpu(T* p, size_t n) {
+    for (size_t i = 0; i != n; i++) {
+        p[i] = le_to_cpu(p[i]);
+    }
+}
+
+template <typename T>
+inline
+void cpu_to_be(T* p, size_t n) {
+    for (size_t i = 0; i != n; i++) {
+        p[i] = cpu_to_be(p[i]);
+    }
+}
+
+template <typename T>
+inline
+void be_to_cpu(T* p, size_t n) {
+    for (size_t i = 0; i != n; i++) {
+        p[i] = be_to_cpu(p[i]);
+    }
+}
+
 template <typename T>
 inline
 T
@@ -58,10 +58,12 @@
 //
 // Unlike std::deque<> or circular_buffer<>, chunked_fifo only provides the
 // operations needed by std::queue, i.e.,: empty(), size(), front(), back(),
-// push_back() and pop_front(). For simplicity, we do *not* implement other
-// possible operations, like inserting or deleting elements from the "wrong"
-// side of the queue or from the middle, nor random-access to items in the
-// middle of the queue or iteration over the items without popping them.
+// push_back() and pop_front(), plus forward iteration and two bulk
+// operations - push_back(first, last) and consume() - which amortize the
+// chunk bookkeeping over whole chunks instead of paying it per item.
+// For simplicity, we do *not* implement other possible operations, like
+// inserting or deleting elements from the "wrong" side of the queue or
+// from the middle, nor random-access to items in the middle of the queue.
 //
 // Another feature of chunked_fifo which std::deque is missing is the ability
 // to control the chunk size, as a template parameter. In std::deque the
@@ -77,6 +79,8 @@
 
 #include <memory>
 #include <algorithm>
+#include <iterator>
+#include <limits>
 
 template <typename T, size_t items_per_chunk = 128>
 class chunked_fifo {
@@ -117,6 +121,61 @@ public:
     using pointer = T*;
     using const_reference = const T&;
     using const_pointer = const T*;
+private:
+    template <typename U>
+    class basic_iterator {
+        friend class chunked_fifo;
+        template <typename V>
+        friend class basic_iterator;
+        chunk* _chunk = nullptr;
+        // unmasked index of the item within _chunk; the occupied region
+        // [begin, end) may wrap within the chunk
+        size_t _item_index = 0;
+        explicit basic_iterator(chunk* c)
+                : _chunk(c), _item_index(c ? c->begin : 0) {}
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = ssize_t;
+        using value_type = U;
+        using pointer = U*;
+        using reference = U&;
+    public:
+        basic_iterator() = default;
+        // a non-const iterator converts to a const one
+        operator basic_iterator<const U>() const {
+            auto i = basic_iterator<const U>(_chunk);
+            i._item_index = _item_index;
+            return i;
+        }
+        bool operator==(const basic_iterator& x) const {
+            return _chunk == x._chunk && _item_index == x._item_index;
+        }
+        bool operator!=(const basic_iterator& x) const {
+            return !operator==(x);
+        }
+        reference operator*() const {
+            return _chunk->items[_item_index & (items_per_chunk - 1)];
+        }
+        pointer operator->() const {
+            return &operator*();
+        }
+        basic_iterator& operator++() {
+            ++_item_index;
+            if (_item_index == _chunk->end) {
+                _chunk = _chunk->next;
+                _item_index = _chunk ? _chunk->begin : 0;
+            }
+            return *this;
+        }
+        basic_iterator operator++(int) {
+            auto it = *this;
+            ++(*this);
+            return it;
+        }
+    };
+public:
+    using iterator = basic_iterator<T>;
+    using const_iterator = basic_iterator<const T>;
 public:
     chunked_fifo() = default;
     chunked_fifo(chunked_fifo&& x) noexcept;
@@ -126,6 +185,24 @@ public:
     chunked_fifo& operator=(chunked_fifo&&) noexcept;
     inline void push_back(const T& data);
     inline void push_back(T&& data);
+    // Appends a whole range; chunk bookkeeping is done once per chunk
+    // instead of once per item.
+    template <typename InputIterator>
+    void push_back(InputIterator first, InputIterator last);
+    // Pops up to max_items items, passing each to func as an rvalue, and
+    // returns the number consumed. The items are visited in place, chunk
+    // by chunk, without the per-item front()/pop_front() bookkeeping.
+    // If func throws, the item it was called with stays in the queue in
+    // a moved-from state and the exception propagates.
+    template <typename Function>
+    size_t consume(Function&& func,
+            size_t max_items = std::numeric_limits<size_t>::max());
+    iterator begin() { return iterator(_front_chunk); }
+    iterator end() { return iterator(nullptr); }
+    const_iterator begin() const { return const_iterator(_front_chunk); }
+    const_iterator end() const { return const_iterator(nullptr); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
     T& back();
     const T& back() const;
     template <typename... A>
@@ -373,6 +450,50 @@ chunked_fifo<T, items_per_chunk>::push_back(T&& data) {
     ++_back_chunk->end;
 }
 
+template <typename T, size_t items_per_chunk>
+template <typename InputIterator>
+void
+chunked_fifo<T, items_per_chunk>::push_back(InputIterator first, InputIterator last) {
+    while (first != last) {
+        ensure_room_back();
+        auto& back = *_back_chunk;
+        auto room = items_per_chunk - (back.end - back.begin);
+        while (room && first != last) {
+            auto p = &back.items[mask(back.end)];
+            try {
+                new(p) T(*first);
+            } catch(...) {
+                undo_room_back();
+                throw;
+            }
+            ++back.end;
+            ++first;
+            --room;
+        }
+    }
+}
+
+template <typename T, size_t items_per_chunk>
+template <typename Function>
+size_t
+chunked_fifo<T, items_per_chunk>::consume(Function&& func, size_t max_items) {
+    size_t done = 0;
+    while (_front_chunk && done < max_items) {
+        auto& front = *_front_chunk;
+        while (front.begin != front.end && done < max_items) {
+            auto& item = front.items[mask(front.begin)];
+            func(std::move(item));
+            item.~T();
+            ++front.begin;
+            ++done;
+        }
+        if (front.begin == front.end) {
+            front_chunk_delete();
+        }
+    }
+    return done;
+}
+
 template <typename T, size_t items_per_chunk>
 inline
 T&
@@ -35,6 +35,7 @@
 #include "transfer.hh"
 #include <memory>
 #include <algorithm>
+#include <utility>
 
 template <typename T, typename Alloc = std::allocator<T>>
 class circular_buffer {
@@ -70,6 +71,24 @@ public:
     void emplace_back(A&&... args);
     T& front();
     T& back();
+    // A contiguous range of raw element slots, for bulk fills.
+    struct span {
+        T* data;
+        size_t size;
+    };
+    // Reserves room for n more elements at the back and returns the
+    // first contiguous span of raw slots, sized min(n, slots until the
+    // storage wraps).  The caller constructs elements there in order
+    // (memcpy for trivial T) and publishes them with commit_back();
+    // for the full n slots in one call, see reserve_back_spans().
+    span reserve_back(size_t n);
+    // Like reserve_back(), but returns both contiguous spans covering
+    // all n slots; the second span is empty unless the storage wraps.
+    std::pair<span, span> reserve_back_spans(size_t n);
+    // Makes n elements constructed in reserve_back() spans part of the
+    // buffer.  Constructing fewer elements than reserved and committing
+    // just those is fine; the remaining slots simply stay free.
+    void commit_back(size_t n);
     void pop_front();
     void pop_back();
     bool empty() const;
@@ -216,7 +235,12 @@ inline
 void
 circular_buffer<T, Alloc>::reserve(size_t size) {
     if (capacity() < size) {
-        expand(size);
+        // mask() requires power-of-two capacities
+        auto new_cap = std::max<size_t>(capacity() * 2, 1);
+        while (new_cap < size) {
+            new_cap *= 2;
+        }
+        expand(new_cap);
     }
 }
 
@@ -353,6 +377,32 @@ circular_buffer<T, Alloc>::emplace_back(Args&&... args) {
     ++_impl.end;
 }
 
+template <typename T, typename Alloc>
+inline
+typename circular_buffer<T, Alloc>::span
+circular_buffer<T, Alloc>::reserve_back(size_t n) {
+    reserve(size() + n);
+    auto e = mask(_impl.end);
+    return { _impl.storage + e, std::min(n, _impl.capacity - e) };
+}
+
+template <typename T, typename Alloc>
+inline
+std::pair<typename circular_buffer<T, Alloc>::span, typename circular_buffer<T, Alloc>::span>
+circular_buffer<T, Alloc>::reserve_back_spans(size_t n) {
+    reserve(size() + n);
+    auto e = mask(_impl.end);
+    auto first = std::min(n, _impl.capacity - e);
+    return { { _impl.storage + e, first }, { _impl.storage, n - first } };
+}
+
+template <typename T, typename Alloc>
+inline
+void
+circular_buffer<T, Alloc>::commit_back(size_t n) {
+    _impl.end += n;
+}
+
 template <typename T, typename Alloc>
 inline
 T&
@@ -0,0 +1,142 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB.
+ */
+
+#pragma once
+
+/// \file
+/// Opt-in coroutine (co_await/co_return) support for future<>.
+///
+/// A coroutine returning future<T...> replaces a chain of .then()
+/// continuations with a single frame allocation: each .then() in a long
+/// chain heap-allocates a continuation capturing its state, while a
+/// coroutine keeps all of it in one frame and suspends in place.  The
+/// two styles interoperate freely - a coroutine can co_await any
+/// future, and its result is an ordinary future that can be chained
+/// with .then().
+///
+/// Requires compiler support (clang -fcoroutines-ts or gcc
+/// -fcoroutines); including this header without it is an error, so
+/// regular builds are unaffected.
+
+#if !defined(__cpp_impl_coroutine) && !defined(__cpp_coroutines)
+#error "coroutine.hh requires compiler support for coroutines (-fcoroutines or -fcoroutines-ts)"
+#endif
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define SEASTAR_COROUTINE_NAMESPACE std
+#elif __has_include(<experimental/coroutine>)
+#include <experimental/coroutine>
+#define SEASTAR_COROUTINE_NAMESPACE std::experimental
+#else
+#error "coroutine.hh could not find <coroutine> or <experimental/coroutine>"
+#endif
+
+#include "future.hh"
+#include "preempt.hh"
+
+namespace coroutine_internal {
+
+// The promise-side glue: forwards co_return/exceptions into an ordinary
+// promise<T...>, so callers see a plain future.  initial_suspend() never
+// suspends: like .then() on a ready future, the body runs inline until
+// the first co_await on a non-ready future.
+template <typename... T>
+class coroutine_traits_base {
+public:
+    class promise_type {
+        promise<T...> _promise;
+    public:
+        future<T...> get_return_object() {
+            return _promise.get_future();
+        }
+        SEASTAR_COROUTINE_NAMESPACE::suspend_never initial_suspend() noexcept { return {}; }
+        SEASTAR_COROUTINE_NAMESPACE::suspend_never final_suspend() noexcept { return {}; }
+        template <typename U>
+        void return_value(U&& value) {
+            _promise.set_value(std::forward<U>(value));
+        }
+        void unhandled_exception() {
+            _promise.set_exception(std::current_exception());
+        }
+    };
+};
+
+template <>
+class coroutine_traits_base<> {
+public:
+    class promise_type {
+        promise<> _promise;
+    public:
+        future<> get_return_object() {
+            return _promise.get_future();
+        }
+        SEASTAR_COROUTINE_NAMESPACE::suspend_never initial_suspend() noexcept { return {}; }
+        SEASTAR_COROUTINE_NAMESPACE::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {
+            _promise.set_value();
+        }
+        void unhandled_exception() {
+            _promise.set_exception(std::current_exception());
+        }
+    };
+};
+
+// The awaiter: suspends on non-ready futures (or when the task quota
+// expired, so a loop of ready co_awaits still preempts, like .then()
+// does), and resumes the coroutine from the reactor when the value
+// arrives.  get0() in await_resume() rethrows failed futures as an
+// exception inside the coroutine.
+template <typename... T>
+class future_awaiter {
+    future<T...> _future;
+public:
+    explicit future_awaiter(future<T...>&& f) noexcept : _future(std::move(f)) {}
+    future_awaiter(future_awaiter&&) = default;
+    bool await_ready() noexcept {
+        return _future.available() && !need_preempt();
+    }
+    void await_suspend(SEASTAR_COROUTINE_NAMESPACE::coroutine_handle<> hndl) {
+        _future.then_wrapped([this, hndl] (future<T...> f) mutable {
+            _future = std::move(f);
+            hndl.resume();
+        });
+    }
+    auto await_resume() {
+        return _future.get0();
+    }
+};
+
+} // namespace coroutine_internal
+
+template <typename... T>
+coroutine_internal::future_awaiter<T...>
+operator co_await(future<T...> f) noexcept {
+    return coroutine_internal::future_awaiter<T...>(std::move(f));
+}
+
+namespace SEASTAR_COROUTINE_NAMESPACE {
+
+template <typename... T, typename... Args>
+struct coroutine_traits<future<T...>, Args...> : public coroutine_internal::coroutine_traits_base<T...> {
+};
+
+} // namespace SEASTAR_COROUTINE_NAMESPACE
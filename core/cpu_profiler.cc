@@ -0,0 +1,198 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 Cloudius Systems, Ltd.
+ */
+
+#include "cpu_profiler.hh"
+#include "reactor.hh"
+#include "future-util.hh"
+#include "print.hh"
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <map>
+#include <string>
+#include <sys/syscall.h>
+
+static int profiler_signal() {
+    // SIGRTMIN and SIGRTMIN + 1 belong to the reactor (alarm_signal() and
+    // task_quota_signal())
+    return SIGRTMIN + 2;
+}
+
+cpu_profiler&
+cpu_profiler::local() {
+    static thread_local cpu_profiler instance;
+    return instance;
+}
+
+void
+cpu_profiler::signal_handler(int signo, siginfo_t* siginfo, void* ignore) {
+    auto& p = local();
+    if (!p._running) {
+        return;
+    }
+    auto& s = p._ring[p._head];
+    // ::backtrace() is not formally async-signal-safe, but glibc's
+    // implementation allocates nothing after the first call, which
+    // start() makes from normal context to warm it up.
+    auto n = ::backtrace(s.frames, max_depth);
+    if (n <= 0) {
+        return;
+    }
+    s.depth = n;
+    p._head = (p._head + 1) % ring_size;
+    if (p._size < ring_size) {
+        ++p._size;
+    } else {
+        ++p._dropped;
+    }
+}
+
+void
+cpu_profiler::start(std::chrono::microseconds period) {
+    _ring.resize(ring_size);
+    // warm up libgcc's unwinder so the signal handler never allocates
+    void* warmup[4];
+    ::backtrace(warmup, 4);
+    struct sigaction sa = {};
+    sa.sa_sigaction = &cpu_profiler::signal_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    auto r = ::sigaction(profiler_signal(), &sa, nullptr);
+    throw_system_error_on(r == -1);
+    // the reactor blocks almost everything; unblock our signal on this
+    // thread only
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, profiler_signal());
+    r = ::pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+    throw_system_error_on(r != 0);
+    if (!_timer_created) {
+        struct sigevent sev = {};
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev._sigev_un._tid = syscall(SYS_gettid);
+        sev.sigev_signo = profiler_signal();
+        // CPU-time clock: idle shards produce no samples, so the output
+        // is a flame graph of reactor time, not wall time
+        r = timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &_timer);
+        throw_system_error_on(r == -1);
+        _timer_created = true;
+    }
+    auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+    itimerspec its;
+    its.it_value.tv_sec = nsec / 1'000'000'000;
+    its.it_value.tv_nsec = nsec % 1'000'000'000;
+    its.it_interval = its.it_value;
+    r = timer_settime(_timer, 0, &its, nullptr);
+    throw_system_error_on(r == -1);
+    _running = true;
+}
+
+void
+cpu_profiler::stop() {
+    if (!_running) {
+        return;
+    }
+    itimerspec its = {};
+    timer_settime(_timer, 0, &its, nullptr);
+    _running = false;
+}
+
+cpu_profiler::~cpu_profiler() {
+    if (_timer_created) {
+        timer_delete(_timer);
+    }
+}
+
+std::string cpu_profiler::frame_name(void* addr) {
+    Dl_info info;
+    if (::dladdr(addr, &info) && info.dli_sname) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        if (status == 0) {
+            std::string ret(demangled);
+            std::free(demangled);
+            return ret;
+        }
+        return info.dli_sname;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%p", addr);
+    return buf;
+}
+
+sstring
+cpu_profiler::dump_collapsed() {
+    // The signal handler is the only other writer and runs on this very
+    // thread, so blocking the signal makes draining race-free.
+    sigset_t mask, old;
+    sigemptyset(&mask);
+    sigaddset(&mask, profiler_signal());
+    ::pthread_sigmask(SIG_BLOCK, &mask, &old);
+    std::map<std::string, uint64_t> collapsed;
+    for (unsigned i = 0; i != _size; ++i) {
+        auto& s = _ring[(_head + ring_size - _size + i) % ring_size];
+        std::string line;
+        // backtrace() is leaf-first; flame graphs want root-first
+        for (int j = s.depth - 1; j >= 0; --j) {
+            line += frame_name(s.frames[j]);
+            if (j) {
+                line += ";";
+            }
+        }
+        ++collapsed[line];
+    }
+    _size = 0;
+    _head = 0;
+    _dropped = 0;
+    ::pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    std::string out;
+    for (auto&& e : collapsed) {
+        out += e.first;
+        out += " ";
+        out += std::to_string(e.second);
+        out += "\n";
+    }
+    return sstring(out);
+}
+
+future<>
+cpu_profiler::start_all(std::chrono::microseconds period) {
+    return smp::invoke_on_all([period] {
+        local().start(period);
+    });
+}
+
+future<>
+cpu_profiler::stop_all() {
+    return smp::invoke_on_all([] {
+        local().stop();
+    });
+}
+
+future<sstring>
+cpu_profiler::dump_all() {
+    return map_reduce(smp::all_cpus(), [] (unsigned id) {
+        return smp::submit_to(id, [] {
+            return local().dump_collapsed();
+        });
+    }, sstring(), [] (sstring a, sstring b) {
+        return a + b;
+    });
+}
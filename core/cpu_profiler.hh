@@ -0,0 +1,83 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 Cloudius Systems, Ltd.
+ */
+
+#pragma once
+
+#include "sstring.hh"
+#include "future.hh"
+#include <chrono>
+#include <vector>
+#include <signal.h>
+#include <time.h>
+
+/// \brief In-process sampling CPU profiler.
+///
+/// Each shard owns one instance (see local()).  A POSIX timer on the
+/// shard's CPU-time clock delivers a signal whose handler captures a
+/// backtrace of whatever continuation is running into a fixed-size
+/// per-shard ring buffer, so profiling a production reactor does not
+/// require attaching external tooling and does not distort tail latency
+/// the way ptrace-based tools do.
+///
+/// dump_collapsed() drains the ring into collapsed-stack text
+/// ("frame;frame;frame count" lines), which flamegraph.pl consumes
+/// directly; the *_all() variants operate on every shard and are suitable
+/// for wiring into a REST handler.
+class cpu_profiler {
+public:
+    static constexpr unsigned max_depth = 64;
+    static constexpr unsigned ring_size = 4096;
+    struct sample {
+        unsigned depth;
+        void* frames[max_depth];
+    };
+private:
+    timer_t _timer = {};
+    bool _timer_created = false;
+    bool _running = false;
+    uint64_t _dropped = 0;   // samples overwritten before being drained
+    unsigned _head = 0;      // next slot the signal handler writes
+    unsigned _size = 0;
+    std::vector<sample> _ring;
+    static void signal_handler(int signo, siginfo_t* siginfo, void* ignore);
+public:
+    ~cpu_profiler();
+    /// Starts capturing a sample every \c period of this shard's CPU time.
+    void start(std::chrono::microseconds period);
+    /// Stops sampling; already-captured samples remain drainable.
+    void stop();
+    bool running() const { return _running; }
+    /// Returns and clears the captured samples, collapsed into
+    /// "frame;frame;frame count" lines with symbolized frames.
+    sstring dump_collapsed();
+    /// Best-effort symbolization of one code address: the demangled
+    /// symbol when the dynamic linker knows it, the raw address
+    /// otherwise.  Also used by the blocked-reactor watchdog.
+    static std::string frame_name(void* addr);
+    /// Returns this shard's profiler.
+    static cpu_profiler& local();
+    /// Starts sampling on every shard.
+    static future<> start_all(std::chrono::microseconds period);
+    /// Stops sampling on every shard.
+    static future<> stop_all();
+    /// Drains every shard, returning the concatenated collapsed stacks.
+    static future<sstring> dump_all();
+};
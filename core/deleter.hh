@@ -75,6 +75,10 @@ public:
     deleter share();
     /// Checks whether the deleter has an associated action.
     explicit operator bool() const { return bool(_impl); }
+    /// Checks whether the encapsulated action is nothing more than a
+    /// plain \c std::free() of a captured pointer (or nothing at all).
+    /// Such an action is safe to carry out from any thread.
+    bool is_trivially_free() const { return !_impl || is_raw_object(); }
     /// \cond internal
     void reset(impl* i) {
         this->~deleter();
@@ -26,6 +26,7 @@
 #include "shared_ptr.hh"
 #include "print.hh"
 #include "circular_buffer.hh"
+#include "lowres_clock.hh"
 #include <queue>
 #include <type_traits>
 #include <experimental/optional>
@@ -45,6 +46,8 @@ class priority_class {
     friend class fair_queue;
     uint32_t _shares = 0;
     float _accumulated = 0;
+    std::chrono::microseconds _latency_goal{};
+    float _latency_ewma = 0; // observed queue-to-completion latency, in microseconds
     circular_buffer<request> _queue;
     bool _queued = false;
 
@@ -93,8 +96,12 @@ class fair_queue {
 
     semaphore _sem;
     unsigned _capacity;
-    using clock_type = std::chrono::steady_clock::time_point;
+    unsigned _throttled = 0;
+    // the coarse clock suffices here: tau is 100ms and latency goals
+    // are millisecond-scale, and reading it is just an atomic load
+    using clock_type = lowres_clock::time_point;
     clock_type _base;
+    clock_type _last_adjust;
     std::chrono::microseconds _tau;
     using prioq = std::priority_queue<priority_class_ptr, std::vector<priority_class_ptr>, class_compare>;
     prioq _handles;
@@ -127,14 +134,14 @@ class fair_queue {
             h->_queue.pop_front();
 
             req.pr.set_value();
-            auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+            auto delta = std::chrono::duration_cast<std::chrono::microseconds>(lowres_clock::now() - _base);
             auto req_cost  = float(req.weight) / h->_shares;
             auto cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
             float next_accumulated = h->_accumulated + cost;
             while (std::isinf(next_accumulated)) {
                 normalize_stats();
                 // If we have renormalized, our time base will have changed. This should happen very infrequently
-                delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+                delta = std::chrono::duration_cast<std::chrono::microseconds>(lowres_clock::now() - _base);
                 cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
                 next_accumulated = h->_accumulated + cost;
             }
@@ -147,6 +154,50 @@ class fair_queue {
         });
     }
 
+    void account_latency(priority_class_ptr pc, lowres_clock::duration d) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        // Exponential moving average over roughly the last 32 requests
+        pc->_latency_ewma += (us - pc->_latency_ewma) / 32;
+        maybe_adjust_throttle();
+    }
+
+    // Latency-goal admission throttling: if a class with a latency goal is
+    // missing it, requests are spending too long queued at the disk behind
+    // other classes' requests, so withhold part of our capacity to shrink the
+    // effective disk concurrency.  When all goals are comfortably met again,
+    // give the capacity back, one unit per adjustment period.
+    void maybe_adjust_throttle() {
+        auto now = lowres_clock::now();
+        if (now - _last_adjust < std::chrono::milliseconds(10)) {
+            return;
+        }
+        _last_adjust = now;
+        bool missing = false;
+        bool comfortable = true;
+        for (auto& pc : _all_classes) {
+            if (!pc->_latency_goal.count()) {
+                continue;
+            }
+            if (pc->_latency_ewma > pc->_latency_goal.count()) {
+                missing = true;
+            }
+            // Hysteresis: only relax once we're 25% below the goal, so the
+            // throttle doesn't oscillate around it.
+            if (pc->_latency_ewma > pc->_latency_goal.count() * 0.75f) {
+                comfortable = false;
+            }
+        }
+        if (missing && _capacity - _throttled > 1) {
+            ++_throttled;
+            // Park a unit of capacity; it is returned by the matching
+            // signal() when the throttle is relaxed.
+            _sem.wait();
+        } else if (!missing && comfortable && _throttled) {
+            --_throttled;
+            _sem.signal();
+        }
+    }
+
     float normalize_factor() const {
         return std::numeric_limits<float>::min();
     }
@@ -167,7 +218,8 @@ public:
     explicit fair_queue(unsigned capacity, std::chrono::microseconds tau = std::chrono::milliseconds(100))
                                            : _sem(capacity)
                                            , _capacity(capacity)
-                                           , _base(std::chrono::steady_clock::now())
+                                           , _base(lowres_clock::now())
+                                           , _last_adjust(_base)
                                            , _tau(tau) {
     }
 
@@ -193,6 +245,12 @@ public:
         return _sem.waiters();
     }
 
+    /// \return how many capacity units are currently withheld to meet
+    ///         latency goals.
+    unsigned throttled_capacity() const {
+        return _throttled;
+    }
+
     /// Executes the function \c func through this class' \ref fair_queue, with weight \c weight
     ///
     /// \return \c func's return value, if \c func returns a future, or future<T> if \c func returns a non-future of type T.
@@ -212,9 +270,11 @@ public:
             pc->_queue.pop_back();
             throw;
         }
+        auto start = lowres_clock::now();
         return fut.then([func = std::move(func)] {
             return func();
-        }).finally([this] {
+        }).finally([this, pc, start] {
+            account_latency(pc, lowres_clock::now() - start);
             _sem.signal();
         });
     }
@@ -225,5 +285,19 @@ public:
     static void update_shares(priority_class_ptr pc, uint32_t new_shares) {
         pc->_shares = new_shares;
     }
+
+    /// Sets a latency goal for this priority class.
+    ///
+    /// While the observed queue-to-completion latency of the class exceeds
+    /// the goal, the queue withholds part of its capacity, so fewer requests
+    /// from other classes sit in the disk's own FIFO queue ahead of this
+    /// class' requests.  A goal of zero (the default) disables throttling
+    /// on behalf of this class.  Latencies are measured with the coarse
+    /// clock, so sub-millisecond goals are not meaningful.
+    ///
+    /// \param goal the target queue-to-completion latency for this class
+    static void set_latency_goal(priority_class_ptr pc, std::chrono::microseconds goal) {
+        pc->_latency_goal = goal;
+    }
 };
 /// @}
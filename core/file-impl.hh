@@ -27,6 +27,9 @@
 class posix_file_impl : public file_impl {
 public:
     int _fd;
+    // The device holding the file; routes requests to that device's I/O
+    // queue when one was configured with --io-queue-mountpoint.
+    dev_t _device = 0;
     posix_file_impl(int fd, file_open_options options);
     virtual ~posix_file_impl() override;
     future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc);
@@ -34,6 +37,7 @@ public:
     future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc);
     future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc);
     future<> flush(void);
+    future<> sync_range(uint64_t pos, uint64_t len) override;
     future<struct stat> stat(void);
     future<> truncate(uint64_t length);
     future<> discard(uint64_t offset, uint64_t length);
@@ -43,6 +47,11 @@ public:
     virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override;
 private:
     void query_dma_alignment();
+    future<> do_sync();
+    // fdatasync coalescing: while a sync is in flight, concurrent flush()
+    // calls queue up here and are all resolved by the single follow-up sync.
+    bool _syncing = false;
+    std::vector<promise<>> _waiting_sync;
 };
 
 // The Linux XFS implementation is challenged wrt. append: a write that changes
@@ -30,6 +30,8 @@
 #include "core/fair_queue.hh"
 #include <experimental/optional>
 #include <system_error>
+#include <algorithm>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
@@ -113,6 +115,9 @@ public:
     virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) = 0;
     virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) = 0;
     virtual future<> flush(void) = 0;
+    // Range-limited durability; stacks without an equivalent fall back to a
+    // full flush.
+    virtual future<> sync_range(uint64_t pos, uint64_t len) { return flush(); }
     virtual future<struct stat> stat(void) = 0;
     virtual future<> truncate(uint64_t length) = 0;
     virtual future<> discard(uint64_t offset, uint64_t length) = 0;
@@ -126,6 +131,13 @@ public:
 
 /// \endcond
 
+/// A contiguous file range paired with the memory it is transferred to
+/// or from, for the vectored bulk DMA calls.
+struct dma_range {
+    uint64_t pos;   ///< on-disk offset; must be aligned to \ref file::disk_read_dma_alignment()
+    iovec iov;      ///< memory to transfer; address and length must be aligned
+};
+
 /// A data file on persistent storage.
 ///
 /// File objects represent uncached, unbuffered files.  As such great care
@@ -177,12 +189,12 @@ public:
     file& operator=(file&& x) noexcept = default;
 
     // O_DIRECT reading requires that buffer, offset, and read length, are
-    // all aligned. Alignment of 4096 was necessary in the past, but no longer
-    // is - 512 is usually enough; But we'll need to use BLKSSZGET ioctl to
-    // be sure it is really enough on this filesystem. 4096 is always safe.
-    // In addition, if we start reading in things outside page boundaries,
-    // we will end up with various pages around, some of them with
-    // overlapping ranges. Those would be very challenging to cache.
+    // all aligned.  The alignments below are discovered per file when it is
+    // opened: XFS reports them via XFS_IOC_DIOINFO, block devices via the
+    // BLKSSZGET/BLKPBSZGET ioctls (so a 512-byte-sector NVMe device permits
+    // 512-byte reads), and everything else falls back to 4096, which is
+    // always safe.  Callers should use the accessors rather than assuming
+    // 4K; make_file_input_stream() already does.
 
     /// Alignment requirement for file offsets (for reads)
     uint64_t disk_read_dma_alignment() const {
@@ -316,6 +328,41 @@ public:
         return _file_impl->write_dma(pos, std::move(iov), pc);
     }
 
+    /// Performs DMA reads of several file ranges at once.
+    ///
+    /// Ranges that are physically adjacent on disk are merged and
+    /// submitted as single, larger requests, so a random-ish set of
+    /// small reads costs fewer disk operations.  The ranges may be
+    /// passed in any order; the merged requests are issued in parallel.
+    ///
+    /// \param ranges disk ranges and the buffers to read into.  Offsets,
+    ///               addresses and lengths must be aligned, and the
+    ///               ranges must not overlap.
+    /// \param pc the IO priority class under which to queue the operations
+    ///
+    /// \return a future representing the total number of bytes actually
+    ///         read.  A short read may happen due to end-of-file or an
+    ///         I/O error.
+    future<size_t> dma_read(std::vector<dma_range> ranges, const io_priority_class& pc = default_priority_class()) {
+        return dma_transfer(std::move(ranges), pc, true);
+    }
+
+    /// Performs DMA writes to several file ranges at once.
+    ///
+    /// The write counterpart of the ranged \ref dma_read(); physically
+    /// adjacent ranges are merged into single requests.
+    ///
+    /// \param ranges disk ranges and the buffers to write from.  Offsets,
+    ///               addresses and lengths must be aligned, and the
+    ///               ranges must not overlap.
+    /// \param pc the IO priority class under which to queue the operations
+    ///
+    /// \return a future representing the total number of bytes actually
+    ///         written.  A short write may happen due to an I/O error.
+    future<size_t> dma_write(std::vector<dma_range> ranges, const io_priority_class& pc = default_priority_class()) {
+        return dma_transfer(std::move(ranges), pc, false);
+    }
+
     /// Causes any previously written data to be made stable on persistent storage.
     ///
     /// Prior to a flush, written data may or may not survive a power failure.  After
@@ -324,6 +371,19 @@ public:
         return _file_impl->flush();
     }
 
+    /// Causes previously written data in the given range to be made stable
+    /// on persistent storage.
+    ///
+    /// Unlike \ref flush(), this does not commit metadata, so it is only
+    /// safe when the file's size and block allocation are already stable —
+    /// for instance, on preallocated commitlog-style segments.
+    ///
+    /// \param pos offset of the first byte to make stable
+    /// \param len number of bytes to make stable
+    future<> sync_range(uint64_t pos, uint64_t len) {
+        return _file_impl->sync_range(pos, len);
+    }
+
     /// Returns \c stat information about the file.
     future<struct stat> stat() {
         return _file_impl->stat();
@@ -425,10 +485,72 @@ private:
     future<temporary_buffer<CharType>>
     read_maybe_eof(uint64_t pos, size_t len, const io_priority_class& pc = default_priority_class());
 
+    future<size_t> dma_transfer(std::vector<dma_range> ranges, const io_priority_class& pc, bool read) {
+        std::sort(ranges.begin(), ranges.end(), [] (const dma_range& a, const dma_range& b) {
+            return a.pos < b.pos;
+        });
+        std::vector<future<size_t>> ops;
+        size_t i = 0;
+        while (i < ranges.size()) {
+            auto pos = ranges[i].pos;
+            auto end = pos + ranges[i].iov.iov_len;
+            std::vector<iovec> iov;
+            iov.push_back(ranges[i].iov);
+            ++i;
+            while (i < ranges.size() && ranges[i].pos == end && iov.size() < IOV_MAX) {
+                end += ranges[i].iov.iov_len;
+                iov.push_back(ranges[i].iov);
+                ++i;
+            }
+            if (read) {
+                ops.push_back(_file_impl->read_dma(pos, std::move(iov), pc));
+            } else {
+                ops.push_back(_file_impl->write_dma(pos, std::move(iov), pc));
+            }
+        }
+        return when_all(ops.begin(), ops.end()).then([] (std::vector<future<size_t>> done) {
+            size_t total = 0;
+            std::exception_ptr ex;
+            for (auto& f : done) {
+                if (f.failed()) {
+                    if (!ex) {
+                        ex = f.get_exception();
+                    } else {
+                        f.ignore_ready_future();
+                    }
+                } else {
+                    total += f.get0();
+                }
+            }
+            if (ex) {
+                std::rethrow_exception(std::move(ex));
+            }
+            return total;
+        });
+    }
+
     friend class reactor;
     friend class file_impl;
 };
 
+/// \brief Recursively lists a directory tree.
+///
+/// Walks \c path and all directories below it, producing one
+/// \ref directory_entry per file found.  Entry names are paths relative
+/// to \c path (e.g. \c "sub/dir/file").  Unlike \ref file::list_directory(),
+/// several directories are scanned concurrently and entries whose type
+/// the file system does not report are stat()ed in parallel across the
+/// syscall thread pool, so walking large trees is not serialized on
+/// per-entry metadata operations.
+///
+/// Entries are produced in no particular order.  A directory entry is
+/// produced before the entries below it.
+///
+/// \param path directory to walk
+/// \param next callback to call for each entry
+/// \return a \ref subscription to the resulting entry stream
+subscription<directory_entry> walk_directory(sstring path, std::function<future<> (directory_entry de)> next);
+
 /// \cond internal
 
 template <typename CharType>
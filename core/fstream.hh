@@ -38,7 +38,7 @@
 /// Data structure describing options for opening a file input stream
 struct file_input_stream_options {
     size_t buffer_size = 8192;    ///< I/O buffer size
-    unsigned read_ahead = 0;      ///< Number of extra read-ahead operations
+    unsigned read_ahead = 0;      ///< Maximum number of extra read-ahead operations; the window grows from one request as sequential access is detected
     ::io_priority_class io_priority_class = default_priority_class();
 };
 
@@ -66,6 +66,25 @@ input_stream<char> make_file_input_stream(
 input_stream<char> make_file_input_stream(
         file file, file_input_stream_options = {});
 
+class file_desc;
+
+/// \brief Creates an input_stream over a read-only memory mapping of a file.
+///
+/// The stream's buffers are views into the mapping: reads copy no data and
+/// make no syscalls, and the mapping stays alive until the last buffer is
+/// released.  The kernel is asked to page in data ahead of the consumer
+/// with madvise().
+///
+/// Only useful for immutable files; the contents of the buffers are
+/// undefined if the file is modified while the mapping exists.  Unlike
+/// \ref make_file_input_stream(), reads go through the page cache, so this
+/// is a poor fit for data that is also written with DMA.
+///
+/// \param fd file to map; may be closed once this function returns
+/// \param offset starting offset to read from (no alignment restrictions)
+/// \param len number of bytes to read
+input_stream<char> make_mmap_input_stream(file_desc& fd, uint64_t offset, uint64_t len);
+
 struct file_output_stream_options {
     unsigned buffer_size = 8192;
     unsigned preallocation_size = 1024*1024; // 1MB
@@ -29,6 +29,7 @@
 #include "future.hh"
 #include "shared_ptr.hh"
 #include "do_with.hh"
+#include "timer.hh"
 #include <tuple>
 #include <iterator>
 #include <vector>
@@ -146,7 +147,10 @@ void do_until_continued(StopCondition&& stop_cond, AsyncAction&& action, promise
     while (!stop_cond()) {
         try {
             auto&& f = action();
-            if (!f.available()) {
+            // when preemption is requested, route even a ready future
+            // through then_wrapped(), which will schedule the
+            // continuation instead of running it inline
+            if (!f.available() || need_preempt()) {
                 f.then_wrapped([action = std::forward<AsyncAction>(action),
                     stop_cond = std::forward<StopCondition>(stop_cond), p = std::move(p)](std::result_of_t<AsyncAction()> fut) mutable {
                     if (!fut.failed()) {
@@ -321,6 +325,11 @@ future<> do_until(StopCondition&& stop_cond, AsyncAction&& action) {
 ///
 /// Calls \c action repeatedly until it returns a failed future.
 ///
+/// Iterations whose futures are already ready are executed inline, in
+/// batches, suspending only when an iteration actually blocks or the
+/// task quota expires (see \c need_preempt()), so tight loops do not
+/// pay a task allocation per iteration.
+///
 /// \param action a callable taking no arguments, returning a \c future<>
 ///        that becomes ready when you wish it to be called again.
 /// \return a future<> that will resolve to the first failure of \c action
@@ -337,7 +346,10 @@ future<> keep_doing(AsyncAction&& action) {
 /// Call a function for each item in a range, sequentially (iterator version).
 ///
 /// For each item in a range, call a function, waiting for the previous
-/// invocation to complete before calling the next one.
+/// invocation to complete before calling the next one.  Items whose
+/// futures are already ready are processed inline, in batches,
+/// yielding to the scheduler only when an invocation actually blocks
+/// or the task quota expires (see \c need_preempt()).
 ///
 /// \param begin an \c InputIterator designating the beginning of the range
 /// \param end an \c InputIterator designating the endof the range
@@ -357,7 +369,7 @@ future<> do_for_each(Iterator begin, Iterator end, AsyncAction&& action) {
         if (begin == end) {
             return f;
         }
-        if (!f.available()) {
+        if (!f.available() || need_preempt()) {
             return std::move(f).then([action = std::forward<AsyncAction>(action),
                     begin = std::move(begin), end = std::move(end)] () mutable {
                 return do_for_each(std::move(begin), std::move(end), std::forward<AsyncAction>(action));
@@ -386,6 +398,64 @@ future<> do_for_each(Container& c, AsyncAction&& action) {
     return do_for_each(std::begin(c), std::end(c), std::forward<AsyncAction>(action));
 }
 
+/// \cond internal
+template <typename Func, typename Next>
+struct fused_stages {
+    Func func;
+    Next next;
+private:
+    // a void-returning stage feeds no arguments into the next one
+    template <typename... Args>
+    auto invoke(std::false_type, Args&&... args) {
+        return next(func(std::forward<Args>(args)...));
+    }
+    template <typename... Args>
+    auto invoke(std::true_type, Args&&... args) {
+        func(std::forward<Args>(args)...);
+        return next();
+    }
+public:
+    template <typename... Args>
+    auto operator()(Args&&... args) {
+        return invoke(typename std::is_void<std::result_of_t<Func (Args&&...)>>::type(),
+                std::forward<Args>(args)...);
+    }
+};
+/// \endcond
+
+/// Fuses synchronous transformations into a single callable (and hence
+/// a single continuation).
+///
+/// Each link in a chain like .then(parse).then(validate).then(route)
+/// allocates its own continuation and re-checks readiness.  When the
+/// intermediate stages are synchronous, composing them at compile time
+/// and attaching the composite with one .then() reduces the chain to a
+/// single continuation:
+///
+///     f.then(fuse(parse, validate, route));
+///
+/// Each stage receives the previous stage's return value (stages
+/// returning \c void pass nothing on).  The last stage may be
+/// asynchronous; its return value is futurized by .then() as usual.
+///
+/// \param func the first transformation to apply
+/// \param rest the remaining transformations, applied in order
+/// \return a callable applying all transformations in sequence
+template <typename Func>
+inline
+Func
+fuse(Func func) {
+    return func;
+}
+
+template <typename Func, typename... Rest>
+inline
+auto
+fuse(Func func, Rest... rest) {
+    using next_type = decltype(fuse(std::move(rest)...));
+    return fused_stages<Func, next_type>{std::move(func), fuse(std::move(rest)...)};
+}
+
 /// \cond internal
 template<typename... Futures>
 class when_all_state : public enable_lw_shared_from_this<when_all_state<Futures...>> {
@@ -497,6 +567,134 @@ when_all(FutureIterator begin, FutureIterator end) {
     return complete_when_all(std::move(ret), ret.begin());
 }
 
+/// \cond internal
+
+// Shared state for when_all_succeed(): one counter block plus the
+// preallocated result array.  All futures complete on the owning shard,
+// so a plain counter suffices; the promise resolves exactly once, from
+// whichever completion drops the counter to zero.
+template <typename T>
+struct when_all_succeed_state {
+    std::vector<T> result;
+    size_t waiting = 0;
+    std::exception_ptr ex;
+    promise<std::vector<T>> p;
+    void reserve(size_t n) { result.reserve(n); }
+    void make_room(size_t n) { result.resize(n); }
+    void complete_one(size_t i, future<T>&& f) {
+        if (f.failed()) {
+            auto e = f.get_exception();
+            if (!ex) {
+                // we can only store one exception; later ones are
+                // consumed so their futures don't warn on destruction
+                ex = std::move(e);
+            }
+        } else {
+            result[i] = f.get0();
+        }
+    }
+    void done() {
+        if (ex) {
+            p.set_exception(std::move(ex));
+        } else {
+            p.set_value(std::move(result));
+        }
+    }
+};
+
+struct when_all_succeed_state_void {
+    size_t waiting = 0;
+    std::exception_ptr ex;
+    promise<> p;
+    void reserve(size_t) {}
+    void make_room(size_t) {}
+    void complete_one(size_t, future<>&& f) {
+        if (f.failed()) {
+            auto e = f.get_exception();
+            if (!ex) {
+                ex = std::move(e);
+            }
+        }
+    }
+    void done() {
+        if (ex) {
+            p.set_exception(std::move(ex));
+        } else {
+            p.set_value();
+        }
+    }
+};
+
+template <typename Future>
+struct when_all_succeed_state_for;
+
+template <typename T>
+struct when_all_succeed_state_for<future<T>> {
+    using type = when_all_succeed_state<T>;
+};
+
+template <>
+struct when_all_succeed_state_for<future<>> {
+    using type = when_all_succeed_state_void;
+};
+
+/// \endcond
+
+/// Wait for many futures to complete, with preallocated result storage
+/// (iterator version).
+///
+/// Like the iterator version of when_all(), but resolves directly with
+/// the values rather than with the futures, using a single shared
+/// counter block and storing each result in place in a contiguous
+/// array as its future completes, rather than chaining a continuation
+/// per future.  This makes it the cheaper choice for fan-outs of
+/// hundreds of futures.
+///
+/// If one or more futures fail, resolves with one of the exceptions;
+/// the remaining results are discarded (but all futures are waited
+/// for).  For \c future<T> inputs \c T must be default-constructible,
+/// since the result array is preallocated.
+///
+/// \param begin an \c InputIterator designating the beginning of the range of futures
+/// \param end an \c InputIterator designating the end of the range of futures
+/// \return for \c future<T> inputs, a \c future<std::vector<T>> of the
+///         values, in input order; for \c future<> inputs, a \c future<>.
+template <typename FutureIterator>
+inline
+auto
+when_all_succeed(FutureIterator begin, FutureIterator end) {
+    using itraits = std::iterator_traits<FutureIterator>;
+    using state = typename when_all_succeed_state_for<typename itraits::value_type>::type;
+    auto s = make_lw_shared<state>();
+    s->reserve(when_all_estimate_vector_capacity(begin, end, typename itraits::iterator_category()));
+    size_t i = 0;
+    while (begin != end) {
+        // invoke *begin before waiting, in case it's a function
+        // iterator, so all computation is launched in parallel
+        auto f = std::move(*begin++);
+        s->make_room(i + 1);
+        if (f.available()) {
+            s->complete_one(i, std::move(f));
+        } else {
+            ++s->waiting;
+            f.then_wrapped([s, i] (auto&& f) {
+                s->complete_one(i, std::move(f));
+                if (--s->waiting == 0) {
+                    s->done();
+                }
+            });
+        }
+        ++i;
+    }
+    // continuations cannot run before we return to the reactor, so the
+    // counter can only be zero here if every future was already ready
+    auto ret = s->p.get_future();
+    if (s->waiting == 0) {
+        s->done();
+    }
+    return ret;
+}
+
 template <typename T, bool IsFuture>
 struct reducer_with_get_traits;
 
@@ -697,6 +895,139 @@ future<> now() {
 // Returns a future which is not ready but is scheduled to resolve soon.
 future<> later();
 
+/// Exception thrown by \ref with_timeout and \ref deadline_timer when
+/// the deadline passes before the operation completes.
+class timed_out_error : public std::exception {
+public:
+    virtual const char* what() const noexcept {
+        return "timedout";
+    }
+};
+
+/// Exception factory producing \ref timed_out_error; \see with_timeout
+struct default_timeout_exception_factory {
+    static auto timeout() {
+        return timed_out_error();
+    }
+};
+
+/// \brief Wait for either a future, or a timeout, whichever comes first
+///
+/// When timeout is reached the returned future resolves with an
+/// exception produced by ExceptionFactory::timeout() (by default
+/// \ref timed_out_error).  In that case the original future is not
+/// cancelled - there is no way to abort a running computation - but
+/// its eventual result is silently ignored.
+///
+/// \param timeout time point after which the returned future should be failed
+/// \param f future to wait for
+/// \return a future which will be either resolved with f or a timeout exception
+template <typename ExceptionFactory = default_timeout_exception_factory,
+        typename Clock = steady_clock_type, typename... T>
+future<T...> with_timeout(typename Clock::time_point timeout, future<T...> f) {
+    if (f.available()) {
+        return f;
+    }
+    auto pr = std::make_unique<promise<T...>>();
+    auto result = pr->get_future();
+    timer<Clock> tmr([&pr = *pr] {
+        pr.set_exception(std::make_exception_ptr(ExceptionFactory::timeout()));
+    });
+    tmr.arm(timeout);
+    f.then_wrapped([pr = std::move(pr), tmr = std::move(tmr)] (auto&& f) mutable {
+        if (tmr.cancel()) {
+            f.forward_to(std::move(*pr));
+        } else if (f.failed()) {
+            // timed out; consume the exception so the discarded future
+            // doesn't warn
+            f.get_exception();
+        }
+    });
+    return result;
+}
+
+/// \brief One timer reused across successive timed operations.
+///
+/// \ref with_timeout() creates, arms and cancels a fresh timer per
+/// call, costing a timer wheel insertion and removal per request.  A
+/// deadline_timer instead owns a single timer for the lifetime of, say,
+/// a connection: when an operation completes the timer is left armed,
+/// and a fire for an already-completed operation either does nothing or
+/// pushes the timer out to the current operation's deadline.  Sequences
+/// of requests completing within one deadline window thus share a
+/// single timer wheel insertion.
+///
+/// Only one operation may be outstanding at a time, and the
+/// deadline_timer must outlive it.
+template <typename ExceptionFactory = default_timeout_exception_factory,
+        typename Clock = steady_clock_type>
+class deadline_timer {
+public:
+    using time_point = typename Clock::time_point;
+private:
+    struct waiter {
+        time_point deadline;
+    protected:
+        ~waiter() = default;
+    public:
+        virtual void timeout() = 0;
+    };
+    template <typename... T>
+    struct typed_waiter final : waiter {
+        promise<T...> pr;
+        virtual void timeout() override {
+            pr.set_exception(ExceptionFactory::timeout());
+        }
+    };
+    timer<Clock> _timer;
+    waiter* _waiter = nullptr;
+public:
+    deadline_timer() {
+        _timer.set_callback([this] { fire(); });
+    }
+    /// Waits for either \c f or the deadline, whichever comes first,
+    /// like \ref with_timeout(), reusing this object's timer.
+    template <typename... T>
+    future<T...> with(time_point timeout, future<T...> f) {
+        if (f.available()) {
+            return f;
+        }
+        assert(!_waiter);
+        auto st = std::make_unique<typed_waiter<T...>>();
+        st->deadline = timeout;
+        auto result = st->pr.get_future();
+        _waiter = st.get();
+        if (!_timer.armed()) {
+            _timer.arm(timeout);
+        } else if (timeout < _timer.get_timeout()) {
+            _timer.rearm(timeout);
+        } // else: armed for an earlier, stale deadline; fire() pushes it out
+        f.then_wrapped([this, st = std::move(st)] (auto&& f) mutable {
+            if (_waiter == st.get()) {
+                // completed in time; leave the timer armed, a stale
+                // fire is cheaper than a cancel and re-insert per request
+                _waiter = nullptr;
+                f.forward_to(std::move(st->pr));
+            } else if (f.failed()) {
+                f.get_exception();
+            }
+        });
+        return result;
+    }
+private:
+    void fire() {
+        if (!_waiter) {
+            return;
+        }
+        if (Clock::now() >= _waiter->deadline) {
+            _waiter->timeout();
+            _waiter = nullptr;
+        } else {
+            _timer.rearm(_waiter->deadline);
+        }
+    }
+};
+
 /// @}
 
 #endif /* CORE_FUTURE_UTIL_HH_ */
@@ -0,0 +1,104 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#ifndef CORE_HISTOGRAM_HH_
+#define CORE_HISTOGRAM_HH_
+
+#include "bitops.hh"
+#include <array>
+#include <cstdint>
+
+namespace seastar {
+
+/// A fixed-layout histogram with logarithmically spaced buckets, meant
+/// for latency-style metrics where the interesting information is in
+/// the tail, not the average.
+///
+/// Values are grouped by power of two, and each power of two is split
+/// into 2^sub_bucket_bits linear sub-buckets, so the relative error of
+/// any recorded value is below 1/2^sub_bucket_bits.  The bucket layout
+/// is a pure function of the bucket index, so a consumer can recover
+/// the bucket bounds without any per-histogram metadata.
+///
+/// An instance is meant to live on one shard and be updated only from
+/// that shard; record() is then just two increments and an add, with no
+/// atomics or locks.  Merging shard-local histograms into a node-wide
+/// view is done by the consumer with operator+=.
+class histogram {
+public:
+    static constexpr unsigned sub_bucket_bits = 2;
+    static constexpr unsigned sub_buckets = 1 << sub_bucket_bits;
+    // sub_buckets exact buckets for the smallest values, then
+    // sub_buckets linear sub-buckets per remaining power of two.
+    static constexpr unsigned n_buckets = sub_buckets + (64 - sub_bucket_bits) * sub_buckets;
+
+    void record(uint64_t value) {
+        _buckets[bucket_index(value)]++;
+        _count++;
+        _sum += value;
+    }
+
+    uint64_t count() const {
+        return _count;
+    }
+    uint64_t sum() const {
+        return _sum;
+    }
+    uint64_t bucket(unsigned idx) const {
+        return _buckets[idx];
+    }
+
+    histogram& operator+=(const histogram& h) {
+        for (unsigned i = 0; i < n_buckets; i++) {
+            _buckets[i] += h._buckets[i];
+        }
+        _count += h._count;
+        _sum += h._sum;
+        return *this;
+    }
+
+    static unsigned bucket_index(uint64_t value) {
+        if (value < sub_buckets) {
+            return value;
+        }
+        auto exp = 63 - count_leading_zeros(value);
+        return (exp - sub_bucket_bits + 1) * sub_buckets
+                + ((value >> (exp - sub_bucket_bits)) - sub_buckets);
+    }
+
+    /// Largest value mapping to bucket \c idx.
+    static uint64_t bucket_upper_bound(unsigned idx) {
+        if (idx < sub_buckets) {
+            return idx;
+        }
+        auto group = (idx - sub_buckets) / sub_buckets;
+        auto sub = (idx - sub_buckets) % sub_buckets;
+        return ((uint64_t(sub_buckets) + sub + 1) << group) - 1;
+    }
+private:
+    std::array<uint64_t, n_buckets> _buckets = {};
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+};
+
+}
+
+#endif /* CORE_HISTOGRAM_HH_ */
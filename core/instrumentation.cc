@@ -0,0 +1,93 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "instrumentation.hh"
+#include "reactor.hh"
+#include "future-util.hh"
+#include "print.hh"
+
+namespace instrumentation {
+
+registry&
+registry::local() {
+    static thread_local registry instance;
+    return instance;
+}
+
+registry::group*
+registry::find(const sstring& name) {
+    for (auto& g : _groups) {
+        if (g.name == name) {
+            return &g;
+        }
+    }
+    return nullptr;
+}
+
+void
+registry::add(sstring name, std::function<void (bool)> toggle,
+        std::function<bool ()> enabled) {
+    _groups.push_back(group{std::move(name), std::move(toggle), std::move(enabled)});
+}
+
+bool
+registry::set(const sstring& name, bool enable) {
+    auto g = find(name);
+    if (!g) {
+        return false;
+    }
+    g->toggle(enable);
+    return true;
+}
+
+sstring
+registry::list() const {
+    sstring out;
+    for (auto& g : _groups) {
+        out += sprint("shard %2d %s %s\n", engine().cpu_id(), g.name,
+                g.enabled() ? "on" : "off");
+    }
+    return out;
+}
+
+future<bool>
+registry::set_all(sstring name, bool enable) {
+    return map_reduce(smp::all_cpus(), [name, enable] (unsigned id) {
+        return smp::submit_to(id, [name, enable] {
+            return local().set(name, enable);
+        });
+    }, true, [] (bool a, bool b) {
+        return a && b;
+    });
+}
+
+future<sstring>
+registry::list_all() {
+    return map_reduce(smp::all_cpus(), [] (unsigned id) {
+        return smp::submit_to(id, [] {
+            return local().list();
+        });
+    }, sstring(), [] (sstring a, sstring b) {
+        return a + b;
+    });
+}
+
+}
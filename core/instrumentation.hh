@@ -0,0 +1,75 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "sstring.hh"
+#include "future.hh"
+#include <functional>
+#include <vector>
+
+namespace instrumentation {
+
+/// \brief Per-shard registry of named, runtime-togglable instrumentation
+/// groups.
+///
+/// Deep instrumentation (profilers, tracers, per-connection counters)
+/// is compiled in unconditionally, but each subsystem keeps its own
+/// per-shard flag on the hot path, checked with a single predictable
+/// branch, so a disabled group costs next to nothing.  This registry
+/// only names those flags and flips them: a group registers a toggle
+/// callback and an enabled query, and operators turn groups on and off
+/// at runtime -- typically through httpd::instrumentation_handler on
+/// one misbehaving node -- without restarting or redeploying.
+///
+/// The reactor registers the built-in groups during configure();
+/// applications may add() their own on every shard.
+class registry {
+public:
+    struct group {
+        sstring name;
+        std::function<void (bool)> toggle;
+        std::function<bool ()> enabled;
+    };
+private:
+    std::vector<group> _groups;
+    group* find(const sstring& name);
+public:
+    /// Registers a group on this shard.  \c toggle enables or disables
+    /// the underlying instrumentation; \c enabled reports its current
+    /// state (the two are separate because some instrumentation can
+    /// stop on its own).
+    void add(sstring name, std::function<void (bool)> toggle,
+            std::function<bool ()> enabled);
+    /// Toggles \c name on this shard; false when no such group exists.
+    bool set(const sstring& name, bool enable);
+    /// One "name on|off" line per group, prefixed with the shard id.
+    sstring list() const;
+    /// Returns this shard's registry.
+    static registry& local();
+    /// Toggles \c name on every shard; resolves to false when no such
+    /// group exists.
+    static future<bool> set_all(sstring name, bool enable);
+    /// Lists every shard's groups and their states.
+    static future<sstring> list_all();
+};
+
+}
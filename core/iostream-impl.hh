@@ -32,10 +32,10 @@ future<> output_stream<CharType>::write(const char_type* buf) {
 }
 
 template<typename CharType>
-template<typename StringChar, typename SizeType, SizeType MaxSize>
+template<typename StringChar, typename SizeType, SizeType MaxSize, bool NulTerminate>
 inline
-future<> output_stream<CharType>::write(const basic_sstring<StringChar, SizeType, MaxSize>& s) {
-    return write(reinterpret_cast<const CharType *>(s.c_str()), s.size());
+future<> output_stream<CharType>::write(const basic_sstring<StringChar, SizeType, MaxSize, NulTerminate>& s) {
+    return write(reinterpret_cast<const CharType *>(s.data()), s.size());
 }
 
 template<typename CharType>
@@ -51,41 +51,74 @@ future<> output_stream<CharType>::write(scattered_message<CharType> msg) {
 
 template<typename CharType>
 future<> output_stream<CharType>::write(net::packet p) {
+    if (!_auto_cork) {
+        return do_write(std::move(p));
+    }
+    return do_write(std::move(p)).then([this] {
+        return cork();
+    });
+}
+
+template<typename CharType>
+future<> output_stream<CharType>::do_write(net::packet p) {
     static_assert(std::is_same<CharType, char>::value, "packet works on char");
 
     if (p.len() == 0) {
         return make_ready_future<>();
     }
 
-    assert(!_end && "Mixing buffered writes and zero-copy writes not supported yet");
+    if (_end) {
+        // chain the buffered data ahead of the zero-copy fragments, so a
+        // mixed header/body write leaves in a single writev() through the
+        // sink instead of one put per piece
+        _buf.trim(_end);
+        _end = 0;
+        net::packet head(net::fragment{_buf.get_write(), _buf.size()}, _buf.release());
+        head.append(std::move(p));
+        p = std::move(head);
+    }
 
     if (!_trim_to_size || p.len() <= _size) {
-        // TODO: aggregate buffers for later coalescing. Currently we flush right
-        // after appending the message anyway, so it doesn't matter.
-        return _fd.put(std::move(p));
+        return put(std::move(p));
     }
 
     auto head = p.share(0, _size);
     p.trim_front(_size);
-    return _fd.put(std::move(head)).then([this, p = std::move(p)] () mutable {
-        return write(std::move(p));
+    return put(std::move(head)).then([this, p = std::move(p)] () mutable {
+        return do_write(std::move(p));
     });
 }
 
 template<typename CharType>
 future<> output_stream<CharType>::write(temporary_buffer<CharType> p) {
+    if (!_auto_cork) {
+        return do_write(std::move(p));
+    }
+    return do_write(std::move(p)).then([this] {
+        return cork();
+    });
+}
+
+template<typename CharType>
+future<> output_stream<CharType>::do_write(temporary_buffer<CharType> p) {
     if (p.empty()) {
         return make_ready_future<>();
     }
-    assert(!_end && "Mixing buffered writes and zero-copy writes not supported yet");
+    if (_end) {
+        // chain the buffered data ahead of the user buffer, so both leave
+        // in a single writev() without copying the body
+        _buf.trim(_end);
+        _end = 0;
+        net::packet head(net::fragment{_buf.get_write(), _buf.size()}, _buf.release());
+        return do_write(net::packet(std::move(head), std::move(p)));
+    }
     if (!_trim_to_size || p.size() <= _size) {
-        // TODO: aggregate buffers for later coalescing.
         return _fd.put(std::move(p));
     }
     auto head = p.share(0, _size);
     p.trim_front(_size);
     return _fd.put(std::move(head)).then([this, p = std::move(p)] () mutable {
-        return write(std::move(p));
+        return do_write(std::move(p));
     });
 }
 
@@ -141,6 +174,45 @@ input_stream<CharType>::read_exactly(size_t n) {
     }
 }
 
+template <typename CharType>
+future<std::vector<temporary_buffer<CharType>>>
+input_stream<CharType>::read_exactly_fragmented_part(size_t n, std::vector<tmp_buf> out, size_t completed) {
+    if (available()) {
+        auto now = std::min(n - completed, available());
+        out.push_back(_buf.share(0, now));
+        _buf.trim_front(now);
+        completed += now;
+    }
+    if (completed == n) {
+        return make_ready_future<std::vector<tmp_buf>>(std::move(out));
+    }
+
+    // _buf is now empty
+    return _fd.get().then([this, n, out = std::move(out), completed] (auto buf) mutable {
+        if (buf.size() == 0) {
+            // Short read; the caller sees fewer than n bytes and eof()
+            _eof = true;
+            return make_ready_future<std::vector<tmp_buf>>(std::move(out));
+        }
+        _buf = std::move(buf);
+        return this->read_exactly_fragmented_part(n, std::move(out), completed);
+    });
+}
+
+template <typename CharType>
+future<std::vector<temporary_buffer<CharType>>>
+input_stream<CharType>::read_exactly_fragmented(size_t n) {
+    std::vector<tmp_buf> out;
+    if (_buf.size() >= n) {
+        // easy case: a single zero-copy view into the current buffer
+        out.push_back(_buf.share(0, n));
+        _buf.trim_front(n);
+        return make_ready_future<std::vector<tmp_buf>>(std::move(out));
+    }
+    // buffer too small: collect views buffer by buffer
+    return read_exactly_fragmented_part(n, std::move(out), 0);
+}
+
 template <typename CharType>
 template <typename Consumer>
 future<>
@@ -228,6 +300,17 @@ output_stream<CharType>::split_and_put(temporary_buffer<CharType> buf) {
 template <typename CharType>
 future<>
 output_stream<CharType>::write(const char_type* buf, size_t n) {
+    if (!_auto_cork) {
+        return do_write(buf, n);
+    }
+    return do_write(buf, n).then([this] {
+        return cork();
+    });
+}
+
+template <typename CharType>
+future<>
+output_stream<CharType>::do_write(const char_type* buf, size_t n) {
     auto bulk_threshold = _end ? (2 * _size - _end) : _size;
     if (n >= bulk_threshold) {
         if (_end) {
@@ -238,13 +321,15 @@ output_stream<CharType>::write(const char_type* buf, size_t n) {
             std::copy(buf + now, buf + n, tmp.get_write());
             _buf.trim(_end);
             _end = 0;
-            return put(std::move(_buf)).then([this, tmp = std::move(tmp)]() mutable {
-                if (_trim_to_size) {
+            if (_trim_to_size) {
+                return put(std::move(_buf)).then([this, tmp = std::move(tmp)]() mutable {
                     return split_and_put(std::move(tmp));
-                } else {
-                    return put(std::move(tmp));
-                }
-            });
+                });
+            }
+            // both chunks are complete, so chain them into one writev()
+            // through the sink instead of two puts
+            net::packet p(net::fragment{_buf.get_write(), _buf.size()}, _buf.release());
+            return put(net::packet(std::move(p), std::move(tmp)));
         } else {
             temporary_buffer<char> tmp = _fd.allocate_buffer(n);
             std::copy(buf, buf + n, tmp.get_write());
@@ -291,6 +376,8 @@ output_stream<CharType>::flush() {
             return make_exception_future<>(std::move(_ex));
         } else {
             _flush = true;
+            // an explicit flush overrides any pending cork deadline
+            _corked = false;
             if (!_in_batch) {
                 add_to_flush_poller(this);
                 _in_batch = promise<>();
@@ -300,6 +387,27 @@ output_stream<CharType>::flush() {
     return make_ready_future<>();
 }
 
+// Auto-cork version of flush(): schedules the same batched flush, but
+// marks it corked so poll_flush() may defer it until _cork_delay has
+// elapsed, letting small writes coalesce across poll iterations.
+template <typename CharType>
+future<>
+output_stream<CharType>::cork() {
+    if (_ex) {
+        return make_exception_future<>(std::move(_ex));
+    }
+    if (!_flush) {
+        _cork_start = std::chrono::steady_clock::now();
+    }
+    _flush = true;
+    _corked = true;
+    if (!_in_batch) {
+        add_to_flush_poller(this);
+        _in_batch = promise<>();
+    }
+    return make_ready_future<>();
+}
+
 void add_to_flush_poller(output_stream<char>* x);
 
 template <typename CharType>
@@ -317,6 +425,21 @@ output_stream<CharType>::put(temporary_buffer<CharType> buf) {
     }
 }
 
+template <typename CharType>
+future<>
+output_stream<CharType>::put(net::packet p) {
+    // if flush is scheduled, disable it, so it will not try to write in parallel
+    _flush = false;
+    if (_flushing) {
+        // flush in progress, wait for it to end before continuing
+        return _in_batch.value().get_future().then([this, p = std::move(p)] () mutable {
+            return _fd.put(std::move(p));
+        });
+    } else {
+        return _fd.put(std::move(p));
+    }
+}
+
 template <typename CharType>
 void
 output_stream<CharType>::poll_flush() {
@@ -328,6 +451,14 @@ output_stream<CharType>::poll_flush() {
         return;
     }
 
+    if (_corked && std::chrono::steady_clock::now() - _cork_start < _cork_delay) {
+        // Cork deadline not reached: let the data keep accumulating and
+        // check again on the next poll iteration
+        add_to_flush_poller(this);
+        return;
+    }
+    _corked = false;
+
     auto f = make_ready_future();
     _flush = false;
     _flushing = true; // make whoever wants to write into the fd to wait for flush to complete
@@ -38,6 +38,7 @@
 #include "future.hh"
 #include "temporary_buffer.hh"
 #include "scattered_message.hh"
+#include <chrono>
 
 namespace net { class packet; }
 
@@ -140,6 +141,12 @@ public:
     input_stream(input_stream&&) = default;
     input_stream& operator=(input_stream&&) = default;
     future<temporary_buffer<CharType>> read_exactly(size_t n);
+    /// Reads exactly \c n bytes as a list of zero-copy views into the
+    /// stream's buffers. Where read_exactly() allocates and copies when a
+    /// request spans buffer boundaries, this shares each underlying buffer
+    /// instead, so large frames are never linearized. On end of stream the
+    /// list may hold fewer than \c n bytes; check \ref eof().
+    future<std::vector<tmp_buf>> read_exactly_fragmented(size_t n);
     template <typename Consumer>
     future<> consume(Consumer& c);
     bool eof() { return _eof; }
@@ -160,6 +167,7 @@ public:
     }
 private:
     future<temporary_buffer<CharType>> read_exactly_part(size_t n, tmp_buf buf, size_t completed);
+    future<std::vector<tmp_buf>> read_exactly_fragmented_part(size_t n, std::vector<tmp_buf> out, size_t completed);
 };
 
 // Facilitates data buffering before it's handed over to data_sink.
@@ -183,12 +191,20 @@ class output_stream final {
     std::experimental::optional<promise<>> _in_batch;
     bool _flush = false;
     bool _flushing = false;
+    // Auto-corking: writes schedule their own flush through the
+    // batch-flush poller; _corked marks a flush the poller may defer
+    // until _cork_delay has elapsed since _cork_start
+    bool _auto_cork = false;
+    bool _corked = false;
+    std::chrono::microseconds _cork_delay{0};
+    std::chrono::steady_clock::time_point _cork_start;
     std::exception_ptr _ex;
 private:
     size_t available() const { return _end - _begin; }
     size_t possibly_available() const { return _size - _begin; }
     future<> split_and_put(temporary_buffer<CharType> buf);
     future<> put(temporary_buffer<CharType> buf);
+    future<> put(net::packet p);
     void poll_flush();
 public:
     using char_type = CharType;
@@ -201,16 +217,38 @@ public:
     future<> write(const char_type* buf, size_t n);
     future<> write(const char_type* buf);
 
-    template <typename StringChar, typename SizeType, SizeType MaxSize>
-    future<> write(const basic_sstring<StringChar, SizeType, MaxSize>& s);
+    template <typename StringChar, typename SizeType, SizeType MaxSize, bool NulTerminate>
+    future<> write(const basic_sstring<StringChar, SizeType, MaxSize, NulTerminate>& s);
     future<> write(const std::basic_string<char_type>& s);
 
+    /// Writes the packet without copying its fragments; ownership of
+    /// the underlying buffers travels with the packet and they are
+    /// released only once the stack (NIC or kernel) is done with them.
+    /// May be freely mixed with the buffered write() overloads; any
+    /// buffered data is flushed first to preserve ordering.
     future<> write(net::packet p);
     future<> write(scattered_message<char_type> msg);
+    /// Writes the buffer without copying it, adopting it as a packet
+    /// fragment; see write(net::packet).
     future<> write(temporary_buffer<char_type>);
     future<> flush();
     future<> close();
+    /// Enables auto-corking: every write leaves its data corked in the
+    /// stream, and the reactor's batch-flush poller sends everything a
+    /// poll iteration accumulated as one segment - no explicit flush()
+    /// discipline needed in the handler. A non-zero \c delay lets small
+    /// writes keep accumulating across iterations until the deadline
+    /// expires; an explicit flush() always sends immediately.
+    void set_auto_cork(std::chrono::microseconds delay = std::chrono::microseconds(0)) {
+        _auto_cork = true;
+        _batch_flushes = true;
+        _cork_delay = delay;
+    }
 private:
+    future<> do_write(const char_type* buf, size_t n);
+    future<> do_write(net::packet p);
+    future<> do_write(temporary_buffer<char_type> p);
+    future<> cork();
     friend class reactor;
 };
 
@@ -0,0 +1,64 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "timer.hh"
+#include <chrono>
+#include <atomic>
+
+/// \brief Coarse, cheap-to-read clock.
+///
+/// now() is a relaxed atomic load, so hot paths that only need
+/// millisecond precision (timer expiry checks, stats timestamps,
+/// decaying averages) can read the time without the vdso call that
+/// std::chrono::steady_clock::now() costs.
+///
+/// The value is refreshed by cpu 0 once per reactor poll iteration, so
+/// while the clock's representation is milliseconds, its staleness is
+/// typically one poll loop; a 10ms periodic timer provides a floor for
+/// when cpu 0 sleeps.
+class lowres_clock {
+public:
+    typedef int64_t rep;
+    // The lowres_clock's resolution is 10ms. However, to make it is easier to
+    // do calcuations with std::chrono::milliseconds, we make the clock's
+    // period to 1ms instead of 10ms.
+    typedef std::ratio<1, 1000> period;
+    typedef std::chrono::duration<rep, period> duration;
+    typedef std::chrono::time_point<lowres_clock, duration> time_point;
+    lowres_clock();
+    static time_point now() {
+        auto nr = _now.load(std::memory_order_relaxed);
+        return time_point(duration(nr));
+    }
+private:
+    static void update();
+    // _now is updated by cpu0 and read by other cpus. Make _now on its own
+    // cache line to avoid false sharing.
+    static std::atomic<rep> _now [[gnu::aligned(64)]];
+    // High resolution timer to drive this low resolution clock
+    timer<> _timer [[gnu::aligned(64)]];
+    // High resolution timer expires every 10 milliseconds
+    static constexpr std::chrono::milliseconds _granularity{10};
+    // the reactor refreshes the clock once per poll iteration on cpu 0
+    friend class reactor;
+};
@@ -53,6 +53,41 @@
 #include "memory.hh"
 #include "reactor.hh"
 
+namespace memory {
+
+// Current label and per-label live-byte estimates; shared by both
+// allocators so scoped_alloc_label is always well-defined, though only
+// the seastar allocator's sampling profiler updates the estimates.
+static thread_local alloc_label g_current_label = alloc_label::other;
+static thread_local uint64_t g_labeled_bytes[unsigned(alloc_label::nr_labels)];
+
+scoped_alloc_label::scoped_alloc_label(alloc_label l)
+    : _prev(g_current_label) {
+    g_current_label = l;
+}
+
+scoped_alloc_label::~scoped_alloc_label() {
+    g_current_label = _prev;
+}
+
+uint64_t labeled_memory(alloc_label l) {
+    return g_labeled_bytes[unsigned(l)];
+}
+
+const char* alloc_label_name(alloc_label l) {
+    switch (l) {
+    case alloc_label::other: return "other";
+    case alloc_label::network: return "network";
+    case alloc_label::filesystem: return "filesystem";
+    case alloc_label::cache: return "cache";
+    case alloc_label::rpc: return "rpc";
+    case alloc_label::app: return "app";
+    default: return "?";
+    }
+}
+
+}
+
 #ifndef DEFAULT_ALLOCATOR
 
 #include "bitops.hh"
@@ -66,11 +101,15 @@
 #include <cassert>
 #include <atomic>
 #include <mutex>
+#include <chrono>
 #include <experimental/optional>
 #include <functional>
 #include <cstring>
 #include <boost/intrusive/list.hpp>
 #include <sys/mman.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <ostream>
 #ifdef HAVE_NUMA
 #include <numaif.h>
 #endif
@@ -83,9 +122,12 @@ void enable_abort_on_allocation_failure() {
     abort_on_allocation_failure.store(true, std::memory_order_seq_cst);
 }
 
+void dump_sampled_memory_profile(std::ostream& os);
+
 static void on_allocation_failure(size_t size) {
     if (abort_on_allocation_failure.load(std::memory_order_relaxed)) {
         seastar_logger.error("Failed to allocate {} bytes", size);
+        dump_sampled_memory_profile(std::cerr);
         abort();
     }
 }
@@ -104,8 +146,292 @@ static std::atomic<bool> live_cpus[max_cpus];
 static thread_local uint64_t g_allocs;
 static thread_local uint64_t g_frees;
 static thread_local uint64_t g_cross_cpu_frees;
+static thread_local uint64_t g_cross_cpu_free_bytes;
 static thread_local uint64_t g_reclaims;
 
+// Sampled allocation profiler.  Every ~sample_interval allocated bytes,
+// one allocation is sampled: its callsite backtrace is recorded and the
+// allocation is tracked until freed, so each site's live-byte estimate
+// (each sample stands for ~sample_interval bytes) tells us who owns the
+// heap when a shard runs out of memory.  The hot-path cost is one
+// subtraction and a predictable branch per allocation, plus one hash
+// probe per free while any samples are live, so it stays on in
+// production.  All state is per-shard and statically sized; no memory
+// is allocated from within the allocator.
+static constexpr size_t sample_interval = 1024 * 1024;
+
+struct alloc_site {
+    static constexpr unsigned max_frames = 14;
+    void* frames[max_frames];
+    unsigned nr_frames = 0;
+    uint64_t live_bytes = 0;    // estimated, see sample_interval
+    uint64_t live_objects = 0;  // sampled, not estimated
+    uint64_t total_bytes = 0;   // estimated, cumulative
+    alloc_site* next = nullptr; // hash chain
+};
+
+struct sampled_object {
+    void* ptr;
+    alloc_site* site;
+    uint64_t weight;
+    alloc_label label;
+    sampled_object* next;  // hash chain or freelist
+};
+
+class heap_profiler {
+    static constexpr unsigned site_buckets = 512;       // power of two
+    static constexpr unsigned max_sites = 1024;
+    static constexpr unsigned object_buckets = 4096;    // power of two
+    static constexpr unsigned max_objects = 4096;
+    alloc_site* _site_hash[site_buckets] = {};
+    alloc_site _sites[max_sites];
+    unsigned _nr_sites = 0;
+    sampled_object* _object_hash[object_buckets] = {};
+    sampled_object _objects[max_objects];
+    sampled_object* _free_objects;
+    size_t _nr_sampled = 0;
+    ssize_t _bytes_until_sample = sample_interval;
+    uint32_t _rng_state = 0x12345678;
+    bool _in_sample = false;  // ::backtrace() may allocate internally
+private:
+    static unsigned object_bucket_of(void* ptr) {
+        return (reinterpret_cast<uintptr_t>(ptr) >> 4) * 2654435761u % object_buckets;
+    }
+    void rearm() {
+        // uniform in [1, 2 * sample_interval), mean ~sample_interval,
+        // so allocation patterns can't sync up with the sampling clock
+        _rng_state = _rng_state * 1664525u + 1013904223u;
+        _bytes_until_sample = 1 + _rng_state % (2 * sample_interval);
+    }
+    alloc_site* find_or_create_site(void* const* frames, unsigned nr_frames) {
+        uint64_t hash = 0;
+        for (unsigned i = 0; i < nr_frames; ++i) {
+            hash = hash * 31 + reinterpret_cast<uintptr_t>(frames[i]);
+        }
+        auto bucket = hash % site_buckets;
+        for (auto s = _site_hash[bucket]; s; s = s->next) {
+            if (s->nr_frames == nr_frames
+                    && std::equal(frames, frames + nr_frames, s->frames)) {
+                return s;
+            }
+        }
+        if (_nr_sites == max_sites) {
+            return nullptr;  // out of site slots; drop the sample
+        }
+        auto s = &_sites[_nr_sites++];
+        std::copy(frames, frames + nr_frames, s->frames);
+        s->nr_frames = nr_frames;
+        s->next = _site_hash[bucket];
+        _site_hash[bucket] = s;
+        return s;
+    }
+    [[gnu::noinline]] void sample(void* ptr, size_t size) {
+        if (_in_sample) {
+            return;
+        }
+        _in_sample = true;
+        rearm();
+        // skip sample() and its inlined-into-allocate() caller
+        constexpr unsigned skip = 2;
+        void* frames[alloc_site::max_frames + skip];
+        int n = ::backtrace(frames, alloc_site::max_frames + skip);
+        if (n > int(skip) && _free_objects) {
+            auto site = find_or_create_site(frames + skip, n - skip);
+            if (site) {
+                auto weight = size + sample_interval;
+                site->live_bytes += weight;
+                site->total_bytes += weight;
+                ++site->live_objects;
+                auto o = _free_objects;
+                _free_objects = o->next;
+                o->ptr = ptr;
+                o->site = site;
+                o->weight = weight;
+                o->label = g_current_label;
+                g_labeled_bytes[unsigned(o->label)] += weight;
+                auto bucket = object_bucket_of(ptr);
+                o->next = _object_hash[bucket];
+                _object_hash[bucket] = o;
+                ++_nr_sampled;
+            }
+        }
+        _in_sample = false;
+    }
+public:
+    heap_profiler() {
+        _free_objects = nullptr;
+        for (auto& o : _objects) {
+            o.next = _free_objects;
+            _free_objects = &o;
+        }
+    }
+    void on_alloc(void* ptr, size_t size) {
+        _bytes_until_sample -= size;
+        if (__builtin_expect(_bytes_until_sample < 0 && ptr, false)) {
+            sample(ptr, size);
+        }
+    }
+    void on_free(void* ptr) {
+        if (__builtin_expect(!_nr_sampled, true)) {
+            return;
+        }
+        auto link = &_object_hash[object_bucket_of(ptr)];
+        while (*link && (*link)->ptr != ptr) {
+            link = &(*link)->next;
+        }
+        auto o = *link;
+        if (!o) {
+            return;
+        }
+        o->site->live_bytes -= o->weight;
+        --o->site->live_objects;
+        g_labeled_bytes[unsigned(o->label)] -= o->weight;
+        *link = o->next;
+        o->next = _free_objects;
+        _free_objects = o;
+        --_nr_sampled;
+    }
+    void dump(std::ostream& os) const;
+};
+
+static thread_local heap_profiler g_heap_profiler;
+
+void heap_profiler::dump(std::ostream& os) const {
+    os << "heap profile: " << _nr_sites << " sites, "
+       << _nr_sampled << " sampled live objects, ~"
+       << sample_interval << " bytes/sample\n";
+    for (unsigned i = 0; i < _nr_sites; ++i) {
+        auto& s = _sites[i];
+        if (!s.live_bytes && !s.total_bytes) {
+            continue;
+        }
+        os << "live ~" << s.live_bytes << " bytes in " << s.live_objects
+           << " sampled objects (cumulative ~" << s.total_bytes << " bytes) at\n";
+        for (unsigned f = 0; f < s.nr_frames; ++f) {
+            os << "    " << s.frames[f];
+            Dl_info info;
+            if (dladdr(s.frames[f], &info) && info.dli_sname) {
+                os << " " << info.dli_sname << "+"
+                   << (reinterpret_cast<uintptr_t>(s.frames[f])
+                       - reinterpret_cast<uintptr_t>(info.dli_saddr));
+            }
+            os << "\n";
+        }
+    }
+}
+
+// Large contiguous allocations walk the free span lists and may trigger
+// reclaim, so a single one can stall a shard for milliseconds while
+// looking perfectly innocent in the caller's own profile.  When a
+// threshold is set (set_large_allocation_threshold()), allocations at
+// least that big are timed and attributed to their callsite, and a log2
+// latency histogram is kept for export through the reactor's metrics.
+// Off by default; the hot path then pays one comparison per large
+// allocation.
+struct large_alloc_site {
+    static constexpr unsigned max_frames = 14;
+    void* frames[max_frames];
+    unsigned nr_frames = 0;
+    uint64_t count = 0;
+    uint64_t total_latency_us = 0;
+    uint64_t max_latency_us = 0;
+    large_alloc_site* next = nullptr; // hash chain
+};
+
+class large_alloc_tracker {
+    static constexpr unsigned site_buckets = 64;  // power of two
+    static constexpr unsigned max_sites = 128;
+    size_t _threshold = std::numeric_limits<size_t>::max();
+    large_alloc_stats _stats = {};
+    large_alloc_site* _site_hash[site_buckets] = {};
+    large_alloc_site _sites[max_sites];
+    unsigned _nr_sites = 0;
+    bool _in_record = false;  // ::backtrace() may allocate internally
+private:
+    large_alloc_site* find_or_create_site(void* const* frames, unsigned nr_frames) {
+        uint64_t hash = 0;
+        for (unsigned i = 0; i < nr_frames; ++i) {
+            hash = hash * 31 + reinterpret_cast<uintptr_t>(frames[i]);
+        }
+        auto bucket = hash % site_buckets;
+        for (auto s = _site_hash[bucket]; s; s = s->next) {
+            if (s->nr_frames == nr_frames
+                    && std::equal(frames, frames + nr_frames, s->frames)) {
+                return s;
+            }
+        }
+        if (_nr_sites == max_sites) {
+            return nullptr;  // out of site slots; keep the histogram only
+        }
+        auto s = &_sites[_nr_sites++];
+        std::copy(frames, frames + nr_frames, s->frames);
+        s->nr_frames = nr_frames;
+        s->next = _site_hash[bucket];
+        _site_hash[bucket] = s;
+        return s;
+    }
+public:
+    void set_threshold(size_t threshold) {
+        _threshold = threshold ? threshold : std::numeric_limits<size_t>::max();
+    }
+    size_t threshold() const {
+        return _threshold == std::numeric_limits<size_t>::max() ? 0 : _threshold;
+    }
+    bool tracked(size_t size) const {
+        return __builtin_expect(size >= _threshold, false);
+    }
+    [[gnu::noinline]] void record(uint64_t latency_us) {
+        ++_stats.allocations;
+        _stats.total_latency_us += latency_us;
+        _stats.max_latency_us = std::max(_stats.max_latency_us, latency_us);
+        // bucket i covers [2^(i-1), 2^i) microseconds
+        unsigned bucket = latency_us ? 64 - __builtin_clzll(latency_us) : 0;
+        ++_stats.latency_hist[std::min(bucket, large_alloc_latency_buckets - 1)];
+        if (_in_record) {
+            return;
+        }
+        _in_record = true;
+        // skip record() and the allocate_large() wrapper
+        constexpr unsigned skip = 2;
+        void* frames[large_alloc_site::max_frames + skip];
+        int n = ::backtrace(frames, large_alloc_site::max_frames + skip);
+        if (n > int(skip)) {
+            auto site = find_or_create_site(frames + skip, n - skip);
+            if (site) {
+                ++site->count;
+                site->total_latency_us += latency_us;
+                site->max_latency_us = std::max(site->max_latency_us, latency_us);
+            }
+        }
+        _in_record = false;
+    }
+    const large_alloc_stats& stats() const { return _stats; }
+    void dump(std::ostream& os) const;
+};
+
+static thread_local large_alloc_tracker g_large_alloc_tracker;
+
+void large_alloc_tracker::dump(std::ostream& os) const {
+    os << "large allocations >= " << threshold() << " bytes: "
+       << _stats.allocations << " timed, worst "
+       << _stats.max_latency_us << "us\n";
+    for (unsigned i = 0; i < _nr_sites; ++i) {
+        auto& s = _sites[i];
+        os << s.count << " allocations, " << s.total_latency_us
+           << "us total, " << s.max_latency_us << "us worst, at\n";
+        for (unsigned f = 0; f < s.nr_frames; ++f) {
+            os << "    " << s.frames[f];
+            Dl_info info;
+            if (dladdr(s.frames[f], &info) && info.dli_sname) {
+                os << " " << info.dli_sname << "+"
+                   << (reinterpret_cast<uintptr_t>(s.frames[f])
+                       - reinterpret_cast<uintptr_t>(info.dli_saddr));
+            }
+            os << "\n";
+        }
+    }
+}
+
 using std::experimental::optional;
 
 using allocate_system_memory_fn
@@ -219,6 +545,8 @@ class small_pool {
     unsigned _min_free;
     unsigned _max_free;
     unsigned _spans_in_use = 0;
+    uint64_t _allocs = 0;
+    uint64_t _frees = 0;
     page_list _span_list;
     static constexpr unsigned idx_frac_bits = 2;
 private:
@@ -229,11 +557,16 @@ public:
     void* allocate();
     void deallocate(void* object);
     unsigned object_size() const { return _object_size; }
+    uint64_t allocs() const { return _allocs; }
+    uint64_t frees() const { return _frees; }
+    unsigned spans_in_use() const { return _spans_in_use; }
+    bool compact();
     static constexpr unsigned size_to_idx(unsigned size);
     static constexpr unsigned idx_to_size(unsigned idx);
 private:
     void add_more_objects();
     void trim_free_list();
+    void trim_free_list_to(unsigned goal);
     float waste();
 };
 
@@ -294,9 +627,18 @@ struct cpu_pages {
     uint32_t nr_pages;
     uint32_t nr_free_pages;
     uint32_t current_min_free_pages = 0;
+    size_t huge_backed_bytes = 0;
     unsigned cpu_id = -1U;
     std::function<void (std::function<void ()>)> reclaim_hook;
     std::vector<reclaimer*> reclaimers;
+    std::vector<pressure_listener*> pressure_listeners;
+    reclaim_pressure last_pressure = reclaim_pressure::relaxed;
+    unsigned next_defrag_pool = 0;
+    std::vector<resource::memory> numa_layout;
+    size_t numa_audit_pos = 0;
+    uint64_t numa_pages_checked = 0;
+    uint64_t numa_pages_misplaced = 0;
+    uint64_t numa_pages_moved = 0;
     static constexpr unsigned nr_span_lists = 32;
     union pla {
         pla() {
@@ -309,8 +651,17 @@ struct cpu_pages {
         }
         page_list free_spans[nr_span_lists];  // contains spans with span_size >= 2^idx
     } fsu;
+    // occupancy of fsu.free_spans, so span search scans a mask instead
+    // of walking empty lists
+    uint64_t free_span_mask = 0;
     small_pool_array small_pools;
     alignas(cache_line_size) std::atomic<cross_cpu_free_item*> xcpu_freelist;
+    // Sender-side batches of cross-cpu frees, keyed by destination cpu.
+    // Objects accumulate here with no atomics and are pushed to the
+    // destination's xcpu_freelist in one compare-exchange per poll.
+    cross_cpu_free_item* xcpu_pending_head[max_cpus] = {};
+    cross_cpu_free_item* xcpu_pending_tail[max_cpus] = {};
+    bool has_xcpu_pending = false;
     alignas(cache_line_size) std::vector<physical_address> virt_to_phys_map;
     static std::atomic<unsigned> cpu_id_gen;
     static cpu_pages* all_cpus[max_cpus];
@@ -318,6 +669,8 @@ struct cpu_pages {
 
     void link(page_list& list, page* span);
     void unlink(page_list& list, page* span);
+    void link_free_span(unsigned idx, page* span);
+    void unlink_free_span(unsigned idx, page* span);
     struct trim {
         unsigned offset;
         unsigned nr_pages;
@@ -337,6 +690,7 @@ struct cpu_pages {
     bool try_cross_cpu_free(void* ptr);
     void shrink(void* ptr, size_t new_size);
     void free_cross_cpu(unsigned cpu_id, void* ptr);
+    bool flush_cross_cpu_frees();
     bool drain_cross_cpu_freelist();
     size_t object_size(void* ptr);
     page* to_page(void* p) {
@@ -345,12 +699,18 @@ struct cpu_pages {
 
     bool is_initialized() const;
     bool initialize();
+    reclaim_pressure compute_pressure() const;
+    void maybe_notify_pressure();
+    bool defragment_step();
     reclaiming_result run_reclaimers(reclaimer_scope);
     void schedule_reclaim();
     void set_reclaim_hook(std::function<void (std::function<void ()>)> hook);
     void resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void replace_memory_backing(allocate_system_memory_fn alloc_sys_mem);
+    void pre_touch_memory();
+    void update_huge_page_accounting();
+    void numa_audit_step(bool repair);
     void init_virt_to_phys_map();
     memory::memory_layout memory_layout();
     translation translate(const void* addr, size_t size);
@@ -387,6 +747,20 @@ cpu_pages::link(page_list& list, page* span) {
     list.push_front(pages, *span);
 }
 
+void
+cpu_pages::link_free_span(unsigned idx, page* span) {
+    link(fsu.free_spans[idx], span);
+    free_span_mask |= uint64_t(1) << idx;
+}
+
+void
+cpu_pages::unlink_free_span(unsigned idx, page* span) {
+    unlink(fsu.free_spans[idx], span);
+    if (fsu.free_spans[idx].empty()) {
+        free_span_mask &= ~(uint64_t(1) << idx);
+    }
+}
+
 void cpu_pages::free_span_no_merge(uint32_t span_start, uint32_t nr_pages) {
     assert(nr_pages);
     nr_free_pages += nr_pages;
@@ -395,7 +769,7 @@ void cpu_pages::free_span_no_merge(uint32_t span_start, uint32_t nr_pages) {
     span->free = span_end->free = true;
     span->span_size = span_end->span_size = nr_pages;
     auto idx = index_of(nr_pages);
-    link(fsu.free_spans[idx], span);
+    link_free_span(idx, span);
 }
 
 void cpu_pages::free_span(uint32_t span_start, uint32_t nr_pages) {
@@ -406,7 +780,7 @@ void cpu_pages::free_span(uint32_t span_start, uint32_t nr_pages) {
         span_start -= b_size;
         nr_pages += b_size;
         nr_free_pages -= b_size;
-        unlink(fsu.free_spans[index_of(b_size)], before - (b_size - 1));
+        unlink_free_span(index_of(b_size), before - (b_size - 1));
     }
     page* after = &pages[span_start + nr_pages];
     if (after->free) {
@@ -414,7 +788,7 @@ void cpu_pages::free_span(uint32_t span_start, uint32_t nr_pages) {
         assert(a_size);
         nr_pages += a_size;
         nr_free_pages -= a_size;
-        unlink(fsu.free_spans[index_of(a_size)], after);
+        unlink_free_span(index_of(a_size), after);
     }
     free_span_no_merge(span_start, nr_pages);
 }
@@ -426,9 +800,7 @@ cpu_pages::find_and_unlink_span(unsigned n_pages) {
     if (n_pages >= (2u << idx)) {
         throw std::bad_alloc();
     }
-    while (idx < nr_span_lists && fsu.free_spans[idx].empty()) {
-        ++idx;
-    }
+    idx = bitmap_find_first_set(&free_span_mask, nr_span_lists, idx);
     if (idx == nr_span_lists) {
         if (initialize()) {
             return find_and_unlink_span(n_pages);
@@ -444,7 +816,7 @@ cpu_pages::find_and_unlink_span(unsigned n_pages) {
     if (!span) {
         return nullptr;
     }
-    unlink(list, span);
+    unlink_free_span(idx, span);
     return span;
 }
 
@@ -499,6 +871,7 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer) {
             schedule_reclaim();
         }
     }
+    maybe_notify_pressure();
     return mem() + span_idx * page_size;
 }
 
@@ -546,26 +919,69 @@ void cpu_pages::free_cross_cpu(unsigned cpu_id, void* ptr) {
         // should only happen for boost unit-tests.
         return;
     }
+    // Just queue locally; flush_cross_cpu_frees() pushes the whole
+    // batch with a single compare-exchange, instead of contending on
+    // the destination's list once per object.
     auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
-    auto& list = all_cpus[cpu_id]->xcpu_freelist;
-    auto old = list.load(std::memory_order_relaxed);
-    do {
-        p->next = old;
-    } while (!list.compare_exchange_weak(old, p, std::memory_order_release, std::memory_order_relaxed));
+    p->next = xcpu_pending_head[cpu_id];
+    xcpu_pending_head[cpu_id] = p;
+    if (!p->next) {
+        xcpu_pending_tail[cpu_id] = p;
+    }
+    has_xcpu_pending = true;
     ++g_cross_cpu_frees;
 }
 
+bool cpu_pages::flush_cross_cpu_frees() {
+    if (!has_xcpu_pending) {
+        return false;
+    }
+    has_xcpu_pending = false;
+    bool flushed = false;
+    for (unsigned i = 0; i < max_cpus; ++i) {
+        auto head = xcpu_pending_head[i];
+        if (!head) {
+            continue;
+        }
+        auto tail = xcpu_pending_tail[i];
+        xcpu_pending_head[i] = nullptr;
+        xcpu_pending_tail[i] = nullptr;
+        if (!live_cpus[i].load(std::memory_order_relaxed)) {
+            // Thread died while the batch was pending; leak it,
+            // as free_cross_cpu() would have.
+            continue;
+        }
+        auto& list = all_cpus[i]->xcpu_freelist;
+        auto old = list.load(std::memory_order_relaxed);
+        do {
+            tail->next = old;
+        } while (!list.compare_exchange_weak(old, head, std::memory_order_release, std::memory_order_relaxed));
+        flushed = true;
+    }
+    return flushed;
+}
+
 bool cpu_pages::drain_cross_cpu_freelist() {
     if (!xcpu_freelist.load(std::memory_order_relaxed)) {
         return false;
     }
     auto p = xcpu_freelist.exchange(nullptr, std::memory_order_acquire);
+    // One pass over the whole batch; the objects go back to their
+    // pools/page lists here, so counter updates are batched.
+    uint64_t nr = 0;
+    uint64_t bytes = 0;
     while (p) {
         auto n = p->next;
-        ++g_frees;
+        ++nr;
+        // free(p) is about to touch the same page metadata, so the
+        // size lookup is effectively free
+        bytes += object_size(p);
+        g_heap_profiler.on_free(p);
         free(p);
         p = n;
     }
+    g_frees += nr;
+    g_cross_cpu_free_bytes += bytes;
     return true;
 }
 
@@ -622,6 +1038,8 @@ void cpu_pages::shrink(void* ptr, size_t new_size) {
 }
 
 cpu_pages::~cpu_pages() {
+    // don't strand pending batches on other cpus' objects
+    flush_cross_cpu_frees();
     live_cpus[cpu_id].store(false, std::memory_order_relaxed);
 }
 
@@ -696,6 +1114,108 @@ void cpu_pages::replace_memory_backing(allocate_system_memory_fn alloc_sys_mem)
     std::memcpy(old_mem, relocated_old_mem.get(), bytes);
 }
 
+void cpu_pages::pre_touch_memory() {
+    // Fault the whole arena in at startup, so the first requests don't
+    // pay for page faults (and, with transparent hugepages enabled, so
+    // each 2M extent is faulted in as a single huge page instead of
+    // being collapsed by khugepaged at some random later time).
+    // hugetlbfs-backed memory was already populated with MAP_POPULATE,
+    // making the touch a cheap no-op there.  A read-modify-write is
+    // needed since the arena already holds live allocator metadata.
+    auto bytes = nr_pages * page_size;
+    for (size_t off = 0; off < bytes; off += huge_page_size) {
+        auto p = reinterpret_cast<volatile char*>(mem() + off);
+        *p = *p;
+    }
+}
+
+void cpu_pages::update_huge_page_accounting() {
+    // MADV_HUGEPAGE is only a hint, so measure what the kernel actually
+    // gave us: a 2M extent is huge-backed iff its first and last small
+    // pages are present and physically contiguous with a 2M-aligned
+    // start.  Sampled once after configure(); cheap enough (two pagemap
+    // reads per 2M) that re-running it on resize would also be fine.
+    huge_backed_bytes = 0;
+    auto fd = file_desc::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    auto nr_extents = nr_pages / (huge_page_size / page_size);
+    constexpr auto pages_per_extent = huge_page_size / page_size;
+    for (size_t i = 0; i != nr_extents; ++i) {
+        auto pfn = reinterpret_cast<uintptr_t>(mem() + i * huge_page_size) / page_size;
+        uint64_t first = 0, last = 0;
+        fd.pread(&first, 8, pfn * 8);
+        fd.pread(&last, 8, (pfn + pages_per_extent - 1) * 8);
+        if (!(first & 0x8000'0000'0000'0000) || !(last & 0x8000'0000'0000'0000)) {
+            continue;
+        }
+        auto first_phys = first & 0x007f'ffff'ffff'ffff;
+        auto last_phys = last & 0x007f'ffff'ffff'ffff;
+        if ((first_phys % pages_per_extent == 0)
+                && (last_phys == first_phys + pages_per_extent - 1)) {
+            huge_backed_bytes += huge_page_size;
+        }
+    }
+}
+
+void cpu_pages::numa_audit_step(bool repair) {
+#ifdef HAVE_NUMA
+    if (numa_layout.empty() || !is_initialized()) {
+        return;
+    }
+    // 16M per step: cheap enough for a periodic timer, fast enough to
+    // sweep a large arena in under an hour
+    constexpr unsigned batch = 4096;
+    static thread_local void* addrs[batch];
+    static thread_local int status[batch];
+    static thread_local int wanted[batch];
+    auto arena_size = size_t(nr_pages) * page_size;
+    unsigned n = 0;
+    auto pos = numa_audit_pos;
+    while (n < batch && pos < arena_size) {
+        addrs[n] = mem() + pos;
+        auto off = pos;
+        int node = -1;
+        for (auto&& r : numa_layout) {
+            if (off < r.bytes) {
+                node = r.nodeid;
+                break;
+            }
+            off -= r.bytes;
+        }
+        wanted[n] = node;
+        ++n;
+        pos += page_size;
+    }
+    numa_audit_pos = pos >= arena_size ? 0 : pos;
+    if (!n) {
+        return;
+    }
+    // nodes == nullptr makes move_pages() a pure placement query
+    if (::move_pages(0, n, addrs, nullptr, status, 0) == -1) {
+        return;
+    }
+    unsigned nr_misplaced = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        ++numa_pages_checked;
+        if (status[i] >= 0 && wanted[i] >= 0 && status[i] != wanted[i]) {
+            ++numa_pages_misplaced;
+            if (repair) {
+                addrs[nr_misplaced] = addrs[i];
+                wanted[nr_misplaced] = wanted[i];
+                ++nr_misplaced;
+            }
+        }
+    }
+    if (nr_misplaced
+            && ::move_pages(0, nr_misplaced, addrs, wanted, status, MPOL_MF_MOVE) == 0) {
+        for (unsigned i = 0; i < nr_misplaced; ++i) {
+            if (status[i] >= 0) {
+                ++numa_pages_moved;
+            }
+        }
+    }
+#endif
+}
+
 void cpu_pages::init_virt_to_phys_map() {
     auto nr_entries = nr_pages / (huge_page_size / page_size);
     virt_to_phys_map.resize(nr_entries);
@@ -774,6 +1294,49 @@ void cpu_pages::resize(size_t new_size, allocate_system_memory_fn alloc_memory)
     }
 }
 
+reclaim_pressure cpu_pages::compute_pressure() const {
+    if (nr_free_pages < min_free_pages) {
+        return reclaim_pressure::critical;
+    }
+    if (nr_free_pages < 2 * min_free_pages) {
+        return reclaim_pressure::pressured;
+    }
+    return reclaim_pressure::relaxed;
+}
+
+void cpu_pages::maybe_notify_pressure() {
+    auto level = compute_pressure();
+    if (level == last_pressure) {
+        return;
+    }
+    // update first: listeners may allocate or free, re-entering us
+    last_pressure = level;
+    for (auto&& l : pressure_listeners) {
+        l->on_change(level);
+    }
+}
+
+bool cpu_pages::defragment_step() {
+    if (!is_initialized()) {
+        return false;
+    }
+    // round-robin over the small pools, pushing cached-free objects
+    // back to their spans; a span whose last object comes home is
+    // freed and merges with its free neighbors in the page lists.
+    bool progress = false;
+    for (unsigned i = 0; i < small_pool_array::nr_small_pools; ++i) {
+        auto idx = next_defrag_pool;
+        next_defrag_pool = (next_defrag_pool + 1) % small_pool_array::nr_small_pools;
+        if (small_pools[idx].compact()) {
+            progress = true;
+            break;
+        }
+    }
+    // idle is also when a shard notices pressure easing off
+    maybe_notify_pressure();
+    return progress;
+}
+
 reclaiming_result cpu_pages::run_reclaimers(reclaimer_scope scope) {
     auto target = std::max(nr_free_pages + 1, min_free_pages);
     reclaiming_result result = reclaiming_result::reclaimed_nothing;
@@ -851,6 +1414,7 @@ small_pool::allocate() {
     auto* obj = _free;
     _free = _free->next;
     --_free_count;
+    ++_allocs;
     return obj;
 }
 
@@ -860,6 +1424,7 @@ small_pool::deallocate(void* object) {
     o->next = _free;
     _free = o;
     ++_free_count;
+    ++_frees;
     if (_free_count >= _max_free) {
         trim_free_list();
     }
@@ -905,7 +1470,18 @@ small_pool::add_more_objects() {
 
 void
 small_pool::trim_free_list() {
-    auto goal = (_min_free + _max_free) / 2;
+    trim_free_list_to((_min_free + _max_free) / 2);
+}
+
+bool
+small_pool::compact() {
+    auto before = _spans_in_use;
+    trim_free_list_to(_min_free);
+    return _spans_in_use != before;
+}
+
+void
+small_pool::trim_free_list_to(unsigned goal) {
     while (_free && _free_count > goal) {
         auto obj = _free;
         _free = _free->next;
@@ -938,19 +1514,38 @@ abort_on_underflow(size_t size) {
     }
 }
 
+// Runs do_allocate(), timing it if size is above the instrumentation
+// threshold (see large_alloc_tracker).
+template <typename Func>
+inline
+void* timed_large_allocation(size_t size, Func do_allocate) {
+    if (!g_large_alloc_tracker.tracked(size)) {
+        return do_allocate();
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto ptr = do_allocate();
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    g_large_alloc_tracker.record(latency);
+    return ptr;
+}
+
 void* allocate_large(size_t size) {
     abort_on_underflow(size);
     unsigned size_in_pages = (size + page_size - 1) >> page_bits;
     assert((size_t(size_in_pages) << page_bits) >= size);
-    return cpu_mem.allocate_large(size_in_pages);
-
+    return timed_large_allocation(size, [size_in_pages] {
+        return cpu_mem.allocate_large(size_in_pages);
+    });
 }
 
 void* allocate_large_aligned(size_t align, size_t size) {
     abort_on_underflow(size);
     unsigned size_in_pages = (size + page_size - 1) >> page_bits;
     unsigned align_in_pages = std::max(align, page_size) >> page_bits;
-    return cpu_mem.allocate_large_aligned(align_in_pages, size_in_pages);
+    return timed_large_allocation(size, [align_in_pages, size_in_pages] {
+        return cpu_mem.allocate_large_aligned(align_in_pages, size_in_pages);
+    });
 }
 
 void free_large(void* ptr) {
@@ -975,6 +1570,7 @@ void* allocate(size_t size) {
         on_allocation_failure(size);
     }
     ++g_allocs;
+    g_heap_profiler.on_alloc(ptr, size);
     return ptr;
 }
 
@@ -996,6 +1592,7 @@ void* allocate_aligned(size_t align, size_t size) {
         on_allocation_failure(size);
     }
     ++g_allocs;
+    g_heap_profiler.on_alloc(ptr, size);
     return ptr;
 }
 
@@ -1004,6 +1601,7 @@ void free(void* obj) {
         return;
     }
     ++g_frees;
+    g_heap_profiler.on_free(obj);
     cpu_mem.free(obj);
 }
 
@@ -1012,6 +1610,7 @@ void free(void* obj, size_t size) {
         return;
     }
     ++g_frees;
+    g_heap_profiler.on_free(obj);
     cpu_mem.free(obj, size);
 }
 
@@ -1036,8 +1635,36 @@ reclaimer::~reclaimer() {
     r.erase(std::find(r.begin(), r.end(), this));
 }
 
+reclaim_pressure current_reclaim_pressure() {
+    return cpu_mem.compute_pressure();
+}
+
+pressure_listener::pressure_listener(pressure_fn notify)
+    : _notify(std::move(notify)) {
+    cpu_mem.pressure_listeners.push_back(this);
+}
+
+pressure_listener::~pressure_listener() {
+    auto& l = cpu_mem.pressure_listeners;
+    l.erase(std::find(l.begin(), l.end(), this));
+}
+
+bool defragment_step() {
+    return cpu_mem.defragment_step();
+}
+
+numa_audit_stats numa_audit() {
+    return numa_audit_stats{cpu_mem.numa_pages_checked,
+        cpu_mem.numa_pages_misplaced, cpu_mem.numa_pages_moved};
+}
+
+void numa_audit_step(bool repair) {
+    cpu_mem.numa_audit_step(repair);
+}
+
 void configure(std::vector<resource::memory> m,
-        optional<std::string> hugetlbfs_path) {
+        optional<std::string> hugetlbfs_path,
+        bool pre_touch) {
     size_t total = 0;
     for (auto&& x : m) {
         total += x.bytes;
@@ -1071,18 +1698,62 @@ void configure(std::vector<resource::memory> m,
 #endif
         pos += x.bytes;
     }
+    cpu_mem.numa_layout = std::move(m);
+    if (pre_touch) {
+        cpu_mem.pre_touch_memory();
+    }
+    cpu_mem.update_huge_page_accounting();
     if (hugetlbfs_path) {
         cpu_mem.init_virt_to_phys_map();
     }
 }
 
 statistics stats() {
+    // the free-span lists are bucketed by power of two, so the highest
+    // occupied bucket bounds the largest contiguous span from below
+    size_t largest_free_span = 0;
+    if (auto mask = cpu_mem.free_span_mask) {
+        auto idx = std::numeric_limits<uint64_t>::digits - count_leading_zeros(uint64_t(mask)) - 1;
+        largest_free_span = (size_t(1) << idx) * page_size;
+    }
     return statistics{g_allocs, g_frees, g_cross_cpu_frees,
-        cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, g_reclaims};
+        cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, g_reclaims,
+        cpu_mem.huge_backed_bytes, g_cross_cpu_free_bytes, largest_free_span};
+}
+
+unsigned nr_small_pools() {
+    return small_pool_array::nr_small_pools;
+}
+
+small_pool_counters small_pool_stats(unsigned idx) {
+    auto& pool = cpu_mem.small_pools[idx];
+    return small_pool_counters{pool.object_size(), pool.allocs(), pool.frees(),
+        pool.spans_in_use()};
 }
 
 bool drain_cross_cpu_freelist() {
-    return cpu_mem.drain_cross_cpu_freelist();
+    auto flushed = cpu_mem.flush_cross_cpu_frees();
+    return cpu_mem.drain_cross_cpu_freelist() || flushed;
+}
+
+void dump_sampled_memory_profile(std::ostream& os) {
+    g_heap_profiler.dump(os);
+}
+
+void set_large_allocation_threshold(size_t threshold) {
+    g_large_alloc_tracker.set_threshold(threshold);
+}
+
+size_t large_allocation_threshold() {
+    return g_large_alloc_tracker.threshold();
+}
+
+large_alloc_stats large_allocations() {
+    return g_large_alloc_tracker.stats();
+}
+
+void dump_large_allocations(std::ostream& os) {
+    g_large_alloc_tracker.dump(os);
 }
 
 translation
@@ -1394,14 +2065,45 @@ reclaimer::reclaimer(reclaim_fn reclaim, reclaimer_scope) {
 reclaimer::~reclaimer() {
 }
 
+reclaim_pressure current_reclaim_pressure() {
+    return reclaim_pressure::relaxed;
+}
+
+pressure_listener::pressure_listener(pressure_fn notify)
+    : _notify(std::move(notify)) {
+}
+
+pressure_listener::~pressure_listener() {
+}
+
+bool defragment_step() {
+    return false;
+}
+
+numa_audit_stats numa_audit() {
+    return numa_audit_stats{0, 0, 0};
+}
+
+void numa_audit_step(bool repair) {
+}
+
 void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
 }
 
-void configure(std::vector<resource::memory> m, std::experimental::optional<std::string> hugepages_path) {
+void configure(std::vector<resource::memory> m, std::experimental::optional<std::string> hugepages_path,
+        bool pre_touch) {
 }
 
 statistics stats() {
-    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0};
+    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0, 0, 0, 1 << 30};
+}
+
+unsigned nr_small_pools() {
+    return 0;
+}
+
+small_pool_counters small_pool_stats(unsigned idx) {
+    return small_pool_counters{0, 0, 0, 0};
 }
 
 bool drain_cross_cpu_freelist() {
@@ -1417,6 +2119,25 @@ memory_layout get_memory_layout() {
     throw std::runtime_error("get_memory_layout() not supported");
 }
 
+void dump_sampled_memory_profile(std::ostream& os) {
+    // only the seastar allocator samples allocations
+}
+
+void set_large_allocation_threshold(size_t threshold) {
+}
+
+size_t large_allocation_threshold() {
+    return 0;
+}
+
+large_alloc_stats large_allocations() {
+    return {};
+}
+
+void dump_large_allocations(std::ostream& os) {
+    // only the seastar allocator times large allocations
+}
+
 }
 
 void* operator new(size_t size, with_alignment wa) {
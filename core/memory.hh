@@ -25,6 +25,7 @@
 #include "resource.hh"
 #include <new>
 #include <functional>
+#include <iosfwd>
 #include <vector>
 
 
@@ -58,7 +59,8 @@ static constexpr size_t page_size = 1 << page_bits;       // 4K
 static constexpr size_t huge_page_size = 512 * page_size; // 2M
 
 void configure(std::vector<resource::memory> m,
-        std::experimental::optional<std::string> hugetlbfs_path = {});
+        std::experimental::optional<std::string> hugetlbfs_path = {},
+        bool pre_touch = true);
 
 void enable_abort_on_allocation_failure();
 
@@ -103,6 +105,99 @@ public:
     reclaimer_scope scope() const { return _scope; }
 };
 
+// Labels for subsystem memory accounting.  Allocations made while a
+// scoped_alloc_label is alive are attributed to its label, and
+// labeled_memory() estimates how many live bytes each label owns, so
+// we can tell how much of a shard's heap belongs to networking buffers
+// vs. the application cache.  The estimates come from the sampled
+// allocation profiler (one sample per ~1MB allocated), so labeling
+// costs nothing on the hot path; treat the numbers as accurate to a
+// few megabytes, not to the byte.
+enum class alloc_label : uint8_t {
+    other = 0,   // anything not otherwise labeled
+    network,     // networking buffers and protocol state
+    filesystem,  // file I/O buffers and metadata
+    cache,       // application caches
+    rpc,         // rpc marshalling and queues
+    app,         // for application-defined use
+    nr_labels    // not a label; number of labels
+};
+
+// Returns a fixed, human-readable name for a label ("network", ...).
+const char* alloc_label_name(alloc_label l);
+
+// Attributes allocations in the enclosing scope to a label; nests, and
+// restores the previous label on exit.
+class scoped_alloc_label {
+    alloc_label _prev;
+public:
+    explicit scoped_alloc_label(alloc_label l);
+    ~scoped_alloc_label();
+    scoped_alloc_label(const scoped_alloc_label&) = delete;
+    scoped_alloc_label& operator=(const scoped_alloc_label&) = delete;
+};
+
+// Estimated live bytes allocated under label \c l on this lcore.
+// Always zero with the default allocator.
+uint64_t labeled_memory(alloc_label l);
+
+// Coarse measure of how close this lcore is to exhausting its memory.
+enum class reclaim_pressure {
+    // plenty of free memory
+    relaxed,
+    // free memory below twice the reclaim threshold; shed what is
+    // cheap to rebuild
+    pressured,
+    // free memory below the reclaim threshold; allocation failure
+    // is imminent
+    critical,
+};
+
+// Returns the current reclaim pressure level for this lcore.
+reclaim_pressure current_reclaim_pressure();
+
+// Installs a callback invoked whenever this lcore's reclaim pressure
+// level changes, so caches can shed objects before allocations start
+// failing.  Like a sync-scope reclaimer, the callback may run
+// synchronously with an allocation, so it must be safe to call from
+// within one.
+class pressure_listener {
+public:
+    using pressure_fn = std::function<void (reclaim_pressure)>;
+private:
+    pressure_fn _notify;
+public:
+    pressure_listener(pressure_fn notify);
+    ~pressure_listener();
+    void on_change(reclaim_pressure level) { _notify(level); }
+};
+
+// Incrementally returns cached-free small objects to their spans, so
+// that fully-free spans merge back into the page lists and large
+// allocations can succeed despite earlier fragmentation.  Meant to be
+// called from the reactor's idle loop.
+//
+// Returns @true if a span was actually freed.
+bool defragment_step();
+
+// Counters kept by the NUMA placement audit; see numa_audit_step().
+struct numa_audit_stats {
+    uint64_t pages_checked;
+    uint64_t pages_misplaced;
+    uint64_t pages_moved;
+};
+
+// Snapshot of this lcore's NUMA audit counters.
+numa_audit_stats numa_audit();
+
+// Audits the next window of arena pages with move_pages(): memory is
+// mbind()ed to the shard's node with MPOL_PREFERRED, which the kernel
+// may override under memory pressure, and nothing else verifies where
+// pages actually ended up.  Misplaced pages are counted, and moved
+// back to the shard's node when \c repair is set.  A no-op without
+// NUMA support or NUMA-aware configuration.
+void numa_audit_step(bool repair);
+
 // Call periodically to recycle objects that were freed
 // on cpu other than the one they were allocated on.
 //
@@ -142,6 +237,50 @@ class statistics;
 /// Capture a snapshot of memory allocation statistics for this lcore.
 statistics stats();
 
+/// Writes this lcore's sampled allocation profile to \c os: for each
+/// sampled callsite, an estimate of the bytes it currently owns, the
+/// number of sampled live objects, and the raw backtrace.  Sampling is
+/// always on (one sample per ~1MB allocated) and cheap enough for
+/// production; call this from a REST handler or a signal handler when a
+/// shard's memory has gone missing.  With the default allocator this
+/// writes nothing.
+void dump_sampled_memory_profile(std::ostream& os);
+
+/// Number of log2 buckets in the large-allocation latency histogram:
+/// bucket 0 counts allocations that took under 1us, bucket \c i those
+/// that took between 2^(i-1) and 2^i microseconds, and the last bucket
+/// everything slower.
+static constexpr unsigned large_alloc_latency_buckets = 16;
+
+/// Counters kept by the large-allocation instrumentation; see
+/// set_large_allocation_threshold().
+struct large_alloc_stats {
+    uint64_t allocations;
+    uint64_t total_latency_us;
+    uint64_t max_latency_us;
+    uint64_t latency_hist[large_alloc_latency_buckets];
+};
+
+/// Enables timing of large contiguous allocations of at least
+/// \c threshold bytes on this lcore.  Such allocations search the free
+/// span lists and may trigger reclaim, so a single one can stall a shard
+/// for milliseconds; when enabled, each is timed and attributed to its
+/// callsite.  Disabled by default and by a threshold of zero.
+void set_large_allocation_threshold(size_t threshold);
+
+/// Returns the current large-allocation instrumentation threshold.
+size_t large_allocation_threshold();
+
+/// Snapshot of this lcore's large-allocation counters and latency
+/// histogram.  All zeros while instrumentation is disabled.
+large_alloc_stats large_allocations();
+
+/// Writes this lcore's large-allocation callsites to \c os: for each
+/// callsite, how many instrumented allocations it issued, their total
+/// and worst-case latency, and the raw backtrace.  With the default
+/// allocator this writes nothing.
+void dump_large_allocations(std::ostream& os);
+
 /// Memory allocation statistics.
 class statistics {
     uint64_t _mallocs;
@@ -150,11 +289,19 @@ class statistics {
     size_t _total_memory;
     size_t _free_memory;
     uint64_t _reclaims;
+    size_t _huge_backed_memory;
+    uint64_t _cross_cpu_free_bytes;
+    size_t _largest_free_span;
 private:
     statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees,
-            uint64_t total_memory, uint64_t free_memory, uint64_t reclaims)
+            uint64_t total_memory, uint64_t free_memory, uint64_t reclaims,
+            uint64_t huge_backed_memory, uint64_t cross_cpu_free_bytes,
+            size_t largest_free_span)
         : _mallocs(mallocs), _frees(frees), _cross_cpu_frees(cross_cpu_frees)
-        , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims) {}
+        , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims)
+        , _huge_backed_memory(huge_backed_memory)
+        , _cross_cpu_free_bytes(cross_cpu_free_bytes)
+        , _largest_free_span(largest_free_span) {}
 public:
     /// Total number of memory allocations calls since the system was started.
     uint64_t mallocs() const { return _mallocs; }
@@ -173,9 +320,45 @@ public:
     size_t total_memory() const { return _total_memory; }
     /// Number of reclaims performed due to low memory
     uint64_t reclaims() const { return _reclaims; }
+    /// Memory backed by huge pages (in bytes), as measured after the
+    /// allocator was configured; anonymous memory the kernel later
+    /// collapses or splits is not re-sampled.
+    size_t huge_backed_memory() const { return _huge_backed_memory; }
+    /// Memory backed by ordinary 4k pages (in bytes); see huge_backed_memory().
+    size_t small_backed_memory() const { return _total_memory - _huge_backed_memory; }
+    /// Total bytes freed on this lcore on behalf of other lcores; high
+    /// volume here means producer/consumer pairs straddle shards.
+    uint64_t cross_cpu_free_bytes() const { return _cross_cpu_free_bytes; }
+    /// Lower bound on the largest contiguous free span (in bytes),
+    /// derived from the free-span list occupancy, so it is accurate to
+    /// a factor of two and costs nothing to sample.
+    size_t largest_free_span() const { return _largest_free_span; }
+    /// How broken up free memory is: 0 when it forms one contiguous
+    /// span, approaching 1 when the largest span is a sliver of it.
+    /// Rising fragmentation with steady free memory predicts large
+    /// allocation failures.  Approximate; see largest_free_span().
+    double fragmentation() const {
+        return _free_memory ? 1.0 - double(_largest_free_span) / _free_memory : 0.0;
+    }
     friend statistics stats();
 };
 
+/// Number of small-object size classes; see small_pool_stats().
+unsigned nr_small_pools();
+
+/// Counters of one small-object size class.
+struct small_pool_counters {
+    unsigned object_size;   ///< bytes per object
+    uint64_t allocs;        ///< objects handed out since startup
+    uint64_t frees;         ///< objects returned since startup
+    unsigned spans_in_use;  ///< page spans currently owned by the class
+};
+
+/// Snapshot of size class \c idx (less than nr_small_pools()) for this
+/// lcore.  Cheap enough to poll; the counters sit on the allocation
+/// fast path and are merely read here.
+small_pool_counters small_pool_stats(unsigned idx);
+
 struct memory_layout {
     uintptr_t start;
     uintptr_t end;
@@ -0,0 +1,167 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "reactor.hh"
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+// A bounded lock-free multi-producer single-consumer queue.
+//
+// smp_message_queue's rings are strictly single-producer, so
+// many-shards-to-one flows (log aggregation, metrics collection) need
+// N SPSC queues and N pollers on the consuming shard.  mpsc_queue is
+// one ring that any shard may push() into; only the owning shard may
+// consume().
+//
+// The algorithm is the well-known bounded queue of Dmitry Vyukov: each
+// cell carries a sequence number which tells producers whether the
+// cell is free and the consumer whether it is filled, so producers
+// only contend on one counter and the consumer is entirely wait-free.
+//
+// push() never blocks; it returns false when the ring is full and the
+// producer is expected to drop or retry later (for reliable delivery
+// with backpressure, use smp::submit_to()).  The consumer drains in
+// batches with consume(), amortizing the cache misses on the cells.
+//
+// Wakeup follows the smp_message_queue protocol: when a consumer
+// reactor is attached, a producer that finds it sleeping on its
+// eventfd wakes it, and stays silent while the consumer is running --
+// a busy consumer absorbs entire batches with no signaling at all.
+template <typename T>
+class mpsc_queue {
+    struct cell {
+        std::atomic<size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+    std::unique_ptr<cell[]> _cells;
+    size_t _mask;
+    reactor* _consumer;
+    // producers share this counter; keep it off the consumer's lines
+    alignas(64) std::atomic<size_t> _enqueue_pos = { 0 };
+    // consumer-only
+    alignas(64) size_t _dequeue_pos = 0;
+public:
+    // capacity is rounded up to a power of two.  consumer, if given,
+    // is the reactor to wake when items arrive while it sleeps; it
+    // must outlive the queue.
+    explicit mpsc_queue(size_t capacity, reactor* consumer = nullptr)
+            : _consumer(consumer) {
+        auto n = size_t(2);
+        while (n < capacity) {
+            n *= 2;
+        }
+        _cells = std::make_unique<cell[]>(n);
+        _mask = n - 1;
+        for (size_t i = 0; i != n; i++) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    mpsc_queue(const mpsc_queue&) = delete;
+    mpsc_queue& operator=(const mpsc_queue&) = delete;
+    ~mpsc_queue() {
+        consume([] (T&&) {});
+    }
+
+    size_t capacity() const {
+        return _mask + 1;
+    }
+
+    // Pushes an item from any thread; returns false if the queue is
+    // full (the item is left untouched in that case).
+    bool push(T item) {
+        cell* c;
+        auto pos = _enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &_cells[pos & _mask];
+            auto seq = c->sequence.load(std::memory_order_acquire);
+            auto diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0) {
+                // free cell; claim it
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // the consumer has not vacated this cell yet
+                return false;
+            } else {
+                // another producer claimed it; reload and retry
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        new (&c->storage) T(std::move(item));
+        c->sequence.store(pos + 1, std::memory_order_release);
+        maybe_wakeup();
+        return true;
+    }
+
+    // Pops up to max_items items, passing each to func as an rvalue;
+    // returns the number consumed.  May only be called from the
+    // consuming thread.
+    template <typename Func>
+    size_t consume(Func&& func,
+            size_t max_items = std::numeric_limits<size_t>::max()) {
+        size_t done = 0;
+        while (done != max_items) {
+            auto& c = _cells[_dequeue_pos & _mask];
+            auto seq = c.sequence.load(std::memory_order_acquire);
+            if (intptr_t(seq) != intptr_t(_dequeue_pos + 1)) {
+                break; // not filled yet
+            }
+            auto p = reinterpret_cast<T*>(&c.storage);
+            func(std::move(*p));
+            p->~T();
+            // mark the cell free for the producer one lap ahead
+            c.sequence.store(_dequeue_pos + _mask + 1, std::memory_order_release);
+            ++_dequeue_pos;
+            ++done;
+        }
+        return done;
+    }
+
+    // May only be called from the consuming thread.
+    bool empty() const {
+        auto& c = _cells[_dequeue_pos & _mask];
+        return intptr_t(c.sequence.load(std::memory_order_acquire))
+                != intptr_t(_dequeue_pos + 1);
+    }
+private:
+    void maybe_wakeup() {
+        if (!_consumer) {
+            return;
+        }
+        // Read-after-write: the sequence store above must be visible
+        // before we read _sleeping.  As in smp_message_queue, the
+        // real barrier is provided by systemwide_memory_barrier()
+        // when the consumer goes to sleep; we only need to stop the
+        // compiler from reordering:
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (_consumer->_sleeping.load(std::memory_order_relaxed)) {
+            _consumer->_sleeping.store(false, std::memory_order_relaxed);
+            _consumer->wakeup();
+        }
+    }
+};
@@ -0,0 +1,93 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include <boost/intrusive/list.hpp>
+#include <boost/intrusive/set.hpp>
+#include <boost/intrusive/options.hpp>
+
+// Objects indexed by several intrusive containers at once - a cache
+// item is typically in a hash table, an expiration structure and an
+// LRU list - declare one hook member per container.  Written as
+// ordinary members, the hooks land wherever the class layout puts
+// them, usually spread over several cache lines, so every link,
+// unlink and list walk touches that many lines of the object.
+//
+// packed_hooks<> gathers the hooks into one contiguous base-class
+// block at the very front of the object, so all of an object's
+// intrusive state shares as few cache lines as the hook sizes allow
+// (three doubly-linked hooks fit in one), and eviction - which must
+// unlink from every index - becomes a single-line operation.
+//
+// Usage: give each hook a distinct tag and derive from packed_hooks:
+//
+//     struct hash_tag {}; struct timer_tag {}; struct lru_tag {};
+//     class item : public packed_hooks<packed_set_hook<hash_tag>,
+//                                      packed_list_hook<timer_tag>,
+//                                      packed_list_hook<lru_tag>> {
+//         ...
+//     };
+//     using lru_list = boost::intrusive::list<item,
+//             boost::intrusive::base_hook<packed_list_hook<lru_tag>>,
+//             boost::intrusive::constant_time_size<false>>;
+//
+// The hook aliases below use auto_unlink mode, which unlink_all()
+// requires; containers over auto_unlink hooks must be declared with
+// constant_time_size<false> (as above).  Arbitrary tagged hooks can
+// be used instead if bulk unlink is not needed.
+//
+// See tests/perf/perf_packed_hooks.cc for the measured layout impact.
+
+template <typename Tag>
+using packed_list_hook = boost::intrusive::list_base_hook<
+        boost::intrusive::tag<Tag>,
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+
+template <typename Tag>
+using packed_set_hook = boost::intrusive::set_base_hook<
+        boost::intrusive::tag<Tag>,
+        boost::intrusive::link_mode<boost::intrusive::auto_unlink>>;
+
+template <typename... Hooks>
+class packed_hooks : public Hooks... {
+    static void do_unlink() {}
+    template <typename Hook, typename... Rest>
+    static void do_unlink(Hook* hook, Rest*... rest) {
+        hook->unlink();
+        do_unlink(rest...);
+    }
+    static bool do_is_linked() { return false; }
+    template <typename Hook, typename... Rest>
+    static bool do_is_linked(const Hook* hook, const Rest*... rest) {
+        return hook->is_linked() || do_is_linked(rest...);
+    }
+public:
+    // Unlinks this object from every container it is linked in; a
+    // no-op for hooks that are not currently linked.
+    void unlink_all() {
+        do_unlink(static_cast<Hooks*>(this)...);
+    }
+    // True if any container still links this object.
+    bool is_linked_any() const {
+        return do_is_linked(static_cast<const Hooks*>(this)...);
+    }
+};
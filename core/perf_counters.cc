@@ -0,0 +1,107 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "perf_counters.hh"
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static int
+perf_event_open(perf_event_attr* attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+    return ::syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+bool
+perf_counters::open() {
+    static constexpr uint64_t configs[nr_counters] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    for (unsigned i = 0; i < nr_counters; i++) {
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = i == 0;      // start the whole group at once below
+        attr.exclude_kernel = 0;
+        attr.exclude_hv = 1;
+        // pid 0, cpu -1: this thread, wherever it runs
+        auto fd = perf_event_open(&attr, 0, -1, _fds[0], 0);
+        if (fd < 0) {
+            close();
+            return false;
+        }
+        _fds[i] = fd;
+    }
+    ::ioctl(_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    read_group(_last);
+    return true;
+}
+
+void
+perf_counters::close() {
+    for (auto& fd : _fds) {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+}
+
+perf_counters::~perf_counters() {
+    close();
+}
+
+void
+perf_counters::read_group(reading& out) {
+    // PERF_FORMAT_GROUP read layout: nr followed by one value per counter
+    struct {
+        uint64_t nr;
+        uint64_t values[nr_counters];
+    } buf;
+    auto r = ::read(_fds[0], &buf, sizeof(buf));
+    if (r != sizeof(buf) || buf.nr != nr_counters) {
+        out = _last;   // yields a zero delta rather than garbage
+        return;
+    }
+    out.cycles = buf.values[0];
+    out.instructions = buf.values[1];
+    out.cache_misses = buf.values[2];
+    out.branch_misses = buf.values[3];
+}
+
+void
+perf_counters::really_switch_phase(phase p) {
+    reading now;
+    read_group(now);
+    auto& t = _totals[unsigned(_current)];
+    t.cycles += now.cycles - _last.cycles;
+    t.instructions += now.instructions - _last.instructions;
+    t.cache_misses += now.cache_misses - _last.cache_misses;
+    t.branch_misses += now.branch_misses - _last.branch_misses;
+    _last = now;
+    _current = p;
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+/// \brief Per-shard CPU performance counter (PMU) readings.
+///
+/// Each shard can open a perf_event group counting cycles,
+/// instructions, LLC misses and branch misses for its own thread, and
+/// charge the deltas to whichever phase of the event loop is running:
+/// executing tasks, running the pollers, or idling.  External "perf
+/// stat" can only show the process total; this keeps the attribution
+/// per shard and per phase, which is what an IPC collapse investigation
+/// needs.
+///
+/// The facility is off by default (enable with --cpu-perf-counters);
+/// when off, a phase switch is an inline comparison.  When the kernel
+/// refuses the counters (perf_event_paranoid, missing PMU in a VM) the
+/// facility stays off and every reading is zero.
+class perf_counters {
+public:
+    enum class phase { tasks, pollers, idle };
+    static constexpr unsigned nr_phases = 3;
+    struct reading {
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t cache_misses = 0;
+        uint64_t branch_misses = 0;
+    };
+private:
+    static constexpr unsigned nr_counters = 4;
+    std::array<int, nr_counters> _fds = { { -1, -1, -1, -1 } };
+    phase _current = phase::idle;
+    reading _last;
+    std::array<reading, nr_phases> _totals;
+public:
+    ~perf_counters();
+    /// Opens the counter group for the calling thread.  Returns false,
+    /// leaving the facility disabled, if the kernel refuses.
+    bool open();
+    void close();
+    bool enabled() const {
+        return _fds[0] >= 0;
+    }
+    /// Charges the counts since the previous switch to the phase that
+    /// was running and starts attributing to \c p.  One read() system
+    /// call when enabled, an inline comparison when not.
+    void switch_phase(phase p) {
+        if (_fds[0] < 0 || p == _current) {
+            return;
+        }
+        really_switch_phase(p);
+    }
+    /// Accumulated counts charged to \c p so far.
+    const reading& total(phase p) const {
+        return _totals[unsigned(p)];
+    }
+private:
+    void read_group(reading& out);
+    void really_switch_phase(phase p);
+};
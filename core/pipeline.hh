@@ -0,0 +1,265 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "reactor.hh"
+#include "queue.hh"
+#include "future-util.hh"
+#include "shared_ptr.hh"
+#include "scollectd.hh"
+
+#include <experimental/optional>
+
+namespace seastar {
+
+/// \addtogroup fiber-module
+/// @{
+
+/// Statistics for one pipeline stage, summed over its shards.
+struct pipeline_stage_stats {
+    uint64_t received = 0;   ///< items accepted into the stage's queues
+    uint64_t processed = 0;  ///< items the worker finished with
+    size_t queued = 0;       ///< items currently waiting in the queues
+};
+
+/// A stage of a multi-shard processing pipeline.
+///
+/// Multi-stage processing (parse -> index -> store) is usually built by
+/// hand from submit_to() chains and ad-hoc queues; this class is that
+/// scaffolding, once.  A stage owns a bounded \ref queue on each shard
+/// of its shard set and a worker fiber per shard draining it.  Items
+/// are offered from any shard, spread round-robin over the stage's
+/// shards, and handed off in batches so a busy producer does not pay
+/// one smp message per item.  When a stage's queues fill up, offer()'s
+/// future stalls -- backpressure propagates to the producing stage
+/// naturally if it waits for offer() before taking more input.
+///
+/// Stages are chained by the workers themselves, which keeps each
+/// stage's item type independent.  Build sink-first, start downstream
+/// stages first, and close from the source down:
+///
+///     auto store = seastar::make_pipeline_stage<record>("store", {2, 3}, 128,
+///             [&db] (record r) { return db.add(std::move(r)); });
+///     auto parse = seastar::make_pipeline_stage<packet>("parse", {0, 1}, 128,
+///             [store = &*store] (packet p) {
+///         return store->offer(parse_packet(std::move(p)));
+///     });
+///
+/// The stage object is created and destroyed on one shard and must stay
+/// alive until close() resolves; cross-shard code (like the capture
+/// above) uses a plain pointer.  The worker may be invoked concurrently
+/// on all of the stage's shards.  An exception escaping the worker
+/// stops that shard's fiber and surfaces from close(); workers that
+/// should survive bad items must catch their own errors.
+template <typename In>
+class pipeline_stage {
+public:
+    static constexpr size_t default_queue_depth = 128;
+    // producer-side handoff batch; one smp message moves this many items
+    static constexpr size_t handoff_batch = 16;
+private:
+    using maybe_item = std::experimental::optional<In>;
+    struct shard_state {
+        queue<maybe_item> q;
+        uint64_t received = 0;
+        uint64_t processed = 0;
+        future<> done = make_ready_future<>();
+        std::vector<scollectd::registration> collectd_regs;
+        explicit shard_state(size_t depth) : q(depth) {}
+    };
+    struct outbox {
+        std::vector<In> items;
+    };
+    // touched only by its own shard
+    struct producer_state {
+        std::vector<outbox> outboxes;  // one per consumer shard
+        unsigned rr = 0;               // round-robin cursor
+        bool flush_scheduled = false;
+    };
+    sstring _name;
+    std::vector<unsigned> _shards;
+    size_t _depth;
+    std::function<future<> (In)> _worker;
+    std::vector<std::unique_ptr<shard_state>> _states;     // indexed by cpu
+    std::vector<producer_state> _producers;                // indexed by cpu
+public:
+    /// \param name used in the stage's collectd metrics.
+    /// \param shards the shards this stage's workers run on.
+    /// \param depth bound of each per-shard queue.
+    /// \param worker `future<> (In)`, invoked per item on the owning shard.
+    pipeline_stage(sstring name, std::vector<unsigned> shards, size_t depth,
+            std::function<future<> (In)> worker)
+        : _name(std::move(name))
+        , _shards(std::move(shards))
+        , _depth(depth)
+        , _worker(std::move(worker))
+        , _states(smp::count)
+        , _producers(smp::count) {
+        assert(!_shards.empty());
+        for (auto&& p : _producers) {
+            p.outboxes.resize(_shards.size());
+        }
+    }
+
+    /// Creates the queues and starts the worker fiber on each of the
+    /// stage's shards.  Call once, before the first offer().
+    future<> start() {
+        return parallel_for_each(_shards, [this] (unsigned cpu) {
+            return smp::submit_to(cpu, [this] {
+                auto& entry = _states[engine().cpu_id()];
+                entry = std::make_unique<shard_state>(_depth);
+                auto& st = *entry;
+                st.collectd_regs = scollectd::registrations({
+                    scollectd::add_polled_metric(scollectd::type_instance_id("pipeline"
+                            , scollectd::per_cpu_plugin_instance
+                            , "total_operations", _name + "-received")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, st.received)
+                    ),
+                    scollectd::add_polled_metric(scollectd::type_instance_id("pipeline"
+                            , scollectd::per_cpu_plugin_instance
+                            , "total_operations", _name + "-processed")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, st.processed)
+                    ),
+                    scollectd::add_polled_metric(scollectd::type_instance_id("pipeline"
+                            , scollectd::per_cpu_plugin_instance
+                            , "queue_length", _name)
+                    , scollectd::make_typed(scollectd::data_type::GAUGE,
+                            [&st] { return st.q.size(); })
+                    ),
+                });
+                st.done = repeat([this, &st] {
+                    return st.q.pop_eventually().then([this, &st] (maybe_item item) {
+                        if (!item) {
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        return _worker(std::move(*item)).then([&st] {
+                            st.processed++;
+                            return stop_iteration::no;
+                        });
+                    });
+                });
+            });
+        });
+    }
+
+    /// Offers an item to the stage, from any shard.  The returned
+    /// future is ready while the item merely joins a partial batch, and
+    /// stalls once a batch must be shipped and the target queue is
+    /// full; producers that wait for it get backpressure at batch
+    /// granularity.
+    future<> offer(In item) {
+        auto& p = _producers[engine().cpu_id()];
+        auto target = p.rr++ % _shards.size();
+        auto& ob = p.outboxes[target];
+        ob.items.push_back(std::move(item));
+        if (ob.items.size() >= handoff_batch) {
+            return flush_outbox(target);
+        }
+        if (!p.flush_scheduled) {
+            p.flush_scheduled = true;
+            // drain leftovers once the tasks currently queued have run,
+            // so a trickling producer does not strand a partial batch
+            schedule(make_task([this] {
+                auto& p = _producers[engine().cpu_id()];
+                p.flush_scheduled = false;
+                flush();
+            }));
+        }
+        return make_ready_future<>();
+    }
+
+    /// Ships this shard's partial batches; resolves when the stage's
+    /// queues accepted them.
+    future<> flush() {
+        auto& p = _producers[engine().cpu_id()];
+        return parallel_for_each(boost::irange<size_t>(0, p.outboxes.size()), [this, &p] (size_t i) {
+            if (p.outboxes[i].items.empty()) {
+                return make_ready_future<>();
+            }
+            return flush_outbox(i);
+        });
+    }
+
+    /// Flushes every shard's outboxes, sends end-of-stream to each
+    /// worker fiber and waits for the queues to drain.  Call exactly
+    /// once, after all producers have stopped offering.
+    future<> close() {
+        return smp::invoke_on_all([this] {
+            return flush();
+        }).then([this] {
+            return parallel_for_each(_shards, [this] (unsigned cpu) {
+                return smp::submit_to(cpu, [this] {
+                    auto& st = *_states[engine().cpu_id()];
+                    return st.q.push_eventually(maybe_item()).then([&st] {
+                        return std::move(st.done);
+                    });
+                });
+            });
+        });
+    }
+
+    /// Returns this stage's counters, summed over its shards.
+    future<pipeline_stage_stats> stats() {
+        return ::map_reduce(_shards.begin(), _shards.end(), [this] (unsigned cpu) {
+            return smp::submit_to(cpu, [this] {
+                auto& st = *_states[engine().cpu_id()];
+                return pipeline_stage_stats{st.received, st.processed, st.q.size()};
+            });
+        }, pipeline_stage_stats(),
+                [] (pipeline_stage_stats a, pipeline_stage_stats b) {
+            a.received += b.received;
+            a.processed += b.processed;
+            a.queued += b.queued;
+            return a;
+        });
+    }
+private:
+    future<> flush_outbox(size_t target) {
+        auto& ob = _producers[engine().cpu_id()].outboxes[target];
+        auto batch = std::move(ob.items);
+        ob.items.clear();
+        return smp::submit_to(_shards[target], [this, batch = std::move(batch)] () mutable {
+            auto& st = *_states[engine().cpu_id()];
+            st.received += batch.size();
+            return do_with(std::move(batch), [&st] (std::vector<In>& batch) {
+                return do_for_each(batch, [&st] (In& item) {
+                    return st.q.push_eventually(maybe_item(std::move(item)));
+                });
+            });
+        });
+    }
+};
+
+/// Creates a \ref pipeline_stage.  The stage must be kept alive on the
+/// creating shard until close() resolves.
+///
+/// \relates pipeline_stage
+template <typename In, typename Func>
+lw_shared_ptr<pipeline_stage<In>>
+make_pipeline_stage(sstring name, std::vector<unsigned> shards, size_t depth, Func worker) {
+    return ::make_lw_shared<pipeline_stage<In>>(std::move(name), std::move(shards),
+            depth, std::function<future<> (In)>(std::move(worker)));
+}
+
+/// @}
+
+}
@@ -35,6 +35,10 @@
 #include <sys/socket.h>
 #include <sys/epoll.h>
 #include <sys/mman.h>
+#ifdef HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
 #include <signal.h>
 #include <system_error>
 #include <boost/optional.hpp>
@@ -43,6 +47,14 @@
 #include <memory>
 #include "net/api.hh"
 
+// Not yet present in all the kernel headers we build against
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
 inline void throw_system_error_on(bool condition, const char* what_arg = "");
 
 template <typename T>
@@ -96,6 +108,13 @@ public:
         throw_system_error_on(fd == -1, "eventfd");
         return file_desc(fd);
     }
+#ifdef HAVE_URING
+    static file_desc io_uring_setup(unsigned entries, struct ::io_uring_params* params) {
+        int fd = ::syscall(__NR_io_uring_setup, entries, params);
+        throw_system_error_on(fd == -1, "io_uring_setup");
+        return file_desc(fd);
+    }
+#endif
     static file_desc epoll_create(int flags = 0) {
         int fd = ::epoll_create1(flags);
         throw_system_error_on(fd == -1, "epoll_create1");
@@ -106,6 +125,12 @@ public:
         throw_system_error_on(fd == -1, "timerfd_create");
         return file_desc(fd);
     }
+    static std::pair<file_desc, file_desc> pipe(int flags = 0) {
+        int fds[2];
+        int r = ::pipe2(fds, flags);
+        throw_system_error_on(r == -1, "pipe2");
+        return { file_desc(fds[0]), file_desc(fds[1]) };
+    }
     static file_desc temporary(sstring directory);
     file_desc dup() const {
         int fd = ::dup(get());
@@ -117,6 +142,14 @@ public:
         throw_system_error_on(ret == -1, "accept4");
         return file_desc(ret);
     }
+    boost::optional<file_desc> try_accept(sockaddr& sa, socklen_t& sl, int flags = 0) {
+        auto ret = ::accept4(_fd, &sa, &sl, flags);
+        if (ret == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(ret == -1, "accept4");
+        return file_desc(ret);
+    }
     void shutdown(int how) {
         auto ret = ::shutdown(_fd, how);
         if (ret == -1 && errno != ENOTCONN) {
@@ -231,6 +264,30 @@ public:
         throw_system_error_on(r == -1, "sendmsg");
         return { size_t(r) };
     }
+    boost::optional<size_t> recvmmsg(mmsghdr* mmsg, unsigned vlen, int flags) {
+        auto r = ::recvmmsg(_fd, mmsg, vlen, flags, nullptr);
+        if (r == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(r == -1, "recvmmsg");
+        return { size_t(r) };
+    }
+    boost::optional<size_t> splice_to(file_desc& out, size_t len, unsigned flags) {
+        auto r = ::splice(_fd, nullptr, out._fd, nullptr, len, flags);
+        if (r == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(r == -1, "splice");
+        return { size_t(r) };
+    }
+    boost::optional<size_t> sendmmsg(mmsghdr* mmsg, unsigned vlen, int flags) {
+        auto r = ::sendmmsg(_fd, mmsg, vlen, flags);
+        if (r == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(r == -1, "sendmmsg");
+        return { size_t(r) };
+    }
     void bind(sockaddr& sa, socklen_t sl) {
         auto r = ::bind(_fd, &sa, sl);
         throw_system_error_on(r == -1, "bind");
@@ -249,6 +306,13 @@ public:
         throw_system_error_on(r == -1, "getsockname");
         return addr;
     }
+    socket_address get_remote_address() {
+        socket_address addr;
+        auto len = (socklen_t) sizeof(addr.u.sas);
+        auto r = ::getpeername(_fd, &addr.u.sa, &len);
+        throw_system_error_on(r == -1, "getpeername");
+        return addr;
+    }
     void listen(int backlog) {
         auto fd = ::listen(_fd, backlog);
         throw_system_error_on(fd == -1, "listen");
@@ -22,13 +22,14 @@
 #pragma once
 #include <atomic>
 
-extern __thread bool g_need_preempt;
+extern __thread std::atomic<bool> g_need_preempt;
 
 inline bool need_preempt() {
 #ifndef DEBUG
-    // prevent compiler from eliminating loads in a loop
-    std::atomic_signal_fence(std::memory_order_seq_cst);
-    return g_need_preempt;
+    // a single relaxed load; the only writers are this thread itself and
+    // the task quota timer's signal handler, which runs on this thread,
+    // so no ordering is required, just immunity from hoisting out of loops
+    return g_need_preempt.load(std::memory_order_relaxed);
 #else
     return true;
 #endif
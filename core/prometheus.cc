@@ -58,8 +58,54 @@ static sstring collectd_name(const scollectd::type_instance_id & id, uint32_t cp
     return id.plugin() + ":" + id.type() + ":" + id.type_instance() + ":" + to_sstring(cpu);
 }
 
+// The name and help text of a series never change, but rendering them
+// is most of the per-series work on a scrape.  Cache a MetricFamily
+// per series with the static fields filled in; each scrape only adds
+// the current values, serializes, and clears them again.  The cache
+// is bounded by the number of registered series.
+static thread_local std::map<std::pair<uint32_t, scollectd::type_instance_id>,
+        pm::MetricFamily> family_cache;
+
+static pm::MetricFamily& get_family(uint32_t cpu,
+        const scollectd::type_instance_id& id, const sstring& help) {
+    auto key = std::make_pair(cpu, id);
+    auto it = family_cache.find(key);
+    if (it == family_cache.end()) {
+        it = family_cache.emplace(std::move(key), pm::MetricFamily()).first;
+        it->second.set_name(collectd_name(id, cpu));
+        it->second.set_help(help);
+    }
+    return it->second;
+}
+
+
+// A histogram value list carries the sample count, the sample sum and
+// one counter per bucket, in that order.  The bucket bounds are a pure
+// function of the bucket index, so they are recovered here rather than
+// shipped with every sample.
+static void fill_histogram(pm::MetricFamily& mf, const std::vector<scollectd::collectd_value>& vals) {
+    auto h = mf.add_metric()->mutable_histogram();
+    h->set_sample_count(vals[0].ui());
+    h->set_sample_sum(vals[1].ui());
+    uint64_t cumulative = 0;
+    for (size_t i = 2; i < vals.size(); i++) {
+        auto count = vals[i].ui();
+        if (!count) {
+            continue;
+        }
+        cumulative += count;
+        auto b = h->add_bucket();
+        b->set_cumulative_count(cumulative);
+        b->set_upper_bound(seastar::histogram::bucket_upper_bound(i - 2));
+    }
+    mf.set_type(pm::MetricType::HISTOGRAM);
+}
 
 static void fill_metric(pm::MetricFamily& mf, const std::vector<scollectd::collectd_value>& vals) {
+    if (!vals.empty() && vals[0].type() == scollectd::data_type::HISTOGRAM) {
+        fill_histogram(mf, vals);
+        return;
+    }
     for (const scollectd::collectd_value& c : vals) {
         switch (c.type()) {
         case scollectd::data_type::DERIVE:
@@ -81,37 +127,39 @@ static void fill_metric(pm::MetricFamily& mf, const std::vector<scollectd::colle
 future<> start(httpd::http_server_control& http_server, const config& ctx) {
     return http_server.set_routes([&ctx](httpd::routes& r) {
         httpd::future_handler_function f = [&ctx](std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
-            return do_with(std::vector<scollectd::value_map>(), [rep = std::move(rep), &ctx] (auto& vec) mutable {
-                vec.resize(smp::count);
-                return parallel_for_each(boost::irange(0u, smp::count), [&vec] (auto cpu) {
-                    return smp::submit_to(cpu, [] {
-                        return scollectd::get_value_map();
-                    }).then([&vec, cpu] (auto res) {
-                        vec[cpu] = res;
-                    });
-                }).then([rep = std::move(rep), &vec, &ctx]() mutable {
-                    uint32_t cpu = 0;
-                    for (auto value: vec) {
-                        cpu++;
-                        for (auto i : value) {
-                            pm::MetricFamily mtf;
+            // Stream the metrics one cpu at a time rather than
+            // materializing all of them in the reply; the peak
+            // footprint is one cpu's families, not the whole node's.
+            rep->write_body("proto", [&ctx](output_stream<char>& out) {
+                return do_with(std::vector<scollectd::value_map>(), [&out, &ctx] (auto& vec) {
+                    vec.resize(smp::count);
+                    return parallel_for_each(boost::irange(0u, smp::count), [&vec] (auto cpu) {
+                        return smp::submit_to(cpu, [] {
+                            return scollectd::get_value_map();
+                        }).then([&vec, cpu] (auto res) {
+                            vec[cpu] = res;
+                        });
+                    }).then([&out, &vec, &ctx] {
+                        auto cpus = boost::irange(0u, smp::count);
+                        return do_for_each(cpus.begin(), cpus.end(), [&out, &vec, &ctx] (auto cpu) {
                             std::string s;
                             google::protobuf::io::StringOutputStream os(&s);
-                            mtf.set_name(collectd_name(i.first, cpu));
-                            mtf.set_help(ctx.metric_help);
-                            fill_metric(mtf, i.second);
-                            if (mtf.metric_size() > 0) {
-                                std::stringstream ss;
-                                if (!write_delimited_to(mtf, &os)) {
-                                    seastar_logger.warn("Failed to write protobuf metrics");
+                            for (auto& i : vec[cpu]) {
+                                auto& mtf = get_family(cpu + 1, i.first, ctx.metric_help);
+                                fill_metric(mtf, i.second);
+                                if (mtf.metric_size() > 0) {
+                                    if (!write_delimited_to(mtf, &os)) {
+                                        seastar_logger.warn("Failed to write protobuf metrics");
+                                    }
                                 }
-                                rep->_content += s;
+                                mtf.clear_metric();
                             }
-                        }
-                    }
-                    return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+                            return out.write(s.data(), s.size());
+                        });
+                    });
                 });
             });
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
         };
         r.put(GET, "/metrics", new httpd::function_handler(f, "proto"));
     });
@@ -45,6 +45,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/eventfd.h>
+#include <netinet/tcp.h>
 #include <boost/filesystem.hpp>
 #include <boost/thread/barrier.hpp>
 #include <boost/algorithm/string/classification.hpp>
@@ -55,6 +56,10 @@
 #include <boost/version.hpp>
 #include <atomic>
 #include <dirent.h>
+#include <execinfo.h>
+#include <thread>
+#include "cpu_profiler.hh"
+#include "instrumentation.hh"
 #include <linux/types.h> // for xfs, below
 #include <sys/ioctl.h>
 #include <xfs/linux.h>
@@ -154,6 +159,15 @@ wrap_syscall(int result, const Extra& extra) {
     return {result, extra, errno};
 }
 
+int reactor_backend::submit_io(io_context_t io_context, iocb** iocbs, size_t nr) {
+    return ::io_submit(io_context, nr, iocbs);
+}
+
+int reactor_backend::getevents(io_context_t io_context, io_event* ev, size_t max) {
+    struct timespec timeout = {0, 0};
+    return ::io_getevents(io_context, 1, max, ev, &timeout);
+}
+
 reactor_backend_epoll::reactor_backend_epoll()
     : _epollfd(file_desc::epoll_create(EPOLL_CLOEXEC)) {
 }
@@ -227,12 +241,19 @@ inline int task_quota_signal() {
     return SIGRTMIN + 1;
 }
 
+inline int stall_signal() {
+    // SIGRTMIN + 2 belongs to the cpu profiler
+    return SIGRTMIN + 3;
+}
+
 reactor::reactor()
-    : _backend()
 #ifdef HAVE_OSV
+    : _backend(std::make_unique<reactor_backend_osv>())
     , _timer_thread(
         [&] { timer_thread_func(); }, sched::thread::attr().stack(4096).name("timer_thread").pin(sched::cpu::current()))
     , _engine_thread(sched::thread::current())
+#else
+    : _backend(std::make_unique<reactor_backend_epoll>())
 #endif
     , _cpu_started(0)
     , _io_context(0)
@@ -240,6 +261,7 @@ reactor::reactor()
     , _reuseport(posix_reuseport_detect()) {
 
     seastar::thread_impl::init();
+    _task_queues.push_back(std::make_unique<task_queue>("main", 1000));
     auto r = ::io_setup(max_aio, &_io_context);
     assert(r >= 0);
 #ifdef HAVE_OSV
@@ -286,7 +308,22 @@ reactor::~reactor() {
 
 void
 reactor::clear_task_quota(int) {
-    g_need_preempt = true;
+    g_need_preempt.store(true, std::memory_order_relaxed);
+}
+
+void
+reactor::stall_signal_handler(int) {
+    // sent by the watchdog thread (smp::start_watchdog()), so we land
+    // right in the middle of whatever has been hogging the shard
+    auto& r = engine();
+    if (r._stall_depth.load(std::memory_order_relaxed) != 0) {
+        // previous capture not consumed yet
+        return;
+    }
+    // safe for the same reason as in cpu_profiler: run() warmed up
+    // the unwinder, so backtrace() no longer allocates
+    auto n = ::backtrace(r._stall_frames, max_stall_backtrace_depth);
+    r._stall_depth.store(n > 0 ? n : 0, std::memory_order_release);
 }
 
 template <typename T, typename E, typename EnableFunc>
@@ -327,7 +364,7 @@ void reactor::timer_thread_func() {
                 if (tmr.expired()) {
                     _timer_due = 0;
                     _engine_thread->unsafe_stop();
-                    _pending_tasks.push_front(make_task([this] {
+                    _task_queues[0]->tasks.push_front(make_task([this] {
                         complete_timers(_timers, _expired_timers, [this] {
                             if (!_timers.empty()) {
                                 enable_timer(_timers.get_next_timeout());
@@ -381,15 +418,52 @@ public:
 };
 
 void reactor::configure(boost::program_options::variables_map vm) {
-    auto network_stack_ready = vm.count("network-stack")
-        ? network_stack_registry::create(sstring(vm["network-stack"].as<std::string>()), vm)
-        : network_stack_registry::create(vm);
-    network_stack_ready.then([this] (std::unique_ptr<network_stack> stack) {
-        _network_stack_ready_promise.set_value(std::move(stack));
-    });
+#if defined(HAVE_URING) && !defined(HAVE_OSV)
+    if (vm["reactor-backend"].as<std::string>() == "io_uring") {
+        if (reactor_backend_uring::available()) {
+            // Safe to replace here: no file descriptor has been registered
+            // with the epoll backend yet.
+            _backend = std::make_unique<reactor_backend_uring>();
+        } else {
+            print("reactor: io_uring not supported by this kernel, falling back to epoll\n");
+        }
+    }
+#endif
+    // Must be settled before the network stack is created below; the posix
+    // stack captures it in its constructor.
+    _reuseport = _reuseport && vm["reuseport"].as<bool>();
+    if (vm.count("io-queue-mountpoint")) {
+        for (auto& opt : vm["io-queue-mountpoint"].as<std::vector<std::string>>()) {
+            auto pos = opt.rfind(':');
+            if (pos == std::string::npos) {
+                throw std::runtime_error("--io-queue-mountpoint expects <mountpoint>:<max-requests>");
+            }
+            auto path = opt.substr(0, pos);
+            auto capacity = unsigned(std::stoul(opt.substr(pos + 1)));
+            struct stat st;
+            auto r = ::stat(path.c_str(), &st);
+            throw_system_error_on(r == -1, "stat");
+            _io_queue_capacities[st.st_dev] = capacity;
+        }
+    }
+    _io_trace_enabled = vm.count("io-trace");
+    if (vm.count("no-network-stack")) {
+        // run() starts the engine with a null stack; anything touching
+        // engine().net() will crash, as the option help warns
+        _network_stack_ready_promise.set_value(nullptr);
+    } else {
+        auto network_stack_ready = vm.count("network-stack")
+            ? network_stack_registry::create(sstring(vm["network-stack"].as<std::string>()), vm)
+            : network_stack_registry::create(vm);
+        network_stack_ready.then([this] (std::unique_ptr<network_stack> stack) {
+            _network_stack_ready_promise.set_value(std::move(stack));
+        });
+    }
 
     _handle_sigint = !vm.count("no-handle-interrupt");
+    net::flow_metrics::local().set_enabled(vm["net-flow-metrics"].as<bool>());
     _task_quota = vm["task-quota-ms"].as<double>() * 1ms;
+    _stall_detector_enabled = vm["blocked-reactor-notify-ms"].as<unsigned>() != 0;
     _max_task_backlog = vm["max-task-backlog"].as<unsigned>();
     _max_poll_time = vm["idle-poll-time-us"].as<unsigned>() * 1us;
     if (vm.count("poll-mode")) {
@@ -400,6 +474,47 @@ void reactor::configure(boost::program_options::variables_map vm) {
            && !vm.count("poll-mode")) {
         _max_poll_time = 0us;
     }
+    // in poll mode we never sleep, so there is nothing to govern
+    _adaptive_idle_poll = vm["idle-poll-governor"].as<bool>() && !vm.count("poll-mode");
+    _poll_dwell = _max_poll_time;
+    _timers.set_slack(std::chrono::duration_cast<steady_clock_type::duration>(
+            vm["timer-slack-us"].as<unsigned>() * 1us));
+    _max_aio_batch = std::min<size_t>(vm["max-io-batch"].as<unsigned>(), max_aio);
+#ifndef HAVE_OSV
+    _thread_pool.set_size(std::max(vm["blocked-syscall-threads"].as<unsigned>(), 1u));
+#endif
+    _numa_audit_repair = vm["numa-audit-repair"].as<bool>();
+    if (vm["cpu-perf-counters"].as<bool>()) {
+        if (!_perf_counters.open()) {
+            seastar_logger.warn("could not open CPU performance counters;"
+                    " check /proc/sys/kernel/perf_event_paranoid");
+        }
+    }
+    memory::set_large_allocation_threshold(vm["large-allocation-threshold"].as<size_t>());
+    // name the per-shard instrumentation flags so they can be flipped at
+    // runtime (e.g. through httpd::instrumentation_handler) on a node
+    // that is already misbehaving
+    auto& instr = instrumentation::registry::local();
+    instr.add("net-flow-metrics",
+        [] (bool on) { net::flow_metrics::local().set_enabled(on); },
+        [] { return net::flow_metrics::local().enabled(); });
+    instr.add("cpu-profiler",
+        [] (bool on) {
+            if (on) {
+                cpu_profiler::local().start(std::chrono::microseconds(100));
+            } else {
+                cpu_profiler::local().stop();
+            }
+        },
+        [] { return cpu_profiler::local().running(); });
+    auto large_alloc_threshold = vm["large-allocation-threshold"].as<size_t>();
+    instr.add("large-alloc-trace",
+        [large_alloc_threshold] (bool on) {
+            // keep the configured threshold when one was given
+            memory::set_large_allocation_threshold(
+                    on ? (large_alloc_threshold ? large_alloc_threshold : 1 << 20) : 0);
+        },
+        [] { return memory::large_allocation_threshold() != 0; });
     set_strict_dma(!vm.count("relaxed-dma"));
     if (!vm["poll-aio"].as<bool>()
             || (vm["poll-aio"].defaulted() && vm.count("overprovisioned"))) {
@@ -477,6 +592,11 @@ future<> reactor_backend_epoll::notified(reactor_notifier *n) {
 }
 
 
+// Not yet present in all the kernel headers we build against
+#ifndef TCP_FASTOPEN
+#define TCP_FASTOPEN 23
+#endif
+
 pollable_fd
 reactor::posix_listen(socket_address sa, listen_options opts) {
     file_desc fd = file_desc::socket(sa.u.sa.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, int(opts.proto));
@@ -485,6 +605,14 @@ reactor::posix_listen(socket_address sa, listen_options opts) {
     }
     if (_reuseport)
         fd.setsockopt(SOL_SOCKET, SO_REUSEPORT, 1);
+    if (opts.proto == transport::TCP) {
+        if (opts.fast_open_queue) {
+            fd.setsockopt(IPPROTO_TCP, TCP_FASTOPEN, int(opts.fast_open_queue));
+        }
+        if (opts.defer_accept_secs) {
+            fd.setsockopt(IPPROTO_TCP, TCP_DEFER_ACCEPT, int(opts.defer_accept_secs));
+        }
+    }
 
     fd.bind(sa.u.sa, sizeof(sa.u.sas));
     fd.listen(100);
@@ -493,8 +621,10 @@ reactor::posix_listen(socket_address sa, listen_options opts) {
 
 bool
 reactor::posix_reuseport_detect() {
-    return false; // FIXME: reuseport currently leads to heavy load imbalance. Until we fix that, just
-                  // disable it unconditionally.
+    // This only reports kernel support.  Actually using it is opt-in
+    // (--reuseport): the kernel spreads connections by 4-tuple hash, which
+    // balances well for short-lived connections but can leave long-lived
+    // ones concentrated on a few shards.
     try {
         file_desc fd = file_desc::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         fd.setsockopt(SOL_SOCKET, SO_REUSEPORT, 1);
@@ -563,7 +693,7 @@ reactor::submit_io(Func prepare_io) {
         _pending_aio.push_back(io);
         pr.release();
         if ((_io_queue->queued_requests() > 0) ||
-            (_pending_aio.size() >= std::min(max_aio / 4, _io_queue->_capacity / 2))) {
+            (_pending_aio.size() >= std::min(_max_aio_batch, _io_queue->_capacity / 2))) {
             flush_pending_aio();
         }
         return f;
@@ -579,7 +709,7 @@ reactor::flush_pending_aio() {
         for (size_t i = 0; i < nr; ++i) {
             iocbs[i] = &_pending_aio[i];
         }
-        auto r = ::io_submit(_io_context, nr, iocbs);
+        auto r = _backend->submit_io(_io_context, iocbs, nr);
         size_t nr_consumed;
         if (r < 0) {
             auto ec = -r;
@@ -625,25 +755,44 @@ const io_priority_class& default_priority_class() {
 
 template <typename Func>
 future<io_event>
-reactor::submit_io_read(const io_priority_class& pc, size_t len, Func prepare_io) {
+reactor::submit_io_read(dev_t device, const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_aio_reads;
     _aio_read_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, std::move(prepare_io));
+    return io_queue::queue_request(_io_coordinator, device, pc, len, std::move(prepare_io));
 }
 
 template <typename Func>
 future<io_event>
-reactor::submit_io_write(const io_priority_class& pc, size_t len, Func prepare_io) {
+reactor::submit_io_write(dev_t device, const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_aio_writes;
     _aio_write_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, std::move(prepare_io));
+    return io_queue::queue_request(_io_coordinator, device, pc, len, std::move(prepare_io));
+}
+
+void reactor::record_io_trace(io_trace_entry e) {
+    if (_io_trace.size() < max_io_trace_entries) {
+        _io_trace.push_back(e);
+    } else {
+        _io_trace[_io_trace_next] = e;
+        _io_trace_next = (_io_trace_next + 1) % max_io_trace_entries;
+    }
+    auto bucket = [] (std::chrono::steady_clock::duration d) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        unsigned b = 0;
+        while (us > 0 && b < io_trace_latency_buckets - 1) {
+            us >>= 1;
+            ++b;
+        }
+        return b;
+    };
+    _io_trace_queue_hist[bucket(e.dispatch - e.submit)]++;
+    _io_trace_device_hist[bucket(e.complete - e.dispatch)]++;
 }
 
 bool reactor::process_io()
 {
     io_event ev[max_aio];
-    struct timespec timeout = {0, 0};
-    auto n = ::io_getevents(_io_context, 1, max_aio, ev, &timeout);
+    auto n = _backend->getevents(_io_context, ev, max_aio);
     assert(n >= 0);
     for (size_t i = 0; i < size_t(n); ++i) {
         auto pr = reinterpret_cast<promise<io_event>*>(ev[i].data);
@@ -679,20 +828,23 @@ std::array<std::atomic<uint32_t>, io_queue::_max_classes> io_queue::_registered_
 // structure is passed along all the time - and sometimes we can't help but copy it, better keep
 // it lean. The name won't really be used for anything other than monitoring.
 std::array<sstring, io_queue::_max_classes> io_queue::_registered_names;
+std::array<std::atomic<uint32_t>, io_queue::_max_classes> io_queue::_registered_latency_goals;
 
 void io_queue::fill_shares_array() {
     for (unsigned i = 0; i < _max_classes; ++i) {
         _registered_shares[i].store(0);
+        _registered_latency_goals[i].store(0);
     }
 }
 
-io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares) {
+io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares, std::chrono::microseconds latency_goal) {
     for (unsigned i = 0; i < _max_classes; ++i) {
         uint32_t unused = 0;
         auto s = _registered_shares[i].compare_exchange_strong(unused, shares, std::memory_order_acq_rel);
         if (s) {
             io_priority_class p;
             _registered_names[i] = name;
+            _registered_latency_goals[i].store(latency_goal.count(), std::memory_order_release);
             p.val = i;
             return std::move(p);
         };
@@ -760,7 +912,12 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
         //
         // This conveys all the information we need and allows one to easily group all classes from
         // the same I/O queue (by filtering by instance ID)
-        auto ret = _priority_classes.emplace(pc.id(), make_lw_shared<priority_class_data>(sprint("%s-%d", name, owner), _fq.register_priority_class(shares)));
+        auto ptr = _fq.register_priority_class(shares);
+        auto goal = _registered_latency_goals.at(pc.id()).load(std::memory_order_acquire);
+        if (goal) {
+            fair_queue::set_latency_goal(ptr, std::chrono::microseconds(goal));
+        }
+        auto ret = _priority_classes.emplace(pc.id(), make_lw_shared<priority_class_data>(sprint("%s-%d", name, owner), ptr));
         it_pclass = ret.first;
     }
     return *(it_pclass->second);
@@ -768,10 +925,12 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
 
 template <typename Func>
 future<io_event>
-io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, Func prepare_io) {
+io_queue::queue_request(shard_id coordinator, dev_t device, const io_priority_class& pc, size_t len, Func prepare_io) {
     auto start = std::chrono::steady_clock::now();
-    return smp::submit_to(coordinator, [start, &pc, len, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] {
-        auto& queue = *(engine()._io_queue);
+    return smp::submit_to(coordinator, [start, device, &pc, len, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] {
+        auto& queue = *(engine().io_queue_for_device(device));
+        auto tracing = engine()._io_trace_enabled;
+        auto queued = tracing ? std::chrono::steady_clock::now() : start;
         unsigned weight = 1 + len/(16 << 10);
         // First time will hit here, and then we create the class. It is important
         // that we create the shared pointer in the same shard it will be used at later.
@@ -779,14 +938,39 @@ io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, size_
         pclass.bytes += len;
         pclass.ops++;
         pclass.nr_queued++;
-        return queue._fq.queue(pclass.ptr, weight, [&pclass, start, prepare_io = std::move(prepare_io)] {
+        return queue._fq.queue(pclass.ptr, weight, [&pclass, start, queued, len, tracing, prepare_io = std::move(prepare_io)] {
             pclass.nr_queued--;
-            pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start);
-            return engine().submit_io(std::move(prepare_io));
+            auto dispatch = std::chrono::steady_clock::now();
+            pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(dispatch - start);
+            auto f = engine().submit_io(std::move(prepare_io));
+            if (!tracing) {
+                return f;
+            }
+            return f.then([start, queued, dispatch, len] (io_event ev) {
+                engine().record_io_trace({start, queued, dispatch, std::chrono::steady_clock::now(), len});
+                return ev;
+            });
         });
     });
 }
 
+io_queue*
+reactor::io_queue_for_device(dev_t device) {
+    auto cit = _io_queue_capacities.find(device);
+    if (cit == _io_queue_capacities.end()) {
+        return _io_queue;
+    }
+    auto qit = _per_device_io_queues.find(device);
+    if (qit == _per_device_io_queues.end()) {
+        // Created lazily; we only get here on the coordinator, so the queue
+        // lands on the shard that submits its requests.
+        qit = _per_device_io_queues.emplace(device,
+                std::make_unique<io_queue>(_io_queue->coordinator(),
+                        cit->second, _io_queue->_io_topology)).first;
+    }
+    return qit->second.get();
+}
+
 file_impl* file_impl::get_file_impl(file& f) {
     return f._file_impl.get();
 }
@@ -794,6 +978,13 @@ file_impl* file_impl::get_file_impl(file& f) {
 posix_file_impl::posix_file_impl(int fd, file_open_options options)
         : _fd(fd) {
     query_dma_alignment();
+    struct stat st;
+    auto r = ::fstat(fd, &st);
+    if (r == 0) {
+        // I/O to a block device node goes to the device itself, not to the
+        // file system holding /dev.
+        _device = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+    }
 }
 
 posix_file_impl::~posix_file_impl() {
@@ -814,11 +1005,15 @@ posix_file_impl::query_dma_alignment() {
         // FIXME: really read the block size
         _disk_write_dma_alignment = std::max<unsigned>(da.d_miniosz, 4096);
     }
+    // Other file systems have no interface for querying their O_DIRECT
+    // requirements, so the conservative 4K defaults stay in effect for
+    // them.  Block devices are handled in blockdev_file_impl, which asks
+    // the block layer for the sector sizes.
 }
 
 future<size_t>
 posix_file_impl::write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& io_priority_class) {
-    return engine().submit_io_write(io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
+    return engine().submit_io_write(_device, io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
         io_prep_pwrite(&io, fd, const_cast<void*>(buffer), len, pos);
     }).then([] (io_event ev) {
         throw_kernel_error(long(ev.res));
@@ -832,7 +1027,7 @@ posix_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priori
     auto iov_ptr = std::make_unique<std::vector<iovec>>(std::move(iov));
     auto size = iov_ptr->size();
     auto data = iov_ptr->data();
-    return engine().submit_io_write(io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
+    return engine().submit_io_write(_device, io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
         io_prep_pwritev(&io, fd, data, size, pos);
     }).then([iov_ptr = std::move(iov_ptr)] (io_event ev) {
         throw_kernel_error(long(ev.res));
@@ -842,7 +1037,7 @@ posix_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priori
 
 future<size_t>
 posix_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& io_priority_class) {
-    return engine().submit_io_read(io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
+    return engine().submit_io_read(_device, io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
         io_prep_pread(&io, fd, buffer, len, pos);
     }).then([] (io_event ev) {
         throw_kernel_error(long(ev.res));
@@ -856,7 +1051,7 @@ posix_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov, const io_priorit
     auto iov_ptr = std::make_unique<std::vector<iovec>>(std::move(iov));
     auto size = iov_ptr->size();
     auto data = iov_ptr->data();
-    return engine().submit_io_read(io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
+    return engine().submit_io_read(_device, io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
         io_prep_preadv(&io, fd, data, size, pos);
     }).then([iov_ptr = std::move(iov_ptr)] (io_event ev) {
         throw_kernel_error(long(ev.res));
@@ -1399,9 +1594,51 @@ reactor::touch_directory(sstring name) {
 
 future<>
 posix_file_impl::flush(void) {
+    if (_syncing) {
+        // A sync is already on its way to the disk; our writes may be too
+        // late for it.  Wait for the follow-up sync, which starts after the
+        // current one finishes and covers everything written up to now.
+        _waiting_sync.emplace_back();
+        return _waiting_sync.back().get_future();
+    }
+    return do_sync();
+}
+
+future<>
+posix_file_impl::do_sync() {
+    _syncing = true;
     ++engine()._fsyncs;
     return engine()._thread_pool.submit<syscall_result<int>>([this] {
         return wrap_syscall<int>(::fdatasync(_fd));
+    }).then([this] (syscall_result<int> sr) {
+        _syncing = false;
+        if (!_waiting_sync.empty()) {
+            // All the flushes that arrived while we were syncing share this
+            // one follow-up sync.
+            auto waiters = std::exchange(_waiting_sync, {});
+            do_sync().then_wrapped([waiters = std::move(waiters)] (future<> f) mutable {
+                if (f.failed()) {
+                    auto ex = f.get_exception();
+                    for (auto& pr : waiters) {
+                        pr.set_exception(ex);
+                    }
+                } else {
+                    for (auto& pr : waiters) {
+                        pr.set_value();
+                    }
+                }
+            });
+        }
+        sr.throw_if_error();
+        return make_ready_future<>();
+    });
+}
+
+future<>
+posix_file_impl::sync_range(uint64_t pos, uint64_t len) {
+    return engine()._thread_pool.submit<syscall_result<int>>([this, pos, len] {
+        return wrap_syscall<int>(::sync_file_range(_fd, pos, len,
+                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER));
     }).then([] (syscall_result<int> sr) {
         sr.throw_if_error();
         return make_ready_future<>();
@@ -1432,6 +1669,23 @@ posix_file_impl::truncate(uint64_t length) {
 
 blockdev_file_impl::blockdev_file_impl(int fd, file_open_options options)
         : posix_file_impl(fd, options) {
+    // XFS_IOC_DIOINFO does not apply to device nodes, so ask the block
+    // layer directly.  O_DIRECT on a block device requires logical-sector
+    // alignment, so devices with 512-byte sectors can serve small reads
+    // without inflating them to the 4K default.
+    int logical = 0;
+    if (::ioctl(_fd, BLKSSZGET, &logical) == 0 && logical > 0) {
+        _memory_dma_alignment = logical;
+        _disk_read_dma_alignment = logical;
+        // Writes smaller than the physical sector turn into
+        // read-modify-write inside 512e devices; keep them physical-sized.
+        unsigned physical = 0;
+        if (::ioctl(_fd, BLKPBSZGET, &physical) == 0 && physical > unsigned(logical)) {
+            _disk_write_dma_alignment = physical;
+        } else {
+            _disk_write_dma_alignment = logical;
+        }
+    }
 }
 
 future<>
@@ -1538,7 +1792,14 @@ posix_file_impl::list_directory(std::function<future<> (directory_entry de)> nex
         unsigned total = 0;
         bool eof = false;
         int error = 0;
-        char buffer[8192];
+        char bufs[2][8192];
+        // Double buffering: entries are parsed out of *ready while the
+        // next getdents() is already running into *incoming on the
+        // syscall thread, so delivering one batch overlaps fetching the
+        // next.
+        char* ready = bufs[0];
+        char* incoming = bufs[1];
+        std::experimental::optional<future<syscall_result<long>>> pending;
     };
 
     // While it would be natural to use fdopendir()/readdir(),
@@ -1564,23 +1825,33 @@ posix_file_impl::list_directory(std::function<future<> (directory_entry de)> nex
     auto w = make_lw_shared<work>();
     auto ret = w->s.listen(std::move(next));
     w->s.started().then([w, this] {
+        auto issue = [w, this] {
+            w->pending = engine()._thread_pool.submit<syscall_result<long>>([w , this] () {
+                auto ret = ::syscall(__NR_getdents, _fd, reinterpret_cast<linux_dirent*>(w->incoming), sizeof(w->bufs[0]));
+                return wrap_syscall(ret);
+            });
+        };
+        issue();
         auto eofcond = [w] { return w->eof; };
-        return do_until(eofcond, [w, this] {
+        return do_until(eofcond, [w, issue] {
             if (w->current == w->total) {
-                return engine()._thread_pool.submit<syscall_result<long>>([w , this] () {
-                    auto ret = ::syscall(__NR_getdents, _fd, reinterpret_cast<linux_dirent*>(w->buffer), sizeof(w->buffer));
-                    return wrap_syscall(ret);
-                }).then([w] (syscall_result<long> ret) {
+                return w->pending->then([w, issue] (syscall_result<long> ret) {
                     ret.throw_if_error();
                     if (ret.result == 0) {
                         w->eof = true;
                     } else {
+                        std::swap(w->ready, w->incoming);
                         w->current = 0;
                         w->total = ret.result;
+                        // Keep the pipeline full: fetch the next batch
+                        // while this one is being delivered.  getdents()
+                        // advances the directory offset, so only one may
+                        // be in flight at a time.
+                        issue();
                     }
                 });
             }
-            auto start = w->buffer + w->current;
+            auto start = w->ready + w->current;
             auto de = reinterpret_cast<linux_dirent*>(start);
             std::experimental::optional<directory_entry_type> type;
             switch (start[de->d_reclen - 1]) {
@@ -1622,6 +1893,12 @@ posix_file_impl::list_directory(std::function<future<> (directory_entry de)> nex
 void reactor::enable_timer(steady_clock_type::time_point when)
 {
 #ifndef HAVE_OSV
+    if (when == _steady_clock_armed) {
+        // with coalescing, colliding wakeups are common; don't pay for
+        // a timer_settime() that would change nothing
+        return;
+    }
+    _steady_clock_armed = when;
     itimerspec its;
     its.it_interval = {};
     its.it_value = to_timespec(when);
@@ -1727,7 +2004,7 @@ reactor::register_collectd_metrics() {
                     , scollectd::per_cpu_plugin_instance
                     , "queue_length", "tasks-pending")
                     , scollectd::make_typed(scollectd::data_type::GAUGE
-                            , std::bind(&decltype(_pending_tasks)::size, &_pending_tasks))
+                            , [this] { return pending_task_count(); })
             ),
             // total_operations value:DERIVE:0:U
             scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
@@ -1735,6 +2012,20 @@ reactor::register_collectd_metrics() {
                     , "total_operations", "tasks-processed")
                     , scollectd::make_typed(scollectd::data_type::DERIVE, _tasks_processed)
             ),
+            // total_operations value:DERIVE:0:U
+            scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "task-quota-violations")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE, _task_quota_violations)
+            ),
+            // gauge value:GAUGE:U:U
+            // Longest non-preemptible run so far, in nanoseconds.
+            scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                    , scollectd::per_cpu_plugin_instance
+                    , "gauge", "longest-task-ns")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                            , [this] { return _longest_task_duration.count(); })
+            ),
             // queue_length     value:GAUGE:0:U
             // Absolute value of num timers in queue.
             scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
@@ -1833,6 +2124,20 @@ reactor::register_collectd_metrics() {
                 scollectd::make_typed(scollectd::data_type::GAUGE,
                         [] { return memory::stats().allocated_memory(); })
             ),
+            scollectd::add_polled_metric(
+                scollectd::type_instance_id("memory",
+                    scollectd::per_cpu_plugin_instance,
+                    "memory", "huge_backed_memory"),
+                scollectd::make_typed(scollectd::data_type::GAUGE,
+                        [] { return memory::stats().huge_backed_memory(); })
+            ),
+            scollectd::add_polled_metric(
+                scollectd::type_instance_id("memory",
+                    scollectd::per_cpu_plugin_instance,
+                    "memory", "small_backed_memory"),
+                scollectd::make_typed(scollectd::data_type::GAUGE,
+                        [] { return memory::stats().small_backed_memory(); })
+            ),
             scollectd::add_polled_metric(
                 scollectd::type_instance_id("memory",
                     scollectd::per_cpu_plugin_instance,
@@ -1863,32 +2168,346 @@ reactor::register_collectd_metrics() {
                 [this] { return my_io_queue->queued_requests(); } )
         ));
     }
+
+    // NUMA placement audit counters
+    ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        , scollectd::per_cpu_plugin_instance
+        , "total_operations", "numa-pages-checked")
+        , scollectd::make_typed(scollectd::data_type::DERIVE,
+            [] { return memory::numa_audit().pages_checked; } )
+    ));
+    ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        , scollectd::per_cpu_plugin_instance
+        , "total_operations", "numa-pages-misplaced")
+        , scollectd::make_typed(scollectd::data_type::DERIVE,
+            [] { return memory::numa_audit().pages_misplaced; } )
+    ));
+    ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        , scollectd::per_cpu_plugin_instance
+        , "total_operations", "numa-pages-moved")
+        , scollectd::make_typed(scollectd::data_type::DERIVE,
+            [] { return memory::numa_audit().pages_moved; } )
+    ));
+
+    // large-allocation latency instrumentation; all zeros unless enabled
+    // with --large-allocation-threshold
+    ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        , scollectd::per_cpu_plugin_instance
+        , "total_operations", "large-allocs")
+        , scollectd::make_typed(scollectd::data_type::DERIVE,
+            [] { return memory::large_allocations().allocations; } )
+    ));
+    ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        , scollectd::per_cpu_plugin_instance
+        , "latency", "large-alloc-max-us")
+        , scollectd::make_typed(scollectd::data_type::GAUGE,
+            [] { return memory::large_allocations().max_latency_us; } )
+    ));
+    for (unsigned i = 0; i != memory::large_alloc_latency_buckets; ++i) {
+        ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", sstring("large-alloc-latency-le-") + to_sstring(1u << i) + "us")
+            , scollectd::make_typed(scollectd::data_type::DERIVE,
+                [i] { return memory::large_allocations().latency_hist[i]; } )
+        ));
+    }
+
+    // I/O request latency breakdown; all zeros unless enabled with --io-trace
+    for (unsigned i = 0; i != io_trace_latency_buckets; ++i) {
+        ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", sstring("io-queue-latency-le-") + to_sstring(1u << i) + "us")
+            , scollectd::make_typed(scollectd::data_type::DERIVE,
+                [this, i] { return _io_trace_queue_hist[i]; } )
+        ));
+        ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", sstring("io-device-latency-le-") + to_sstring(1u << i) + "us")
+            , scollectd::make_typed(scollectd::data_type::DERIVE,
+                [this, i] { return _io_trace_device_hist[i]; } )
+        ));
+    }
+
+    // estimated live bytes per allocation label (see memory::alloc_label)
+    for (unsigned i = 0; i != unsigned(memory::alloc_label::nr_labels); ++i) {
+        auto l = memory::alloc_label(i);
+        ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+            , scollectd::per_cpu_plugin_instance
+            , "memory", sstring("labeled-") + memory::alloc_label_name(l))
+            , scollectd::make_typed(scollectd::data_type::GAUGE,
+                [l] { return memory::labeled_memory(l); } )
+        ));
+    }
+    if (_perf_counters.enabled()) {
+        static const std::pair<perf_counters::phase, const char*> phases[] = {
+            { perf_counters::phase::tasks, "tasks" },
+            { perf_counters::phase::pollers, "pollers" },
+            { perf_counters::phase::idle, "idle" },
+        };
+        for (auto&& p : phases) {
+            auto ph = p.first;
+            auto add = [&] (const char* counter, uint64_t perf_counters::reading::*field) {
+                ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                    , scollectd::per_cpu_plugin_instance
+                    , "derive", sstring("perf-") + p.second + "-" + counter)
+                    , scollectd::make_typed(scollectd::data_type::DERIVE,
+                        [this, ph, field] { return _perf_counters.total(ph).*field; } )
+                ));
+            };
+            add("cycles", &perf_counters::reading::cycles);
+            add("instructions", &perf_counters::reading::instructions);
+            add("cache-misses", &perf_counters::reading::cache_misses);
+            add("branch-misses", &perf_counters::reading::branch_misses);
+        }
+    }
+    if (_stall_detector_enabled) {
+        // stalls the watchdog observed, by duration: bucket k counts
+        // stalls between 2^k and 2^(k+1) times --blocked-reactor-notify-ms
+        for (unsigned i = 0; i != stall_nr_buckets; ++i) {
+            ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("reactor"
+                , scollectd::per_cpu_plugin_instance
+                , "derive", sstring("stalls-x") + to_sstring(1u << i))
+                , scollectd::make_typed(scollectd::data_type::DERIVE,
+                    [this, i] { return _stalls_by_bucket[i].load(std::memory_order_relaxed); } )
+            ));
+        }
+    }
+    // allocator breakdown: per-size-class churn and span occupancy,
+    // cross-cpu free volume and free-span fragmentation, so capacity
+    // alerts can fire on fragmentation trends before allocations fail
+    for (unsigned i = 0; i != memory::nr_small_pools(); ++i) {
+        auto sz = memory::small_pool_stats(i).object_size;
+        ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", sstring("malloc-") + to_sstring(sz))
+            , scollectd::make_typed(scollectd::data_type::DERIVE,
+                [i] { return memory::small_pool_stats(i).allocs; } )
+        ));
+        ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", sstring("free-") + to_sstring(sz))
+            , scollectd::make_typed(scollectd::data_type::DERIVE,
+                [i] { return memory::small_pool_stats(i).frees; } )
+        ));
+        ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+            , scollectd::per_cpu_plugin_instance
+            , "objects", sstring("spans-") + to_sstring(sz))
+            , scollectd::make_typed(scollectd::data_type::GAUGE,
+                [i] { return memory::small_pool_stats(i).spans_in_use; } )
+        ));
+    }
+    ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        , scollectd::per_cpu_plugin_instance
+        , "derive", "cross-cpu-free-bytes")
+        , scollectd::make_typed(scollectd::data_type::DERIVE,
+            [] { return memory::stats().cross_cpu_free_bytes(); } )
+    ));
+    ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        , scollectd::per_cpu_plugin_instance
+        , "memory", "largest_free_span")
+        , scollectd::make_typed(scollectd::data_type::GAUGE,
+            [] { return memory::stats().largest_free_span(); } )
+    ));
+    ret.regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("memory"
+        , scollectd::per_cpu_plugin_instance
+        , "gauge", "fragmentation")
+        , scollectd::make_typed(scollectd::data_type::GAUGE,
+            [] { return memory::stats().fragmentation(); } )
+    ));
     return ret;
 }
 
-void reactor::run_tasks(circular_buffer<std::unique_ptr<task>>& tasks) {
-    g_need_preempt = false;
+reactor::task_queue::task_queue(sstring nm, unsigned sh)
+        : name(std::move(nm)), shares(std::max(sh, 1u)) {
+    // latency          value:GAUGE:0:U
+    stats_regs.emplace_back(scollectd::add_polled_metric(
+            scollectd::type_instance_id("reactor", scollectd::per_cpu_plugin_instance,
+                    "latency", name + "-queue-delay-ns"),
+            scollectd::description("sampled delay between task enqueue and run, in nanoseconds"),
+            queue_delay_ns));
+    stats_regs.emplace_back(scollectd::add_polled_metric(
+            scollectd::type_instance_id("reactor", scollectd::per_cpu_plugin_instance,
+                    "latency", name + "-task-runtime-ns"),
+            scollectd::description("sampled task run time, in nanoseconds"),
+            task_runtime_ns));
+}
+
+void reactor::run_tasks(circular_buffer<std::unique_ptr<task>>& tasks, task_queue* tq) {
+    g_need_preempt.store(false, std::memory_order_relaxed);
+    auto t_start = steady_clock_type::now();
     while (!tasks.empty()) {
         auto tsk = std::move(tasks.front());
         tasks.pop_front();
+        auto t_run = t_start;
+        bool sampled = false;
+        if (tq) {
+            auto seq = tq->tasks_dequeued++;
+            if (!tq->pending_samples.empty() && tq->pending_samples.front().seq == seq) {
+                t_run = steady_clock_type::now();
+                tq->queue_delay_ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        t_run - tq->pending_samples.front().enqueued).count());
+                tq->pending_samples.pop_front();
+                sampled = true;
+            }
+        }
+        tracing::set_current(tsk->get_trace_context());
         tsk->run();
-        tsk.reset();
+        if (sampled) {
+            tq->task_runtime_ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    steady_clock_type::now() - t_run).count());
+        }
         ++_tasks_processed;
-        // check at end of loop, to allow at least one task to run
-        if (need_preempt() && tasks.size() <= _max_task_backlog) {
+        bump_progress();
+        // The task quota timer's signal handler sets the flag, so the
+        // per-task cost here is a single relaxed load rather than a
+        // clock_gettime() pair; we only touch the clock once the quota
+        // has actually expired.
+        if (!need_preempt()) {
+            tsk.reset();
+            continue;
+        }
+        auto t_end = steady_clock_type::now();
+        auto dt = t_end - t_start;
+        // the quota expired somewhere in [t_start, t_end); blame the task
+        // that just finished, as only it can have blown the quota alone
+        if (dt > _longest_task_duration) {
+            _longest_task_duration = dt;
+            _longest_task_type = &typeid(*tsk);
+        }
+        if (dt > _task_quota) {
+            ++_task_quota_violations;
+            // log each new record only, so a repeat offender can't flood
+            // the log
+            if (dt > _longest_violation_logged) {
+                _longest_violation_logged = dt;
+                seastar_logger.warn("task {} ran for {} us, exceeding the task quota of {} us;"
+                        " I/O and other tasks were delayed by that much",
+                        seastar::pretty_type_name(typeid(*tsk)),
+                        std::chrono::duration_cast<std::chrono::microseconds>(dt).count(),
+                        std::chrono::duration_cast<std::chrono::microseconds>(_task_quota).count());
+            }
+        }
+        tsk.reset();
+        // allow at least one task to run past the quota, but yield to
+        // polling once the backlog is under control
+        if (tasks.size() <= _max_task_backlog) {
             break;
         }
+        t_start = t_end;
+    }
+    // don't attribute the reactor's own work to the last task's trace
+    tracing::set_current({});
+}
+
+reactor::task_queue*
+reactor::pick_task_queue() {
+    task_queue* candidate = nullptr;
+    for (auto&& tq : _task_queues) {
+        if (tq && !tq->tasks.empty() && (!candidate || tq->vruntime < candidate->vruntime)) {
+            candidate = tq.get();
+        }
+    }
+    return candidate;
+}
+
+void reactor::run_some_tasks() {
+    auto tq = pick_task_queue();
+    if (!tq) {
+        return;
+    }
+    auto start = steady_clock_type::now();
+    do {
+        _min_vruntime = tq->vruntime;
+        _current_scheduling_group = scheduling_group(tq->id);
+        auto before = _tasks_processed;
+        run_tasks(tq->tasks, tq);
+        auto end = steady_clock_type::now();
+        auto delta = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+        tq->runtime_ns += delta.count();
+        tq->tasks_processed += _tasks_processed - before;
+        tq->vruntime += double(delta.count()) / tq->shares;
+        start = end;
+        tq = pick_task_queue();
+        // within one quota the scheduler rotates through the groups; once
+        // the quota expires we go back to polling I/O
+    } while (tq && !need_preempt());
+    _current_scheduling_group = scheduling_group();
+}
+
+bool reactor::have_pending_tasks() const {
+    for (auto&& tq : _task_queues) {
+        if (tq && !tq->tasks.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t reactor::pending_task_count() const {
+    uint64_t ret = 0;
+    for (auto&& tq : _task_queues) {
+        if (tq) {
+            ret += tq->tasks.size();
+        }
     }
+    return ret;
 }
 
+void reactor::add_task_in(scheduling_group sg, std::unique_ptr<task>&& t) {
+    assert(sg.id() < _task_queues.size() && _task_queues[sg.id()]);
+    auto& tq = *_task_queues[sg.id()];
+    if (tq.tasks.empty()) {
+        // a queue waking up from idle must not make up for CPU time it
+        // didn't want while asleep
+        tq.vruntime = std::max(tq.vruntime, _min_vruntime);
+    }
+    t->set_trace_context(tracing::current());
+    tq.tasks.push_back(std::move(t));
+    auto seq = tq.tasks_enqueued++;
+    if (--tq.sample_countdown == 0) {
+        tq.sample_countdown = task_queue::sample_rate;
+        tq.pending_samples.push_back({seq, steady_clock_type::now()});
+    }
+}
+
+void reactor::init_scheduling_group(scheduling_group sg, sstring name, unsigned shares) {
+    assert(sg.id() < max_scheduling_groups);
+    if (_task_queues.size() <= sg.id()) {
+        _task_queues.resize(sg.id() + 1);
+    }
+    assert(!_task_queues[sg.id()]);
+    _task_queues[sg.id()] = std::make_unique<task_queue>(std::move(name), shares);
+    _task_queues[sg.id()]->id = sg.id();
+    _task_queues[sg.id()]->vruntime = _min_vruntime;
+}
+
+future<scheduling_group>
+create_scheduling_group(sstring name, unsigned shares) {
+    assert(engine().cpu_id() == 0);
+    // ids are allocated on shard 0 only, so creations cannot race
+    static unsigned next_id = 1;
+    auto sg = scheduling_group(next_id++);
+    return smp::invoke_on_all([sg, name, shares] {
+        engine().init_scheduling_group(sg, name, shares);
+    }).then([sg] {
+        return make_ready_future<scheduling_group>(sg);
+    });
+}
+
+constexpr std::chrono::microseconds reactor::_min_poll_dwell;
+
 void reactor::force_poll() {
-    g_need_preempt = true;
+    g_need_preempt.store(true, std::memory_order_relaxed);
 }
 
 bool
 reactor::flush_tcp_batches() {
-    bool work = _flush_batching.size();
-    while (!_flush_batching.empty()) {
+    // A stream corked past its deadline re-registers itself from
+    // poll_flush(), so only drain the entries present on entry; the
+    // re-added ones are examined on the next poll iteration
+    auto n = _flush_batching.size();
+    bool work = n;
+    while (n--) {
         auto os = std::move(_flush_batching.front());
         _flush_batching.pop_front();
         os->poll_flush();
@@ -2213,9 +2832,22 @@ int reactor::run() {
     }
 
     _cpu_started.wait(smp::count).then([this] {
-        _network_stack->initialize().then([this] {
+        if (!_network_stack) {
+            // --no-network-stack
             _start_promise.set_value();
-        });
+            return;
+        }
+        auto stack_ready = _network_stack->initialize();
+        if (stack_ready.available() && !stack_ready.failed()) {
+            // Statically configured stacks come up synchronously; start the
+            // application right away instead of taking another trip through
+            // the scheduler.
+            _start_promise.set_value();
+        } else {
+            stack_ready.then([this] {
+                _start_promise.set_value();
+            });
+        }
     });
     _network_stack_ready_promise.get_future().then([this] (std::unique_ptr<network_stack> stack) {
         _network_stack = std::move(stack);
@@ -2266,6 +2898,14 @@ int reactor::run() {
     });
     load_timer.arm_periodic(1s);
 
+    // periodically verify (and optionally fix) that arena pages live on
+    // the NUMA node this shard was bound to
+    timer<lowres_clock> numa_audit_timer;
+    numa_audit_timer.set_callback([this] {
+        memory::numa_audit_step(_numa_audit_repair);
+    });
+    numa_audit_timer.arm_periodic(1s);
+
     itimerspec its = {};
     auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(_task_quota).count();
     auto tv_nsec = nsec % 1'000'000'000;
@@ -2282,25 +2922,51 @@ int reactor::run() {
     r = sigaction(task_quota_signal(), &sa_task_quota, nullptr);
     assert(r == 0);
 
+    if (_stall_detector_enabled) {
+        // warm up libgcc's unwinder so the stall handler never
+        // allocates (see cpu_profiler)
+        void* warmup[4];
+        ::backtrace(warmup, 4);
+        struct sigaction sa_stall = {};
+        sa_stall.sa_handler = &reactor::stall_signal_handler;
+        sa_stall.sa_flags = SA_RESTART;
+        r = sigaction(stall_signal(), &sa_stall, nullptr);
+        assert(r == 0);
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, stall_signal());
+        r = ::pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+        assert(r == 0);
+    }
+
     bool idle = false;
 
     std::function<bool()> check_for_work = [this] () {
-        return poll_once() || !_pending_tasks.empty() || seastar::thread::try_run_one_yielded_thread();
+        return poll_once() || have_pending_tasks() || seastar::thread::try_run_one_yielded_thread();
     };
     std::function<bool()> pure_check_for_work = [this] () {
-        return pure_poll_once() || !_pending_tasks.empty() || seastar::thread::try_run_one_yielded_thread();
+        return pure_poll_once() || have_pending_tasks() || seastar::thread::try_run_one_yielded_thread();
     };
     while (true) {
-        run_tasks(_pending_tasks);
+        bump_progress();
+        if (_id == 0) {
+            // one clock read here refreshes lowres_clock::now() for
+            // every reader on every shard; the 10ms periodic timer
+            // covers the periods when this shard sleeps
+            lowres_clock::update();
+        }
+        _perf_counters.switch_phase(perf_counters::phase::tasks);
+        run_some_tasks();
         if (_stopped) {
             load_timer.cancel();
             // Final tasks may include sending the last response to cpu 0, so run them
-            while (!_pending_tasks.empty()) {
-                run_tasks(_pending_tasks);
+            while (have_pending_tasks()) {
+                run_some_tasks();
             }
             while (!_at_destroy_tasks.empty()) {
                 run_tasks(_at_destroy_tasks);
             }
+            log_poller_stats();
             smp::arrive_at_event_loop_end();
             if (_id == 0) {
                 smp::join_all();
@@ -2308,20 +2974,31 @@ int reactor::run() {
             break;
         }
 
+        _perf_counters.switch_phase(perf_counters::phase::pollers);
         if (check_for_work()) {
             if (idle) {
+                // polling while idle found work, so the poll window is
+                // pulling its weight; widen it again
+                if (_adaptive_idle_poll) {
+                    _poll_dwell = std::min(std::max(_poll_dwell * 2, std::chrono::nanoseconds(_min_poll_dwell)), _max_poll_time);
+                }
                 idle_count += (idle_end - idle_start).count();
                 idle_start = idle_end;
                 idle = false;
             }
         } else {
+            _perf_counters.switch_phase(perf_counters::phase::idle);
             idle_end = steady_clock_type::now();
             if (!idle) {
                 idle_start = idle_end;
                 idle = true;
             }
             bool go_to_sleep = true;
-            try {
+            // an idle shard first tries to steal work from the
+            // work-stealing pool (a no-op unless --work-stealing is on)
+            if (smp::try_run_one_stealable_task()) {
+                go_to_sleep = false;
+            } else try {
                 // we can't run check_for_work(), because that can run tasks in the context
                 // of the idle handler which change its state, without the idle handler expecting
                 // it.  So run pure_check_for_work() instead.
@@ -2330,9 +3007,20 @@ int reactor::run() {
             } catch (...) {
                 report_exception("Exception while running idle cpu handler", std::current_exception());
             }
+            if (go_to_sleep) {
+                // use the idle time to merge free spans back together,
+                // so a later large allocation doesn't fail on a
+                // fragmented heap
+                go_to_sleep = !memory::defragment_step();
+            }
             if (go_to_sleep) {
                 _mm_pause();
-                if (idle_end - idle_start > _max_poll_time) {
+                if (idle_end - idle_start > _poll_dwell) {
+                    // a whole poll window expired without finding work;
+                    // next time give up on polling earlier
+                    if (_adaptive_idle_poll) {
+                        _poll_dwell = std::min(_poll_dwell / 2, _max_poll_time);
+                    }
                     sleep();
                     // We may have slept for a while, so freshen idle_end
                     idle_end = steady_clock_type::now();
@@ -2348,6 +3036,7 @@ int reactor::run() {
     // This is needed because the reactor is destroyed from the thread_local destructors. If
     // the I/O queue happens to use any other infrastructure that is also kept this way (for
     // instance, collectd), we will not have any way to guarantee who is destroyed first.
+    _per_device_io_queues.clear();
     my_io_queue.reset(nullptr);
     return _return;
 }
@@ -2380,12 +3069,22 @@ bool
 reactor::poll_once() {
     bool work = false;
     for (auto c : _pollers) {
-        work |= c->poll();
+        if (c->poll()) {
+            ++c->work_count;
+            work = true;
+        }
     }
 
     return work;
 }
 
+void
+reactor::log_poller_stats() {
+    for (auto c : _pollers) {
+        seastar_logger.info("poller {}: {} useful polls", seastar::pretty_type_name(typeid(*c)), c->work_count);
+    }
+}
+
 bool
 reactor::pure_poll_once() {
     for (auto c : _pollers) {
@@ -2513,6 +3212,294 @@ reactor_backend_epoll::wait_and_process(int timeout, const sigset_t* active_sigm
     return nr;
 }
 
+#ifdef HAVE_URING
+
+static long io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+        unsigned flags, const sigset_t* sig) {
+    return ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+            sig, _NSIG / 8);
+}
+
+// user_data tagging: promise<io_event> pointers (disk I/O) are at least
+// word-aligned, so the two low bits distinguish readiness polls from disk
+// completions.
+static constexpr uint64_t uring_tag_pollin = 1;
+static constexpr uint64_t uring_tag_pollout = 2;
+
+static uint64_t uring_poll_user_data(pollable_fd_state& pfd, int event) {
+    return reinterpret_cast<uintptr_t>(&pfd)
+            | (event == EPOLLIN ? uring_tag_pollin : uring_tag_pollout);
+}
+
+bool reactor_backend_uring::available() {
+    static bool probed = [] {
+        ::io_uring_params params = {};
+        int fd = ::syscall(__NR_io_uring_setup, 1, &params);
+        if (fd == -1) {
+            return false;
+        }
+        ::close(fd);
+        return true;
+    }();
+    return probed;
+}
+
+reactor_backend_uring::reactor_backend_uring()
+    : _ring_fd(file_desc::io_uring_setup(ring_entries, &_params)) {
+    auto sq_size = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+    auto cq_size = _params.cq_off.cqes + _params.cq_entries * sizeof(::io_uring_cqe);
+    _sq_map = _ring_fd.map_shared_rw(sq_size, IORING_OFF_SQ_RING);
+    _cq_map = _ring_fd.map_shared_rw(cq_size, IORING_OFF_CQ_RING);
+    _sqe_map = _ring_fd.map_shared_rw(_params.sq_entries * sizeof(::io_uring_sqe), IORING_OFF_SQES);
+    auto sq = _sq_map.get();
+    _sq_entries = _params.sq_entries;
+    _sq_khead = reinterpret_cast<unsigned*>(sq + _params.sq_off.head);
+    _sq_ktail = reinterpret_cast<unsigned*>(sq + _params.sq_off.tail);
+    _sq_kmask = reinterpret_cast<unsigned*>(sq + _params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned*>(sq + _params.sq_off.array);
+    _sqes = reinterpret_cast<::io_uring_sqe*>(_sqe_map.get());
+    auto cq = _cq_map.get();
+    _cq_entries = _params.cq_entries;
+    _cq_khead = reinterpret_cast<unsigned*>(cq + _params.cq_off.head);
+    _cq_ktail = reinterpret_cast<unsigned*>(cq + _params.cq_off.tail);
+    _cq_kmask = reinterpret_cast<unsigned*>(cq + _params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<::io_uring_cqe*>(cq + _params.cq_off.cqes);
+    _sq_tail = *_sq_ktail;
+}
+
+::io_uring_sqe* reactor_backend_uring::try_get_sqe() {
+    auto head = __atomic_load_n(_sq_khead, __ATOMIC_ACQUIRE);
+    if (_sq_tail - head == _sq_entries) {
+        // ring full; submitting frees all sq entries (the kernel copies
+        // them during io_uring_enter())
+        flush_submissions();
+        head = __atomic_load_n(_sq_khead, __ATOMIC_ACQUIRE);
+        if (_sq_tail - head == _sq_entries) {
+            return nullptr;
+        }
+    }
+    auto idx = _sq_tail & *_sq_kmask;
+    _sq_array[idx] = idx;
+    ++_sq_tail;
+    ++_to_submit;
+    auto sqe = &_sqes[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void reactor_backend_uring::flush_submissions() {
+    if (!_to_submit) {
+        return;
+    }
+    __atomic_store_n(_sq_ktail, _sq_tail, __ATOMIC_RELEASE);
+    auto r = io_uring_enter(_ring_fd.get(), _to_submit, 0, 0, nullptr);
+    throw_system_error_on(r == -1, "io_uring_enter");
+    _to_submit -= r;
+}
+
+void reactor_backend_uring::process_poll_completion(uint64_t user_data, int res) {
+    auto pfd = reinterpret_cast<pollable_fd_state*>(user_data & ~uint64_t(3));
+    auto event = (user_data & uring_tag_pollin) ? EPOLLIN : EPOLLOUT;
+    auto pr = (user_data & uring_tag_pollin) ? &pollable_fd_state::pollin
+                                             : &pollable_fd_state::pollout;
+    pfd->events_epoll &= ~event;   // poll_add is one-shot; no longer armed
+    if (res < 0) {
+        (pfd->*pr).set_exception(std::make_exception_ptr(
+                std::system_error(-res, std::system_category())));
+        pfd->events_requested &= ~event;
+        pfd->*pr = promise<>();
+        return;
+    }
+    if (pfd->events_requested & event) {
+        pfd->events_requested &= ~event;
+        pfd->events_known &= ~event;
+        (pfd->*pr).set_value();
+        pfd->*pr = promise<>();
+    } else {
+        // completed after the waiter lost interest; remember it like a
+        // speculation so the next readable()/writeable() is free
+        pfd->events_known |= event;
+    }
+}
+
+unsigned reactor_backend_uring::reap_completions() {
+    auto tail = __atomic_load_n(_cq_ktail, __ATOMIC_ACQUIRE);
+    auto head = *_cq_khead;
+    auto processed = tail - head;
+    while (head != tail) {
+        auto& cqe = _cqes[head & *_cq_kmask];
+        auto user_data = cqe.user_data;
+        if (_orphans.count(user_data)) {
+            // stale completion of a poll whose fd was forget()ten
+            _orphans.erase(user_data);
+        } else if (user_data & 3) {
+            process_poll_completion(user_data, cqe.res);
+        } else if (user_data) {
+            io_event ev = {};
+            ev.data = reinterpret_cast<void*>(user_data);
+            ev.res = cqe.res;  // negative errno on failure, like linux-aio
+            _completed_io.push_back(ev);
+        } // user_data == 0: internal completion (poll_remove), ignored
+        ++head;
+    }
+    __atomic_store_n(_cq_khead, head, __ATOMIC_RELEASE);
+    return processed;
+}
+
+bool reactor_backend_uring::wait_and_process(int timeout, const sigset_t* active_sigmask) {
+    // The reactor only ever polls (timeout == 0) or sleeps until the next
+    // event (timeout == -1); positive timeouts are the timers' business.
+    auto processed = reap_completions();
+    bool block = timeout != 0 && !processed;
+    if (_to_submit || block) {
+        __atomic_store_n(_sq_ktail, _sq_tail, __ATOMIC_RELEASE);
+        auto r = io_uring_enter(_ring_fd.get(), _to_submit, block ? 1 : 0,
+                IORING_ENTER_GETEVENTS, active_sigmask);
+        if (r == -1 && errno == EINTR) {
+            return processed;
+        }
+        throw_system_error_on(r == -1, "io_uring_enter");
+        _to_submit -= r;
+        processed += reap_completions();
+    }
+    return processed;
+}
+
+future<> reactor_backend_uring::get_poll_future(pollable_fd_state& pfd,
+        promise<> pollable_fd_state::*pr, int event) {
+    if (pfd.events_known & event) {
+        pfd.events_known &= ~event;
+        return make_ready_future();
+    }
+    pfd.events_requested |= event;
+    if (!(pfd.events_epoll & event)) {  // events_epoll doubles as "armed in the ring"
+        auto sqe = try_get_sqe();
+        // the ring cannot be full right after a submission drained it
+        assert(sqe);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = pfd.fd.get();
+        sqe->poll_events = event;
+        sqe->user_data = uring_poll_user_data(pfd, event);
+        pfd.events_epoll |= event;
+    }
+    pfd.*pr = promise<>();
+    return (pfd.*pr).get_future();
+}
+
+void reactor_backend_uring::abort_fd(pollable_fd_state& pfd, std::exception_ptr ex,
+        promise<> pollable_fd_state::* pr, int event) {
+    if (pfd.events_epoll & event) {
+        auto user_data = uring_poll_user_data(pfd, event);
+        if (auto sqe = try_get_sqe()) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->addr = user_data;
+        }
+        _orphans.insert(user_data);
+        pfd.events_epoll &= ~event;
+    }
+    if (pfd.events_requested & event) {
+        pfd.events_requested &= ~event;
+        (pfd.*pr).set_exception(std::move(ex));
+        pfd.*pr = promise<>();
+    }
+    pfd.events_known &= ~event;
+}
+
+future<> reactor_backend_uring::readable(pollable_fd_state& fd) {
+    return get_poll_future(fd, &pollable_fd_state::pollin, EPOLLIN);
+}
+
+future<> reactor_backend_uring::writeable(pollable_fd_state& fd) {
+    return get_poll_future(fd, &pollable_fd_state::pollout, EPOLLOUT);
+}
+
+void reactor_backend_uring::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollin, EPOLLIN);
+}
+
+void reactor_backend_uring::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollout, EPOLLOUT);
+}
+
+void reactor_backend_uring::forget(pollable_fd_state& fd) {
+    for (auto event : {EPOLLIN, EPOLLOUT}) {
+        if (fd.events_epoll & event) {
+            auto user_data = uring_poll_user_data(fd, event);
+            if (auto sqe = try_get_sqe()) {
+                sqe->opcode = IORING_OP_POLL_REMOVE;
+                sqe->addr = user_data;
+            }
+            _orphans.insert(user_data);
+        }
+    }
+}
+
+future<> reactor_backend_uring::notified(reactor_notifier *n) {
+    // Like reactor_backend_epoll, we communicate between threads with
+    // eventfds rather than notifiers.
+    std::cout << "reactor_backend_uring does not yet support notifiers!\n";
+    abort();
+}
+
+int reactor_backend_uring::submit_io(io_context_t io_context, iocb** iocbs, size_t nr) {
+    size_t done = 0;
+    while (done < nr) {
+        auto& io = *iocbs[done];
+        auto sqe = try_get_sqe();
+        if (!sqe) {
+            break;
+        }
+        switch (io.aio_lio_opcode) {
+        case IO_CMD_PREAD:
+            sqe->opcode = IORING_OP_READ;
+            break;
+        case IO_CMD_PWRITE:
+            sqe->opcode = IORING_OP_WRITE;
+            break;
+        case IO_CMD_PREADV:
+            sqe->opcode = IORING_OP_READV;
+            break;
+        case IO_CMD_PWRITEV:
+            sqe->opcode = IORING_OP_WRITEV;
+            break;
+        case IO_CMD_FDSYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+            break;
+        case IO_CMD_FSYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            break;
+        default:
+            abort();
+        }
+        sqe->fd = io.aio_fildes;
+        sqe->addr = reinterpret_cast<uintptr_t>(io.u.c.buf);
+        sqe->len = io.u.c.nbytes;
+        sqe->off = io.u.c.offset;
+        sqe->user_data = reinterpret_cast<uintptr_t>(io.data);
+        ++done;
+    }
+    if (!done) {
+        return -EAGAIN;
+    }
+    // Kick the kernel right away rather than waiting for the next
+    // wait_and_process(), to keep the disk queues busy.
+    flush_submissions();
+    return done;
+}
+
+int reactor_backend_uring::getevents(io_context_t io_context, io_event* ev, size_t max) {
+    reap_completions();
+    auto n = std::min(max, _completed_io.size());
+    for (size_t i = 0; i != n; ++i) {
+        ev[i] = _completed_io.front();
+        _completed_io.pop_front();
+    }
+    return n;
+}
+
+#endif /* HAVE_URING */
+
 syscall_work_queue::syscall_work_queue()
     : _pending()
     , _completed()
@@ -2541,9 +3528,11 @@ unsigned syscall_work_queue::complete() {
     return nr;
 }
 
-smp_message_queue::smp_message_queue(reactor* from, reactor* to)
-    : _pending(to)
-    , _completed(from)
+smp_message_queue::smp_message_queue(reactor* from, reactor* to, size_t queue_length)
+    : _queue_length(queue_length)
+    , _pending(to, queue_length)
+    , _completed(from, queue_length)
+    , _queue_has_room(queue_length)
 {
 }
 
@@ -2560,6 +3549,15 @@ void smp_message_queue::move_pending() {
     _current_queue_length += nr;
     _last_snt_batch = nr;
     _sent += nr;
+    // adapt the flush threshold: a full batch means traffic is brisk
+    // enough to batch more aggressively, a partial one (the end-of-poll
+    // flush draining leftovers) means it is sparse and should be sent
+    // with less delay
+    if (size_t(nr) >= _cur_batch_size) {
+        _cur_batch_size = std::min(_cur_batch_size * 2, max_batch_size);
+    } else {
+        _cur_batch_size = std::max(_cur_batch_size / 2, min_batch_size);
+    }
 }
 
 bool smp_message_queue::pure_poll_tx() const {
@@ -2570,7 +3568,7 @@ bool smp_message_queue::pure_poll_tx() const {
 
 void smp_message_queue::submit_item(smp_message_queue::work_item* item) {
     _tx.a.pending_fifo.push_back(item);
-    if (_tx.a.pending_fifo.size() >= batch_size) {
+    if (_tx.a.pending_fifo.size() >= _cur_batch_size) {
         move_pending();
     }
 }
@@ -2626,14 +3624,16 @@ template<size_t PrefetchCnt, typename Func>
 size_t smp_message_queue::process_queue(lf_queue& q, Func process) {
     // copy batch to local memory in order to minimize
     // time in which cross-cpu data is accessed
-    work_item* items[queue_length + PrefetchCnt];
+    work_item* items[process_batch_length + PrefetchCnt];
     work_item* wi;
     if (!q.pop(wi))
         return 0;
     // start prefecthing first item before popping the rest to overlap memory
     // access with potential cache miss the second pop may cause
     prefetch<2>(wi);
-    auto nr = q.pop(items);
+    // bound the pop so the PrefetchCnt sentinel slots at the tail stay
+    // free even when the ring holds more than process_batch_length items
+    auto nr = q.pop(items, process_batch_length);
     std::fill(std::begin(items) + nr, std::begin(items) + nr + PrefetchCnt, nr ? items[nr - 1] : wi);
     unsigned i = 0;
     do {
@@ -2653,6 +3653,8 @@ size_t smp_message_queue::process_completions() {
     _current_queue_length -= nr;
     _compl += nr;
     _last_cmpl_batch = nr;
+    // hand the freed slots to senders parked on a full queue
+    _queue_has_room.signal(nr);
 
     return nr;
 }
@@ -2701,6 +3703,16 @@ void smp_message_queue::start(unsigned cpuid) {
                     , "queue_length", "send-queue-length")
             , scollectd::make_typed(scollectd::data_type::GAUGE, _current_queue_length)
             ),
+            scollectd::add_disabled_polled_metric(scollectd::type_instance_id("smp"
+                    , instance
+                    , "queue_length", "send-queue-capacity")
+            , scollectd::make_typed(scollectd::data_type::GAUGE, _queue_length)
+            ),
+            scollectd::add_disabled_polled_metric(scollectd::type_instance_id("smp"
+                    , instance
+                    , "queue_length", "send-batch-threshold")
+            , scollectd::make_typed(scollectd::data_type::GAUGE, _cur_batch_size)
+            ),
             // total_operations value:DERIVE:0:U
             scollectd::add_disabled_polled_metric(scollectd::type_instance_id("smp"
                     , instance
@@ -2719,47 +3731,74 @@ void smp_message_queue::start(unsigned cpuid) {
                     , "total_operations", "completed-messages")
             , scollectd::make_typed(scollectd::data_type::DERIVE, _compl)
             ),
+            // total_operations value:DERIVE:0:U
+            scollectd::add_disabled_polled_metric(scollectd::type_instance_id("smp"
+                    , instance
+                    , "total_operations", "blocked-on-full-queue")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, _blocked_on_room)
+            ),
     });
 }
 
 /* not yet implemented for OSv. TODO: do the notification like we do class smp. */
 #ifndef HAVE_OSV
-thread_pool::thread_pool() : _worker_thread([this] { work(); }), _notify(pthread_self()) {
+thread_pool::thread_pool() : _notify(pthread_self()) {
+    _worker_threads.emplace_back([this] { work(); });
     engine()._signals.handle_signal(SIGUSR1, [this] { inter_thread_wq.complete(); });
 }
 
+void thread_pool::set_size(unsigned nr_threads) {
+    while (_worker_threads.size() < nr_threads) {
+        _worker_threads.emplace_back([this] { work(); });
+    }
+}
+
 void thread_pool::work() {
     sigset_t mask;
     sigfillset(&mask);
     auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
     throw_system_error_on(r == -1);
-    std::array<syscall_work_queue::work_item*, syscall_work_queue::queue_length> tmp_buf;
+    std::array<syscall_work_queue::work_item*, completion_batch> batch;
     while (true) {
         uint64_t count;
         auto r = ::read(inter_thread_wq._start_eventfd.get_read_fd(), &count, sizeof(count));
         assert(r == sizeof(count));
         if (_stopped.load(std::memory_order_relaxed)) {
+            // pass the shutdown wakeup on to the next pool thread; an
+            // eventfd read may have consumed several wakeups at once
+            inter_thread_wq._start_eventfd.signal(1);
             break;
         }
-        auto end = tmp_buf.data();
-        inter_thread_wq._pending.consume_all([&] (syscall_work_queue::work_item* wi) {
-            *end++ = wi;
-        });
-        for (auto p = tmp_buf.data(); p != end; ++p) {
-            auto wi = *p;
+        auto end = batch.data();
+        auto flush = [&] {
+            for (auto p = batch.data(); p != end; ++p) {
+                inter_thread_wq._completed.push(*p);
+            }
+            if (end != batch.data() && _main_thread_idle.load(std::memory_order_seq_cst)) {
+                pthread_kill(_notify, SIGUSR1);
+            }
+            end = batch.data();
+        };
+        // drain everything queued at wakeup time; other pool threads may
+        // be draining concurrently, so pop one item at a time
+        syscall_work_queue::work_item* wi;
+        while (inter_thread_wq._pending.pop(wi)) {
             wi->process();
-            inter_thread_wq._completed.push(wi);
-        }
-        if (_main_thread_idle.load(std::memory_order_seq_cst)) {
-            pthread_kill(_notify, SIGUSR1);
+            *end++ = wi;
+            if (end == batch.data() + completion_batch) {
+                flush();
+            }
         }
+        flush();
     }
 }
 
 thread_pool::~thread_pool() {
     _stopped.store(true, std::memory_order_relaxed);
     inter_thread_wq._start_eventfd.signal(1);
-    _worker_thread.join();
+    for (auto&& t : _worker_threads) {
+        t.join();
+    }
 }
 #endif
 
@@ -2855,12 +3894,42 @@ reactor::get_options_description() {
         ("network-stack", bpo::value<std::string>(),
                 sprint("select network stack (valid values: %s)",
                         format_separated(net_stack_names.begin(), net_stack_names.end(), ", ")).c_str())
+        ("reactor-backend", bpo::value<std::string>()->default_value("epoll"),
+                "internal reactor backend (epoll"
+#ifdef HAVE_URING
+                ", io_uring"
+#endif
+                ")")
+        ("no-network-stack", "do not create a network stack; cuts startup time for tools that do no networking (engine().net() must not be used)")
         ("no-handle-interrupt", "ignore SIGINT (for gdb)")
+        ("reuseport", bpo::value<bool>()->default_value(false),
+                "bind a separate SO_REUSEPORT listening socket on each shard, so the kernel spreads incoming connections and accepts never cross shards (posix stack only)")
+        ("io-queue-mountpoint", bpo::value<std::vector<std::string>>()->multitoken(),
+                "give the device mounted at <mountpoint> its own I/O queue with its own concurrency limit, instead of sharing --max-io-requests (format: <mountpoint>:<max-requests>; may be repeated)")
+        ("io-trace", "record per-request I/O lifecycle timestamps (queueing vs. device time) in a per-shard ring and export the latency breakdown histograms")
         ("poll-mode", "poll continuously (100% cpu use)")
         ("idle-poll-time-us", bpo::value<unsigned>()->default_value(calculate_poll_time() / 1us),
                 "idle polling time in microseconds (reduce for overprovisioned environments or laptops)")
+        ("idle-poll-governor", bpo::value<bool>()->default_value(true),
+                "adapt idle polling time to recent poll success, between 0 and --idle-poll-time-us")
+        ("timer-slack-us", bpo::value<unsigned>()->default_value(0),
+                "coalesce timer wakeups into buckets of this many microseconds (timers may fire this much late)")
         ("poll-aio", bpo::value<bool>()->default_value(true),
                 "busy-poll for disk I/O (reduces latency and increases throughput)")
+        ("max-io-batch", bpo::value<unsigned>()->default_value(max_aio / 4),
+                "maximum number of iocbs to accumulate before a mid-poll io_submit() (the rest flush at poll end)")
+        ("blocked-syscall-threads", bpo::value<unsigned>()->default_value(1),
+                "number of helper threads (per shard) serving blocking syscalls such as open() and stat()")
+        ("numa-audit-repair", bpo::value<bool>()->default_value(false),
+                "move pages the periodic NUMA audit finds on the wrong node back to the shard's node")
+        ("cpu-perf-counters", bpo::value<bool>()->default_value(false),
+                "count CPU cycles, instructions, LLC misses and branch misses per shard, attributed to event loop phases (tasks/pollers/idle) and exported via collectd")
+        ("blocked-reactor-notify-ms", bpo::value<unsigned>()->default_value(0),
+                "log a rate-limited backtrace of any reactor that stops making progress for longer than this many milliseconds, and count stalls by duration (0: disabled)")
+        ("net-flow-metrics", bpo::value<bool>()->default_value(false),
+                "keep per-connection byte, packet and retransmit counters for the heaviest connections on each shard (bounded memory; see net::flow_metrics)")
+        ("large-allocation-threshold", bpo::value<size_t>()->default_value(0),
+                "time allocations of at least this many bytes and attribute them to their call sites (0 disables)")
         ("task-quota-ms", bpo::value<double>()->default_value(2.0), "Max time (ms) between polls")
         ("max-task-backlog", bpo::value<unsigned>()->default_value(1000), "Maximum number of task backlog to allow; above this we ignore I/O")
         ("relaxed-dma", "allow using buffered I/O if DMA is not available (reduces performance)")
@@ -2884,6 +3953,10 @@ smp::get_options_description()
         ("hugepages", bpo::value<std::string>(), "path to accessible hugetlbfs mount (typically /dev/hugepages/something)")
         ("lock-memory", bpo::value<bool>(), "lock all memory (prevents swapping)")
         ("thread-affinity", bpo::value<bool>()->default_value(true), "pin threads to their cpus (disable for overprovisioning)")
+        ("work-stealing", bpo::value<bool>()->default_value(false), "allow idle shards to steal tasks submitted with smp::submit_stealable()")
+        ("smp-queue-length", bpo::value<unsigned>()->default_value(128), "depth of each cross-shard message queue (per shard pair, per direction); senders wait when their peer's queue is full")
+        ("defer-memory-touch", "do not fault the memory arena in at startup; pages fault in on first use (faster startup, slower first allocations)")
+        ("startup-timings", "print the time spent in each startup phase")
 #ifdef HAVE_HWLOC
         ("num-io-queues", bpo::value<unsigned>(), "Number of IO queues. Each IO unit will be responsible for a fraction of the IO requests. Defaults to the number of threads")
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of IO queues")
@@ -2910,6 +3983,8 @@ struct reactor_deleter {
 thread_local std::unique_ptr<reactor, reactor_deleter> reactor_holder;
 
 std::vector<posix_thread> smp::_threads;
+std::unique_ptr<posix_thread> smp::_watchdog;
+std::atomic<bool> smp::_watchdog_stop;
 std::vector<std::function<void ()>> smp::_thread_loops;
 std::experimental::optional<boost::barrier> smp::_all_event_loops_done;
 std::vector<reactor*> smp::_reactors;
@@ -2917,6 +3992,37 @@ smp_message_queue** smp::_qs;
 std::thread::id smp::_tmain;
 unsigned smp::count = 1;
 bool smp::_using_dpdk;
+std::unique_ptr<boost::lockfree::queue<task*>> smp::_stealable_tasks;
+std::atomic<int> smp::_stealable_pending;
+bool smp::_work_stealing = false;
+
+void smp::schedule_stealable(std::unique_ptr<task> t) {
+    t->set_trace_context(tracing::current());
+    if (_work_stealing && _stealable_tasks->push(t.get())) {
+        t.release();
+        _stealable_pending.fetch_add(1, std::memory_order_release);
+    } else {
+        engine().add_task(std::move(t));
+    }
+}
+
+bool smp::try_run_one_stealable_task() {
+    // cheap out when the pool is off or empty, so busy shards don't
+    // bounce the queue's cache lines around
+    if (_stealable_pending.load(std::memory_order_relaxed) <= 0) {
+        return false;
+    }
+    task* t;
+    if (!_stealable_tasks->pop(t)) {
+        return false;
+    }
+    _stealable_pending.fetch_sub(1, std::memory_order_relaxed);
+    std::unique_ptr<task> tsk(t);
+    tracing::set_current(tsk->get_trace_context());
+    tsk->run();
+    tracing::set_current({});
+    return true;
+}
 
 void smp::start_all_queues()
 {
@@ -2977,9 +4083,110 @@ void smp::allocate_reactor() {
     reactor_holder.reset(local_engine);
 }
 
+void smp::start_watchdog(std::chrono::milliseconds threshold) {
+    _watchdog_stop.store(false, std::memory_order_relaxed);
+    _watchdog = std::make_unique<posix_thread>([threshold] {
+        struct shard_state {
+            uint64_t last_progress = 0;
+            steady_clock_type::time_point stall_start;
+            steady_clock_type::time_point last_report;
+            bool stalled = false;
+            bool reported = false;
+        };
+        // asks the shard for its stack (the stall signal handler fills
+        // _stall_frames), then symbolizes and logs it; symbolization
+        // allocates, which is fine here on the watchdog thread
+        auto report = [] (unsigned shard, reactor& r, std::chrono::milliseconds blocked) {
+            r._stall_depth.store(0, std::memory_order_relaxed);
+            if (::pthread_kill(r._thread_id, stall_signal()) != 0) {
+                return;
+            }
+            int depth = 0;
+            // the shard is busy, not gone, so the handler runs promptly
+            for (unsigned spin = 0; spin != 100 && !depth; ++spin) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                depth = r._stall_depth.load(std::memory_order_acquire);
+            }
+            std::string bt;
+            if (!depth) {
+                bt = "<no backtrace captured>";
+            } else {
+                for (int i = 0; i != depth; ++i) {
+                    if (i) {
+                        bt += "\n  ";
+                    }
+                    bt += cpu_profiler::frame_name(r._stall_frames[i]);
+                }
+            }
+            seastar_logger.warn("reactor on shard {} blocked for more than {} ms:\n  {}",
+                    shard, blocked.count(), bt);
+        };
+        std::vector<shard_state> shards(smp::count);
+        // sample well inside the threshold, so stalls just above it are
+        // still seen
+        auto period = std::max(threshold / 4, std::chrono::milliseconds(1));
+        // at most one backtrace per shard per this long; the bucket
+        // counters still see every stall
+        constexpr auto report_interval = std::chrono::seconds(5);
+        while (!_watchdog_stop.load(std::memory_order_relaxed)) {
+            std::this_thread::sleep_for(period);
+            auto now = steady_clock_type::now();
+            for (unsigned i = 0; i != smp::count; ++i) {
+                auto& r = *_reactors[i];
+                auto& w = shards[i];
+                auto progress = r._progress_counter.load(std::memory_order_relaxed);
+                if (progress != w.last_progress || r._sleeping.load(std::memory_order_relaxed)) {
+                    // advancing, or legitimately asleep in the kernel
+                    w.last_progress = progress;
+                    if (w.stalled) {
+                        auto d = now - w.stall_start;
+                        if (d >= threshold) {
+                            unsigned bucket = 0;
+                            while (bucket + 1 < reactor::stall_nr_buckets && d >= threshold * (2 << bucket)) {
+                                ++bucket;
+                            }
+                            r._stalls_by_bucket[bucket].fetch_add(1, std::memory_order_relaxed);
+                        }
+                        w.stalled = false;
+                    }
+                    continue;
+                }
+                if (!w.stalled) {
+                    w.stalled = true;
+                    w.stall_start = now;
+                    w.reported = false;
+                    continue;
+                }
+                if (now - w.stall_start < threshold || w.reported) {
+                    continue;
+                }
+                // a single report per stall, as early as possible; the
+                // total duration is only known once the stall ends
+                w.reported = true;
+                if (now - w.last_report >= report_interval) {
+                    w.last_report = now;
+                    report(i, r, std::chrono::duration_cast<std::chrono::milliseconds>(now - w.stall_start));
+                }
+            }
+        }
+    });
+}
+
 void smp::cleanup() {
+    if (_watchdog) {
+        _watchdog_stop.store(true, std::memory_order_relaxed);
+        _watchdog->join();
+        _watchdog.reset();
+    }
     smp::_threads = std::vector<posix_thread>();
     _thread_loops.clear();
+    if (_stealable_tasks) {
+        task* t;
+        while (_stealable_tasks->pop(t)) {
+            delete t;
+        }
+        _stealable_tasks.reset();
+    }
 }
 
 void smp::create_thread(std::function<void ()> thread_loop) {
@@ -3086,12 +4293,26 @@ void smp::configure(boost::program_options::variables_map configuration)
         rc.io_queues = configuration["num-io-queues"].as<unsigned>();
     }
 
+    auto pre_touch = !configuration.count("defer-memory-touch");
+    auto startup_timings = bool(configuration.count("startup-timings"));
+    auto phase_start = std::chrono::steady_clock::now();
+    auto report_phase = [&startup_timings, &phase_start] (const char* phase) {
+        auto now = std::chrono::steady_clock::now();
+        if (startup_timings) {
+            print("startup: %-18s %10.3f ms\n", phase,
+                    std::chrono::duration<double, std::milli>(now - phase_start).count());
+        }
+        phase_start = now;
+    };
+
     auto resources = resource::allocate(rc);
     std::vector<resource::cpu> allocations = std::move(resources.cpus);
     if (thread_affinity) {
         smp::pin(allocations[0].cpu_id);
     }
-    memory::configure(allocations[0].mem, hugepages_path);
+    report_phase("cpu allocation");
+    memory::configure(allocations[0].mem, hugepages_path, pre_touch);
+    report_phase("memory arena");
 
     if (configuration.count("abort-on-seastar-bad-alloc")) {
         memory::enable_abort_on_allocation_failure();
@@ -3104,6 +4325,7 @@ void smp::configure(boost::program_options::variables_map configuration)
             cpus[a.cpu_id] = true;
         }
         dpdk::eal::init(cpus, configuration);
+        report_phase("dpdk init");
     }
 #endif
 
@@ -3148,11 +4370,11 @@ void smp::configure(boost::program_options::variables_map configuration)
     unsigned i;
     for (i = 1; i < smp::count; i++) {
         auto allocation = allocations[i];
-        create_thread([configuration, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity] {
+        create_thread([configuration, hugepages_path, pre_touch, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity] {
             if (thread_affinity) {
                 smp::pin(allocation.cpu_id);
             }
-            memory::configure(allocation.mem, hugepages_path);
+            memory::configure(allocation.mem, hugepages_path, pre_touch);
             sigset_t mask;
             sigfillset(&mask);
             auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
@@ -3185,20 +4407,30 @@ void smp::configure(boost::program_options::variables_map configuration)
 #endif
 
     reactors_registered.wait();
+    auto smp_queue_length = configuration["smp-queue-length"].as<unsigned>();
     smp::_qs = new smp_message_queue* [smp::count];
     for(unsigned i = 0; i < smp::count; i++) {
         smp::_qs[i] = reinterpret_cast<smp_message_queue*>(operator new[] (sizeof(smp_message_queue) * smp::count));
         for (unsigned j = 0; j < smp::count; ++j) {
-            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i]);
+            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i], smp_queue_length);
         }
     }
     smp_queues_constructed.wait();
     start_all_queues();
     assign_io_queue(0, queue_idx);
     inited.wait();
+    // covers thread creation, the other shards' arenas, and the
+    // io/smp queue setup serialized by the barriers above
+    report_phase("reactor threads");
+
+    auto blocked_ms = configuration["blocked-reactor-notify-ms"].as<unsigned>();
+    if (blocked_ms) {
+        start_watchdog(std::chrono::milliseconds(blocked_ms));
+    }
 
     engine().configure(configuration);
     engine()._lowres_clock = std::make_unique<lowres_clock>();
+    report_phase("reactor configure");
 }
 
 bool smp::poll_queues() {
@@ -3232,7 +4464,7 @@ bool smp::pure_poll_queues() {
     return false;
 }
 
-__thread bool g_need_preempt;
+__thread std::atomic<bool> g_need_preempt;
 
 __thread reactor* local_engine;
 
@@ -3260,6 +4492,15 @@ reactor_backend_epoll::make_reactor_notifier() {
     return std::make_unique<reactor_notifier_epoll>();
 }
 
+#ifdef HAVE_URING
+std::unique_ptr<reactor_notifier>
+reactor_backend_uring::make_reactor_notifier() {
+    // The eventfd-based notifier works with any backend that can wait on
+    // file descriptors.
+    return std::make_unique<reactor_notifier_epoll>();
+}
+#endif
+
 #ifdef HAVE_OSV
 class reactor_notifier_osv :
         public reactor_notifier, private osv::newpoll::pollable {
@@ -3359,6 +4600,18 @@ reactor_backend_osv::writeable(pollable_fd_state& fd) {
     abort();
 }
 
+void
+reactor_backend_osv::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_reader() shouldn't have been called!\n";
+    abort();
+}
+
+void
+reactor_backend_osv::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_writer() shouldn't have been called!\n";
+    abort();
+}
+
 void
 reactor_backend_osv::forget(pollable_fd_state& fd) {
     std::cout << "reactor_backend_osv does not support file descriptors - forget() shouldn't have been called!\n";
@@ -3444,6 +4697,107 @@ future<file> open_directory(sstring name) {
     return engine().open_directory(std::move(name));
 }
 
+subscription<directory_entry>
+walk_directory(sstring path, std::function<future<> (directory_entry de)> next) {
+    struct walk_state {
+        stream<directory_entry> s;
+        sstring root;
+        // Caps the number of directories open at once, so walking a wide
+        // tree does not exhaust file descriptors.
+        semaphore dirs{8};
+        // produce() may only be called after the previous call resolved.
+        semaphore out{1};
+        // Set when the consumer callback failed; produce() has already
+        // forwarded the exception to the stream in that case.
+        bool consumer_failed = false;
+    };
+
+    struct walker {
+        static future<> emit(lw_shared_ptr<walk_state> ws, directory_entry de) {
+            return ws->out.wait().then([ws, de = std::move(de)] () mutable {
+                return ws->s.produce(std::move(de)).then_wrapped([ws] (future<> f) {
+                    if (f.failed()) {
+                        ws->consumer_failed = true;
+                    }
+                    return std::move(f);
+                });
+            }).finally([ws] {
+                ws->out.signal();
+            });
+        }
+        static future<> scan(lw_shared_ptr<walk_state> ws, sstring rel) {
+            auto full = rel.empty() ? ws->root : ws->root + "/" + rel;
+            // Entries are classified and delivered in the background, so
+            // the getdents() loop never waits for an individual stat();
+            // lookups for entries the file system did not type proceed in
+            // parallel across the syscall thread pool.
+            auto pending = make_lw_shared<std::vector<future<>>>();
+            return ws->dirs.wait().then([ws, rel, full, pending] {
+                return open_directory(full).then([ws, rel, full, pending] (file dir) {
+                    auto d = make_lw_shared<file>(std::move(dir));
+                    return d->list_directory([ws, rel, full, pending] (directory_entry de) {
+                        auto entry_rel = rel.empty() ? de.name : rel + "/" + de.name;
+                        auto typed = de.type
+                                ? make_ready_future<std::experimental::optional<directory_entry_type>>(de.type)
+                                : engine().file_type(full + "/" + de.name);
+                        pending->emplace_back(typed.then([ws, entry_rel] (std::experimental::optional<directory_entry_type> type) {
+                            return emit(ws, directory_entry{entry_rel, type}).then([ws, entry_rel, type] {
+                                if (type && *type == directory_entry_type::directory) {
+                                    return scan(ws, entry_rel);
+                                }
+                                return make_ready_future<>();
+                            });
+                        }));
+                        return make_ready_future<>();
+                    }).done().finally([d] {
+                        return d->close();
+                    });
+                });
+            }).finally([ws] {
+                // Release the directory slot before waiting for the
+                // subtrees; holding it while they wait for slots of their
+                // own would deadlock on trees deeper than the cap.
+                ws->dirs.signal();
+            }).then([pending] {
+                return when_all(pending->begin(), pending->end()).then([] (std::vector<future<>> results) {
+                    std::exception_ptr ex;
+                    for (auto& f : results) {
+                        if (f.failed()) {
+                            if (!ex) {
+                                ex = f.get_exception();
+                            } else {
+                                f.ignore_ready_future();
+                            }
+                        }
+                    }
+                    if (ex) {
+                        std::rethrow_exception(std::move(ex));
+                    }
+                });
+            });
+        }
+    };
+
+    auto ws = make_lw_shared<walk_state>();
+    ws->root = std::move(path);
+    auto ret = ws->s.listen(std::move(next));
+    ws->s.started().then([ws] {
+        return walker::scan(ws, sstring());
+    }).then_wrapped([ws] (future<> f) {
+        if (f.failed()) {
+            auto ex = f.get_exception();
+            if (!ws->consumer_failed) {
+                ws->s.set_exception(std::move(ex));
+            }
+            // Otherwise produce() already forwarded the consumer's
+            // exception; don't set it twice.
+        } else {
+            ws->s.close();
+        }
+    });
+    return ret;
+}
+
 future<> make_directory(sstring name) {
     return engine().make_directory(std::move(name));
 }
@@ -3539,9 +4893,12 @@ future<connected_socket> connect(socket_address sa, socket_address local, transp
 }
 
 void reactor::add_high_priority_task(std::unique_ptr<task>&& t) {
-    _pending_tasks.push_front(std::move(t));
+    auto& tq = *_task_queues[0];
+    tq.tasks.push_front(std::move(t));
+    // make sure the main queue runs next, regardless of accumulated runtime
+    tq.vruntime = _min_vruntime;
     // break .then() chains
-    g_need_preempt = true;
+    g_need_preempt.store(true, std::memory_order_relaxed);
 }
 
 static
@@ -3575,8 +4932,20 @@ void add_to_flush_poller(output_stream<char>* os) {
     engine()._flush_batching.emplace_back(os);
 }
 
+static boost::program_options::options_description posix_stack_options() {
+    namespace bpo = boost::program_options;
+    bpo::options_description opts("Posix stack options");
+    opts.add_options()
+        ("posix-zerocopy", bpo::value<bool>()->default_value(false),
+                "use MSG_ZEROCOPY for large writes, pinning user buffers until transmission completes instead of copying into the kernel")
+        ("posix-tcp-fastopen", bpo::value<bool>()->default_value(false),
+                "use TCP Fast Open on outgoing connections, deferring the SYN to the first write so it can carry data")
+        ;
+    return opts;
+}
+
 network_stack_registrator nsr_posix{"posix",
-    boost::program_options::options_description(),
+    posix_stack_options(),
     [](boost::program_options::variables_map ops) {
         return smp::main_thread() ? posix_network_stack::create(ops) : posix_ap_network_stack::create(ops);
     },
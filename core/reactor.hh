@@ -28,9 +28,13 @@
 #include <type_traits>
 #include <libaio.h>
 #include <sys/epoll.h>
+#ifdef HAVE_URING
+#include <linux/io_uring.h>
+#endif
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <netinet/ip.h>
 #include <cstring>
 #include <cassert>
@@ -47,6 +51,7 @@
 #include <atomic>
 #include <experimental/optional>
 #include <boost/lockfree/spsc_queue.hpp>
+#include <boost/lockfree/queue.hpp>
 #include <boost/optional.hpp>
 #include <boost/program_options.hpp>
 #include <boost/thread/barrier.hpp>
@@ -62,11 +67,15 @@
 #include "circular_buffer.hh"
 #include "file.hh"
 #include "semaphore.hh"
+#include "lowres_clock.hh"
 #include "fair_queue.hh"
 #include "core/scattered_message.hh"
 #include "core/enum.hh"
 #include "core/memory.hh"
 #include <boost/range/irange.hpp>
+#include "core/histogram.hh"
+#include "core/perf_counters.hh"
+#include "core/small_vector.hh"
 #include "timer.hh"
 #include "condition-variable.hh"
 #include "util/log.hh"
@@ -108,31 +117,6 @@ std::unique_ptr<CharType[], free_deleter> allocate_aligned_buffer(size_t size, s
     }
 }
 
-class lowres_clock {
-public:
-    typedef int64_t rep;
-    // The lowres_clock's resolution is 10ms. However, to make it is easier to
-    // do calcuations with std::chrono::milliseconds, we make the clock's
-    // period to 1ms instead of 10ms.
-    typedef std::ratio<1, 1000> period;
-    typedef std::chrono::duration<rep, period> duration;
-    typedef std::chrono::time_point<lowres_clock, duration> time_point;
-    lowres_clock();
-    static time_point now() {
-        auto nr = _now.load(std::memory_order_relaxed);
-        return time_point(duration(nr));
-    }
-private:
-    static void update();
-    // _now is updated by cpu0 and read by other cpus. Make _now on its own
-    // cache line to avoid false sharing.
-    static std::atomic<rep> _now [[gnu::aligned(64)]];
-    // High resolution timer to drive this low resolution clock
-    timer<> _timer [[gnu::aligned(64)]];
-    // High resolution timer expires every 10 milliseconds
-    static constexpr std::chrono::milliseconds _granularity{10};
-};
-
 class pollable_fd_state {
 public:
     struct speculation {
@@ -155,6 +139,10 @@ public:
     friend class pollable_fd;
 };
 
+// Most scatter/gather I/O involves only a few buffers; keep the iovec
+// list inline to avoid an allocation per call.
+using iovec_vector = seastar::small_vector<iovec, 4>;
+
 inline
 size_t iovec_len(const std::vector<iovec>& iov)
 {
@@ -165,6 +153,16 @@ size_t iovec_len(const std::vector<iovec>& iov)
     return ret;
 }
 
+inline
+size_t iovec_len(const iovec_vector& iov)
+{
+    size_t ret = 0;
+    for (auto&& e : iov) {
+        ret += e.iov_len;
+    }
+    return ret;
+}
+
 class pollable_fd {
 public:
     using speculation = pollable_fd_state::speculation;
@@ -175,18 +173,26 @@ public:
     pollable_fd& operator=(pollable_fd&&) = default;
     future<size_t> read_some(char* buffer, size_t size);
     future<size_t> read_some(uint8_t* buffer, size_t size);
-    future<size_t> read_some(const std::vector<iovec>& iov);
+    future<size_t> read_some(const iovec_vector& iov);
     future<> write_all(const char* buffer, size_t size);
     future<> write_all(const uint8_t* buffer, size_t size);
     future<size_t> write_some(net::packet& p);
+    // Like write_some(), but passes MSG_ZEROCOPY; the caller must keep the
+    // packet's buffers alive until the completion arrives on the error queue.
+    future<size_t> write_some_zerocopy(net::packet& p);
     future<> write_all(net::packet& p);
     future<> readable();
     future<> writeable();
     void abort_reader(std::exception_ptr ex);
     void abort_writer(std::exception_ptr ex);
     future<pollable_fd, socket_address> accept();
+    // Like accept(), but once the listening socket becomes readable, drains
+    // the kernel accept queue (up to max connections) in a single pass.
+    future<std::vector<std::pair<pollable_fd, socket_address>>> accept_batch(unsigned max);
     future<size_t> sendmsg(struct msghdr *msg);
     future<size_t> recvmsg(struct msghdr *msg);
+    future<size_t> sendmmsg(struct mmsghdr* msgs, unsigned vlen);
+    future<size_t> recvmmsg(struct mmsghdr* msgs, unsigned vlen);
     future<size_t> sendto(socket_address addr, const void* buf, size_t len);
     file_desc& get_file_desc() const { return _s->fd; }
     void shutdown(int how) { _s->fd.shutdown(how); }
@@ -214,6 +220,38 @@ struct hash<::sockaddr_in> {
 
 bool operator==(const ::sockaddr_in a, const ::sockaddr_in b);
 
+/// \brief Identifies a group of tasks that are scheduled together and
+/// entitled to a weighted fraction of the CPU.
+///
+/// Each group has a number of shares; when several groups have runnable
+/// tasks, CPU time is divided between them in proportion to their shares,
+/// so latency-critical continuations cannot be starved by background work
+/// (and vice versa - background work is guaranteed its fraction too).
+/// A scheduling_group is a trivially copyable handle; the per-shard task
+/// queues live inside the reactor.  Group 0 always exists and is where
+/// tasks run unless they are scheduled elsewhere.
+class scheduling_group {
+    unsigned _id = 0;
+    explicit scheduling_group(unsigned id) : _id(id) {}
+public:
+    /// Creates a handle to the default scheduling group.
+    scheduling_group() = default;
+    unsigned id() const { return _id; }
+    bool operator==(scheduling_group x) const { return _id == x._id; }
+    bool operator!=(scheduling_group x) const { return _id != x._id; }
+    friend class reactor;
+    friend future<scheduling_group> create_scheduling_group(sstring name, unsigned shares);
+};
+
+/// Returns the default scheduling group (group 0, named "main").
+inline scheduling_group default_scheduling_group() { return scheduling_group(); }
+
+/// \brief Creates a scheduling group with the given number of shares on
+/// every shard.
+///
+/// Must run on shard 0.  The returned handle is valid on all shards.
+future<scheduling_group> create_scheduling_group(sstring name, unsigned shares);
+
 class network_stack_registrator {
 public:
     using options = boost::program_options::variables_map;
@@ -273,7 +311,9 @@ class smp;
 class syscall_work_queue {
     static constexpr size_t queue_length = 128;
     struct work_item;
-    using lf_queue = boost::lockfree::spsc_queue<work_item*,
+    // multi-producer/multi-consumer: any of the helper threads may pop
+    // pending items and push completions
+    using lf_queue = boost::lockfree::queue<work_item*,
                             boost::lockfree::capacity<queue_length>>;
     lf_queue _pending;
     lf_queue _completed;
@@ -318,20 +358,29 @@ private:
 };
 
 class smp_message_queue {
-    static constexpr size_t queue_length = 128;
+    static constexpr size_t default_queue_length = 128;
+    // fixed threshold for the response side, which has no poller pacing it
     static constexpr size_t batch_size = 16;
+    // bounds for the adaptive flush threshold below
+    static constexpr size_t min_batch_size = 4;
+    static constexpr size_t max_batch_size = 64;
     static constexpr size_t prefetch_cnt = 2;
+    // how many items a single process_queue() call drains at most; also
+    // bounds the local copy made of the cross-cpu ring, so it stays a
+    // stack array even though the ring capacity is now a runtime value
+    static constexpr size_t process_batch_length = 128;
     struct work_item;
     struct lf_queue_remote {
         reactor* remote;
     };
-    using lf_queue_base = boost::lockfree::spsc_queue<work_item*,
-                            boost::lockfree::capacity<queue_length>>;
+    using lf_queue_base = boost::lockfree::spsc_queue<work_item*>;
     // use inheritence to control placement order
     struct lf_queue : lf_queue_remote, lf_queue_base {
-        lf_queue(reactor* remote) : lf_queue_remote{remote} {}
+        lf_queue(reactor* remote, size_t queue_length)
+            : lf_queue_remote{remote}, lf_queue_base(queue_length) {}
         void maybe_wakeup();
     };
+    size_t _queue_length;
     lf_queue _pending;
     lf_queue _completed;
     struct alignas(64) {
@@ -340,6 +389,11 @@ class smp_message_queue {
         size_t _last_snt_batch = 0;
         size_t _last_cmpl_batch = 0;
         size_t _current_queue_length = 0;
+        // flush threshold, doubled after full batches and halved after
+        // partial ones, so bursts amortize ring and wakeup costs while
+        // sparse traffic is not delayed waiting for company
+        size_t _cur_batch_size = min_batch_size;
+        size_t _blocked_on_room = 0;
     };
     // keep this between two structures with statistics
     // this makes sure that they have at least one cache line
@@ -358,6 +412,10 @@ class smp_message_queue {
     template <typename Func>
     struct async_work_item : work_item {
         Func _func;
+        // captured at submit() time; the remote shard runs _func under
+        // it and the completion hands it back, so a trace follows its
+        // work across shards
+        trace_context _trace = tracing::current();
         using futurator = futurize<std::result_of_t<Func()>>;
         using future_type = typename futurator::type;
         using value_type = typename future_type::value_type;
@@ -366,6 +424,7 @@ class smp_message_queue {
         typename futurator::promise_type _promise; // used on local side
         async_work_item(Func&& func) : _func(std::move(func)) {}
         virtual future<> process() override {
+            tracing::set_current(_trace);
             try {
                 return futurator::apply(this->_func).then_wrapped([this] (auto&& f) {
                     try {
@@ -380,6 +439,7 @@ class smp_message_queue {
             }
         }
         virtual void complete() override {
+            tracing::set_current(_trace);
             if (_result) {
                 _promise.set_value(std::move(*_result));
             } else {
@@ -398,13 +458,26 @@ class smp_message_queue {
         } a;
     } _tx;
     std::vector<work_item*> _completed_fifo;
+    // one unit per in-flight request; taken at submit() time and returned
+    // by process_completions(), so a full peer queue parks new senders on
+    // the semaphore instead of growing pending_fifo without bound
+    semaphore _queue_has_room;
 public:
-    smp_message_queue(reactor* from, reactor* to);
+    smp_message_queue(reactor* from, reactor* to, size_t queue_length = default_queue_length);
     template <typename Func>
     futurize_t<std::result_of_t<Func()>> submit(Func&& func) {
         auto wi = new async_work_item<Func>(std::forward<Func>(func));
         auto fut = wi->get_future();
-        submit_item(wi);
+        // try_wait() only succeeds when no earlier sender is parked, so
+        // submissions stay in order
+        if (_queue_has_room.try_wait()) {
+            submit_item(wi);
+        } else {
+            ++_blocked_on_room;
+            _queue_has_room.wait().then([this, wi] {
+                submit_item(wi);
+            });
+        }
         return fut;
     }
     void start(unsigned cpuid);
@@ -429,15 +502,22 @@ private:
 class thread_pool {
     uint64_t _aio_threaded_fallbacks = 0;
 #ifndef HAVE_OSV
+    // how many completions a helper thread accumulates before pushing
+    // them back to the reactor and considering a wakeup
+    static constexpr size_t completion_batch = 16;
     // FIXME: implement using reactor_notifier abstraction we used for SMP
     syscall_work_queue inter_thread_wq;
-    posix_thread _worker_thread;
+    std::vector<posix_thread> _worker_threads;
     std::atomic<bool> _stopped = { false };
     std::atomic<bool> _main_thread_idle = { false };
     pthread_t _notify;
 public:
     thread_pool();
     ~thread_pool();
+    // Grows the pool to \c nr_threads helper threads (never shrinks); a
+    // single thread serializes stat()/open() heavy workloads, so
+    // metadata-bound applications may want more.
+    void set_size(unsigned nr_threads);
     template <typename T, typename Func>
     future<T> submit(Func func) {
         ++_aio_threaded_fallbacks;
@@ -485,7 +565,16 @@ public:
     // they are called (which is fine if no file descriptors are waited on):
     virtual future<> readable(pollable_fd_state& fd) = 0;
     virtual future<> writeable(pollable_fd_state& fd) = 0;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) = 0;
     virtual void forget(pollable_fd_state& fd) = 0;
+    // Disk I/O submission and completion, expressed in terms of linux-aio
+    // iocbs. The default implementations go through the reactor's
+    // io_setup()ed context; a backend that owns a kernel queue of its own
+    // (reactor_backend_uring) overrides them so that file and socket I/O
+    // share a single submission/completion path.
+    virtual int submit_io(io_context_t io_context, iocb** iocbs, size_t nr);
+    virtual int getevents(io_context_t io_context, io_event* ev, size_t max);
     // Methods that allow polling on a reactor_notifier. This is currently
     // used only for reactor_backend_osv, but in the future it should really
     // replace the above functions.
@@ -516,9 +605,72 @@ public:
     virtual void forget(pollable_fd_state& fd) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
-    void abort_reader(pollable_fd_state& fd, std::exception_ptr ex);
-    void abort_writer(pollable_fd_state& fd, std::exception_ptr ex);
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+};
+
+#ifdef HAVE_URING
+// reactor backend using a Linux io_uring instance. A single pair of
+// submission/completion rings carries both socket readiness polls
+// (IORING_OP_POLL_ADD) and disk I/O (IORING_OP_READV and friends), so most
+// requests are queued in user memory and submitted in batches, and one
+// io_uring_enter() reaps every kind of completion. Selected at runtime with
+// --reactor-backend=io_uring; we fall back to reactor_backend_epoll on
+// kernels without io_uring support.
+class reactor_backend_uring : public reactor_backend {
+private:
+    static constexpr unsigned ring_entries = 1024;
+    ::io_uring_params _params = {};
+    file_desc _ring_fd;
+    // the three ring mappings; the unsigned*/io_uring_sqe*/io_uring_cqe*
+    // members below point into these
+    mmap_area _sq_map;
+    mmap_area _cq_map;
+    mmap_area _sqe_map;
+    unsigned _sq_entries;
+    unsigned _cq_entries;
+    unsigned* _sq_khead;
+    unsigned* _sq_ktail;
+    unsigned* _sq_kmask;
+    unsigned* _sq_array;
+    ::io_uring_sqe* _sqes;
+    unsigned* _cq_khead;
+    unsigned* _cq_ktail;
+    unsigned* _cq_kmask;
+    ::io_uring_cqe* _cqes;
+    unsigned _sq_tail = 0;      // our private tail; published on flush
+    unsigned _to_submit = 0;    // sqes queued but not yet io_uring_enter()ed
+    // disk completions reaped from the shared ring, waiting for getevents()
+    circular_buffer<io_event> _completed_io;
+    // user_data values of polls cancelled by forget(); their stale
+    // completions must not be dereferenced
+    std::unordered_set<uint64_t> _orphans;
+private:
+    ::io_uring_sqe* try_get_sqe();
+    void flush_submissions();
+    unsigned reap_completions();
+    void process_poll_completion(uint64_t user_data, int res);
+    future<> get_poll_future(pollable_fd_state& fd, promise<> pollable_fd_state::*pr, int event);
+    void abort_fd(pollable_fd_state& fd, std::exception_ptr ex,
+            promise<> pollable_fd_state::* pr, int event);
+public:
+    reactor_backend_uring();
+    virtual ~reactor_backend_uring() override = default;
+    // Probes the kernel without committing to anything; used to decide
+    // whether --reactor-backend=io_uring can be honored.
+    static bool available();
+    virtual bool wait_and_process(int timeout, const sigset_t* active_sigmask) override;
+    virtual future<> readable(pollable_fd_state& fd) override;
+    virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual void forget(pollable_fd_state& fd) override;
+    virtual future<> notified(reactor_notifier *n) override;
+    virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual int submit_io(io_context_t io_context, iocb** iocbs, size_t nr) override;
+    virtual int getevents(io_context_t io_context, io_event* ev, size_t max) override;
 };
+#endif /* HAVE_URING */
 
 #ifdef HAVE_OSV
 // reactor_backend using OSv-specific features, without any file descriptors.
@@ -537,6 +689,8 @@ public:
     virtual bool wait_and_process() override;
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
     virtual void forget(pollable_fd_state& fd) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
@@ -580,8 +734,9 @@ private:
     static constexpr unsigned _max_classes = 1024;
     static std::array<std::atomic<uint32_t>, _max_classes> _registered_shares;
     static std::array<sstring, _max_classes> _registered_names;
+    static std::array<std::atomic<uint32_t>, _max_classes> _registered_latency_goals; // microseconds; 0 = none
 
-    static io_priority_class register_one_priority_class(sstring name, uint32_t shares);
+    static io_priority_class register_one_priority_class(sstring name, uint32_t shares, std::chrono::microseconds latency_goal = {});
 
     priority_class_data& find_or_create_class(const io_priority_class& pc, shard_id owner);
     static void fill_shares_array();
@@ -593,7 +748,7 @@ public:
 
     template <typename Func>
     static future<io_event>
-    queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, Func do_io);
+    queue_request(shard_id coordinator, dev_t device, const io_priority_class& pc, size_t len, Func do_io);
 
     size_t capacity() const {
         return _capacity;
@@ -630,6 +785,9 @@ private:
         // If it returns false, the sleeping idle loop may not be entered.
         virtual bool try_enter_interrupt_mode() { return false; }
         virtual void exit_interrupt_mode() {}
+        // number of poll() calls that found work; identifies the
+        // dominating poller (see reactor::log_poller_stats())
+        uint64_t work_count = 0;
     };
 
     class io_pollfn;
@@ -661,6 +819,17 @@ public:
         static poller simple(Func&& poll) {
             return poller(make_pollfn(std::forward<Func>(poll)));
         }
+        // A poller that doesn't keep the reactor spinning: when the
+        // reactor idles, enter_fn runs and, by returning true, promises
+        // that further events will wake the reactor up (e.g. via a
+        // pollable_fd); exit_fn undoes the arrangement on wakeup.  A
+        // simple() poller never lets the reactor sleep.
+        template <typename PollFn, typename EnterFn, typename ExitFn>
+        // signatures: bool (), bool (), void ()
+        static poller interruptible(PollFn&& poll, EnterFn&& enter, ExitFn&& exit) {
+            return poller(make_interruptible_pollfn(std::forward<PollFn>(poll),
+                    std::forward<EnterFn>(enter), std::forward<ExitFn>(exit)));
+        }
         poller(std::unique_ptr<pollfn> fn)
                 : _pollfn(std::move(fn)) {
             do_register();
@@ -679,21 +848,24 @@ public:
     using idle_cpu_handler = std::function<idle_cpu_handler_result(work_waiting_on_reactor)>;
 
 private:
-    // FIXME: make _backend a unique_ptr<reactor_backend>, not a compile-time #ifdef.
+    // Chosen at construction (epoll by default) and possibly replaced in
+    // configure() before any file descriptor is registered, e.g. by
+    // --reactor-backend=io_uring.
+    std::unique_ptr<reactor_backend> _backend;
 #ifdef HAVE_OSV
-    reactor_backend_osv _backend;
     sched::thread _timer_thread;
     sched::thread *_engine_thread;
     mutable mutex _timer_mutex;
     condvar _timer_cond;
     s64 _timer_due = 0;
-#else
-    reactor_backend_epoll _backend;
 #endif
     sigset_t _active_sigmask; // holds sigmask while sleeping with sig disabled
     std::vector<pollfn*> _pollers;
 
     static constexpr size_t max_aio = 128;
+    // flush _pending_aio to the kernel once this many iocbs accumulate
+    // (a poll-end flush submits smaller leftovers); see --max-io-batch
+    size_t _max_aio_batch = max_aio / 4;
     // Not all reactors have IO queues. If the number of IO queues is less than the number of shards,
     // some reactors will talk to foreign io_queues. If this reactor holds a valid IO queue, it will
     // be stored here.
@@ -704,6 +876,12 @@ private:
     // separately saves us the pointer access.
     shard_id _io_coordinator;
     io_queue* _io_queue;
+    // Devices given their own concurrency limit via --io-queue-mountpoint.
+    // The queues themselves are created lazily, and only on I/O coordinator
+    // shards.
+    std::unordered_map<dev_t, unsigned> _io_queue_capacities;
+    std::unordered_map<dev_t, std::unique_ptr<io_queue>> _per_device_io_queues;
+    io_queue* io_queue_for_device(dev_t device);
     friend io_queue;
 
     std::vector<std::function<future<> ()>> _exit_funcs;
@@ -715,15 +893,37 @@ private:
     promise<std::unique_ptr<network_stack>> _network_stack_ready_promise;
     int _return = 0;
     timer_t _steady_clock_timer = {};
+    // last value armed into _steady_clock_timer, to elide no-op re-arms
+    steady_clock_type::time_point _steady_clock_armed = steady_clock_type::time_point::min();
     timer_t _task_quota_timer = {};
     promise<> _start_promise;
     semaphore _cpu_started;
     uint64_t _tasks_processed = 0;
+    // task instrumentation, exported via the "reactor" collectd metrics
+    uint64_t _task_quota_violations = 0;
+    std::chrono::nanoseconds _longest_task_duration = {};
+    const std::type_info* _longest_task_type = nullptr;
+    std::chrono::nanoseconds _longest_violation_logged = {};
+    // blocked-reactor watchdog state (--blocked-reactor-notify-ms): the
+    // event loop bumps _progress_counter as it advances; the watchdog
+    // thread (smp::start_watchdog()) samples it, and when a shard stops
+    // advancing for too long signals it, whose handler captures the
+    // blocked continuation's stack into _stall_frames for the watchdog
+    // to symbolize and log
+    static constexpr unsigned stall_nr_buckets = 8;
+    static constexpr unsigned max_stall_backtrace_depth = 64;
+    std::atomic<uint64_t> _progress_counter = { 0 };
+    void* _stall_frames[max_stall_backtrace_depth];
+    std::atomic<int> _stall_depth = { 0 };
+    // stalls by duration: bucket k counts stalls that lasted between
+    // 2^k and 2^(k+1) times the notify threshold
+    std::array<std::atomic<uint64_t>, stall_nr_buckets> _stalls_by_bucket = {};
+    bool _stall_detector_enabled = false;
     unsigned _max_task_backlog = 1000;
-    seastar::timer_set<timer<>, &timer<>::_link> _timers;
-    seastar::timer_set<timer<>, &timer<>::_link>::timer_list_t _expired_timers;
-    seastar::timer_set<timer<lowres_clock>, &timer<lowres_clock>::_link> _lowres_timers;
-    seastar::timer_set<timer<lowres_clock>, &timer<lowres_clock>::_link>::timer_list_t _expired_lowres_timers;
+    seastar::timer_backing_set<timer<>, &timer<>::_link> _timers;
+    seastar::timer_backing_set<timer<>, &timer<>::_link>::timer_list_t _expired_timers;
+    seastar::timer_backing_set<timer<lowres_clock>, &timer<lowres_clock>::_link> _lowres_timers;
+    seastar::timer_backing_set<timer<lowres_clock>, &timer<lowres_clock>::_link>::timer_list_t _expired_lowres_timers;
     io_context_t _io_context;
     std::vector<struct ::iocb> _pending_aio;
     semaphore _io_context_available;
@@ -733,7 +933,67 @@ private:
     uint64_t _aio_write_bytes = 0;
     uint64_t _fsyncs = 0;
     uint64_t _cxx_exceptions = 0;
-    circular_buffer<std::unique_ptr<task>> _pending_tasks;
+    // Opt-in per-request I/O trace (--io-trace).  Each completed request
+    // leaves its lifecycle timestamps in a small per-shard ring (for
+    // post-mortem inspection from a debugger or core dump), and the
+    // queue/device latency split feeds the log2 histograms below, which
+    // are exported like any other metric.
+    struct io_trace_entry {
+        std::chrono::steady_clock::time_point submit;   // created on the owner shard
+        std::chrono::steady_clock::time_point queued;   // arrived at the I/O coordinator
+        std::chrono::steady_clock::time_point dispatch; // left the fair queue
+        std::chrono::steady_clock::time_point complete; // completion reaped
+        size_t len;
+    };
+    static constexpr unsigned max_io_trace_entries = 1024;
+    static constexpr unsigned io_trace_latency_buckets = 16;
+    bool _io_trace_enabled = false;
+    std::vector<io_trace_entry> _io_trace;
+    size_t _io_trace_next = 0;
+    std::array<uint64_t, io_trace_latency_buckets> _io_trace_queue_hist = {};
+    std::array<uint64_t, io_trace_latency_buckets> _io_trace_device_hist = {};
+    void record_io_trace(io_trace_entry e);
+    // One task queue per scheduling group.  The queue to run next is the
+    // non-empty one with the smallest vruntime, i.e. the one furthest
+    // behind its entitled fraction of the CPU.
+    struct task_queue {
+        sstring name;
+        unsigned id = 0;     // which scheduling group this queue serves
+        unsigned shares;
+        // consumed CPU time scaled by 1/shares; the scheduler equalizes
+        // this across queues with runnable tasks
+        double vruntime = 0;
+        uint64_t runtime_ns = 0;
+        uint64_t tasks_processed = 0;
+        circular_buffer<std::unique_ptr<task>> tasks;
+        // Sampled latency tracing: every sample_rate-th enqueued task
+        // records its enqueue time; run_tasks() matches it by sequence
+        // number on dequeue and feeds the queue delay and the task's
+        // run time into shard-local histograms, in nanoseconds.  Tasks
+        // between samples only pay a counter decrement.
+        static constexpr unsigned sample_rate = 256;
+        struct task_sample {
+            uint64_t seq;
+            steady_clock_type::time_point enqueued;
+        };
+        uint64_t tasks_enqueued = 0;
+        uint64_t tasks_dequeued = 0;
+        unsigned sample_countdown = 1;
+        circular_buffer<task_sample> pending_samples;
+        seastar::histogram queue_delay_ns;
+        seastar::histogram task_runtime_ns;
+        std::vector<scollectd::registration> stats_regs;
+        task_queue(sstring name, unsigned shares);
+    };
+    static constexpr unsigned max_scheduling_groups = 16;
+    std::vector<std::unique_ptr<task_queue>> _task_queues;
+    scheduling_group _current_scheduling_group;
+    // lower bound for vruntime of a queue waking up from idle, so it
+    // cannot monopolize the CPU to make up for time it didn't want
+    double _min_vruntime = 0;
+    // per-shard PMU counters attributed to event loop phases; enabled
+    // with --cpu-perf-counters
+    perf_counters _perf_counters;
     circular_buffer<std::unique_ptr<task>> _at_destroy_tasks;
     std::chrono::duration<double> _task_quota;
     /// Handler that will be called when there is no task to execute on cpu.
@@ -751,10 +1011,19 @@ private:
     lowres_clock::time_point _lowres_next_timeout;
     std::experimental::optional<poller> _epoll_poller;
     std::experimental::optional<pollable_fd> _aio_eventfd;
-    const bool _reuseport;
+    bool _reuseport;
     circular_buffer<double> _loads;
     double _load = 0;
     std::chrono::nanoseconds _max_poll_time = calculate_poll_time();
+    // Adaptive idle governor: how long we keep polling while idle before
+    // arming the kernel wait.  Grows (up to _max_poll_time) whenever
+    // polling while idle finds work, and shrinks whenever a whole poll
+    // window expires without any, so lightly loaded shards stop burning
+    // whole cores while loaded ones keep poll-mode latency.
+    std::chrono::nanoseconds _poll_dwell = calculate_poll_time();
+    bool _adaptive_idle_poll = true;
+    bool _numa_audit_repair = false;
+    static constexpr std::chrono::microseconds _min_poll_dwell{5};
     circular_buffer<output_stream<char>* > _flush_batching;
     std::atomic<bool> _sleeping alignas(64);
     pthread_t _thread_id alignas(64) = pthread_self();
@@ -762,6 +1031,13 @@ private:
 private:
     static std::chrono::nanoseconds calculate_poll_time();
     static void clear_task_quota(int);
+    static void stall_signal_handler(int);
+    void bump_progress() {
+        // this shard is the only writer; the watchdog just needs to
+        // observe the value changing
+        _progress_counter.store(_progress_counter.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    }
     void wakeup();
     bool flush_pending_aio();
     bool flush_tcp_batches();
@@ -783,6 +1059,9 @@ private:
     bool pure_poll_once();
     template <typename Func> // signature: bool ()
     static std::unique_ptr<pollfn> make_pollfn(Func&& func);
+    template <typename PollFn, typename EnterFn, typename ExitFn>
+    static std::unique_ptr<pollfn> make_interruptible_pollfn(PollFn&& poll,
+            EnterFn&& enter, ExitFn&& exit);
 
     class signals {
     public:
@@ -808,7 +1087,12 @@ private:
     thread_pool _thread_pool;
     friend class thread_pool;
 
-    void run_tasks(circular_buffer<std::unique_ptr<task>>& tasks);
+    void run_tasks(circular_buffer<std::unique_ptr<task>>& tasks, task_queue* tq = nullptr);
+    void run_some_tasks();
+    void log_poller_stats();
+    task_queue* pick_task_queue();
+    bool have_pending_tasks() const;
+    uint64_t pending_task_count() const;
     bool posix_reuseport_detect();
 public:
     static boost::program_options::options_description get_options_description();
@@ -821,8 +1105,16 @@ public:
         return *_io_queue;
     }
 
-    io_priority_class register_one_priority_class(sstring name, uint32_t shares) {
-        return io_queue::register_one_priority_class(std::move(name), shares);
+    /// Runs a blocking or CPU-heavy function on the syscall helper thread
+    /// pool, resolving the returned future with its result.  The function
+    /// must not touch reactor state.
+    template <typename T, typename Func>
+    future<T> submit_blocking(Func func) {
+        return _thread_pool.submit<T>(std::move(func));
+    }
+
+    io_priority_class register_one_priority_class(sstring name, uint32_t shares, std::chrono::microseconds latency_goal = {}) {
+        return io_queue::register_one_priority_class(std::move(name), shares, latency_goal);
     }
 
     void configure(boost::program_options::variables_map config);
@@ -840,9 +1132,10 @@ public:
     future<> posix_connect(lw_shared_ptr<pollable_fd> pfd, socket_address sa, socket_address local);
 
     future<pollable_fd, socket_address> accept(pollable_fd_state& listen_fd);
+    future<std::vector<std::pair<pollable_fd, socket_address>>> accept_batch(pollable_fd_state& listen_fd, unsigned max);
 
     future<size_t> read_some(pollable_fd_state& fd, void* buffer, size_t size);
-    future<size_t> read_some(pollable_fd_state& fd, const std::vector<iovec>& iov);
+    future<size_t> read_some(pollable_fd_state& fd, const iovec_vector& iov);
 
     future<size_t> write_some(pollable_fd_state& fd, const void* buffer, size_t size);
 
@@ -866,9 +1159,9 @@ public:
     template <typename Func>
     future<io_event> submit_io(Func prepare_io);
     template <typename Func>
-    future<io_event> submit_io_read(const io_priority_class& priority_class, size_t len, Func prepare_io);
+    future<io_event> submit_io_read(dev_t device, const io_priority_class& priority_class, size_t len, Func prepare_io);
     template <typename Func>
-    future<io_event> submit_io_write(const io_priority_class& priority_class, size_t len, Func prepare_io);
+    future<io_event> submit_io_write(dev_t device, const io_priority_class& priority_class, size_t len, Func prepare_io);
 
     int run();
     void exit(int ret);
@@ -887,7 +1180,13 @@ public:
         _at_destroy_tasks.push_back(make_task(std::forward<Func>(func)));
     }
 
-    void add_task(std::unique_ptr<task>&& t) { _pending_tasks.push_back(std::move(t)); }
+    // Adds a task to the scheduling group of the currently running task, so
+    // continuations stay in the group that spawned them.
+    void add_task(std::unique_ptr<task>&& t) { add_task_in(_current_scheduling_group, std::move(t)); }
+    void add_task_in(scheduling_group sg, std::unique_ptr<task>&& t);
+    // Instantiates sg's task queue on this shard; used by create_scheduling_group().
+    void init_scheduling_group(scheduling_group sg, sstring name, unsigned shares);
+    scheduling_group current_scheduling_group() const { return _current_scheduling_group; }
 
     /// Set a handler that will be called when there is no task to execute on cpu.
     /// Handler should do a low priority work.
@@ -950,35 +1249,37 @@ private:
     friend class timer<lowres_clock>;
     friend class smp;
     friend class smp_message_queue;
+    template <typename T>
+    friend class mpsc_queue;
     friend class poller;
     friend void add_to_flush_poller(output_stream<char>* os);
     friend int _Unwind_RaiseException(void *h);
 public:
     bool wait_and_process(int timeout = 0, const sigset_t* active_sigmask = nullptr) {
-        return _backend.wait_and_process(timeout, active_sigmask);
+        return _backend->wait_and_process(timeout, active_sigmask);
     }
 
     future<> readable(pollable_fd_state& fd) {
-        return _backend.readable(fd);
+        return _backend->readable(fd);
     }
     future<> writeable(pollable_fd_state& fd) {
-        return _backend.writeable(fd);
+        return _backend->writeable(fd);
     }
     void forget(pollable_fd_state& fd) {
-        _backend.forget(fd);
+        _backend->forget(fd);
     }
     future<> notified(reactor_notifier *n) {
-        return _backend.notified(n);
+        return _backend->notified(n);
     }
     void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_reader(fd, std::move(ex));
+        return _backend->abort_reader(fd, std::move(ex));
     }
     void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_writer(fd, std::move(ex));
+        return _backend->abort_writer(fd, std::move(ex));
     }
     void enable_timer(steady_clock_type::time_point when);
     std::unique_ptr<reactor_notifier> make_reactor_notifier() {
-        return _backend.make_reactor_notifier();
+        return _backend->make_reactor_notifier();
     }
     /// Sets the "Strict DMA" flag.
     ///
@@ -1011,6 +1312,35 @@ reactor::make_pollfn(Func&& func) {
     return std::make_unique<the_pollfn>(std::forward<Func>(func));
 }
 
+template <typename PollFn, typename EnterFn, typename ExitFn>
+inline
+std::unique_ptr<reactor::pollfn>
+reactor::make_interruptible_pollfn(PollFn&& poll, EnterFn&& enter, ExitFn&& exit) {
+    struct the_pollfn : pollfn {
+        the_pollfn(PollFn&& poll, EnterFn&& enter, ExitFn&& exit)
+            : poll_fn(std::forward<PollFn>(poll))
+            , enter_fn(std::forward<EnterFn>(enter))
+            , exit_fn(std::forward<ExitFn>(exit)) {}
+        PollFn poll_fn;
+        EnterFn enter_fn;
+        ExitFn exit_fn;
+        virtual bool poll() override final {
+            return poll_fn();
+        }
+        virtual bool pure_poll() override final {
+            return poll(); // dubious, but compatible
+        }
+        virtual bool try_enter_interrupt_mode() override final {
+            return enter_fn();
+        }
+        virtual void exit_interrupt_mode() override final {
+            exit_fn();
+        }
+    };
+    return std::make_unique<the_pollfn>(std::forward<PollFn>(poll),
+            std::forward<EnterFn>(enter), std::forward<ExitFn>(exit));
+}
+
 extern __thread reactor* local_engine;
 extern __thread size_t task_quota;
 
@@ -1018,6 +1348,28 @@ inline reactor& engine() {
     return *local_engine;
 }
 
+/// Returns the scheduling group of the currently running task.
+inline scheduling_group current_scheduling_group() {
+    return engine().current_scheduling_group();
+}
+
+/// \brief Runs \c func as a task in scheduling group \c sg.
+///
+/// Continuations chained off the returned future run in \c sg as well, so
+/// this is the usual way of pushing a whole computation into a group.
+template <typename Func>
+inline
+futurize_t<std::result_of_t<Func ()>>
+with_scheduling_group(scheduling_group sg, Func func) {
+    using futurator = futurize<std::result_of_t<Func ()>>;
+    typename futurator::promise_type pr;
+    auto f = pr.get_future();
+    engine().add_task_in(sg, make_task([pr = std::move(pr), func = std::move(func)] () mutable {
+        futurator::apply(func).forward_to(std::move(pr));
+    }));
+    return f;
+}
+
 class smp {
     static std::vector<posix_thread> _threads;
     static std::vector<std::function<void ()>> _thread_loops; // for dpdk
@@ -1026,6 +1378,17 @@ class smp {
     static smp_message_queue** _qs;
     static std::thread::id _tmain;
     static bool _using_dpdk;
+    // Work-stealing pool (opt-in via --work-stealing): tasks explicitly
+    // submitted as stealable may be run by whichever shard goes idle
+    // first.  Unlike the smp_message_queue rings this queue is
+    // multi-producer/multi-consumer, since any shard may push or pull.
+    static std::unique_ptr<boost::lockfree::queue<task*>> _stealable_tasks;
+    static std::atomic<int> _stealable_pending;
+    static bool _work_stealing;
+    // blocked-reactor watchdog (--blocked-reactor-notify-ms)
+    static std::unique_ptr<posix_thread> _watchdog;
+    static std::atomic<bool> _watchdog_stop;
+    static void start_watchdog(std::chrono::milliseconds threshold);
 
     template <typename Func>
     using returns_future = is_future<std::result_of_t<Func()>>;
@@ -1041,6 +1404,15 @@ public:
 
     /// Runs a function on a remote core.
     ///
+    /// When \c t is the local core the function is invoked inline, without
+    /// touching the message queues or allocating a work item; if it does
+    /// not return a future the call is guaranteed allocation-free, so
+    /// shard-agnostic code may call submit_to() unconditionally with no
+    /// penalty on the same-shard path.  For cross-shard reads of small,
+    /// rarely-changing data, consider publishing it into a
+    /// shard_published<> (core/shard_published.hh) instead, which skips
+    /// the round trip entirely.
+    ///
     /// \param t designates the core to run the function on (may be a remote
     ///          core or the local core).
     /// \param func a callable to run on core \c t.  If \c func is a temporary object,
@@ -1075,6 +1447,18 @@ public:
     }
     static bool poll_queues();
     static bool pure_poll_queues();
+    /// Submits a task that whichever shard goes idle first may execute.
+    /// Fire-and-forget; the task must not assume it runs on a particular
+    /// shard (use smp::submit_to() from within it to get back to one).
+    /// Runs the task on the local shard if --work-stealing is off or the
+    /// pool is full.
+    template <typename Func>
+    static void submit_stealable(Func&& func) {
+        schedule_stealable(make_task(std::forward<Func>(func)));
+    }
+    static void schedule_stealable(std::unique_ptr<task> t);
+    // Runs one stolen task, if any is available; called by idle reactors.
+    static bool try_run_one_stealable_task();
     static boost::integer_range<unsigned> all_cpus() {
         return boost::irange(0u, count);
     }
@@ -1126,6 +1510,33 @@ reactor::accept(pollable_fd_state& listenfd) {
     });
 }
 
+inline
+future<std::vector<std::pair<pollable_fd, socket_address>>>
+reactor::accept_batch(pollable_fd_state& listenfd, unsigned max) {
+    return readable(listenfd).then([this, &listenfd, max] () mutable {
+        std::vector<std::pair<pollable_fd, socket_address>> conns;
+        while (conns.size() < max) {
+            socket_address sa;
+            socklen_t sl = sizeof(&sa.u.sas);
+            auto fd = listenfd.fd.try_accept(sa.u.sa, sl, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (!fd) {
+                break;
+            }
+            conns.emplace_back(pollable_fd(std::move(*fd), pollable_fd::speculation(EPOLLOUT)), sa);
+        }
+        if (conns.empty()) {
+            // Spurious wakeup; go back to sleep.
+            return accept_batch(listenfd, max);
+        }
+        if (conns.size() == max) {
+            // The accept queue may hold more; have the next call try to
+            // drain it without a round-trip through epoll.
+            listenfd.speculate_epoll(EPOLLIN);
+        }
+        return make_ready_future<std::vector<std::pair<pollable_fd, socket_address>>>(std::move(conns));
+    });
+}
+
 inline
 future<size_t>
 reactor::read_some(pollable_fd_state& fd, void* buffer, size_t len) {
@@ -1143,7 +1554,7 @@ reactor::read_some(pollable_fd_state& fd, void* buffer, size_t len) {
 
 inline
 future<size_t>
-reactor::read_some(pollable_fd_state& fd, const std::vector<iovec>& iov) {
+reactor::read_some(pollable_fd_state& fd, const iovec_vector& iov) {
     return readable(fd).then([this, &fd, iov = iov] () mutable {
         ::msghdr mh = {};
         mh.msg_iov = &iov[0];
@@ -1205,7 +1616,7 @@ future<size_t> pollable_fd::read_some(uint8_t* buffer, size_t size) {
 }
 
 inline
-future<size_t> pollable_fd::read_some(const std::vector<iovec>& iov) {
+future<size_t> pollable_fd::read_some(const iovec_vector& iov) {
     return engine().read_some(*_s, iov);
 }
 
@@ -1245,6 +1656,24 @@ future<size_t> pollable_fd::write_some(net::packet& p) {
     });
 }
 
+inline
+future<size_t> pollable_fd::write_some_zerocopy(net::packet& p) {
+    return engine().writeable(*_s).then([this, &p] () mutable {
+        iovec* iov = reinterpret_cast<iovec*>(p.fragment_array());
+        msghdr mh = {};
+        mh.msg_iov = iov;
+        mh.msg_iovlen = p.nr_frags();
+        auto r = get_file_desc().sendmsg(&mh, MSG_NOSIGNAL | MSG_ZEROCOPY);
+        if (!r) {
+            return write_some_zerocopy(p);
+        }
+        if (size_t(*r) == p.len()) {
+            _s->speculate_epoll(EPOLLOUT);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
 inline
 future<> pollable_fd::write_all(net::packet& p) {
     return write_some(p).then([this, &p] (size_t size) {
@@ -1283,6 +1712,11 @@ future<pollable_fd, socket_address> pollable_fd::accept() {
     return engine().accept(*_s);
 }
 
+inline
+future<std::vector<std::pair<pollable_fd, socket_address>>> pollable_fd::accept_batch(unsigned max) {
+    return engine().accept_batch(*_s, max);
+}
+
 inline
 future<size_t> pollable_fd::recvmsg(struct msghdr *msg) {
     return engine().readable(*_s).then([this, msg] {
@@ -1319,6 +1753,37 @@ future<size_t> pollable_fd::sendmsg(struct msghdr* msg) {
     });
 }
 
+inline
+future<size_t> pollable_fd::recvmmsg(struct mmsghdr* msgs, unsigned vlen) {
+    return engine().readable(*_s).then([this, msgs, vlen] {
+        auto r = get_file_desc().recvmmsg(msgs, vlen, 0);
+        if (!r) {
+            return recvmmsg(msgs, vlen);
+        }
+        // Speculate only when we filled every slot; a short batch means
+        // the socket queue is drained.
+        if (*r == vlen) {
+            _s->speculate_epoll(EPOLLIN);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
+inline
+future<size_t> pollable_fd::sendmmsg(struct mmsghdr* msgs, unsigned vlen) {
+    return engine().writeable(*_s).then([this, msgs, vlen] () mutable {
+        auto r = get_file_desc().sendmmsg(msgs, vlen, 0);
+        if (!r) {
+            return sendmmsg(msgs, vlen);
+        }
+        // See the comment about speculation in sendmsg().
+        if (*r == vlen) {
+            _s->speculate_epoll(EPOLLOUT);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
 inline
 future<size_t> pollable_fd::sendto(socket_address addr, const void* buf, size_t len) {
     return engine().writeable(*_s).then([this, buf, len, addr] () mutable {
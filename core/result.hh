@@ -0,0 +1,184 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB.
+ */
+
+#pragma once
+
+#include "future.hh"
+#include <cassert>
+#include <type_traits>
+#include <utility>
+
+/// \addtogroup future-module
+/// @{
+
+/// \cond internal
+struct result_error_tag {};
+/// \endcond
+
+/// Tag for constructing a \ref result holding an error.
+static constexpr result_error_tag result_error {};
+
+/// \brief An expected-style value-or-error, for exception-free failure paths.
+///
+/// A failed future carries an std::exception_ptr, which costs an
+/// allocation to create and a throw/catch to examine - acceptable for
+/// rare failures, but not for failures that are part of the protocol,
+/// like timeouts on an RPC path.  A future<result<T, E>> instead
+/// always resolves successfully and carries either the value or a
+/// cheap error value (typically an enum), so expected failures flow
+/// through .then() chains with no allocation and no unwinding.
+/// futurize and the rest of the future machinery need no special
+/// support, since the future itself never fails; exceptions remain
+/// available for the genuinely exceptional.
+///
+/// \c T and \c E must be distinct types; use the \ref result_error tag
+/// to construct the error alternative.
+template <typename T, typename E>
+class result {
+    union {
+        T _value;
+        E _error;
+    };
+    bool _has_value;
+public:
+    using value_type = T;
+    using error_type = E;
+
+    result(T&& value) : _value(std::move(value)), _has_value(true) {}
+    result(const T& value) : _value(value), _has_value(true) {}
+    result(result_error_tag, E error) : _error(std::move(error)), _has_value(false) {}
+    result(result&& x) noexcept(std::is_nothrow_move_constructible<T>::value
+                                && std::is_nothrow_move_constructible<E>::value)
+            : _has_value(x._has_value) {
+        if (_has_value) {
+            new (&_value) T(std::move(x._value));
+        } else {
+            new (&_error) E(std::move(x._error));
+        }
+    }
+    result(const result& x) : _has_value(x._has_value) {
+        if (_has_value) {
+            new (&_value) T(x._value);
+        } else {
+            new (&_error) E(x._error);
+        }
+    }
+    ~result() {
+        if (_has_value) {
+            _value.~T();
+        } else {
+            _error.~E();
+        }
+    }
+    result& operator=(result&& x) noexcept(std::is_nothrow_move_constructible<T>::value
+                                           && std::is_nothrow_move_constructible<E>::value) {
+        if (this != &x) {
+            this->~result();
+            new (this) result(std::move(x));
+        }
+        return *this;
+    }
+    result& operator=(const result& x) {
+        if (this != &x) {
+            this->~result();
+            new (this) result(x);
+        }
+        return *this;
+    }
+
+    /// Returns true if this result holds a value rather than an error.
+    bool has_value() const { return _has_value; }
+    explicit operator bool() const { return _has_value; }
+
+    /// Returns the contained value; must hold a value.
+    T& value() & { assert(_has_value); return _value; }
+    const T& value() const& { assert(_has_value); return _value; }
+    T&& value() && { assert(_has_value); return std::move(_value); }
+
+    /// Returns the contained error; must hold an error.
+    E& error() & { assert(!_has_value); return _error; }
+    const E& error() const& { assert(!_has_value); return _error; }
+    E&& error() && { assert(!_has_value); return std::move(_error); }
+};
+
+/// Creates a \ref result holding an error, with the value type spelled
+/// out once: \c make_result_error<T>(my_errors::timed_out).
+template <typename T, typename E>
+inline
+result<T, std::decay_t<E>>
+make_result_error(E&& error) {
+    return result<T, std::decay_t<E>>(result_error, std::forward<E>(error));
+}
+
+/// Applies \c func to the value carried by a result-bearing future,
+/// propagating errors untouched: the value-or-error analogue of
+/// .then().  \c func receives the value (by rvalue) and returns a
+/// plain value of some type \c U; the resulting future carries
+/// result<U, E>.
+template <typename T, typename E, typename Func>
+inline
+auto
+map_result(future<result<T, E>> f, Func func) {
+    using U = std::result_of_t<Func (T&&)>;
+    return f.then([func = std::move(func)] (result<T, E> r) mutable {
+        if (r) {
+            return make_ready_future<result<U, E>>(result<U, E>(func(std::move(r).value())));
+        }
+        return make_ready_future<result<U, E>>(result<U, E>(result_error, std::move(r).error()));
+    });
+}
+
+/// Chains a result-bearing future into another asynchronous step:
+/// \c func receives the value (by rvalue) and returns a
+/// future<result<U, E>>; errors short-circuit past \c func as values,
+/// with no exception in flight.
+template <typename T, typename E, typename Func>
+inline
+auto
+then_result(future<result<T, E>> f, Func func) {
+    using future_type = std::result_of_t<Func (T&&)>;
+    return f.then([func = std::move(func)] (result<T, E> r) mutable {
+        if (r) {
+            return func(std::move(r).value());
+        }
+        using U = typename future_type::value_type; // std::tuple<result<U, E>>
+        using result_type = std::tuple_element_t<0, U>;
+        return make_ready_future<result_type>(result_type(result_error, std::move(r).error()));
+    });
+}
+
+/// Converts a result-bearing future into an ordinary one, surfacing a
+/// carried error as a failed future via \c exception_factory(error).
+/// Useful at the boundary where a hot, exception-free path meets code
+/// that speaks exceptions.
+template <typename T, typename E, typename ExceptionFactory>
+inline
+future<T>
+result_to_future(future<result<T, E>> f, ExceptionFactory exception_factory) {
+    return f.then([exception_factory = std::move(exception_factory)] (result<T, E> r) mutable {
+        if (r) {
+            return make_ready_future<T>(std::move(r).value());
+        }
+        return make_exception_future<T>(exception_factory(std::move(r).error()));
+    });
+}
+
+/// @}
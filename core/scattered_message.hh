@@ -57,8 +57,8 @@ public:
         append_static(s, strlen(s));
     }
 
-    template <typename size_type, size_type max_size>
-    void append_static(const basic_sstring<char_type, size_type, max_size>& s) {
+    template <typename size_type, size_type max_size, bool nul_terminate>
+    void append_static(const basic_sstring<char_type, size_type, max_size, nul_terminate>& s) {
         append_static(s.begin(), s.size());
     }
 
@@ -66,24 +66,45 @@ public:
         append_static(s.data(), s.size());
     }
 
-    template <typename size_type, size_type max_size>
-    void append(basic_sstring<char_type, size_type, max_size> s) {
+    template <typename size_type, size_type max_size, bool nul_terminate>
+    void append(basic_sstring<char_type, size_type, max_size, nul_terminate> s) {
         if (s.size()) {
             _p = packet(std::move(_p), std::move(s).release());
         }
     }
 
-    template <typename size_type, size_type max_size, typename Callback>
-    void append(const basic_sstring<char_type, size_type, max_size>& s, Callback callback) {
+    template <typename size_type, size_type max_size, bool nul_terminate, typename Callback>
+    void append(const basic_sstring<char_type, size_type, max_size, nul_terminate>& s, Callback callback) {
         if (s.size()) {
             _p = packet(std::move(_p), fragment{s.begin(), s.size()}, make_deleter(std::move(callback)));
         }
     }
 
+    void append(temporary_buffer<char_type> buf) {
+        if (buf.size()) {
+            _p = packet(std::move(_p), fragment{buf.get_write(), buf.size()}, buf.release());
+        }
+    }
+
+    // Transfers another message's fragments wholesale: the fragment
+    // array grows at most once, never once per fragment, and the
+    // deleter chains are spliced rather than nested
+    void append(scattered_message&& o) {
+        if (o._p.len()) {
+            _p.append(std::move(o._p));
+        }
+    }
+
     void reserve(int n_frags) {
         _p.reserve(n_frags);
     }
 
+    // Fragments appended so far; lets a caller reserve() an enclosing
+    // message precisely before transferring this one into it
+    unsigned nr_frags() const {
+        return _p.nr_frags();
+    }
+
     packet release() && {
         return std::move(_p);
     }
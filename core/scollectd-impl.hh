@@ -34,7 +34,8 @@ static const std::chrono::milliseconds default_period(1s);
 
 class impl {
     net::udp_channel _chan;
-    timer<> _timer;
+    // second-scale period; the coarse clock is plenty
+    timer<lowres_clock> _timer;
 
     sstring _host = "localhost";
     ipv4_addr _addr = default_addr;
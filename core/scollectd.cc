@@ -208,6 +208,11 @@ struct cpwriter {
     cpwriter & put(const sstring & host,
             const duration & period,
             const type_instance_id & id, const value_list & v) {
+        if (v.is_histogram()) {
+            // no histogram type in the collectd protocol; these are
+            // only exported through get_value_map().
+            return *this;
+        }
         const auto ps = std::chrono::duration_cast<collectd_hres_duration>(
                 period).count();
         put(host, id);
@@ -470,7 +475,7 @@ static std::vector<collectd_value> raw_to_value(shared_ptr<value_list> raw_types
 
     auto i = value.begin();
     for (auto t : types) {
-        collectd_value c(t, be64toh(*i));
+        collectd_value c(t, be64toh(*i++));
         res_values.push_back(c);
     }
     return res_values;
@@ -36,6 +36,7 @@
 
 #include "future.hh"
 #include "net/byteorder.hh"
+#include "core/histogram.hh"
 #include "core/shared_ptr.hh"
 #include "core/sstring.hh"
 
@@ -85,6 +86,9 @@ enum class data_type : uint8_t {
     GAUGE, // double
     DERIVE, // signed int 64
     ABSOLUTE, // unsigned int 64
+    HISTOGRAM, // seastar::histogram bucket counter. Not a collectd wire
+               // type; such values are only exported through the local
+               // value_map API (e.g. the prometheus exporter).
 };
 
 enum class known_type {
@@ -693,6 +697,12 @@ public:
     void set_enabled(bool b) {
         _enabled = b;
     }
+
+    // histogram lists cannot be sent over the collectd protocol and
+    // are skipped by the network sender.
+    virtual bool is_histogram() const {
+        return false;
+    }
 private:
     description _description;
 };
@@ -739,6 +749,35 @@ private:
     std::tuple < Args... > _values;
 };
 
+// Exposes a shard-local seastar::histogram as a value list: the sample
+// count, the sample sum, and one counter per bucket, in that order, all
+// typed data_type::HISTOGRAM. The histogram must outlive the
+// registration, like any other polled variable.
+class histogram_values : public value_list {
+public:
+    histogram_values(description d, const seastar::histogram& h)
+        : value_list(std::move(d)), _h(h) {
+    }
+    size_t size() const override {
+        return 2 + seastar::histogram::n_buckets;
+    }
+    void types(data_type * p) const override {
+        std::fill_n(p, size(), data_type::HISTOGRAM);
+    }
+    void values(net::packed<uint64_t> * p) const override {
+        *p++ = ntohq(_h.count());
+        *p++ = ntohq(_h.sum());
+        for (unsigned i = 0; i < seastar::histogram::n_buckets; i++) {
+            *p++ = ntohq(_h.bucket(i));
+        }
+    }
+    bool is_histogram() const override {
+        return true;
+    }
+private:
+    const seastar::histogram& _h;
+};
+
 void add_polled(const type_instance_id &, const shared_ptr<value_list> &, bool enabled = true);
 
 typedef std::function<void()> notify_function;
@@ -794,6 +833,16 @@ static type_instance_id add_polled_metric(const type_instance_id & id, descripti
     return id;
 }
 
+static inline type_instance_id add_polled_metric(const type_instance_id & id,
+        description d, seastar::histogram & h) {
+    add_polled(id, ::make_shared<histogram_values>(std::move(d), h));
+    return id;
+}
+static inline type_instance_id add_polled_metric(const type_instance_id & id,
+        seastar::histogram & h) {
+    return add_polled_metric(id, description(), h);
+}
+
 template<typename ... Args>
 static type_instance_id add_disabled_polled_metric(const type_instance_id & id, description d,
         Args&& ... args) {
@@ -109,6 +109,20 @@ private:
         entry& operator=(entry&&) noexcept = delete;
     };
     chunked_fifo<entry> _wait_list;
+private:
+    // Contended (or broken) path of wait(), kept out of line so the
+    // uncontended path inlines into callers as a compare, a decrement
+    // and a ready future, with no allocation.
+    [[gnu::noinline]]
+    future<> wait_slow(size_t nr) {
+        if (_ex) {
+            return make_exception_future(_ex);
+        }
+        promise<> pr;
+        auto fut = pr.get_future();
+        _wait_list.push_back(entry(std::move(pr), nr));
+        return fut;
+    }
 public:
     using duration =  timer<>::duration;
     using clock =  timer<>::clock;
@@ -131,17 +145,10 @@ public:
     ///         to satisfy the request.  If the semaphore was \ref broken(), may
     ///         contain an exception.
     future<> wait(size_t nr = 1) {
-        if (_count >= nr && _wait_list.empty()) {
-            _count -= nr;
+        if (try_wait(nr)) {
             return make_ready_future<>();
         }
-        if (_ex) {
-            return make_exception_future(_ex);
-        }
-        promise<> pr;
-        auto fut = pr.get_future();
-        _wait_list.push_back(entry(std::move(pr), nr));
-        return fut;
+        return wait_slow(nr);
     }
     /// Waits until at least a specific number of units are available in the
     /// counter, and reduces the counter by that amount of units.  If the request
@@ -0,0 +1,98 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "reactor.hh"
+#include <atomic>
+#include <type_traits>
+#include <vector>
+
+/// Read-mostly storage that each shard publishes and any shard may peek.
+///
+/// smp::submit_to() costs a message-queue round trip even when the remote
+/// function only reads a small, rarely-changing value -- statistics, load
+/// estimates, configuration a shard republishes after updates.  A
+/// shard_published<T> gives each shard a slot it updates locally with
+/// publish(); any shard copies out a consistent snapshot of any slot with
+/// peek(), with no allocation and no round trip.
+///
+/// Each slot is protected by a sequence lock: the writer bumps the
+/// sequence to an odd value, writes the data, and bumps it again; a
+/// reader retries its copy if it observed an odd sequence or a change
+/// across the copy.  Readers never block the writer, and since the owner
+/// republishes rarely, retries are all but nonexistent.  This requires
+/// \c T to be trivially copyable (a torn copy is thrown away, never
+/// looked at); keep it small -- a cache line or two.  Large or mutable
+/// shared state still belongs behind submit_to().
+///
+/// publish() must only be called from the owning shard.  The object
+/// itself must be created before use and destroyed after use on all
+/// shards, like any memory shared across the smp; creating it in main()
+/// before engine start and never destroying it is the typical pattern.
+template <typename T>
+class shard_published {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "shard_published requires a trivially copyable T; peek() discards torn copies without inspecting them");
+    // one slot per shard, padded apart so the writers do not false-share
+    struct alignas(64) slot {
+        std::atomic<uint32_t> _seq = { 0 };
+        T _value {};
+    };
+    std::vector<slot> _slots;
+public:
+    shard_published() : _slots(smp::count) {}
+    /// Updates the local shard's slot.  Call only from the owning shard.
+    void publish(const T& value) {
+        auto& s = _slots[engine().cpu_id()];
+        auto seq = s._seq.load(std::memory_order_relaxed);
+        s._seq.store(seq + 1, std::memory_order_relaxed);
+        // order the odd marker before the data stores (a no-op on x86,
+        // which does not reorder stores)
+        std::atomic_thread_fence(std::memory_order_release);
+        s._value = value;
+        s._seq.store(seq + 2, std::memory_order_release);
+    }
+    /// Returns a snapshot of shard \c cpu's slot, retrying if a publish()
+    /// raced with the copy.  May be called from any shard.
+    T peek(unsigned cpu) const {
+        auto& s = _slots[cpu];
+        for (;;) {
+            auto seq1 = s._seq.load(std::memory_order_acquire);
+            if (seq1 & 1) {
+                // write in progress
+                continue;
+            }
+            T copy = s._value;
+            // order the data loads before the recheck (a no-op on x86,
+            // which does not reorder loads)
+            std::atomic_thread_fence(std::memory_order_acquire);
+            auto seq2 = s._seq.load(std::memory_order_relaxed);
+            if (seq1 == seq2) {
+                return copy;
+            }
+        }
+    }
+    /// Returns a snapshot of the local shard's slot.
+    T peek() const {
+        return peek(engine().cpu_id());
+    }
+};
@@ -25,10 +25,59 @@
 #include "future-util.hh"
 #include "util/is_smart_ptr.hh"
 #include "do_with.hh"
+#include "print.hh"
 #include <boost/iterator/counting_iterator.hpp>
+#include <chrono>
+#include <typeinfo>
 
 namespace seastar {
 
+/// Per-shard log of how long each named startup phase took.
+///
+/// sharded<>::start() records service construction automatically; init
+/// hooks that do real work (I/O, large allocations) wrap themselves in
+/// \ref record_boot_phase().  After boot, \ref print_boot_report()
+/// shows every shard's phases and, per phase, the slowest shard --
+/// which is the boot critical path, since phases run concurrently
+/// across shards and join before the next phase starts.
+class boot_phases {
+public:
+    struct phase {
+        sstring name;
+        std::chrono::steady_clock::duration duration;
+    };
+private:
+    std::vector<phase> _phases;
+public:
+    static boot_phases& local() {
+        static thread_local boot_phases instance;
+        return instance;
+    }
+    void record(sstring name, std::chrono::steady_clock::duration d) {
+        _phases.push_back(phase{std::move(name), d});
+    }
+    const std::vector<phase>& phases() const { return _phases; }
+};
+
+/// Runs \c func on the calling shard, recording its wall-clock duration
+/// as a named startup phase for \ref print_boot_report().  \c func may
+/// return a future or a plain value.
+template <typename Func>
+inline
+futurize_t<std::result_of_t<Func()>>
+record_boot_phase(sstring name, Func&& func) {
+    auto start = std::chrono::steady_clock::now();
+    return futurize<std::result_of_t<Func()>>::apply(std::forward<Func>(func)).finally(
+            [name = std::move(name), start] {
+        boot_phases::local().record(std::move(name),
+                std::chrono::steady_clock::now() - start);
+    });
+}
+
+/// Prints each shard's recorded startup phases, then each phase's
+/// slowest shard.  Call once boot has finished.
+future<> print_boot_report();
+
 /// if sharded service inherits from this class sharded::stop() will wait
 /// untill all references to a service on each shard will dissapper before
 /// returning. It is still service's own responcibility to track its references
@@ -81,6 +130,9 @@ class sharded {
     struct entry {
         ::shared_ptr<Service> service;
         promise<> freed;
+#ifdef SEASTAR_DEBUG_SHARDED
+        unsigned borrowed = 0;
+#endif
     };
     std::vector<entry> _instances;
 private:
@@ -147,7 +199,10 @@ public:
     ///
     /// \param func a callable with the signature `void (Service&)`
     ///             or `future<> (Service&)`, to be called on each core
-    ///             with the local instance as an argument.
+    ///             with the local instance as an argument.  A single
+    ///             copy of \c func is shared by all cores and may be
+    ///             invoked concurrently, so it must not rely on
+    ///             mutating its own captures.
     /// \return a `future<>` that becomes ready when all cores have
     ///         processed the message.
     template <typename Func>
@@ -229,6 +284,57 @@ public:
                             std::move(reduce));
     }
 
+    /// Like \ref map_reduce0, but reduces up a binary tree of shards
+    /// instead of linearly on the caller.
+    ///
+    /// Each subtree is combined on its first shard, so at 64 shards the
+    /// caller receives two intermediate values rather than 64 -- with
+    /// large intermediates this is the difference between the caller
+    /// deserializing everything and the work spreading over the machine.
+    ///
+    /// \c reduce must be associative: the fold order is the in-order
+    /// tree combination of shard results, with \c initial folded in
+    /// last on the caller.  Unlike map_reduce0, \c reduce runs on
+    /// intermediate shards, so it must not capture anything shard-local.
+    template <typename Mapper, typename Initial, typename Reduce>
+    inline
+    future<Initial>
+    map_reduce_tree(Mapper map, Initial initial, Reduce reduce) {
+        return tree_reduce_range<Initial>(this, 0, smp::count, std::move(map), reduce).then(
+                [initial = std::move(initial), reduce] (Initial value) mutable {
+            return reduce(std::move(initial), std::move(value));
+        });
+    }
+
+    /// Applies a map function to all shards, each shard depositing its
+    /// result into a caller-provided slot, then folds the slots locally.
+    ///
+    /// \param slots storage for one result per shard; must hold at least
+    ///              \c smp::count entries and stay alive until the
+    ///              returned future resolves.  The vector is typically
+    ///              allocated once and reused by periodic aggregations,
+    ///              so steady-state calls allocate nothing beyond the
+    ///              smp messages themselves.
+    /// \param map callable with the signature `Value (Service&)`,
+    ///            invoked on each shard; must not defer.
+    ///
+    /// Shards write disjoint slots, and the fold only starts once every
+    /// shard has replied, so no further synchronization is needed.
+    template <typename Value, typename Mapper, typename Initial, typename Reduce>
+    inline
+    future<Initial>
+    map_reduce_into(std::vector<Value>& slots, Mapper map, Initial initial, Reduce reduce) {
+        assert(slots.size() >= smp::count);
+        return invoke_on_all([&slots, map] (Service& s) {
+            slots[engine().cpu_id()] = map(s);
+        }).then([&slots, initial = std::move(initial), reduce = std::move(reduce)] () mutable {
+            for (unsigned c = 0; c < smp::count; c++) {
+                initial = reduce(std::move(initial), std::move(slots[c]));
+            }
+            return std::move(initial);
+        });
+    }
+
     /// Applies a map function to all shards, and return a vector of the result.
     ///
     /// \param mapper callable with the signature `Value (Service&)` or
@@ -290,6 +396,83 @@ public:
     /// Gets a reference to the local instance.
     Service& local();
 
+    /// A direct, borrowed reference to this shard's instance.
+    ///
+    /// local() pays an \c _instances vector index plus a pointer chase
+    /// on every call; code that touches the service once per request
+    /// captures a local_ref after start() has completed on this shard
+    /// and dereferences a plain pointer thereafter.
+    ///
+    /// A local_ref does not keep the service alive: the borrowing code
+    /// must be done with it before sharded::stop().  Compiling with
+    /// -DSEASTAR_DEBUG_SHARDED counts outstanding references per shard
+    /// and makes stop() assert if any are still live.  A local_ref must
+    /// not be moved to another shard.
+    class local_ref {
+        Service* _service = nullptr;
+#ifdef SEASTAR_DEBUG_SHARDED
+        entry* _entry = nullptr;
+        void borrow() {
+            if (_entry) {
+                ++_entry->borrowed;
+            }
+        }
+        void unborrow() {
+            if (_entry) {
+                --_entry->borrowed;
+            }
+        }
+#else
+        void borrow() {}
+        void unborrow() {}
+#endif
+        explicit local_ref(entry& e) : _service(&*e.service) {
+#ifdef SEASTAR_DEBUG_SHARDED
+            _entry = &e;
+#endif
+            borrow();
+        }
+        friend class sharded;
+    public:
+        /// Constructs an empty local_ref.
+        local_ref() = default;
+        local_ref(const local_ref& other) : _service(other._service) {
+#ifdef SEASTAR_DEBUG_SHARDED
+            _entry = other._entry;
+#endif
+            borrow();
+        }
+        local_ref(local_ref&& other) noexcept : local_ref() {
+            std::swap(_service, other._service);
+#ifdef SEASTAR_DEBUG_SHARDED
+            std::swap(_entry, other._entry);
+#endif
+        }
+        local_ref& operator=(local_ref other) noexcept {
+            std::swap(_service, other._service);
+#ifdef SEASTAR_DEBUG_SHARDED
+            std::swap(_entry, other._entry);
+#endif
+            return *this;
+        }
+        ~local_ref() {
+            unborrow();
+        }
+        /// Accesses the local instance.
+        Service& operator*() const { return *_service; }
+        /// Accesses the local instance.
+        Service* operator->() const { return _service; }
+        /// Checks whether a reference was captured.
+        explicit operator bool() const { return _service != nullptr; }
+    };
+
+    /// Captures a \ref local_ref to the local instance; the instance
+    /// must already be started on this shard.
+    local_ref make_local_ref() {
+        assert(local_is_initialized());
+        return local_ref(_instances[engine().cpu_id()]);
+    }
+
     /// Gets a shared pointer to the local instance.
     shared_ptr<Service> local_shared();
 
@@ -320,6 +503,39 @@ private:
         }
         return inst;
     }
+
+    // Reduces shards [b, e) up a binary tree: each half recurses on its
+    // own first shard, which also combines the half's two intermediates,
+    // so every internal reduce runs off the caller.
+    template <typename Value, typename Mapper, typename Reduce>
+    static future<Value> tree_reduce_range(sharded* s, unsigned b, unsigned e, Mapper map, Reduce reduce) {
+        if (e - b == 1) {
+            return smp::submit_to(b, [s, map] {
+                return map(*s->get_local_service());
+            });
+        }
+        auto mid = b + (e - b) / 2;
+        auto left = smp::submit_to(b, [s, b, mid, map, reduce] {
+            return tree_reduce_range<Value>(s, b, mid, map, reduce);
+        });
+        auto right = smp::submit_to(mid, [s, mid, e, map, reduce] {
+            return tree_reduce_range<Value>(s, mid, e, map, reduce);
+        });
+        return when_all(std::move(left), std::move(right)).then(
+                [reduce] (std::tuple<future<Value>, future<Value>> both) mutable {
+            auto l = std::move(std::get<0>(both));
+            auto r = std::move(std::get<1>(both));
+            if (l.failed() || r.failed()) {
+                // consume both exceptions; propagate the first
+                auto ex = l.failed() ? l.get_exception() : r.get_exception();
+                if (l.failed() && r.failed()) {
+                    r.get_exception();
+                }
+                return make_exception_future<Value>(std::move(ex));
+            }
+            return futurize<Value>::apply(reduce, l.get0(), r.get0());
+        });
+    }
 };
 
 template <typename Service>
@@ -332,12 +548,18 @@ template <typename... Args>
 future<>
 sharded<Service>::start(Args&&... args) {
     _instances.resize(smp::count);
+    // all shards construct concurrently; parallel_for_each() is the
+    // join barrier, so boot pays the slowest shard, not the sum
     return parallel_for_each(boost::irange<unsigned>(0, _instances.size()),
         [this, args = std::make_tuple(std::forward<Args>(args)...)] (unsigned c) mutable {
             return smp::submit_to(c, [this, args] () mutable {
+                auto construction_start = std::chrono::steady_clock::now();
                 _instances[engine().cpu_id()].service = apply([this] (Args... args) {
                     return create_local_service(std::forward<Args>(args)...);
                 }, args);
+                boot_phases::local().record(
+                        sstring("construct ") + sstring(typeid(Service).name()),
+                        std::chrono::steady_clock::now() - construction_start);
             });
     }).then_wrapped([this] (future<> f) {
         try {
@@ -358,9 +580,13 @@ sharded<Service>::start_single(Args&&... args) {
     assert(_instances.empty());
     _instances.resize(1);
     return smp::submit_to(0, [this, args = std::make_tuple(std::forward<Args>(args)...)] () mutable {
+        auto construction_start = std::chrono::steady_clock::now();
         _instances[0].service = apply([this] (Args... args) {
             return create_local_service(std::forward<Args>(args)...);
         }, args);
+        boot_phases::local().record(
+                sstring("construct ") + sstring(typeid(Service).name()),
+                std::chrono::steady_clock::now() - construction_start);
     }).then_wrapped([this] (future<> f) {
         try {
             f.get();
@@ -382,6 +608,10 @@ sharded<Service>::stop() {
             if (!inst) {
                 return make_ready_future<>();
             }
+#ifdef SEASTAR_DEBUG_SHARDED
+            // every local_ref captured on this shard must be gone by now
+            assert(_instances[engine().cpu_id()].borrowed == 0);
+#endif
             _instances[engine().cpu_id()].service = nullptr;
             return inst->stop().then([this, inst] {
                 return _instances[engine().cpu_id()].freed.get_future();
@@ -426,10 +656,17 @@ future<>
 sharded<Service>::invoke_on_all(Func&& func) {
     static_assert(std::is_same<futurize_t<std::result_of_t<Func(Service&)>>, future<>>::value,
                   "invoke_on_all()'s func must return void or future<>");
-    return parallel_for_each(boost::irange<unsigned>(0, _instances.size()), [this, &func] (unsigned c) {
-        return smp::submit_to(c, [this, func] {
-            auto inst = get_local_service();
-            return func(*inst);
+    // a single copy of func, kept alive until every shard has run it;
+    // the shards share it by reference instead of each dragging a copy
+    // of a potentially fat callable through the message queues.  func
+    // may therefore be invoked concurrently and must not rely on
+    // mutating its own captures.
+    return do_with(std::forward<Func>(func), [this] (Func& func) {
+        return parallel_for_each(boost::irange<unsigned>(0, _instances.size()), [this, &func] (unsigned c) {
+            return smp::submit_to(c, [this, &func] {
+                auto inst = get_local_service();
+                return func(*inst);
+            });
         });
     });
 }
@@ -452,8 +689,93 @@ inline bool sharded<Service>::local_is_initialized() {
            _instances[engine().cpu_id()].service;
 }
 
+inline
+future<> print_boot_report() {
+    using phases_vector = std::vector<boot_phases::phase>;
+    auto to_ms = [] (std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(d).count();
+    };
+    return do_with(std::vector<phases_vector>(smp::count), [to_ms] (std::vector<phases_vector>& all) {
+        return parallel_for_each(smp::all_cpus(), [&all] (unsigned cpu) {
+            return smp::submit_to(cpu, [] {
+                return boot_phases::local().phases();
+            }).then([&all, cpu] (phases_vector v) {
+                all[cpu] = std::move(v);
+            });
+        }).then([&all, to_ms] {
+            for (unsigned cpu = 0; cpu < all.size(); cpu++) {
+                for (auto&& p : all[cpu]) {
+                    print("boot: cpu %3d: %-40s %9.3f ms\n", cpu, p.name, to_ms(p.duration));
+                }
+            }
+            // the slowest shard of each phase bounds boot time, since
+            // the shards join between phases
+            std::vector<boot_phases::phase> critical;
+            for (auto&& v : all) {
+                for (auto&& p : v) {
+                    auto i = std::find_if(critical.begin(), critical.end(), [&p] (boot_phases::phase& c) {
+                        return c.name == p.name;
+                    });
+                    if (i == critical.end()) {
+                        critical.push_back(p);
+                    } else {
+                        i->duration = std::max(i->duration, p.duration);
+                    }
+                }
+            }
+            for (auto&& p : critical) {
+                print("boot: critical path: %-33s %9.3f ms\n", p.name, to_ms(p.duration));
+            }
+        });
+    });
+}
+
 }
 
+/// \cond internal
+
+// Batches cross-cpu deletions of foreign_ptr targets.  Scans returning
+// millions of foreign pointers used to submit one smp message per
+// destroyed pointer; instead the destructor now parks the deleter here,
+// and a task scheduled behind the current batch ships everything
+// accumulated so far with a single submit_to() per owner shard.
+class foreign_ptr_reclaimer {
+    // pending deleters, indexed by owner shard
+    std::vector<std::vector<std::unique_ptr<task>>> _pending;
+    bool _flush_scheduled = false;
+public:
+    foreign_ptr_reclaimer() : _pending(smp::count) {}
+    void enqueue(unsigned cpu, std::unique_ptr<task> deleter) {
+        _pending[cpu].push_back(std::move(deleter));
+        if (!_flush_scheduled) {
+            _flush_scheduled = true;
+            // runs after the tasks currently queued, so destructions
+            // they perform join this batch rather than starting new ones
+            schedule(make_task([this] { flush(); }));
+        }
+    }
+    void flush() {
+        _flush_scheduled = false;
+        for (unsigned cpu = 0; cpu < smp::count; cpu++) {
+            if (_pending[cpu].empty()) {
+                continue;
+            }
+            smp::submit_to(cpu, [batch = std::move(_pending[cpu])] {
+                for (auto&& deleter : batch) {
+                    deleter->run();
+                }
+            });
+            _pending[cpu].clear();
+        }
+    }
+    static foreign_ptr_reclaimer& local() {
+        static thread_local foreign_ptr_reclaimer instance;
+        return instance;
+    }
+};
+
+/// \endcond
+
 /// Smart pointer wrapper which makes it safe to move across CPUs.
 ///
 /// \c foreign_ptr<> is a smart pointer wrapper which, unlike
@@ -509,9 +831,12 @@ public:
     /// Destroys the wrapped object on its original cpu.
     ~foreign_ptr() {
         if (_value && !on_origin()) {
-            smp::submit_to(_cpu, [v = std::move(_value)] () mutable {
+            // deferred so that a burst of destructions becomes one
+            // message per owner shard instead of one per pointer
+            foreign_ptr_reclaimer::local().enqueue(_cpu,
+                    make_task([v = std::move(_value)] () mutable {
                 auto local(std::move(v));
-            });
+            }));
         }
     }
     /// Accesses the wrapped object.
@@ -535,5 +860,87 @@ foreign_ptr<T> make_foreign(T ptr) {
 template<typename T>
 struct is_smart_ptr<::foreign_ptr<T>> : std::true_type {};
 
+/// Maps a 64-bit key hash onto \c buckets buckets with jump consistent
+/// hashing (Lamping & Veach, "A Fast, Minimal Memory, Consistent Hash
+/// Algorithm").  When the bucket count grows from n to n+1, only
+/// 1/(n+1) of the keys move, all of them to the new bucket -- unlike
+/// `hash % n`, which reshuffles nearly everything.  O(ln n) arithmetic
+/// with no memory accesses, so it inlines into per-request paths.
+inline
+unsigned jump_consistent_hash(uint64_t hash, unsigned buckets) {
+    int64_t b = -1;
+    int64_t j = 0;
+    while (j < int64_t(buckets)) {
+        b = j;
+        hash = hash * 2862933555777941757ULL + 1;
+        j = (b + 1) * (double(1LL << 31) / double((hash >> 33) + 1));
+    }
+    return unsigned(b);
+}
+
+/// Returns the shard that owns \c hash on this machine.  The stable
+/// replacement for the ad-hoc `hash % smp::count` pattern: shard counts
+/// differing between runs (or between peers) move a minimal fraction of
+/// keys instead of almost all of them.
+inline
+unsigned shard_of(uint64_t hash) {
+    return jump_consistent_hash(hash, smp::count);
+}
+
+/// Partitions a linear token space [0, size) evenly across shards.
+///
+/// Unlike hashing, range partitioning keeps adjacent tokens on the same
+/// shard, which sequential scans exploit.  Both directions are exact:
+/// shard_of() maps a token to its owner and first_token_of() returns
+/// the start of a shard's sub-range, so a scan can be cut into per-shard
+/// pieces without probing.
+class range_sharder {
+    using u128 = unsigned __int128;
+    uint64_t _size;
+    unsigned _shards;
+public:
+    explicit range_sharder(uint64_t size, unsigned shards = smp::count)
+        : _size(size), _shards(shards) {}
+    /// Returns the shard owning \c token; \c token must be below the
+    /// size given at construction.
+    unsigned shard_of(uint64_t token) const {
+        return unsigned(u128(token) * _shards / _size);
+    }
+    /// Returns the first token owned by \c shard, such that
+    /// `shard_of(first_token_of(s)) == s` for every non-empty sub-range.
+    uint64_t first_token_of(unsigned shard) const {
+        return uint64_t((u128(shard) * _size + _shards - 1) / _shards);
+    }
+};
+
+/// Routes keys to a (host, shard) pair, for rpc clients addressing a
+/// cluster of sharded servers.
+///
+/// The key is jump-hashed over the hosts first and, with an independent
+/// remix, over the chosen host's shard count second, so adding a host
+/// or raising one host's --smp each move only the minimal fraction of
+/// keys.  Hosts may have different shard counts.
+class host_shard_router {
+public:
+    struct location {
+        unsigned host;
+        unsigned shard;
+    };
+private:
+    std::vector<unsigned> _host_shards;
+public:
+    /// \param host_shards the shard count of each host, in a fixed
+    ///                    order shared by every client.
+    explicit host_shard_router(std::vector<unsigned> host_shards)
+        : _host_shards(std::move(host_shards)) {}
+    unsigned hosts() const { return _host_shards.size(); }
+    location route(uint64_t hash) const {
+        auto host = jump_consistent_hash(hash, _host_shards.size());
+        // decorrelate the shard choice from the host choice
+        auto remix = (hash ^ 0x9e3779b97f4a7c15ULL) * 2862933555777941757ULL + host;
+        return location{host, jump_consistent_hash(remix, _host_shards[host])};
+    }
+};
+
 /// @}
 
@@ -22,8 +22,9 @@
 
 #pragma once
 
-#include <deque>
+#include <experimental/optional>
 #include "future.hh"
+#include "chunked_fifo.hh"
 
 /// \addtogroup future-module
 /// @{
@@ -53,32 +54,52 @@ template<typename... T>
 class shared_future {
     /// \cond internal
     class shared_state {
+        // the first waiters live inline in the (already heap-allocated)
+        // shared state; only fan-outs beyond that touch the allocator,
+        // and then only once per chunk of 128 waiters
+        static constexpr size_t nr_inline_peers = 8;
         future_state<T...> _future_state;
-        std::deque<promise<T...>> _peers;
-    public:
-        void resolve(future<T...>&& f) noexcept {
-            _future_state = f.get_available_state();
+        size_t _nr_peers = 0;
+        std::experimental::optional<promise<T...>> _inline_peers[nr_inline_peers];
+        chunked_fifo<promise<T...>> _overflow_peers;
+    private:
+        void resolve_one(promise<T...>& p) noexcept {
             if (_future_state.failed()) {
-                for (auto&& p : _peers) {
-                    p.set_exception(_future_state.get_exception());
-                }
+                p.set_exception(_future_state.get_exception());
             } else {
-                for (auto&& p : _peers) {
-                    try {
-                        p.set_value(_future_state.get_value());
-                    } catch (...) {
-                        p.set_exception(std::current_exception());
-                    }
+                try {
+                    p.set_value(_future_state.get_value());
+                } catch (...) {
+                    p.set_exception(std::current_exception());
                 }
             }
-            _peers.clear();
+        }
+    public:
+        void resolve(future<T...>&& f) noexcept {
+            _future_state = f.get_available_state();
+            for (size_t i = 0; i != std::min(_nr_peers, size_t(nr_inline_peers)); ++i) {
+                resolve_one(*_inline_peers[i]);
+                _inline_peers[i] = std::experimental::nullopt;
+            }
+            while (!_overflow_peers.empty()) {
+                resolve_one(_overflow_peers.front());
+                _overflow_peers.pop_front();
+            }
+            _nr_peers = 0;
         }
 
         future<T...> get_future() {
             if (!_future_state.available()) {
                 promise<T...> p;
                 auto f = p.get_future();
-                _peers.emplace_back(std::move(p));
+                // both stores keep the promise at a stable address, so
+                // the future/promise link survives
+                if (_nr_peers < nr_inline_peers) {
+                    _inline_peers[_nr_peers] = std::move(p);
+                } else {
+                    _overflow_peers.push_back(std::move(p));
+                }
+                ++_nr_peers;
                 return f;
             } else if (_future_state.failed()) {
                 return make_exception_future<T...>(_future_state.get_exception());
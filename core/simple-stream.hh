@@ -82,6 +82,65 @@ public:
         skip(size);
     }
 
+    // Returns a pointer to the next \c size bytes in place and skips
+    // over them; no copy is made, so the view lives only as long as the
+    // buffer backing the stream
+    [[gnu::always_inline]]
+    const char* read_view(size_t size) {
+        if (size > _size) {
+            throw std::out_of_range("deserialization buffer underflow");
+        }
+        auto p = _p;
+        _p += size;
+        _size -= size;
+        return p;
+    }
+
+    // Typed view over the next \c count elements of T.  Returns nullptr
+    // without consuming anything when the buffer is not aligned for T,
+    // so the caller can fall back to copying reads.
+    template<typename T>
+    [[gnu::always_inline]]
+    const T* read_view_as(size_t count = 1) {
+        static_assert(std::is_trivially_copyable<T>::value, "not a trivially copyable type");
+        if (count * sizeof(T) > _size) {
+            throw std::out_of_range("deserialization buffer underflow");
+        }
+        if (reinterpret_cast<uintptr_t>(_p) % alignof(T)) {
+            return nullptr;
+        }
+        auto p = reinterpret_cast<const T*>(_p);
+        _p += count * sizeof(T);
+        _size -= count * sizeof(T);
+        return p;
+    }
+
+    // Decodes one trivially-copyable value, reading in place when the
+    // buffer happens to be aligned for it
+    template<typename T>
+    [[gnu::always_inline]]
+    T read_pod() {
+        static_assert(std::is_trivially_copyable<T>::value, "not a trivially copyable type");
+        if (sizeof(T) > _size) {
+            throw std::out_of_range("deserialization buffer underflow");
+        }
+        T v;
+        read_pod_unchecked(v);
+        return v;
+    }
+
+    // Decodes a batch of values laid out back to back in the buffer
+    // with a single bounds check for the whole batch
+    template<typename... T>
+    [[gnu::always_inline]]
+    void read_pods(T&... v) {
+        if (packed_size<T...>() > _size) {
+            throw std::out_of_range("deserialization buffer underflow");
+        }
+        using expand = int[];
+        (void)expand{0, (read_pod_unchecked(v), 0)...};
+    }
+
     template<typename Output>
     [[gnu::always_inline]]
     void copy_to(Output& out) const {
@@ -92,6 +151,29 @@ public:
     const size_t size() const {
         return _size;
     }
+private:
+    template<typename... T>
+    static constexpr size_t packed_size() {
+        size_t total = 0;
+        size_t sizes[] = {0, sizeof(T)...};
+        for (auto s : sizes) {
+            total += s;
+        }
+        return total;
+    }
+
+    template<typename T>
+    [[gnu::always_inline]]
+    void read_pod_unchecked(T& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "not a trivially copyable type");
+        if (reinterpret_cast<uintptr_t>(_p) % alignof(T) == 0) {
+            v = *reinterpret_cast<const T*>(_p);
+        } else {
+            std::copy_n(_p, sizeof(T), reinterpret_cast<char*>(&v));
+        }
+        _p += sizeof(T);
+        _size -= sizeof(T);
+    }
 };
 
 }
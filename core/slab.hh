@@ -119,6 +119,19 @@ public:
         _free_objects.push_back(reinterpret_cast<uintptr_t>(object));
     }
 
+    // Re-initialize an evacuated (fully free) slab page for another slab
+    // class. Unlike the constructor, all objects are free afterwards.
+    void reassign(size_t objects, size_t object_size, uint8_t slab_class_id) {
+        _slab_class_id = slab_class_id;
+        _free_objects.clear();
+        _free_objects.reserve(objects);
+        auto object = reinterpret_cast<uintptr_t>(_slab_page);
+        for (auto i = 0u; i < objects; i++) {
+            _free_objects.push_back(object);
+            object += object_size;
+        }
+    }
+
     template<typename Item>
     friend class slab_class;
     template<typename Item>
@@ -127,9 +140,26 @@ public:
 
 class slab_item_base {
     bi::list_member_hook<> _lru_link;
+    // CLOCK reference bit: set by slab_allocator::touch() on a cache hit,
+    // cleared when the eviction hand passes over the item. A hit updates
+    // only this flag, never the LRU list itself.
+    bool _referenced = false;
 
     template<typename Item>
     friend class slab_class;
+    template<typename Item>
+    friend class slab_allocator;
+};
+
+/*
+ * Per-class occupancy counters, used to spot classes hoarding
+ * mostly-empty slab pages after a workload shift.
+ */
+struct slab_class_stats {
+    size_t object_size;
+    size_t nr_pages;        // slab pages currently owned by the class
+    size_t nr_objects;      // objects those pages can hold
+    size_t nr_free_objects; // of which currently free
 };
 
 template<typename Item>
@@ -143,6 +173,11 @@ private:
         &slab_item_base::_lru_link>> _lru;
     size_t _size; // size of objects
     uint8_t _slab_class_id;
+    size_t _nr_pages = 0;
+    size_t _nr_free_objects = 0;
+    uint64_t _nr_hits = 0;
+    // upper bound on second-chance rotations per eviction
+    static constexpr size_t max_eviction_scan = 8;
 private:
     template<typename... Args>
     inline
@@ -158,6 +193,21 @@ private:
             return { nullptr, 0U };
         }
 
+        //
+        // CLOCK-style second chance: a hit only sets the reference bit, so
+        // the hot path never splices the list; the cost is paid here, where
+        // recently referenced items found at the tail are rotated back to
+        // the front with their bit cleared. The scan is bounded so that an
+        // all-referenced list still evicts in constant time.
+        //
+        auto scan = max_eviction_scan;
+        while (scan-- && _lru.back()._referenced) {
+            auto& rotated = _lru.back();
+            rotated._referenced = false;
+            _lru.erase(_lru.iterator_to(rotated));
+            _lru.push_front(rotated);
+        }
+
         Item& victim = reinterpret_cast<Item&>(_lru.back());
         uint32_t index = victim.get_slab_page_index();
         assert(victim.is_unlocked());
@@ -183,6 +233,23 @@ public:
         return _size;
     }
 
+    uint8_t slab_class_id() const {
+        return _slab_class_id;
+    }
+
+    slab_class_stats stats(uint64_t max_object_size) const {
+        auto objects_per_page = max_object_size / _size;
+        return { _size, _nr_pages, _nr_pages * objects_per_page, _nr_free_objects };
+    }
+
+    void record_hit() {
+        _nr_hits++;
+    }
+
+    uint64_t nr_hits() const {
+        return _nr_hits;
+    }
+
     bool empty() const {
         return _free_slab_pages.empty();
     }
@@ -196,6 +263,7 @@ public:
         assert(!_free_slab_pages.empty());
         auto& desc = _free_slab_pages.back();
         auto object = desc.allocate_object();
+        _nr_free_objects--;
         if (desc.empty()) {
             // if empty, remove desc from the list of slab pages with free objects.
             _free_slab_pages.erase(_free_slab_pages.iterator_to(desc));
@@ -227,6 +295,8 @@ public:
 
         _free_slab_pages.push_front(*desc);
         insert_slab_page_desc(*desc);
+        _nr_pages++;
+        _nr_free_objects += max_object_size / _size - 1;
 
         // first object from the allocated slab page is returned.
         return create_item(slab_page, slab_page_index, std::forward<Args>(args)...);
@@ -245,18 +315,13 @@ public:
         void *object = item;
         _lru.erase(_lru.iterator_to(reinterpret_cast<slab_item_base&>(*item)));
         desc.free_object(object);
+        _nr_free_objects++;
         if (desc.size() == 1) {
             // push back desc into the list of slab pages with free objects.
             _free_slab_pages.push_back(desc);
         }
     }
 
-    void touch_item(Item *item) {
-        auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
-        _lru.erase(_lru.iterator_to(item_ref));
-        _lru.push_front(item_ref);
-    }
-
     void remove_item_from_lru(Item *item) {
         auto& item_ref = reinterpret_cast<slab_item_base&>(*item);
         _lru.erase(_lru.iterator_to(item_ref));
@@ -271,6 +336,36 @@ public:
         assert(desc.slab_class_id() == _slab_class_id);
         _free_slab_pages.erase(_free_slab_pages.iterator_to(desc));
     }
+
+    // Find the slab page with the most free objects, provided it has at
+    // least min_free of them; used to pick eviction/migration victims.
+    slab_page_desc* find_mostly_free_page(size_t min_free) {
+        slab_page_desc* best = nullptr;
+        for (auto& desc : _free_slab_pages) {
+            if (desc.refcnt() != 0 || desc.size() < min_free) {
+                continue;
+            }
+            if (!best || desc.size() > best->size()) {
+                best = &desc;
+            }
+        }
+        return best;
+    }
+
+    // Take ownership of a fully free slab page evacuated from another class.
+    void add_free_page(slab_page_desc& desc) {
+        assert(desc.slab_class_id() == _slab_class_id);
+        _free_slab_pages.push_front(desc);
+        _nr_pages++;
+        _nr_free_objects += desc.size();
+    }
+
+    // Account for a slab page leaving this class through eviction or
+    // migration; the caller is responsible for its remaining items.
+    void account_page_removed(slab_page_desc& desc) {
+        _nr_pages--;
+        _nr_free_objects -= desc.size();
+    }
 };
 
 template<typename Item>
@@ -290,6 +385,7 @@ private:
     struct collectd_stats {
         uint64_t allocs;
         uint64_t frees;
+        uint64_t rebalances;
     } _stats;
     memory::reclaimer *_reclaimer = nullptr;
     bool _reclaimed = false;
@@ -339,6 +435,7 @@ private:
             _erase_func(*item);
             _stats.frees++;
         }
+        slab_class->account_page_removed(desc);
 #ifdef DEBUG
         printf("lru slab page eviction succeeded! desc_empty?=%d\n", desc.empty());
 #endif
@@ -358,6 +455,73 @@ private:
         return evict_lru_slab_page();
     }
 
+    /*
+     * Evict the remaining items of a slab page, leaving it fully free but
+     * still owned by the allocator; same object walk as evict_lru_slab_page().
+     */
+    void evacuate_slab_page(slab_class<Item>& src, slab_page_desc& desc) {
+        assert(desc.refcnt() == 0);
+        auto& free_objects = desc.free_objects();
+        src.remove_desc_from_free_list(desc);
+        std::sort(free_objects.begin(), free_objects.end());
+
+        uintptr_t object = reinterpret_cast<uintptr_t>(desc.slab_page());
+        auto object_size = src.size();
+        auto objects = _max_object_size / object_size;
+        for (auto i = 0u; i < objects; i++, object += object_size) {
+            if (std::binary_search(free_objects.begin(), free_objects.end(), object)) {
+                continue;
+            }
+            Item* item = reinterpret_cast<Item*>(object);
+            assert(item->is_unlocked());
+            src.remove_item_from_lru(item);
+            _erase_func(*item);
+            _stats.frees++;
+        }
+        src.account_page_removed(desc);
+    }
+
+    /*
+     * Move a mostly-empty slab page from some other slab class to dst, so a
+     * class starved by a workload shift can grow at the expense of idle pages
+     * elsewhere instead of thrashing its own LRU. The donor is the page with
+     * the most free memory; its remaining items are evicted through
+     * erase_func(). Returns true if a page changed hands.
+     */
+    bool rebalance_slab_page(slab_class<Item>& dst) {
+        slab_class<Item>* src = nullptr;
+        slab_page_desc* victim = nullptr;
+        size_t victim_free_bytes = 0;
+        for (auto& slab_class : _slab_classes) {
+            if (&slab_class == &dst) {
+                continue;
+            }
+            auto objects = _max_object_size / slab_class.size();
+            // A page qualifies as mostly empty when at least half of its
+            // objects are free; without an erase_func we cannot evict, so
+            // only fully free pages may migrate.
+            auto min_free = _erase_func ? (objects + 1) / 2 : objects;
+            auto desc = slab_class.find_mostly_free_page(min_free);
+            if (desc) {
+                auto free_bytes = desc->size() * slab_class.size();
+                if (free_bytes > victim_free_bytes) {
+                    src = &slab_class;
+                    victim = desc;
+                    victim_free_bytes = free_bytes;
+                }
+            }
+        }
+        if (!victim) {
+            return false;
+        }
+        evacuate_slab_page(*src, *victim);
+        // hand the now fully free page over to the destination class.
+        victim->reassign(_max_object_size / dst.size(), dst.size(), dst.slab_class_id());
+        dst.add_free_page(*victim);
+        _stats.rebalances++;
+        return true;
+    }
+
     void initialize_slab_allocator(double growth_factor, uint64_t limit) {
         constexpr size_t alignment = std::alignment_of<Item>::value;
         constexpr size_t initial_size = 96;
@@ -410,6 +574,31 @@ private:
         add("total_operations", "malloc", scollectd::data_type::DERIVE, [&] { return _stats.allocs; });
         add("total_operations", "free", scollectd::data_type::DERIVE, [&] { return _stats.frees; });
         add("objects", "malloc", scollectd::data_type::GAUGE, [&] { return _stats.allocs - _stats.frees; });
+        add("total_operations", "page_rebalance", scollectd::data_type::DERIVE, [&] { return _stats.rebalances; });
+        add("objects", "free", scollectd::data_type::GAUGE, [&] {
+            size_t free_objects = 0;
+            for (auto& slab_class : _slab_classes) {
+                free_objects += slab_class.stats(_max_object_size).nr_free_objects;
+            }
+            return free_objects;
+        });
+
+        // Per-class gauges and hit counters, keyed by the class object
+        // size, from which a collector can render occupancy and hit-ratio
+        // histograms across the slab classes.
+        for (auto class_id = 0u; class_id < _slab_classes.size(); class_id++) {
+            auto instance = to_sstring(_slab_classes[class_id].size());
+            add("objects", "class-" + instance + "-used", scollectd::data_type::GAUGE, [this, class_id] {
+                auto stats = _slab_classes[class_id].stats(_max_object_size);
+                return stats.nr_objects - stats.nr_free_objects;
+            });
+            add("objects", "class-" + instance + "-free", scollectd::data_type::GAUGE, [this, class_id] {
+                return _slab_classes[class_id].stats(_max_object_size).nr_free_objects;
+            });
+            add("total_operations", "class-" + instance + "-hit", scollectd::data_type::DERIVE, [this, class_id] {
+                return _slab_classes[class_id].nr_hits();
+            });
+        }
     }
 
     inline slab_page_desc& get_slab_page_desc(Item *item)
@@ -425,6 +614,39 @@ private:
             (_available_slab_pages > 0 || sc.has_no_slab_pages());
     }
 public:
+    /*
+     * Voluntarily evict the least recently used slab page, returning its
+     * memory to the system. Unlike reclaim(), this doesn't stop the slab
+     * from growing again later, so it is suitable for shedding objects on
+     * memory pressure.
+     */
+    memory::reclaiming_result shed() {
+        return evict_lru_slab_page();
+    }
+
+    /**
+     * Try to move a mostly-empty slab page from another class to the class
+     * serving the given size; see rebalance_slab_page(). create() does this
+     * automatically when a class can no longer grow.
+     */
+    bool rebalance(const size_t size) {
+        auto slab_class = get_slab_class(size);
+        return slab_class && rebalance_slab_page(*slab_class);
+    }
+
+    /**
+     * Per-class occupancy statistics. The fragmentation of a class is the
+     * share of nr_objects that are free while the pages backing them stay
+     * allocated to the class.
+     */
+    std::vector<slab_class_stats> class_stats() const {
+        std::vector<slab_class_stats> stats;
+        stats.reserve(_slab_classes.size());
+        for (auto& slab_class : _slab_classes) {
+            stats.push_back(slab_class.stats(_max_object_size));
+        }
+        return stats;
+    }
     slab_allocator(double growth_factor, uint64_t limit, uint64_t max_object_size)
         : _max_object_size(max_object_size)
         , _available_slab_pages(limit / max_object_size)
@@ -488,6 +710,9 @@ public:
                     _available_slab_pages--;
                 }
                 _stats.allocs++;
+            } else if (rebalance_slab_page(*slab_class)) {
+                item = slab_class->create(std::forward<Args>(args)...);
+                _stats.allocs++;
             } else if (_erase_func) {
                 item = slab_class->create_from_lru(_erase_func, std::forward<Args>(args)...);
             }
@@ -538,13 +763,13 @@ public:
     }
 
     /**
-     * Update item position in the LRU of its slab class.
+     * Mark the item recently used, granting it a second chance when the
+     * eviction hand of its slab class reaches it.
      */
     void touch(Item *item) {
         if (item) {
-            auto& desc = get_slab_page_desc(item);
-            auto slab_class = get_slab_class(desc.slab_class_id());
-            slab_class->touch_item(item);
+            reinterpret_cast<slab_item_base&>(*item)._referenced = true;
+            get_slab_class(get_slab_page_desc(item).slab_class_id())->record_hit();
         }
     }
 
@@ -0,0 +1,188 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace seastar {
+
+// A vector with inline storage for its first N elements, spilling to
+// the heap only beyond that.  Request handling builds many tiny,
+// short-lived vectors - iovecs for a writev(), fragment lists - whose
+// size almost always fits a known small bound, so std::vector's
+// guaranteed allocation is pure overhead.  Interface is the familiar
+// subset of std::vector; elements must be movable.
+template <typename T, size_t N>
+class small_vector {
+    static_assert(N > 0, "small_vector needs inline capacity");
+    T* _begin;
+    T* _end;
+    T* _capacity_end;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type _internal[N];
+private:
+    T* internal() {
+        return reinterpret_cast<T*>(_internal);
+    }
+    const T* internal() const {
+        return reinterpret_cast<const T*>(_internal);
+    }
+    bool uses_internal_storage() const {
+        return _begin == internal();
+    }
+    // Moves our elements into other's inline storage; used when moving
+    // out of a small_vector that has not spilled.
+    void move_internal_to(small_vector& other) noexcept {
+        other._begin = other.internal();
+        other._end = other._begin;
+        other._capacity_end = other._begin + N;
+        for (auto p = _begin; p != _end; ++p) {
+            new (other._end++) T(std::move(*p));
+            p->~T();
+        }
+        _end = _begin;
+    }
+    void expand(size_t new_capacity) {
+        auto buf = static_cast<T*>(::operator new(new_capacity * sizeof(T)));
+        auto dest = buf;
+        for (auto p = _begin; p != _end; ++p) {
+            new (dest++) T(std::move(*p));
+            p->~T();
+        }
+        if (!uses_internal_storage()) {
+            ::operator delete(_begin);
+        }
+        _begin = buf;
+        _end = dest;
+        _capacity_end = buf + new_capacity;
+    }
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    small_vector() noexcept
+        : _begin(internal())
+        , _end(_begin)
+        , _capacity_end(_begin + N) {
+    }
+    small_vector(small_vector&& x) noexcept {
+        if (x.uses_internal_storage()) {
+            x.move_internal_to(*this);
+        } else {
+            _begin = x._begin;
+            _end = x._end;
+            _capacity_end = x._capacity_end;
+            x._begin = x.internal();
+            x._end = x._begin;
+            x._capacity_end = x._begin + N;
+        }
+    }
+    small_vector(const small_vector& x)
+        : small_vector() {
+        reserve(x.size());
+        for (auto& e : x) {
+            new (_end++) T(e);
+        }
+    }
+    small_vector& operator=(small_vector&& x) noexcept {
+        if (this != &x) {
+            this->~small_vector();
+            new (this) small_vector(std::move(x));
+        }
+        return *this;
+    }
+    small_vector& operator=(const small_vector& x) {
+        if (this != &x) {
+            this->~small_vector();
+            new (this) small_vector(x);
+        }
+        return *this;
+    }
+    ~small_vector() {
+        clear();
+        if (!uses_internal_storage()) {
+            ::operator delete(_begin);
+        }
+    }
+
+    void reserve(size_t n) {
+        if (n > capacity()) {
+            expand(std::max(n, capacity() * 2));
+        }
+    }
+    void push_back(const T& x) {
+        emplace_back(x);
+    }
+    void push_back(T&& x) {
+        emplace_back(std::move(x));
+    }
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (_end == _capacity_end) {
+            expand(capacity() * 2);
+        }
+        new (_end) T(std::forward<Args>(args)...);
+        return *_end++;
+    }
+    void pop_back() {
+        (--_end)->~T();
+    }
+    void resize(size_t n) {
+        reserve(n);
+        while (size() > n) {
+            pop_back();
+        }
+        while (size() < n) {
+            new (_end++) T();
+        }
+    }
+    void clear() {
+        while (_end != _begin) {
+            (--_end)->~T();
+        }
+    }
+
+    T* data() { return _begin; }
+    const T* data() const { return _begin; }
+    size_t size() const { return _end - _begin; }
+    size_t capacity() const { return _capacity_end - _begin; }
+    bool empty() const { return _begin == _end; }
+    iterator begin() { return _begin; }
+    iterator end() { return _end; }
+    const_iterator begin() const { return _begin; }
+    const_iterator end() const { return _end; }
+    const_iterator cbegin() const { return _begin; }
+    const_iterator cend() const { return _end; }
+    T& operator[](size_t i) { return _begin[i]; }
+    const T& operator[](size_t i) const { return _begin[i]; }
+    T& front() { return *_begin; }
+    const T& front() const { return *_begin; }
+    T& back() { return _end[-1]; }
+    const T& back() const { return _end[-1]; }
+};
+
+}
@@ -37,15 +37,18 @@
 #include <experimental/string_view>
 #include "core/temporary_buffer.hh"
 
-template <typename char_type, typename Size, Size max_size>
+template <typename char_type, typename Size, Size max_size, bool NulTerminate = true>
 class basic_sstring;
 
 using sstring = basic_sstring<char, uint32_t, 15>;
+// larger internal buffer for key-heavy containers; a 32-byte object
+// keeps strings of up to 30 characters off the heap
+using sstring32 = basic_sstring<char, uint32_t, 31>;
 
 template <typename string_type = sstring, typename T>
 inline string_type to_sstring(T value);
 
-template <typename char_type, typename Size, Size max_size>
+template <typename char_type, typename Size, Size max_size, bool NulTerminate>
 class basic_sstring {
     static_assert(
             (std::is_same<char_type, char>::value
@@ -65,6 +68,10 @@ class basic_sstring {
         static_assert(sizeof(external_type) <= sizeof(internal_type), "max_size too small");
         static_assert(max_size <= 127, "max_size too large");
     } u;
+    // room reserved for the terminating NUL, if any
+    static constexpr size_t padding() noexcept {
+        return NulTerminate ? 1 : 0;
+    }
     bool is_internal() const noexcept {
         return u.internal.size >= 0;
     }
@@ -164,60 +171,77 @@ public:
 
     basic_sstring() noexcept {
         u.internal.size = 0;
-        u.internal.str[0] = '\0';
+        if (NulTerminate) {
+            u.internal.str[0] = '\0';
+        }
     }
     basic_sstring(const basic_sstring& x) {
         if (x.is_internal()) {
             u.internal = x.u.internal;
         } else {
             u.internal.size = -1;
-            u.external.str = reinterpret_cast<char_type*>(std::malloc(x.u.external.size + 1));
+            u.external.str = reinterpret_cast<char_type*>(std::malloc(x.u.external.size + padding()));
             if (!u.external.str) {
                 throw std::bad_alloc();
             }
-            std::copy(x.u.external.str, x.u.external.str + x.u.external.size + 1, u.external.str);
+            std::copy(x.u.external.str, x.u.external.str + x.u.external.size + padding(), u.external.str);
             u.external.size = x.u.external.size;
         }
     }
     basic_sstring(basic_sstring&& x) noexcept {
         u = x.u;
         x.u.internal.size = 0;
-        x.u.internal.str[0] = '\0';
+        if (NulTerminate) {
+            x.u.internal.str[0] = '\0';
+        }
     }
+    // converts between instantiations differing in internal capacity,
+    // size type or null termination; explicit, since it may allocate
+    template <typename Size2, Size2 max_size2, bool NulTerminate2>
+    explicit basic_sstring(const basic_sstring<char_type, Size2, max_size2, NulTerminate2>& x)
+        : basic_sstring(x.data(), x.size()) {}
     basic_sstring(initialized_later, size_t size) {
         if (size_type(size) != size) {
             throw std::overflow_error("sstring overflow");
         }
-        if (size + 1 <= sizeof(u.internal.str)) {
-            u.internal.str[size] = '\0';
+        if (size + padding() <= sizeof(u.internal.str)) {
+            if (NulTerminate) {
+                u.internal.str[size] = '\0';
+            }
             u.internal.size = size;
         } else {
             u.internal.size = -1;
-            u.external.str = reinterpret_cast<char_type*>(std::malloc(size + 1));
+            u.external.str = reinterpret_cast<char_type*>(std::malloc(size + padding()));
             if (!u.external.str) {
                 throw std::bad_alloc();
             }
             u.external.size = size;
-            u.external.str[size] = '\0';
+            if (NulTerminate) {
+                u.external.str[size] = '\0';
+            }
         }
     }
     basic_sstring(const char_type* x, size_t size) {
         if (size_type(size) != size) {
             throw std::overflow_error("sstring overflow");
         }
-        if (size + 1 <= sizeof(u.internal.str)) {
+        if (size + padding() <= sizeof(u.internal.str)) {
             std::copy(x, x + size, u.internal.str);
-            u.internal.str[size] = '\0';
+            if (NulTerminate) {
+                u.internal.str[size] = '\0';
+            }
             u.internal.size = size;
         } else {
             u.internal.size = -1;
-            u.external.str = reinterpret_cast<char_type*>(std::malloc(size + 1));
+            u.external.str = reinterpret_cast<char_type*>(std::malloc(size + padding()));
             if (!u.external.str) {
                 throw std::bad_alloc();
             }
             u.external.size = size;
             std::copy(x, x + size, u.external.str);
-            u.external.str[size] = '\0';
+            if (NulTerminate) {
+                u.external.str[size] = '\0';
+            }
         }
     }
 
@@ -341,12 +365,12 @@ public:
      */
     void resize(size_t n, const char_type c  = '\0') {
         if (n > size()) {
-            *this += sstring(n - size(), c);
+            *this += basic_sstring(n - size(), c);
         } else if (n < size()) {
             if (is_internal()) {
                 u.internal.size = n;
-            } else if (n + 1 <= sizeof(u.internal.str)) {
-                *this = sstring(u.external.str, n);
+            } else if (n + padding() <= sizeof(u.internal.str)) {
+                *this = basic_sstring(u.external.str, n);
             } else {
                 u.external.size = n;
             }
@@ -480,7 +504,9 @@ public:
             std::free(u.external.str);
         }
         u.internal.size = 0;
-        u.internal.str[0] = '\0';
+        if (NulTerminate) {
+            u.internal.str[0] = '\0';
+        }
     }
     temporary_buffer<char_type> release() && {
         if (is_external()) {
@@ -493,7 +519,9 @@ public:
             auto buf = temporary_buffer<char_type>(u.internal.size);
             std::copy(u.internal.str, u.internal.str + u.internal.size, buf.get_write());
             u.internal.size = 0;
-            u.internal.str[0] = '\0';
+            if (NulTerminate) {
+                u.internal.str[0] = '\0';
+            }
             return buf;
         }
     }
@@ -543,6 +571,7 @@ public:
         return str();
     }
     const char_type* c_str() const {
+        static_assert(NulTerminate, "c_str() is only valid for null-terminated sstrings");
         return str();
     }
     const char_type* begin() const { return str(); }
@@ -560,6 +589,20 @@ public:
     bool operator<(const basic_sstring& x) const {
         return compare(x) < 0;
     }
+    // content comparisons between different instantiations
+    template <typename Size2, Size2 max_size2, bool NulTerminate2>
+    bool operator==(const basic_sstring<char_type, Size2, max_size2, NulTerminate2>& x) const {
+        return size() == x.size() && std::equal(begin(), end(), x.begin());
+    }
+    template <typename Size2, Size2 max_size2, bool NulTerminate2>
+    bool operator!=(const basic_sstring<char_type, Size2, max_size2, NulTerminate2>& x) const {
+        return !operator==(x);
+    }
+    template <typename Size2, Size2 max_size2, bool NulTerminate2>
+    bool operator<(const basic_sstring<char_type, Size2, max_size2, NulTerminate2>& x) const {
+        auto n = traits_type::compare(begin(), x.begin(), std::min(size(), x.size()));
+        return n != 0 ? n < 0 : size() < x.size();
+    }
     basic_sstring operator+(const basic_sstring& x) const {
         basic_sstring ret(initialized_later(), size() + x.size());
         std::copy(begin(), end(), ret.begin());
@@ -583,14 +626,14 @@ public:
     template <typename string_type, typename T>
     friend inline string_type to_sstring(T value);
 };
-template <typename char_type, typename Size, Size max_size>
-constexpr Size basic_sstring<char_type, Size, max_size>::npos;
+template <typename char_type, typename Size, Size max_size, bool NulTerminate>
+constexpr Size basic_sstring<char_type, Size, max_size, NulTerminate>::npos;
 
-template <typename char_type, typename size_type, size_type Max, size_type N>
+template <typename char_type, typename size_type, size_type Max, size_type N, bool NulTerminate>
 inline
-basic_sstring<char_type, size_type, Max>
-operator+(const char(&s)[N], const basic_sstring<char_type, size_type, Max>& t) {
-    using sstring = basic_sstring<char_type, size_type, Max>;
+basic_sstring<char_type, size_type, Max, NulTerminate>
+operator+(const char(&s)[N], const basic_sstring<char_type, size_type, Max, NulTerminate>& t) {
+    using sstring = basic_sstring<char_type, size_type, Max, NulTerminate>;
     // don't copy the terminating NUL character
     sstring ret(typename sstring::initialized_later(), N-1 + t.size());
     auto p = std::copy(std::begin(s), std::end(s)-1, ret.begin());
@@ -610,17 +653,17 @@ template <size_t N>
 static inline
 const char* str_end(const char(&s)[N]) { return str_begin(s) + str_len(s); }
 
-template <typename char_type, typename size_type, size_type max_size>
+template <typename char_type, typename size_type, size_type max_size, bool NulTerminate>
 static inline
-const char_type* str_begin(const basic_sstring<char_type, size_type, max_size>& s) { return s.begin(); }
+const char_type* str_begin(const basic_sstring<char_type, size_type, max_size, NulTerminate>& s) { return s.begin(); }
 
-template <typename char_type, typename size_type, size_type max_size>
+template <typename char_type, typename size_type, size_type max_size, bool NulTerminate>
 static inline
-const char_type* str_end(const basic_sstring<char_type, size_type, max_size>& s) { return s.end(); }
+const char_type* str_end(const basic_sstring<char_type, size_type, max_size, NulTerminate>& s) { return s.end(); }
 
-template <typename char_type, typename size_type, size_type max_size>
+template <typename char_type, typename size_type, size_type max_size, bool NulTerminate>
 static inline
-size_type str_len(const basic_sstring<char_type, size_type, max_size>& s) { return s.size(); }
+size_type str_len(const basic_sstring<char_type, size_type, max_size, NulTerminate>& s) { return s.size(); }
 
 template <typename First, typename Second, typename... Tail>
 static inline
@@ -628,27 +671,27 @@ const size_t str_len(const First& first, const Second& second, const Tail&... ta
     return str_len(first) + str_len(second, tail...);
 }
 
-template <typename char_type, typename size_type, size_type max_size>
+template <typename char_type, typename size_type, size_type max_size, bool NulTerminate>
 inline
-void swap(basic_sstring<char_type, size_type, max_size>& x,
-          basic_sstring<char_type, size_type, max_size>& y) noexcept
+void swap(basic_sstring<char_type, size_type, max_size, NulTerminate>& x,
+          basic_sstring<char_type, size_type, max_size, NulTerminate>& y) noexcept
 {
     return x.swap(y);
 }
 
-template <typename char_type, typename size_type, size_type max_size, typename char_traits>
+template <typename char_type, typename size_type, size_type max_size, bool NulTerminate, typename char_traits>
 inline
 std::basic_ostream<char_type, char_traits>&
 operator<<(std::basic_ostream<char_type, char_traits>& os,
-        const basic_sstring<char_type, size_type, max_size>& s) {
+        const basic_sstring<char_type, size_type, max_size, NulTerminate>& s) {
     return os.write(s.begin(), s.size());
 }
 
-template <typename char_type, typename size_type, size_type max_size, typename char_traits>
+template <typename char_type, typename size_type, size_type max_size, bool NulTerminate, typename char_traits>
 inline
 std::basic_istream<char_type, char_traits>&
 operator>>(std::basic_istream<char_type, char_traits>& is,
-        basic_sstring<char_type, size_type, max_size>& s) {
+        basic_sstring<char_type, size_type, max_size, NulTerminate>& s) {
     std::string tmp;
     is >> tmp;
     s = tmp;
@@ -657,9 +700,11 @@ operator>>(std::basic_istream<char_type, char_traits>& is,
 
 namespace std {
 
-template <typename char_type, typename size_type, size_type max_size>
-struct hash<basic_sstring<char_type, size_type, max_size>> {
-    size_t operator()(const basic_sstring<char_type, size_type, max_size>& s) const {
+// hashes the characters only, so equal strings of different
+// instantiations hash alike
+template <typename char_type, typename size_type, size_type max_size, bool NulTerminate>
+struct hash<basic_sstring<char_type, size_type, max_size, NulTerminate>> {
+    size_t operator()(const basic_sstring<char_type, size_type, max_size, NulTerminate>& s) const {
         return std::hash<std::experimental::basic_string_view<char_type>>()(s);
     }
 };
@@ -680,7 +725,7 @@ char* copy_str_to(char* dst, const Head& head, const Tail&... tail) {
 template <typename String = sstring, typename... Args>
 static String make_sstring(Args&&... args)
 {
-    String ret(sstring::initialized_later(), str_len(args...));
+    String ret(typename String::initialized_later(), str_len(args...));
     copy_str_to(ret.begin(), args...);
     return ret;
 }
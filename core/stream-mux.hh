@@ -0,0 +1,377 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "iostream.hh"
+#include "future-util.hh"
+#include "semaphore.hh"
+#include "shared_ptr.hh"
+#include "scattered_message.hh"
+#include "byteorder.hh"
+#include "print.hh"
+#include "net/packet.hh"
+#include <deque>
+#include <vector>
+#include <experimental/optional>
+
+//
+// Framed stream multiplexing: several logical byte streams (channels)
+// over one connection, so that an application needing a data, a control
+// and a heartbeat stream to the same peer pays for one socket instead
+// of three.
+//
+// Wire format: every frame is a fixed header - one byte of channel id
+// followed by the payload length as a 32-bit big-endian integer - and
+// then the payload.  A zero-length frame marks end-of-stream for its
+// channel.  Both sides must create channels in the same order so that
+// the ids agree.
+//
+// Each channel presents an ordinary input_stream/output_stream pair.
+// Received frames are handed to the channel's input_stream without
+// copying; transmitted frames are assembled with scattered_message, so
+// the header and the caller's buffer travel to the connection as one
+// packet without linearization.  Transmission is scheduled by channel
+// priority (lower value first), letting a small control frame overtake
+// a queue of bulk data.
+//
+// Flow control is per channel: a channel whose consumer stalls stops
+// accepting frames once its window fills.  Note that this stalls the
+// shared receive pump - the transport delivers bytes in order, so a
+// frame for a slow channel blocks frames behind it for every channel
+// (head-of-line blocking).  Size the windows generously relative to
+// frame sizes.
+//
+// The stream_mux must outlive the channel streams obtained from it.
+//
+
+class stream_mux {
+public:
+    static constexpr size_t frame_header_size = 5;
+    static constexpr size_t max_frame_size = 128 * 1024;
+private:
+    struct channel {
+        uint8_t id;
+        unsigned priority;
+        // receive side: frames parked here until the channel's
+        // input_stream consumes them; rx_window (bytes) is what the
+        // receive pump may still accept for this channel
+        std::deque<temporary_buffer<char>> rx;
+        semaphore rx_window;
+        std::experimental::optional<promise<>> rx_waiter;
+        bool rx_eof = false;
+        // transmit side: frames parked here until the transmit pump
+        // writes them out; tx_window (bytes) bounds what a producer
+        // may have in flight
+        std::deque<net::packet> tx;
+        semaphore tx_window;
+        bool tx_closed = false;
+        channel(uint8_t id, unsigned priority, size_t window)
+            : id(id), priority(priority), rx_window(window), tx_window(window) {}
+    };
+    class mux_source_impl final : public data_source_impl {
+        stream_mux& _mux;
+        lw_shared_ptr<channel> _chan;
+    public:
+        mux_source_impl(stream_mux& mux, lw_shared_ptr<channel> chan)
+            : _mux(mux), _chan(std::move(chan)) {}
+        virtual future<temporary_buffer<char>> get() override {
+            return _mux.read_frame(_chan);
+        }
+    };
+    class mux_sink_impl final : public data_sink_impl {
+        stream_mux& _mux;
+        lw_shared_ptr<channel> _chan;
+    public:
+        mux_sink_impl(stream_mux& mux, lw_shared_ptr<channel> chan)
+            : _mux(mux), _chan(std::move(chan)) {}
+        virtual future<> put(temporary_buffer<char> buf) override {
+            if (buf.empty()) {
+                return make_ready_future<>();
+            }
+            scattered_message<char> msg;
+            msg.reserve(2);
+            msg.append(_mux.make_frame_header(_chan->id, buf.size()));
+            msg.append(std::move(buf));
+            return _mux.send_frame(_chan, std::move(msg).release());
+        }
+        virtual future<> put(net::packet p) override {
+            if (!p.len()) {
+                return make_ready_future<>();
+            }
+            auto len = p.len();
+            auto hdr = p.prepend_uninitialized_header(frame_header_size);
+            hdr[0] = _chan->id;
+            write_be<uint32_t>(hdr + 1, uint32_t(len));
+            return _mux.send_frame(_chan, std::move(p));
+        }
+        virtual future<> flush() override {
+            return _mux.flush_tx();
+        }
+        virtual future<> close() override {
+            return _mux.close_channel(_chan);
+        }
+    };
+    input_stream<char> _in;
+    output_stream<char> _out;
+    size_t _window;
+    size_t _stream_buffer_size;
+    std::vector<lw_shared_ptr<channel>> _channels;
+    bool _tx_active = false;
+    std::vector<promise<>> _tx_idle_waiters;
+    std::exception_ptr _tx_ex;
+    std::exception_ptr _rx_ex;
+public:
+    /// Builds a multiplexer over an established connection's streams,
+    /// e.g. \c socket.input() and \c socket.output().  \c window is the
+    /// per-channel flow control window, in bytes, for each direction.
+    stream_mux(input_stream<char> in, output_stream<char> out,
+               size_t window = 512 * 1024, size_t stream_buffer_size = 8192)
+        : _in(std::move(in)), _out(std::move(out))
+        , _window(window), _stream_buffer_size(stream_buffer_size) {
+    }
+    /// Registers the next channel and returns its id.  Must be called
+    /// in the same order on both peers, before \ref run().  Lower
+    /// \c priority values transmit first.
+    uint8_t add_channel(unsigned priority = 0) {
+        assert(_channels.size() < 256);
+        auto id = uint8_t(_channels.size());
+        _channels.push_back(make_lw_shared<channel>(id, priority, _window));
+        return id;
+    }
+    /// Returns the read side of a channel.  Call at most once per
+    /// channel.
+    input_stream<char> input(uint8_t chan) {
+        return input_stream<char>(data_source(
+                std::make_unique<mux_source_impl>(*this, _channels[chan])));
+    }
+    /// Returns the write side of a channel.  Call at most once per
+    /// channel.
+    output_stream<char> output(uint8_t chan) {
+        return output_stream<char>(data_sink(
+                std::make_unique<mux_sink_impl>(*this, _channels[chan])), _stream_buffer_size);
+    }
+    /// Runs the receive pump, demultiplexing incoming frames to their
+    /// channels.  Resolves when the peer closes the connection, or
+    /// fails with the connection error; either way all channel readers
+    /// are unblocked first.
+    future<> run() {
+        return repeat([this] {
+            return handle_frame();
+        }).then_wrapped([this] (future<> f) {
+            if (f.failed()) {
+                _rx_ex = f.get_exception();
+            }
+            // unblock readers; they see _rx_ex or end of stream
+            for (auto& c : _channels) {
+                c->rx_eof = true;
+                if (c->rx_waiter) {
+                    c->rx_waiter->set_value();
+                    c->rx_waiter = {};
+                }
+            }
+            if (_rx_ex) {
+                return make_exception_future<>(_rx_ex);
+            }
+            return make_ready_future<>();
+        });
+    }
+    /// Waits until all queued frames have reached the connection, then
+    /// closes the write side.  Channel outputs should be closed first
+    /// so the peer sees their end-of-stream frames.
+    future<> stop() {
+        return flush_tx().then([this] {
+            return _out.close();
+        });
+    }
+private:
+    static sstring make_frame_header(uint8_t chan, uint32_t len) {
+        sstring hdr(sstring::initialized_later(), frame_header_size);
+        hdr[0] = chan;
+        write_be<uint32_t>(hdr.begin() + 1, len);
+        return hdr;
+    }
+    future<stop_iteration> handle_frame() {
+        return _in.read_exactly(frame_header_size).then([this] (temporary_buffer<char> hdr) {
+            if (hdr.size() < frame_header_size) {
+                // clean close only on a frame boundary
+                if (!hdr.empty()) {
+                    throw std::runtime_error("stream_mux: truncated frame header");
+                }
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto chan = uint8_t(hdr[0]);
+            auto len = read_be<uint32_t>(hdr.get() + 1);
+            if (chan >= _channels.size()) {
+                throw std::runtime_error(sprint("stream_mux: frame for unknown channel %d", chan));
+            }
+            if (len > max_frame_size) {
+                throw std::runtime_error(sprint("stream_mux: oversized frame (%d bytes)", len));
+            }
+            auto c = _channels[chan];
+            if (!len) {
+                c->rx_eof = true;
+                if (c->rx_waiter) {
+                    c->rx_waiter->set_value();
+                    c->rx_waiter = {};
+                }
+                return make_ready_future<stop_iteration>(stop_iteration::no);
+            }
+            return _in.read_exactly(len).then([this, c, len] (temporary_buffer<char> payload) mutable {
+                if (payload.size() < len) {
+                    throw std::runtime_error("stream_mux: truncated frame payload");
+                }
+                // per-channel flow control; while this channel is out
+                // of window the whole pump waits (see header comment)
+                return c->rx_window.wait(len).then([c = std::move(c), payload = std::move(payload)] () mutable {
+                    c->rx.push_back(std::move(payload));
+                    if (c->rx_waiter) {
+                        c->rx_waiter->set_value();
+                        c->rx_waiter = {};
+                    }
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+    future<temporary_buffer<char>> read_frame(lw_shared_ptr<channel> c) {
+        if (!c->rx.empty()) {
+            auto buf = std::move(c->rx.front());
+            c->rx.pop_front();
+            c->rx_window.signal(buf.size());
+            return make_ready_future<temporary_buffer<char>>(std::move(buf));
+        }
+        if (_rx_ex) {
+            return make_exception_future<temporary_buffer<char>>(_rx_ex);
+        }
+        if (c->rx_eof) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        c->rx_waiter = promise<>();
+        return c->rx_waiter->get_future().then([this, c = std::move(c)] () mutable {
+            return read_frame(std::move(c));
+        });
+    }
+    future<> send_frame(lw_shared_ptr<channel> c, net::packet p) {
+        if (_tx_ex) {
+            return make_exception_future<>(_tx_ex);
+        }
+        if (c->tx_closed) {
+            return make_exception_future<>(std::make_exception_ptr(
+                    std::runtime_error("stream_mux: write on closed channel")));
+        }
+        auto len = p.len() - frame_header_size;
+        return c->tx_window.wait(len).then([this, c = std::move(c), p = std::move(p)] () mutable {
+            if (_tx_ex) {
+                return make_exception_future<>(_tx_ex);
+            }
+            c->tx.push_back(std::move(p));
+            tx_kick();
+            return make_ready_future<>();
+        });
+    }
+    future<> close_channel(lw_shared_ptr<channel> c) {
+        if (c->tx_closed || _tx_ex) {
+            return make_ready_future<>();
+        }
+        c->tx_closed = true;
+        scattered_message<char> msg;
+        msg.append(make_frame_header(c->id, 0));
+        c->tx.push_back(std::move(msg).release());
+        tx_kick();
+        return flush_tx();
+    }
+    future<> flush_tx() {
+        if (_tx_ex) {
+            return make_exception_future<>(_tx_ex);
+        }
+        if (!_tx_active) {
+            // pump only parks with every queue drained and flushed
+            return make_ready_future<>();
+        }
+        _tx_idle_waiters.emplace_back();
+        return _tx_idle_waiters.back().get_future();
+    }
+    channel* pick_tx_channel() {
+        channel* best = nullptr;
+        for (auto& c : _channels) {
+            if (!c->tx.empty() && (!best || c->priority < best->priority)) {
+                best = c.get();
+            }
+        }
+        return best;
+    }
+    void tx_kick() {
+        if (_tx_active || _tx_ex) {
+            return;
+        }
+        _tx_active = true;
+        do_tx();
+    }
+    void do_tx() {
+        auto c = pick_tx_channel();
+        if (!c) {
+            // drained: push everything to the connection and park
+            _out.flush().then_wrapped([this] (future<> f) {
+                if (f.failed()) {
+                    tx_fail(f.get_exception());
+                    return;
+                }
+                _tx_active = false;
+                if (pick_tx_channel()) {
+                    // frames arrived while flushing
+                    tx_kick();
+                    return;
+                }
+                auto waiters = std::move(_tx_idle_waiters);
+                for (auto& w : waiters) {
+                    w.set_value();
+                }
+            });
+            return;
+        }
+        auto p = std::move(c->tx.front());
+        c->tx.pop_front();
+        auto len = p.len() - frame_header_size;
+        _out.write(std::move(p)).then_wrapped([this, c, len] (future<> f) {
+            if (f.failed()) {
+                tx_fail(f.get_exception());
+                return;
+            }
+            c->tx_window.signal(len);
+            do_tx();
+        });
+    }
+    void tx_fail(std::exception_ptr ex) {
+        _tx_ex = std::move(ex);
+        _tx_active = false;
+        for (auto& c : _channels) {
+            c->tx.clear();
+            // wake producers parked on the window; they recheck _tx_ex
+            c->tx_window.signal(_window);
+        }
+        auto waiters = std::move(_tx_idle_waiters);
+        for (auto& w : waiters) {
+            w.set_exception(_tx_ex);
+        }
+    }
+};
@@ -21,13 +21,66 @@
 
 #include "systemwide_memory_barrier.hh"
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <cassert>
+#include <cerrno>
+
+// membarrier(2) appeared in Linux 4.3 and the expedited flavor in 4.14;
+// define what we need locally so older build hosts still compile, and
+// detect at runtime whether the running kernel supports it.
+#if defined(__NR_membarrier)
+
+namespace {
+
+enum {
+    membarrier_cmd_query = 0,
+    membarrier_cmd_private_expedited = 1 << 3,
+    membarrier_cmd_register_private_expedited = 1 << 4,
+};
+
+int
+membarrier(int cmd, int flags) {
+    return syscall(__NR_membarrier, cmd, flags);
+}
+
+bool
+try_systemwide_membarrier() {
+    static const bool available = [] {
+        auto commands = membarrier(membarrier_cmd_query, 0);
+        if (commands < 0
+                || !(commands & membarrier_cmd_private_expedited)
+                || !(commands & membarrier_cmd_register_private_expedited)) {
+            return false;
+        }
+        return membarrier(membarrier_cmd_register_private_expedited, 0) == 0;
+    }();
+    if (!available) {
+        return false;
+    }
+    auto r = membarrier(membarrier_cmd_private_expedited, 0);
+    assert(r == 0);
+    return true;
+}
+
+}
+
+#else
+
+static bool try_systemwide_membarrier() {
+    return false;
+}
+
+#endif
 
 // cause all threads to invoke a full memory barrier
 void
 systemwide_memory_barrier() {
-    // FIXME: use sys_membarrier() when available
+    if (try_systemwide_membarrier()) {
+        // the kernel ran a barrier on every cpu running one of our
+        // threads, without the TLB shootdowns the fallback causes
+        return;
+    }
     static thread_local char* mem = [] {
        void* mem = mmap(nullptr, getpagesize(),
                PROT_READ | PROT_WRITE,
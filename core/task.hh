@@ -21,12 +21,103 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include "tracing.hh"
+
+/// \cond internal
+
+// Tasks - mostly .then() continuations - are allocated and freed at an
+// enormous rate, one per link in every continuation chain, always on
+// the owning shard and in near-LIFO order.  A small per-thread cache of
+// recently freed blocks turns the common small allocation into a
+// pointer pop, while captures too large for the cache fall back to
+// operator new.  Sized deallocation (C++14) gives us the exact derived
+// size back on delete, even through a task* with a virtual destructor.
+class task_recycler {
+    static constexpr size_t granularity = 16;
+    static constexpr size_t max_size = 16 * granularity;   // 256 bytes
+    static constexpr size_t nr_buckets = max_size / granularity;
+    static constexpr size_t max_cached = 32;               // per bucket
+    struct free_block {
+        free_block* next;
+    };
+    free_block* _buckets[nr_buckets] = {};
+    uint8_t _nr_free[nr_buckets] = {};
+private:
+    static size_t bucket_of(size_t size) {
+        return (size - 1) / granularity;
+    }
+public:
+    ~task_recycler() {
+        for (auto&& head : _buckets) {
+            while (head) {
+                auto next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+    void* alloc(size_t size) {
+        if (size > max_size) {
+            return ::operator new(size);
+        }
+        auto b = bucket_of(size);
+        auto blk = _buckets[b];
+        if (!blk) {
+            // allocate the full bucket size, so the block is reusable
+            // by anything that maps to the same bucket
+            return ::operator new((b + 1) * granularity);
+        }
+        _buckets[b] = blk->next;
+        --_nr_free[b];
+        return blk;
+    }
+    void free(void* ptr, size_t size) {
+        if (size > max_size) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto b = bucket_of(size);
+        if (_nr_free[b] == max_cached) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto blk = static_cast<free_block*>(ptr);
+        blk->next = _buckets[b];
+        _buckets[b] = blk;
+        ++_nr_free[b];
+    }
+    static task_recycler& local() {
+        static thread_local task_recycler instance;
+        return instance;
+    }
+};
+
+/// \endcond
 
 class task {
+    trace_context _trace;
 public:
     virtual ~task() noexcept {}
     virtual void run() noexcept = 0;
+    // The trace context that was current when the task became runnable;
+    // the reactor stamps it in add_task_in() and makes it current again
+    // before run(), so a continuation executes in the context of
+    // whatever produced its input (see core/tracing.hh).
+    void set_trace_context(trace_context c) {
+        _trace = c;
+    }
+    trace_context get_trace_context() const {
+        return _trace;
+    }
+    static void* operator new(size_t size) {
+        return task_recycler::local().alloc(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        task_recycler::local().free(ptr, size);
+    }
 };
 
 void schedule(std::unique_ptr<task> t);
@@ -23,6 +23,7 @@
 #define TEMPORARY_BUFFER_HH_
 
 #include "deleter.hh"
+#include "buffer_pool.hh"
 #include "util/eclipse.hh"
 #include <malloc.h>
 #include <algorithm>
@@ -67,11 +68,19 @@ public:
     ///
     /// \param size buffer size, in bytes
     explicit temporary_buffer(size_t size)
-        : _buffer(static_cast<CharType*>(malloc(size * sizeof(CharType)))), _size(size)
-        , _deleter(make_free_deleter(_buffer)) {
+        : _size(size) {
+        // common I/O sizes come from the per-shard recycled-buffer pool
+        auto a = buffer_pool::try_allocate(size * sizeof(CharType));
+        if (a.buf) {
+            _buffer = reinterpret_cast<CharType*>(a.buf);
+            _deleter = std::move(a.del);
+            return;
+        }
+        _buffer = static_cast<CharType*>(malloc(size * sizeof(CharType)));
         if (size && !_buffer) {
             throw std::bad_alloc();
         }
+        _deleter = make_free_deleter(_buffer);
     }
     //explicit temporary_buffer(CharType* borrow, size_t size) : _buffer(borrow), _size(size) {}
     /// Creates an empty \c temporary_buffer that does not point at anything.
@@ -194,6 +203,10 @@ public:
     /// \param size Required size.
     /// \return a new \c temporary_buffer object.
     static temporary_buffer aligned(size_t alignment, size_t size) {
+        auto a = buffer_pool::try_allocate(size * sizeof(CharType), alignment);
+        if (a.buf) {
+            return temporary_buffer(reinterpret_cast<CharType*>(a.buf), size, std::move(a.del));
+        }
         void *ptr = nullptr;
         auto ret = ::posix_memalign(&ptr, alignment, size * sizeof(CharType));
         auto buf = static_cast<CharType*>(ptr);
@@ -22,8 +22,11 @@
 
 #include "thread.hh"
 #include "posix.hh"
+#include "scollectd.hh"
 #include <ucontext.h>
+#include <sys/mman.h>
 #include <algorithm>
+#include <vector>
 
 /// \cond internal
 
@@ -32,20 +35,77 @@ namespace seastar {
 thread_local jmp_buf_link g_unthreaded_context;
 thread_local jmp_buf_link* g_current_context;
 
+// Request handlers spawn threads at a high rate, and a fresh stack per
+// thread means map/unmap churn (and TLB shootdowns).  Instead, retired
+// stacks go into a per-shard pool with their pages returned to the
+// kernel via madvise(), so an idle pool costs address space only;
+// reusing a pooled stack refaults a few pages, which is much cheaper
+// than a new mapping.
+static constexpr size_t max_pooled_stacks = 32;
+static thread_local std::vector<mmap_area> g_stack_pool;
+
+static thread_local struct {
+    uint64_t switches = 0;
+    uint64_t stacks_allocated = 0;
+    uint64_t stack_pool_hits = 0;
+} g_thread_stats;
+
+static std::vector<scollectd::registration>
+register_thread_metrics() {
+    std::vector<scollectd::registration> regs;
+    regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("thread"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "context-switches")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, g_thread_stats.switches)
+    ));
+    regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("thread"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "stacks-allocated")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, g_thread_stats.stacks_allocated)
+    ));
+    regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("thread"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "stack-pool-hits")
+            , scollectd::make_typed(scollectd::data_type::DERIVE, g_thread_stats.stack_pool_hits)
+    ));
+    regs.push_back(scollectd::add_polled_metric(scollectd::type_instance_id("thread"
+            , scollectd::per_cpu_plugin_instance
+            , "queue_length", "stack-pool-size")
+            , scollectd::make_typed(scollectd::data_type::GAUGE,
+                    [] { return g_stack_pool.size(); })
+    ));
+    return regs;
+}
+
 thread_context::thread_context(thread_attributes attr, std::function<void ()> func)
         : _attr(std::move(attr))
         , _func(std::move(func)) {
+    static thread_local auto metrics = register_thread_metrics();
+    (void)metrics;
     setup();
     _all_threads.push_front(*this);
 }
 
 thread_context::~thread_context() {
     _all_threads.erase(_all_threads.iterator_to(*this));
+    if (g_stack_pool.size() < max_pooled_stacks) {
+        ::madvise(_stack.get(), _stack_size, MADV_DONTNEED);
+        g_stack_pool.push_back(std::move(_stack));
+    }
 }
 
-std::unique_ptr<char[]>
+mmap_area
 thread_context::make_stack() {
-    auto stack = std::make_unique<char[]>(_stack_size);
+    mmap_area stack;
+    if (!g_stack_pool.empty()) {
+        stack = std::move(g_stack_pool.back());
+        g_stack_pool.pop_back();
+        ++g_thread_stats.stack_pool_hits;
+    } else {
+        stack = mmap_anonymous(nullptr, _stack_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS);
+        ++g_thread_stats.stacks_allocated;
+    }
 #ifdef ASAN_ENABLED
     // Avoid ASAN false positive due to garbage on stack
     std::fill_n(stack.get(), _stack_size, 0);
@@ -74,7 +134,7 @@ thread_context::setup() {
 #ifdef ASAN_ENABLED
     swapcontext(&prev->context, &initial_context);
 #else
-    if (setjmp(prev->jmpbuf) == 0) {
+    if (sigsetjmp(prev->jmpbuf, 0) == 0) {
         setcontext(&initial_context);
     }
 #endif
@@ -91,11 +151,15 @@ thread_context::switch_in() {
     } else {
         _context.yield_at = {};
     }
+    ++g_thread_stats.switches;
 #ifdef ASAN_ENABLED
     swapcontext(&prev->context, &_context.context);
 #else
-    if (setjmp(prev->jmpbuf) == 0) {
-        longjmp(_context.jmpbuf, 1);
+    // savemask of zero: the signal mask is per-kernel-thread and does
+    // not change across a stack switch, so saving and restoring it
+    // would only add two sigprocmask() syscalls per switch
+    if (sigsetjmp(prev->jmpbuf, 0) == 0) {
+        siglongjmp(_context.jmpbuf, 1);
     }
 #endif
 }
@@ -106,11 +170,12 @@ thread_context::switch_out() {
         _attr.scheduling_group->account_stop();
     }
     g_current_context = _context.link;
+    ++g_thread_stats.switches;
 #ifdef ASAN_ENABLED
     swapcontext(&_context.context, &g_current_context->context);
 #else
-    if (setjmp(_context.jmpbuf) == 0) {
-        longjmp(g_current_context->jmpbuf, 1);
+    if (sigsetjmp(_context.jmpbuf, 0) == 0) {
+        siglongjmp(g_current_context->jmpbuf, 1);
     }
 #endif
 }
@@ -184,7 +249,7 @@ thread_context::main() {
 #ifdef ASAN_ENABLED
     setcontext(&g_current_context->context);
 #else
-    longjmp(g_current_context->jmpbuf, 1);
+    siglongjmp(g_current_context->jmpbuf, 1);
 #endif
 }
 
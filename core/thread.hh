@@ -95,7 +95,7 @@ extern thread_local jmp_buf_link g_unthreaded_context;
 class thread_context {
     thread_attributes _attr;
     static constexpr size_t _stack_size = 128*1024;
-    std::unique_ptr<char[]> _stack{make_stack()};
+    mmap_area _stack{make_stack()};
     std::function<void ()> _func;
     jmp_buf_link _context;
     promise<> _done;
@@ -121,7 +121,7 @@ private:
     static void s_main(unsigned int lo, unsigned int hi);
     void setup();
     void main();
-    static std::unique_ptr<char[]> make_stack();
+    static mmap_area make_stack();
 public:
     thread_context(thread_attributes attr, std::function<void ()> func);
     ~thread_context();
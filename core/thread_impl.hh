@@ -38,7 +38,9 @@ struct jmp_buf_link {
 #ifdef ASAN_ENABLED
     ucontext_t context;
 #else
-    jmp_buf jmpbuf;
+    // sigjmp_buf, used with a zero savemask, so a switch does not pay
+    // the two sigprocmask() calls glibc's plain setjmp/longjmp make
+    sigjmp_buf jmpbuf;
 #endif
     jmp_buf_link* link;
     thread_context* thread;
@@ -53,6 +53,10 @@ private:
     std::array<timer_list_t, n_buckets> _buckets;
     timestamp_t _last;
     timestamp_t _next;
+    // Expirations are coalesced into buckets of this size: a timer may
+    // fire up to _slack late if that lets it share a wakeup with others.
+    // Zero (the default) preserves exact wakeups.
+    timestamp_t _slack = 0;
 
     std::bitset<n_buckets> _non_empty_buckets;
 private:
@@ -82,6 +86,16 @@ private:
         return get_index(get_timestamp(timer));
     }
 
+    // Rounds a timeout up to the end of its slack bucket, which is when
+    // we will actually wake up for it.
+    timestamp_t align_up_to_slack(timestamp_t timestamp) const
+    {
+        if (!_slack) {
+            return timestamp;
+        }
+        return timestamp + (_slack - timestamp % _slack) % _slack;
+    }
+
     int get_last_non_empty_bucket() const
     {
         return bitsets::get_last_set(_non_empty_buckets);
@@ -128,8 +142,11 @@ public:
         _buckets[index].push_back(timer);
         _non_empty_buckets[index] = true;
 
-        if (timestamp < _next) {
-            _next = timestamp;
+        // A timer whose aligned timeout does not precede the armed wakeup
+        // rides on it, so inserting it costs only the list push above.
+        auto aligned = align_up_to_slack(timestamp);
+        if (aligned < _next) {
+            _next = aligned;
             return true;
         }
         return false;
@@ -204,7 +221,7 @@ public:
 
         if (_next == max_timestamp && _non_empty_buckets.any()) {
             for (auto& timer : _buckets[get_last_non_empty_bucket()]) {
-                _next = std::min(_next, get_timestamp(timer));
+                _next = std::min(_next, align_up_to_slack(get_timestamp(timer)));
             }
         }
         return exp;
@@ -221,6 +238,19 @@ public:
         return time_point(duration(std::max(_last, _next)));
     }
 
+    /**
+     * Sets the timer coalescing slack.
+     *
+     * Aligns wakeups to multiples of \c slack, so that timers expiring
+     * within the same slack bucket share one wakeup; each such timer may
+     * be delivered up to \c slack late.  May be called only while the
+     * set is empty.
+     */
+    void set_slack(duration slack)
+    {
+        _slack = slack.count();
+    }
+
     /**
      * Clears both active and expired timer sets.
      */
@@ -0,0 +1,402 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#ifndef __TIMER_WHEEL_HH
+#define __TIMER_WHEEL_HH
+
+#include <chrono>
+#include <limits>
+#include <bitset>
+#include <array>
+#include <cassert>
+#include <boost/intrusive/list.hpp>
+#include "bitset-iter.hh"
+
+namespace bi = boost::intrusive;
+
+namespace seastar {
+/**
+ * A hierarchical timer wheel with the same interface as timer_set.
+ *
+ * timer_set hashes timers into buckets by the most significant bit in
+ * which their timeout differs from the current time, so timers that
+ * survive several expire() rounds migrate between buckets (the boundary
+ * bucket is resorted on every round).  With millions of long-lived,
+ * mostly-cancelled timers per shard that resorting shows up.  The wheel
+ * instead places a timer by the ticks remaining until its timeout:
+ * level 0 holds one tick per slot, and each higher level holds slots
+ * 64x coarser, so insert and cancel are O(1) and a timer is touched
+ * again only when the wheel's current time enters its slot (lazy
+ * cascading), at most once per level.
+ *
+ * A tick is 2^ResolutionBits timestamp units; the resolution affects
+ * only how often timers cascade, not when they fire - firing is always
+ * checked against the exact timeout.  With the default 16 and
+ * nanosecond timestamps a tick is ~65us and the five levels cover
+ * ~19 hours; later timeouts are parked in an overflow list and fed
+ * into the wheel when it turns far enough.
+ *
+ * The template type "Timer" should have a method named
+ * get_timeout() which returns Timer::time_point which denotes
+ * timer's expiration.
+ */
+template<typename Timer, bi::list_member_hook<> Timer::*link, int ResolutionBits = 16>
+class timer_wheel {
+public:
+    using time_point = typename Timer::time_point;
+    using timer_list_t = bi::list<Timer, bi::member_hook<Timer, bi::list_member_hook<>, link>>;
+private:
+    using duration = typename Timer::duration;
+    using timestamp_t = typename Timer::duration::rep;
+
+    static constexpr timestamp_t max_timestamp = std::numeric_limits<timestamp_t>::max();
+    static constexpr int slot_bits = 6;
+    static constexpr int slots_per_level = 1 << slot_bits;
+    static constexpr int n_levels = 5;
+    static constexpr int wheel_bits = slot_bits * n_levels;
+
+    std::array<std::array<timer_list_t, slots_per_level>, n_levels> _slots;
+    std::array<std::bitset<slots_per_level>, n_levels> _non_empty;
+    // timers with timeout <= _last; expired wholesale on every expire()
+    timer_list_t _past;
+    // timers beyond the wheel's horizon; cascaded into the wheel when
+    // the current tick crosses a horizon boundary
+    timer_list_t _overflow;
+    timestamp_t _last;
+    timestamp_t _next;
+    // As in timer_set: wakeups are aligned to multiples of _slack so
+    // nearby timers share one wakeup; zero preserves exact wakeups.
+    timestamp_t _slack = 0;
+private:
+    static timestamp_t get_timestamp(time_point _time_point)
+    {
+        return _time_point.time_since_epoch().count();
+    }
+
+    static timestamp_t get_timestamp(Timer& timer)
+    {
+        return get_timestamp(timer.get_timeout());
+    }
+
+    static timestamp_t get_tick(timestamp_t timestamp)
+    {
+        return timestamp >> ResolutionBits;
+    }
+
+    // The level whose slots are fine enough to distinguish tick from
+    // the current tick; both ticks must share their slot's parent, so
+    // a slot is never entered by the current time while still
+    // accepting inserts.
+    static int get_level(timestamp_t tick, timestamp_t current)
+    {
+        auto diff = tick ^ current;
+        int msb = std::numeric_limits<timestamp_t>::digits - 1
+                - bitsets::count_leading_zeros(diff);
+        return msb / slot_bits;
+    }
+
+    static int get_slot(timestamp_t tick, int level)
+    {
+        return (tick >> (slot_bits * level)) & (slots_per_level - 1);
+    }
+
+    // Locates the list currently holding a timer with this timestamp.
+    // Stable as _last advances: a timer's level can only change by
+    // cascading, which reinserts it.
+    timer_list_t& get_list(timestamp_t timestamp, int& level, int& slot)
+    {
+        level = -1;
+        slot = -1;
+        if (timestamp <= _last) {
+            return _past;
+        }
+        auto tick = get_tick(timestamp);
+        auto current = get_tick(_last);
+        if (tick == current) {
+            level = 0;
+        } else {
+            level = get_level(tick, current);
+        }
+        if (level >= n_levels) {
+            level = -1;
+            return _overflow;
+        }
+        slot = get_slot(tick, level);
+        return _slots[level][slot];
+    }
+
+    timestamp_t align_up_to_slack(timestamp_t timestamp) const
+    {
+        if (!_slack) {
+            return timestamp;
+        }
+        return timestamp + (_slack - timestamp % _slack) % _slack;
+    }
+
+    // Drains a slot through a private list and re-dispatches each
+    // timer: due ones to exp, the rest back into the wheel (at a finer
+    // level, or the same slot for sub-tick residue).  Draining first
+    // keeps the loop from chasing its own reinsertions.
+    void cascade(timer_list_t& list, timer_list_t& exp, time_point now)
+    {
+        timer_list_t work;
+        work.splice(work.end(), list);
+        while (!work.empty()) {
+            auto& timer = *work.begin();
+            work.pop_front();
+            if (timer.get_timeout() <= now) {
+                exp.push_back(timer);
+            } else {
+                insert(timer);
+            }
+        }
+    }
+
+    void recalculate_next()
+    {
+        auto current = get_tick(_last);
+        for (int level = 0; level < n_levels; level++) {
+            if (_non_empty[level].none()) {
+                continue;
+            }
+            auto slot = bitsets::get_first_set(_non_empty[level]);
+            if (level == 0) {
+                // exact: the earliest slot's timers bound every
+                // higher level, so take their earliest timeout
+                for (auto& timer : _slots[0][slot]) {
+                    _next = std::min(_next, align_up_to_slack(get_timestamp(timer)));
+                }
+            } else {
+                // wake at the slot boundary to cascade
+                auto span = timestamp_t(1) << (slot_bits * level);
+                auto base = (current >> (slot_bits * (level + 1))) << (slot_bits * (level + 1));
+                auto tick = base + timestamp_t(slot) * span;
+                _next = std::min(_next, tick << ResolutionBits);
+            }
+            return;
+        }
+        if (!_overflow.empty()) {
+            // wake at the horizon boundary to feed the wheel
+            auto tick = ((current >> wheel_bits) + 1) << wheel_bits;
+            _next = std::min(_next, tick << ResolutionBits);
+        }
+    }
+public:
+    timer_wheel()
+        : _last(0)
+        , _next(max_timestamp)
+    {
+    }
+
+    ~timer_wheel() {
+        clear_list(_past);
+        clear_list(_overflow);
+        for (auto&& level : _slots) {
+            for (auto&& list : level) {
+                clear_list(list);
+            }
+        }
+    }
+
+    /**
+     * Adds timer to the active set; see timer_set::insert().
+     *
+     * Returns true if and only if this timer's timeout is less than
+     * get_next_timeout(), in which case the caller should reschedule
+     * expire() to be called at timer.get_timeout().
+     */
+    bool insert(Timer& timer)
+    {
+        auto timestamp = get_timestamp(timer);
+        int level, slot;
+        auto& list = get_list(timestamp, level, slot);
+        list.push_back(timer);
+        if (slot >= 0) {
+            _non_empty[level][slot] = true;
+        }
+        auto aligned = align_up_to_slack(timestamp);
+        if (aligned < _next) {
+            _next = aligned;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Removes timer from the active set; see timer_set::remove().
+     */
+    void remove(Timer& timer)
+    {
+        auto timestamp = get_timestamp(timer);
+        int level, slot;
+        auto& list = get_list(timestamp, level, slot);
+        list.erase(list.iterator_to(timer));
+        if (slot >= 0 && list.empty()) {
+            _non_empty[level][slot] = false;
+        }
+    }
+
+    /**
+     * Expires active timers; see timer_set::expire().
+     *
+     * Advances the wheel to now, splicing out whole slots that lie
+     * entirely in the past and cascading the slot the current time
+     * lands in at each level.
+     */
+    timer_list_t expire(time_point now)
+    {
+        timer_list_t exp;
+        auto timestamp = get_timestamp(now);
+
+        if (timestamp < _last) {
+            abort();
+        }
+
+        auto prev = get_tick(_last);
+        auto current = get_tick(timestamp);
+        _last = timestamp;
+        _next = max_timestamp;
+
+        exp.splice(exp.end(), _past);
+
+        for (int level = 0; level < n_levels; level++) {
+            auto p = prev >> (slot_bits * level);
+            auto c = current >> (slot_bits * level);
+            if (p == c && level > 0) {
+                // no boundary crossed here, hence none above either
+                break;
+            }
+            if ((p >> slot_bits) != (c >> slot_bits)) {
+                // crossed this level's parent slot: everything here
+                // was placed under the old parent and is due
+                for (int i : bitsets::for_each_set(_non_empty[level])) {
+                    exp.splice(exp.end(), _slots[level][i]);
+                }
+                _non_empty[level] = 0;
+                continue;
+            }
+            // slots strictly before the current one are wholly due; a
+            // level-0 slot is one tick, so the previous tick's slot
+            // counts too, while at higher levels the previous boundary
+            // slot was already emptied by cascading
+            auto first = int(p & (slots_per_level - 1)) + (level > 0);
+            auto last = int(c & (slots_per_level - 1));
+            for (int i : bitsets::for_each_set(_non_empty[level], first)) {
+                if (i >= last) {
+                    break;
+                }
+                exp.splice(exp.end(), _slots[level][i]);
+                _non_empty[level][i] = false;
+            }
+            // the slot the current time lands in may hold a mix of due
+            // and future timers; re-dispatch them
+            if (_non_empty[level][last]) {
+                _non_empty[level][last] = false;
+                cascade(_slots[level][last], exp, now);
+            }
+        }
+
+        if ((prev >> wheel_bits) != (current >> wheel_bits) && !_overflow.empty()) {
+            cascade(_overflow, exp, now);
+        }
+
+        if (_next == max_timestamp) {
+            recalculate_next();
+        }
+        return exp;
+    }
+
+    /**
+     * Returns a time point at which expire() should be called; see
+     * timer_set::get_next_timeout().  May precede the earliest
+     * timeout by up to one coarse slot, when the wheel needs to wake
+     * just to cascade.
+     */
+    time_point get_next_timeout() const
+    {
+        return time_point(duration(std::max(_last, _next)));
+    }
+
+    /**
+     * Sets the timer coalescing slack; see timer_set::set_slack().
+     * May be called only while the set is empty.
+     */
+    void set_slack(duration slack)
+    {
+        _slack = slack.count();
+    }
+
+    /**
+     * Clears both active and expired timer sets.
+     */
+    void clear()
+    {
+        _past.clear();
+        _overflow.clear();
+        for (int level = 0; level < n_levels; level++) {
+            for (int i : bitsets::for_each_set(_non_empty[level])) {
+                _slots[level][i].clear();
+            }
+            _non_empty[level] = 0;
+        }
+    }
+
+    size_t size() const
+    {
+        size_t res = _past.size() + _overflow.size();
+        for (int level = 0; level < n_levels; level++) {
+            for (int i : bitsets::for_each_set(_non_empty[level])) {
+                res += _slots[level][i].size();
+            }
+        }
+        return res;
+    }
+
+    /**
+     * Returns true if and only if there are no timers in the active set.
+     */
+    bool empty() const
+    {
+        if (!_past.empty() || !_overflow.empty()) {
+            return false;
+        }
+        for (auto&& bits : _non_empty) {
+            if (bits.any()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    time_point now() {
+        return Timer::clock::now();
+    }
+private:
+    static void clear_list(timer_list_t& list) {
+        while (!list.empty()) {
+            auto& timer = *list.begin();
+            timer.cancel();
+        }
+    }
+};
+};
+
+#endif
@@ -26,9 +26,26 @@
 #include <atomic>
 #include "future.hh"
 #include "timer-set.hh"
+#include "timer-wheel.hh"
 
 using steady_clock_type = std::chrono::steady_clock;
 
+namespace seastar {
+
+// The structure holding armed timers.  timer_set is the default;
+// building with -DSEASTAR_TIMER_WHEEL selects the hierarchical timer
+// wheel instead, which keeps insert/cancel O(1) at very large timer
+// counts (see timer-wheel.hh).  Both expose the same interface.
+#ifdef SEASTAR_TIMER_WHEEL
+template <typename Timer, bi::list_member_hook<> Timer::*link>
+using timer_backing_set = timer_wheel<Timer, link>;
+#else
+template <typename Timer, bi::list_member_hook<> Timer::*link>
+using timer_backing_set = timer_set<Timer, link>;
+#endif
+
+}
+
 template <typename Clock = steady_clock_type>
 class timer {
 public:
@@ -67,5 +84,6 @@ public:
     time_point get_timeout();
     friend class reactor;
     friend class seastar::timer_set<timer, &timer::_link>;
+    friend class seastar::timer_wheel<timer, &timer::_link>;
 };
 
@@ -0,0 +1,66 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "tracing.hh"
+#include <random>
+
+namespace tracing {
+
+thread_local trace_context g_current;
+
+}
+
+constexpr size_t tracer::ring_capacity;
+constexpr unsigned tracer::sample_rate;
+
+tracer::tracer() {
+    // ids only need to be unique with high probability, across shards
+    // and across nodes; a random per-thread starting point plus a
+    // counter gives that without any coordination
+    std::random_device rd;
+    _next_id = (uint64_t(rd()) << 32) | rd();
+    _next_id |= 1;   // id 0 means "not traced"
+}
+
+tracer&
+tracer::local() {
+    static thread_local tracer instance;
+    return instance;
+}
+
+trace_context
+tracer::new_trace() {
+    if (--_sample_countdown != 0) {
+        return {};
+    }
+    _sample_countdown = sample_rate;
+    auto id = next_id();
+    return {id, id};
+}
+
+void
+tracer::record(span_record r) {
+    if (_ring.size() >= ring_capacity) {
+        ++_dropped;
+        return;
+    }
+    _ring.push_back(std::move(r));
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "circular_buffer.hh"
+#include <chrono>
+#include <cstdint>
+
+/// \brief Ambient trace context, propagated along continuation chains.
+///
+/// A trace context identifies one sampled request (\c trace_id) and the
+/// unit of work currently executing on its behalf (\c span_id).  The
+/// context is ambient: a thread-local holds the context of whatever is
+/// running right now, the reactor stamps it onto every task when the
+/// task becomes runnable and restores it before running the task, and
+/// smp::submit_to() and the rpc layer carry it across shard and node
+/// boundaries.  Code in the middle of a call chain needs no plumbing at
+/// all, which is the point - a trace must survive layers that never
+/// heard of it.
+///
+/// A zero \c trace_id means "not traced"; that is the overwhelmingly
+/// common case, and everything here degrades to a load and a branch on
+/// it.
+struct trace_context {
+    uint64_t trace_id = 0;   // 0: not part of any trace
+    uint64_t span_id = 0;
+    explicit operator bool() const {
+        return trace_id != 0;
+    }
+};
+
+namespace tracing {
+
+extern thread_local trace_context g_current;
+
+inline trace_context current() {
+    return g_current;
+}
+
+inline void set_current(trace_context c) {
+    g_current = c;
+}
+
+}
+
+/// \brief Per-shard span recorder.
+///
+/// Completed spans of sampled traces go into a fixed-size ring; when
+/// the ring is full new spans are counted as dropped rather than
+/// reallocating or evicting, so tracing cannot become a memory or
+/// latency problem of its own.  Draining the ring (to a log, a wire
+/// protocol, a debugger) is the consumer's business.
+class tracer {
+public:
+    struct span_record {
+        uint64_t trace_id;
+        uint64_t span_id;
+        uint64_t parent_id;   // 0 for a root span
+        const char* name;     // must point to a string literal
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::duration duration;
+    };
+    static constexpr size_t ring_capacity = 4096;
+    static constexpr unsigned sample_rate = 1024;   // 1 in N new_trace() calls
+private:
+    circular_buffer<span_record> _ring;
+    uint64_t _dropped = 0;
+    uint64_t _next_id;   // randomly seeded per thread, see tracer()
+    unsigned _sample_countdown = 1;
+public:
+    tracer();
+    static tracer& local();
+    /// Starts a new trace one time in \ref sample_rate; the other calls
+    /// return an inactive context.  Call this where requests enter the
+    /// system and make the result current; propagation does the rest.
+    trace_context new_trace();
+    uint64_t next_id() {
+        return _next_id++;
+    }
+    void record(span_record r);
+    circular_buffer<span_record>& spans() {
+        return _ring;
+    }
+    void clear() {
+        while (!_ring.empty()) {
+            _ring.pop_front();
+        }
+        _dropped = 0;
+    }
+    uint64_t dropped() const {
+        return _dropped;
+    }
+};
+
+/// Scopes a named child span of the current trace.  When nothing is
+/// being traced - the normal case - construction and destruction are a
+/// thread-local load and a branch each.
+class trace_span {
+    trace_context _prev;
+    std::chrono::steady_clock::time_point _start;
+    const char* _name;
+public:
+    explicit trace_span(const char* name)
+            : _prev(tracing::current()), _name(name) {
+        if (!_prev) {
+            return;
+        }
+        tracing::set_current({_prev.trace_id, tracer::local().next_id()});
+        _start = std::chrono::steady_clock::now();
+    }
+    ~trace_span() {
+        if (!_prev) {
+            return;
+        }
+        auto cur = tracing::current();
+        tracer::local().record({cur.trace_id, cur.span_id, _prev.span_id, _name,
+                _start, std::chrono::steady_clock::now() - _start});
+        tracing::set_current(_prev);
+    }
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+};
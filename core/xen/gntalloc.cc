@@ -125,6 +125,11 @@ class kernel_gntalloc;
 
 class kernel_grant_head : public grant_head {
     uint32_t _head;
+    // Grants handed out from this head all target the same backend domain,
+    // so a returned ref stays valid as-is: instead of ending foreign access
+    // and freeing the frame on every completion we park the still-granted
+    // ref here and hand it out again.
+    std::vector<gntref> _pool;
 public:
     kernel_grant_head(uint32_t head) : _head(head) {}
     virtual gntref new_ref() override;
@@ -155,6 +160,12 @@ virt_to_mfn(void *virt) {
 }
 
 gntref kernel_grant_head::new_ref() {
+    if (!_pool.empty()) {
+        auto r = _pool.back();
+        _pool.pop_back();
+        return r;
+    }
+
     auto gnt = dynamic_cast<kernel_gntalloc *>(gntalloc::instance());
 
     auto ref = gnttab_claim_grant_reference(&_head);
@@ -164,6 +175,12 @@ gntref kernel_grant_head::new_ref() {
 }
 
 gntref kernel_grant_head::new_ref(void *addr, size_t size) {
+    if (!_pool.empty()) {
+        auto r = _pool.back();
+        _pool.pop_back();
+        memcpy(r.page, addr, size);
+        return r;
+    }
 
     auto gnt = dynamic_cast<kernel_gntalloc *>(gntalloc::instance());
 
@@ -207,9 +224,9 @@ grant_head *kernel_gntalloc::alloc_ref(unsigned nr_ents) {
 }
 
 void kernel_grant_head::free_ref(gntref& ref) {
-    gnttab_end_foreign_access_ref(ref.xen_id);
-    gnttab_release_grant_reference(&_head, ref.xen_id);
-    free(ref.page);
+    // Keep the grant active and the frame mapped; steady-state traffic
+    // then needs no grant table operations at all.
+    _pool.push_back(ref);
     ref = invalid_ref;
 }
 #endif
@@ -0,0 +1,125 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "handlers.hh"
+#include "core/future-util.hh"
+#include <cstdlib>
+#include <unordered_map>
+
+namespace httpd {
+
+/**
+ * Synthetic handlers for benchmarking the http server itself: they do
+ * no work beyond producing a response, so what a load driver (see
+ * apps/seawreck) measures against them is the parser, the routing and
+ * the output path, not handler cost.
+ */
+
+/**
+ * Replies with a precomputed body of "size" bytes (default 1024).
+ * Bodies are cached per size, so repeated requests cost one map lookup
+ * and an sstring copy.
+ */
+class fixed_reply_handler : public handler_base {
+    std::unordered_map<size_t, sstring> _payloads;
+    const sstring& payload(size_t size) {
+        auto it = _payloads.find(size);
+        if (it == _payloads.end()) {
+            it = _payloads.emplace(size, sstring(size, 'x')).first;
+        }
+        return it->second;
+    }
+public:
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        size_t size = 1024;
+        auto size_param = req->get_query_param("size");
+        if (size_param != "") {
+            size = std::strtoul(size_param.c_str(), nullptr, 10);
+        }
+        rep->_content = payload(size);
+        rep->done("txt");
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    }
+};
+
+/**
+ * Streams a body of "size" bytes (default 1MB) in "chunk"-byte writes
+ * (default 4096) through reply::write_body(), exercising the chunked
+ * output path instead of a materialized content string.
+ */
+class streamed_reply_handler : public handler_base {
+    std::unordered_map<size_t, sstring> _chunks;
+    const sstring& chunk(size_t size) {
+        auto it = _chunks.find(size);
+        if (it == _chunks.end()) {
+            it = _chunks.emplace(size, sstring(size, 'x')).first;
+        }
+        return it->second;
+    }
+public:
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        size_t size = 1024 * 1024;
+        size_t chunk_size = 4096;
+        auto size_param = req->get_query_param("size");
+        if (size_param != "") {
+            size = std::strtoul(size_param.c_str(), nullptr, 10);
+        }
+        auto chunk_param = req->get_query_param("chunk");
+        if (chunk_param != "") {
+            chunk_size = std::max(1ul, std::strtoul(chunk_param.c_str(), nullptr, 10));
+        }
+        auto& body_chunk = chunk(chunk_size);
+        auto nr_chunks = (size + chunk_size - 1) / chunk_size;
+        rep->write_body("txt", [&body_chunk, nr_chunks] (output_stream<char>& out) {
+            return do_with(uint64_t(0), [&body_chunk, nr_chunks, &out] (uint64_t& i) {
+                return repeat([&body_chunk, nr_chunks, &out, &i] {
+                    if (i++ == nr_chunks) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    return out.write(body_chunk).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            });
+        });
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    }
+};
+
+/**
+ * Replies with a small static JSON document, standing in for a typical
+ * API response without any serialization work.
+ */
+class json_reply_handler : public handler_base {
+public:
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        rep->_content = "{\"status\":\"ok\",\"value\":42,\"items\":[1,2,3]}";
+        rep->done("json");
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    }
+};
+
+}
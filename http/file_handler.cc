@@ -93,10 +93,77 @@ public:
     }
 };
 
+// Open file handles for the streaming path, revalidated on every hit
+// by comparing size and mtime against a fresh fstat, so an asset
+// modified in place is picked up while the open() cost is paid only
+// once per file.  Bounded crudely: static asset sets are small, and a
+// stale entry costs only a reopen.
+struct cached_file {
+    file f;
+    uint64_t size;
+    struct timespec mtime;
+};
+static thread_local std::unordered_map<sstring, cached_file> open_file_cache;
+static constexpr size_t open_file_cache_max_size = 256;
+
+static future<file> get_cached_file(sstring file_name) {
+    auto it = open_file_cache.find(file_name);
+    if (it != open_file_cache.end()) {
+        auto f = it->second.f;
+        return f.stat().then([file_name, f](struct stat st) mutable {
+            auto it = open_file_cache.find(file_name);
+            if (it != open_file_cache.end()
+                    && it->second.size == uint64_t(st.st_size)
+                    && it->second.mtime.tv_sec == st.st_mtim.tv_sec
+                    && it->second.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+                return make_ready_future<file>(std::move(f));
+            }
+            open_file_cache.erase(file_name);
+            return get_cached_file(std::move(file_name));
+        });
+    }
+    return open_file_dma(file_name, open_flags::ro).then([file_name](file f) {
+        return f.stat().then([file_name, f](struct stat st) mutable {
+            if (open_file_cache.size() >= open_file_cache_max_size) {
+                open_file_cache.clear();
+            }
+            open_file_cache[file_name] = {f, uint64_t(st.st_size), st.st_mtim};
+            return make_ready_future<file>(std::move(f));
+        });
+    });
+}
+
 future<std::unique_ptr<reply>> file_interaction_handler::read(
         const sstring& file_name, std::unique_ptr<request> req,
         std::unique_ptr<reply> rep) {
     sstring extension = get_extension(file_name);
+    if (transformer == nullptr) {
+        // sendfile-style path: stream the file straight into the
+        // connection's output stream, buffer by buffer with read-ahead,
+        // without ever materializing the body in reply::_content
+        rep->write_body(extension, [file_name](output_stream<char>& out) {
+            return get_cached_file(file_name).then([&out](file f) {
+                file_input_stream_options options;
+                options.read_ahead = 4;
+                return do_with(make_file_input_stream(std::move(f), options), false,
+                        [&out](input_stream<char>& is, bool& eof) {
+                    return do_until([&eof] { return eof; }, [&is, &out, &eof] {
+                        return is.read().then([&out, &eof](temporary_buffer<char> data) {
+                            if (data.empty()) {
+                                eof = true;
+                                return make_ready_future<>();
+                            }
+                            // adopted by the stream, not copied
+                            return out.write(std::move(data));
+                        });
+                    }).finally([&is] {
+                        return is.close();
+                    });
+                });
+            });
+        });
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    }
     rep->set_content_type(extension);
     return open_file_dma(file_name, open_flags::ro).then(
             [rep = std::move(rep), extension, this, req = std::move(req)](file f) mutable {
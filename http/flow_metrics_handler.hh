@@ -0,0 +1,59 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "handlers.hh"
+#include "net/flow_metrics.hh"
+#include <cstdlib>
+
+namespace httpd {
+
+/**
+ * Serves the per-connection flow counters (see net::flow_metrics) as
+ * plain text, heaviest flows first across all shards.
+ *
+ * Query parameters: "k" limits the flows reported per shard (default
+ * 10); a non-empty "reset" clears the counters after dumping, so
+ * polling with reset=1 yields per-interval rates.
+ *
+ * Returns nothing unless the server runs with --net-flow-metrics.
+ */
+class flow_metrics_handler : public handler_base {
+public:
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        unsigned k = 10;
+        auto k_param = req->get_query_param("k");
+        if (k_param != "") {
+            k = std::max(1ul, std::strtoul(k_param.c_str(), nullptr, 10));
+        }
+        bool reset = req->get_query_param("reset") != "";
+        return net::flow_metrics::dump_all(k, reset).then(
+                [rep = std::move(rep)] (sstring dump) mutable {
+            rep->_content = std::move(dump);
+            rep->done("txt");
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        });
+    }
+};
+
+}
@@ -44,6 +44,7 @@
 #include <boost/intrusive/list.hpp>
 #include "reply.hh"
 #include "http/routes.hh"
+#include "http/websocket.hh"
 
 namespace httpd {
 
@@ -58,6 +59,45 @@ public:
     http_stats(http_server& server);
 };
 
+// Wraps the connection's output stream in HTTP/1.1 chunked transfer
+// framing: every buffer the body writer flushes becomes one chunk.
+// The final zero-length chunk is written by the connection once the
+// writer is done.
+class http_chunked_data_sink_impl : public data_sink_impl {
+    output_stream<char>& _out;
+public:
+    explicit http_chunked_data_sink_impl(output_stream<char>& out) : _out(out) {}
+    virtual future<> put(net::packet data) override {
+        if (!data.len()) {
+            return make_ready_future<>();
+        }
+        char header[16];
+        auto n = snprintf(header, sizeof(header), "%zx\r\n", data.len());
+        return _out.write(header, n).then([this, data = std::move(data)] () mutable {
+            return _out.write(std::move(data));
+        }).then([this] {
+            return _out.write("\r\n", 2);
+        });
+    }
+    virtual future<> close() override {
+        return make_ready_future<>();
+    }
+};
+
+// As above, but without framing, for clients that predate chunked
+// encoding; the body is then delimited by closing the connection.
+class http_raw_data_sink_impl : public data_sink_impl {
+    output_stream<char>& _out;
+public:
+    explicit http_raw_data_sink_impl(output_stream<char>& out) : _out(out) {}
+    virtual future<> put(net::packet data) override {
+        return _out.write(std::move(data));
+    }
+    virtual future<> close() override {
+        return make_ready_future<>();
+    }
+};
+
 class http_server {
     std::vector<server_socket> _listeners;
     http_stats _stats { *this };
@@ -66,11 +106,23 @@ class http_server {
     uint64_t _requests_served = 0;
     uint64_t _connections_being_accepted = 0;
     sstring _date = http_date();
-    timer<> _date_format_timer { [this] {_date = http_date();} };
+    // "Server: ...\r\nDate: ...\r\n", rebuilt together with the date
+    // once per second, so every response copies one precomputed block
+    // instead of formatting these headers again
+    sstring _common_headers = make_common_headers();
+    timer<> _date_format_timer { [this] {
+        _date = http_date();
+        _common_headers = make_common_headers();
+    } };
     bool _stopping = false;
+    // benchmark aid: print one line per connection when it ends
+    bool _log_connection_stats = false;
     promise<> _all_connections_stopped;
     future<> _stopped = _all_connections_stopped.get_future();
 private:
+    sstring make_common_headers() const {
+        return "Server: Seastar httpd\r\nDate: " + _date + "\r\n";
+    }
     void maybe_idle() {
         if (_stopping && !_connections_being_accepted && !_current_connections) {
             _all_connections_stopped.set_value();
@@ -109,9 +161,9 @@ public:
                         return;
                     }
                     auto cs_sa = f_cs_sa.get();
-                    auto conn = new connection(*this, std::get<0>(std::move(cs_sa)), std::get<1>(std::move(cs_sa)));
+                    auto conn = get_connection(std::get<0>(std::move(cs_sa)), std::get<1>(std::move(cs_sa)));
                     conn->process().then_wrapped([this, conn] (auto&& f) {
-                                delete conn;
+                                recycle_connection(conn);
                                 try {
                                     f.get();
                                 } catch (std::exception& ex) {
@@ -137,8 +189,30 @@ public:
         http_request_parser _parser;
         std::unique_ptr<request> _req;
         std::unique_ptr<reply> _resp;
-        // null element marks eof
-        queue<std::unique_ptr<reply>> _replies { 10 };bool _done = false;
+        // Responses in request order; each element resolves when its
+        // handler finishes, so the read loop can parse ahead of slow
+        // handlers up to the queue bound.  A null reply marks eof.
+        queue<future<std::unique_ptr<reply>>> _replies { 10 };
+        bool _done = false;
+        // set after streaming a close-delimited body: nothing more may
+        // be written, or the client could not tell it from the body
+        bool _close_delimited = false;
+        // reusable header serialization buffer; it keeps its capacity
+        // across responses, so a typical response serializes into it
+        // without allocating
+        std::vector<char> _header_buf;
+        // set while the connection sits in the server's free list, so
+        // the destructor does not unregister it a second time
+        bool _retired = false;
+        // set when an upgrade request reached a websocket route; the
+        // http loops then wind down without closing the streams and
+        // process() runs the websocket session over them
+        websocket_handler* _upgrade = nullptr;
+        std::unique_ptr<request> _upgrade_req;
+        // per-connection stats, reported on retire when the server
+        // runs with connection stats logging enabled
+        uint64_t _conn_requests = 0;
+        lowres_clock::time_point _conn_started;
     public:
         connection(http_server& server, connected_socket&& fd,
                 socket_address addr)
@@ -146,12 +220,57 @@ public:
                         _fd.output()) {
             ++_server._total_connections;
             ++_server._current_connections;
+            _conn_started = lowres_clock::now();
             _server._connections.push_back(*this);
         }
         ~connection() {
+            if (!_retired) {
+                retire();
+            }
+        }
+        // Detaches the connection from the server and releases the
+        // socket, undoing what the constructor did, so the object can
+        // wait in the server's free list for the next accept.
+        void retire() {
+            if (_server._log_connection_stats && _conn_requests) {
+                auto secs = std::chrono::duration_cast<std::chrono::duration<double>>(
+                        lowres_clock::now() - _conn_started).count();
+                print("httpd: shard %2d connection served %d requests in %.3f s\n",
+                        engine().cpu_id(), _conn_requests, secs);
+            }
             --_server._current_connections;
             _server._connections.erase(_server._connections.iterator_to(*this));
             _server.maybe_idle();
+            _read_buf = input_stream<char>();
+            _write_buf = output_stream<char>();
+            _fd = connected_socket();
+            _retired = true;
+        }
+        // Rearms a retired connection with a freshly accepted socket.
+        // All per-connection state is reset, but buffers that grew to
+        // their working size (notably _header_buf) keep their
+        // allocations, which is the point of pooling.
+        void reuse(connected_socket&& fd, socket_address addr) {
+            _fd = std::move(fd);
+            _read_buf = _fd.input();
+            _write_buf = _fd.output();
+            // the respond loop stops at the first failed reply, which
+            // may leave entries behind it in the queue
+            while (!_replies.empty()) {
+                _replies.pop();
+            }
+            _done = false;
+            _close_delimited = false;
+            _upgrade = nullptr;
+            _upgrade_req.reset();
+            _req.reset();
+            _resp.reset();
+            _conn_requests = 0;
+            _conn_started = lowres_clock::now();
+            ++_server._total_connections;
+            ++_server._current_connections;
+            _server._connections.push_back(*this);
+            _retired = false;
         }
         future<> process() {
             // Launch read and write "threads" simultaneously:
@@ -159,6 +278,14 @@ public:
                     [] (std::tuple<future<>, future<>> joined) {
                         // FIXME: notify any exceptions in joined?
                         return make_ready_future<>();
+                    }).then([this] {
+                        if (_upgrade) {
+                            // both http loops are done and all queued
+                            // replies went out, so the 101 is next on
+                            // the wire
+                            return websocket_session();
+                        }
+                        return make_ready_future<>();
                     });
         }
         void shutdown() {
@@ -171,8 +298,12 @@ public:
             }).then_wrapped([this] (future<> f) {
                 // swallow error
                 // FIXME: count it?
-                    return _replies.push_eventually( {});
+                    return _replies.push_eventually(make_ready_future<std::unique_ptr<reply>>(std::unique_ptr<reply>()));
             }).finally([this] {
+                if (_upgrade) {
+                    // the websocket session keeps reading
+                    return make_ready_future<>();
+                }
                 return _read_buf.close();
             });
         }
@@ -184,44 +315,76 @@ public:
                     return make_ready_future<>();
                 }
                 ++_server._requests_served;
+                ++_conn_requests;
                 std::unique_ptr<httpd::request> req = _parser.get_parsed_request();
 
+                if (websocket::is_upgrade_request(*req)) {
+                    sstring url = set_query_param(*req.get());
+                    auto h = dynamic_cast<websocket_handler*>(
+                            _server._routes.get_handler(str2type(req->_method),
+                                    _server._routes.normalize_url(url),
+                                    req->param));
+                    if (h != nullptr) {
+                        _upgrade = h;
+                        _upgrade_req = std::move(req);
+                        _done = true;
+                        return make_ready_future<>();
+                    }
+                    // no websocket route there; the normal dispatch
+                    // answers the request (likely with a 404)
+                }
+
+                // pipelining: start the handler and go back to reading
+                // right away; the reply queue keeps the responses in
+                // request order and its bound limits how far we parse
+                // ahead of slow handlers
                 return _replies.not_full().then([req = std::move(req), this] () mutable {
-                    return generate_reply(std::move(req));
-                }).then([this](bool done) {
-                    _done = done;
+                    _done = generate_reply(std::move(req));
                 });
             });
         }
         future<> respond() {
             return do_response_loop().finally([this] {
+                if (_upgrade) {
+                    // the websocket session keeps writing
+                    return make_ready_future<>();
+                }
                 return _write_buf.close();
             });
         }
         future<> do_response_loop() {
             return _replies.pop_eventually().then(
-                    [this] (std::unique_ptr<reply> resp) {
-                        if (!resp) {
-                            // eof
-                            return make_ready_future<>();
-                        }
-                        _resp = std::move(resp);
-                        return start_response().then([this] {
-                                    return do_response_loop();
-                                });
+                    [this] (future<std::unique_ptr<reply>> pending) {
+                        return pending.then_wrapped([this] (future<std::unique_ptr<reply>> f) {
+                            if (f.failed()) {
+                                // the handler failed in a way routes could
+                                // not turn into an error reply; drop the
+                                // connection
+                                f.ignore_ready_future();
+                                return make_ready_future<>();
+                            }
+                            auto resp = f.get0();
+                            if (!resp) {
+                                // eof
+                                return make_ready_future<>();
+                            }
+                            if (_close_delimited) {
+                                // a close-delimited body went out; keep
+                                // draining the queue so the read side is
+                                // not blocked on it, but write nothing
+                                return do_response_loop();
+                            }
+                            _resp = std::move(resp);
+                            return start_response().then([this] {
+                                        return do_response_loop();
+                                    });
+                        });
                     });
         }
         future<> start_response() {
-            _resp->_headers["Server"] = "Seastar httpd";
-            _resp->_headers["Date"] = _server._date;
-            _resp->_headers["Content-Length"] = to_sstring(
-                    _resp->_content.size());
-            return _write_buf.write(_resp->_response_line.begin(),
-                    _resp->_response_line.size()).then([this] {
-                return write_reply_headers(_resp->_headers.begin());
-            }).then([this] {
-                return _write_buf.write("\r\n", 2);
-            }).then([this] {
+            serialize_headers();
+            return _write_buf.write(_header_buf.data(),
+                    _header_buf.size()).then([this] {
                 return write_body();
             }).then([this] {
                 return _write_buf.flush();
@@ -229,21 +392,43 @@ public:
                 _resp.reset();
             });
         }
-        future<> write_reply_headers(
-                std::unordered_map<sstring, sstring>::iterator hi) {
-            if (hi == _resp->_headers.end()) {
-                return make_ready_future<>();
+        // serializes the status line and all headers into _header_buf,
+        // so the whole head goes out in one write and, on the common
+        // path, without a single allocation
+        void serialize_headers() {
+            auto& buf = _header_buf;
+            buf.clear();
+            auto append = [&buf] (const char* s, size_t n) {
+                buf.insert(buf.end(), s, s + n);
+            };
+            auto append_str = [&append] (const sstring& s) {
+                append(s.begin(), s.size());
+            };
+            append("HTTP/", 5);
+            append_str(_resp->_version);
+            append_str(reply::status_string(_resp->_status));
+            append_str(_server._common_headers);
+            for (auto& h : _resp->_headers) {
+                if (h.first == "Server" || h.first == "Date") {
+                    // already in the precomputed block
+                    continue;
+                }
+                append_str(h.first);
+                append(": ", 2);
+                append_str(h.second);
+                append("\r\n", 2);
             }
-            return _write_buf.write(hi->first.begin(), hi->first.size()).then(
-                    [this] {
-                        return _write_buf.write(": ", 2);
-                    }).then([hi, this] {
-                return _write_buf.write(hi->second.begin(), hi->second.size());
-            }).then([this] {
-                return _write_buf.write("\r\n", 2);
-            }).then([hi, this] () mutable {
-                return write_reply_headers(++hi);
-            });
+            if (!_resp->_body_writer) {
+                char content_length[48];
+                auto n = snprintf(content_length, sizeof(content_length),
+                        "Content-Length: %zu\r\n", _resp->_content.size());
+                append(content_length, n);
+            } else if (_resp->_version == "1.1") {
+                append("Transfer-Encoding: chunked\r\n", 28);
+            }
+            // else: a streamed body to a pre-1.1 client is delimited by
+            // connection close
+            append("\r\n", 2);
         }
 
         static short hex_to_byte(char c) {
@@ -330,7 +515,9 @@ public:
             return req._url.substr(0, pos);
         }
 
-        future<bool> generate_reply(std::unique_ptr<request> req) {
+        // dispatches the handler and queues the eventual reply; returns
+        // whether this request asked for the connection to be closed
+        bool generate_reply(std::unique_ptr<request> req) {
             auto resp = std::make_unique<reply>();
             bool conn_keep_alive = false;
             bool conn_close = false;
@@ -359,18 +546,78 @@ public:
             }
             sstring url = set_query_param(*req.get());
             sstring version = req->_version;
-            return _server._routes.handle(url, std::move(req), std::move(resp)).
             // Caller guarantees enough room
-            then([this, should_close, version = std::move(version)](std::unique_ptr<reply> rep) {
+            this->_replies.push(_server._routes.handle(url, std::move(req), std::move(resp)).
+            then([version = std::move(version)](std::unique_ptr<reply> rep) {
                 rep->set_version(version).done();
-                this->_replies.push(std::move(rep));
-                return make_ready_future<bool>(should_close);
-            });
+                return rep;
+            }));
+            return should_close;
         }
         future<> write_body() {
+            if (_resp->_body_writer) {
+                bool chunked = _resp->_version == "1.1";
+                auto sink = chunked
+                        ? data_sink(std::make_unique<http_chunked_data_sink_impl>(_write_buf))
+                        : data_sink(std::make_unique<http_raw_data_sink_impl>(_write_buf));
+                return do_with(output_stream<char>(std::move(sink), 8192), [this] (output_stream<char>& out) {
+                    return _resp->_body_writer(out).then([&out] {
+                        return out.close();
+                    });
+                }).then([this, chunked] {
+                    if (chunked) {
+                        return _write_buf.write("0\r\n\r\n", 5);
+                    }
+                    // the body ends when the connection does; stop
+                    // reading and responding so nothing follows it
+                    _close_delimited = true;
+                    _fd.shutdown_input();
+                    return make_ready_future<>();
+                });
+            }
             return _write_buf.write(_resp->_content.begin(),
                     _resp->_content.size());
         }
+        // Runs after the http loops wound down on an upgrade request:
+        // completes the handshake and hands the raw streams to the
+        // websocket session, closing them once it is done.
+        future<> websocket_session() {
+            sstring resp = "HTTP/1.1 101 Switching Protocols\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Accept: "
+                    + websocket::handshake_accept(
+                            _upgrade_req->get_header("Sec-WebSocket-Key"))
+                    + "\r\n\r\n";
+            return _write_buf.write(resp.begin(), resp.size()).then([this] {
+                return _write_buf.flush();
+            }).then([this] {
+                return do_with(websocket::connection(_read_buf, _write_buf),
+                        [this] (websocket::connection& ws) {
+                    auto writer = ws.do_writes();
+                    auto session = _upgrade->serve(std::move(_upgrade_req), ws)
+                            .then_wrapped([&ws] (future<> f) {
+                        try {
+                            f.get();
+                        } catch (std::exception& ex) {
+                            std::cerr << "websocket session error " << ex.what()
+                                    << std::endl;
+                        }
+                        // stops the writer once the close frame is out
+                        return ws.close();
+                    });
+                    return when_all(std::move(writer), std::move(session)).then(
+                            [] (std::tuple<future<>, future<>> joined) {
+                        // FIXME: notify any exceptions in joined?
+                        return make_ready_future<>();
+                    });
+                });
+            }).finally([this] {
+                return _read_buf.close();
+            }).finally([this] {
+                return _write_buf.close();
+            });
+        }
     };
     uint64_t total_connections() const {
         return _total_connections;
@@ -381,6 +628,12 @@ public:
     uint64_t requests_served() const {
         return _requests_served;
     }
+    // When enabled, every connection prints its request count and
+    // lifetime as it ends, so a load driver's per-connection numbers
+    // can be checked against the server's view.
+    void set_log_connection_stats(bool enabled) {
+        _log_connection_stats = enabled;
+    }
     static sstring http_date() {
         auto t = ::time(nullptr);
         struct tm tm;
@@ -391,6 +644,30 @@ public:
     }
 private:
     boost::intrusive::list<connection> _connections;
+    // Retired connection objects kept for reuse; with short-lived
+    // connections churning at high rates, reset-and-reuse avoids
+    // paying an allocation and teardown of the connection, its parser
+    // and its buffers on every accept.  Bounded so a burst does not
+    // pin memory forever.
+    static constexpr size_t max_pooled_connections = 512;
+    std::vector<std::unique_ptr<connection>> _free_connections;
+    connection* get_connection(connected_socket&& fd, socket_address addr) {
+        if (!_free_connections.empty()) {
+            auto conn = _free_connections.back().release();
+            _free_connections.pop_back();
+            conn->reuse(std::move(fd), addr);
+            return conn;
+        }
+        return new connection(*this, std::move(fd), addr);
+    }
+    void recycle_connection(connection* conn) {
+        if (_stopping || _free_connections.size() >= max_pooled_connections) {
+            delete conn;
+            return;
+        }
+        conn->retire();
+        _free_connections.emplace_back(conn);
+    }
 };
 
 /*
@@ -0,0 +1,63 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "handlers.hh"
+#include "core/instrumentation.hh"
+
+namespace httpd {
+
+/**
+ * Lists and toggles the runtime instrumentation groups (see
+ * instrumentation::registry) as plain text.
+ *
+ * Without parameters, reports every group's state on every shard.
+ * With "group" and "enabled" (0 or 1), toggles that group on all
+ * shards first, so deep tracing compiled into a production binary can
+ * be switched on over HTTP on one misbehaving node.
+ */
+class instrumentation_handler : public handler_base {
+public:
+    future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        auto group = req->get_query_param("group");
+        auto toggled = make_ready_future<>();
+        if (group != "") {
+            bool enable = req->get_query_param("enabled") == "1";
+            toggled = instrumentation::registry::set_all(group, enable).then(
+                    [group] (bool found) {
+                if (!found) {
+                    throw std::runtime_error(sstring("unknown instrumentation group: ") + group);
+                }
+            });
+        }
+        return toggled.then([] {
+            return instrumentation::registry::list_all();
+        }).then([rep = std::move(rep)] (sstring status) mutable {
+            rep->_content = std::move(status);
+            rep->done("txt");
+            return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+        });
+    }
+};
+
+}
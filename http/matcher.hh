@@ -77,6 +77,21 @@ public:
 
     virtual size_t match(const sstring& url, size_t ind, parameters& param)
             override;
+
+    /**
+     * The parameter name, for compiling the matcher into the routes
+     * radix tree
+     */
+    const sstring& name() const {
+        return _name;
+    }
+
+    /**
+     * true when the parameter consumes the rest of the url
+     */
+    bool entire_path() const {
+        return _entire_path;
+    }
 private:
     sstring _name;
     bool _entire_path;
@@ -100,6 +115,14 @@ public:
 
     virtual size_t match(const sstring& url, size_t ind, parameters& param)
             override;
+
+    /**
+     * The matched string, for compiling the matcher into the routes
+     * radix tree
+     */
+    const sstring& str() const {
+        return _cmp;
+    }
 private:
     sstring _cmp;
     unsigned _len;
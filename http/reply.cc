@@ -95,4 +95,8 @@ sstring reply::response_line() {
     return "HTTP/" + _version + status_strings::to_string(_status);
 }
 
+const sstring& reply::status_string(reply::status_type status) {
+    return status_strings::to_string(status);
+}
+
 } // namespace server
@@ -32,7 +32,9 @@
 #pragma once
 
 #include "core/sstring.hh"
+#include "core/iostream.hh"
 #include <unordered_map>
+#include <functional>
 #include "http/mime_types.hh"
 
 namespace httpd {
@@ -73,7 +75,13 @@ struct reply {
      */
     sstring _content;
 
-    sstring _response_line;
+    /**
+     * A streaming body producer, set with write_body(). When present,
+     * _content is ignored and the connection invokes the writer with an
+     * output stream after sending the headers.
+     */
+    std::function<future<> (output_stream<char>&)> _body_writer;
+
     reply()
             : _status(status_type::ok) {
     }
@@ -118,15 +126,35 @@ struct reply {
     reply& done(const sstring& content_type) {
         return set_content_type(content_type).done();
     }
+
+    /**
+     * Stream the body instead of materializing it in _content.
+     * The writer is called after the headers have been sent and may
+     * emit the body incrementally through the stream; the connection
+     * takes care of the transfer framing (chunked for HTTP/1.1,
+     * delimited by connection close otherwise) and of flushing and
+     * closing the stream, so the writer should only write.
+     */
+    reply& write_body(const sstring& content_type, std::function<future<> (output_stream<char>&)>&& body_writer) {
+        set_content_type(content_type);
+        _body_writer = std::move(body_writer);
+        return *this;
+    }
     /**
      * Done should be called before using the reply.
-     * It would set the response line
+     * The response line itself is serialized directly by the
+     * connection, from the version and status, without going through
+     * an sstring; use response_line() if the full line is needed.
      */
     reply& done() {
-        _response_line = response_line();
         return *this;
     }
     sstring response_line();
+
+    /**
+     * The status line fragment (" 200 OK\r\n") for a status code
+     */
+    static const sstring& status_string(status_type status);
 };
 
 } // namespace httpd
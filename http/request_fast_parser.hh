@@ -0,0 +1,160 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "http/request.hh"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace httpd {
+namespace internal {
+
+// true for HTTP token characters (tchar), the same set the ragel
+// machine in request_parser.rl accepts for header field names
+inline bool is_tchar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '-' || c == '!' || c == '#' || c == '$' || c == '%' || c == '&'
+        || c == '\'' || c == '*' || c == '+' || c == '.' || c == '^' || c == '_'
+        || c == '`' || c == '|' || c == '~';
+}
+
+// returns a pointer to the first occurrence of c in [p, end), or end
+inline const char* scan_for(const char* p, const char* end, char c) {
+#if defined(__SSE2__)
+    auto needle = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p != end && *p != c) {
+        p++;
+    }
+    return p;
+}
+
+// Vectorized fast path for complete, well-formed request heads, in the
+// spirit of picohttpparser: SIMD scans locate the delimiters and scalar
+// code validates the short token runs in between, instead of walking
+// every byte through a state transition.  Fills req exactly like the
+// ragel actions do.  Returns the number of bytes consumed when a full
+// head was parsed, or 0 to make the caller fall back to the ragel
+// machine -- the head is incomplete, uses obs-folded headers, or is
+// otherwise unusual (including invalid; the machine owns error
+// reporting).
+inline size_t parse_http_request_fast(const char* begin, size_t len, request& req) {
+    auto p = begin;
+    auto end = begin + len;
+    // method: one or more upper-case letters, then a single space
+    auto q = scan_for(p, end, ' ');
+    if (q == p || q == end) {
+        return 0;
+    }
+    for (auto s = p; s != q; s++) {
+        if (*s < 'A' || *s > 'Z') {
+            return 0;
+        }
+    }
+    req._method = sstring(p, q - p);
+    p = q + 1;
+    // uri: anything up to the next space; leave uris with bare CR or LF
+    // in them to the machine
+    q = scan_for(p, end, ' ');
+    if (q == p || q == end) {
+        return 0;
+    }
+    if (scan_for(p, q, '\r') != q || scan_for(p, q, '\n') != q) {
+        return 0;
+    }
+    req._url = sstring(p, q - p);
+    p = q + 1;
+    // version: "HTTP/" digit '.' digit, then crlf
+    if (end - p < 10) {
+        return 0;
+    }
+    if (std::memcmp(p, "HTTP/", 5) || p[5] < '0' || p[5] > '9' || p[6] != '.' || p[7] < '0' || p[7] > '9'
+            || p[8] != '\r' || p[9] != '\n') {
+        return 0;
+    }
+    req._version = sstring(p + 5, 3);
+    p += 10;
+    for (;;) {
+        if (end - p < 2) {
+            return 0;
+        }
+        if (p[0] == '\r' && p[1] == '\n') {
+            // empty line: end of the head
+            return p + 2 - begin;
+        }
+        if (*p == ' ' || *p == '\t') {
+            // obs-fold continuation line; rare, and its append
+            // semantics belong to the machine
+            return 0;
+        }
+        // find the end of this header line: the first crlf (a bare CR
+        // may legally appear inside the value)
+        auto eol = p;
+        for (;;) {
+            eol = scan_for(eol, end, '\r');
+            if (end - eol < 2) {
+                return 0;
+            }
+            if (eol[1] == '\n') {
+                break;
+            }
+            eol++;
+        }
+        auto colon = scan_for(p, eol, ':');
+        if (colon == eol) {
+            return 0;
+        }
+        // field name: tchar+, with optional whitespace before the colon
+        auto name_end = colon;
+        while (name_end > p && (name_end[-1] == ' ' || name_end[-1] == '\t')) {
+            name_end--;
+        }
+        if (name_end == p) {
+            return 0;
+        }
+        for (auto s = p; s != name_end; s++) {
+            if (!is_tchar(*s)) {
+                return 0;
+            }
+        }
+        // value: skip leading whitespace, take the rest of the line
+        auto v = colon + 1;
+        while (v != eol && (*v == ' ' || *v == '\t')) {
+            v++;
+        }
+        req._headers[sstring(p, name_end - p)] = sstring(v, eol - v);
+        p = eol + 2;
+    }
+}
+
+}
+}
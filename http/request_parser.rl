@@ -25,6 +25,7 @@
 #include <memory>
 #include <unordered_map>
 #include "http/request.hh"
+#include "http/request_fast_parser.hh"
 
 using namespace httpd;
 
@@ -108,14 +109,30 @@ public:
     sstring _field_name;
     sstring _value;
     state _state;
+    // true until the machine has consumed anything; while it holds, a
+    // buffer may contain a whole request head and be handed to the
+    // vectorized parser instead
+    bool _fresh;
 public:
     void init() {
         init_base();
         _req.reset(new httpd::request());
         _state = state::eof;
+        _fresh = true;
         %% write init;
     }
     char* parse(char* p, char* pe, char* eof) {
+        if (_fresh) {
+            _fresh = false;
+            // common case: the whole head arrived in one buffer and is
+            // unremarkable; anything else falls through to the machine,
+            // which re-parses from scratch
+            auto consumed = internal::parse_http_request_fast(p, pe - p, *_req);
+            if (consumed) {
+                _state = state::done;
+                return p + consumed;
+            }
+        }
         sstring_builder::guard g(_builder, p, pe);
         auto str = [this, &g, &p] { g.mark_end(p); return get_str(); };
         bool done = false;
@@ -32,6 +32,122 @@ void verify_param(const request& req, const sstring& param) {
         throw missing_param_exception(param);
     }
 }
+
+bool route_trie::add(const match_rule& rule) {
+    // validate before touching the tree, so a rejected rule leaves it
+    // unchanged: only fixed strings aligned on segment boundaries and
+    // parameters can be compiled, and a rest parameter must come last
+    auto& matchers = rule.matchers();
+    if (matchers.empty() || rule.get_handler() == nullptr) {
+        return false;
+    }
+    for (unsigned i = 0; i < matchers.size(); i++) {
+        if (auto s = dynamic_cast<str_matcher*>(matchers[i])) {
+            if (s->str().empty() || s->str()[0] != '/' || s->str().back() == '/') {
+                return false;
+            }
+        } else if (auto p = dynamic_cast<param_matcher*>(matchers[i])) {
+            if (p->entire_path() && i != matchers.size() - 1) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    node* cur = &_root;
+    for (auto m : matchers) {
+        if (auto s = dynamic_cast<str_matcher*>(m)) {
+            auto& str = s->str();
+            size_t pos = 1;
+            while (pos <= str.size()) {
+                auto next = str.find('/', pos);
+                if (next == sstring::npos) {
+                    next = str.size();
+                }
+                auto seg = str.substr(pos, next - pos);
+                if (seg.empty()) {
+                    return false;
+                }
+                auto& child = cur->children[seg];
+                if (!child) {
+                    child = std::make_unique<node>();
+                }
+                cur = child.get();
+                pos = next + 1;
+            }
+        } else {
+            auto p = static_cast<param_matcher*>(m);
+            if (p->entire_path()) {
+                if (cur->rest_handler != nullptr) {
+                    return false;
+                }
+                cur->rest_name = p->name();
+                cur->rest_handler = rule.get_handler();
+                return true;
+            }
+            if (cur->param) {
+                if (cur->param_name != p->name()) {
+                    return false;
+                }
+            } else {
+                cur->param = std::make_unique<node>();
+                cur->param_name = p->name();
+            }
+            cur = cur->param.get();
+        }
+    }
+    if (cur->handler != nullptr) {
+        return false;
+    }
+    cur->handler = rule.get_handler();
+    return true;
+}
+
+handler_base* route_trie::get(const node& n, const sstring& url, size_t ind, parameters& params) {
+    if (ind >= url.length()) {
+        if (n.handler != nullptr) {
+            return n.handler;
+        }
+        if (n.rest_handler != nullptr) {
+            // an empty rest parameter is a valid match
+            params.set(n.rest_name, "");
+            return n.rest_handler;
+        }
+        return nullptr;
+    }
+    if (url[ind] != '/') {
+        return nullptr;
+    }
+    auto next = url.find('/', ind + 1);
+    if (next == sstring::npos) {
+        next = url.length();
+    }
+    auto seg = url.substr(ind + 1, next - ind - 1);
+    auto it = n.children.find(seg);
+    if (it != n.children.end()) {
+        auto h = get(*it->second, url, next, params);
+        if (h != nullptr) {
+            return h;
+        }
+    }
+    if (n.param && !seg.empty()) {
+        auto h = get(*n.param, url, next, params);
+        if (h != nullptr) {
+            // like param_matcher, the value keeps its leading slash
+            params.set(n.param_name, url.substr(ind, next - ind));
+            return h;
+        }
+    }
+    if (n.rest_handler != nullptr) {
+        params.set(n.rest_name, url.substr(ind));
+        return n.rest_handler;
+    }
+    return nullptr;
+}
+
+handler_base* route_trie::get(const sstring& url, parameters& params) const {
+    return get(_root, url, 0, params);
+}
 routes::routes() : _general_handler([this](std::exception_ptr eptr) mutable {
     return exception_reply(eptr);
 }) {}
@@ -120,6 +236,12 @@ handler_base* routes::get_handler(operation_type type, const sstring& url,
         return handler;
     }
 
+    handler = _trie[type].get(url, params);
+    if (handler != nullptr) {
+        return handler;
+    }
+    params.clear();
+
     for (auto rule = _rules[type].cbegin(); rule != _rules[type].cend();
             ++rule) {
         handler = (*rule)->get(url, params);
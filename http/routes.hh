@@ -30,10 +30,55 @@
 #include <boost/program_options/variables_map.hpp>
 #include <unordered_map>
 #include <vector>
+#include <memory>
 #include "core/future-util.hh"
 
 namespace httpd {
 
+/**
+ * A radix tree over url path segments, compiled from the simple match
+ * rules (fixed strings and parameters) at registration time, so a
+ * request is routed in O(path length) instead of a linear scan over
+ * every rule.  Literal segments win over parameters.  Rules built from
+ * custom matchers cannot be compiled and stay on the linear scan, which
+ * also remains the fallback for anything the tree does not match.
+ */
+class route_trie {
+    struct node {
+        // literal path segments
+        std::unordered_map<sstring, std::unique_ptr<node>> children;
+        // a one-segment parameter
+        std::unique_ptr<node> param;
+        sstring param_name;
+        // a parameter consuming the rest of the url
+        sstring rest_name;
+        handler_base* rest_handler = nullptr;
+        // handler when the url ends here; handlers are owned by the
+        // match rules, the tree only points at them
+        handler_base* handler = nullptr;
+    };
+    node _root;
+public:
+    /**
+     * Try to compile a rule into the tree.
+     * @param rule the rule to compile
+     * @return true when all the rule's matchers were fixed strings or
+     * parameters and the rule does not collide with an earlier one;
+     * false leaves the tree unchanged
+     */
+    bool add(const match_rule& rule);
+
+    /**
+     * Route a url.
+     * @param url the normalized request url
+     * @param params filled with the extracted parameters on a match
+     * @return the handler, or nullptr when the tree has no match
+     */
+    handler_base* get(const sstring& url, parameters& params) const;
+private:
+    static handler_base* get(const node& n, const sstring& url, size_t ind, parameters& params);
+};
+
 /**
  * The url helps defining a route.
  */
@@ -104,6 +149,9 @@ public:
      * @return it self
      */
     routes& add(match_rule* rule, operation_type type = GET) {
+        // compiled rules are still kept on the list: it owns them, and
+        // the linear scan remains the fallback for tree misses
+        _trie[type].add(*rule);
         _rules[type].push_back(rule);
         return *this;
     }
@@ -140,8 +188,6 @@ public:
                 nullptr : _map[type][url];
     }
 
-private:
-
     /**
      * Search and return a handler by the operation type and url
      * @param type the http operation type
@@ -161,8 +207,11 @@ private:
      */
     sstring normalize_url(const sstring& url);
 
+private:
+
     std::unordered_map<sstring, handler_base*> _map[NUM_OPERATION];
     std::vector<match_rule*> _rules[NUM_OPERATION];
+    route_trie _trie[NUM_OPERATION];
 public:
     using exception_handler_fun = std::function<std::unique_ptr<reply>(std::exception_ptr eptr)>;
     using exception_handler_id = size_t;
@@ -21,7 +21,10 @@
 
 #include <boost/algorithm/string/replace.hpp>
 #include "transformers.hh"
+#include "net/packet.hh"
 #include <experimental/string_view>
+#include <zlib.h>
+#include <vector>
 
 namespace httpd {
 
@@ -37,4 +40,190 @@ void content_replace::transform(sstring& content, const request& req,
     boost::replace_all(content, "{{Protocol}}", req.get_protocol_name());
 }
 
+// gzip is deflate with a wrapper; windowBits + 16 selects it
+static int window_bits(bool gzip) {
+    return gzip ? 15 + 16 : 15;
+}
+
+/**
+ * One shot compression of a materialized body. Returns false and
+ * leaves out untouched if zlib fails, in which case the reply simply
+ * goes out uncompressed.
+ */
+static bool compress_block(const sstring& in, sstring& out, bool gzip,
+        int level) {
+    z_stream zs = {};
+    if (deflateInit2(&zs, level, Z_DEFLATED, window_bits(gzip), 8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    auto bound = deflateBound(&zs, in.size());
+    sstring res(sstring::initialized_later(), bound);
+    zs.next_in = reinterpret_cast<unsigned char*>(const_cast<char*>(in.begin()));
+    zs.avail_in = in.size();
+    zs.next_out = reinterpret_cast<unsigned char*>(res.begin());
+    zs.avail_out = bound;
+    auto rc = deflate(&zs, Z_FINISH);
+    auto size = bound - zs.avail_out;
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END) {
+        return false;
+    }
+    out = res.substr(0, size);
+    return true;
+}
+
+/**
+ * Compresses whatever the body writer produces and forwards it to the
+ * connection's stream. zlib buffers up to a compression window of
+ * input before emitting, so output still flows incrementally for
+ * large bodies.
+ */
+class compressing_data_sink_impl : public data_sink_impl {
+    output_stream<char>& _out;
+    z_stream _zs = {};
+public:
+    compressing_data_sink_impl(output_stream<char>& out, bool gzip, int level)
+            : _out(out) {
+        if (deflateInit2(&_zs, level, Z_DEFLATED, window_bits(gzip), 8,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("deflateInit2 failed");
+        }
+    }
+    ~compressing_data_sink_impl() {
+        deflateEnd(&_zs);
+    }
+    virtual future<> put(net::packet data) override {
+        std::vector<char> compressed;
+        char buf[8192];
+        for (unsigned i = 0; i < data.nr_frags(); i++) {
+            auto f = data.frag(i);
+            _zs.next_in = reinterpret_cast<unsigned char*>(f.base);
+            _zs.avail_in = f.size;
+            do {
+                _zs.next_out = reinterpret_cast<unsigned char*>(buf);
+                _zs.avail_out = sizeof(buf);
+                deflate(&_zs, Z_NO_FLUSH);
+                compressed.insert(compressed.end(), buf,
+                        buf + sizeof(buf) - _zs.avail_out);
+            } while (_zs.avail_in != 0 || _zs.avail_out == 0);
+        }
+        if (compressed.empty()) {
+            return make_ready_future<>();
+        }
+        return _out.write(temporary_buffer<char>(compressed.data(),
+                compressed.size()));
+    }
+    virtual future<> close() override {
+        std::vector<char> compressed;
+        char buf[8192];
+        int rc;
+        do {
+            _zs.next_out = reinterpret_cast<unsigned char*>(buf);
+            _zs.avail_out = sizeof(buf);
+            rc = deflate(&_zs, Z_FINISH);
+            compressed.insert(compressed.end(), buf,
+                    buf + sizeof(buf) - _zs.avail_out);
+        } while (rc != Z_STREAM_END);
+        if (compressed.empty()) {
+            return make_ready_future<>();
+        }
+        return _out.write(temporary_buffer<char>(compressed.data(),
+                compressed.size()));
+    }
+};
+
+/**
+ * Whether a coding appears in the Accept-Encoding list without an
+ * explicit q=0 disabling it
+ */
+static bool accepts(const std::experimental::string_view& h,
+        const std::experimental::string_view& coding) {
+    size_t pos = 0;
+    while (pos < h.size()) {
+        auto end = h.find(',', pos);
+        if (end == std::experimental::string_view::npos) {
+            end = h.size();
+        }
+        auto token = h.substr(pos, end - pos);
+        pos = end + 1;
+        while (!token.empty() && token.front() == ' ') {
+            token.remove_prefix(1);
+        }
+        if (token.size() < coding.size()
+                || token.compare(0, coding.size(), coding) != 0) {
+            continue;
+        }
+        if (token.size() > coding.size() && token[coding.size()] != ';'
+                && token[coding.size()] != ' ') {
+            continue;
+        }
+        auto q = token.find("q=");
+        if (q == std::experimental::string_view::npos) {
+            return true;
+        }
+        // "q=0", "q=0.000" and friends all mean "never this coding"
+        auto value = token.substr(q + 2);
+        bool zero = !value.empty() && value[0] == '0';
+        for (size_t i = 1; zero && i < value.size(); i++) {
+            if (value[i] >= '1' && value[i] <= '9') {
+                zero = false;
+            }
+        }
+        return !zero;
+    }
+    return false;
+}
+
+content_compressor::encoding content_compressor::accepted_encoding(
+        const request& req) {
+    sstring h = req.get_header("Accept-Encoding");
+    if (accepts(h, "gzip")) {
+        return encoding::gzip;
+    }
+    if (accepts(h, "deflate")) {
+        return encoding::deflate;
+    }
+    return encoding::none;
+}
+
+future<std::unique_ptr<reply>> content_compressor::handle(const sstring& path,
+        std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+    auto enc = accepted_encoding(*req);
+    return _next->handle(path, std::move(req), std::move(rep)).then(
+            [this, enc] (std::unique_ptr<reply> rep) {
+        // the reply differs by the request's Accept-Encoding, with or
+        // without compression, so caches have to know
+        rep->_headers["Vary"] = "Accept-Encoding";
+        if (enc == encoding::none
+                || rep->_headers.count("Content-Encoding")) {
+            return rep;
+        }
+        bool gzip = enc == encoding::gzip;
+        if (rep->_body_writer) {
+            auto writer = std::move(rep->_body_writer);
+            auto level = _level;
+            rep->_body_writer = [writer, gzip, level] (output_stream<char>& out) {
+                return do_with(output_stream<char>(data_sink(
+                        std::make_unique<compressing_data_sink_impl>(out, gzip,
+                                level)), 8192),
+                        [&writer] (output_stream<char>& compressed) {
+                    return writer(compressed).then([&compressed] {
+                        return compressed.close();
+                    });
+                });
+            };
+            rep->add_header("Content-Encoding", gzip ? "gzip" : "deflate");
+        } else if (rep->_content.size() >= _min_size) {
+            sstring compressed;
+            if (compress_block(rep->_content, compressed, gzip, _level)) {
+                rep->_content = std::move(compressed);
+                rep->add_header("Content-Encoding",
+                        gzip ? "gzip" : "deflate");
+            }
+        }
+        return rep;
+    });
+}
+
 }
@@ -53,5 +53,49 @@ private:
     sstring extension;
 };
 
+/**
+ * content_compressor compresses the reply body with gzip or deflate,
+ * according to the request's Accept-Encoding header.
+ *
+ * It wraps the handler of a route, so compression is opted into per
+ * route:
+ *
+ *     r.put(GET, "/big", new content_compressor(new my_handler()));
+ *
+ * Replies that were materialized into reply::_content are compressed
+ * in one shot, and only when they are at least min_size bytes - below
+ * that the encoding overhead exceeds the win. Streamed replies (set
+ * with reply::write_body()) are compressed incrementally as the body
+ * writer produces data, whatever their eventual size turns out to be.
+ */
+class content_compressor : public handler_base {
+public:
+    enum class encoding {
+        none, gzip, deflate
+    };
+    /**
+     * @param next the handler producing the reply; the compressor
+     *        takes ownership
+     * @param level zlib compression level (1-9), -1 for zlib's default
+     * @param min_size materialized replies below this size are sent
+     *        uncompressed
+     */
+    explicit content_compressor(handler_base* next, int level = -1,
+            size_t min_size = 1024)
+            : _next(next), _level(level), _min_size(min_size) {
+        _mandatory_param = _next->_mandatory_param;
+    }
+    virtual future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override;
+    /**
+     * The encoding the client prefers, gzip winning over deflate
+     */
+    static encoding accepted_encoding(const request& req);
+private:
+    std::unique_ptr<handler_base> _next;
+    int _level;
+    size_t _min_size;
+};
+
 }
 #endif /* TRANSFORMERS_HH_ */
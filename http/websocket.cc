@@ -0,0 +1,186 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "websocket.hh"
+
+#include <cryptopp/sha.h>
+#include <cryptopp/base64.h>
+#include <cryptopp/filters.h>
+
+namespace httpd {
+
+namespace websocket {
+
+// nonce the handshake key is hashed with, fixed by RFC 6455
+static const sstring handshake_magic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+bool is_upgrade_request(const request& req) {
+    return req.get_header("Upgrade") == "websocket"
+            && req.get_header("Sec-WebSocket-Key") != ""
+            && req.get_header("Sec-WebSocket-Version") == "13";
+}
+
+sstring handshake_accept(const sstring& key) {
+    auto input = key + handshake_magic;
+    CryptoPP::SHA1 sha1;
+    std::string accept;
+    CryptoPP::StringSource ss(reinterpret_cast<const unsigned char*>(input.begin()),
+            input.size(), true,
+            new CryptoPP::HashFilter(sha1,
+                    new CryptoPP::Base64Encoder(
+                            new CryptoPP::StringSink(accept), false)));
+    return sstring(accept.data(), accept.size());
+}
+
+future<message> connection::read() {
+    if (_eof) {
+        return make_ready_future<message>(message());
+    }
+    return read_frame().then([this] (message msg) {
+        if (msg.op == opcode::ping) {
+            // answered here; the session only sees data frames
+            return send(message(opcode::pong, std::move(msg.payload))).then(
+                    [this] {
+                return read();
+            });
+        }
+        if (msg.op == opcode::pong) {
+            return read();
+        }
+        return make_ready_future<message>(std::move(msg));
+    });
+}
+
+future<message> connection::read_frame() {
+    return _read_buf.read_exactly(2).then([this] (temporary_buffer<char> hdr) {
+        if (hdr.size() < 2) {
+            _eof = true;
+            return make_ready_future<message>(message());
+        }
+        auto b0 = uint8_t(hdr[0]);
+        auto b1 = uint8_t(hdr[1]);
+        bool fin = b0 & 0x80;
+        auto op = opcode(b0 & 0x0f);
+        bool masked = b1 & 0x80;
+        uint64_t len = b1 & 0x7f;
+        size_t ext = len == 126 ? 2 : len == 127 ? 8 : 0;
+        size_t mask_len = masked ? 4 : 0;
+        return _read_buf.read_exactly(ext + mask_len).then(
+                [this, fin, op, masked, len, ext, mask_len]
+                (temporary_buffer<char> rest) mutable {
+            if (rest.size() < ext + mask_len) {
+                _eof = true;
+                return make_ready_future<message>(message());
+            }
+            for (size_t i = 0; i < ext; i++) {
+                len = (len << 8) | uint8_t(rest[i]);
+            }
+            return _read_buf.read_exactly(len).then(
+                    [this, fin, op, masked, len, ext, rest = std::move(rest)]
+                    (temporary_buffer<char> payload) {
+                if (payload.size() < len) {
+                    _eof = true;
+                    return message();
+                }
+                if (masked) {
+                    // unmasking is the only touch the payload gets;
+                    // the buffer itself still aliases the read buffer
+                    auto p = payload.get_write();
+                    auto mask = rest.get() + ext;
+                    for (size_t i = 0; i < payload.size(); i++) {
+                        p[i] ^= mask[i & 3];
+                    }
+                }
+                if (op == opcode::close) {
+                    _eof = true;
+                }
+                return message(op, std::move(payload), fin);
+            });
+        });
+    });
+}
+
+future<> connection::send(message msg) {
+    if (_send_closed) {
+        return make_ready_future<>();
+    }
+    return _out.push_eventually(std::move(msg));
+}
+
+future<> connection::close() {
+    if (_send_closed) {
+        return make_ready_future<>();
+    }
+    _send_closed = true;
+    return _out.push_eventually(message());
+}
+
+future<> connection::do_writes() {
+    return repeat([this] {
+        return _out.pop_eventually().then([this] (message msg) {
+            bool last = msg.op == opcode::close;
+            return write_frame(std::move(msg)).then([this] {
+                // batch flushes: only touch the wire when nothing
+                // else is queued behind us
+                if (_out.empty()) {
+                    return _write_buf.flush();
+                }
+                return make_ready_future<>();
+            }).then([last] {
+                return last ? stop_iteration::yes : stop_iteration::no;
+            });
+        });
+    });
+}
+
+future<> connection::write_frame(message msg) {
+    char hdr[10];
+    size_t n = 2;
+    hdr[0] = (msg.fin ? 0x80 : 0x00) | uint8_t(msg.op);
+    size_t len = msg.payload.size();
+    if (len < 126) {
+        hdr[1] = len;
+    } else if (len < 65536) {
+        hdr[1] = 126;
+        hdr[2] = len >> 8;
+        hdr[3] = len;
+        n = 4;
+    } else {
+        hdr[1] = 127;
+        for (int i = 0; i < 8; i++) {
+            hdr[2 + i] = uint64_t(len) >> (56 - 8 * i);
+        }
+        n = 10;
+    }
+    // server to client frames are unmasked, so the payload goes to
+    // the socket as the caller handed it over
+    return _write_buf.write(hdr, n).then(
+            [this, payload = std::move(msg.payload)] () mutable {
+        if (payload.empty()) {
+            return make_ready_future<>();
+        }
+        return _write_buf.write(std::move(payload));
+    });
+}
+
+}
+
+}
@@ -0,0 +1,178 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#ifndef HTTP_WEBSOCKET_HH_
+#define HTTP_WEBSOCKET_HH_
+
+#include "handlers.hh"
+#include "core/iostream.hh"
+#include "core/queue.hh"
+#include "core/future-util.hh"
+#include "core/temporary_buffer.hh"
+
+namespace httpd {
+
+namespace websocket {
+
+enum class opcode : uint8_t {
+    continuation = 0x0,
+    text = 0x1,
+    binary = 0x2,
+    close = 0x8,
+    ping = 0x9,
+    pong = 0xa,
+};
+
+/**
+ * One websocket frame. The payload is a view into the connection's
+ * read buffer (incoming) or handed to the framing layer as-is
+ * (outgoing), so frames move through the codec without copying.
+ */
+struct message {
+    opcode op;
+    temporary_buffer<char> payload;
+    bool fin = true;
+
+    message() : op(opcode::close) {}
+    message(opcode op, temporary_buffer<char> payload, bool fin = true)
+            : op(op), payload(std::move(payload)), fin(fin) {
+    }
+    message(opcode op, const sstring& content)
+            : op(op), payload(content.begin(), content.size()) {
+    }
+};
+
+/**
+ * Whether this request asks to be upgraded to a websocket: the
+ * Upgrade and Sec-WebSocket-Key headers are there and the client
+ * speaks protocol version 13 (the RFC 6455 one)
+ */
+bool is_upgrade_request(const request& req);
+
+/**
+ * The Sec-WebSocket-Accept value proving to the client that its
+ * handshake key was seen: base64(sha1(key + magic))
+ */
+sstring handshake_accept(const sstring& key);
+
+/**
+ * The frame-level interface of an upgraded connection, given to a
+ * websocket_handler session.
+ *
+ * Reading returns one frame at a time; the payload aliases the read
+ * buffer and is unmasked in place, so nothing is copied on the way
+ * in. Ping frames are answered and close frames are echoed
+ * internally, the session only ever sees data frames and the final
+ * close.
+ *
+ * Outgoing frames go through a bounded per-connection queue drained
+ * by a writer loop; send() waits for room in the queue when the
+ * socket cannot keep up, which is the session's backpressure. An
+ * idle subscription holds nothing but this object.
+ */
+class connection {
+    input_stream<char>& _read_buf;
+    output_stream<char>& _write_buf;
+    // outgoing frames, drained in order by do_writes(); the bound is
+    // what pushes back on a session outrunning the socket
+    queue<message> _out { 16 };
+    bool _eof = false;
+    bool _send_closed = false;
+public:
+    connection(input_stream<char>& in, output_stream<char>& out)
+            : _read_buf(in), _write_buf(out) {
+    }
+
+    /**
+     * Reads the next data frame; its payload is valid until the next
+     * read. Returns a close frame on a peer close or on eof, after
+     * which every further read returns the same.
+     */
+    future<message> read();
+
+    /**
+     * Queues a frame for sending, waiting for queue room when the
+     * peer is slow. May not be called after close().
+     */
+    future<> send(message msg);
+    future<> send(opcode op, temporary_buffer<char> payload) {
+        return send(message(op, std::move(payload)));
+    }
+
+    /**
+     * Queues a close frame and stops the writer; idempotent
+     */
+    future<> close();
+
+    /**
+     * The writer loop; the owning http connection runs it alongside
+     * the session and joins it when the session is done
+     */
+    future<> do_writes();
+private:
+    future<message> read_frame();
+    future<> write_frame(message msg);
+};
+
+}
+
+/**
+ * Routes a url to a websocket session. Registered like any other
+ * handler:
+ *
+ *     r.put(GET, "/metrics", new websocket_handler(
+ *             [] (std::unique_ptr<request> req, websocket::connection& ws) {
+ *         return do_something_with(ws);
+ *     }));
+ *
+ * The http connection performs the upgrade handshake and calls the
+ * session function with the frame-level connection; when the returned
+ * future resolves the connection is closed. A plain http request to
+ * the url is answered with a 400.
+ */
+class websocket_handler : public handler_base {
+public:
+    using session_fun = std::function<future<> (std::unique_ptr<request> req,
+            websocket::connection& ws)>;
+
+    explicit websocket_handler(session_fun session)
+            : _session(std::move(session)) {
+    }
+
+    virtual future<std::unique_ptr<reply>> handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) override {
+        // only reached without an upgrade request; the upgrade itself
+        // never comes through here
+        rep->set_status(reply::status_type::bad_request,
+                "websocket upgrade required").done("txt");
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    }
+
+    future<> serve(std::unique_ptr<request> req, websocket::connection& ws) {
+        return _session(std::move(req), ws);
+    }
+private:
+    session_fun _session;
+};
+
+}
+
+#endif /* HTTP_WEBSOCKET_HH_ */
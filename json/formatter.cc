@@ -27,61 +27,121 @@ using namespace std;
 
 namespace json {
 
+template<typename T>
+static sstring via_writer(const T& value) {
+    json_writer out;
+    formatter::write(out, value);
+    return out.str();
+}
+
 sstring formatter::to_json(const sstring& str) {
-    return to_json(str.c_str());
+    return via_writer(str);
 }
 
 sstring formatter::to_json(const char* str) {
-    sstring res = "\"";
-    res += str;
-    res += "\"";
-    return res;
+    json_writer out;
+    write(out, str);
+    return out.str();
 }
 
 sstring formatter::to_json(int n) {
-    return to_string(n);
+    return via_writer(n);
 }
 
 sstring formatter::to_json(long n) {
-    return to_string(n);
+    return via_writer(n);
 }
 
 sstring formatter::to_json(float f) {
+    return via_writer(f);
+}
+
+sstring formatter::to_json(double d) {
+    return via_writer(d);
+}
+
+sstring formatter::to_json(bool b) {
+    return via_writer(b);
+}
+
+sstring formatter::to_json(const date_time& d) {
+    return via_writer(d);
+}
+
+sstring formatter::to_json(const jsonable& obj) {
+    return obj.to_json();
+}
+
+sstring formatter::to_json(unsigned long l) {
+    return via_writer(l);
+}
+
+void formatter::write(json_writer& out, const sstring& str) {
+    out.append_quoted(str);
+}
+
+void formatter::write(json_writer& out, const char* str) {
+    out.append_quoted(str, strlen(str));
+}
+
+void formatter::write(json_writer& out, int n) {
+    out.append_int(n);
+}
+
+void formatter::write(json_writer& out, long n) {
+    out.append_int(n);
+}
+
+void formatter::write(json_writer& out, unsigned long l) {
+    out.append_uint(l);
+}
+
+// Doubles that hold an integral value - the common case for counters
+// coming out of the REST API - take the integer fast path; the rest
+// keep the old conversion
+static void write_fp(json_writer& out, double d) {
+    // up to 2^53 the conversion to int64_t is exact and well defined
+    constexpr double max_exact = 9007199254740992.0;
+    if (d >= -max_exact && d <= max_exact && d == int64_t(d)) {
+        out.append_int(int64_t(d));
+        return;
+    }
+    out.append(to_sstring(d));
+}
+
+void formatter::write(json_writer& out, float f) {
     if (std::isinf(f)) {
         throw out_of_range("Infinite float value is not supported");
     } else if (std::isnan(f)) {
         throw invalid_argument("Invalid float value");
     }
-    return to_sstring(f);
+    write_fp(out, f);
 }
 
-sstring formatter::to_json(double d) {
+void formatter::write(json_writer& out, double d) {
     if (std::isinf(d)) {
         throw out_of_range("Infinite double value is not supported");
     } else if (std::isnan(d)) {
         throw invalid_argument("Invalid double value");
     }
-    return to_sstring(d);
+    write_fp(out, d);
 }
 
-sstring formatter::to_json(bool b) {
-    return (b) ? "true" : "false";
+void formatter::write(json_writer& out, bool b) {
+    out.append(b ? "true" : "false");
 }
 
-sstring formatter::to_json(const date_time& d) {
+void formatter::write(json_writer& out, const date_time& d) {
+    // a strftime of TIME_FORMAT never needs json escaping
     char buff[50];
-    sstring res = "\"";
-    strftime(buff, 50, TIME_FORMAT, &d);
-    res += buff;
-    return res + "\"";
+    auto n = strftime(buff, sizeof(buff), TIME_FORMAT, &d);
+    out.append('"');
+    out.append(buff, n);
+    out.append('"');
 }
 
-sstring formatter::to_json(const jsonable& obj) {
-    return obj.to_json();
-}
-
-sstring formatter::to_json(unsigned long l) {
-    return to_string(l);
+void formatter::write(json_writer& out, const jsonable& obj) {
+    out.append(obj.to_json());
 }
 
 }
@@ -27,6 +27,7 @@
 #include <time.h>
 #include <sstream>
 #include "core/sstring.hh"
+#include "json_writer.hh"
 
 namespace json {
 
@@ -98,19 +99,9 @@ public:
      */
     template<typename T>
     static sstring to_json(const std::vector<T>& vec) {
-        std::stringstream res;
-        res << "[";
-        bool first = true;
-        for (auto i : vec) {
-            if (first) {
-                first = false;
-            } else {
-                res << ",";
-            }
-            res << to_json(i);
-        }
-        res << "]";
-        return res.str();
+        json_writer out;
+        write(out, vec);
+        return out.str();
     }
 
     /**
@@ -134,6 +125,38 @@ public:
      */
     static sstring to_json(unsigned long l);
 
+    /**
+     * The append-to-buffer serialization behind the to_json
+     * overloads; writing into a caller supplied json_writer lets a
+     * whole object serialize into one buffer without a temporary
+     * string per field
+     */
+    static void write(json_writer& out, const sstring& str);
+    static void write(json_writer& out, const char* str);
+    static void write(json_writer& out, int n);
+    static void write(json_writer& out, long n);
+    static void write(json_writer& out, unsigned long l);
+    static void write(json_writer& out, float f);
+    static void write(json_writer& out, double d);
+    static void write(json_writer& out, bool b);
+    static void write(json_writer& out, const date_time& d);
+    static void write(json_writer& out, const jsonable& obj);
+
+    template<typename T>
+    static void write(json_writer& out, const std::vector<T>& vec) {
+        out.append('[');
+        bool first = true;
+        for (auto& i : vec) {
+            if (first) {
+                first = false;
+            } else {
+                out.append(',');
+            }
+            write(out, i);
+        }
+        out.append(']');
+    }
+
 private:
 
     static constexpr const char* TIME_FORMAT = "%a %b %d %I:%M:%S %Z %Y";
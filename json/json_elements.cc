@@ -36,23 +36,9 @@ namespace json {
  */
 class json_builder {
 public:
-    json_builder()
-            : first(true) {
-        result << OPEN;
-    }
-
-    /**
-     * add a name value to an object
-     * @param name the name of the element
-     * @param str the value already formated
-     */
-    void add(const string& name, const string& str) {
-        if (first) {
-            first = false;
-        } else {
-            result << ", ";
-        }
-        result << '"' << name << "\": " << str;
+    explicit json_builder(size_t estimate = 0)
+            : result(estimate), first(true) {
+        result.append('{');
     }
 
     /**
@@ -63,7 +49,15 @@ public:
         if (element == nullptr || element->_set == false) {
             return;
         }
-        add(element->_name, element->to_string());
+        if (first) {
+            first = false;
+        } else {
+            result.append(", ", 2);
+        }
+        result.append('"');
+        result.append(element->_name);
+        result.append("\": ", 3);
+        element->write(result);
     }
 
     /**
@@ -71,22 +65,16 @@ public:
      * @return a string of accumulative object
      */
     string as_json() {
-        result << CLOSE;
-        return result.str();
+        result.append('}');
+        return string(result.data(), result.size());
     }
 
 private:
-    static const string OPEN;
-    static const string CLOSE;
-
-    stringstream result;
+    json_writer result;
     bool first;
 
 };
 
-const string json_builder::OPEN("{");
-const string json_builder::CLOSE("}");
-
 void json_base::add(json_base_element* element, string name, bool mandatory) {
     element->_mandatory = mandatory;
     element->_name = name;
@@ -94,7 +82,13 @@ void json_base::add(json_base_element* element, string name, bool mandatory) {
 }
 
 string json_base::to_json() const {
-    json_builder res;
+    // a rough size estimate saves the buffer growth in the common
+    // case; values are guessed at, names are known
+    size_t estimate = 2;
+    for (auto i : _elements) {
+        estimate += i->_name.size() + 16;
+    }
+    json_builder res(estimate);
     for (auto i : _elements) {
         res.add(i);
     }
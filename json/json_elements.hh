@@ -73,6 +73,15 @@ public:
      */
     virtual std::string to_string() = 0;
 
+    /**
+     * writes the internal value in a json format into the given
+     * buffer, avoiding a temporary string per field; the default
+     * falls back to to_string() for elements that do not override it
+     */
+    virtual void write(json_writer& out) {
+        out.append(to_string());
+    }
+
     std::string _name;
     bool _mandatory;
     bool _set;
@@ -129,6 +138,10 @@ public:
         return formatter::to_json(_value);
     }
 
+    virtual void write(json_writer& out) override {
+        formatter::write(out, _value);
+    }
+
 private:
     T _value;
 };
@@ -157,6 +170,10 @@ public:
         return formatter::to_json(_elements);
     }
 
+    virtual void write(json_writer& out) override {
+        formatter::write(out, _elements);
+    }
+
     /**
      * Assignment can be done from any object that support const range
      * iteration and that it's elements can be assigned to the list elements
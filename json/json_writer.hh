@@ -0,0 +1,177 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#ifndef JSON_JSON_WRITER_HH_
+#define JSON_JSON_WRITER_HH_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include "core/sstring.hh"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace json {
+
+/**
+ * An append-to-buffer json serializer. All the to_json() entry points
+ * build their output through one of these instead of concatenating
+ * sstrings, so a whole object serializes into a single buffer that
+ * can be reserved up front from a size estimate.
+ *
+ * Numbers are formatted directly into the buffer without snprintf,
+ * and quoted strings are scanned for characters needing an escape
+ * sixteen bytes at a time, so the common escape-free string appends
+ * wholesale.
+ */
+class json_writer {
+    std::vector<char> _buf;
+public:
+    explicit json_writer(size_t estimate = 0) {
+        _buf.reserve(estimate);
+    }
+
+    void append(char c) {
+        _buf.push_back(c);
+    }
+
+    void append(const char* s, size_t n) {
+        _buf.insert(_buf.end(), s, s + n);
+    }
+
+    void append(const char* s) {
+        append(s, strlen(s));
+    }
+
+    void append(const sstring& s) {
+        append(s.begin(), s.size());
+    }
+
+    void append(const std::string& s) {
+        append(s.data(), s.size());
+    }
+
+    /**
+     * Appends the value as a json number
+     */
+    void append_uint(uint64_t v) {
+        // digits fall out in reverse; build them at the end of a
+        // stack buffer and append the used part
+        char tmp[20];
+        char* p = tmp + sizeof(tmp);
+        do {
+            *--p = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        append(p, tmp + sizeof(tmp) - p);
+    }
+
+    void append_int(int64_t v) {
+        uint64_t u = v;
+        if (v < 0) {
+            append('-');
+            // negating as unsigned is fine for INT64_MIN too
+            u = -u;
+        }
+        append_uint(u);
+    }
+
+    /**
+     * Appends the string in double quotes, escaping quotes,
+     * backslashes and control characters as json requires
+     */
+    void append_quoted(const char* s, size_t n) {
+        append('"');
+        size_t i = 0;
+#if defined(__SSE2__)
+        auto quote = _mm_set1_epi8('"');
+        auto backslash = _mm_set1_epi8('\\');
+        auto ctrl = _mm_set1_epi8(0x1f);
+        while (i + 16 <= n) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+            // unsigned "v <= 0x1f" via min: min(v, 0x1f) == v
+            auto needs_escape = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                            _mm_cmpeq_epi8(v, backslash)),
+                    _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+            auto mask = _mm_movemask_epi8(needs_escape);
+            if (!mask) {
+                append(s + i, 16);
+                i += 16;
+                continue;
+            }
+            auto clean = size_t(__builtin_ctz(mask));
+            append(s + i, clean);
+            i += clean;
+            append_escaped(s[i++]);
+        }
+#endif
+        for (; i < n; i++) {
+            char c = s[i];
+            if (c == '"' || c == '\\' || uint8_t(c) <= 0x1f) {
+                append_escaped(c);
+            } else {
+                append(c);
+            }
+        }
+        append('"');
+    }
+
+    void append_quoted(const sstring& s) {
+        append_quoted(s.begin(), s.size());
+    }
+
+    const char* data() const {
+        return _buf.data();
+    }
+
+    size_t size() const {
+        return _buf.size();
+    }
+
+    sstring str() const {
+        return sstring(_buf.data(), _buf.size());
+    }
+private:
+    void append_escaped(char c) {
+        switch (c) {
+        case '"': append("\\\"", 2); break;
+        case '\\': append("\\\\", 2); break;
+        case '\n': append("\\n", 2); break;
+        case '\r': append("\\r", 2); break;
+        case '\t': append("\\t", 2); break;
+        case '\b': append("\\b", 2); break;
+        case '\f': append("\\f", 2); break;
+        default: {
+            static const char hex[] = "0123456789abcdef";
+            char buf[6] = { '\\', 'u', '0', '0',
+                    hex[uint8_t(c) >> 4], hex[c & 0xf] };
+            append(buf, 6);
+        }
+        }
+    }
+};
+
+}
+
+#endif /* JSON_JSON_WRITER_HH_ */
@@ -24,13 +24,16 @@
 
 #include <memory>
 #include <vector>
+#include <deque>
 #include <cstring>
+#include <functional>
 #include "core/future.hh"
 #include "net/byteorder.hh"
 #include "net/packet.hh"
 #include "core/print.hh"
 #include "core/temporary_buffer.hh"
 #include "core/iostream.hh"
+#include "core/gate.hh"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/ip.h>
@@ -66,8 +69,24 @@ enum class transport {
 }
 
 struct listen_options {
+    // how accepted connections are spread over shards (posix stack; the
+    // native stack and reuseport listeners steer in hardware/kernel)
+    enum class load_balancing_algorithm {
+        round_robin,  // even spread of connection counts
+        peer_address, // hash of the peer IP: same client, same shard
+        fixed,        // everything stays on the accepting shard
+    };
     seastar::transport proto = seastar::transport::TCP;
     bool reuse_address = false;
+    load_balancing_algorithm lba = load_balancing_algorithm::round_robin;
+    // overrides lba when set; must return a target shard for the peer
+    std::function<unsigned (socket_address)> shard_selector;
+    // TCP Fast Open: accept SYNs carrying data, with a pending-cookie
+    // queue of this depth; 0 leaves it disabled
+    unsigned fast_open_queue = 0;
+    // don't wake the acceptor until the connection carries data, for up
+    // to this many seconds; 0 leaves it disabled
+    unsigned defer_accept_secs = 0;
     listen_options(bool rua = false)
         : reuse_address(rua)
     {}
@@ -186,8 +205,14 @@ public:
     udp_channel& operator=(udp_channel&&);
 
     future<udp_datagram> receive();
+    // Receives every datagram already queued on the channel; waits only
+    // when none is available yet.
+    future<std::vector<udp_datagram>> receive_batch();
     future<> send(ipv4_addr dst, const char* msg);
     future<> send(ipv4_addr dst, packet p);
+    // Sends a batch of datagrams to one destination in a single
+    // traversal of the stack.
+    future<> send_batch(ipv4_addr dst, std::vector<packet> ps);
     bool is_closed() const;
     void close();
 };
@@ -242,6 +267,29 @@ public:
     void set_keepalive_parameters(const net::keepalive_params& p);
     /// Get TCP keepalive parameters
     net::keepalive_params get_keepalive_parameters() const;
+    /// Sets the socket send buffer size (SO_SNDBUF); ignored by stacks
+    /// without an equivalent
+    void set_sndbuf(size_t bytes);
+    /// Gets the socket send buffer size; 0 when not applicable
+    size_t get_sndbuf() const;
+    /// Sets the socket receive buffer size (SO_RCVBUF); ignored by stacks
+    /// without an equivalent
+    void set_rcvbuf(size_t bytes);
+    /// Gets the socket receive buffer size; 0 when not applicable
+    size_t get_rcvbuf() const;
+    /// Limits unsent data queued in the kernel (TCP_NOTSENT_LOWAT),
+    /// bounding bufferbloat in streaming responses
+    void set_notsent_lowat(size_t bytes);
+    /// Busy-polls the device queue for this long before sleeping on a
+    /// blocked receive (SO_BUSY_POLL), trading CPU for latency
+    void set_busy_poll(std::chrono::microseconds us);
+    /// Forwards everything received on this socket to \c to until EOF,
+    /// without passing the bytes through userspace buffers when the
+    /// stack supports it (splice() on the posix stack, packet handoff
+    /// on the native stack).  Flow control follows the slower of the
+    /// two sockets.  Claims this socket's input and \c to's output for
+    /// the duration; \c to is flushed but not shut down at EOF.
+    future<> splice_to(connected_socket& to);
 
     /// Disables output to the socket.
     ///
@@ -326,12 +374,57 @@ public:
     /// \see listen(socket_address sa, listen_options opts)
     future<connected_socket, socket_address> accept();
 
+    /// Accepts a batch of connections in one go.
+    ///
+    /// Waits like \ref accept(), but once connections start arriving,
+    /// drains everything already waiting in the accept queue (up to an
+    /// internal limit) instead of taking one connection per reactor
+    /// wakeup.  Useful for servers facing connection storms.
+    ///
+    /// \return the accepted connections, each paired with the
+    ///         \ref socket_address of its remote endpoint; never empty.
+    future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch();
+
     /// Stops any \ref accept() in progress.
     ///
     /// Current and future \ref accept() calls will terminate immediately
     /// with an error.
     void abort_accept();
 };
+
+/// A pool of pre-established connections to a single endpoint.
+///
+/// Keeps up to \c warm connections open in the background, so that
+/// \ref get() usually returns without waiting for a connection
+/// handshake.  Useful for fan-out RPC clients that open many
+/// short-lived connections to the same peer.
+///
+/// The pool must be \ref close()d before destruction, and must outlive
+/// any outstanding \ref get().
+class connection_pool {
+    socket_address _addr;
+    unsigned _warm;
+    std::deque<connected_socket> _ready;
+    unsigned _connecting = 0;
+    bool _closed = false;
+    seastar::gate _gate;
+public:
+    /// Creates a pool and starts establishing \c warm connections to
+    /// \c addr in the background.
+    explicit connection_pool(socket_address addr, unsigned warm = 8);
+    /// Returns a pre-established connection if one is available, and
+    /// falls back to connecting directly otherwise.  Triggers a refill
+    /// of the pool either way.
+    future<connected_socket> get();
+    /// Returns a healthy connection to the pool for reuse.  Connections
+    /// beyond the warm target are discarded.
+    void put(connected_socket cs);
+    /// Discards the warm connections and waits for connection attempts
+    /// still in flight.
+    future<> close();
+private:
+    void refill();
+};
 /// @}
 
 class network_stack {
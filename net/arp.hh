@@ -137,6 +137,9 @@ private:
 private:
     l3addr _l3self = L3::broadcast_address();
     std::unordered_map<l3addr, l2addr> _table;
+    // Bumped whenever _table changes; lets upper layers cache resolved
+    // next hops and revalidate them with a single comparison
+    uint64_t _gen = 1;
     std::unordered_map<l3addr, resolution> _in_progress;
 private:
     packet make_query_packet(l3addr paddr);
@@ -150,12 +153,14 @@ public:
         _table[L3::broadcast_address()] = ethernet::broadcast_address();
     }
     future<ethernet_address> lookup(const l3addr& addr);
+    uint64_t generation() const { return _gen; }
     void learn(l2addr l2, l3addr l3);
     void run();
     void set_self_addr(l3addr addr) {
         _table.erase(_l3self);
         _table[addr] = l2self();
         _l3self = addr;
+        _gen++;
     }
     friend class arp;
 };
@@ -241,6 +246,7 @@ template <typename L3>
 void
 arp_for<L3>::learn(l2addr hwaddr, l3addr paddr) {
     _table[paddr] = hwaddr;
+    _gen++;
     auto i = _in_progress.find(paddr);
     if (i != _in_progress.end()) {
         auto& res = i->second;
@@ -216,6 +216,8 @@ class dpdk_device : public device {
     unsigned _home_cpu;
     bool _use_lro;
     bool _enable_fc;
+    uint16_t _rx_mbufs_per_queue;
+    bool _rx_intr_enabled;
     std::vector<uint8_t> _redir_table;
     rss_key_type _rss_key;
     port_stats _stats;
@@ -272,12 +274,15 @@ private:
 
 public:
     dpdk_device(uint8_t port_idx, uint16_t num_queues, bool use_lro,
-                bool enable_fc)
+                bool enable_fc, uint16_t rx_mbufs_per_queue = mbufs_per_queue_rx,
+                bool rx_interrupts = false)
         : _port_idx(port_idx)
         , _num_queues(num_queues)
         , _home_cpu(engine().cpu_id())
         , _use_lro(use_lro)
         , _enable_fc(enable_fc)
+        , _rx_mbufs_per_queue(rx_mbufs_per_queue)
+        , _rx_intr_enabled(rx_interrupts)
         , _stats_plugin_name("network")
         , _stats_plugin_inst(std::string("port") + std::to_string(_port_idx))
     {
@@ -413,6 +418,13 @@ public:
      */
     void set_rss_table();
 
+    /**
+     * Program the HW indirection table from _redir_table.
+     */
+    void program_rss_table();
+
+    virtual std::vector<uint8_t> rss_table() const override { return _redir_table; }
+    virtual void update_rss_table(const std::vector<uint8_t>& reta) override;
     virtual uint16_t hw_queues_count() override { return _num_queues; }
     virtual future<> link_ready() { return _link_ready_promise.get_future(); }
     virtual std::unique_ptr<qp> init_local_queue(boost::program_options::variables_map opts, uint16_t qid) override;
@@ -427,6 +439,12 @@ public:
     bool is_vmxnet3_device() const {
         return _is_vmxnet3_device;
     }
+    uint16_t rx_mbufs_per_queue() const {
+        return _rx_mbufs_per_queue;
+    }
+    bool rx_interrupts_enabled() const {
+        return _rx_intr_enabled;
+    }
 
     virtual const rss_key_type& rss_key() const override { return _rss_key; }
 };
@@ -578,54 +596,76 @@ class dpdk_qp : public net::qp {
          *         failure
          */
         static tx_buf* from_packet_zc(packet&& p, dpdk_qp& qp) {
-
-            // Too fragmented - linearize
-            if (p.nr_frags() > max_frags) {
-                p.linearize();
-                ++qp._stats.tx.linearized;
-            }
-
 build_mbuf_cluster:
             rte_mbuf *head = nullptr, *last_seg = nullptr;
             unsigned nsegs = 0;
 
-            //
-            // Create a HEAD of the fragmented packet: check if frag0 has to be
-            // copied and if yes - send it in a copy way
-            //
-            if (!check_frag0(p)) {
-                if (!copy_one_frag(qp, p.frag(0), head, last_seg, nsegs)) {
+            if (p.nr_frags() > max_frags) {
+                //
+                // More fragments than a cluster may carry - the packet can't
+                // translate 1:1, so build it in the repacking mode right
+                // away: small fragments share copy mbufs, large ones are
+                // still mapped zero-copy.
+                //
+                if (!build_repacked_cluster(p, qp, head, last_seg)) {
+                    return nullptr;
+                }
+                ++qp._stats.tx.repacked;
+            } else {
+                //
+                // Create a HEAD of the fragmented packet: check if frag0 has
+                // to be copied and if yes - send it in a copy way
+                //
+                if (!check_frag0(p)) {
+                    if (!copy_one_frag(qp, p.frag(0), head, last_seg, nsegs)) {
+                        return nullptr;
+                    }
+                } else if (!translate_one_frag(qp, p.frag(0), head, last_seg, nsegs)) {
                     return nullptr;
                 }
-            } else if (!translate_one_frag(qp, p.frag(0), head, last_seg, nsegs)) {
-                return nullptr;
-            }
 
-            unsigned total_nsegs = nsegs;
+                unsigned total_nsegs = nsegs;
 
-            for (unsigned i = 1; i < p.nr_frags(); i++) {
-                rte_mbuf *h = nullptr, *new_last_seg = nullptr;
-                if (!translate_one_frag(qp, p.frag(i), h, new_last_seg, nsegs)) {
-                    me(head)->recycle();
-                    return nullptr;
+                for (unsigned i = 1; i < p.nr_frags(); i++) {
+                    rte_mbuf *h = nullptr, *new_last_seg = nullptr;
+                    if (!translate_one_frag(qp, p.frag(i), h, new_last_seg, nsegs)) {
+                        me(head)->recycle();
+                        return nullptr;
+                    }
+
+                    total_nsegs += nsegs;
+
+                    // Attach a new buffers' chain to the packet chain
+                    last_seg->next = h;
+                    last_seg = new_last_seg;
                 }
 
-                total_nsegs += nsegs;
+                // Update the HEAD buffer with the packet info
+                head->pkt_len = p.len();
+                head->nb_segs = total_nsegs;
 
-                // Attach a new buffers' chain to the packet chain
-                last_seg->next = h;
-                last_seg = new_last_seg;
+                //
+                // Even a packet with few fragments may overflow the cluster
+                // limit when translated 1:1 (the 15K chunking, physically
+                // discontiguous buffers).  Rebuild it in the repacking mode
+                // before giving up on zero-copy.
+                //
+                if (head->nb_segs > max_frags) {
+                    me(head)->recycle();
+                    head = last_seg = nullptr;
+                    if (!build_repacked_cluster(p, qp, head, last_seg)) {
+                        return nullptr;
+                    }
+                    ++qp._stats.tx.repacked;
+                }
             }
 
-            // Update the HEAD buffer with the packet info
-            head->pkt_len = p.len();
-            head->nb_segs = total_nsegs;
-
             set_cluster_offload_info(p, qp, head);
 
             //
-            // If a packet hasn't been linearized already and the resulting
-            // cluster requires the linearisation due to HW limitation:
+            // If the cluster still can't be sent as built - either the
+            // layout is truly degenerate (repacking overflowed too) or a HW
+            // limitation kicks in:
             //
             //    - Recycle the cluster.
             //    - Linearize the packet.
@@ -646,6 +686,110 @@ build_mbuf_cluster:
             return me(head);
         }
 
+        /**
+         * Creates a tx_buf cluster for a packet that cannot be translated
+         * into mbufs 1:1: fragments smaller than an inline data buffer
+         * are packed together into shared copy mbufs while the large
+         * fragments are still mapped zero-copy, so the bulk of the data
+         * is never copied.
+         *
+         * @param p packet to translate (in)
+         * @param qp dpdk_qp handle (in)
+         * @param head Head of the cluster (out)
+         * @param last_seg Last segment of the cluster (out)
+         *
+         * @return TRUE in case of success
+         */
+        static bool build_repacked_cluster(packet& p, dpdk_qp& qp,
+                                           rte_mbuf*& head, rte_mbuf*& last_seg) {
+            unsigned total_nsegs = 0;
+            // The tail mbuf of the cluster while it still has room for more
+            // copied bytes, nullptr otherwise.
+            rte_mbuf* pack_seg = nullptr;
+
+            for (unsigned i = 0; i < p.nr_frags(); i++) {
+                fragment& frag = p.frag(i);
+
+                //
+                // Large fragments are mapped zero-copy; frag0 is eligible
+                // only if its headers won't be split (see check_frag0()).
+                //
+                if (frag.size >= inline_mbuf_data_size &&
+                    (i != 0 || check_frag0(p))) {
+                    rte_mbuf *h = nullptr, *new_last_seg = nullptr;
+                    unsigned nsegs = 0;
+
+                    if (!translate_one_frag(qp, frag, h, new_last_seg, nsegs)) {
+                        if (head) {
+                            me(head)->recycle();
+                        }
+                        return false;
+                    }
+
+                    if (!head) {
+                        head = h;
+                    } else {
+                        last_seg->next = h;
+                    }
+                    last_seg = new_last_seg;
+                    total_nsegs += nsegs;
+
+                    // The next copied fragment has to go after this one, not
+                    // into a half-filled mbuf earlier in the chain.
+                    pack_seg = nullptr;
+                    continue;
+                }
+
+                //
+                // A small fragment - pack it into the tail copy mbuf,
+                // chaining a new one each time the current fills up.
+                //
+                size_t left_to_set = frag.size;
+                char* base = frag.base;
+
+                while (left_to_set) {
+                    if (!pack_seg || pack_seg->data_len == inline_mbuf_data_size) {
+                        tx_buf* buf = qp.get_tx_buf();
+                        if (!buf) {
+                            if (head) {
+                                me(head)->recycle();
+                            }
+                            return false;
+                        }
+
+                        pack_seg = buf->rte_mbuf_p();
+                        pack_seg->data_len = 0;
+
+                        if (!head) {
+                            head = pack_seg;
+                        } else {
+                            last_seg->next = pack_seg;
+                        }
+                        last_seg = pack_seg;
+                        total_nsegs++;
+                    }
+
+                    size_t to_copy = std::min(left_to_set,
+                            inline_mbuf_data_size - pack_seg->data_len);
+
+                    memcpy(rte_pktmbuf_mtod_offset(pack_seg, void*, pack_seg->data_len),
+                           base, to_copy);
+
+                    pack_seg->data_len += to_copy;
+                    base += to_copy;
+                    left_to_set -= to_copy;
+                }
+
+                qp._stats.tx.good.update_copy_stats(1, frag.size);
+            }
+
+            // Update the HEAD buffer with the packet info
+            head->pkt_len = p.len();
+            head->nb_segs = total_nsegs;
+
+            return true;
+        }
+
         /**
          * Copy the contents of the "packet" into the given cluster of
          * rte_mbuf's.
@@ -1270,10 +1414,19 @@ private:
      *
      * @param m mbuf to update
      */
-    static bool refill_rx_mbuf(rte_mbuf* m, size_t size = mbuf_data_size) {
+    bool refill_rx_mbuf(rte_mbuf* m, size_t size = mbuf_data_size) {
         char* data;
 
-        if (posix_memalign((void**)&data, size, size)) {
+        if (!_rx_buf_cache.empty()) {
+            //
+            // Recycling fast path: reuse a buffer the stack has released on
+            // this engine.  It's already properly aligned, so the translation
+            // below is the only remaining work.
+            //
+            data = _rx_buf_cache.back();
+            _rx_buf_cache.pop_back();
+        } else if (posix_memalign((void**)&data, size, size)) {
+            ++_rx_refill_failures;
             return false;
         }
 
@@ -1295,8 +1448,8 @@ private:
         return true;
     }
 
-    static bool init_noninline_rx_mbuf(rte_mbuf* m,
-                                       size_t size = mbuf_data_size) {
+    bool init_noninline_rx_mbuf(rte_mbuf* m,
+                                size_t size = mbuf_data_size) {
         if (!refill_rx_mbuf(m, size)) {
             return false;
         }
@@ -1306,6 +1459,25 @@ private:
         return true;
     }
 
+    /**
+     * Takes back a data buffer the stack has released.
+     *
+     * Cheap only on the home engine: the cache is not thread-safe, so
+     * buffers released on other shards (forwarded packets) go back to the
+     * allocator as before.
+     *
+     * @param data buffer to recycle
+     */
+    void recycle_rx_buf(char* data) {
+        if (engine().cpu_id() != _home_cpu ||
+            _rx_buf_cache.size() >= _rx_buf_cache_max) {
+            free(data);
+            return;
+        }
+
+        _rx_buf_cache.push_back(data);
+    }
+
     bool init_rx_mbuf_pool();
     bool rx_gc();
     bool refill_one_cluster(rte_mbuf* head);
@@ -1339,6 +1511,65 @@ private:
      */
     bool poll_rx_once();
 
+#if RTE_VERSION >= RTE_VERSION_NUM(2,1,0,0)
+    /**
+     * Hooks this queue's Rx interrupt into the reactor's sleep path.
+     *
+     * The interrupt eventfd is wired into a dedicated epoll fd which in
+     * turn is watched by the reactor, so an incoming packet wakes a
+     * sleeping reactor up.  Failure leaves the queue in pure poll mode.
+     */
+    void init_rx_interrupts() {
+        auto epfd = file_desc::epoll_create(EPOLL_CLOEXEC);
+        if (rte_eth_dev_rx_intr_ctl_q(_dev->port_idx(), _qid, epfd.get(),
+                                      RTE_INTR_EVENT_ADD, nullptr)) {
+            printf("Port %d queue %d: Rx interrupts unavailable - "
+                   "staying in poll mode\n", _dev->port_idx(), _qid);
+            return;
+        }
+        _rx_intr_epfd = epfd.get();
+        _rx_intr_pfd.emplace(std::move(epfd));
+    }
+
+    /**
+     * Arms the Rx interrupt and allows the reactor to sleep.  Called
+     * once polls have come back empty for the idle dwell time (see
+     * --idle-poll-time-us), not on every empty poll.
+     *
+     * @return TRUE if the reactor may sleep: packets arriving while it
+     *         does will wake it through the interrupt eventfd
+     */
+    bool try_enter_rx_interrupt_mode() {
+        if (rte_eth_dev_rx_intr_enable(_dev->port_idx(), _qid)) {
+            return false;
+        }
+
+        // Close the race with packets that arrived after the last empty
+        // poll but before the interrupt was armed.
+        if (poll_rx_once()) {
+            rte_eth_dev_rx_intr_disable(_dev->port_idx(), _qid);
+            return false;
+        }
+
+        if (!_rx_intr_armed) {
+            _rx_intr_pfd->readable().then([this] {
+                // Consume and ack the interrupt; the wakeup itself has
+                // already returned the reactor to poll mode.
+                rte_epoll_event event;
+                rte_epoll_wait(_rx_intr_epfd, &event, 1, 0);
+                _rx_intr_armed = false;
+            });
+            _rx_intr_armed = true;
+        }
+
+        return true;
+    }
+
+    void exit_rx_interrupt_mode() {
+        rte_eth_dev_rx_intr_disable(_dev->port_idx(), _qid);
+    }
+#endif // RTE_VERSION >= RTE_VERSION_NUM(2,1,0,0)
+
     /**
      * Translates an rte_mbuf's into net::packet and feeds them to _rx_stream.
      *
@@ -1371,6 +1602,11 @@ private:
     rte_mempool *_pktmbuf_pool_rx;
     std::vector<rte_mbuf*> _rx_free_pkts;
     std::vector<rte_mbuf*> _rx_free_bufs;
+    std::vector<char*> _rx_buf_cache;
+    size_t _rx_buf_cache_max = 0;
+    unsigned _home_cpu = engine().cpu_id();
+    uint64_t _rx_refill_failures = 0;
+    unsigned _rx_pool_free_lwm = 0;
     std::vector<fragment> _frags;
     std::vector<char*> _bufs;
     size_t _num_rx_free_segs = 0;
@@ -1378,6 +1614,9 @@ private:
     std::unique_ptr<void, free_deleter> _rx_xmem;
     tx_buf_factory _tx_buf_factory;
     std::experimental::optional<reactor::poller> _rx_poller;
+    std::experimental::optional<pollable_fd> _rx_intr_pfd;
+    int _rx_intr_epfd = -1;
+    bool _rx_intr_armed = false;
     reactor::poller _tx_gc_poller;
     std::vector<rte_mbuf*> _tx_burst;
     uint16_t _tx_burst_idx = 0;
@@ -1459,6 +1698,18 @@ int dpdk_device::init_port_start()
     /* for port configuration all features are off by default */
     rte_eth_conf port_conf = { 0 };
 
+#if RTE_VERSION >= RTE_VERSION_NUM(2,1,0,0)
+    // Ask for the Rx interrupt infrastructure when requested; the queues
+    // arm the interrupts themselves, and only when they idle (see
+    // dpdk_qp::try_enter_rx_interrupt_mode()).
+    port_conf.intr_conf.rxq = _rx_intr_enabled;
+#else
+    if (_rx_intr_enabled) {
+        printf("Rx interrupts need DPDK 2.1 or later - staying in poll mode\n");
+        _rx_intr_enabled = false;
+    }
+#endif
+
     printf("Port %d: max_rx_queues %d max_tx_queues %d\n",
            _port_idx, _dev_info.max_rx_queues, _dev_info.max_tx_queues);
 
@@ -1713,9 +1964,10 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
 {
     using namespace memory;
     sstring name = sstring(pktmbuf_pool_name) + to_sstring(_qid) + "_rx";
+    uint16_t nr_mbufs = _dev->rx_mbufs_per_queue();
 
     printf("Creating Rx mbuf pool '%s' [%u mbufs] ...\n",
-           name.c_str(), mbufs_per_queue_rx);
+           name.c_str(), nr_mbufs);
 
     //
     // If we have a hugetlbfs memory backend we may perform a virt2phys
@@ -1726,7 +1978,7 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
     if (HugetlbfsMemBackend) {
         std::vector<phys_addr_t> mappings;
 
-        _rx_xmem.reset(alloc_mempool_xmem(mbufs_per_queue_rx, mbuf_overhead,
+        _rx_xmem.reset(alloc_mempool_xmem(nr_mbufs, mbuf_overhead,
                                           mappings));
         if (!_rx_xmem.get()) {
             printf("Can't allocate a memory for Rx buffers\n");
@@ -1741,7 +1993,7 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
         roomsz.mbuf_data_room_size = mbuf_data_size + RTE_PKTMBUF_HEADROOM;
         _pktmbuf_pool_rx =
                 rte_mempool_xmem_create(name.c_str(),
-                                   mbufs_per_queue_rx, mbuf_overhead,
+                                   nr_mbufs, mbuf_overhead,
                                    mbuf_cache_size,
                                    sizeof(struct rte_pktmbuf_pool_private),
                                    rte_pktmbuf_pool_init, as_cookie(roomsz),
@@ -1752,15 +2004,19 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
                                    page_bits);
 
         // reserve the memory for Rx buffers containers
-        _rx_free_pkts.reserve(mbufs_per_queue_rx);
-        _rx_free_bufs.reserve(mbufs_per_queue_rx);
+        _rx_free_pkts.reserve(nr_mbufs);
+        _rx_free_bufs.reserve(nr_mbufs);
+
+        // ... and for the data buffers recycling cache
+        _rx_buf_cache_max = nr_mbufs;
+        _rx_buf_cache.reserve(_rx_buf_cache_max);
 
         //
         // 1) Pull all entries from the pool.
         // 2) Bind data buffers to each of them.
         // 3) Return them back to the pool.
         //
-        for (int i = 0; i < mbufs_per_queue_rx; i++) {
+        for (int i = 0; i < nr_mbufs; i++) {
             rte_mbuf* m = rte_pktmbuf_alloc(_pktmbuf_pool_rx);
             assert(m);
             _rx_free_bufs.push_back(m);
@@ -1783,7 +2039,7 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
         roomsz.mbuf_data_room_size = inline_mbuf_data_size + RTE_PKTMBUF_HEADROOM;
         _pktmbuf_pool_rx =
                 rte_mempool_create(name.c_str(),
-                               mbufs_per_queue_rx, inline_mbuf_size,
+                               nr_mbufs, inline_mbuf_size,
                                mbuf_cache_size,
                                sizeof(struct rte_pktmbuf_pool_private),
                                rte_pktmbuf_pool_init, as_cookie(roomsz),
@@ -1791,6 +2047,10 @@ bool dpdk_qp<HugetlbfsMemBackend>::init_rx_mbuf_pool()
                                rte_socket_id(), 0);
     }
 
+    if (_pktmbuf_pool_rx) {
+        _rx_pool_free_lwm = rte_mempool_count(_pktmbuf_pool_rx);
+    }
+
     return _pktmbuf_pool_rx != nullptr;
 }
 
@@ -1891,10 +2151,42 @@ dpdk_qp<HugetlbfsMemBackend>::dpdk_qp(dpdk_device* dev, uint8_t qid,
                     , scollectd::make_typed(scollectd::data_type::DERIVE
                     , _stats.rx.bad.no_mem)
     ));
+
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id(
+                      _stats_plugin_name
+                    , scollectd::per_cpu_plugin_instance
+                    , "if_rx_errors", "Refill Failures")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE
+                    , _rx_refill_failures)
+    ));
+
+    // Low-water-mark of free entries in the Rx mempool: how close bursts
+    // have come to exhausting it (see --dpdk-rx-mbufs).
+    _collectd_regs.push_back(
+        scollectd::add_polled_metric(scollectd::type_instance_id(
+                      _stats_plugin_name
+                    , scollectd::per_cpu_plugin_instance
+                    , "queue_length", "rx-pool-free-lwm")
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                    , _rx_pool_free_lwm)
+    ));
 }
 
 template <bool HugetlbfsMemBackend>
 void dpdk_qp<HugetlbfsMemBackend>::rx_start() {
+#if RTE_VERSION >= RTE_VERSION_NUM(2,1,0,0)
+    if (_dev->rx_interrupts_enabled()) {
+        init_rx_interrupts();
+    }
+    if (_rx_intr_pfd) {
+        _rx_poller = reactor::poller::interruptible(
+                [&] { return poll_rx_once(); },
+                [&] { return try_enter_rx_interrupt_mode(); },
+                [&] { exit_rx_interrupt_mode(); });
+        return;
+    }
+#endif
     _rx_poller = reactor::poller::simple([&] { return poll_rx_once(); });
 }
 
@@ -1978,9 +2270,9 @@ dpdk_qp<true>::from_mbuf_lro(rte_mbuf* m)
 
     return packet(_frags.begin(), _frags.end(),
                   make_deleter(deleter(),
-                          [bufs_vec = std::move(_bufs)] {
+                          [this, bufs_vec = std::move(_bufs)] {
                               for (auto&& b : bufs_vec) {
-                                  free(b);
+                                  recycle_rx_buf(b);
                               }
                           }));
 }
@@ -1995,7 +2287,9 @@ inline std::experimental::optional<packet> dpdk_qp<true>::from_mbuf(rte_mbuf* m)
         char* data = rte_pktmbuf_mtod(m, char*);
 
         return packet(fragment{data, rte_pktmbuf_data_len(m)},
-                      make_free_deleter(data));
+                      make_deleter(deleter(), [this, data] {
+                          recycle_rx_buf(data);
+                      }));
     } else {
         return from_mbuf_lro(m);
     }
@@ -2023,6 +2317,16 @@ template <bool HugetlbfsMemBackend>
 bool dpdk_qp<HugetlbfsMemBackend>::rx_gc()
 {
     if (_num_rx_free_segs >= rx_gc_thresh) {
+        //
+        // Track how deeply Rx bursts drain the mempool: exported as a
+        // gauge, it tells whether --dpdk-rx-mbufs needs raising before the
+        // pool runs dry and packets get dropped.
+        //
+        auto pool_free = rte_mempool_count(_pktmbuf_pool_rx);
+        if (pool_free < _rx_pool_free_lwm) {
+            _rx_pool_free_lwm = pool_free;
+        }
+
         while (!_rx_free_pkts.empty()) {
             //
             // Use back() + pop_back() semantics to avoid an extra
@@ -2136,28 +2440,50 @@ void dpdk_device::set_rss_table()
     if (_dev_info.reta_size == 0)
         return;
 
+    // Start from an even, round-robin spread over the Rx queues
+    unsigned i = 0;
+    for (auto& r : _redir_table) {
+        r = i++ % _num_queues;
+    }
+
+    program_rss_table();
+}
+
+void dpdk_device::program_rss_table()
+{
     int reta_conf_size =
         std::max(1, _dev_info.reta_size / RTE_RETA_GROUP_SIZE);
     rte_eth_rss_reta_entry64 reta_conf[reta_conf_size];
 
-    // Configure the HW indirection table
+    // Configure the HW indirection table; reta_conf covers whole
+    // RTE_RETA_GROUP_SIZE groups, so wrap around for devices with a
+    // table smaller than one group
     unsigned i = 0;
     for (auto& x : reta_conf) {
         x.mask = ~0ULL;
         for (auto& r: x.reta) {
-            r = i++ % _num_queues;
+            r = _redir_table[i++ % _redir_table.size()];
         }
     }
 
     if (rte_eth_dev_rss_reta_update(_port_idx, reta_conf, _dev_info.reta_size)) {
         rte_exit(EXIT_FAILURE, "Port %d: Failed to update an RSS indirection table", _port_idx);
     }
+}
 
-    // Fill our local indirection table. Make it in a separate loop to keep things simple.
-    i = 0;
-    for (auto& r : _redir_table) {
-        r = i++ % _num_queues;
+void dpdk_device::update_rss_table(const std::vector<uint8_t>& reta)
+{
+    if (_dev_info.reta_size == 0) {
+        return;
     }
+
+    assert(reta.size() == _redir_table.size());
+    for (auto r : reta) {
+        assert(r < _num_queues);
+    }
+
+    _redir_table = reta;
+    program_rss_table();
 }
 
 std::unique_ptr<qp> dpdk_device::init_local_queue(boost::program_options::variables_map opts, uint16_t qid) {
@@ -2186,7 +2512,9 @@ std::unique_ptr<net::device> create_dpdk_net_device(
                                     uint8_t port_idx,
                                     uint8_t num_queues,
                                     bool use_lro,
-                                    bool enable_fc)
+                                    bool enable_fc,
+                                    uint16_t rx_mbufs_per_queue,
+                                    bool rx_interrupts)
 {
     static bool called = false;
 
@@ -2202,8 +2530,17 @@ std::unique_ptr<net::device> create_dpdk_net_device(
         printf("ports number: %d\n", rte_eth_dev_count());
     }
 
+    // PMDs need twice the ring size of buffers to refill the ring (see the
+    // mbufs_per_queue_rx definition above).
+    if (rx_mbufs_per_queue < 2 * default_ring_size) {
+        rte_exit(EXIT_FAILURE,
+                 "--dpdk-rx-mbufs has to be at least %u\n",
+                 2 * default_ring_size);
+    }
+
     return std::make_unique<dpdk::dpdk_device>(port_idx, num_queues, use_lro,
-                                               enable_fc);
+                                               enable_fc, rx_mbufs_per_queue,
+                                               rx_interrupts);
 }
 
 boost::program_options::options_description
@@ -2215,7 +2552,13 @@ get_dpdk_net_options_description()
     opts.add_options()
         ("hw-fc",
                 boost::program_options::value<std::string>()->default_value("on"),
-                "Enable HW Flow Control (on / off)");
+                "Enable HW Flow Control (on / off)")
+        ("dpdk-rx-mbufs",
+                boost::program_options::value<uint16_t>()->default_value(mbufs_per_queue_rx),
+                "Number of Rx mbufs per queue (larger values absorb longer Rx bursts without dropping packets)")
+        ("dpdk-rx-interrupts",
+                boost::program_options::value<bool>()->default_value(false),
+                "Arm Rx interrupts and let the reactor sleep when a queue idles instead of spinning at 100% CPU (needs DPDK >= 2.1 and PMD support)");
 #if 0
     opts.add_options()
         ("csum-offload",
@@ -32,7 +32,9 @@ std::unique_ptr<net::device> create_dpdk_net_device(
                                     uint8_t port_idx = 0,
                                     uint8_t num_queues = 1,
                                     bool use_lro = true,
-                                    bool enable_fc = true);
+                                    bool enable_fc = true,
+                                    uint16_t rx_mbufs_per_queue = 1024,
+                                    bool rx_interrupts = false);
 
 boost::program_options::options_description get_dpdk_net_options_description();
 
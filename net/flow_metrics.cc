@@ -0,0 +1,126 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "flow_metrics.hh"
+#include "core/reactor.hh"
+#include "core/future-util.hh"
+#include "core/print.hh"
+#include <algorithm>
+
+namespace net {
+
+constexpr unsigned flow_metrics::capacity;
+
+flow_metrics&
+flow_metrics::local() {
+    static thread_local flow_metrics instance;
+    return instance;
+}
+
+flow_metrics::entry&
+flow_metrics::touch(const flow_id& id) {
+    auto i = _index.find(id);
+    if (i != _index.end()) {
+        return _entries[i->second];
+    }
+    if (_entries.size() < capacity) {
+        _index.emplace(id, _entries.size());
+        _entries.emplace_back();
+        _entries.back().id = id;
+        return _entries.back();
+    }
+    // space-saving eviction: replace the smallest flow, and charge its
+    // count to the newcomer as an error bound, so a heavy flow that
+    // cycles through the bottom slot is never undercounted
+    auto victim = &_entries[0];
+    for (auto& e : _entries) {
+        if (e.total() < victim->total()) {
+            victim = &e;
+        }
+    }
+    _index.erase(victim->id);
+    auto inherited = victim->total();
+    *victim = entry{};
+    victim->id = id;
+    victim->error = inherited;
+    _index.emplace(id, unsigned(victim - _entries.data()));
+    return *victim;
+}
+
+void
+flow_metrics::account_retransmit(const flow_id& id, uint64_t nr) {
+    if (!_enabled || !nr) {
+        return;
+    }
+    auto i = _index.find(id);
+    if (i != _index.end()) {
+        _entries[i->second].retransmits += nr;
+    }
+}
+
+static sstring
+format_endpoint(uint32_t ip, uint16_t port) {
+    return sprint("%d.%d.%d.%d:%d",
+            (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff,
+            port);
+}
+
+sstring
+flow_metrics::dump(unsigned k, bool reset) {
+    auto sorted = _entries;
+    std::sort(sorted.begin(), sorted.end(), [] (const entry& a, const entry& b) {
+        return a.total() > b.total();
+    });
+    if (sorted.size() > k) {
+        sorted.resize(k);
+    }
+    sstring out;
+    for (auto& e : sorted) {
+        out += sprint("shard %2d %s <-> %s tx %d/%d rx %d/%d retx %d",
+                engine().cpu_id(),
+                format_endpoint(e.id.local_ip, e.id.local_port),
+                format_endpoint(e.id.foreign_ip, e.id.foreign_port),
+                e.tx_bytes, e.tx_packets, e.rx_bytes, e.rx_packets,
+                e.retransmits);
+        if (e.error) {
+            out += sprint(" (bytes overcounted by up to %d)", e.error);
+        }
+        out += "\n";
+    }
+    if (reset) {
+        _entries.clear();
+        _index.clear();
+    }
+    return out;
+}
+
+future<sstring>
+flow_metrics::dump_all(unsigned k, bool reset) {
+    return map_reduce(smp::all_cpus(), [k, reset] (unsigned id) {
+        return smp::submit_to(id, [k, reset] {
+            return local().dump(k, reset);
+        });
+    }, sstring(), [] (sstring a, sstring b) {
+        return a + b;
+    });
+}
+
+}
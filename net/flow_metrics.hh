@@ -0,0 +1,116 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "core/sstring.hh"
+#include "core/future.hh"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace net {
+
+/// One TCP connection, as seen from this host.  Addresses and ports are
+/// in host byte order, matching ipv4_addr.
+struct flow_id {
+    uint32_t local_ip;
+    uint32_t foreign_ip;
+    uint16_t local_port;
+    uint16_t foreign_port;
+    bool operator==(const flow_id& o) const {
+        return local_ip == o.local_ip && foreign_ip == o.foreign_ip
+            && local_port == o.local_port && foreign_port == o.foreign_port;
+    }
+};
+
+struct flow_id_hash {
+    size_t operator()(const flow_id& id) const {
+        auto x = (uint64_t(id.local_ip) << 32) | id.foreign_ip;
+        x ^= (uint64_t(id.local_port) << 16) | id.foreign_port;
+        return std::hash<uint64_t>()(x);
+    }
+};
+
+/// \brief Per-shard top-K connection byte/packet/retransmit counters.
+///
+/// A server can carry millions of connections, so exact per-connection
+/// counters are off the table; this keeps the space-saving summary
+/// instead: a fixed table of \c capacity entries where the smallest
+/// entry is evicted when a new flow appears, and the newcomer inherits
+/// the evicted byte count as its error bound.  Heavy flows ("elephants")
+/// are therefore always present with at most that much overcounting,
+/// while mice churn through the bottom of the table.
+///
+/// Accounting is a no-op unless --net-flow-metrics is set, so the
+/// data path pays one predictable branch when the feature is off.
+class flow_metrics {
+public:
+    static constexpr unsigned capacity = 64;
+    struct entry {
+        flow_id id;
+        uint64_t tx_bytes = 0;
+        uint64_t rx_bytes = 0;
+        uint64_t tx_packets = 0;
+        uint64_t rx_packets = 0;
+        uint64_t retransmits = 0;
+        uint64_t error = 0; // bytes possibly inherited from evicted flows
+        uint64_t total() const { return tx_bytes + rx_bytes + error; }
+    };
+private:
+    bool _enabled = false;
+    std::vector<entry> _entries;
+    std::unordered_map<flow_id, unsigned, flow_id_hash> _index;
+    entry& touch(const flow_id& id);
+public:
+    bool enabled() const { return _enabled; }
+    // set from --net-flow-metrics in reactor::configure(), per shard
+    void set_enabled(bool enabled) { _enabled = enabled; }
+    void account_tx(const flow_id& id, uint64_t bytes) {
+        if (_enabled) {
+            auto& e = touch(id);
+            e.tx_bytes += bytes;
+            ++e.tx_packets;
+        }
+    }
+    void account_rx(const flow_id& id, uint64_t bytes) {
+        if (_enabled) {
+            auto& e = touch(id);
+            e.rx_bytes += bytes;
+            ++e.rx_packets;
+        }
+    }
+    /// Counts retransmissions for a flow already in the table; a flow
+    /// too small to have a slot isn't worth a slot for its retransmits.
+    void account_retransmit(const flow_id& id, uint64_t nr = 1);
+    /// The raw table, in no particular order.
+    const std::vector<entry>& entries() const { return _entries; }
+    /// Returns the top \c k flows by total bytes, one text line each,
+    /// heaviest first.  With \c reset, the table is cleared afterwards
+    /// so the next dump shows rates over the interval since this one.
+    sstring dump(unsigned k, bool reset);
+    /// Returns this shard's tracker.
+    static flow_metrics& local();
+    /// Dumps every shard, returning the concatenated lines.
+    static future<sstring> dump_all(unsigned k, bool reset);
+};
+
+}
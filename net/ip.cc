@@ -100,7 +100,7 @@ bool ipv4::needs_frag(packet& p, ip_protocol_num prot_num, net::hw_features hw_f
         return false;
     }
 
-    if ((prot_num == ip_protocol_num::tcp && hw_features.tx_tso) ||
+    if ((prot_num == ip_protocol_num::tcp && hw_features.can_tx_tso()) ||
         (prot_num == ip_protocol_num::udp && hw_features.tx_ufo)) {
         return false;
     }
@@ -117,6 +117,7 @@ ipv4::handle_received_packet(packet p, ethernet_address from) {
 
     // Skip checking csum of reassembled IP datagram
     if (!hw_features().rx_csum_offload && !p.offload_info_ref().reassembled) {
+        ++sw_offload_fallback_stats::local().rx_ip_csum;
         checksummer csum;
         csum.sum(reinterpret_cast<char*>(iph), sizeof(*iph));
         if (csum.get() != 0) {
@@ -178,7 +179,7 @@ ipv4::handle_received_packet(packet p, ethernet_address from) {
         if (frag.is_complete()) {
             // All the fragments are received
             auto dropped_size = frag.mem_size;
-            auto& ip_data = frag.data.map.begin()->second;
+            auto& ip_data = frag.data.segments.begin()->second;
             // Choose a cpu to forward this packet
             auto cpu_id = engine().cpu_id();
             auto l4 = _l4[h.ip_proto];
@@ -188,7 +189,7 @@ ipv4::handle_received_packet(packet p, ethernet_address from) {
                 hash_data.push_back(hton(h.src_ip.ip));
                 hash_data.push_back(hton(h.dst_ip.ip));
                 l4->forward(hash_data, ip_data, l4_offset);
-                cpu_id = _netif->hash2cpu(toeplitz_hash(_netif->rss_key(), hash_data));
+                cpu_id = _netif->hash2cpu(_netif->rss_hasher().hash(hash_data));
             }
 
             // No need to forward if the dst cpu is the current cpu
@@ -265,6 +266,7 @@ void ipv4::send(ipv4_address to, ip_protocol_num proto_num, packet p, ethernet_a
             iph->csum = 0;
             pkt.offload_info_ref().needs_ip_csum = true;
         } else {
+            ++sw_offload_fallback_stats::local().tx_ip_csum;
             checksummer csum;
             csum.sum(reinterpret_cast<char*>(iph), sizeof(*iph));
             iph->csum = csum.get();
@@ -414,7 +416,7 @@ int32_t ipv4::frag::merge(ip_hdr &h, uint16_t offset, packet p) {
     data.merge(offset, std::move(p));
     // Update mem size
     mem_size = header.memory();
-    for (const auto& x : data.map) {
+    for (const auto& x : data.segments) {
         mem_size += x.second.memory();
     }
     auto added_size = mem_size - old;
@@ -424,14 +426,14 @@ int32_t ipv4::frag::merge(ip_hdr &h, uint16_t offset, packet p) {
 bool ipv4::frag::is_complete() {
     // If all the fragments are received, ipv4::frag::merge() should merge all
     // the fragments into a single packet
-    auto offset = data.map.begin()->first;
-    auto nr_packet = data.map.size();
+    auto offset = data.segments.begin()->first;
+    auto nr_packet = data.segments.size();
     return last_frag_received && nr_packet == 1 && offset == 0;
 }
 
 packet ipv4::frag::get_assembled_packet(ethernet_address from, ethernet_address to) {
     auto& ip_header = header;
-    auto& ip_data = data.map.begin()->second;
+    auto& ip_data = data.segments.begin()->second;
     // Append a ethernet header, needed for forwarding
     auto eh = ip_header.prepend_header<eth_hdr>();
     eh->src_mac = from;
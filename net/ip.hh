@@ -51,6 +51,7 @@ struct ipv4_address;
 
 template <typename InetTraits>
 class tcp;
+class tcp_rx_coalescer;
 
 struct ipv4_address {
     ipv4_address() : ip(0) {}
@@ -145,6 +146,7 @@ public:
     ipv4_l4(ipv4& inet) : _inet(inet) {}
     void register_packet_provider(ipv4_traits::packet_provider_type func);
     future<ethernet_address> get_l2_dst_address(ipv4_address to);
+    uint64_t l2_dst_generation() const;
 };
 
 class ip_protocol {
@@ -185,6 +187,8 @@ struct l4connid {
 class ipv4_tcp final : public ip_protocol {
     ipv4_l4<ip_protocol_num::tcp> _inet_l4;
     std::unique_ptr<tcp<ipv4_traits>> _tcp;
+    // merges in-order data segments within a poll batch; see tcp.cc
+    std::unique_ptr<tcp_rx_coalescer> _coalescer;
 public:
     ipv4_tcp(ipv4& inet);
     ~ipv4_tcp();
@@ -257,6 +261,7 @@ private:
     circular_buffer<ipv4_traits::l4packet> _packetq;
 private:
     uint16_t next_port(uint16_t port);
+    void prepare_datagram(uint16_t src_port, ipv4_addr dst, packet& p);
 public:
     class registration {
     private:
@@ -278,6 +283,9 @@ public:
     udp_channel make_channel(ipv4_addr addr);
     virtual void received(packet p, ipv4_address from, ipv4_address to) override;
     void send(uint16_t src_port, ipv4_addr dst, packet &&p);
+    // Sends a batch of datagrams to one destination, resolving the L2
+    // address once for the whole batch
+    void send_batch(uint16_t src_port, ipv4_addr dst, std::vector<packet> ps);
     bool forward(forward_hash& out_hash_data, packet& p, size_t off) override;
     void set_queue_size(int size) { _queue_size = size; }
 };
@@ -408,6 +416,9 @@ public:
         _pkt_providers.push_back(std::move(func));
     }
     future<ethernet_address> get_l2_dst_address(ipv4_address to);
+    // Generation counter of the neighbor table behind
+    // get_l2_dst_address(); a cached result is valid while it matches
+    uint64_t l2_dst_generation() const { return _arp.generation(); }
 };
 
 template <ip_protocol_num ProtoNum>
@@ -428,6 +439,12 @@ future<ethernet_address> ipv4_l4<ProtoNum>::get_l2_dst_address(ipv4_address to)
     return _inet.get_l2_dst_address(to);
 }
 
+template <ip_protocol_num ProtoNum>
+inline
+uint64_t ipv4_l4<ProtoNum>::l2_dst_generation() const {
+    return _inet.l2_dst_generation();
+}
+
 struct ip_hdr {
     uint8_t ihl : 4;
     uint8_t ver : 4;
@@ -90,7 +90,9 @@ void create_native_net_device(boost::program_options::variables_map opts) {
         // TODO: Inherit it from the opts
         dev = create_dpdk_net_device(0, smp::count,
             !(opts.count("lro") && opts["lro"].as<std::string>() == "off"),
-            !(opts.count("hw-fc") && opts["hw-fc"].as<std::string>() == "off"));
+            !(opts.count("hw-fc") && opts["hw-fc"].as<std::string>() == "off"),
+            opts["dpdk-rx-mbufs"].as<uint16_t>(),
+            opts["dpdk-rx-interrupts"].as<bool>());
     } else
 #endif
     dev = create_virtio_net_device(opts);
@@ -199,6 +201,18 @@ native_network_stack::native_network_stack(boost::program_options::variables_map
         _inet.set_gw_address(ipv4_address(opts["gw-ipv4-addr"].as<std::string>()));
         _inet.set_netmask_address(ipv4_address(opts["netmask-ipv4-addr"].as<std::string>()));
     }
+    if (opts.count("static-arp")) {
+        // Pre-populate the neighbor cache so the first packet to a known
+        // peer (typically the gateway) does not wait for an ARP round-trip.
+        for (auto& entry : opts["static-arp"].as<std::vector<std::string>>()) {
+            auto pos = entry.find('=');
+            if (pos == std::string::npos) {
+                throw std::runtime_error("invalid --static-arp entry, expected IP=MAC: " + entry);
+            }
+            _inet.learn(parse_ethernet_address(entry.substr(pos + 1)),
+                        ipv4_address(entry.substr(0, pos)));
+        }
+    }
 }
 
 server_socket
@@ -272,11 +286,13 @@ void native_network_stack::on_dhcp(bool success, const dhcp::lease & res, bool i
 }
 
 future<> native_network_stack::initialize() {
+    if (!_dhcp) {
+        // Statically configured: addresses (and any --static-arp entries)
+        // were installed at construction time, so the stack is up already
+        // and the application can start without waiting for anything.
+        return make_ready_future();
+    }
     return network_stack::initialize().then([this]() {
-        if (!_dhcp) {
-            return make_ready_future();
-        }
-
         // Only run actual discover on main cpu.
         // All other cpus must simply for main thread to complete and signal them.
         if (engine().cpu_id() == 0) {
@@ -322,6 +338,9 @@ boost::program_options::options_description nns_options() {
         ("dhcp",
                 boost::program_options::value<bool>()->default_value(true),
                         "Use DHCP discovery")
+        ("static-arp",
+                boost::program_options::value<std::vector<std::string>>()->multitoken(),
+                "Pre-populate the ARP cache with a static IP=MAC entry (may be repeated)")
         ("hw-queue-weight",
                 boost::program_options::value<float>()->default_value(1.0f),
                 "Weighing of a hardware network queue relative to a software queue (0=no work, 1=equal share)")
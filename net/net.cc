@@ -23,6 +23,7 @@
 #include <boost/asio/ip/address_v4.hpp>
 #include <boost/algorithm/string.hpp>
 #include "net.hh"
+#include "core/print.hh"
 #include <utility>
 #include "toeplitz.hh"
 
@@ -128,6 +129,17 @@ qp::qp(bool register_copy_stats,
                     , _stats.tx.linearized)
             ),
 
+            //
+            // Repacking counter: DERIVE:0:U
+            //
+            scollectd::add_polled_metric(scollectd::type_instance_id(
+                    _stats_plugin_name
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "xmit-repacked")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE
+                    , _stats.tx.repacked)
+            ),
+
             //
             // Number of packets in last bunch: GAUGE:0:U
             //
@@ -271,11 +283,91 @@ subscription<packet, ethernet_address> l3_protocol::receive(
     return _netif->register_l3(_proto_num, std::move(rx_fn), std::move(forward));
 };
 
+sw_offload_fallback_stats&
+sw_offload_fallback_stats::local() {
+    static thread_local sw_offload_fallback_stats instance;
+    return instance;
+}
+
+sstring interface::offload_diagnostics() const {
+    sstring ret = "offloads:";
+    _hw_features.for_each_offload([&ret] (const char* name, const bool& enabled) {
+        ret += sprint(" %s=%s", name, enabled ? "on" : "off");
+    });
+    auto& fb = sw_offload_fallback_stats::local();
+    ret += sprint("; sw fallbacks: tx-l4-csum=%d tx-ip-csum=%d rx-l4-csum=%d rx-ip-csum=%d tx-seg=%d",
+                  fb.tx_l4_csum, fb.tx_ip_csum, fb.rx_l4_csum, fb.rx_ip_csum, fb.tx_seg);
+    return ret;
+}
+
 interface::interface(std::shared_ptr<device> dev)
     : _dev(dev)
     , _rx(_dev->receive([this] (packet p) { return dispatch_packet(std::move(p)); }))
     , _hw_address(_dev->hw_address())
-    , _hw_features(_dev->hw_features()) {
+    , _hw_features(_dev->hw_features())
+    , _rss_hasher(_dev->rss_key())
+    , _collectd_regs({
+            //
+            // Flow steering rates: DERIVE:0:u
+            //
+            scollectd::add_polled_metric(scollectd::type_instance_id(
+                    "network"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "rx-steered-local")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE
+                    , _steering.local)
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id(
+                    "network"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "rx-steered-forward")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE
+                    , _steering.forwarded)
+            ),
+            scollectd::add_polled_metric(scollectd::type_instance_id(
+                    "network"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", "rx-sw-hash")
+                    , scollectd::make_typed(scollectd::data_type::DERIVE
+                    , _steering.sw_hashes)
+            ),
+    }) {
+    // Export the negotiated state of each offload and the per-shard
+    // software fallback counters, so deployments can verify what the
+    // device actually accelerates.
+    _hw_features.for_each_offload([this] (const char* name, const bool& enabled) {
+        _collectd_regs.push_back(
+            scollectd::add_polled_metric(scollectd::type_instance_id(
+                    "network"
+                    , scollectd::per_cpu_plugin_instance
+                    , "gauge", std::string("offload-") + name)
+                    , scollectd::make_typed(scollectd::data_type::GAUGE
+                    , enabled)
+        ));
+    });
+    auto& fb = sw_offload_fallback_stats::local();
+    struct fallback_metric { const char* name; uint64_t& counter; };
+    for (auto&& m : { fallback_metric{"sw-tx-l4-csum", fb.tx_l4_csum}
+                    , fallback_metric{"sw-tx-ip-csum", fb.tx_ip_csum}
+                    , fallback_metric{"sw-rx-l4-csum", fb.rx_l4_csum}
+                    , fallback_metric{"sw-rx-ip-csum", fb.rx_ip_csum}
+                    , fallback_metric{"sw-tx-seg", fb.tx_seg} }) {
+        _collectd_regs.push_back(
+            scollectd::add_polled_metric(scollectd::type_instance_id(
+                    "network"
+                    , scollectd::per_cpu_plugin_instance
+                    , "total_operations", m.name)
+                    , scollectd::make_typed(scollectd::data_type::DERIVE
+                    , m.counter)
+        ));
+    }
+    if (engine().cpu_id() == 0) {
+        _hw_features.for_each_offload([first = true] (const char* name, const bool& enabled) mutable {
+            print("%s%s=%s", first ? "net: offloads: " : " ", name, enabled ? "on" : "off");
+            first = false;
+        });
+        print("\n");
+    }
     dev->local_queue().register_packet_provider([this, idx = 0u] () mutable {
             std::experimental::optional<packet> p;
             for (size_t i = 0; i < _pkt_providers.size(); i++) {
@@ -319,6 +411,14 @@ const rss_key_type& interface::rss_key() const {
     return _dev->rss_key();
 }
 
+std::vector<uint8_t> interface::rss_table() const {
+    return _dev->rss_table();
+}
+
+void interface::update_rss_table(const std::vector<uint8_t>& reta) {
+    _dev->update_rss_table(reta);
+}
+
 void interface::forward(unsigned cpuid, packet p) {
     static __thread unsigned queue_depth;
 
@@ -344,16 +444,19 @@ future<> interface::dispatch_packet(packet p) {
                 if (hwrss) {
                     return hwrss.value();
                 } else {
+                    _steering.sw_hashes++;
                     forward_hash data;
                     if (l3.forward(data, p, sizeof(eth_hdr))) {
-                        return toeplitz_hash(rss_key(), data);
+                        return _rss_hasher.hash(data);
                     }
                     return 0u;
                 }
             });
             if (fw != engine().cpu_id()) {
+                _steering.forwarded++;
                 forward(fw, std::move(p));
             } else {
+                _steering.local++;
                 auto h = ntoh(*eh);
                 auto from = h.src_mac;
                 p.trim_front(sizeof(*eh));
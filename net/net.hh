@@ -82,6 +82,35 @@ struct hw_features {
     uint16_t mtu = 1500;
     // Maximun packet len when TCP/UDP offload is enabled
     uint16_t max_packet_len = net::ip_packet_len_max - net::eth_hdr_len;
+
+    // TSO takes effect only if the driver also computes the L4 checksum
+    // of every segment it produces; otherwise we must segment in software.
+    bool can_tx_tso() const { return tx_tso && tx_csum_l4_offload; }
+
+    // Enumerate the offloads above as (name, enabled) pairs, for the
+    // diagnostics and statistics registration code.
+    template <typename Func>
+    void for_each_offload(Func&& f) const {
+        f("tx-csum-ip", tx_csum_ip_offload);
+        f("tx-csum-l4", tx_csum_l4_offload);
+        f("rx-csum", rx_csum_offload);
+        f("rx-lro", rx_lro);
+        f("tx-tso", tx_tso);
+        f("tx-ufo", tx_ufo);
+    }
+};
+
+// Per-shard counters of work the stack had to do in software because the
+// device lacks (or negotiated away) the matching offload. A climbing
+// counter here means a supposedly accelerated deployment is silently
+// spending cycles on checksums or segmentation.
+struct sw_offload_fallback_stats {
+    uint64_t tx_l4_csum = 0; // L4 checksums computed in software
+    uint64_t tx_ip_csum = 0; // IP header checksums computed in software
+    uint64_t rx_l4_csum = 0; // received L4 checksums verified in software
+    uint64_t rx_ip_csum = 0; // received IP header checksums verified in software
+    uint64_t tx_seg = 0;     // payloads split to MSS-sized packets in software
+    static sw_offload_fallback_stats& local();
 };
 
 class l3_protocol {
@@ -116,7 +145,16 @@ class interface {
     subscription<packet> _rx;
     ethernet_address _hw_address;
     net::hw_features _hw_features;
+    // precomputed per-byte tables for the device's RSS key
+    toeplitz_hasher _rss_hasher;
     std::vector<l3_protocol::packet_provider_type> _pkt_providers;
+    // per-shard flow steering visibility
+    struct steering_stats {
+        uint64_t local = 0;      // packets handled on the receiving shard
+        uint64_t forwarded = 0;  // packets steered to another shard
+        uint64_t sw_hashes = 0;  // RSS hashes computed in software
+    } _steering;
+    scollectd::registrations _collectd_regs;
 private:
     future<> dispatch_packet(packet p);
 public:
@@ -132,7 +170,15 @@ public:
         _pkt_providers.push_back(std::move(func));
     }
     uint16_t hw_queues_count();
+    // One-line snapshot of the negotiated offloads and the software
+    // fallbacks taken so far on this shard, for diagnostics.
+    sstring offload_diagnostics() const;
     const rss_key_type& rss_key() const;
+    const toeplitz_hasher& rss_hasher() const { return _rss_hasher; }
+    // Current and reprogrammable hardware RSS indirection table, see
+    // device::update_rss_table()
+    std::vector<uint8_t> rss_table() const;
+    void update_rss_table(const std::vector<uint8_t>& reta);
     friend class l3_protocol;
 };
 
@@ -206,6 +252,9 @@ struct qp_stats {
     struct {
         struct qp_stats_good good;
         uint64_t linearized;       // number of packets that were linearized
+        uint64_t repacked;         // number of packets whose small fragments
+                                   // were packed into shared copy buffers
+                                   // while the large ones stayed zero-copy
     } tx;
 };
 
@@ -275,6 +324,13 @@ public:
     virtual unsigned hash2qid(uint32_t hash) {
         return hash % hw_queues_count();
     }
+    // The hardware RSS indirection table, as queue ids; empty when the
+    // device has none.
+    virtual std::vector<uint8_t> rss_table() const { return {}; }
+    // Reprograms the indirection table at runtime, so hot buckets can
+    // be rebalanced to idle queues.  The argument must have the same
+    // length as rss_table().  Ignored by devices without a table.
+    virtual void update_rss_table(const std::vector<uint8_t>& reta) {}
     void set_local_queue(std::unique_ptr<qp> dev);
     template <typename Func>
     unsigned forward_dst(unsigned src_cpuid, Func&& hashfn) {
@@ -23,132 +23,102 @@
 #define PACKET_UTIL_HH_
 
 #include "net/packet.hh"
-#include <map>
-#include <iostream>
+#include <algorithm>
+#include <vector>
 
 namespace net {
 
 template <typename Offset, typename Tag>
 class packet_merger {
 private:
+    // Collapse a stored segment back into a single fragment once it has
+    // accumulated this many, so fragment arrays and deleter chains stay
+    // bounded while a large hole is outstanding.
+    static constexpr unsigned max_frags_per_segment = 64;
     static uint64_t& linearizations_ref() {
         static thread_local uint64_t linearization_count;
         return linearization_count;
     }
+    static void append(packet& seg, packet p) {
+        seg.append(std::move(p));
+        if (seg.nr_frags() >= max_frags_per_segment) {
+            seg.linearize();
+            ++linearizations_ref();
+        }
+    }
 public:
-    std::map<Offset, packet> map;
+    // Disjoint, non-adjacent segments sorted by offset. A flat vector makes
+    // the common case - new data landing at or past the end of the last
+    // segment - an O(1) append, and fills holes with one batched splice
+    // instead of a map operation per segment.
+    std::vector<std::pair<Offset, packet>> segments;
 
     static uint64_t linearizations() {
         return linearizations_ref();
     }
 
     void merge(Offset offset, packet p) {
-        bool insert = true;
         auto beg = offset;
         auto end = beg + p.len();
-        // Fisrt, try to merge the packet with existing segment
-        for (auto it = map.begin(); it != map.end();) {
-            auto& seg_pkt = it->second;
-            auto seg_beg = it->first;
-            auto seg_end = seg_beg + seg_pkt.len();
-            // There are 6 cases:
-            if (seg_beg <= beg && end <= seg_end) {
-                // 1) seg_beg beg end seg_end
-                // We already have data in this packet
-                return;
-            } else if (beg <= seg_beg && seg_end <= end) {
-                // 2) beg seg_beg seg_end end
-                // The new segment contains more data than this old segment
-                // Delete the old one, insert the new one
-                it = map.erase(it);
-                insert = true;
-                break;
-            } else if (beg < seg_beg && seg_beg <= end && end <= seg_end) {
-                // 3) beg seg_beg end seg_end
-                // Merge two segments, trim front of old segment
-                auto trim = end - seg_beg;
-                seg_pkt.trim_front(trim);
-                p.append(std::move(seg_pkt));
-                // Delete the old one, insert the new one
-                it = map.erase(it);
-                insert = true;
-                break;
-            } else if (seg_beg <= beg && beg <= seg_end && seg_end < end) {
-                // 4) seg_beg beg seg_end end
-                // Merge two segments, trim front of new segment
-                auto trim = seg_end - beg;
-                p.trim_front(trim);
-                // Append new data to the old segment, keep the old segment
-                seg_pkt.append(std::move(p));
-                seg_pkt.linearize();
-                ++linearizations_ref();
-                insert = false;
-                break;
-            } else {
-                // 5) beg end < seg_beg seg_end
-                //   or
-                // 6) seg_beg seg_end < beg end
-                // Can not merge with this segment, keep looking
-                it++;
-                insert = true;
-            }
-        }
 
-        if (insert) {
-            p.linearize();
-            ++linearizations_ref();
-            map.emplace(beg, std::move(p));
+        // Common case: delivery resumed behind a hole, so the new segment
+        // starts at or past the end of the last one we have.
+        if (segments.empty()) {
+            segments.emplace_back(beg, std::move(p));
+            return;
+        }
+        auto last_end = segments.back().first + segments.back().second.len();
+        if (beg == last_end) {
+            append(segments.back().second, std::move(p));
+            return;
+        }
+        if (last_end < beg) {
+            segments.emplace_back(beg, std::move(p));
+            return;
         }
 
-        // Second, merge adjacent segments after this packet has been merged,
-        // becasue this packet might fill a "whole" and make two adjacent
-        // segments mergable
-        for (auto it = map.begin(); it != map.end();) {
-            // The first segment
-            auto& seg_pkt = it->second;
-            auto seg_beg = it->first;
-            auto seg_end = seg_beg + seg_pkt.len();
-
-            // The second segment
-            auto it_next = it;
-            it_next++;
-            if (it_next == map.end()) {
-                break;
+        // Slow path: the new segment overlaps or precedes stored data.
+        // Find the first stored segment starting at or after it.
+        auto it = std::lower_bound(segments.begin(), segments.end(), beg,
+                [] (const std::pair<Offset, packet>& seg, Offset off) {
+                    return seg.first < off;
+                });
+        if (it != segments.begin()) {
+            auto prev = std::prev(it);
+            auto prev_end = prev->first + prev->second.len();
+            if (end <= prev_end) {
+                // We already have all of this data
+                return;
             }
-            auto& p = it_next->second;
-            auto beg = it_next->first;
-            auto end = beg + p.len();
-
-            // Merge the the second segment into first segment if possible
-            if (seg_beg <= beg && beg <= seg_end && seg_end < end) {
-                // Merge two segments, trim front of second segment
-                auto trim = seg_end - beg;
-                p.trim_front(trim);
-                // Append new data to the first segment, keep the first segment
-                seg_pkt.append(std::move(p));
-
-                // Delete the second segment
-                map.erase(it_next);
-
-                // Keep merging this first segment with its new next packet
-                // So we do not update the iterator: it
-                continue;
-            } else if (end <= seg_end) {
-                // The first segment has all the data in the second segment
-                // Delete the second segment
-                map.erase(it_next);
-                continue;
-            } else if (seg_end < beg) {
-                // Can not merge first segment with second segment
-                it = it_next;
-                continue;
-            } else {
-                // If we reach here, we have a bug with merge.
-                std::cout << "packet_merger: merge error\n";
-                abort();
+            if (beg < prev_end) {
+                // Keep the copy we already have of the overlapping prefix
+                p.trim_front(prev_end - beg);
+                beg = prev_end;
+            }
+        }
+        // Drop stored segments the new one covers entirely, and splice the
+        // first one extending past its end onto it
+        while (it != segments.end() && it->first <= end) {
+            auto seg_end = it->first + it->second.len();
+            if (end < seg_end) {
+                it->second.trim_front(end - it->first);
+                append(p, std::move(it->second));
+                end = seg_end;
+                it = segments.erase(it);
                 break;
             }
+            it = segments.erase(it);
+        }
+        // [beg, end) no longer touches anything stored beyond it; stitch it
+        // to its predecessor if they are adjacent, otherwise insert it.
+        if (it != segments.begin()) {
+            auto prev = std::prev(it);
+            if (prev->first + prev->second.len() == beg) {
+                append(prev->second, std::move(p));
+                return;
+            }
         }
+        segments.emplace(it, beg, std::move(p));
     }
 };
 
@@ -33,6 +33,16 @@
 
 namespace net {
 
+// Headroom reserved in every packet's internal data area, so the whole
+// transmit header stack (TCP, then IP, then ethernet) serializes into
+// pre-reserved space with no allocation, like skb headroom. The default
+// covers those three headers with common options and keeps packet::impl
+// under two cache lines; override at compile time if your stack prepends
+// fatter headers.
+#ifndef SEASTAR_PACKET_HEADROOM
+#define SEASTAR_PACKET_HEADROOM (128 - 16)
+#endif
+
 struct fragment {
     char* base;
     size_t size;
@@ -75,8 +85,8 @@ struct offload_info {
 // allocations.  This is useful when adding headers.
 //
 class packet final {
-    // enough for lots of headers, not quite two cache lines:
-    static constexpr size_t internal_data_size = 128 - 16;
+    // enough for lots of headers, not quite two cache lines by default:
+    static constexpr size_t internal_data_size = SEASTAR_PACKET_HEADROOM;
     static constexpr size_t default_nr_frags = 4;
 
     struct pseudo_vector {
@@ -89,6 +99,14 @@ class packet final {
         fragment& operator[](size_t idx) { return _start[idx]; }
     };
 
+    struct impl;
+    // Deleter that returns default-sized impls to the per-shard pool
+    // below instead of the allocator.
+    struct impl_deleter {
+        void operator()(impl* i) const;
+    };
+    using impl_ptr = std::unique_ptr<impl, impl_deleter>;
+
     struct impl {
         // when destroyed, virtual destructor will reclaim resources
         deleter _deleter;
@@ -107,14 +125,21 @@ class packet final {
         impl(const impl&) = delete;
         impl(fragment frag, size_t nr_frags = default_nr_frags);
 
+        // Per-shard pool of default-sized impls - the dominant allocation
+        // on the transmit path - recycled here to bypass the allocator.
+        static constexpr size_t max_pool_size = 256;
+        static thread_local std::vector<void*> _pool;
+
         pseudo_vector fragments() { return { _frags, _nr_frags }; }
 
-        static std::unique_ptr<impl> allocate(size_t nr_frags) {
-            nr_frags = std::max(nr_frags, default_nr_frags);
-            return std::unique_ptr<impl>(new (nr_frags) impl(nr_frags));
+        static impl_ptr allocate(size_t nr_frags) {
+            // Leave a spare slot for the header fragment that transmit
+            // prepends, so adding it never copies the fragment array.
+            nr_frags = std::max(nr_frags + 1, default_nr_frags);
+            return impl_ptr(new (nr_frags) impl(nr_frags));
         }
 
-        static std::unique_ptr<impl> copy(impl* old, size_t nr) {
+        static impl_ptr copy(impl* old, size_t nr) {
             auto n = allocate(nr);
             n->_deleter = std::move(old->_deleter);
             n->_len = old->_len;
@@ -127,11 +152,11 @@ class packet final {
             return std::move(n);
         }
 
-        static std::unique_ptr<impl> copy(impl* old) {
+        static impl_ptr copy(impl* old) {
             return copy(old, old->_nr_frags);
         }
 
-        static std::unique_ptr<impl> allocate_if_needed(std::unique_ptr<impl> old, size_t extra_frags) {
+        static impl_ptr allocate_if_needed(impl_ptr old, size_t extra_frags) {
             if (old->_allocated_frags >= old->_nr_frags + extra_frags) {
                 return std::move(old);
             }
@@ -139,6 +164,11 @@ class packet final {
         }
         void* operator new(size_t size, size_t nr_frags = default_nr_frags) {
             assert(nr_frags == uint16_t(nr_frags));
+            if (nr_frags == default_nr_frags && !_pool.empty()) {
+                auto p = _pool.back();
+                _pool.pop_back();
+                return p;
+            }
             return ::operator new(size + nr_frags * sizeof(fragment));
         }
         // Matching the operator new above
@@ -179,8 +209,8 @@ class packet final {
                     to->_frags[0].base);
         }
     };
-    packet(std::unique_ptr<impl>&& impl) : _impl(std::move(impl)) {}
-    std::unique_ptr<impl> _impl;
+    packet(impl_ptr&& impl) : _impl(std::move(impl)) {}
+    impl_ptr _impl;
 public:
     static packet from_static_data(const char* data, size_t len) {
         return {fragment{const_cast<char*>(data), len}, deleter()};
@@ -308,6 +338,18 @@ public:
 
 std::ostream& operator<<(std::ostream& os, const packet& p);
 
+inline
+void packet::impl_deleter::operator()(impl* i) const {
+    auto recycle = i->_allocated_frags == default_nr_frags
+            && impl::_pool.size() < impl::max_pool_size;
+    i->~impl();
+    if (recycle) {
+        impl::_pool.push_back(i);
+    } else {
+        impl::operator delete(i);
+    }
+}
+
 inline
 packet::packet(packet&& x) noexcept
     : _impl(std::move(x._impl)) {
@@ -23,8 +23,27 @@
 #include "net.hh"
 #include "packet.hh"
 #include "api.hh"
+#include "core/memory.hh"
 #include <netinet/tcp.h>
 #include <netinet/sctp.h>
+#include <linux/errqueue.h>
+
+// Not yet present in all the kernel headers we build against
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
 
 namespace net {
 
@@ -61,6 +80,9 @@ public:
             _fd.getsockopt<unsigned>(IPPROTO_TCP, TCP_KEEPCNT)
         };
     }
+    void set_notsent_lowat(file_desc& _fd, size_t bytes) {
+        _fd.setsockopt(IPPROTO_TCP, TCP_NOTSENT_LOWAT, int(bytes));
+    }
 };
 
 template <>
@@ -98,6 +120,58 @@ public:
             params.spp_pathmaxrxt
         };
     }
+    void set_notsent_lowat(file_desc& _fd, size_t bytes) {
+        // no SCTP equivalent
+    }
+};
+
+// Moves bytes between two sockets through a kernel pipe, so they never
+// cross into userspace.  We only feed the pipe what we then drain
+// completely, so its capacity never throttles us across iterations.
+class splice_ctx {
+    static constexpr size_t chunk_size = 128 * 1024;
+    pollable_fd& _in;
+    pollable_fd& _out;
+    std::pair<file_desc, file_desc> _pipe;
+public:
+    splice_ctx(pollable_fd& in, pollable_fd& out)
+        : _in(in), _out(out), _pipe(file_desc::pipe(O_NONBLOCK | O_CLOEXEC)) {}
+    future<> run() {
+        return repeat([this] {
+            return pull().then([this] (size_t n) {
+                if (!n) { // EOF
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return push(n).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+private:
+    future<size_t> pull() {
+        auto r = _in.get_file_desc().splice_to(_pipe.second, chunk_size,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (!r) {
+            return _in.readable().then([this] {
+                return pull();
+            });
+        }
+        return make_ready_future<size_t>(*r);
+    }
+    future<> push(size_t n) {
+        if (!n) {
+            return make_ready_future<>();
+        }
+        auto r = _pipe.first.splice_to(_out.get_file_desc(), n,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (!r) {
+            return _out.writeable().then([this, n] {
+                return push(n);
+            });
+        }
+        return push(n - *r);
+    }
 };
 
 template <transport Transport>
@@ -135,6 +209,35 @@ public:
     keepalive_params get_keepalive_parameters() const override {
         return _ops::get_keepalive_parameters(_fd->get_file_desc());
     }
+    virtual void set_sndbuf(size_t bytes) override {
+        _fd->get_file_desc().setsockopt(SOL_SOCKET, SO_SNDBUF, int(bytes));
+    }
+    virtual size_t get_sndbuf() const override {
+        return _fd->get_file_desc().getsockopt<int>(SOL_SOCKET, SO_SNDBUF);
+    }
+    virtual void set_rcvbuf(size_t bytes) override {
+        _fd->get_file_desc().setsockopt(SOL_SOCKET, SO_RCVBUF, int(bytes));
+    }
+    virtual size_t get_rcvbuf() const override {
+        return _fd->get_file_desc().getsockopt<int>(SOL_SOCKET, SO_RCVBUF);
+    }
+    virtual void set_notsent_lowat(size_t bytes) override {
+        _ops::set_notsent_lowat(_fd->get_file_desc(), bytes);
+    }
+    virtual void set_busy_poll(std::chrono::microseconds us) override {
+        _fd->get_file_desc().setsockopt(SOL_SOCKET, SO_BUSY_POLL, int(us.count()));
+    }
+    virtual future<> splice_to(connected_socket_impl& to) override {
+        auto dst = dynamic_cast<posix_connected_socket_impl*>(&to);
+        if (!dst) {
+            // the other side belongs to another stack (or transport);
+            // fall back to shuttling buffers
+            return connected_socket_impl::splice_to(to);
+        }
+        return do_with(splice_ctx(*_fd, *dst->_fd), [] (splice_ctx& ctx) {
+            return ctx.run();
+        });
+    }
     friend class posix_server_socket_impl<Transport>;
     friend class posix_ap_server_socket_impl<Transport>;
     friend class posix_reuseport_server_socket_impl<Transport>;
@@ -152,6 +255,13 @@ public:
 
     virtual future<connected_socket> connect(socket_address sa, socket_address local, transport proto = transport::TCP) override {
         _fd = engine().make_pollable_fd(sa, proto);
+        if (proto == transport::TCP && posix_network_stack::tcp_fastopen_connect) {
+            try {
+                _fd->get_file_desc().setsockopt(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+            } catch (std::system_error& e) {
+                // old kernel; fall back to an ordinary handshake
+            }
+        }
         return engine().posix_connect(_fd, sa, local).then([fd = _fd, proto]() mutable {
             std::unique_ptr<connected_socket_impl> csi;
             if (proto == transport::TCP) {
@@ -176,12 +286,33 @@ public:
     }
 };
 
+template <transport Transport>
+unsigned
+posix_server_socket_impl<Transport>::pick_cpu(const socket_address& sa) {
+    if (_shard_selector) {
+        return _shard_selector(sa) % smp::count;
+    }
+    switch (_lba) {
+    case listen_options::load_balancing_algorithm::peer_address: {
+        // hash the peer IP only, so every connection from a client lands
+        // on the shard holding its session state
+        auto ip = ntoh(sa.as_posix_sockaddr_in().sin_addr.s_addr);
+        return (ip * 0x9e3779b9u >> 16) % smp::count;
+    }
+    case listen_options::load_balancing_algorithm::fixed:
+        return engine().cpu_id();
+    default: {
+        static unsigned balance = 0;
+        return balance++ % smp::count;
+    }
+    }
+}
+
 template <transport Transport>
 future<connected_socket, socket_address>
 posix_server_socket_impl<Transport>::accept() {
     return _lfd.accept().then([this] (pollable_fd fd, socket_address sa) {
-        static unsigned balance = 0;
-        auto cpu = balance++ % smp::count;
+        auto cpu = pick_cpu(sa);
 
         if (cpu == engine().cpu_id()) {
             std::unique_ptr<connected_socket_impl> csi(
@@ -197,6 +328,37 @@ posix_server_socket_impl<Transport>::accept() {
     });
 }
 
+// How many connections accept_batch() takes from the kernel in one pass.
+// Large enough to ride out a connection storm, small enough to keep the
+// reactor responsive while distributing them.
+static constexpr unsigned accept_batch_max = 16;
+
+template <transport Transport>
+future<std::vector<std::pair<connected_socket, socket_address>>>
+posix_server_socket_impl<Transport>::accept_batch() {
+    return _lfd.accept_batch(accept_batch_max).then([this] (std::vector<std::pair<pollable_fd, socket_address>> conns) {
+        std::vector<std::pair<connected_socket, socket_address>> batch;
+        batch.reserve(conns.size());
+        for (auto& c : conns) {
+            auto cpu = pick_cpu(c.second);
+            if (cpu == engine().cpu_id()) {
+                std::unique_ptr<connected_socket_impl> csi(
+                        new posix_connected_socket_impl<Transport>(make_lw_shared(std::move(c.first))));
+                batch.emplace_back(connected_socket(std::move(csi)), c.second);
+            } else {
+                smp::submit_to(cpu, [this, fd = std::move(c.first.get_file_desc()), sa = c.second] () mutable {
+                    posix_ap_server_socket_impl<Transport>::move_connected_socket(_sa, pollable_fd(std::move(fd)), sa);
+                });
+            }
+        }
+        if (batch.empty()) {
+            // Everything went to other shards; wait for a connection of our own.
+            return accept_batch();
+        }
+        return make_ready_future<std::vector<std::pair<connected_socket, socket_address>>>(std::move(batch));
+    });
+}
+
 template <transport Transport>
 void
 posix_server_socket_impl<Transport>::abort_accept() {
@@ -249,6 +411,21 @@ posix_reuseport_server_socket_impl<Transport>::accept() {
     });
 }
 
+template <transport Transport>
+future<std::vector<std::pair<connected_socket, socket_address>>>
+posix_reuseport_server_socket_impl<Transport>::accept_batch() {
+    return _lfd.accept_batch(accept_batch_max).then([] (std::vector<std::pair<pollable_fd, socket_address>> conns) {
+        std::vector<std::pair<connected_socket, socket_address>> batch;
+        batch.reserve(conns.size());
+        for (auto& c : conns) {
+            std::unique_ptr<connected_socket_impl> csi(
+                    new posix_connected_socket_impl<Transport>(make_lw_shared(std::move(c.first))));
+            batch.emplace_back(connected_socket(std::move(csi)), c.second);
+        }
+        return batch;
+    });
+}
+
 template <transport Transport>
 void
 posix_reuseport_server_socket_impl<Transport>::abort_accept() {
@@ -271,26 +448,74 @@ void  posix_ap_server_socket_impl<Transport>::move_connected_socket(socket_addre
     }
 }
 
+bool try_resolve_flow(pollable_fd& fd, flow_id& id) {
+    try {
+        auto local = fd.get_file_desc().get_address();
+        auto remote = fd.get_file_desc().get_remote_address();
+        if (local.u.sa.sa_family != AF_INET) {
+            return false;
+        }
+        id.local_ip = ntoh(local.u.in.sin_addr.s_addr);
+        id.local_port = ntoh(local.u.in.sin_port);
+        id.foreign_ip = ntoh(remote.u.in.sin_addr.s_addr);
+        id.foreign_port = ntoh(remote.u.in.sin_port);
+        return true;
+    } catch (std::system_error&) {
+        return false;
+    }
+}
+
 data_source posix_data_source(pollable_fd& fd) {
     return data_source(std::make_unique<posix_data_source_impl>(fd));
 }
 
 future<temporary_buffer<char>>
 posix_data_source_impl::get() {
-    return _fd.read_some(_buf.get_write(), _buf_size).then([this] (size_t size) {
-        _buf.trim(size);
-        auto ret = std::move(_buf);
-        _buf = temporary_buffer<char>(_buf_size);
-        return make_ready_future<temporary_buffer<char>>(std::move(ret));
+    if (!_ready.empty()) {
+        // served out of the previous readv()'s surplus, no syscall
+        auto buf = std::move(_ready.front());
+        _ready.pop_front();
+        return make_ready_future<temporary_buffer<char>>(std::move(buf));
+    }
+    memory::scoped_alloc_label label(memory::alloc_label::network);
+    _bufs.clear();
+    iovec_vector iov;
+    iov.reserve(read_batch);
+    for (unsigned i = 0; i < read_batch; i++) {
+        _bufs.emplace_back(_buf_size);
+        iov.push_back({.iov_base = _bufs.back().get_write(), .iov_len = _buf_size});
+    }
+    return _fd.read_some(iov).then([this] (size_t size) {
+        if (_flow_valid && size) {
+            flow_metrics::local().account_rx(_flow, size);
+        }
+        temporary_buffer<char> first;
+        for (auto& buf : _bufs) {
+            auto now = std::min(size, buf.size());
+            buf.trim(now);
+            size -= now;
+            if (&buf == &_bufs.front()) {
+                // an empty first buffer still signals EOF, as before
+                first = std::move(buf);
+            } else if (now) {
+                _ready.push_back(std::move(buf));
+            }
+        }
+        _bufs.clear();
+        return make_ready_future<temporary_buffer<char>>(std::move(first));
     });
 }
 
 data_sink posix_data_sink(pollable_fd& fd) {
-    return data_sink(std::make_unique<posix_data_sink_impl>(fd));
+    auto impl = std::make_unique<posix_data_sink_impl>(fd);
+    if (posix_data_sink_impl::zerocopy_opt_in) {
+        impl->try_enable_zerocopy();
+    }
+    return data_sink(std::move(impl));
 }
 
-std::vector<struct iovec> to_iovec(const packet& p) {
-    std::vector<struct iovec> v;
+iovec_vector to_iovec(const packet& p) {
+    iovec_vector v;
     v.reserve(p.nr_frags());
     for (auto&& f : p.fragments()) {
         v.push_back({.iov_base = f.base, .iov_len = f.size});
@@ -298,8 +523,8 @@ std::vector<struct iovec> to_iovec(const packet& p) {
     return v;
 }
 
-std::vector<iovec> to_iovec(std::vector<temporary_buffer<char>>& buf_vec) {
-    std::vector<iovec> v;
+iovec_vector to_iovec(std::vector<temporary_buffer<char>>& buf_vec) {
+    iovec_vector v;
     v.reserve(buf_vec.size());
     for (auto& buf : buf_vec) {
         v.push_back({.iov_base = buf.get_write(), .iov_len = buf.size()});
@@ -307,13 +532,117 @@ std::vector<iovec> to_iovec(std::vector<temporary_buffer<char>>& buf_vec) {
     return v;
 }
 
+thread_local bool posix_data_sink_impl::zerocopy_opt_in = false;
+thread_local bool posix_network_stack::tcp_fastopen_connect = false;
+
+void
+posix_data_sink_impl::try_enable_zerocopy() {
+    try {
+        _fd.get_file_desc().setsockopt(SOL_SOCKET, SO_ZEROCOPY, 1);
+        _zerocopy = true;
+    } catch (std::system_error& e) {
+        // old kernel, or a protocol without zerocopy support; keep copying
+    }
+}
+
+void
+posix_data_sink_impl::drain_zerocopy_completions() {
+    while (!_zc_pending.empty()) {
+        char control[64];
+        msghdr mh = {};
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        auto r = _fd.get_file_desc().recvmsg(&mh, MSG_ERRQUEUE);
+        if (!r) {
+            break; // nothing queued
+        }
+        for (auto cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+            auto err = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cmsg));
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // [ee_info, ee_data] is the completed send range; sequence
+            // numbers wrap, hence the signed comparison
+            auto completed_to = err->ee_data;
+            while (!_zc_pending.empty()
+                    && int32_t(_zc_pending.front().seq_end - completed_to) <= 0) {
+                _zc_pending.pop_front();
+            }
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                // the kernel copied anyway (e.g. no scatter-gather on
+                // this path), so zerocopy only adds overhead here
+                _zerocopy = false;
+            }
+        }
+    }
+}
+
+future<>
+posix_data_sink_impl::put_zerocopy(packet p) {
+    _p = std::move(p);
+    return do_with(unsigned(0), [this] (unsigned& sends) {
+        return repeat([this, &sends] {
+            return _fd.write_some_zerocopy(_p).then([this, &sends] (size_t size) {
+                sends++;
+                _p.trim_front(size);
+                return _p.len() ? stop_iteration::no : stop_iteration::yes;
+            });
+        }).then([this, &sends] {
+            // the buffers stay pinned until the error queue reports the
+            // last send of this packet complete
+            _zc_seq += sends;
+            _zc_pending.push_back({_zc_seq - 1, std::move(_p)});
+            _p.reset();
+            drain_zerocopy_completions();
+        });
+    });
+}
+
+void
+posix_data_sink_impl::account_put(size_t bytes) {
+    flow_metrics::local().account_tx(_flow, bytes);
+    if (--_tcp_info_countdown == 0) {
+        _tcp_info_countdown = tcp_info_sample_interval;
+        sample_retransmits();
+    }
+}
+
+void
+posix_data_sink_impl::sample_retransmits() {
+    if (!_tcp_info_ok) {
+        return;
+    }
+    try {
+        auto ti = _fd.get_file_desc().getsockopt<struct tcp_info>(IPPROTO_TCP, TCP_INFO);
+        if (ti.tcpi_total_retrans > _retrans_base) {
+            flow_metrics::local().account_retransmit(_flow, ti.tcpi_total_retrans - _retrans_base);
+        }
+        _retrans_base = ti.tcpi_total_retrans;
+    } catch (std::system_error&) {
+        // not TCP (e.g. sctp); bytes and packets are still accounted
+        _tcp_info_ok = false;
+    }
+}
+
 future<>
 posix_data_sink_impl::put(temporary_buffer<char> buf) {
+    if (_flow_valid) {
+        account_put(buf.size());
+    }
     return _fd.write_all(buf.get(), buf.size()).then([d = buf.release()] {});
 }
 
 future<>
 posix_data_sink_impl::put(packet p) {
+    if (_flow_valid) {
+        account_put(p.len());
+    }
+    if (_zerocopy) {
+        drain_zerocopy_completions();
+        if (p.len() >= zerocopy_threshold && _zc_pending.size() < max_zerocopy_inflight) {
+            return put_zerocopy(std::move(p));
+        }
+    }
     _p = std::move(p);
     return _fd.write_all(_p).then([this] { _p.reset(); });
 }
@@ -324,12 +653,12 @@ posix_network_stack::listen(socket_address sa, listen_options opt) {
         return _reuseport ?
             server_socket(std::make_unique<posix_reuseport_server_tcp_socket_impl>(sa, engine().posix_listen(sa, opt)))
             :
-            server_socket(std::make_unique<posix_server_tcp_socket_impl>(sa, engine().posix_listen(sa, opt)));
+            server_socket(std::make_unique<posix_server_tcp_socket_impl>(sa, engine().posix_listen(sa, opt), opt));
     } else {
         return _reuseport ?
             server_socket(std::make_unique<posix_reuseport_server_sctp_socket_impl>(sa, engine().posix_listen(sa, opt)))
             :
-            server_socket(std::make_unique<posix_server_sctp_socket_impl>(sa, engine().posix_listen(sa, opt)));
+            server_socket(std::make_unique<posix_server_sctp_socket_impl>(sa, engine().posix_listen(sa, opt), opt));
     }
 }
 
@@ -391,7 +720,7 @@ private:
     };
     struct send_ctx {
         struct msghdr _hdr;
-        std::vector<struct iovec> _iovecs;
+        iovec_vector _iovecs;
         socket_address _dst;
         packet _p;
 
@@ -409,10 +738,83 @@ private:
             _hdr.msg_iovlen = _iovecs.size();
         }
     };
+    // one recvmmsg()/sendmmsg() covers up to this many datagrams
+    static constexpr unsigned MAX_BATCH = 16;
+    struct recv_batch_ctx {
+        struct mmsghdr _mmsg[MAX_BATCH];
+        struct iovec _iov[MAX_BATCH];
+        socket_address _src_addr[MAX_BATCH];
+        cmsg_with_pktinfo _cmsg[MAX_BATCH];
+        char* _buffers[MAX_BATCH] = {};
+
+        recv_batch_ctx() {
+            memset(_mmsg, 0, sizeof(_mmsg));
+            memset(_cmsg, 0, sizeof(_cmsg));
+            for (unsigned i = 0; i < MAX_BATCH; i++) {
+                auto& hdr = _mmsg[i].msg_hdr;
+                hdr.msg_iov = &_iov[i];
+                hdr.msg_iovlen = 1;
+                hdr.msg_name = &_src_addr[i].u.sa;
+                hdr.msg_namelen = sizeof(_src_addr[i].u.sas);
+                hdr.msg_control = &_cmsg[i];
+                hdr.msg_controllen = sizeof(_cmsg[i]);
+            }
+        }
+
+        ~recv_batch_ctx() {
+            for (auto b : _buffers) {
+                delete[] b;
+            }
+        }
+
+        void prepare() {
+            for (unsigned i = 0; i < MAX_BATCH; i++) {
+                // slots whose buffer moved into a datagram get a new
+                // one; unused slots keep theirs
+                if (!_buffers[i]) {
+                    _buffers[i] = new char[MAX_DATAGRAM_SIZE];
+                    _iov[i].iov_base = _buffers[i];
+                    _iov[i].iov_len = MAX_DATAGRAM_SIZE;
+                }
+                // the kernel overwrites these on every call
+                _mmsg[i].msg_hdr.msg_namelen = sizeof(_src_addr[i].u.sas);
+                _mmsg[i].msg_hdr.msg_controllen = sizeof(_cmsg[i]);
+            }
+        }
+    };
+    struct send_batch_ctx {
+        std::vector<struct mmsghdr> _mmsg;
+        std::vector<iovec_vector> _iovecs;
+        socket_address _dst;
+        std::vector<packet> _ps;
+
+        void prepare(ipv4_addr dst, std::vector<packet> ps) {
+            _dst = make_ipv4_address(dst);
+            _ps = std::move(ps);
+            _iovecs.resize(_ps.size());
+            _mmsg.assign(_ps.size(), mmsghdr{});
+            for (size_t i = 0; i < _ps.size(); i++) {
+                _iovecs[i] = to_iovec(_ps[i]);
+                auto& hdr = _mmsg[i].msg_hdr;
+                hdr.msg_name = &_dst.u.sa;
+                hdr.msg_namelen = sizeof(_dst.u.sas);
+                hdr.msg_iov = _iovecs[i].data();
+                hdr.msg_iovlen = _iovecs[i].size();
+            }
+        }
+
+        void clear() {
+            _mmsg.clear();
+            _iovecs.clear();
+            _ps.clear();
+        }
+    };
     std::unique_ptr<pollable_fd> _fd;
     ipv4_addr _address;
     recv_ctx _recv;
     send_ctx _send;
+    recv_batch_ctx _recv_batch;
+    send_batch_ctx _send_batch;
     bool _closed;
 public:
     posix_udp_channel(ipv4_addr bind_address)
@@ -429,8 +831,10 @@ public:
     }
     virtual ~posix_udp_channel() { if (!_closed) close(); };
     virtual future<udp_datagram> receive() override;
+    virtual future<std::vector<udp_datagram>> receive_batch() override;
     virtual future<> send(ipv4_addr dst, const char *msg);
     virtual future<> send(ipv4_addr dst, packet p);
+    virtual future<> send_batch(ipv4_addr dst, std::vector<packet> ps) override;
     virtual void close() override {
         _closed = true;
         _fd.reset();
@@ -451,6 +855,23 @@ future<> posix_udp_channel::send(ipv4_addr dst, packet p) {
             .then([len] (size_t size) { assert(size == len); });
 }
 
+future<> posix_udp_channel::send_batch(ipv4_addr dst, std::vector<packet> ps) {
+    _send_batch.prepare(dst, std::move(ps));
+    return do_with(unsigned(0), [this] (unsigned& sent) {
+        return repeat([this, &sent] {
+            auto n = _send_batch._mmsg.size() - sent;
+            if (!n) {
+                _send_batch.clear();
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return _fd->sendmmsg(_send_batch._mmsg.data() + sent, n).then([&sent] (size_t size) {
+                sent += size;
+                return stop_iteration::no;
+            });
+        });
+    });
+}
+
 udp_channel
 posix_network_stack::make_udp_channel(ipv4_addr addr) {
     return udp_channel(std::make_unique<posix_udp_channel>(addr));
@@ -479,4 +900,23 @@ posix_udp_channel::receive() {
     });
 }
 
+future<std::vector<udp_datagram>>
+posix_udp_channel::receive_batch() {
+    _recv_batch.prepare();
+    return _fd->recvmmsg(_recv_batch._mmsg, MAX_BATCH).then([this] (size_t n) {
+        std::vector<udp_datagram> ret;
+        ret.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            auto size = _recv_batch._mmsg[i].msg_len;
+            auto dst = ipv4_addr(_recv_batch._cmsg[i].pktinfo.ipi_addr.s_addr, _address.port);
+            auto buf = _recv_batch._buffers[i];
+            // ownership moves into the packet; prepare() replaces the buffer
+            _recv_batch._buffers[i] = nullptr;
+            ret.emplace_back(std::make_unique<posix_datagram>(
+                _recv_batch._src_addr[i], dst, packet(fragment{buf, size}, make_deleter([buf] { delete[] buf; }))));
+        }
+        return make_ready_future<std::vector<udp_datagram>>(std::move(ret));
+    });
+}
+
 }
@@ -24,7 +24,9 @@
 
 #include "core/reactor.hh"
 #include "stack.hh"
+#include "flow_metrics.hh"
 #include <boost/program_options.hpp>
+#include <deque>
 
 namespace net {
 
@@ -33,27 +35,80 @@ using namespace seastar;
 data_source posix_data_source(pollable_fd& fd);
 data_sink posix_data_sink(pollable_fd& fd);
 
+// getsockname/getpeername on fd; false when the socket has no IPv4
+// 5-tuple (not connected, unix domain, ...), in which case the flow
+// simply goes unaccounted
+bool try_resolve_flow(pollable_fd& fd, flow_id& id);
+
 class posix_data_source_impl final : public data_source_impl {
+    // read this many buffers with a single readv(); get() hands out
+    // the surplus without further syscalls
+    static constexpr unsigned read_batch = 4;
     pollable_fd& _fd;
-    temporary_buffer<char> _buf;
+    std::vector<temporary_buffer<char>> _bufs;
+    std::deque<temporary_buffer<char>> _ready;
     size_t _buf_size;
+    flow_id _flow;
+    bool _flow_valid = false;
 public:
     explicit posix_data_source_impl(pollable_fd& fd, size_t buf_size = 8192)
-        : _fd(fd), _buf(buf_size), _buf_size(buf_size) {}
+        : _fd(fd), _buf_size(buf_size) {
+        if (flow_metrics::local().enabled()) {
+            _flow_valid = try_resolve_flow(_fd, _flow);
+        }
+    }
     virtual future<temporary_buffer<char>> get() override;
 };
 
 class posix_data_sink_impl : public data_sink_impl {
+    // zerocopy doesn't pay for writes the kernel can copy cheaply
+    static constexpr size_t zerocopy_threshold = 16384;
+    // bound on buffers pinned while awaiting completions; beyond it we
+    // fall back to copying, which always makes progress
+    static constexpr size_t max_zerocopy_inflight = 64;
+    struct zerocopy_pending {
+        uint32_t seq_end; // per-socket sequence number of the last send
+        packet p;
+    };
+    // the kernel retransmits for us, so per-flow retransmit counts come
+    // from TCP_INFO, sampled once per this many writes
+    static constexpr unsigned tcp_info_sample_interval = 64;
     pollable_fd& _fd;
     packet _p;
+    bool _zerocopy = false;
+    uint32_t _zc_seq = 0; // sequence number of the next MSG_ZEROCOPY send
+    std::deque<zerocopy_pending> _zc_pending;
+    flow_id _flow;
+    bool _flow_valid = false;
+    bool _tcp_info_ok = true;
+    uint32_t _retrans_base = 0;
+    unsigned _tcp_info_countdown = tcp_info_sample_interval;
 public:
-    explicit posix_data_sink_impl(pollable_fd& fd) : _fd(fd) {}
+    // set from the posix stack's --posix-zerocopy option
+    static thread_local bool zerocopy_opt_in;
+    explicit posix_data_sink_impl(pollable_fd& fd) : _fd(fd) {
+        if (flow_metrics::local().enabled()) {
+            _flow_valid = try_resolve_flow(_fd, _flow);
+        }
+    }
+    void try_enable_zerocopy();
     future<> put(packet p) override;
     future<> put(temporary_buffer<char> buf) override;
     future<> close() override {
+        if (_zerocopy) {
+            // best effort; the kernel keeps its own page references for
+            // anything still in flight
+            drain_zerocopy_completions();
+            _zc_pending.clear();
+        }
         _fd.close();
         return make_ready_future<>();
     }
+private:
+    future<> put_zerocopy(packet p);
+    void drain_zerocopy_completions();
+    void account_put(size_t bytes);
+    void sample_retransmits();
 };
 
 template <transport Transport>
@@ -79,10 +134,16 @@ template <transport Transport>
 class posix_server_socket_impl : public server_socket_impl {
     socket_address _sa;
     pollable_fd _lfd;
+    listen_options::load_balancing_algorithm _lba;
+    std::function<unsigned (socket_address)> _shard_selector;
 public:
-    explicit posix_server_socket_impl(socket_address sa, pollable_fd lfd) : _sa(sa), _lfd(std::move(lfd)) {}
+    explicit posix_server_socket_impl(socket_address sa, pollable_fd lfd, listen_options opts = {})
+        : _sa(sa), _lfd(std::move(lfd)), _lba(opts.lba), _shard_selector(std::move(opts.shard_selector)) {}
     virtual future<connected_socket, socket_address> accept();
+    virtual future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch() override;
     virtual void abort_accept() override;
+private:
+    unsigned pick_cpu(const socket_address& sa);
 };
 using posix_server_tcp_socket_impl = posix_server_socket_impl<transport::TCP>;
 using posix_server_sctp_socket_impl = posix_server_socket_impl<transport::SCTP>;
@@ -94,6 +155,7 @@ class posix_reuseport_server_socket_impl : public server_socket_impl {
 public:
     explicit posix_reuseport_server_socket_impl(socket_address sa, pollable_fd lfd) : _sa(sa), _lfd(std::move(lfd)) {}
     virtual future<connected_socket, socket_address> accept();
+    virtual future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch() override;
     virtual void abort_accept() override;
 };
 using posix_reuseport_server_tcp_socket_impl = posix_reuseport_server_socket_impl<transport::TCP>;
@@ -103,7 +165,13 @@ class posix_network_stack : public network_stack {
 private:
     const bool _reuseport;
 public:
-    explicit posix_network_stack(boost::program_options::variables_map opts) : _reuseport(engine().posix_reuseport_available()) {}
+    // set from --posix-tcp-fastopen; makes connect() defer the SYN to the
+    // first write, so reconnects can carry data in the handshake
+    static thread_local bool tcp_fastopen_connect;
+    explicit posix_network_stack(boost::program_options::variables_map opts) : _reuseport(engine().posix_reuseport_available()) {
+        posix_data_sink_impl::zerocopy_opt_in = opts["posix-zerocopy"].as<bool>();
+        tcp_fastopen_connect = opts["posix-tcp-fastopen"].as<bool>();
+    }
     virtual server_socket listen(socket_address sa, listen_options opts) override;
     virtual ::seastar::socket socket() override;
     virtual net::udp_channel make_udp_channel(ipv4_addr addr) override;
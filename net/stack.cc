@@ -38,6 +38,10 @@ future<net::udp_datagram> net::udp_channel::receive() {
     return _impl->receive();
 }
 
+future<std::vector<net::udp_datagram>> net::udp_channel::receive_batch() {
+    return _impl->receive_batch();
+}
+
 future<> net::udp_channel::send(ipv4_addr dst, const char* msg) {
     return _impl->send(std::move(dst), msg);
 }
@@ -46,6 +50,10 @@ future<> net::udp_channel::send(ipv4_addr dst, packet p) {
     return _impl->send(std::move(dst), std::move(p));
 }
 
+future<> net::udp_channel::send_batch(ipv4_addr dst, std::vector<packet> ps) {
+    return _impl->send_batch(std::move(dst), std::move(ps));
+}
+
 bool net::udp_channel::is_closed() const {
     return _impl->is_closed();
 }
@@ -96,6 +104,44 @@ void connected_socket::set_keepalive_parameters(const net::keepalive_params& p)
 net::keepalive_params connected_socket::get_keepalive_parameters() const {
     return _csi->get_keepalive_parameters();
 }
+void connected_socket::set_sndbuf(size_t bytes) {
+    _csi->set_sndbuf(bytes);
+}
+size_t connected_socket::get_sndbuf() const {
+    return _csi->get_sndbuf();
+}
+void connected_socket::set_rcvbuf(size_t bytes) {
+    _csi->set_rcvbuf(bytes);
+}
+size_t connected_socket::get_rcvbuf() const {
+    return _csi->get_rcvbuf();
+}
+void connected_socket::set_notsent_lowat(size_t bytes) {
+    _csi->set_notsent_lowat(bytes);
+}
+void connected_socket::set_busy_poll(std::chrono::microseconds us) {
+    _csi->set_busy_poll(us);
+}
+future<> connected_socket::splice_to(connected_socket& to) {
+    return _csi->splice_to(*to._csi);
+}
+
+future<> net::connected_socket_impl::splice_to(connected_socket_impl& to) {
+    return do_with(source(), to.sink(), [] (data_source& in, data_sink& out) {
+        return repeat([&in, &out] {
+            return in.get().then([&out] (temporary_buffer<char> buf) {
+                if (buf.empty()) {
+                    return out.flush().then([] {
+                        return stop_iteration::yes;
+                    });
+                }
+                return out.put(std::move(buf)).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    });
+}
 
 future<> connected_socket::shutdown_output() {
     return _csi->shutdown_output();
@@ -140,10 +186,63 @@ future<connected_socket, socket_address> server_socket::accept() {
     return _ssi->accept();
 }
 
+future<std::vector<std::pair<connected_socket, socket_address>>> server_socket::accept_batch() {
+    return _ssi->accept_batch();
+}
+
 void server_socket::abort_accept() {
     _ssi->abort_accept();
 }
 
+connection_pool::connection_pool(socket_address addr, unsigned warm)
+        : _addr(addr), _warm(warm) {
+    refill();
+}
+
+void connection_pool::refill() {
+    while (!_closed && _ready.size() + _connecting < _warm) {
+        ++_connecting;
+        _gate.enter();
+        engine().connect(_addr).then_wrapped([this] (future<connected_socket> f) {
+            --_connecting;
+            try {
+                auto cs = f.get0();
+                if (!_closed) {
+                    _ready.push_back(std::move(cs));
+                }
+            } catch (...) {
+                // The endpoint is unreachable or overloaded; don't retry in
+                // a tight loop.  A direct connect from the next get() will
+                // surface the error to a caller that can act on it.
+            }
+            _gate.leave();
+        });
+    }
+}
+
+future<connected_socket> connection_pool::get() {
+    if (!_ready.empty()) {
+        auto cs = std::move(_ready.front());
+        _ready.pop_front();
+        refill();
+        return make_ready_future<connected_socket>(std::move(cs));
+    }
+    refill();
+    return engine().connect(_addr);
+}
+
+void connection_pool::put(connected_socket cs) {
+    if (!_closed && _ready.size() < _warm) {
+        _ready.push_back(std::move(cs));
+    }
+}
+
+future<> connection_pool::close() {
+    _closed = true;
+    _ready.clear();
+    return _gate.close();
+}
+
 socket_address::socket_address(ipv4_addr addr)
     : socket_address(make_ipv4_address(addr))
 {}
@@ -22,6 +22,7 @@
 
 #include <chrono>
 #include "api.hh"
+#include "core/future-util.hh"
 
 namespace net {
 
@@ -39,6 +40,20 @@ public:
     virtual bool get_keepalive() const = 0;
     virtual void set_keepalive_parameters(const keepalive_params&) = 0;
     virtual keepalive_params get_keepalive_parameters() const = 0;
+    // Per-connection tuning knobs.  The defaults ignore the request, for
+    // stacks where the option has no equivalent.
+    virtual void set_sndbuf(size_t bytes) {}
+    virtual size_t get_sndbuf() const { return 0; }
+    virtual void set_rcvbuf(size_t bytes) {}
+    virtual size_t get_rcvbuf() const { return 0; }
+    virtual void set_notsent_lowat(size_t bytes) {}
+    virtual void set_busy_poll(std::chrono::microseconds us) {}
+    // Moves everything read from this socket into `to` until EOF, with
+    // flow control following the slower side.  The default shuttles
+    // buffers between source and sink (already a zero-copy packet
+    // handoff on the native stack); the posix stack overrides it with
+    // splice().  Claims both this socket's source and `to`'s sink.
+    virtual future<> splice_to(connected_socket_impl& to);
 };
 
 class socket_impl {
@@ -52,6 +67,15 @@ class server_socket_impl {
 public:
     virtual ~server_socket_impl() {}
     virtual future<connected_socket, socket_address> accept() = 0;
+    // Stacks that can drain their accept queue in one pass override
+    // this; the default degrades to a single accept().
+    virtual future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch() {
+        return accept().then([] (connected_socket cs, socket_address sa) {
+            std::vector<std::pair<connected_socket, socket_address>> batch;
+            batch.emplace_back(std::move(cs), sa);
+            return batch;
+        });
+    }
     virtual void abort_accept() = 0;
 };
 
@@ -61,6 +85,28 @@ public:
     virtual future<udp_datagram> receive() = 0;
     virtual future<> send(ipv4_addr dst, const char* msg) = 0;
     virtual future<> send(ipv4_addr dst, packet p) = 0;
+    // Stacks that can traverse their transmit and receive paths once
+    // for a whole batch override these; the defaults degrade to one
+    // datagram at a time.
+    virtual future<> send_batch(ipv4_addr dst, std::vector<packet> ps) {
+        return do_with(std::move(ps), size_t(0), [this, dst] (std::vector<packet>& ps, size_t& i) {
+            return repeat([this, dst, &ps, &i] {
+                if (i == ps.size()) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                return send(dst, std::move(ps[i++])).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    }
+    virtual future<std::vector<udp_datagram>> receive_batch() {
+        return receive().then([] (udp_datagram d) {
+            std::vector<udp_datagram> batch;
+            batch.push_back(std::move(d));
+            return batch;
+        });
+    }
     virtual bool is_closed() const = 0;
     virtual void close() = 0;
 };
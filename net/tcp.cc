@@ -75,12 +75,39 @@ void tcp_option::parse(uint8_t* beg1, uint8_t* end1) {
     }
 }
 
-uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
+void tcp_option::parse_sack(uint8_t* beg1, uint8_t* end1) {
+    const char* beg = reinterpret_cast<const char*>(beg1);
+    const char* end = reinterpret_cast<const char*>(end1);
+    _sack_rx_count = 0;
+    while (beg < end) {
+        auto kind = option_kind(*beg);
+        if (kind == option_kind::eol) {
+            return;
+        }
+        if (kind == option_kind::nop) {
+            beg += option_len::nop;
+            continue;
+        }
+        uint8_t len = uint8_t(beg[1]);
+        if (len < 2 || beg + len > end) {
+            return;
+        }
+        if (kind == option_kind::sack_block) {
+            auto nr = std::min(size_t((len - 2) / 8), _sack_rx.size());
+            for (size_t i = 0; i < nr; i++) {
+                _sack_rx[i].start = read_be<uint32_t>(beg + 2 + 8 * i);
+                _sack_rx[i].end = read_be<uint32_t>(beg + 6 + 8 * i);
+            }
+            _sack_rx_count = nr;
+        }
+        beg += len;
+    }
+}
+
+uint8_t tcp_option::fill(void* h, bool syn_on, bool ack_on, uint8_t options_size) {
     auto hdr = reinterpret_cast<char*>(h);
     auto off = hdr + tcp_hdr::len;
     uint8_t size = 0;
-    bool syn_on = th->f_syn;
-    bool ack_on = th->f_ack;
 
     if (syn_on) {
         if (_mss_received || !ack_on) {
@@ -97,6 +124,22 @@ uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
             off += win_scale.len;
             size += win_scale.len;
         }
+        if (_sack_received || !ack_on) {
+            auto sack = tcp_option::sack();
+            sack.write(off);
+            off += sack.len;
+            size += sack.len;
+        }
+    } else if (_sack_tx_count) {
+        uint8_t len = 2 + _sack_tx_count * 8;
+        off[0] = static_cast<uint8_t>(option_kind::sack_block);
+        off[1] = len;
+        for (uint8_t i = 0; i < _sack_tx_count; i++) {
+            write_be<uint32_t>(off + 2 + 8 * i, _sack_tx[i].start);
+            write_be<uint32_t>(off + 6 + 8 * i, _sack_tx[i].end);
+        }
+        off += len;
+        size += len;
     }
     if (size > 0) {
         // Insert NOP option
@@ -125,6 +168,11 @@ uint8_t tcp_option::get_size(bool syn_on, bool ack_on) {
         if (_win_scale_received || !ack_on) {
             size += option_len::win_scale;
         }
+        if (_sack_received || !ack_on) {
+            size += option_len::sack;
+        }
+    } else if (_sack_tx_count) {
+        size += 2 + _sack_tx_count * 8;
     }
     if (size > 0) {
         size += option_len::eol;
@@ -134,15 +182,176 @@ uint8_t tcp_option::get_size(bool syn_on, bool ack_on) {
     return size;
 }
 
+/*
+ * GRO-style receive coalescing: merges a run of in-order TCP data
+ * segments of one flow arriving within a single poll batch into one
+ * packet, so the per-segment processing in tcp::received() is paid once
+ * per run instead of once per MSS during bulk ingest.  The usual GRO
+ * rules apply: only clean ACK (optionally PSH) data segments with
+ * identical options, ack and window are merged; anything else flushes
+ * the flow first, so segment ordering is preserved.  Held packets are
+ * flushed by a task that runs right after the poll that produced them,
+ * so coalescing never delays delivery beyond the current batch.
+ *
+ * Requires rx checksum offload: tcp::received() verifies the checksum
+ * of the packet it is given, and a merged packet no longer checksums.
+ * Without it every segment is passed through unmodified.
+ */
+class tcp_rx_coalescer {
+    struct flow {
+        ipv4_address from;
+        ipv4_address to;
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint32_t next_seq;
+        uint32_t ack;
+        uint16_t window;
+        uint8_t hdr_len;
+        packet p; // zero length marks a free slot
+    };
+    static constexpr unsigned max_flows = 4;
+    // keep the merged payload within one IP datagram
+    static constexpr size_t max_len = ip_packet_len_max - ipv4_hdr_len_min;
+    tcp<ipv4_traits>& _tcp;
+    bool _enabled;
+    std::array<flow, max_flows> _flows;
+    unsigned _next_victim = 0;
+    bool _flush_scheduled = false;
+    struct collectd_stats {
+        uint64_t merged_segments = 0;
+        uint64_t delivered_packets = 0;
+    } _stats;
+    std::vector<scollectd::registration> _registrations;
+private:
+    flow* find_flow(ipv4_address from, ipv4_address to, const tcp_hdr& h) {
+        for (auto& e : _flows) {
+            if (e.p.len() && e.from == from && e.to == to
+                    && e.src_port == h.src_port && e.dst_port == h.dst_port) {
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+    void flush(flow& e) {
+        ++_stats.delivered_packets;
+        _tcp.received(std::move(e.p), e.from, e.to);
+        e.p = packet();
+    }
+    void flush_all() {
+        for (auto& e : _flows) {
+            if (e.p.len()) {
+                flush(e);
+            }
+        }
+    }
+    static bool same_options(packet& held, packet& p, uint8_t hdr_len) {
+        if (hdr_len == tcp_hdr::len) {
+            return true;
+        }
+        auto a = held.get_header(0, hdr_len);
+        auto b = p.get_header(0, hdr_len);
+        return std::equal(a + tcp_hdr::len, a + hdr_len, b + tcp_hdr::len);
+    }
+    void hold(packet p, ipv4_address from, ipv4_address to, const tcp_hdr& h, uint8_t hdr_len) {
+        flow* e = nullptr;
+        for (auto& candidate : _flows) {
+            if (!candidate.p.len()) {
+                e = &candidate;
+                break;
+            }
+        }
+        if (!e) {
+            // all slots busy: flush one round-robin and reuse it
+            e = &_flows[_next_victim++ % max_flows];
+            flush(*e);
+        }
+        e->from = from;
+        e->to = to;
+        e->src_port = h.src_port;
+        e->dst_port = h.dst_port;
+        e->next_seq = h.seq.raw + (p.len() - hdr_len);
+        e->ack = h.ack.raw;
+        e->window = h.window;
+        e->hdr_len = hdr_len;
+        e->p = std::move(p);
+        if (!_flush_scheduled) {
+            // tasks run after the poll that is producing this batch
+            _flush_scheduled = true;
+            engine().add_task(make_task([this] {
+                _flush_scheduled = false;
+                flush_all();
+            }));
+        }
+    }
+public:
+    explicit tcp_rx_coalescer(tcp<ipv4_traits>& t)
+        : _tcp(t)
+        , _enabled(t.hw_features().rx_csum_offload) {
+        _registrations.push_back(
+            scollectd::add_polled_metric(scollectd::type_instance_id("tcp",
+                scollectd::per_cpu_plugin_instance,
+                "total_operations", "rx-coalesced-segments"),
+                scollectd::make_typed(scollectd::data_type::DERIVE,
+                    [this] { return _stats.merged_segments; })));
+    }
+    void received(packet p, ipv4_address from, ipv4_address to);
+};
+
+void tcp_rx_coalescer::received(packet p, ipv4_address from, ipv4_address to) {
+    auto th = _enabled ? p.get_header(0, tcp_hdr::len) : nullptr;
+    if (!th) {
+        _tcp.received(std::move(p), from, to);
+        return;
+    }
+    auto h = tcp_hdr::read(th);
+    uint8_t hdr_len = h.data_offset * 4;
+    auto e = find_flow(from, to, h);
+    // Only clean data segments coalesce.  Everything else (SYN/FIN/RST,
+    // urgent data, pure acks, bad header) is delivered as-is, after
+    // flushing the flow so segments stay in order.
+    bool candidate = h.f_ack && !h.f_syn && !h.f_fin && !h.f_rst && !h.f_urg
+            && hdr_len >= tcp_hdr::len && p.len() > hdr_len;
+    if (!candidate) {
+        if (e) {
+            flush(*e);
+        }
+        _tcp.received(std::move(p), from, to);
+        return;
+    }
+    if (e) {
+        auto payload = p.len() - hdr_len;
+        bool mergeable = h.seq.raw == e->next_seq
+                && h.ack.raw == e->ack
+                && h.window == e->window
+                && hdr_len == e->hdr_len
+                && e->p.len() + payload <= max_len
+                && same_options(e->p, p, hdr_len);
+        if (mergeable) {
+            p.trim_front(hdr_len);
+            e->p.append(std::move(p));
+            e->next_seq += payload;
+            ++_stats.merged_segments;
+            if (h.f_psh) {
+                // sender is done for now; no point holding the run back
+                flush(*e);
+            }
+            return;
+        }
+        flush(*e);
+    }
+    hold(std::move(p), from, to, h, hdr_len);
+}
+
 ipv4_tcp::ipv4_tcp(ipv4& inet)
-	: _inet_l4(inet), _tcp(std::make_unique<tcp<ipv4_traits>>(_inet_l4)) {
+	: _inet_l4(inet), _tcp(std::make_unique<tcp<ipv4_traits>>(_inet_l4))
+	, _coalescer(std::make_unique<tcp_rx_coalescer>(*_tcp)) {
 }
 
 ipv4_tcp::~ipv4_tcp() {
 }
 
 void ipv4_tcp::received(packet p, ipv4_address from, ipv4_address to) {
-    _tcp->received(std::move(p), from, to);
+    _coalescer->received(std::move(p), from, to);
 }
 
 bool ipv4_tcp::forward(forward_hash& out_hash_data, packet& p, size_t off) {
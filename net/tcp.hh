@@ -23,6 +23,7 @@
 #define TCP_HH_
 
 #include "core/shared_ptr.hh"
+#include "core/flat_hash_map.hh"
 #include "core/queue.hh"
 #include "core/semaphore.hh"
 #include "core/print.hh"
@@ -32,15 +33,19 @@
 #include "ip.hh"
 #include "const.hh"
 #include "packet-util.hh"
+#include "flow_metrics.hh"
+#include "core/memory.hh"
 #include <unordered_map>
 #include <map>
 #include <functional>
+#include <memory>
 #include <deque>
 #include <chrono>
 #include <experimental/optional>
 #include <random>
 #include <stdexcept>
 #include <system_error>
+#include <array>
 
 #define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
 #include <cryptopp/md5.h>
@@ -94,7 +99,7 @@ void tcp_debug(const char* fmt, Args&&... args) {
 
 struct tcp_option {
     // The kind and len field are fixed and defined in TCP protocol
-    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, timestamps = 8,  nop = 1, eol = 0 };
+    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, sack_block = 5, timestamps = 8,  nop = 1, eol = 0 };
     enum class option_len:  uint8_t { mss = 4, win_scale = 3, sack = 2, timestamps = 10, nop = 1, eol = 1 };
     static void write(char* p, option_kind kind, option_len len) {
         p[0] = static_cast<uint8_t>(kind);
@@ -140,6 +145,12 @@ struct tcp_option {
             tcp_option::write(p, kind, len);
         }
     };
+    // One SACK block: [start, end) in network sequence space, stored raw
+    // because tcp_seq is defined further down
+    struct sack_block {
+        uint32_t start;
+        uint32_t end;
+    };
     struct timestamps {
         static constexpr option_kind kind = option_kind::timestamps;
         static constexpr option_len len = option_len::timestamps;
@@ -174,7 +185,9 @@ struct tcp_option {
     static const uint8_t align = 4;
 
     void parse(uint8_t* beg, uint8_t* end);
-    uint8_t fill(void* h, const tcp_hdr* th, uint8_t option_size);
+    // Extract only SACK blocks, for segments received after the handshake
+    void parse_sack(uint8_t* beg, uint8_t* end);
+    uint8_t fill(void* h, bool syn_on, bool ack_on, uint8_t option_size);
     uint8_t get_size(bool syn_on, bool ack_on);
 
     // For option negotiattion
@@ -188,6 +201,14 @@ struct tcp_option {
     uint16_t _local_mss;
     uint8_t _remote_win_scale = 0;
     uint8_t _local_win_scale = 0;
+
+    // SACK scoreboard exchange: blocks the peer reported in the segment
+    // just parsed, and blocks to advertise on the next outgoing ACK
+    static constexpr uint8_t max_sack_blocks = 3;
+    uint8_t _sack_rx_count = 0;
+    std::array<sack_block, 4> _sack_rx;
+    uint8_t _sack_tx_count = 0;
+    std::array<sack_block, max_sack_blocks> _sack_tx;
 };
 inline char*& operator+=(char*& x, tcp_option::option_len len) { x += uint8_t(len); return x; }
 inline const char*& operator+=(const char*& x, tcp_option::option_len len) { x += uint8_t(len); return x; }
@@ -281,11 +302,268 @@ struct tcp_hdr {
     static void write_nbo_checksum(char* p, uint16_t checksum_in_network_byte_order) {
         std::copy_n(reinterpret_cast<const char*>(&checksum_in_network_byte_order), 2, p + 16);
     }
+    // Serialize only the fields that change per segment on top of a
+    // pre-built header; ports, checksum and urgent pointer are expected
+    // to be in place already (from the connection's header template).
+    static void patch(char* p, tcp_seq seq, tcp_seq ack, uint8_t data_offset,
+            bool fin, bool syn, bool ack_on, uint16_t window) {
+        write_be<uint32_t>(p + 4, seq.raw);
+        write_be<uint32_t>(p + 8, ack.raw);
+        p[12] = data_offset << 4;
+        p[13] = (fin << 0)
+                | (syn << 1)
+                | (ack_on << 4);
+        write_be<uint16_t>(p + 14, window);
+    }
 };
 
 struct tcp_tag {};
 using tcp_packet_merger = packet_merger<tcp_seq, tcp_tag>;
 
+// Congestion control algorithms selectable per connection, see
+// tcp::connection::set_congestion_control().
+enum class tcp_congestion_algorithm {
+    reno,
+    bbr,
+};
+
+// Pluggable congestion control.  The TCP state machine reports
+// connection events through the hooks below and consults cwnd() when
+// deciding how much it may transmit; the algorithm owns the congestion
+// window.  pacing_delay() lets rate-based algorithms spread consecutive
+// transmissions over the round trip instead of releasing a whole window
+// back to back.
+class tcp_congestion_control {
+public:
+    virtual ~tcp_congestion_control() {}
+    // Congestion window, in bytes
+    virtual uint32_t cwnd() const = 0;
+    // Three-way handshake completed; peer_window is the initial send window
+    virtual void connection_established(uint16_t smss, uint32_t peer_window) = 0;
+    // New data cumulatively acknowledged outside fast recovery.  srtt is
+    // zero until the first RTT measurement is taken.
+    virtual void on_ack(uint32_t acked_bytes, uint16_t smss, uint32_t flight, std::chrono::milliseconds srtt) = 0;
+    // Third duplicate ACK.  reset_window is false when the RFC6582
+    // heuristic suppresses a second window reduction for one loss event.
+    virtual void on_enter_fast_retransmit(uint32_t flight, uint16_t smss, bool reset_window) = 0;
+    // Further duplicate ACKs while in fast recovery
+    virtual void on_dup_ack_in_recovery(uint16_t smss) = 0;
+    // Partial ACK during fast recovery
+    virtual void on_partial_ack(uint32_t acked_bytes, uint16_t smss) = 0;
+    // ACK covering all data sent before the loss: fast recovery is over
+    virtual void on_full_ack(uint32_t flight, uint16_t smss) = 0;
+    // Retransmission timer fired; first is true for the first
+    // retransmission of the segment
+    virtual void on_retransmit_timeout(uint32_t flight, uint16_t smss, bool first) = 0;
+    // Delay to impose before the transmission following a packet of the
+    // given size; zero disables pacing
+    virtual std::chrono::microseconds pacing_delay(uint32_t bytes) {
+        return std::chrono::microseconds::zero();
+    }
+};
+
+// RFC5681 + RFC6582 NewReno, the algorithm the state machine originally
+// implemented inline; the comments below reference the steps of those
+// RFCs the way the inline code did.
+class reno_congestion_control final : public tcp_congestion_control {
+    uint32_t _cwnd = 0;
+    uint32_t _ssthresh = 0;
+public:
+    virtual uint32_t cwnd() const override { return _cwnd; }
+    virtual void connection_established(uint16_t smss, uint32_t peer_window) override {
+        // Setup initial congestion window
+        if (2190 < smss) {
+            _cwnd = 2 * smss;
+        } else if (1095 < smss && smss <= 2190) {
+            _cwnd = 3 * smss;
+        } else {
+            _cwnd = 4 * smss;
+        }
+        // Setup initial slow start threshold
+        _ssthresh = peer_window;
+    }
+    virtual void on_ack(uint32_t acked_bytes, uint16_t smss, uint32_t flight, std::chrono::milliseconds srtt) override {
+        if (_cwnd < _ssthresh) {
+            // In slow start phase
+            _cwnd += std::min(acked_bytes, uint32_t(smss));
+        } else {
+            // In congestion avoidance phase
+            uint32_t round_up = 1;
+            _cwnd += std::max(round_up, smss * smss / _cwnd);
+        }
+    }
+    virtual void on_enter_fast_retransmit(uint32_t flight, uint16_t smss, bool reset_window) override {
+        if (reset_window) {
+            // RFC5681 Step 3.2
+            _ssthresh = std::max(flight / 2, 2 * uint32_t(smss));
+        }
+        // RFC5681 Step 3.3
+        _cwnd = _ssthresh + 3 * smss;
+    }
+    virtual void on_dup_ack_in_recovery(uint16_t smss) override {
+        // RFC5681 Step 3.4
+        _cwnd += smss;
+    }
+    virtual void on_partial_ack(uint32_t acked_bytes, uint16_t smss) override {
+        // Deflate the congestion window by the amount of new data
+        // acknowledged by the Cumulative Acknowledgment field
+        _cwnd -= acked_bytes;
+        // If the partial ACK acknowledges at least one SMSS of new
+        // data, then add back SMSS bytes to the congestion window
+        if (acked_bytes >= smss) {
+            _cwnd += smss;
+        }
+    }
+    virtual void on_full_ack(uint32_t flight, uint16_t smss) override {
+        // Set cwnd to min (ssthresh, max(FlightSize, SMSS) + SMSS)
+        _cwnd = std::min(_ssthresh, std::max(flight, uint32_t(smss)) + smss);
+    }
+    virtual void on_retransmit_timeout(uint32_t flight, uint16_t smss, bool first) override {
+        // According to RFC5681
+        // Update ssthresh only for the first retransmit
+        if (first) {
+            _ssthresh = std::max(flight / 2, 2 * uint32_t(smss));
+        }
+        // Start the slow start process
+        _cwnd = smss;
+    }
+};
+
+// BBR-style rate-based congestion control, after "BBR: Congestion-Based
+// Congestion Control" (Cardwell et al).  Instead of backing off on loss
+// it models the path: bottleneck bandwidth is the windowed maximum
+// delivery rate, propagation delay is the windowed minimum RTT, and the
+// congestion window is held at a small multiple of the resulting
+// bandwidth-delay product while pacing_delay() spreads the window over
+// the round trip.  Loss only collapses the window on a retransmission
+// timeout, so a lossy long-haul path keeps running at the measured rate
+// where Reno would repeatedly halve its window.
+//
+// This is a simplified model on top of our coarse (lowres_clock,
+// millisecond) RTT samples: the startup phase and the steady-state
+// bandwidth probing cycle are implemented, the DRAIN and PROBE_RTT
+// phases are not.
+class bbr_congestion_control final : public tcp_congestion_control {
+    using clock_type = lowres_clock;
+    uint32_t _cwnd = 0;
+    // Bottleneck bandwidth estimate, bytes per second
+    uint64_t _btl_bw = 0;
+    // Rounds since _btl_bw was last raised; an old maximum eventually
+    // expires in favor of the current delivery rate
+    unsigned _bw_age = 0;
+    // Total bytes acknowledged, and its value when this round started
+    uint64_t _delivered = 0;
+    uint64_t _round_delivered = 0;
+    clock_type::time_point _round_start;
+    std::chrono::milliseconds _min_rtt{0};
+    clock_type::time_point _min_rtt_since;
+    bool _startup = true;
+    uint64_t _full_bw = 0;
+    unsigned _full_bw_rounds = 0;
+    unsigned _cycle_phase = 0;
+    uint16_t _smss = 0;
+
+    // Gains are expressed in 1/100 units
+    unsigned pacing_gain() const {
+        // Slightly less than 2/ln(2), enough to double the delivery
+        // rate every round while startup lasts
+        static constexpr unsigned startup_gain = 289;
+        // Steady state: probe for more bandwidth for one round, drain
+        // the queue the probe may have built for one round, then cruise
+        static constexpr unsigned cycle_gains[8] = { 125, 75, 100, 100, 100, 100, 100, 100 };
+        return _startup ? startup_gain : cycle_gains[_cycle_phase];
+    }
+    uint64_t bdp() const {
+        return _btl_bw * _min_rtt.count() / 1000;
+    }
+    void update_cwnd() {
+        // Twice the BDP keeps the pipe full with delayed ACKs present
+        _cwnd = std::max<uint64_t>(bdp() * 2, 4 * uint32_t(_smss));
+    }
+public:
+    virtual uint32_t cwnd() const override { return _cwnd; }
+    virtual void connection_established(uint16_t smss, uint32_t peer_window) override {
+        _smss = smss;
+        // No rate samples yet; open like slow start and let the model
+        // take over once the first round trip completes
+        _cwnd = 4 * uint32_t(smss);
+        _round_start = _min_rtt_since = clock_type::now();
+    }
+    virtual void on_ack(uint32_t acked_bytes, uint16_t smss, uint32_t flight, std::chrono::milliseconds srtt) override {
+        _smss = smss;
+        _delivered += acked_bytes;
+        auto now = clock_type::now();
+        if (srtt.count() && (!_min_rtt.count() || srtt < _min_rtt
+                || now - _min_rtt_since > std::chrono::seconds(10))) {
+            _min_rtt = srtt;
+            _min_rtt_since = now;
+        }
+        if (!_min_rtt.count()) {
+            // No RTT measurement yet, keep growing exponentially
+            _cwnd += std::min(acked_bytes, uint32_t(smss));
+            return;
+        }
+        if (now - _round_start < _min_rtt) {
+            return;
+        }
+        // A round trip has passed: take one delivery rate sample
+        auto interval = std::chrono::duration_cast<std::chrono::milliseconds>(now - _round_start);
+        auto bw = (_delivered - _round_delivered) * 1000 / std::max<int64_t>(interval.count(), 1);
+        _round_delivered = _delivered;
+        _round_start = now;
+        if (bw > _btl_bw) {
+            _btl_bw = bw;
+            _bw_age = 0;
+        } else if (++_bw_age >= 10) {
+            // The old maximum no longer reflects the path
+            _btl_bw = bw;
+            _bw_age = 0;
+        }
+        if (_startup) {
+            // Leave startup once the delivery rate stops growing by at
+            // least 25% per round for three rounds in a row
+            if (bw > _full_bw + _full_bw / 4) {
+                _full_bw = bw;
+                _full_bw_rounds = 0;
+            } else if (++_full_bw_rounds >= 3) {
+                _startup = false;
+            }
+        } else {
+            _cycle_phase = (_cycle_phase + 1) % 8;
+        }
+        update_cwnd();
+    }
+    virtual void on_enter_fast_retransmit(uint32_t flight, uint16_t smss, bool reset_window) override {
+        // Isolated loss is not treated as a congestion signal; the
+        // window stays at the modeled BDP
+    }
+    virtual void on_dup_ack_in_recovery(uint16_t smss) override {
+    }
+    virtual void on_partial_ack(uint32_t acked_bytes, uint16_t smss) override {
+    }
+    virtual void on_full_ack(uint32_t flight, uint16_t smss) override {
+        update_cwnd();
+    }
+    virtual void on_retransmit_timeout(uint32_t flight, uint16_t smss, bool first) override {
+        // A timeout means the pipe drained completely; restart
+        // conservatively and let fresh samples rebuild the model
+        _smss = smss;
+        _cwnd = 4 * uint32_t(smss);
+        _round_delivered = _delivered;
+        _round_start = clock_type::now();
+    }
+    virtual std::chrono::microseconds pacing_delay(uint32_t bytes) override {
+        if (!_btl_bw) {
+            return std::chrono::microseconds::zero();
+        }
+        auto rate = _btl_bw * pacing_gain() / 100;
+        auto us = uint64_t(bytes) * 1000000 / rate;
+        // Never let a stale estimate stall the connection for long; the
+        // next round of samples will correct the model
+        return std::chrono::microseconds(std::min<uint64_t>(us, 10000));
+    }
+};
+
 template <typename InetTraits>
 class tcp {
 public:
@@ -324,6 +602,9 @@ private:
             uint16_t data_len;
             unsigned nr_transmits;
             clock_type::time_point tx_time;
+            // Set when the peer reports this segment in a SACK block;
+            // it has left the network and must not be retransmitted
+            bool sacked = false;
         };
         struct send {
             tcp_seq unacknowledged;
@@ -351,10 +632,6 @@ private:
             std::chrono::milliseconds srtt;
             bool first_rto_sample = true;
             clock_type::time_point syn_tx_time;
-            // Congestion window
-            uint32_t cwnd;
-            // Slow start threshold
-            uint32_t ssthresh;
             // Duplicated ACKs
             uint16_t dupacks = 0;
             unsigned syn_retransmit = 0;
@@ -374,6 +651,15 @@ private:
             std::deque<packet> data;
             tcp_packet_merger out_of_order;
             std::experimental::optional<promise<>> _data_received_promise;
+            // Receive window auto-tuning: rcv.next at the start of the
+            // current measurement round, sampled roughly once per
+            // smoothed RTT
+            tcp_seq tune_mark;
+            clock_type::time_point tune_start;
+            // Highest right edge ever advertised; the window may shrink
+            // under memory pressure, but never below what was already
+            // offered to the peer
+            tcp_seq advertised;
         } _rcv;
         tcp_option _option;
         timer<lowres_clock> _delayed_ack;
@@ -387,6 +673,13 @@ private:
         static constexpr uint16_t _max_nr_retransmit{5};
         timer<lowres_clock> _retransmit;
         timer<lowres_clock> _persist;
+        // Pluggable congestion control, NewReno unless the user selects
+        // another algorithm on the connection
+        std::unique_ptr<tcp_congestion_control> _cc = std::make_unique<reno_congestion_control>();
+        // Pacing uses the high resolution timer: inter-packet gaps are
+        // far below the lowres_clock granularity
+        timer<> _pacing_timer;
+        bool _pacing_blocked = false;
         uint16_t _nr_full_seg_received = 0;
         struct isn_secret {
             // 512 bits secretkey for ISN generating
@@ -402,14 +695,43 @@ private:
         };
         static isn_secret _isn_secret;
         tcp_seq get_isn();
+        // SYN cookies: the ISN of a stateless SYN-ACK encodes the peer's
+        // MSS (2 bits, an index into _cookie_mss), a one-second timestamp
+        // (6 bits) and a 24-bit keyed hash of the connection id, so the
+        // handshake can be validated from the completing ACK alone
+        static constexpr uint16_t _cookie_mss[4] = {536, 1440, 1460, 8960};
+        static uint32_t syn_cookie_hash(connid id, uint32_t extra);
         circular_buffer<typename InetTraits::l4packet> _packetq;
         bool _poll_active = false;
+        // An ACK-only output is owed and a task to send it right after
+        // the current poll is pending; see schedule_batched_ack()
+        bool _batched_ack_pending = false;
+        // Resolved next hop for this flow, valid while the neighbor
+        // table generation matches; lets established flows skip the
+        // route decision and ARP lookup on every output
+        std::experimental::optional<ethernet_address> _next_hop;
+        uint64_t _next_hop_gen = 0;
+        // Precomputed transmit constants: a serialized header prototype
+        // (ports and zeroed invariant fields) copied into each segment
+        // and patched with seq/ack/flags/window, plus the address and
+        // protocol part of the pseudo-header checksum, to which only the
+        // segment length needs to be folded per packet.
+        char _tx_hdr_template[tcp_hdr::len];
+        checksummer _pseudo_hdr_csum_base;
     public:
         tcb(tcp& t, connid id);
         void input_handle_listen_state(tcp_hdr* th, packet p);
         void input_handle_syn_sent_state(tcp_hdr* th, packet p);
         void input_handle_other_state(tcp_hdr* th, packet p);
-        void output_one(bool data_retransmit = false);
+        // Initial receive window (Linux's default); auto-tuning grows
+        // it towards the bandwidth-delay product of the path
+        static constexpr uint32_t _default_rcv_window{29200};
+        void input_handle_cookie_ack(tcp_hdr* th, packet p, uint16_t peer_mss);
+        static tcp_seq make_syn_cookie(connid id, tcp_seq irs, uint16_t peer_mss);
+        // Returns the peer MSS a valid cookie encodes, or 0 when the
+        // cookie fails validation
+        static uint16_t verify_syn_cookie(connid id, tcp_seq irs, tcp_seq cookie);
+        void output_one(bool data_retransmit = false, size_t retransmit_idx = 0);
         future<> wait_for_data();
         void abort_reader();
         future<> wait_for_all_data_acked();
@@ -421,8 +743,15 @@ private:
             auto id = connid{_local_ip, _foreign_ip, _local_port, _foreign_port};
             _tcp._tcbs.erase(id);
         }
+        flow_id fid() const {
+            return flow_id{_local_ip.ip, _foreign_ip.ip, _local_port, _foreign_port};
+        }
         std::experimental::optional<typename InetTraits::l4packet> get_packet();
         void output() {
+            if (_pacing_blocked) {
+                // the pacing timer will call us back
+                return;
+            }
             if (!_poll_active) {
                 _poll_active = true;
                 _tcp.poll_tcb(_foreign_ip, this->shared_from_this()).then_wrapped([this] (auto&& f) {
@@ -445,9 +774,34 @@ private:
         future<> connect_done() {
             return _connect_done.get_future();
         }
+        void set_congestion_control(tcp_congestion_algorithm alg) {
+            switch (alg) {
+            case tcp_congestion_algorithm::reno:
+                _cc = std::make_unique<reno_congestion_control>();
+                break;
+            case tcp_congestion_algorithm::bbr:
+                _cc = std::make_unique<bbr_congestion_control>();
+                break;
+            }
+            if (!in_state(CLOSED | LISTEN | SYN_SENT | SYN_RECEIVED)) {
+                // Handshake is over, so the new algorithm will not see
+                // connection_established() from the state machine
+                _cc->connection_established(_snd.mss, _snd.window);
+            }
+        }
         tcp_state& state() {
             return _state;
         }
+        std::experimental::optional<ethernet_address> cached_next_hop(uint64_t gen) const {
+            if (_next_hop_gen != gen) {
+                return {};
+            }
+            return _next_hop;
+        }
+        void cache_next_hop(ethernet_address e_dst, uint64_t gen) {
+            _next_hop = e_dst;
+            _next_hop_gen = gen;
+        }
     private:
         void respond_with_reset(tcp_hdr* th);
         bool merge_out_of_order();
@@ -455,10 +809,27 @@ private:
         void trim_receive_data_after_window();
         bool should_send_ack(uint16_t seg_len);
         void clear_delayed_ack();
+        // Coalesce ACKs within one poll: the first in-order data segment
+        // that wants an ACK schedules a task that runs right after the
+        // current poll, so a run of segments received in one batch is
+        // acknowledged once instead of once per segment. Duplicate ACKs
+        // and the delayed-ack timer bypass this and send immediately.
+        void schedule_batched_ack() {
+            if (_batched_ack_pending) {
+                return;
+            }
+            _batched_ack_pending = true;
+            engine().add_task(make_task([zis = this->shared_from_this()] {
+                if (zis->_batched_ack_pending) {
+                    zis->_batched_ack_pending = false;
+                    zis->output();
+                }
+            }));
+        }
         packet get_transmit_packet();
-        void retransmit_one() {
+        void retransmit_one(size_t retransmit_idx = 0) {
             bool data_retransmit = true;
-            output_one(data_retransmit);
+            output_one(data_retransmit, retransmit_idx);
         }
         void start_retransmit_timer() {
             auto now = clock_type::now();
@@ -485,8 +856,12 @@ private:
         void persist();
         void retransmit();
         void fast_retransmit();
+        void update_sack_scoreboard();
+        bool sack_retransmit();
+        void fill_sack_blocks();
         void update_rto(clock_type::time_point tx_time);
         void update_cwnd(uint32_t acked_bytes);
+        void maybe_tune_rcv_window();
         void cleanup();
         uint32_t can_send() {
             if (_snd.window_probe) {
@@ -495,12 +870,12 @@ private:
             // Can not send more than advertised window allows
             auto x = std::min(uint32_t(_snd.unacknowledged + _snd.window - _snd.next), _snd.unsent_len);
             // Can not send more than congestion window allows
-            x = std::min(_snd.cwnd, x);
+            x = std::min(_cc->cwnd(), x);
             if (_snd.dupacks == 1 || _snd.dupacks == 2) {
                 // RFC5681 Step 3.1
                 // Send cwnd + 2 * smss per RFC3042
                 auto flight = flight_size();
-                auto max = _snd.cwnd + 2 * _snd.mss;
+                auto max = _cc->cwnd() + 2 * _snd.mss;
                 x = flight <= max ? std::min(x, max - flight) : 0;
                 _snd.limited_transfer += x;
             } else if (_snd.dupacks >= 3) {
@@ -511,8 +886,14 @@ private:
             return x;
         }
         uint32_t flight_size() {
+            // SACKed segments have left the network, so they do not count
+            // against the congestion window
             uint32_t size = 0;
-            std::for_each(_snd.data.begin(), _snd.data.end(), [&] (unacked_segment& seg) { size += seg.p.len(); });
+            std::for_each(_snd.data.begin(), _snd.data.end(), [&] (unacked_segment& seg) {
+                if (!seg.sacked) {
+                    size += seg.p.len();
+                }
+            });
             return size;
         }
         uint16_t local_mss() {
@@ -610,7 +991,9 @@ private:
         friend class connection;
     };
     inet_type& _inet;
-    std::unordered_map<connid, lw_shared_ptr<tcb>, connid_hash> _tcbs;
+    // open addressing + incremental growth: one packet never pays for
+    // rehashing the whole connection table
+    flat_hash_map<connid, lw_shared_ptr<tcb>, connid_hash> _tcbs;
     std::unordered_map<uint16_t, listener*> _listening;
     std::random_device _rd;
     std::default_random_engine _e;
@@ -619,6 +1002,12 @@ private:
     // queue for packets that do not belong to any tcb
     circular_buffer<ipv4_traits::l4packet> _packetq;
     semaphore _queue_space = {212992};
+    // SYN cookie events, exported via collectd
+    struct {
+        uint64_t sent = 0;
+        uint64_t accepted = 0;
+        uint64_t rejected = 0;
+    } _syn_cookies;
     scollectd::registrations _collectd_regs;
 public:
     class connection {
@@ -659,6 +1048,12 @@ public:
         void shutdown_connect();
         void close_read();
         void close_write();
+        // Select the congestion control algorithm for this connection;
+        // may be called at any time, state carries over from the old
+        // algorithm only through the connection's RTT estimate
+        void set_congestion_control(tcp_congestion_algorithm alg) {
+            _tcb->set_congestion_control(alg);
+        }
     };
     class listener {
         tcp& _tcp;
@@ -712,6 +1107,7 @@ public:
 private:
     void send_packet_without_tcb(ipaddr from, ipaddr to, packet p);
     void respond_with_reset(tcp_hdr* rth, ipaddr local_ip, ipaddr foreign_ip);
+    void send_syn_cookie_syn_ack(tcp_hdr* rth, connid id, uint16_t peer_mss);
     friend class listener;
 };
 
@@ -730,6 +1126,59 @@ tcp<InetTraits>::tcp(inet_type& inet)
             , scollectd::make_typed(scollectd::data_type::DERIVE
             , [] { return tcp_packet_merger::linearizations(); })
         ),
+        //
+        // Listen queue depth: GAUGE:0:U
+        //
+        // Established connections waiting to be accepted, and embryonic
+        // (SYN_RECEIVED) connections, summed over all listeners
+        scollectd::add_polled_metric(scollectd::type_instance_id(
+              "tcp"
+            , scollectd::per_cpu_plugin_instance
+            , "queue_length", "listen-backlog")
+            , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+                size_t n = 0;
+                for (auto&& l : _listening) {
+                    n += l.second->_q.size();
+                }
+                return n;
+            })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id(
+              "tcp"
+            , scollectd::per_cpu_plugin_instance
+            , "queue_length", "listen-half-open")
+            , scollectd::make_typed(scollectd::data_type::GAUGE, [this] {
+                size_t n = 0;
+                for (auto&& l : _listening) {
+                    n += l.second->_pending;
+                }
+                return n;
+            })
+        ),
+        //
+        // SYN cookie events: DERIVE:0:u
+        //
+        scollectd::add_polled_metric(scollectd::type_instance_id(
+              "tcp"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "syn_cookies_sent")
+            , scollectd::make_typed(scollectd::data_type::DERIVE
+            , [this] { return _syn_cookies.sent; })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id(
+              "tcp"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "syn_cookies_accepted")
+            , scollectd::make_typed(scollectd::data_type::DERIVE
+            , [this] { return _syn_cookies.accepted; })
+        ),
+        scollectd::add_polled_metric(scollectd::type_instance_id(
+              "tcp"
+            , scollectd::per_cpu_plugin_instance
+            , "total_operations", "syn_cookies_rejected")
+            , scollectd::make_typed(scollectd::data_type::DERIVE
+            , [this] { return _syn_cookies.rejected; })
+        ),
     }) {
     _inet.register_packet_provider([this, tcb_polled = 0u] () mutable {
         std::experimental::optional<typename InetTraits::l4packet> l4p;
@@ -758,7 +1207,16 @@ tcp<InetTraits>::tcp(inet_type& inet)
 
 template <typename InetTraits>
 future<> tcp<InetTraits>::poll_tcb(ipaddr to, lw_shared_ptr<tcb> tcb) {
-    return  _inet.get_l2_dst_address(to).then([this, tcb = std::move(tcb)] (ethernet_address dst) {
+    // Fast path: reuse the flow's cached next hop while the neighbor
+    // table is unchanged, skipping route decision and ARP lookup
+    auto gen = _inet.l2_dst_generation();
+    auto e_dst = tcb->cached_next_hop(gen);
+    if (e_dst) {
+        _poll_tcbs.emplace_back(std::move(tcb), *e_dst);
+        return make_ready_future<>();
+    }
+    return  _inet.get_l2_dst_address(to).then([this, gen, tcb = std::move(tcb)] (ethernet_address dst) {
+            tcb->cache_next_hop(dst, gen);
             _poll_tcbs.emplace_back(std::move(tcb), dst);
     });
 }
@@ -781,10 +1239,10 @@ auto tcp<InetTraits>::connect(socket_address sa) -> connection {
         id = connid{src_ip, dst_ip, src_port, dst_port};
     } while (_inet._inet.netif()->hw_queues_count() > 1 &&
              (_inet._inet.netif()->hash2cpu(id.hash(_inet._inet.netif()->rss_key())) != engine().cpu_id()
-              || _tcbs.find(id) != _tcbs.end()));
+              || _tcbs.find(id)));
 
     auto tcbp = make_lw_shared<tcb>(*this, id);
-    _tcbs.insert({id, tcbp});
+    _tcbs.insert(id, tcbp);
     tcbp->connect();
     return connection(tcbp);
 }
@@ -815,6 +1273,7 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
     }
 
     if (!hw_features().rx_csum_offload) {
+        ++sw_offload_fallback_stats::local().rx_l4_csum;
         checksummer csum;
         InetTraits::tcp_pseudo_header_checksum(csum, from, to, p.len());
         csum.sum(p);
@@ -826,9 +1285,9 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
     auto id = connid{to, from, h.dst_port, h.src_port};
     auto tcbi = _tcbs.find(id);
     lw_shared_ptr<tcb> tcbp;
-    if (tcbi == _tcbs.end()) {
+    if (!tcbi) {
         auto listener = _listening.find(id.local_port);
-        if (listener == _listening.end() || listener->second->full()) {
+        if (listener == _listening.end()) {
             // 1) In CLOSE state
             // 1.1 all data in the incoming segment is discarded.  An incoming
             // segment containing a RST is discarded. An incoming segment not
@@ -837,39 +1296,67 @@ void tcp<InetTraits>::received(packet p, ipaddr from, ipaddr to) {
             //      if ACK off: <SEQ=0><ACK=SEG.SEQ+SEG.LEN><CTL=RST,ACK>
             //      if ACK on:  <SEQ=SEG.ACK><CTL=RST>
             return respond_with_reset(&h, id.local_ip, id.foreign_ip);
-        } else {
-            // 2) In LISTEN state
-            // 2.1 first check for an RST
-            if (h.f_rst) {
-                // An incoming RST should be ignored
-                return;
-            }
-            // 2.2 second check for an ACK
-            if (h.f_ack) {
-                // Any acknowledgment is bad if it arrives on a connection
-                // still in the LISTEN state.
-                // <SEQ=SEG.ACK><CTL=RST>
-                return respond_with_reset(&h, id.local_ip, id.foreign_ip);
+        }
+        auto l = listener->second;
+        // 2) In LISTEN state
+        // 2.1 first check for an RST
+        if (h.f_rst) {
+            // An incoming RST should be ignored
+            return;
+        }
+        // 2.2 second check for an ACK
+        if (h.f_ack) {
+            if (!h.f_syn) {
+                // May complete a handshake we answered statelessly with
+                // a SYN cookie: the cookie is the ISN we chose, so it is
+                // seg.ack - 1, and the peer's ISN is seg.seq - 1
+                auto peer_mss = tcb::verify_syn_cookie(id, h.seq - 1, h.ack - 1);
+                if (peer_mss && !l->full()) {
+                    _syn_cookies.accepted++;
+                    tcbp = make_lw_shared<tcb>(*this, id);
+                    _tcbs.insert(id, tcbp);
+                    tcbp->input_handle_cookie_ack(&h, std::move(p), peer_mss);
+                    l->_q.push(connection(tcbp));
+                    return;
+                }
+                _syn_cookies.rejected++;
             }
-            // 2.3 third check for a SYN
-            if (h.f_syn) {
-                // check the security
-                // NOTE: Ignored for now
-                tcbp = make_lw_shared<tcb>(*this, id);
-                _tcbs.insert({id, tcbp});
-                // TODO: we need to remove the tcb and decrease the pending if
-                // it stays SYN_RECEIVED state forever.
-                listener->second->inc_pending();
-
-                return tcbp->input_handle_listen_state(&h, std::move(p));
+            // Any other acknowledgment is bad if it arrives on a
+            // connection still in the LISTEN state.
+            // <SEQ=SEG.ACK><CTL=RST>
+            return respond_with_reset(&h, id.local_ip, id.foreign_ip);
+        }
+        // 2.3 third check for a SYN
+        if (h.f_syn) {
+            // check the security
+            // NOTE: Ignored for now
+            if (l->full() || memory::current_reclaim_pressure() != memory::reclaim_pressure::relaxed) {
+                // Backlog exhausted, or the shard is tight on memory:
+                // answer with a SYN cookie instead of allocating a tcb,
+                // deferring all per-connection state to the completing
+                // ACK.  Losing the SYN's options is the usual cookie
+                // tradeoff
+                auto opt_start = reinterpret_cast<uint8_t*>(p.get_header(0, data_offset * 4)) + tcp_hdr::len;
+                auto opt_end = opt_start + data_offset * 4 - tcp_hdr::len;
+                tcp_option opt;
+                opt.parse(opt_start, opt_end);
+                _syn_cookies.sent++;
+                return send_syn_cookie_syn_ack(&h, id, opt._remote_mss);
             }
-            // 2.4 fourth other text or control
-            // So you are unlikely to get here, but if you do, drop the
-            // segment, and return.
-            return;
+            tcbp = make_lw_shared<tcb>(*this, id);
+            _tcbs.insert(id, tcbp);
+            // TODO: we need to remove the tcb and decrease the pending if
+            // it stays SYN_RECEIVED state forever.
+            l->inc_pending();
+
+            return tcbp->input_handle_listen_state(&h, std::move(p));
         }
+        // 2.4 fourth other text or control
+        // So you are unlikely to get here, but if you do, drop the
+        // segment, and return.
+        return;
     } else {
-        tcbp = tcbi->second;
+        tcbp = *tcbi;
         if (tcbp->state() == tcp_state::SYN_SENT) {
             // 3) In SYN_SENT State
             return tcbp->input_handle_syn_sent_state(&h, std::move(p));
@@ -910,7 +1397,14 @@ tcp<InetTraits>::tcb::tcb(tcp& t, connid id)
     , _foreign_port(id.foreign_port)
     , _delayed_ack([this] { _nr_full_seg_received = 0; output(); })
     , _retransmit([this] { retransmit(); })
-    , _persist([this] { persist(); }) {
+    , _persist([this] { persist(); })
+    , _pacing_timer([this] { _pacing_blocked = false; output(); }) {
+    auto th = tcp_hdr{};
+    th.src_port = _local_port;
+    th.dst_port = _foreign_port;
+    th.write(_tx_hdr_template);
+    InetTraits::tcp_pseudo_header_checksum(_pseudo_hdr_csum_base, _local_ip,
+                                           _foreign_ip, 0);
 }
 
 template <typename InetTraits>
@@ -962,6 +1456,55 @@ void tcp<InetTraits>::respond_with_reset(tcp_hdr* rth, ipaddr local_ip, ipaddr f
     send_packet_without_tcb(local_ip, foreign_ip, std::move(p));
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::send_syn_cookie_syn_ack(tcp_hdr* rth, connid id, uint16_t peer_mss) {
+    // A stateless SYN-ACK: everything needed to complete the handshake
+    // is encoded in the sequence number (the cookie), so no tcb exists
+    // until the peer's ACK comes back and validates
+    static constexpr size_t hdr_len = tcp_hdr::len + uint8_t(tcp_option::option_len::mss);
+    packet p;
+    auto th = p.prepend_uninitialized_header(hdr_len);
+    auto h = tcp_hdr{};
+    h.src_port = rth->dst_port;
+    h.dst_port = rth->src_port;
+    h.seq = tcb::make_syn_cookie(id, rth->seq, peer_mss);
+    h.ack = rth->seq + 1;
+    h.f_syn = true;
+    h.f_ack = true;
+    h.data_offset = hdr_len / 4;
+    // Cookie connections run without window scaling; advertise what the
+    // unscaled field can carry
+    h.window = tcb::_default_rcv_window;
+    h.checksum = 0;
+    h.write(th);
+    // A single MSS option; the other options a stateful SYN-ACK would
+    // negotiate cannot survive a stateless handshake
+    auto opt = th + tcp_hdr::len;
+    opt[0] = char(tcp_option::option_kind::mss);
+    opt[1] = uint8_t(tcp_option::option_len::mss);
+    write_be<uint16_t>(opt + 2, hw_features().mtu - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min);
+
+    checksummer csum;
+    offload_info oi;
+    InetTraits::tcp_pseudo_header_checksum(csum, id.local_ip, id.foreign_ip, hdr_len);
+    uint16_t checksum;
+    if (hw_features().tx_csum_l4_offload) {
+        checksum = ~csum.get();
+        oi.needs_csum = true;
+    } else {
+        csum.sum(p);
+        checksum = csum.get();
+        oi.needs_csum = false;
+    }
+    tcp_hdr::write_nbo_checksum(th, checksum);
+
+    oi.protocol = ip_protocol_num::tcp;
+    oi.tcp_hdr_len = hdr_len;
+    p.set_offload_info(oi);
+
+    send_packet_without_tcb(id.local_ip, id.foreign_ip, std::move(p));
+}
+
 template <typename InetTraits>
 uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack) {
     uint32_t total_acked_bytes = 0;
@@ -1030,7 +1573,7 @@ void tcp<InetTraits>::tcb::init_from_options(tcp_hdr* th, uint8_t* opt_start, ui
     _rcv.mss = _option._local_mss = local_mss();
 
     // Linux's default window size
-    _rcv.window = 29200 << _rcv.window_scale;
+    _rcv.window = _default_rcv_window << _rcv.window_scale;
     _snd.window = th->window << _snd.window_scale;
 
     // Segment sequence number used for last window update
@@ -1038,17 +1581,8 @@ void tcp<InetTraits>::tcb::init_from_options(tcp_hdr* th, uint8_t* opt_start, ui
     // Segment acknowledgment number used for last window update
     _snd.wl2 = th->ack;
 
-    // Setup initial congestion window
-    if (2190 < _snd.mss) {
-        _snd.cwnd = 2 * _snd.mss;
-    } else if (1095 < _snd.mss && _snd.mss <= 2190) {
-        _snd.cwnd = 3 * _snd.mss;
-    } else {
-        _snd.cwnd = 4 * _snd.mss;
-    }
-
-    // Setup initial slow start threshold
-    _snd.ssthresh = th->window << _snd.window_scale;
+    // Setup the initial congestion window and slow start threshold
+    _cc->connection_established(_snd.mss, th->window << _snd.window_scale);
 }
 
 template <typename InetTraits>
@@ -1080,6 +1614,33 @@ void tcp<InetTraits>::tcb::input_handle_listen_state(tcp_hdr* th, packet p) {
     do_syn_received();
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::input_handle_cookie_ack(tcp_hdr* th, packet p, uint16_t peer_mss) {
+    // Reconstruct the state a tcb in SYN_RECEIVED would have carried
+    // into ESTABLISHED.  The SYN's options are gone with the SYN, so
+    // cookie connections run without window scaling or SACK
+    tcp_debug("cookie ack: LISTEN -> ESTABLISHED\n");
+    _rcv.initial = th->seq - 1;
+    _rcv.next = th->seq;
+    _rcv.urgent = _rcv.next;
+    _rcv.window_scale = _option._local_win_scale = 0;
+    _rcv.mss = _option._local_mss = local_mss();
+    _rcv.window = _default_rcv_window;
+    _snd.initial = th->ack - 1;
+    _snd.unacknowledged = _snd.next = _snd.initial + 1;
+    _snd.window_scale = 0;
+    _snd.mss = peer_mss;
+    _snd.window = th->window;
+    _snd.wl1 = th->seq;
+    _snd.wl2 = th->ack;
+    _state = ESTABLISHED;
+    _connect_done.set_value();
+    _cc->connection_established(_snd.mss, _snd.window);
+    // The completing ACK may carry data; run it through the regular
+    // ESTABLISHED-state processing
+    input_handle_other_state(th, std::move(p));
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_syn_sent_state(tcp_hdr* th, packet p) {
     auto opt_len = th->data_offset * 4 - tcp_hdr::len;
@@ -1152,6 +1713,17 @@ void tcp<InetTraits>::tcb::input_handle_syn_sent_state(tcp_hdr* th, packet p) {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
+    // SACK blocks ride on duplicate ACKs; feed them to the scoreboard
+    // before the ACK processing below acts on the segment
+    auto opt_len = th->data_offset * 4 - tcp_hdr::len;
+    if (_option._sack_received && opt_len) {
+        auto opt_start = reinterpret_cast<uint8_t*>(p.get_header(0, th->data_offset * 4)) + tcp_hdr::len;
+        _option.parse_sack(opt_start, opt_start + opt_len);
+        if (_option._sack_rx_count) {
+            update_sack_scoreboard();
+            _option._sack_rx_count = 0;
+        }
+    }
     p.trim_front(th->data_offset * 4);
     bool do_output = false;
     bool do_output_data = false;
@@ -1298,8 +1870,7 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                     uint32_t smss = _snd.mss;
                     if (seg_ack > _snd.recover) {
                         tcp_debug("ack: full_ack\n");
-                        // Set cwnd to min (ssthresh, max(FlightSize, SMSS) + SMSS)
-                        _snd.cwnd = std::min(_snd.ssthresh, std::max(flight_size(), smss) + smss);
+                        _cc->on_full_ack(flight_size(), smss);
                         // Exit the fast recovery procedure
                         exit_fast_recovery();
                         set_retransmit_timer();
@@ -1307,14 +1878,7 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                         tcp_debug("ack: partial_ack\n");
                         // Retransmit the first unacknowledged segment
                         fast_retransmit();
-                        // Deflate the congestion window by the amount of new data
-                        // acknowledged by the Cumulative Acknowledgment field
-                        _snd.cwnd -= acked_bytes;
-                        // If the partial ACK acknowledges at least one SMSS of new
-                        // data, then add back SMSS bytes to the congestion window
-                        if (acked_bytes >= smss) {
-                            _snd.cwnd += smss;
-                        }
+                        _cc->on_partial_ack(acked_bytes, smss);
                         // Send a new segment if permitted by the new value of
                         // cwnd.  Do not exit the fast recovery procedure For
                         // the first partial ACK that arrives during fast
@@ -1354,19 +1918,22 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                     do_output_data = true;
                 } else if (_snd.dupacks == 3) {
                     // RFC6582 Step 3.2
-                    if (seg_ack - 1 > _snd.recover) {
+                    bool reset_window = seg_ack - 1 > _snd.recover;
+                    if (reset_window) {
                         _snd.recover = _snd.next - 1;
-                        // RFC5681 Step 3.2
-                        _snd.ssthresh = std::max((flight_size() - _snd.limited_transfer) / 2, 2 * smss);
                         fast_retransmit();
                     } else {
                         // Do not enter fast retransmit and do not reset ssthresh
                     }
-                    // RFC5681 Step 3.3
-                    _snd.cwnd = _snd.ssthresh + 3 * smss;
+                    // Limited transfer segments are not part of the
+                    // flight for window sizing purposes
+                    _cc->on_enter_fast_retransmit(flight_size() - _snd.limited_transfer, smss, reset_window);
                 } else if (_snd.dupacks > 3) {
-                    // RFC5681 Step 3.4
-                    _snd.cwnd += smss;
+                    _cc->on_dup_ack_in_recovery(smss);
+                    // With SACK the scoreboard can already show that later
+                    // holes are lost too; retransmit them now instead of
+                    // waiting one partial ACK (one RTT) per hole
+                    sack_retransmit();
                     // RFC5681 Step 3.5
                     do_output_data = true;
                 }
@@ -1438,8 +2005,10 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
             // RCV.NXT and RCV.WND should not be reduced.
             _rcv.data.push_back(std::move(p));
             _rcv.next += seg_len;
+            flow_metrics::local().account_rx(fid(), seg_len);
             auto merged = merge_out_of_order();
             signal_data_received();
+            maybe_tune_rcv_window();
             // Send an acknowledgment of the form:
             // <SEQ=SND.NXT><ACK=RCV.NXT><CTL=ACK>
             // This acknowledgment should be piggybacked on a segment being
@@ -1449,8 +2018,11 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                 // incoming segment fills in all or part of a gap in the
                 // sequence space.
                 do_output = true;
-            } else {
-                do_output = should_send_ack(seg_len);
+            } else if (should_send_ack(seg_len)) {
+                // The 2-MSS threshold (or a TSO-sized receive) wants an
+                // ACK; batch it with the rest of this poll rather than
+                // sending one mid-batch per threshold crossing
+                schedule_batched_ack();
             }
         }
     } else if (in_state(CLOSE_WAIT | CLOSING | LAST_ACK | TIME_WAIT)) {
@@ -1513,7 +2085,7 @@ packet tcp<InetTraits>::tcb::get_transmit_packet() {
     auto can_send = this->can_send();
     // Max number of TCP payloads we can pass to NIC
     uint32_t len;
-    if (_tcp.hw_features().tx_tso) {
+    if (_tcp.hw_features().can_tx_tso()) {
         // FIXME: Info tap device the size of the splitted packet
         len = _tcp.hw_features().max_packet_len - net::tcp_hdr_len_min - InetTraits::ip_hdr_len_min;
     } else {
@@ -1529,6 +2101,11 @@ packet tcp<InetTraits>::tcb::get_transmit_packet() {
     }
     // moderate case: need to split one packet
     if (_snd.unsent.front().len() > can_send) {
+        if (!_tcp.hw_features().can_tx_tso() && can_send == len) {
+            // this split is segmentation that TSO hardware would have
+            // done for us
+            ++sw_offload_fallback_stats::local().tx_seg;
+        }
         auto p = _snd.unsent.front().share(0, can_send);
         _snd.unsent.front().trim_front(can_send);
         _snd.unsent_len -= p.len();
@@ -1554,55 +2131,60 @@ packet tcp<InetTraits>::tcb::get_transmit_packet() {
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
+void tcp<InetTraits>::tcb::output_one(bool data_retransmit, size_t retransmit_idx) {
     if (in_state(CLOSED)) {
         return;
     }
 
-    packet p = data_retransmit ? _snd.data.front().p.share() : get_transmit_packet();
+    packet p = data_retransmit ? _snd.data[retransmit_idx].p.share() : get_transmit_packet();
     packet clone = p.share();  // early clone to prevent share() from calling packet::unuse_internal_data() on header.
     uint16_t len = p.len();
     bool syn_on = syn_needs_on();
     bool ack_on = ack_needs_on();
 
+    _option._sack_tx_count = 0;
+    if (ack_on && !syn_on && len == 0) {
+        // Pure ACKs carry SACK blocks; data segments are sized to fill
+        // the MTU and have no room left for options
+        fill_sack_blocks();
+    }
     auto options_size = _option.get_size(syn_on, ack_on);
     auto th = p.prepend_uninitialized_header(tcp_hdr::len + options_size);
-    auto h = tcp_hdr{};
+    // The constant fields (ports, zero checksum and urgent pointer) come
+    // pre-serialized from the connection's header template; only the
+    // per-segment fields are patched on top.
+    std::copy_n(_tx_hdr_template, tcp_hdr::len, th);
 
-    h.src_port = _local_port;
-    h.dst_port = _foreign_port;
-
-    h.f_syn = syn_on;
-    h.f_ack = ack_on;
     if (ack_on) {
         clear_delayed_ack();
+        // This segment carries the ACK, so a pending batched ACK task
+        // has nothing left to do
+        _batched_ack_pending = false;
     }
-    h.f_urg = false;
-    h.f_psh = false;
 
     tcp_seq seq;
     if (data_retransmit) {
         seq = _snd.unacknowledged;
+        for (size_t i = 0; i < retransmit_idx; i++) {
+            seq += _snd.data[i].p.len();
+        }
     } else {
         seq = syn_on ? _snd.initial : _snd.next;
         _snd.next += len;
     }
-    h.seq = seq;
-    h.ack = _rcv.next;
-    h.data_offset = (tcp_hdr::len + options_size) / 4;
-    h.window = _rcv.window >> _rcv.window_scale;
-    h.checksum = 0;
 
     // FIXME: does the FIN have to fit in the window?
     bool fin_on = fin_needs_on();
-    h.f_fin = fin_on;
+
+    _rcv.advertised = _rcv.next + _rcv.window;
+    tcp_hdr::patch(th, seq, _rcv.next, (tcp_hdr::len + options_size) / 4,
+                   fin_on, syn_on, ack_on, _rcv.window >> _rcv.window_scale);
 
     // Add tcp options
-    _option.fill(th, &h, options_size);
-    h.write(th);
+    _option.fill(th, syn_on, ack_on, options_size);
 
     offload_info oi;
-    checksummer csum;
+    checksummer csum = _pseudo_hdr_csum_base;
     uint16_t pseudo_hdr_seg_len = 0;
 
     oi.tcp_hdr_len = tcp_hdr::len + options_size;
@@ -1629,13 +2211,13 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
         oi.needs_csum = false;
     }
 
-    InetTraits::tcp_pseudo_header_checksum(csum, _local_ip, _foreign_ip,
-                                           pseudo_hdr_seg_len);
+    csum.sum(pseudo_hdr_seg_len);
 
     uint16_t checksum;
     if (_tcp.hw_features().tx_csum_l4_offload) {
         checksum = ~csum.get();
     } else {
+        ++sw_offload_fallback_stats::local().tx_l4_csum;
         csum.sum(p);
         checksum = csum.get();
     }
@@ -1657,6 +2239,11 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
         }
     }
 
+    if (!data_retransmit) {
+        // retransmissions are counted separately, in retransmit() and
+        // fast_retransmit()
+        flow_metrics::local().account_tx(fid(), len);
+    }
     queue_packet(std::move(p));
 }
 
@@ -1700,7 +2287,7 @@ void tcp<InetTraits>::tcb::connect() {
     // Maximum segment size local can receive
     _rcv.mss = _option._local_mss = local_mss();
     // Linux's default window size
-    _rcv.window = 29200 << _rcv.window_scale;
+    _rcv.window = _default_rcv_window << _rcv.window_scale;
 
     do_syn_sent();
 }
@@ -1802,10 +2389,12 @@ void tcp<InetTraits>::tcb::clear_delayed_ack() {
 template <typename InetTraits>
 bool tcp<InetTraits>::tcb::merge_out_of_order() {
     bool merged = false;
-    if (_rcv.out_of_order.map.empty()) {
+    auto& segments = _rcv.out_of_order.segments;
+    if (segments.empty()) {
         return merged;
     }
-    for (auto it = _rcv.out_of_order.map.begin(); it != _rcv.out_of_order.map.end();) {
+    auto it = segments.begin();
+    for (; it != segments.end(); ++it) {
         auto& p = it->second;
         auto seg_beg = it->first;
         auto seg_len = p.len();
@@ -1820,19 +2409,18 @@ bool tcp<InetTraits>::tcb::merge_out_of_order() {
             }
             _rcv.next += seg_len;
             _rcv.data.push_back(std::move(p));
-            // Since c++11, erase() always returns the value of the following element
-            it = _rcv.out_of_order.map.erase(it);
             merged = true;
         } else if (_rcv.next >= seg_end) {
             // This segment has been receive already, drop it
-            it = _rcv.out_of_order.map.erase(it);
         } else {
             // seg_beg > _rcv.need, can not merge. Note, seg_beg can grow only,
             // so we can stop looking here.
-            it++;
             break;
         }
     }
+    // Erase everything consumed above in one go rather than shifting the
+    // vector once per segment
+    segments.erase(segments.begin(), it);
     return merged;
 }
 
@@ -1895,24 +2483,25 @@ void tcp<InetTraits>::tcb::retransmit() {
         return;
     }
 
+    // RFC2018: SACK information is advisory and the receiver may renege
+    // on it, so after a timeout start over from the cumulative ACK
+    for (auto& seg : _snd.data) {
+        seg.sacked = false;
+    }
+
     // If there are unacked data, retransmit the earliest segment
     auto& unacked_seg = _snd.data.front();
 
-    // According to RFC5681
-    // Update ssthresh only for the first retransmit
     uint32_t smss = _snd.mss;
-    if (unacked_seg.nr_transmits == 0) {
-        _snd.ssthresh = std::max(flight_size() / 2, 2 * smss);
-    }
+    _cc->on_retransmit_timeout(flight_size(), smss, unacked_seg.nr_transmits == 0);
     // RFC6582 Step 4
     _snd.recover = _snd.next - 1;
-    // Start the slow start process
-    _snd.cwnd = smss;
     // End fast recovery
     exit_fast_recovery();
 
     if (unacked_seg.nr_transmits < _max_nr_retransmit) {
         unacked_seg.nr_transmits++;
+        flow_metrics::local().account_retransmit(fid());
     } else {
         // Delete connection when max num of retransmission is reached
         cleanup();
@@ -1928,11 +2517,90 @@ void tcp<InetTraits>::tcb::fast_retransmit() {
     if (!_snd.data.empty()) {
         auto& unacked_seg = _snd.data.front();
         unacked_seg.nr_transmits++;
+        flow_metrics::local().account_retransmit(fid());
         retransmit_one();
         output();
     }
 }
 
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_sack_scoreboard() {
+    for (uint8_t i = 0; i < _option._sack_rx_count; i++) {
+        auto start = tcp_seq{_option._sack_rx[i].start};
+        auto end = tcp_seq{_option._sack_rx[i].end};
+        if (!(start < end) || end <= _snd.unacknowledged) {
+            // Malformed block, or a D-SACK for data already acked
+            continue;
+        }
+        auto seq = _snd.unacknowledged;
+        for (auto& seg : _snd.data) {
+            auto seg_end = seq + seg.p.len();
+            if (end <= seq) {
+                break;
+            }
+            if (start <= seq && seg_end <= end) {
+                seg.sacked = true;
+            }
+            seq = seg_end;
+        }
+    }
+}
+
+template <typename InetTraits>
+bool tcp<InetTraits>::tcb::sack_retransmit() {
+    // RFC6675-style loss detection: a hole is treated as lost once at
+    // least 3 * SMSS bytes above it have been SACKed. Retransmit the
+    // earliest such hole not already retransmitted; nr_transmits keeps
+    // us from sending the same hole again on every duplicate ACK.
+    uint32_t sacked_total = 0;
+    for (auto& seg : _snd.data) {
+        if (seg.sacked) {
+            sacked_total += seg.p.len();
+        }
+    }
+    if (!sacked_total) {
+        return false;
+    }
+    uint32_t sacked_below = 0;
+    for (size_t i = 0; i < _snd.data.size(); i++) {
+        auto& seg = _snd.data[i];
+        if (seg.sacked) {
+            sacked_below += seg.p.len();
+            continue;
+        }
+        if (sacked_total - sacked_below < 3 * uint32_t(_snd.mss)) {
+            // Not enough SACKed data above this hole to call it lost,
+            // and later holes have even less above them
+            return false;
+        }
+        if (seg.nr_transmits == 0) {
+            seg.nr_transmits++;
+            flow_metrics::local().account_retransmit(fid());
+            retransmit_one(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::fill_sack_blocks() {
+    if (!_option._sack_received) {
+        return;
+    }
+    // The out-of-order merger keeps segments sorted, so the first blocks
+    // describe the holes closest to rcv.next - the ones the peer needs to
+    // fill first
+    for (auto& seg : _rcv.out_of_order.segments) {
+        if (_option._sack_tx_count == tcp_option::max_sack_blocks) {
+            break;
+        }
+        auto& blk = _option._sack_tx[_option._sack_tx_count++];
+        blk.start = seg.first.raw;
+        blk.end = (seg.first + seg.second.len()).raw;
+    }
+}
+
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
     // Update RTO according to RFC6298
@@ -1960,25 +2628,67 @@ void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::update_cwnd(uint32_t acked_bytes) {
-    uint32_t smss = _snd.mss;
-    if (_snd.cwnd < _snd.ssthresh) {
-        // In slow start phase
-        _snd.cwnd += std::min(acked_bytes, smss);
-    } else {
-        // In congestion avoidance phase
-        uint32_t round_up = 1;
-        _snd.cwnd += std::max(round_up, smss * smss / _snd.cwnd);
+void tcp<InetTraits>::tcb::maybe_tune_rcv_window() {
+    if (_snd.first_rto_sample) {
+        // No RTT estimate yet, keep the default window
+        return;
+    }
+    auto now = clock_type::now();
+    if (_rcv.tune_start == clock_type::time_point()) {
+        _rcv.tune_mark = _rcv.next;
+        _rcv.tune_start = now;
+        return;
     }
+    if (now - _rcv.tune_start < _snd.srtt) {
+        return;
+    }
+    // Dynamic right-sizing: the data delivered over the last RTT
+    // approximates the path's bandwidth-delay product.  Advertise twice
+    // that, so the window stays ahead of the sender while it grows, and
+    // the path rather than the receiver becomes the limit
+    auto delivered = uint32_t(_rcv.next - _rcv.tune_mark);
+    _rcv.tune_mark = _rcv.next;
+    _rcv.tune_start = now;
+    auto target = std::max(delivered * 2, _rcv.window);
+    // The 16-bit window field caps what the negotiated scale factor can
+    // express
+    target = std::min(target, uint32_t(65535) << _rcv.window_scale);
+    // Per-connection receive buffering is cheap to shed when the shard
+    // is short on memory: stop growing under pressure, fall back to the
+    // unscaled default when allocation failure is imminent
+    switch (memory::current_reclaim_pressure()) {
+    case memory::reclaim_pressure::relaxed:
+        break;
+    case memory::reclaim_pressure::pressured:
+        target = std::min(target, _default_rcv_window << _rcv.window_scale);
+        break;
+    case memory::reclaim_pressure::critical:
+        target = std::min(target, _default_rcv_window);
+        break;
+    }
+    // Never pull back a right edge already offered to the peer
+    if (_rcv.advertised > _rcv.next) {
+        target = std::max(target, uint32_t(_rcv.advertised - _rcv.next));
+    }
+    _rcv.window = target;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_cwnd(uint32_t acked_bytes) {
+    // No RTT estimate exists until the first sample is taken
+    auto srtt = _snd.first_rto_sample ? std::chrono::milliseconds(0) : _snd.srtt;
+    _cc->on_ack(acked_bytes, _snd.mss, flight_size(), srtt);
 }
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::cleanup() {
     _snd.unsent.clear();
     _snd.data.clear();
-    _rcv.out_of_order.map.clear();
+    _rcv.out_of_order.segments.clear();
     _rcv.data.clear();
     stop_retransmit_timer();
+    _pacing_timer.cancel();
+    _pacing_blocked = false;
     clear_delayed_ack();
     remove_from_tcbs();
 }
@@ -2002,6 +2712,49 @@ tcp_seq tcp<InetTraits>::tcb::get_isn() {
     return make_seq(seq);
 }
 
+template <typename InetTraits>
+uint32_t tcp<InetTraits>::tcb::syn_cookie_hash(connid id, uint32_t extra) {
+    uint32_t hash[4];
+    hash[0] = id.local_ip.ip;
+    hash[1] = id.foreign_ip.ip;
+    hash[2] = (id.local_port << 16) + id.foreign_port;
+    hash[3] = extra ^ _isn_secret.key[14];
+    CryptoPP::Weak::MD5::Transform(hash, _isn_secret.key);
+    return hash[1];
+}
+
+template <typename InetTraits>
+tcp_seq tcp<InetTraits>::tcb::make_syn_cookie(connid id, tcp_seq irs, uint16_t peer_mss) {
+    using namespace std::chrono;
+    uint32_t mss_idx = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        if (_cookie_mss[i] <= peer_mss) {
+            mss_idx = i;
+        }
+    }
+    uint32_t t = duration_cast<seconds>(clock_type::now().time_since_epoch()).count() & 0x3f;
+    auto h = syn_cookie_hash(id, irs.raw + (t << 8) + mss_idx);
+    return make_seq((h & 0xffffff00) | (t << 2) | mss_idx);
+}
+
+template <typename InetTraits>
+uint16_t tcp<InetTraits>::tcb::verify_syn_cookie(connid id, tcp_seq irs, tcp_seq cookie) {
+    using namespace std::chrono;
+    uint32_t mss_idx = cookie.raw & 0x3;
+    uint32_t t = (cookie.raw >> 2) & 0x3f;
+    // Cookies stay valid for a few seconds: enough for the ACK's round
+    // trip, short enough to bound replay
+    uint32_t now = duration_cast<seconds>(clock_type::now().time_since_epoch()).count() & 0x3f;
+    if (((now - t) & 0x3f) > 4) {
+        return 0;
+    }
+    auto h = syn_cookie_hash(id, irs.raw + (t << 8) + mss_idx);
+    if ((h & 0xffffff00) != (cookie.raw & 0xffffff00)) {
+        return 0;
+    }
+    return _cookie_mss[mss_idx];
+}
+
 template <typename InetTraits>
 std::experimental::optional<typename InetTraits::l4packet> tcp<InetTraits>::tcb::get_packet() {
     _poll_active = false;
@@ -2021,7 +2774,15 @@ std::experimental::optional<typename InetTraits::l4packet> tcp<InetTraits>::tcb:
         // If there are packets to send in the queue or tcb is allowed to send
         // more add tcp back to polling set to keep sending. In addition, dupacks >= 3
         // is an indication that an segment is lost, stop sending more in this case.
-        output();
+        auto delay = _cc->pacing_delay(p.p.len());
+        if (delay.count()) {
+            // A pacing algorithm spreads the window over the round trip
+            // instead of releasing it back to back
+            _pacing_blocked = true;
+            _pacing_timer.arm(delay);
+        } else {
+            output();
+        }
     }
     return std::move(p);
 }
@@ -2062,6 +2823,9 @@ constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_clk_granularity;
 template <typename InetTraits>
 typename tcp<InetTraits>::tcb::isn_secret tcp<InetTraits>::tcb::_isn_secret;
 
+template <typename InetTraits>
+constexpr uint16_t tcp<InetTraits>::tcb::_cookie_mss[4];
+
 }
 
 
@@ -290,6 +290,9 @@ public:
             _load_system_trust = false; // should only do once, for whatever reason
         });
     }
+    void enable_handshake_offload(bool enable) {
+        _handshake_offload = enable;
+    }
 private:
     friend class credentials_builder;
     friend class session;
@@ -297,6 +300,9 @@ private:
     bool need_load_system_trust() const {
         return _load_system_trust;
     }
+    bool handshake_offload() const {
+        return _handshake_offload;
+    }
     future<> maybe_load_system_trust() {
         return with_semaphore(_system_trust_sem, 1, [this] {
             if (!_load_system_trust) {
@@ -309,6 +315,7 @@ private:
     gnutls_certificate_credentials_t _creds;
     std::unique_ptr<tls::dh_params::impl> _dh_params;
     bool _load_system_trust = false;
+    bool _handshake_offload = false;
     semaphore _system_trust_sem;
 };
 
@@ -379,6 +386,10 @@ future<> seastar::tls::certificate_credentials::set_system_trust() {
     return _impl->set_system_trust();
 }
 
+void seastar::tls::certificate_credentials::enable_handshake_offload(bool enable) {
+    _impl->enable_handshake_offload(enable);
+}
+
 seastar::tls::server_credentials::server_credentials(::shared_ptr<dh_params> dh)
     : server_credentials(*dh)
 {}
@@ -573,13 +584,52 @@ public:
                return handshake();
             });
         }
-        auto res = gnutls_handshake(_session);
+        // Only the initial handshake is offloaded; once the connection
+        // carries traffic, a rehandshake step running off-reactor could
+        // overlap with record send/recv on the same gnutls session.
+        if (_creds->_impl->handshake_offload() && !_handshake_done) {
+            return offloaded_handshake_step();
+        }
+        return handle_handshake_result(gnutls_handshake(_session), false);
+    }
+
+    // Runs one gnutls_handshake() step on the helper thread pool, where
+    // the asymmetric crypto cannot stall the reactor.  Transport I/O is
+    // staged in memory: pull() already reads from _input, and vec_push()
+    // collects the encrypted output in _staged_output for the reactor to
+    // send once the step completes.  Nothing else touches this session
+    // while the step is in flight.
+    future<> offloaded_handshake_step() {
+        _push_staging = true;
+        return engine().submit_blocking<int>([this] {
+            return gnutls_handshake(_session);
+        }).then([this](int res) {
+            _push_staging = false;
+            return flush_staged_output().then([this, res] {
+                return handle_handshake_result(res, true);
+            });
+        });
+    }
+
+    future<> flush_staged_output() {
+        if (_staged_output.empty()) {
+            return make_ready_future<>();
+        }
+        scattered_message<char> msg;
+        msg.append(sstring(_staged_output.data(), _staged_output.size()));
+        _staged_output.clear();
+        return _out.put(std::move(msg).release());
+    }
+
+    future<> handle_handshake_result(int res, bool offloaded) {
         if (res < 0) {
             switch (res) {
             case GNUTLS_E_AGAIN:
                 // Could not send/recv data immediately.
                 // Ask gnutls which direction we are waiting for.
-                if (gnutls_record_get_direction(_session) == 0) {
+                // In the offloaded path the output was staged and already
+                // flushed, so EAGAIN can only mean missing input.
+                if (offloaded || gnutls_record_get_direction(_session) == 0) {
                     return wait_for_input().then([this] {
                         return handshake();
                     });
@@ -599,6 +649,7 @@ public:
         if (_type == type::CLIENT) {
             verify();
         }
+        _handshake_done = true;
         return make_ready_future<>();
     }
 
@@ -676,6 +727,18 @@ public:
         return n;
     }
     ssize_t vec_push(const giovec_t * iov, int iovcnt) {
+        if (_push_staging) {
+            // handshake step running on a helper thread: collect the
+            // encrypted output in memory; the reactor sends it once the
+            // step is done
+            size_t n = 0;
+            for (int i = 0; i < iovcnt; ++i) {
+                auto p = reinterpret_cast<const char *>(iov[i].iov_base);
+                _staged_output.insert(_staged_output.end(), p, p + iov[i].iov_len);
+                n += iov[i].iov_len;
+            }
+            return n;
+        }
         // Sending is a pain.
         // While gnutls handles async IO, it assumes
         // that if it get EAGAIN (io would block)
@@ -817,6 +880,24 @@ public:
     net::keepalive_params get_keepalive_parameters() const override {
         return _sock->get_keepalive_parameters();
     }
+    void set_sndbuf(size_t bytes) override {
+        _sock->set_sndbuf(bytes);
+    }
+    size_t get_sndbuf() const override {
+        return _sock->get_sndbuf();
+    }
+    void set_rcvbuf(size_t bytes) override {
+        _sock->set_rcvbuf(bytes);
+    }
+    size_t get_rcvbuf() const override {
+        return _sock->get_rcvbuf();
+    }
+    void set_notsent_lowat(size_t bytes) override {
+        _sock->set_notsent_lowat(bytes);
+    }
+    void set_busy_poll(std::chrono::microseconds us) override {
+        _sock->set_busy_poll(us);
+    }
 
     // helper for sink
     future<> flush() {
@@ -840,6 +921,10 @@ private:
     std::exception_ptr _output_exception;
     size_t _out_expect = 0;
     buf_type _input;
+    bool _handshake_done = false;
+    // handshake offload (see offloaded_handshake_step())
+    bool _push_staging = false;
+    std::vector<char> _staged_output;
 
     gnutls_session_t _session;
 };
@@ -852,19 +937,32 @@ public:
     }
 private:
     future<temporary_buffer<char>> get() override {
-        // gnutls might have stuff in its buffers.
-        auto avail = gnutls_record_check_pending(_session);
-        if (avail == 0) {
-            // or we might...
-            avail = _session.in_avail();
-        }
+        // gnutls might have stuff in its buffers, and we might have
+        // undecrypted ciphertext; drain both in one pass instead of one
+        // record per call.  Typically, unencrypted data can get smaller
+        // (padding), but not larger, so their sum bounds the plaintext.
+        auto avail = gnutls_record_check_pending(_session)
+                + _session.in_avail();
         if (avail != 0) {
-            // typically, unencrypted data can get smaller (padding),
-            // but not larger.
             temporary_buffer<char> output(avail);
-            auto n = gnutls_record_recv(_session, output.get_write(),
-                    output.size());
-            if (n < 0) {
+            size_t off = 0;
+            while (off < output.size()) {
+                auto n = gnutls_record_recv(_session, output.get_write() + off,
+                        output.size() - off);
+                if (n > 0) {
+                    off += n;
+                    continue;
+                }
+                if (n == 0) {
+                    // clean close; anything decrypted so far is still
+                    // delivered, and the next get() reports eof
+                    break;
+                }
+                if (off != 0) {
+                    // deliver what we have; the condition repeats on the
+                    // next call, with nothing consumed in between
+                    break;
+                }
                 switch (n) {
                 case GNUTLS_E_AGAIN:
                     // Assume we got this because we read to little underlying
@@ -879,7 +977,7 @@ private:
                     return make_exception_future<temporary_buffer<char>>(std::system_error(n, glts_errorc));
                 }
             }
-            output.trim(n);
+            output.trim(off);
             return make_ready_future<temporary_buffer<char>>(std::move(output));
         }
         if (_session.eof()) {
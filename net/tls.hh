@@ -144,6 +144,13 @@ namespace tls {
          */
         future<> set_system_trust();
 
+        /**
+         * Runs the CPU-heavy parts of handshakes for sessions created
+         * from these credentials on the reactor's helper thread pool,
+         * so e.g. a reconnect storm does not stall the shard.
+         */
+        void enable_handshake_offload(bool enable = true);
+
         // TODO add methods for certificate verification
     private:
         class impl;
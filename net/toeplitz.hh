@@ -45,6 +45,9 @@
 #define TOEPLITZ_HH_
 
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
 
 using rss_key_type = std::vector<uint8_t>;
 
@@ -90,4 +93,59 @@ toeplitz_hash(const rss_key_type& key, const T& data)
 	}
 	return (hash);
 }
+
+// Precomputed Toeplitz: _table[i][v] is the hash contribution of data
+// byte i having value v, so hashing n bytes costs n table lookups and
+// xors instead of the 8n shift-and-test steps of toeplitz_hash().
+// Build one per RSS key (the table is key-dependent) and reuse it; this
+// sits in the per-packet receive path when the NIC doesn't compute the
+// RSS hash itself.
+class toeplitz_hasher {
+    std::vector<std::array<uint32_t, 256>> _table;
+private:
+    // the 32 key bits starting at bit n; zeros past the end of the key
+    static uint32_t key_window(const rss_key_type& key, size_t n) {
+        uint32_t v = 0;
+        for (unsigned b = 0; b < 32; b++) {
+            auto bit = n + b;
+            auto i = bit / 8;
+            v <<= 1;
+            if (i < key.size() && (key[i] & (1 << (7 - bit % 8)))) {
+                v |= 1;
+            }
+        }
+        return v;
+    }
+public:
+    toeplitz_hasher() = default;
+    explicit toeplitz_hasher(const rss_key_type& key) : _table(key.size()) {
+        // data bytes at or past key.size() only meet zero key bits, so
+        // the table stops there and hash() ignores them, like the
+        // bit-serial version does
+        for (size_t i = 0; i < _table.size(); i++) {
+            uint32_t bit_contrib[8];
+            for (unsigned b = 0; b < 8; b++) {
+                bit_contrib[b] = key_window(key, i * 8 + b);
+            }
+            for (unsigned v = 0; v < 256; v++) {
+                uint32_t h = 0;
+                for (unsigned b = 0; b < 8; b++) {
+                    if (v & (1 << (7 - b))) {
+                        h ^= bit_contrib[b];
+                    }
+                }
+                _table[i][v] = h;
+            }
+        }
+    }
+    template<typename T>
+    uint32_t hash(const T& data) const {
+        uint32_t h = 0;
+        auto n = std::min(data.size(), _table.size());
+        for (size_t i = 0; i < n; i++) {
+            h ^= _table[i][data[i]];
+        }
+        return h;
+    }
+};
 #endif
@@ -91,6 +91,18 @@ public:
         return _state->_queue.pop_eventually();
     }
 
+    virtual future<std::vector<udp_datagram>> receive_batch() override {
+        return _state->_queue.not_empty().then([this] {
+            // Drain everything the last poll delivered in one go
+            std::vector<udp_datagram> batch;
+            batch.reserve(_state->_queue.size());
+            while (!_state->_queue.empty()) {
+                batch.push_back(_state->_queue.pop());
+            }
+            return batch;
+        });
+    }
+
     virtual future<> send(ipv4_addr dst, const char* msg) override {
         return send(dst, packet::from_static_data(msg, strlen(msg)));
     }
@@ -103,6 +115,20 @@ public:
         });
     }
 
+    virtual future<> send_batch(ipv4_addr dst, std::vector<packet> ps) override {
+        size_t len = 0;
+        for (auto& p : ps) {
+            len += p.len();
+        }
+        return _state->wait_for_send_buffer(len).then([this, dst, ps = std::move(ps)] () mutable {
+            for (auto& p : ps) {
+                auto plen = p.len();
+                p = packet(std::move(p), make_deleter([s = _state, plen] { s->complete_send(plen); }));
+            }
+            _proto.send_batch(_reg.port(), dst, std::move(ps));
+        });
+    }
+
     virtual bool is_closed() const {
         return _closed;
     }
@@ -154,7 +180,7 @@ void ipv4_udp::received(packet p, ipv4_address from, ipv4_address to)
     }
 }
 
-void ipv4_udp::send(uint16_t src_port, ipv4_addr dst, packet &&p)
+void ipv4_udp::prepare_datagram(uint16_t src_port, ipv4_addr dst, packet& p)
 {
     auto src = _inet.host_address();
     auto hdr = p.prepend_header<udp_hdr>();
@@ -171,18 +197,38 @@ void ipv4_udp::send(uint16_t src_port, ipv4_addr dst, packet &&p)
         hdr->cksum = ~csum.get();
         oi.needs_csum = true;
     } else {
+        ++sw_offload_fallback_stats::local().tx_l4_csum;
         csum.sum(p);
         hdr->cksum = csum.get();
         oi.needs_csum = false;
     }
     oi.protocol = ip_protocol_num::udp;
     p.set_offload_info(oi);
+}
+
+void ipv4_udp::send(uint16_t src_port, ipv4_addr dst, packet &&p)
+{
+    prepare_datagram(src_port, dst, p);
 
     _inet.get_l2_dst_address(dst).then([this, dst, p = std::move(p)] (ethernet_address e_dst) mutable {
         _packetq.emplace_back(ipv4_traits::l4packet{dst, std::move(p), e_dst, ip_protocol_num::udp});
     });
 }
 
+void ipv4_udp::send_batch(uint16_t src_port, ipv4_addr dst, std::vector<packet> ps)
+{
+    for (auto& p : ps) {
+        prepare_datagram(src_port, dst, p);
+    }
+
+    // One neighbor lookup serves the whole batch
+    _inet.get_l2_dst_address(dst).then([this, dst, ps = std::move(ps)] (ethernet_address e_dst) mutable {
+        for (auto& p : ps) {
+            _packetq.emplace_back(ipv4_traits::l4packet{dst, std::move(p), e_dst, ip_protocol_num::udp});
+        }
+    });
+}
+
 uint16_t ipv4_udp::next_port(uint16_t port) {
     return (port + 1) == 0 ? min_anonymous_port : port + 1;
 }
@@ -69,11 +69,44 @@ private:
     boost::program_options::variables_map _opts;
     net::hw_features _hw_features;
     uint64_t _features;
+    uint16_t _queues_count;
 
 private:
+    // One queue pair per shard, if the host lets us have them. With the
+    // vhost backend a "queue pair" is a separate tap queue (IFF_MULTI_QUEUE,
+    // Linux 3.8+) driven by its own vhost-net device, so instead of
+    // negotiating VIRTIO_NET_F_MQ we probe the tap driver and attach one
+    // queue fd per shard. Without multiqueue support everything funnels
+    // through the cpu0 queue and the other shards get proxy devices.
+    static uint16_t queues_count() {
+#ifdef HAVE_OSV
+        if (osv::assigned_virtio::get && osv::assigned_virtio::get()) {
+            // The OSv assigned-virtio interface drives a single queue pair.
+            return 1;
+        }
+#endif
+        if (smp::count == 1) {
+            return 1;
+        }
+        try {
+            file_desc tun_fd(file_desc::open("/dev/net/tun", O_RDWR | O_NONBLOCK));
+            unsigned int features = 0;
+            tun_fd.ioctl<unsigned int>(TUNGETFEATURES, features);
+            if (features & IFF_MULTI_QUEUE) {
+                return smp::count;
+            }
+        } catch (std::system_error&) {
+            // No tap device at all; init_local_queue() will report it.
+        }
+        return 1;
+    }
+
     uint64_t setup_features() {
-        int64_t seastar_supported_features = VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_NET_F_MRG_RXBUF;
+        int64_t seastar_supported_features = VIRTIO_NET_F_MRG_RXBUF;
 
+        if (!(_opts.count("indirect") && _opts["indirect"].as<std::string>() == "off")) {
+            seastar_supported_features |= VIRTIO_RING_F_INDIRECT_DESC;
+        }
         if (!(_opts.count("event-index") && _opts["event-index"].as<std::string>() == "off")) {
             seastar_supported_features |= VIRTIO_RING_F_EVENT_IDX;
         }
@@ -113,7 +146,7 @@ private:
 
 public:
     device(boost::program_options::variables_map opts)
-       : _opts(opts), _features(setup_features())
+       : _opts(opts), _features(setup_features()), _queues_count(queues_count())
        {}
     ethernet_address hw_address() override {
         return { 0x12, 0x23, 0x34, 0x56, 0x67, 0x78 };
@@ -127,6 +160,10 @@ public:
         return _features;
     }
 
+    virtual uint16_t hw_queues_count() override {
+        return _queues_count;
+    }
+
     virtual std::unique_ptr<net::qp> init_local_queue(boost::program_options::variables_map opts, uint16_t qid) override;
 };
 
@@ -194,6 +231,16 @@ struct buffer {
     bool writeable;
 };
 
+// Allocate and zero-initialize a buffer which is page-aligned and can be
+// used for virt_to_phys (i.e., physically contiguous).
+static std::unique_ptr<char[], free_deleter> virtio_buffer(size_t size) {
+    void* ret;
+    auto r = posix_memalign(&ret, 4096, size);
+    assert(r == 0);
+    bzero(ret, size);
+    return std::unique_ptr<char[], free_deleter>(reinterpret_cast<char*>(ret));
+}
+
 // The 'buffer_chain' concept, used in vring, is a container of buffers, as in:
 //
 //   using buffer_chain = std::vector<buffer>;
@@ -286,10 +333,18 @@ private:
         uint16_t _tail = 0;
     };
 private:
+    // Largest buffer chain an indirect table can describe; enough for a
+    // 64 KB TSO packet built from 2 KB fragments plus the virtio header.
+    // Longer chains fall back to direct descriptors.
+    static constexpr unsigned max_indirect_entries = 33;
+
     ring_config _config;
     Completion _complete;
     std::unique_ptr<notifier> _notifier;
     std::unique_ptr<BufferChain[]> _buffer_chains;
+    // One pre-allocated indirect table per descriptor slot, so the post
+    // path never allocates (null when the indirect feature is off).
+    std::unique_ptr<char[], free_deleter> _indirect_storage;
     desc* _descs;
     avail _avail;
     used _used;
@@ -325,7 +380,22 @@ public:
     void post(Iterator begin, Iterator end);
 
     semaphore& available_descriptors() { return _available_descriptors; }
+
+    // Number of descriptor-ring slots a chain of @nr_bufs buffers will
+    // occupy. With indirect descriptors a multi-buffer chain folds into a
+    // single slot, so more packets fit in flight in the same ring.
+    unsigned descriptors_needed(unsigned nr_bufs) {
+        if (_config.indirect && nr_bufs > 1 && nr_bufs <= max_indirect_entries) {
+            return 1;
+        }
+        return nr_bufs;
+    }
 private:
+    desc* indirect_table(unsigned desc_idx) {
+        return reinterpret_cast<desc*>(_indirect_storage.get()
+                + desc_idx * max_indirect_entries * sizeof(desc));
+    }
+
     bool notifications_disabled() {
         return (_used._shared->_flags.load(std::memory_order_relaxed) & VRING_USED_F_NO_NOTIFY) != 0;
     }
@@ -385,6 +455,9 @@ vring<BufferChain, Completion>::vring(ring_config conf, Completion complete)
     : _config(conf)
     , _complete(complete)
     , _buffer_chains(new BufferChain[_config.size])
+    , _indirect_storage(conf.indirect
+            ? virtio_buffer(conf.size * max_indirect_entries * sizeof(desc))
+            : nullptr)
     , _descs(reinterpret_cast<desc*>(conf.descs))
     , _avail(conf)
     , _used(conf)
@@ -413,21 +486,50 @@ template <typename Iterator>
 void vring<BufferChain, Completion>::post(Iterator begin, Iterator end) {
     for (auto bci = begin; bci!= end; ++bci) {
         auto&& bc = *bci;
-        desc pseudo_head = {};
-        desc* prev = &pseudo_head;
+        unsigned nr_bufs = 0;
         for (auto i = bc.begin(); i != bc.end(); ++i) {
-            unsigned desc_idx = allocate_desc();
-            prev->_flags.has_next = true;
-            prev->_next = desc_idx;
-            desc &d = _descs[desc_idx];
+            ++nr_bufs;
+        }
+        uint16_t desc_head;
+        if (descriptors_needed(nr_bufs) < nr_bufs) {
+            // Lay the whole chain out in this slot's indirect table; the
+            // ring descriptor itself just points at the table.
+            desc_head = allocate_desc();
+            auto table = indirect_table(desc_head);
+            unsigned n = 0;
+            for (auto i = bc.begin(); i != bc.end(); ++i, ++n) {
+                auto&& b = *i;
+                desc& d = table[n];
+                d._flags = {};
+                d._flags.writeable = b.writeable;
+                d._flags.has_next = true;
+                d._next = n + 1;
+                d._paddr = b.addr;
+                d._len = b.len;
+            }
+            table[n - 1]._flags.has_next = false;
+            desc& d = _descs[desc_head];
             d._flags = {};
-            auto&& b = *i;
-            d._flags.writeable = b.writeable;
-            d._paddr = b.addr;
-            d._len = b.len;
-            prev = &d;
+            d._flags.indirect = true;
+            d._paddr = virt_to_phys(table);
+            d._len = n * sizeof(desc);
+        } else {
+            desc pseudo_head = {};
+            desc* prev = &pseudo_head;
+            for (auto i = bc.begin(); i != bc.end(); ++i) {
+                unsigned desc_idx = allocate_desc();
+                prev->_flags.has_next = true;
+                prev->_next = desc_idx;
+                desc &d = _descs[desc_idx];
+                d._flags = {};
+                auto&& b = *i;
+                d._flags.writeable = b.writeable;
+                d._paddr = b.addr;
+                d._len = b.len;
+                prev = &d;
+            }
+            desc_head = pseudo_head._next;
         }
-        auto desc_head = pseudo_head._next;
         _buffer_chains[desc_head] = std::move(bc);
         _avail._shared->_ring[masked(_avail._head++)] = desc_head;
         _avail._avail_added_since_kick++;
@@ -438,8 +540,10 @@ void vring<BufferChain, Completion>::post(Iterator begin, Iterator end) {
 
 template <typename BufferChain, typename Completion>
 bool vring<BufferChain, Completion>::do_complete() {
+    // A single acquire pairs with the host's release store of _idx and
+    // covers the whole batch of used elements we consume below.
     auto used_head = _used._shared->_idx.load(std::memory_order_acquire);
-    auto count = _used._tail - used_head;
+    uint16_t count = used_head - _used._tail;
     _complete.bunch(count);
     while (used_head != _used._tail) {
         auto ue = _used._shared->_used_elements[masked(_used._tail++)];
@@ -450,6 +554,8 @@ bool vring<BufferChain, Completion>::do_complete() {
         } else {
             _free_head = id;
         }
+        // An indirect head carries its chain in the side table, so it has
+        // no has_next and frees as a single descriptor.
         while (true) {
             auto& d = _descs[id];
             if (!d._flags.has_next) {
@@ -499,7 +605,7 @@ protected:
             void operator()(packet_as_buffer_chain&& bc, size_t len) {
                 // move the packet here, to be destroyed on scope exit
                 auto p = std::move(bc.p);
-                q._ring.available_descriptors().signal(p.nr_frags());
+                q._ring.available_descriptors().signal(q._ring.descriptors_needed(p.nr_frags()));
             }
             void bunch(uint64_t c) {}
         };
@@ -592,7 +698,7 @@ qp::txq::post(circular_buffer<packet>& pb) {
 
     _packets.clear();
 
-    while (!pb.empty() && pb.front().nr_frags() + 1 <= _ring.available_descriptors().current()) {
+    while (!pb.empty() && _ring.descriptors_needed(pb.front().nr_frags() + 1) <= _ring.available_descriptors().current()) {
         net_hdr_mrg vhdr = {};
         auto p = std::move(pb.front());
 
@@ -640,7 +746,7 @@ qp::txq::post(circular_buffer<packet>& pb) {
         // prepend virtio-net header
         packet q = packet(fragment{reinterpret_cast<char*>(&vhdr), _dev._header_len},
                 std::move(p));
-        auto fut = _ring.available_descriptors().wait(q.nr_frags());
+        auto fut = _ring.available_descriptors().wait(_ring.descriptors_needed(q.nr_frags()));
         assert(fut.available()); // how it cannot?
         _packets.emplace_back(packet_as_buffer_chain{ std::move(q) });
     }
@@ -739,16 +845,6 @@ qp::rxq::complete_buffer(single_buffer&& bc, size_t len) {
     }
 }
 
-// Allocate and zero-initialize a buffer which is page-aligned and can be
-// used for virt_to_phys (i.e., physically contiguous).
-static std::unique_ptr<char[], free_deleter> virtio_buffer(size_t size) {
-    void* ret;
-    auto r = posix_memalign(&ret, 4096, size);
-    assert(r == 0);
-    bzero(ret, size);
-    return std::unique_ptr<char[], free_deleter>(reinterpret_cast<char*>(ret));
-}
-
 qp::qp(device* dev, size_t rx_ring_size, size_t tx_ring_size)
     : _dev(dev)
     , _txq_storage(virtio_buffer(vring_storage_size(tx_ring_size)))
@@ -766,7 +862,7 @@ void qp::common_config(ring_config& r) {
     r.avail = r.descs + 16 * r.size;
     r.used = align_up(r.avail + 2 * r.size + 6, 4096);
     r.event_index = (_dev->features() & VIRTIO_RING_F_EVENT_IDX) != 0;
-    r.indirect = false;
+    r.indirect = (_dev->features() & VIRTIO_RING_F_INDIRECT_DESC) != 0;
 }
 
 ring_config qp::txq_config(size_t tx_ring_size) {
@@ -784,6 +880,9 @@ ring_config qp::rxq_config(size_t rx_ring_size) {
     r.descs = _rxq_storage.get();
     r.mergable_buffers = true;
     common_config(r);
+    // rx posts single-buffer chains, which never benefit from indirection;
+    // don't waste memory on the side tables.
+    r.indirect = false;
     return r;
 }
 
@@ -834,10 +933,20 @@ qp_vhost::qp_vhost(device *dev, boost::program_options::variables_map opts)
     // this function. It appears that this is fine - i.e., after we pass
     // this fd to VHOST_NET_SET_BACKEND, the Linux kernel keeps the reference
     // to it and it's fine to close the file descriptor.
+    //
+    // In multiqueue mode every shard runs this constructor; each TUNSETIFF
+    // with IFF_MULTI_QUEUE on the same interface name attaches one more
+    // queue to the tap, so rx traffic lands directly on the owning shard
+    // instead of bouncing through a cpu0 proxy.
     file_desc tap_fd(file_desc::open("/dev/net/tun", O_RDWR | O_NONBLOCK));
     assert(tap_device.size() + 1 <= IFNAMSIZ);
     ifreq ifr = {};
-    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_ONE_QUEUE | IFF_VNET_HDR;
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+    if (_dev->hw_queues_count() > 1) {
+        ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    } else {
+        ifr.ifr_flags |= IFF_ONE_QUEUE;
+    }
     strcpy(ifr.ifr_ifrn.ifrn_name, tap_device.c_str());
     tap_fd.ioctl(TUNSETIFF, ifr);
     unsigned int offload = 0;
@@ -971,13 +1080,11 @@ qp_osv::qp_osv(device *dev, osv::assigned_virtio &virtio,
 #endif
 
 std::unique_ptr<net::qp> device::init_local_queue(boost::program_options::variables_map opts, uint16_t qid) {
-    static bool called = false;
-    assert(!qid);
-    assert(!called);
-    called = true;
+    assert(qid < _queues_count);
 
 #ifdef HAVE_OSV
     if (osv::assigned_virtio::get && osv::assigned_virtio::get()) {
+        assert(!qid);
         std::cout << "In OSv and assigned host's virtio device\n";
         return std::make_unique<qp_osv>(this, *osv::assigned_virtio::get(), opts);
     }
@@ -996,6 +1103,9 @@ get_virtio_net_options_description()
         ("event-index",
                 boost::program_options::value<std::string>()->default_value("on"),
                 "Enable event-index feature (on / off)")
+        ("indirect",
+                boost::program_options::value<std::string>()->default_value("on"),
+                "Enable indirect descriptors feature (on / off)")
         ("csum-offload",
                 boost::program_options::value<std::string>()->default_value("on"),
                 "Enable checksum offload feature (on / off)")
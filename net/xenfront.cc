@@ -288,11 +288,21 @@ void xenfront_qp::alloc_one_rx_reference(unsigned index) {
 
 future<> xenfront_qp::alloc_rx_references() {
     return _rx_ring.entries.has_room().then([this] () {
-        unsigned i = _rx_ring.entries.get_index();
+        // Opportunistically top up every free slot in one go, so a refill
+        // batch costs a single producer update and a single event channel
+        // notification instead of one per buffer.
+        unsigned count = 1;
+        auto opportunistic = _rx_ring.entries.room();
+        if (_rx_ring.entries.try_room(opportunistic)) {
+            count += opportunistic;
+        }
 
         auto req_prod = _rx_ring.req_prod_pvt;
-        alloc_one_rx_reference(i);
-        ++req_prod;
+        while (count--) {
+            unsigned i = _rx_ring.entries.get_index();
+            alloc_one_rx_reference(i);
+            ++req_prod;
+        }
         _rx_ring.req_prod_pvt = req_prod;
         wmb();
         _rx_ring._sring->req_prod = req_prod;
@@ -111,6 +111,10 @@ public:
         future<> has_room();
         unsigned get_index();
         void free_index(unsigned index);
+        // How many more slots can be taken without blocking; used to
+        // batch request-ring refills.
+        size_t room() { return _available.current(); }
+        bool try_room(size_t n) { return _available.try_wait(n); }
     };
 protected:
     static uint32_t idx(int i) { return i & (nr_ents - 1); }
@@ -28,15 +28,26 @@ const sstring lz4_compressor::factory::_name = "LZ4";
 
 temporary_buffer<char> lz4_compressor::compress(size_t head_space, temporary_buffer<char> data) {
     head_space += 4;
-    temporary_buffer<char> dst(head_space + LZ4_compressBound(data.size()));
-    // Can't use LZ4_compress_default() since it's too new.
-    // Safe since output buffer is sized properly.
-    auto size = LZ4_compress(data.begin(), dst.get_write() + head_space, data.size());
-    if (size == 0) {
-        throw std::runtime_error("RPC frame LZ4 compression failure");
+    if (worth_compressing(data.begin(), data.size())) {
+        temporary_buffer<char> dst(head_space + LZ4_compressBound(data.size()));
+        // Can't use LZ4_compress_default() since it's too new.
+        // Safe since output buffer is sized properly.
+        auto size = LZ4_compress(data.begin(), dst.get_write() + head_space, data.size());
+        if (size == 0) {
+            throw std::runtime_error("RPC frame LZ4 compression failure");
+        }
+        if (size_t(size) < data.size()) {
+            dst.trim(size + head_space);
+            write_le<uint32_t>(dst.get_write() + 4, data.size());
+            return dst;
+        }
+        // the frame grew; send it stored instead
     }
-    dst.trim(size + head_space);
-    write_le<uint32_t>(dst.get_write() + 4, data.size());
+    // store uncompressed, marked with uncompressed size 0; the decompress
+    // side has always supported this
+    temporary_buffer<char> dst(head_space + data.size());
+    write_le<uint32_t>(dst.get_write() + 4, 0);
+    std::copy_n(data.begin(), data.size(), dst.get_write() + head_space);
     return dst;
 }
 
@@ -53,7 +64,7 @@ temporary_buffer<char> lz4_compressor::decompress(temporary_buffer<char> data) {
             return dst;
         } else {
             // special case: if uncompressed size is zero it means that data was not compressed
-            // compress side still not use this but we want to be ready for the future
+            // (tiny or incompressible frames are sent stored)
             data.trim_front(4);
             return std::move(data);
         }
@@ -24,6 +24,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <list>
+#include <array>
 #include "core/future.hh"
 #include "net/api.hh"
 #include "core/reactor.hh"
@@ -31,8 +32,10 @@
 #include "core/shared_ptr.hh"
 #include "core/condition-variable.hh"
 #include "core/gate.hh"
+#include "core/sleep.hh"
 #include "rpc/rpc_types.hh"
 #include "core/byteorder.hh"
+#include "core/scollectd.hh"
 
 namespace rpc {
 
@@ -66,18 +69,52 @@ struct resource_limits {
     size_t basic_request_size = 0; ///< Minimum request footprint in memory
     unsigned bloat_factor = 1;     ///< Serialized size multiplied by this to estimate memory used by request
     size_t max_memory = std::numeric_limits<size_t>::max(); ///< Maximum amount of memory that may be consumed by all requests
+    size_t max_requests = std::numeric_limits<size_t>::max(); ///< Maximum number of requests that may be in flight on the server
+    size_t max_memory_per_connection = std::numeric_limits<size_t>::max(); ///< Like max_memory, for one connection
+    size_t max_requests_per_connection = std::numeric_limits<size_t>::max(); ///< Like max_requests, for one connection
 };
 
 struct client_options {
     std::experimental::optional<net::tcp_keepalive_params> keepalive;
     compressor::factory* compressor_factory = nullptr;
     bool send_timeout_data = true;
+    // accumulate outgoing frames for up to this long, or until
+    // batch_flush_bytes are pending, before flushing them in one TCP
+    // segment; zero flushes after every frame
+    std::chrono::microseconds batch_flush_delay{0};
+    size_t batch_flush_bytes = 128 * 1024;
+    // ask the server to encode frame headers as varints with
+    // delta-encoded message ids instead of the fixed 20-byte form; used
+    // only if the server enables it too
+    bool compact_frames = false;
 };
 
 struct server_options {
     compressor::factory* compressor_factory = nullptr;
+    // see client_options
+    std::chrono::microseconds batch_flush_delay{0};
+    size_t batch_flush_bytes = 128 * 1024;
+    bool compact_frames = false;
 };
 
+// passed as the first argument of an rpc call to send its frame on the
+// urgent lane, ahead of queued traffic, and flush it immediately instead
+// of letting it wait for the batching delay
+struct urgent_flag {};
+
+// Priority lane of a frame inside a connection.  Urgent frames are
+// always sent first; the normal and bulk lanes are served round-robin,
+// so a queue of large bulk responses cannot head-of-line block ordinary
+// traffic.  A frame that has started transmission cannot be preempted --
+// the wire format is not chunked -- so scheduling is at frame
+// granularity.
+enum class lane : uint8_t {
+    urgent = 0,
+    normal = 1,
+    bulk = 2,
+};
+static constexpr unsigned nr_lanes = 3;
+
 inline
 size_t
 estimate_request_size(const resource_limits& lim, size_t serialized_size) {
@@ -92,11 +129,43 @@ struct negotiation_frame {
 enum class protocol_features : uint32_t {
     COMPRESS = 0,
     TIMEOUT = 1,
+    STREAM = 2,
+    COMPACT = 3,
+    // when negotiated, request frames carry the sender's 16-byte trace
+    // context (trace id + span id, see core/tracing.hh) between the
+    // expiration prefix and the verb
+    TRACE = 4,
 };
 
 // internal representation of feature data
 using feature_map = std::map<protocol_features, sstring>;
 
+// Streaming: a stream is a flow-controlled, one-way sequence of opaque
+// frames tied to a connection.  Stream frames travel on the request path
+// with a negated message id (ordinary requests use positive ids only); the
+// opening frame carries the verb the stream is opened on in the type field,
+// subsequent frames carry a stream_opcode there.  The receiver grants
+// window credits (and acknowledges close) on the response path, using the
+// same negated id.
+enum class stream_opcode : uint64_t {
+    data = 0,
+    close = 1,
+};
+
+// Number of frames a sender may have in flight before it has to wait for
+// the receiver to grant more credits.
+static constexpr uint32_t stream_initial_window = 64;
+
+// The sink end of a stream: invoked once per frame, in the order the frames
+// were sent, and finally with a disengaged optional when the sender closes
+// the stream.  The next frame is delivered only after the returned future
+// resolves.
+using stream_sink = std::function<future<> (std::experimental::optional<temporary_buffer<char>>)>;
+
+// Invoked once for every incoming stream opened on the verb it was
+// registered for; returns the sink that will consume that stream's frames.
+using stream_handler_factory = std::function<stream_sink (client_info&)>;
+
 // MsgType is a type that holds type of a message. The type should be hashable
 // and serializable. It is preferable to use enum for message types, but
 // do not forget to provide hash function for it
@@ -113,10 +182,12 @@ class protocol {
         stats _stats;
         struct outgoing_entry {
             timer<> t;
-            temporary_buffer<char> buf;
+            // a packet, so that serialized messages can carry large
+            // argument buffers as their own fragments without copying
+            net::packet buf;
             std::experimental::optional<promise<>> p = promise<>();
             cancellable* pcancel = nullptr;
-            outgoing_entry(temporary_buffer<char> b) : buf(std::move(b)) {}
+            outgoing_entry(net::packet b) : buf(std::move(b)) {}
             outgoing_entry(outgoing_entry&& o) : t(std::move(o.t)), buf(std::move(o.buf)), p(std::move(o.p)), pcancel(o.pcancel) {
                 o.p = std::experimental::nullopt;
             }
@@ -131,19 +202,102 @@ class protocol {
             }
         };
         friend outgoing_entry;
-        std::list<outgoing_entry> _outgoing_queue;
+        std::list<outgoing_entry> _outgoing_queue[nr_lanes];
+        bool _last_served_bulk = false;
         condition_variable _outgoing_queue_cond;
         future<> _send_loop_stopped = make_ready_future<>();
         std::unique_ptr<compressor> _compressor;
         bool _timeout_negotiated = false;
+        bool _stream_negotiated = false;
+        bool _compact_negotiated = false;
+        bool _trace_negotiated = false;
+        // previous message id sent/received in compact mode; ids are
+        // delta-encoded against it, in wire order
+        int64_t _compact_sent_id = 0;
+        int64_t _compact_rcvd_id = 0;
+        // nagle-style frame batching (see client_options::batch_flush_delay)
+        std::chrono::microseconds _batch_flush_delay{0};
+        size_t _batch_flush_bytes = 128 * 1024;
+        size_t _unflushed_bytes = 0;
+
+        bool has_outgoing() const {
+            for (auto&& q : _outgoing_queue) {
+                if (!q.empty()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        size_t pending_outgoing() const {
+            size_t n = 0;
+            for (auto&& q : _outgoing_queue) {
+                n += q.size();
+            }
+            return n;
+        }
+        // next lane to serve: urgent always wins; normal and bulk
+        // alternate when both have traffic so neither starves
+        unsigned pick_lane() {
+            if (!_outgoing_queue[unsigned(lane::urgent)].empty()) {
+                return unsigned(lane::urgent);
+            }
+            auto normal = !_outgoing_queue[unsigned(lane::normal)].empty();
+            auto bulk = !_outgoing_queue[unsigned(lane::bulk)].empty();
+            if (normal && bulk) {
+                _last_served_bulk = !_last_served_bulk;
+                return unsigned(_last_served_bulk ? lane::bulk : lane::normal);
+            } else if (normal) {
+                return unsigned(lane::normal);
+            } else if (bulk) {
+                return unsigned(lane::bulk);
+            }
+            return nr_lanes;
+        }
+
+        // rewrites the fixed frame header at the front of p into the
+        // compact varint form (see protocol_features::COMPACT)
+        void compact_header(net::packet& p, bool request) {
+            size_t classic = request ? (_timeout_negotiated ? 28 : 20) + (_trace_negotiated ? 16 : 0) : 12;
+            auto h = p.get_header(0, classic);
+            char tmp[55]; // six maximum-length varints
+            size_t n = 0;
+            const char* q = h;
+            if (request) {
+                if (_timeout_negotiated) {
+                    n += write_varint(tmp + n, read_le<uint64_t>(q));
+                    q += 8;
+                }
+                if (_trace_negotiated) {
+                    n += write_varint(tmp + n, read_le<uint64_t>(q));
+                    n += write_varint(tmp + n, read_le<uint64_t>(q + 8));
+                    q += 16;
+                }
+                n += write_varint(tmp + n, read_le<uint64_t>(q));
+                auto id = read_le<int64_t>(q + 8);
+                n += write_varint(tmp + n, zigzag_encode(id - _compact_sent_id));
+                _compact_sent_id = id;
+                n += write_varint(tmp + n, read_le<uint32_t>(q + 16));
+            } else {
+                auto id = read_le<int64_t>(q);
+                n += write_varint(tmp + n, zigzag_encode(id - _compact_sent_id));
+                _compact_sent_id = id;
+                n += write_varint(tmp + n, read_le<uint32_t>(q + 8));
+            }
+            p.trim_front(classic);
+            p = net::packet(net::fragment{tmp, n}, std::move(p));
+        }
 
-        temporary_buffer<char> compress(temporary_buffer<char> buf) {
+        net::packet compress(net::packet p) {
             if (_compressor) {
+                // the compressor works on a contiguous buffer
+                p.linearize();
+                auto bufs = p.release();
+                auto buf = bufs.empty() ? temporary_buffer<char>() : std::move(bufs.front());
                 buf = _compressor->compress(4, std::move(buf));
                 write_le<uint32_t>(buf.get_write(), buf.size() - 4);
-                return std::move(buf);
+                return net::packet(net::fragment{buf.get_write(), buf.size()}, buf.release());
             }
-            return std::move(buf);
+            return std::move(p);
         }
         enum class outgoing_queue_type {
             request,
@@ -152,35 +306,54 @@ class protocol {
         template<outgoing_queue_type QueueType>
         void send_loop() {
             _send_loop_stopped = do_until([this] { return _error; }, [this] {
-                return _outgoing_queue_cond.wait([this] { return !_outgoing_queue.empty(); }).then([this] {
+                return _outgoing_queue_cond.wait([this] { return has_outgoing(); }).then([this] {
                     // despite using wait with predicated above _outgoing_queue can still be empty here if
                     // there is only one entry on the list and its expire timer runs after wait() returned ready future,
                     // but before this continuation runs.
-                    if (_outgoing_queue.empty()) {
+                    auto l = pick_lane();
+                    if (l == nr_lanes) {
                         return make_ready_future();
                     }
-                    auto d = std::move(_outgoing_queue.front());
-                    _outgoing_queue.pop_front();
+                    auto& q = _outgoing_queue[l];
+                    auto d = std::move(q.front());
+                    q.pop_front();
                     d.t.cancel(); // cancel timeout timer
                     if (d.pcancel) {
                         d.pcancel->cancel_send = std::function<void()>(); // request is no longer cancellable
                     }
                     if (QueueType == outgoing_queue_type::request) {
+                        // requests are marshalled with room for every
+                        // optional header prefix (see send_helper):
+                        // [8 expiration][16 trace context]; keep the
+                        // negotiated ones and trim the rest
+                        auto h = d.buf.get_header(0, 24);
+                        char tmp[24];
+                        size_t n = 0;
                         if (_timeout_negotiated) {
                             auto expire = d.t.get_timeout();
                             uint64_t left = 0;
                             if (expire != typename timer<>::time_point()) {
                                 left = std::chrono::duration_cast<std::chrono::milliseconds>(expire - timer<>::clock::now()).count();
                             }
-                            write_le<uint64_t>(d.buf.get_write(), left);
-                        } else {
-                            d.buf.trim_front(8);
+                            write_le<uint64_t>(tmp + n, left);
+                            n += 8;
                         }
+                        if (_trace_negotiated) {
+                            std::memcpy(tmp + n, h + 8, 16);
+                            n += 16;
+                        }
+                        std::memcpy(h + 24 - n, tmp, n);
+                        d.buf.trim_front(24 - n);
+                    }
+                    if (_compact_negotiated) {
+                        compact_header(d.buf, QueueType == outgoing_queue_type::request);
                     }
                     d.buf = compress(std::move(d.buf));
-                    auto f = _write_buf.write(std::move(d.buf)).then([this] {
+                    _unflushed_bytes += d.buf.len();
+                    auto urgent = lane(l) == lane::urgent;
+                    auto f = _write_buf.write(std::move(d.buf)).then([this, urgent] {
                         _stats.sent_messages++;
-                        return _write_buf.flush();
+                        return flush_output(urgent);
                     });
                     return f.finally([d = std::move(d)] {});
                 });
@@ -191,6 +364,28 @@ class protocol {
             });
         }
 
+        // Flushes the write buffer, or defers the flush so that frames
+        // sent close together share one TCP segment.  An urgent frame, a
+        // full batch or a zero batching delay flushes right away;
+        // otherwise the flush lingers briefly so later frames can join
+        // the batch, and any frame queued meanwhile takes over flushing.
+        future<> flush_output(bool urgent) {
+            if (has_outgoing()) {
+                return make_ready_future<>();
+            }
+            if (urgent || _batch_flush_delay == std::chrono::microseconds(0) || _unflushed_bytes >= _batch_flush_bytes) {
+                _unflushed_bytes = 0;
+                return _write_buf.flush();
+            }
+            return sleep(_batch_flush_delay).then([this] {
+                if (_error || has_outgoing()) {
+                    return make_ready_future<>();
+                }
+                _unflushed_bytes = 0;
+                return _write_buf.flush();
+            });
+        }
+
         future<> stop_send_loop() {
             _error = true;
             if (!_send_loop_stopped.available()) {
@@ -200,7 +395,9 @@ class protocol {
                 _fd.shutdown_output();
             }
             return _send_loop_stopped.finally([this] {
-                _outgoing_queue.clear();
+                for (auto&& q : _outgoing_queue) {
+                    q.clear();
+                }
             });
         }
 
@@ -215,24 +412,28 @@ class protocol {
         }
         // functions below are public because they are used by external heavily templated functions
         // and I am not smart enough to know how to define them as friends
-        future<> send(temporary_buffer<char> buf, std::experimental::optional<steady_clock_type::time_point> timeout = {}, cancellable* cancel = nullptr) {
+        future<> send(temporary_buffer<char> buf, std::experimental::optional<steady_clock_type::time_point> timeout = {}, cancellable* cancel = nullptr, lane l = lane::normal) {
+            return send(net::packet(net::packet(), std::move(buf)), timeout, cancel, l);
+        }
+        future<> send(net::packet buf, std::experimental::optional<steady_clock_type::time_point> timeout = {}, cancellable* cancel = nullptr, lane l = lane::normal) {
             if (!_error) {
-                _outgoing_queue.emplace_back(std::move(buf));
-                auto deleter = [this, it = std::prev(_outgoing_queue.cend())] {
-                    _outgoing_queue.erase(it);
+                auto& q = _outgoing_queue[unsigned(l)];
+                q.emplace_back(std::move(buf));
+                auto deleter = [this, l, it = std::prev(q.cend())] {
+                    _outgoing_queue[unsigned(l)].erase(it);
                 };
                 if (timeout) {
-                    auto& t = _outgoing_queue.back().t;
+                    auto& t = q.back().t;
                     t.set_callback(deleter);
                     t.arm(timeout.value());
                 }
                 if (cancel) {
                     cancel->cancel_send = std::move(deleter);
-                    cancel->send_back_pointer = &_outgoing_queue.back().pcancel;
-                    _outgoing_queue.back().pcancel = cancel;
+                    cancel->send_back_pointer = &q.back().pcancel;
+                    q.back().pcancel = cancel;
                 }
                 _outgoing_queue_cond.signal();
-                return _outgoing_queue.back().p->get_future();
+                return q.back().p->get_future();
             } else {
                 return make_exception_future<>(closed_error());
             }
@@ -256,6 +457,10 @@ public:
         class connection : public protocol::connection, public enable_lw_shared_from_this<connection> {
             server& _server;
             client_info _info;
+            // admission control (see resource_limits); per-connection units
+            // are acquired before the shared server-wide ones
+            semaphore _memory_available;
+            semaphore _requests_available;
         private:
             future<> negotiate_protocol(input_stream<char>& in);
             future<std::experimental::optional<uint64_t>, MsgType, int64_t, std::experimental::optional<temporary_buffer<char>>>
@@ -263,18 +468,31 @@ public:
             future<std::experimental::optional<uint64_t>, MsgType, int64_t, std::experimental::optional<temporary_buffer<char>>>
             read_request_frame_compressed(input_stream<char>& in);
             feature_map negotiate(feature_map requested);
+            // Incoming streams, keyed by stream id.  Frames of one stream
+            // are sunk strictly in send order by chaining on the order
+            // future, and the sender's window is replenished as the sink
+            // consumes frames.
+            struct stream_state {
+                stream_sink sink;
+                future<> order = make_ready_future<>();
+                uint32_t consumed = 0;
+            };
+            std::unordered_map<int64_t, stream_state> _streams;
+            future<> handle_stream_frame(MsgType type, int64_t stream_id, std::experimental::optional<steady_clock_type::time_point> timeout, temporary_buffer<char> data);
+            void grant_credits(int64_t stream_id, uint32_t credits, std::experimental::optional<steady_clock_type::time_point> timeout);
             void send_loop() {
                 protocol::connection::template send_loop<protocol::connection::outgoing_queue_type::response>();
             }
         public:
             connection(server& s, connected_socket&& fd, socket_address&& addr, protocol& proto);
             future<> process();
-            future<> respond(int64_t msg_id, temporary_buffer<char>&& data, std::experimental::optional<steady_clock_type::time_point> timeout);
+            future<> respond(int64_t msg_id, temporary_buffer<char>&& data, std::experimental::optional<steady_clock_type::time_point> timeout, lane l = lane::normal);
+            future<> respond(int64_t msg_id, net::packet&& data, std::experimental::optional<steady_clock_type::time_point> timeout, lane l = lane::normal);
             client_info& info() { return _info; }
             const client_info& info() const { return _info; }
             stats get_stats() const {
                 stats res = this->_stats;
-                res.pending = this->_outgoing_queue.size();
+                res.pending = this->pending_outgoing();
                 return res;
             }
 
@@ -284,11 +502,45 @@ public:
             ipv4_addr peer_address() const {
                 return ipv4_addr(_info.addr);
             }
-            future<> wait_for_resources(size_t memory_consumed) {
-                return _server._resources_available.wait(memory_consumed);
+            // Admits a request, waiting until it fits under the
+            // per-connection and server-wide in-flight limits; the wait
+            // backpressures the connection's read loop, so a misbehaving
+            // client cannot queue unbounded parsed arguments.  With a
+            // timeout (the client's propagated deadline) the wait gives up
+            // once the client stopped caring, and the caller sheds the
+            // request.
+            future<> wait_for_resources(size_t memory_consumed, std::experimental::optional<steady_clock_type::time_point> timeout) {
+                auto acquire = [timeout] (semaphore& sem, size_t units) {
+                    return timeout ? sem.wait(timeout.value(), units) : sem.wait(units);
+                };
+                if (!(_requests_available.current() && _memory_available.current() >= memory_consumed &&
+                        _server._requests_available.current() && _server._resources_available.current() >= memory_consumed)) {
+                    this->_stats.queued++;
+                }
+                // acquired in a fixed order so concurrent admissions cannot
+                // deadlock; a failed stage rolls back the earlier ones
+                return acquire(_requests_available, 1).then([this, memory_consumed, acquire] {
+                    return acquire(_memory_available, memory_consumed).then([this, memory_consumed, acquire] {
+                        return acquire(_server._requests_available, 1).then([this, memory_consumed, acquire] {
+                            return acquire(_server._resources_available, memory_consumed).handle_exception([this] (std::exception_ptr ex) {
+                                _server._requests_available.signal();
+                                return make_exception_future<>(std::move(ex));
+                            });
+                        }).handle_exception([this, memory_consumed] (std::exception_ptr ex) {
+                            _memory_available.signal(memory_consumed);
+                            return make_exception_future<>(std::move(ex));
+                        });
+                    }).handle_exception([this] (std::exception_ptr ex) {
+                        _requests_available.signal();
+                        return make_exception_future<>(std::move(ex));
+                    });
+                });
             }
             void release_resources(size_t memory_consumed) {
                 _server._resources_available.signal(memory_consumed);
+                _server._requests_available.signal();
+                _memory_available.signal(memory_consumed);
+                _requests_available.signal();
             }
             size_t estimate_request_size(size_t serialized_size) {
                 return rpc::estimate_request_size(_server._limits, serialized_size);
@@ -302,6 +554,7 @@ public:
         server_socket _ss;
         resource_limits _limits;
         semaphore _resources_available;
+        semaphore _requests_available;
         std::unordered_set<lw_shared_ptr<connection>> _conns;
         promise<> _ss_stopped;
         seastar::gate _reply_gate;
@@ -316,6 +569,7 @@ public:
             _ss.abort_accept();
             _ss = server_socket();
             _resources_available.broken();
+            _requests_available.broken();
             return when_all(_ss_stopped.get_future(),
                 parallel_for_each(_conns, [] (lw_shared_ptr<connection> conn) {
                     return conn->stop();
@@ -375,6 +629,16 @@ public:
         std::unordered_map<id_type, std::unique_ptr<reply_handler_base>> _outstanding;
         ipv4_addr _server_addr;
         client_options _options;
+        // Outgoing streams, keyed by their (positive) stream id.  Ids are
+        // drawn from the same counter as message ids, so a stream never
+        // collides with an outstanding request.
+        struct stream_state {
+            semaphore credits{0};
+            promise<> closed;
+            bool done = false;
+        };
+        std::unordered_map<id_type, lw_shared_ptr<stream_state>> _streams;
+        bool _stream_rejected = false;
     private:
         future<> negotiate_protocol(input_stream<char>& in);
         void negotiate(feature_map server_features);
@@ -382,6 +646,21 @@ public:
         read_response_frame(input_stream<char>& in);
         future<int64_t, std::experimental::optional<temporary_buffer<char>>>
         read_response_frame_compressed(input_stream<char>& in);
+        bool handle_stream_response(id_type stream_id, temporary_buffer<char>& data) {
+            auto it = _streams.find(stream_id);
+            if (it == _streams.end()) {
+                return false;
+            }
+            if (data.size() >= 4) {
+                it->second->credits.signal(read_le<uint32_t>(data.get()));
+            } else {
+                // a zero-length grant acknowledges our close
+                it->second->done = true;
+                it->second->closed.set_value();
+                _streams.erase(it);
+            }
+            return true;
+        }
         void send_loop() {
             protocol::connection::template send_loop<protocol::connection::outgoing_queue_type::request>();
         }
@@ -409,7 +688,7 @@ public:
         stats get_stats() const {
             stats res = this->_stats;
             res.wait_reply = _outstanding.size();
-            res.pending = this->_outgoing_queue.size();
+            res.pending = this->pending_outgoing();
             return res;
         }
 
@@ -438,6 +717,74 @@ public:
             _outstanding.erase(id);
         }
 
+        // A one-way, flow-controlled channel for pushing a sequence of
+        // opaque frames to the server, where they are consumed, in order,
+        // by the sink of the stream handler registered for the verb the
+        // stream was opened on.  send() waits for window credits granted by
+        // the receiver, so a slow sink back-pressures the producer.
+        // close() resolves once the receiver has consumed every frame and
+        // acknowledged; neither may be called after close().  The stream
+        // must not outlive its client.
+        class stream {
+            client& _client;
+            id_type _id;
+            lw_shared_ptr<stream_state> _state;
+            stream(client& c, id_type id, lw_shared_ptr<stream_state> state)
+                    : _client(c), _id(id), _state(std::move(state)) {}
+            temporary_buffer<char> make_frame(stream_opcode op, size_t payload) {
+                temporary_buffer<char> buf(28 + payload);
+                auto p = buf.get_write() + 8; // 8 extra bytes for expiration timer
+                write_le<uint64_t>(p, uint64_t(op));
+                write_le<int64_t>(p + 8, -_id);
+                write_le<uint32_t>(p + 16, payload);
+                return buf;
+            }
+            friend client;
+        public:
+            future<> send(temporary_buffer<char> data) {
+                if (_client.error()) {
+                    return make_exception_future<>(closed_error());
+                }
+                auto buf = make_frame(stream_opcode::data, data.size());
+                std::copy_n(data.get(), data.size(), buf.get_write() + 28);
+                // stream frames go to the bulk lane so a busy stream does
+                // not delay ordinary calls on the same connection
+                return _state->credits.wait(1).then([&c = _client, buf = std::move(buf)] () mutable {
+                    return c.send(std::move(buf), {}, nullptr, lane::bulk);
+                });
+            }
+            future<> close() {
+                if (_state->done) {
+                    return make_exception_future<>(closed_error());
+                }
+                return _client.send(make_frame(stream_opcode::close, 0), {}, nullptr, lane::bulk).then([state = _state] {
+                    return state->closed.get_future();
+                });
+            }
+        };
+
+        stream make_stream(MsgType t) {
+            auto id = next_message_id();
+            auto state = make_lw_shared<stream_state>();
+            if (this->_error || _stream_rejected) {
+                state->done = true;
+                state->credits.broken();
+                return stream(*this, id, std::move(state));
+            }
+            _streams.emplace(id, state);
+            // the opening frame travels on the request path like an
+            // ordinary call, but with a negated message id and the verb in
+            // the type field; it goes to the bulk lane, like every other
+            // stream frame, so frames of one stream stay in FIFO order
+            temporary_buffer<char> buf(28);
+            auto p = buf.get_write() + 8;
+            write_le<uint64_t>(p, uint64_t(t));
+            write_le<int64_t>(p + 8, -id);
+            write_le<uint32_t>(p + 16, 0);
+            this->send(std::move(buf), {}, nullptr, lane::bulk).ignore_ready_future();
+            return stream(*this, id, std::move(state));
+        }
+
         future<> stop() {
             if (!this->_error) {
                 this->_error = true;
@@ -449,11 +796,113 @@ public:
             return _server_addr;
         }
     };
+
+    // A fixed-size pool of connections to one server, multiplexing many
+    // callers over a few sockets instead of one connection per caller.
+    // get() hands out connections round-robin; get(routing_key) pins a
+    // key (say, the server shard owning the data) to one connection so
+    // calls for that key keep their relative order.  The pool only cuts
+    // socket and handshake counts: a handler that must run on a
+    // particular server shard still hops there with smp::submit_to, as
+    // it does today.  Verbs are invoked as verb(pool.get(), args...).
+    class client_pool {
+        std::vector<std::unique_ptr<client>> _clients;
+        size_t _next = 0;
+    public:
+        client_pool(protocol& proto, client_options options, size_t nr_connections, ipv4_addr addr, ipv4_addr local = ipv4_addr()) {
+            nr_connections = std::max<size_t>(nr_connections, 1);
+            _clients.reserve(nr_connections);
+            while (_clients.size() < nr_connections) {
+                _clients.push_back(std::make_unique<client>(proto, options, addr, local));
+            }
+        }
+        client_pool(protocol& proto, size_t nr_connections, ipv4_addr addr, ipv4_addr local = ipv4_addr())
+                : client_pool(proto, client_options(), nr_connections, addr, local) {}
+        // for callers that bring their own sockets (tls, tests)
+        client_pool(protocol& proto, client_options options, size_t nr_connections, std::function<seastar::socket ()> make_socket, ipv4_addr addr, ipv4_addr local = ipv4_addr()) {
+            nr_connections = std::max<size_t>(nr_connections, 1);
+            _clients.reserve(nr_connections);
+            while (_clients.size() < nr_connections) {
+                _clients.push_back(std::make_unique<client>(proto, options, make_socket(), addr, local));
+            }
+        }
+        size_t size() const {
+            return _clients.size();
+        }
+        client& get() {
+            auto& c = *_clients[_next];
+            _next = (_next + 1) % _clients.size();
+            return c;
+        }
+        client& get(uint64_t routing_key) {
+            return *_clients[routing_key % _clients.size()];
+        }
+        stats get_stats() const {
+            stats res;
+            for (auto& c : _clients) {
+                auto s = c->get_stats();
+                res.replied += s.replied;
+                res.pending += s.pending;
+                res.exception_received += s.exception_received;
+                res.sent_messages += s.sent_messages;
+                res.wait_reply += s.wait_reply;
+                res.timeout += s.timeout;
+            }
+            return res;
+        }
+        future<> stop() {
+            auto f = make_ready_future<>();
+            for (auto& c : _clients) {
+                f = f.then([&c] { return c->stop(); });
+            }
+            return f;
+        }
+    };
+
     friend server;
+
+    // Per-verb server-side instrumentation.  The scalar counters are
+    // polled by scollectd under plugin "rpc" (type instance = the verb
+    // id), so rates and averages come out of the usual pipeline; the
+    // log2-bucketed latency histograms -- one bucket per power of two
+    // microseconds, HDR style -- are read in-process through
+    // get_verb_stats(), as collectd has no histogram type.
+    struct verb_stats {
+        static constexpr unsigned nr_latency_buckets = 24;
+        uint64_t invocations = 0;
+        uint64_t bytes = 0;            // serialized argument bytes
+        uint64_t handler_nanos = 0;    // total time spent in the handler
+        uint64_t queue_wait_nanos = 0; // total time from frame receipt to handler start
+        std::array<uint64_t, nr_latency_buckets> handler_latency{};
+        std::array<uint64_t, nr_latency_buckets> queue_wait{};
+        static unsigned bucket_of(std::chrono::nanoseconds d) {
+            auto us = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+            unsigned b = 0;
+            while (us > 1 && b < nr_latency_buckets - 1) {
+                us >>= 1;
+                b++;
+            }
+            return b;
+        }
+        void add_queue_wait(std::chrono::nanoseconds d) {
+            queue_wait_nanos += d.count();
+            queue_wait[bucket_of(d)]++;
+        }
+        void add_handler_time(std::chrono::nanoseconds d) {
+            handler_nanos += d.count();
+            handler_latency[bucket_of(d)]++;
+        }
+    };
+
 private:
     using rpc_handler = std::function<future<> (lw_shared_ptr<typename server::connection>, std::experimental::optional<steady_clock_type::time_point> timeout, int64_t msgid,
                                                 temporary_buffer<char> data)>;
     std::unordered_map<MsgType, rpc_handler> _handlers;
+    std::unordered_map<MsgType, stream_handler_factory> _stream_handlers;
+    // per-verb counters; references into the map are given to scollectd
+    // and to the receive lambdas, so entries are never removed
+    std::unordered_map<MsgType, verb_stats> _verb_stats;
+    scollectd::registrations _verb_metrics;
     Serializer _serializer;
     std::function<void(const sstring&)> _logger;
 public:
@@ -467,10 +916,32 @@ public:
     template<typename Func>
     auto register_handler(MsgType t, Func&& func);
 
+    // as above, but responses of this verb are sent on lane l; register
+    // verbs with large responses on lane::bulk so they do not head-of-line
+    // block latency-sensitive traffic on the same connection
+    template<typename Func>
+    auto register_handler(MsgType t, lane l, Func&& func);
+
     void unregister_handler(MsgType t) {
         _handlers.erase(t);
     }
 
+    // instrumentation of a registered verb, or nullptr for an unknown one
+    const verb_stats* get_verb_stats(MsgType t) const {
+        auto it = _verb_stats.find(t);
+        return it == _verb_stats.end() ? nullptr : &it->second;
+    }
+
+    // registers a factory that is invoked once for every incoming stream
+    // opened on verb t; the sink it returns receives that stream's frames
+    void register_stream_handler(MsgType t, stream_handler_factory&& factory) {
+        _stream_handlers.emplace(t, std::move(factory));
+    }
+
+    void unregister_stream_handler(MsgType t) {
+        _stream_handlers.erase(t);
+    }
+
     void set_logger(std::function<void(const sstring&)> logger) {
         _logger = logger;
     }
@@ -496,12 +967,116 @@ private:
         _handlers.emplace(t, std::move(handler));
     }
 
+    verb_stats& register_verb_stats(MsgType t);
+
     template <typename FrameType, typename Info>
     typename FrameType::return_type read_frame(const Info& info, input_stream<char>& in);
 
     template <typename FrameType, typename Info>
     typename FrameType::return_type read_frame_compressed(const Info& info, std::unique_ptr<compressor>& compressor, input_stream<char>& in);
+
+    template <typename FrameType, typename Info>
+    typename FrameType::return_type read_compact_frame(const Info& info, input_stream<char>& in, int64_t& last_id);
+
+    template <typename FrameType, typename Info>
+    typename FrameType::return_type read_compact_frame_compressed(const Info& info, std::unique_ptr<compressor>& compressor, input_stream<char>& in, int64_t& last_id);
 };
+
+template <typename Verb, typename Client, typename... InArgs>
+inline auto hedge_impl(Verb verb, Client& primary, Client& secondary,
+        steady_clock_type::duration hedge_delay,
+        std::experimental::optional<steady_clock_type::time_point> deadline,
+        InArgs... args) {
+    using fut_type = std::result_of_t<Verb(Client&, cancellable&, const InArgs&...)>;
+    struct state_t {
+        typename fut_type::promise_type pr;
+        cancellable cancel[2];
+        timer<> hedge_timer;
+        bool done = false;
+        bool hedged = false;
+        unsigned running = 0;
+    };
+    auto state = make_lw_shared<state_t>();
+    auto call = [deadline] (Verb& verb, Client& c, cancellable& cancel, const InArgs&... args) {
+        if (deadline) {
+            return verb(c, deadline.value(), cancel, args...);
+        }
+        return verb(c, cancel, args...);
+    };
+    // resolves a finished attempt; returns true when its failure should
+    // launch the hedged attempt right away
+    auto finish = [state] (fut_type& f) {
+        if (state->done) {
+            f.ignore_ready_future();
+            return false;
+        }
+        if (!f.failed()) {
+            state->done = true;
+            state->hedge_timer.cancel();
+            // cancelling an attempt that already finished is a no-op
+            state->cancel[0].cancel();
+            state->cancel[1].cancel();
+            f.forward_to(std::move(state->pr));
+            return false;
+        }
+        if (state->running) {
+            // the other attempt may still win
+            f.ignore_ready_future();
+            return false;
+        }
+        if (!state->hedged) {
+            // the primary failed before the hedge fired; do not wait for it
+            f.ignore_ready_future();
+            return true;
+        }
+        // both attempts failed; report the last failure
+        state->done = true;
+        f.forward_to(std::move(state->pr));
+        return false;
+    };
+    auto launch_hedge = [state, finish, call, verb, sec = &secondary, args...] () mutable {
+        state->hedged = true;
+        state->running++;
+        call(verb, *sec, state->cancel[1], args...).then_wrapped([state, finish] (fut_type f) mutable {
+            state->running--;
+            finish(f);
+        });
+    };
+    state->hedge_timer.set_callback(launch_hedge);
+    state->hedge_timer.arm(hedge_delay);
+    state->running++;
+    call(verb, primary, state->cancel[0], args...).then_wrapped([state, finish, launch_hedge] (fut_type f) mutable {
+        state->running--;
+        if (finish(f)) {
+            state->hedge_timer.cancel();
+            launch_hedge();
+        }
+    });
+    return state->pr.get_future();
+}
+
+// Issues a call on the primary client and, if no reply arrives within
+// hedge_delay, repeats it on the secondary; the first reply to arrive
+// wins and the losing call is cancelled.  Pick hedge_delay around the
+// verb's observed p95 latency so only the slowest few percent of calls
+// pay for a duplicate.  The attempts are independent calls with their
+// own message ids, so a straggling loser reply is silently dropped by
+// its client -- but the verb must be idempotent, since the server may
+// execute the handler twice.  If the primary fails outright the
+// secondary is tried immediately.  Both clients must outlive the
+// returned future.
+template <typename Verb, typename Client, typename... InArgs>
+inline auto hedge(Verb verb, Client& primary, Client& secondary, steady_clock_type::duration hedge_delay, const InArgs&... args) {
+    return hedge_impl(std::move(verb), primary, secondary, hedge_delay, std::experimental::optional<steady_clock_type::time_point>(), args...);
+}
+
+// as above, with a deadline covering both attempts; it is propagated to
+// the servers in the frame header (see protocol_features::TIMEOUT), so
+// they can drop work whose client already gave up
+template <typename Verb, typename Client, typename... InArgs>
+inline auto hedge(Verb verb, Client& primary, Client& secondary, steady_clock_type::duration hedge_delay, steady_clock_type::time_point deadline, const InArgs&... args) {
+    return hedge_impl(std::move(verb), primary, secondary, hedge_delay, std::experimental::optional<steady_clock_type::time_point>(deadline), args...);
+}
 }
 
 #include "rpc_impl.hh"
@@ -28,6 +28,8 @@
 #include "core/future-util.hh"
 #include "util/is_smart_ptr.hh"
 #include "core/simple-stream.hh"
+#include "core/scattered_message.hh"
+#include "core/tracing.hh"
 #include <boost/range/numeric.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 #include "net/packet-data-source.hh"
@@ -152,6 +154,84 @@ inline void marshall_one(Serializer& serializer, Output& out, const T& arg) {
     serialize_helper_type::serialize(serializer, out, arg);
 }
 
+// Arguments and return values of type temporary_buffer<char> are handled
+// by the rpc layer itself rather than the user serializer: on the wire
+// they are a 32-bit length followed by the raw bytes.  On the send side a
+// buffer larger than this threshold is adopted as its own fragment of a
+// scattered_message instead of being copied through the linear buffer;
+// smaller ones are copied inline to avoid accumulating tiny fragments.
+static constexpr size_t adopt_fragment_threshold = 4096;
+
+// measures the linear (non-adopted) part of a scattered serialization
+class scattered_measuring_stream {
+    size_t _size = 0;
+public:
+    void write(const char* data, size_t size) {
+        _size += size;
+    }
+    size_t size() const {
+        return _size;
+    }
+};
+
+// Writes serialized output into a single linear buffer, assembling a
+// scattered_message from views of it; put() adopts a buffer as its own
+// fragment, splitting the linear buffer around it.
+class scattered_output_stream {
+    scattered_message<char>& _msg;
+    temporary_buffer<char>& _linear;
+    size_t _pos;
+    size_t _mark = 0; // start of the linear run being accumulated
+public:
+    scattered_output_stream(scattered_message<char>& msg, temporary_buffer<char>& linear, size_t head_space)
+            : _msg(msg), _linear(linear), _pos(head_space) {}
+    void write(const char* data, size_t size) {
+        std::copy_n(data, size, _linear.get_write() + _pos);
+        _pos += size;
+    }
+    void put(temporary_buffer<char> frag) {
+        flush();
+        _msg.append(std::move(frag));
+    }
+    void flush() {
+        if (_pos != _mark) {
+            _msg.append(_linear.share(_mark, _pos - _mark));
+            _mark = _pos;
+        }
+    }
+};
+
+template <typename Serializer, typename Output>
+inline void marshall_one(Serializer&, Output& out, const temporary_buffer<char>& arg) {
+    char len[4];
+    write_le<uint32_t>(len, arg.size());
+    out.write(len, sizeof(len));
+    out.write(arg.get(), arg.size());
+}
+
+template <typename Serializer>
+inline void marshall_one(Serializer&, scattered_measuring_stream& out, const temporary_buffer<char>& arg) {
+    char len[4];
+    out.write(len, sizeof(len));
+    if (arg.size() < adopt_fragment_threshold) {
+        out.write(arg.get(), arg.size());
+    }
+}
+
+template <typename Serializer>
+inline void marshall_one(Serializer&, scattered_output_stream& out, const temporary_buffer<char>& arg) {
+    char len[4];
+    write_le<uint32_t>(len, arg.size());
+    out.write(len, sizeof(len));
+    if (arg.size() < adopt_fragment_threshold) {
+        out.write(arg.get(), arg.size());
+    } else {
+        // rpc never mutates argument buffers, so sharing a const argument
+        // is safe
+        out.put(const_cast<temporary_buffer<char>&>(arg).share());
+    }
+}
+
 template <typename Serializer, typename Output, typename... T>
 inline void do_marshall(Serializer& serializer, Output& out, const T&... args) {
     // C++ guarantees that brace-initialization expressions are evaluted in order
@@ -168,6 +248,22 @@ inline temporary_buffer<char> marshall(Serializer& serializer, size_t head_space
     return ret;
 }
 
+// Like marshall(), but produces a scattered_message: large
+// temporary_buffer arguments become their own fragments without being
+// copied.  The wire format is identical to marshall()'s.
+template <typename Serializer, typename... T>
+inline scattered_message<char> marshall_scattered(Serializer& serializer, size_t head_space, const T&... args) {
+    scattered_measuring_stream measure;
+    do_marshall(serializer, measure, args...);
+    // the shares taken below keep the underlying storage alive
+    temporary_buffer<char> linear(measure.size() + head_space);
+    scattered_message<char> msg;
+    scattered_output_stream out(msg, linear, head_space);
+    do_marshall(serializer, out, args...);
+    out.flush();
+    return msg;
+}
+
 template <typename Serializer, typename Input>
 inline std::tuple<> do_unmarshall(Serializer& serializer, Input& in) {
     return std::make_tuple();
@@ -191,6 +287,56 @@ struct unmarshal_one<Serializer, Input, optional<T>> {
     }
 };
 
+// An input stream over the receive buffer that can hand out zero-copy
+// views of it; share() keeps the underlying storage alive for as long as
+// the view does.
+class shared_input_stream {
+    temporary_buffer<char>& _buf;
+    size_t _pos = 0;
+public:
+    explicit shared_input_stream(temporary_buffer<char>& buf) : _buf(buf) {}
+    void read(char* p, size_t size) {
+        if (size > _buf.size() - _pos) {
+            throw std::out_of_range("deserialization buffer underflow");
+        }
+        std::copy_n(_buf.get() + _pos, size, p);
+        _pos += size;
+    }
+    temporary_buffer<char> share(size_t size) {
+        if (size > _buf.size() - _pos) {
+            throw std::out_of_range("deserialization buffer underflow");
+        }
+        auto ret = _buf.share(_pos, size);
+        _pos += size;
+        return ret;
+    }
+    size_t size() const {
+        return _buf.size() - _pos;
+    }
+};
+
+template<typename Serializer, typename Input>
+struct unmarshal_one<Serializer, Input, temporary_buffer<char>> {
+    static temporary_buffer<char> doit(Serializer&, Input& in) {
+        char len[4];
+        in.read(len, sizeof(len));
+        auto size = read_le<uint32_t>(len);
+        temporary_buffer<char> ret(size);
+        in.read(ret.get_write(), size);
+        return ret;
+    }
+};
+
+template<typename Serializer>
+struct unmarshal_one<Serializer, shared_input_stream, temporary_buffer<char>> {
+    static temporary_buffer<char> doit(Serializer&, shared_input_stream& in) {
+        char len[4];
+        in.read(len, sizeof(len));
+        // a view over the receive buffer; no copy
+        return in.share(read_le<uint32_t>(len));
+    }
+};
+
 template <typename Serializer, typename Input, typename T0, typename... Trest>
 inline std::tuple<T0, Trest...> do_unmarshall(Serializer& serializer, Input& in) {
     // FIXME: something less recursive
@@ -201,8 +347,8 @@ inline std::tuple<T0, Trest...> do_unmarshall(Serializer& serializer, Input& in)
 
 template <typename Serializer, typename... T>
 inline std::tuple<T...> unmarshall(Serializer& serializer, temporary_buffer<char> input) {
-    seastar::simple_input_stream in(input.get(), input.size());
-    return do_unmarshall<Serializer, seastar::simple_input_stream, T...>(serializer, in);
+    shared_input_stream in(input);
+    return do_unmarshall<Serializer, shared_input_stream, T...>(serializer, in);
 }
 
 static std::exception_ptr unmarshal_exception(temporary_buffer<char>& data) {
@@ -314,7 +460,7 @@ auto send_helper(MsgType xt, signature<Ret (InArgs...)> xsig) {
     struct shelper {
         MsgType t;
         signature<Ret (InArgs...)> sig;
-        auto send(typename protocol<Serializer, MsgType>::client& dst, std::experimental::optional<steady_clock_type::time_point> timeout, cancellable* cancel, const InArgs&... args) {
+        auto send(typename protocol<Serializer, MsgType>::client& dst, std::experimental::optional<steady_clock_type::time_point> timeout, cancellable* cancel, lane l, const InArgs&... args) {
             if (dst.error()) {
                 using cleaned_ret_type = typename wait_signature<Ret>::cleaned_type;
                 return futurize<cleaned_ret_type>::make_exception_future(closed_error());
@@ -322,29 +468,41 @@ auto send_helper(MsgType xt, signature<Ret (InArgs...)> xsig) {
 
             // send message
             auto msg_id = dst.next_message_id();
-            temporary_buffer<char> data = marshall(dst.serializer(), 28, args...);
-            auto p = data.get_write() + 8; // 8 extra bytes for expiration timer
-            write_le<uint64_t>(p, uint64_t(t));
-            write_le<int64_t>(p + 8, msg_id);
-            write_le<uint32_t>(p + 16, data.size() - 28);
+            net::packet data = std::move(marshall_scattered(dst.serializer(), 44, args...)).release();
+            auto p = data.get_header(0, 44) + 8; // 8 extra bytes for expiration timer
+            auto trace = tracing::current();
+            write_le<uint64_t>(p, trace.trace_id); // 16 bytes for the trace context
+            write_le<uint64_t>(p + 8, trace.span_id);
+            write_le<uint64_t>(p + 16, uint64_t(t));
+            write_le<int64_t>(p + 24, msg_id);
+            write_le<uint32_t>(p + 32, data.len() - 44);
 
             // prepare reply handler, if return type is now_wait_type this does nothing, since no reply will be sent
             using wait = wait_signature_t<Ret>;
-            return when_all(dst.send(std::move(data), timeout, cancel), wait_for_reply<Serializer, MsgType>(wait(), timeout, cancel, dst, msg_id, sig)).then([] (auto r) {
+            return when_all(dst.send(std::move(data), timeout, cancel, l), wait_for_reply<Serializer, MsgType>(wait(), timeout, cancel, dst, msg_id, sig)).then([] (auto r) {
                     return std::move(std::get<1>(r)); // return future of wait_for_reply
             });
         }
         auto operator()(typename protocol<Serializer, MsgType>::client& dst, const InArgs&... args) {
-            return send(dst, {}, nullptr, args...);
+            return send(dst, {}, nullptr, lane::normal, args...);
         }
         auto operator()(typename protocol<Serializer, MsgType>::client& dst, steady_clock_type::time_point timeout, const InArgs&... args) {
-            return send(dst, timeout, nullptr, args...);
+            return send(dst, timeout, nullptr, lane::normal, args...);
         }
         auto operator()(typename protocol<Serializer, MsgType>::client& dst, steady_clock_type::duration timeout, const InArgs&... args) {
-            return send(dst, steady_clock_type::now() + timeout, nullptr, args...);
+            return send(dst, steady_clock_type::now() + timeout, nullptr, lane::normal, args...);
         }
         auto operator()(typename protocol<Serializer, MsgType>::client& dst, cancellable& cancel, const InArgs&... args) {
-            return send(dst, {}, &cancel, args...);
+            return send(dst, {}, &cancel, lane::normal, args...);
+        }
+        auto operator()(typename protocol<Serializer, MsgType>::client& dst, steady_clock_type::time_point timeout, cancellable& cancel, const InArgs&... args) {
+            return send(dst, timeout, &cancel, lane::normal, args...);
+        }
+        auto operator()(typename protocol<Serializer, MsgType>::client& dst, urgent_flag, const InArgs&... args) {
+            return send(dst, {}, nullptr, lane::urgent, args...);
+        }
+        auto operator()(typename protocol<Serializer, MsgType>::client& dst, lane l, const InArgs&... args) {
+            return send(dst, {}, nullptr, l, args...);
         }
 
     };
@@ -354,32 +512,43 @@ auto send_helper(MsgType xt, signature<Ret (InArgs...)> xsig) {
 template <typename Serializer, typename MsgType>
 inline
 future<>
-protocol<Serializer, MsgType>::server::connection::respond(int64_t msg_id, temporary_buffer<char>&& data, std::experimental::optional<steady_clock_type::time_point> timeout) {
+protocol<Serializer, MsgType>::server::connection::respond(int64_t msg_id, temporary_buffer<char>&& data, std::experimental::optional<steady_clock_type::time_point> timeout, lane l) {
     auto p = data.get_write();
     write_le<int64_t>(p, msg_id);
     write_le<uint32_t>(p + 8, data.size() - 12);
-    return this->send(std::move(data), timeout);
+    return this->send(std::move(data), timeout, nullptr, l);
+}
+
+template <typename Serializer, typename MsgType>
+inline
+future<>
+protocol<Serializer, MsgType>::server::connection::respond(int64_t msg_id, net::packet&& data, std::experimental::optional<steady_clock_type::time_point> timeout, lane l) {
+    auto p = data.get_header(0, 12);
+    write_le<int64_t>(p, msg_id);
+    write_le<uint32_t>(p + 8, data.len() - 12);
+    return this->send(std::move(data), timeout, nullptr, l);
 }
 
 template<typename Serializer, typename MsgType, typename... RetTypes>
 inline future<> reply(wait_type, future<RetTypes...>&& ret, int64_t msg_id, lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client,
-        std::experimental::optional<steady_clock_type::time_point> timeout) {
+        std::experimental::optional<steady_clock_type::time_point> timeout, lane l) {
     if (!client->error()) {
-        temporary_buffer<char> data;
+        net::packet data;
         try {
-            data = ::apply(marshall<Serializer, const RetTypes&...>,
-                    std::tuple_cat(std::make_tuple(std::ref(client->serializer()), 12), std::move(ret.get())));
+            data = std::move(::apply(marshall_scattered<Serializer, const RetTypes&...>,
+                    std::tuple_cat(std::make_tuple(std::ref(client->serializer()), 12), std::move(ret.get())))).release();
         } catch (std::exception& ex) {
             uint32_t len = std::strlen(ex.what());
-            data = temporary_buffer<char>(20 + len);
-            auto p = data.get_write() + 12;
+            temporary_buffer<char> buf(20 + len);
+            auto p = buf.get_write() + 12;
             write_le<uint32_t>(p, uint32_t(exception_type::USER));
             write_le<uint32_t>(p + 4, len);
             std::copy_n(ex.what(), len, p + 8);
-            msg_id = -msg_id;
+            // exceptions are small; do not let them queue behind bulk data
+            return client->respond(-msg_id, std::move(buf), timeout);
         }
 
-        return client->respond(msg_id, std::move(data), timeout);
+        return client->respond(msg_id, std::move(data), timeout, l);
     } else {
         return make_ready_future<>();
     }
@@ -387,7 +556,7 @@ inline future<> reply(wait_type, future<RetTypes...>&& ret, int64_t msg_id, lw_s
 
 // specialization for no_wait_type which does not send a reply
 template<typename Serializer, typename MsgType>
-inline future<> reply(no_wait_type, future<no_wait_type>&& r, int64_t msgid, lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client, std::experimental::optional<steady_clock_type::time_point> timeout) {
+inline future<> reply(no_wait_type, future<no_wait_type>&& r, int64_t msgid, lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client, std::experimental::optional<steady_clock_type::time_point> timeout, lane) {
     try {
         r.get();
     } catch (std::exception& ex) {
@@ -420,21 +589,40 @@ auto lref_to_cref(T& x) {
 // Creates lambda to handle RPC message on a server.
 // The lambda unmarshalls all parameters, calls a handler, marshall return values and sends them back to a client
 template <typename Serializer, typename MsgType, typename Func, typename Ret, typename... InArgs, typename WantClientInfo>
-auto recv_helper(signature<Ret (InArgs...)> sig, Func&& func, WantClientInfo wci) {
+auto recv_helper(signature<Ret (InArgs...)> sig, Func&& func, WantClientInfo wci, lane l, typename protocol<Serializer, MsgType>::verb_stats* vs) {
     using signature = decltype(sig);
     using wait_style = wait_signature_t<Ret>;
-    return [func = lref_to_cref(std::forward<Func>(func))](lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client,
+    return [func = lref_to_cref(std::forward<Func>(func)), l, vs](lw_shared_ptr<typename protocol<Serializer, MsgType>::server::connection> client,
                                                            std::experimental::optional<steady_clock_type::time_point> timeout,
                                                            int64_t msg_id,
                                                            temporary_buffer<char> data) mutable {
+        auto received = steady_clock_type::now();
+        vs->invocations++;
+        vs->bytes += data.size();
+        if (timeout && received >= timeout.value()) {
+            // the client's deadline has already expired, so it is no
+            // longer waiting; do not waste cycles producing a reply
+            return make_ready_future<>();
+        }
         auto memory_consumed = client->estimate_request_size(data.size());
         auto args = unmarshall<Serializer, InArgs...>(client->serializer(), std::move(data));
         // note: apply is executed asynchronously with regards to networking so we cannot chain futures here by doing "return apply()"
-        return client->wait_for_resources(memory_consumed).then([client, timeout, msg_id, memory_consumed, args = std::move(args), &func] () mutable {
+        return client->wait_for_resources(memory_consumed, timeout).then_wrapped([client, timeout, msg_id, memory_consumed, args = std::move(args), &func, l, vs, received] (future<> admitted) mutable {
+            if (admitted.failed()) {
+                // admission outlasted the client's deadline (or the server
+                // is stopping); shed the request instead of doing work
+                // nobody is waiting for
+                admitted.ignore_ready_future();
+                client->get_stats_internal().shed++;
+                return;
+            }
             try {
-                seastar::with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, memory_consumed, args = std::move(args), &func] () mutable {
-                    return apply(func, client->info(), WantClientInfo(), signature(), std::move(args)).then_wrapped([client, timeout, msg_id, memory_consumed] (futurize_t<typename signature::ret_type> ret) mutable {
-                        return reply<Serializer, MsgType>(wait_style(), std::move(ret), msg_id, client, timeout).finally([client, memory_consumed] {
+                seastar::with_gate(client->get_server().reply_gate(), [client, timeout, msg_id, memory_consumed, args = std::move(args), &func, l, vs, received] () mutable {
+                    auto started = steady_clock_type::now();
+                    vs->add_queue_wait(started - received);
+                    return apply(func, client->info(), WantClientInfo(), signature(), std::move(args)).then_wrapped([client, timeout, msg_id, memory_consumed, l, vs, started] (futurize_t<typename signature::ret_type> ret) mutable {
+                        vs->add_handler_time(steady_clock_type::now() - started);
+                        return reply<Serializer, MsgType>(wait_style(), std::move(ret), msg_id, client, timeout, l).finally([client, memory_consumed] {
                             client->release_resources(memory_consumed);
                         });
                     });
@@ -536,11 +724,42 @@ auto protocol<Serializer, MsgType>::make_client(MsgType t) {
 template<typename Serializer, typename MsgType>
 template<typename Func>
 auto protocol<Serializer, MsgType>::register_handler(MsgType t, Func&& func) {
+    return register_handler(t, lane::normal, std::forward<Func>(func));
+}
+
+template<typename Serializer, typename MsgType>
+typename protocol<Serializer, MsgType>::verb_stats&
+protocol<Serializer, MsgType>::register_verb_stats(MsgType t) {
+    auto it = _verb_stats.find(t);
+    if (it != _verb_stats.end()) {
+        // re-registered verb; keep the counters and metrics
+        return it->second;
+    }
+    auto& vs = _verb_stats[t];
+    auto name = to_sstring(uint64_t(t));
+    _verb_metrics.emplace_back(scollectd::add_polled_metric(
+            scollectd::type_instance_id("rpc", scollectd::per_cpu_plugin_instance, "total_operations", name),
+            scollectd::make_typed(scollectd::data_type::DERIVE, vs.invocations)));
+    _verb_metrics.emplace_back(scollectd::add_polled_metric(
+            scollectd::type_instance_id("rpc", scollectd::per_cpu_plugin_instance, "derive", name + "-bytes"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, vs.bytes)));
+    _verb_metrics.emplace_back(scollectd::add_polled_metric(
+            scollectd::type_instance_id("rpc", scollectd::per_cpu_plugin_instance, "derive", name + "-handler-ns"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, vs.handler_nanos)));
+    _verb_metrics.emplace_back(scollectd::add_polled_metric(
+            scollectd::type_instance_id("rpc", scollectd::per_cpu_plugin_instance, "derive", name + "-queue-wait-ns"),
+            scollectd::make_typed(scollectd::data_type::DERIVE, vs.queue_wait_nanos)));
+    return vs;
+}
+
+template<typename Serializer, typename MsgType>
+template<typename Func>
+auto protocol<Serializer, MsgType>::register_handler(MsgType t, lane l, Func&& func) {
     using sig_type = signature<typename function_traits<Func>::signature>;
     using clean_sig_type = typename sig_type::clean;
     using want_client_info = typename sig_type::want_client_info;
     auto recv = recv_helper<Serializer, MsgType>(clean_sig_type(), std::forward<Func>(func),
-            want_client_info());
+            want_client_info(), l, &register_verb_stats(t));
     register_receiver(t, make_copyable_function(std::move(recv)));
     return make_client<Func>(t);
 }
@@ -557,7 +776,7 @@ protocol<Serializer, MsgType>::server::server(protocol<Serializer, MsgType>& pro
 
 template<typename Serializer, typename MsgType>
 protocol<Serializer, MsgType>::server::server(protocol<Serializer, MsgType>& proto, server_socket ss, resource_limits limits, server_options opts)
-        : _proto(proto), _ss(std::move(ss)), _limits(limits), _resources_available(limits.max_memory), _options(opts)
+        : _proto(proto), _ss(std::move(ss)), _limits(limits), _resources_available(limits.max_memory), _requests_available(limits.max_requests), _options(opts)
 {
     accept();
 }
@@ -588,8 +807,11 @@ void protocol<Serializer, MsgType>::server::accept() {
 
 template<typename Serializer, typename MsgType>
 protocol<Serializer, MsgType>::server::connection::connection(protocol<Serializer, MsgType>::server& s, connected_socket&& fd, socket_address&& addr, protocol<Serializer, MsgType>& proto)
-    : protocol<Serializer, MsgType>::connection(std::move(fd), proto), _server(s) {
+    : protocol<Serializer, MsgType>::connection(std::move(fd), proto), _server(s),
+      _memory_available(s._limits.max_memory_per_connection), _requests_available(s._limits.max_requests_per_connection) {
     _info.addr = std::move(addr);
+    this->_batch_flush_delay = s._options.batch_flush_delay;
+    this->_batch_flush_bytes = s._options.batch_flush_bytes;
 }
 
 
@@ -708,6 +930,109 @@ protocol<Serializer, MsgType>::read_frame(const Info& info, input_stream<char>&
     });
 }
 
+// Reads one base-128 varint.  A disengaged result means the stream hit
+// eof before the first byte (a clean connection close); eof in the
+// middle of a varint is a protocol error.
+inline future<std::experimental::optional<uint64_t>> read_varint(input_stream<char>& in) {
+    struct state {
+        uint64_t val = 0;
+        unsigned shift = 0;
+        std::experimental::optional<uint64_t> out;
+    };
+    return do_with(state{}, [&in] (state& s) {
+        return repeat([&in, &s] {
+            return in.read_exactly(1).then([&s] (temporary_buffer<char> b) {
+                if (!b.size()) {
+                    if (s.shift) {
+                        throw rpc_protocol_error();
+                    }
+                    return stop_iteration::yes;
+                }
+                auto byte = uint8_t(*b.get());
+                s.val |= uint64_t(byte & 0x7f) << s.shift;
+                s.shift += 7;
+                if (s.shift > 70) {
+                    // more than ten continuation bytes
+                    throw rpc_protocol_error();
+                }
+                if (byte & 0x80) {
+                    return stop_iteration::no;
+                }
+                s.out = s.val;
+                return stop_iteration::yes;
+            });
+        }).then([&s] {
+            return make_ready_future<std::experimental::optional<uint64_t>>(s.out);
+        });
+    });
+}
+
+template <typename Serializer, typename MsgType>
+template<typename FrameType, typename Info>
+typename FrameType::return_type
+protocol<Serializer, MsgType>::read_compact_frame(const Info& info, input_stream<char>& in, int64_t& last_id) {
+    struct state {
+        uint64_t fields[4];
+        unsigned idx = 0;
+        bool eof = false;
+    };
+    return do_with(state{}, [this, &info, &in, &last_id] (state& s) {
+        return repeat([this, &info, &in, &s] {
+            return read_varint(in).then([this, &info, &s] (std::experimental::optional<uint64_t> v) {
+                if (!v) {
+                    if (s.idx) {
+                        log(info, sprint("unexpected eof on a %s while reading compact header", FrameType::role()));
+                    }
+                    s.eof = true;
+                    return stop_iteration::yes;
+                }
+                s.fields[s.idx++] = v.value();
+                return s.idx == FrameType::nr_compact_fields ? stop_iteration::yes : stop_iteration::no;
+            });
+        }).then([this, &info, &in, &s, &last_id] {
+            if (s.eof) {
+                return FrameType::empty_value();
+            }
+            auto h = FrameType::decode_compact(s.fields, last_id);
+            return in.read_exactly(FrameType::get_size(h)).then([this, h, &info] (temporary_buffer<char> data) {
+                if (data.size() != FrameType::get_size(h)) {
+                    log(info, sprint("unexpected eof on a %s while reading data: expected %d got %d", FrameType::role(), FrameType::get_size(h), data.size()));
+                    return FrameType::empty_value();
+                }
+                return FrameType::make_value(h, std::move(data));
+            });
+        });
+    });
+}
+
+template <typename Serializer, typename MsgType>
+template<typename FrameType, typename Info>
+typename FrameType::return_type
+protocol<Serializer, MsgType>::read_compact_frame_compressed(const Info& info, std::unique_ptr<compressor>& compressor, input_stream<char>& in, int64_t& last_id) {
+    if (compressor) {
+        return in.read_exactly(4).then([&, this] (temporary_buffer<char> compress_header) {
+            if (compress_header.size() != 4) {
+                if (compress_header.size() != 0) {
+                    log(info, sprint("unexpected eof on a %s while reading compression header: expected 4 got %d", FrameType::role(), compress_header.size()));
+                }
+                return FrameType::empty_value();
+            }
+            auto size = read_le<uint32_t>(compress_header.get());
+            return in.read_exactly(size).then([this, size, &compressor, &info, &last_id] (temporary_buffer<char> compressed_data) {
+                if (compressed_data.size() != size) {
+                    log(info, sprint("unexpected eof on a %s while reading compressed data: expected %d got %d", FrameType::role(), size, compressed_data.size()));
+                    return FrameType::empty_value();
+                }
+                return do_with(as_input_stream(net::packet(net::packet(), compressor->decompress(std::move(compressed_data)))), [this, &info, &last_id] (input_stream<char>& in) {
+                    return read_compact_frame<FrameType>(info, in, last_id);
+                });
+            });
+        });
+    } else {
+        return read_compact_frame<FrameType>(info, in, last_id);
+    }
+}
+
 template <typename Serializer, typename MsgType>
 template<typename FrameType, typename Info>
 typename FrameType::return_type
@@ -756,6 +1081,20 @@ protocol<Serializer, MsgType>::server::connection::negotiate(feature_map request
             this->_timeout_negotiated = true;
             ret[protocol_features::TIMEOUT] = "";
             break;
+        case protocol_features::STREAM:
+            this->_stream_negotiated = true;
+            ret[protocol_features::STREAM] = "";
+            break;
+        case protocol_features::COMPACT:
+            if (_server._options.compact_frames) {
+                this->_compact_negotiated = true;
+                ret[protocol_features::COMPACT] = "";
+            }
+            break;
+        case protocol_features::TRACE:
+            this->_trace_negotiated = true;
+            ret[protocol_features::TRACE] = "";
+            break;
         default:
             // nothing to do
             ;
@@ -792,6 +1131,11 @@ struct request_frame {
         auto size = read_le<uint32_t>(ptr + 16);
         return std::make_tuple(std::experimental::nullopt, type, msgid, size);
     }
+    static constexpr unsigned nr_compact_fields = 3;
+    static header_type decode_compact(const uint64_t* f, int64_t& last_id) {
+        last_id += zigzag_decode(f[1]);
+        return std::make_tuple(std::experimental::nullopt, MsgType(f[0]), last_id, uint32_t(f[2]));
+    }
     static uint32_t get_size(const header_type& t) {
         return std::get<3>(t);
     }
@@ -800,24 +1144,70 @@ struct request_frame {
     }
 };
 
+// Decodes the trace context prefix (protocol_features::TRACE) and makes
+// it current, so the handler and everything it chains run as part of
+// the sender's trace.
 template<typename MsgType>
-struct request_frame_with_timeout : request_frame<MsgType> {
+struct request_frame_with_trace : request_frame<MsgType> {
     using super = request_frame<MsgType>;
     static size_t header_size() {
-        return 28;
+        return super::header_size() + 16;
+    }
+    static typename super::header_type decode_header(const char* ptr) {
+        tracing::set_current({read_le<uint64_t>(ptr), read_le<uint64_t>(ptr + 8)});
+        return super::decode_header(ptr + 16);
+    }
+    static constexpr unsigned nr_compact_fields = super::nr_compact_fields + 2;
+    static typename super::header_type decode_compact(const uint64_t* f, int64_t& last_id) {
+        tracing::set_current({f[0], f[1]});
+        return super::decode_compact(f + 2, last_id);
+    }
+};
+
+template<typename MsgType, typename Base = request_frame<MsgType>>
+struct request_frame_with_timeout : Base {
+    using super = Base;
+    static size_t header_size() {
+        return super::header_size() + 8;
     }
     static typename super::header_type decode_header(const char* ptr) {
         auto h = super::decode_header(ptr + 8);
         std::get<0>(h) = read_le<uint64_t>(ptr);
         return h;
     }
+    static constexpr unsigned nr_compact_fields = super::nr_compact_fields + 1;
+    static typename super::header_type decode_compact(const uint64_t* f, int64_t& last_id) {
+        auto h = super::decode_compact(f + 1, last_id);
+        std::get<0>(h) = f[0];
+        return h;
+    }
 };
 
 template <typename Serializer, typename MsgType>
 future<std::experimental::optional<uint64_t>, MsgType, int64_t, std::experimental::optional<temporary_buffer<char>>>
 protocol<Serializer, MsgType>::server::connection::read_request_frame(input_stream<char>& in) {
+    using trace_frame = request_frame_with_trace<MsgType>;
+    if (this->_compact_negotiated) {
+        if (this->_timeout_negotiated) {
+            if (this->_trace_negotiated) {
+                return this->_server._proto.template read_compact_frame<request_frame_with_timeout<MsgType, trace_frame>>(_info, in, this->_compact_rcvd_id);
+            } else {
+                return this->_server._proto.template read_compact_frame<request_frame_with_timeout<MsgType>>(_info, in, this->_compact_rcvd_id);
+            }
+        } else if (this->_trace_negotiated) {
+            return this->_server._proto.template read_compact_frame<trace_frame>(_info, in, this->_compact_rcvd_id);
+        } else {
+            return this->_server._proto.template read_compact_frame<request_frame<MsgType>>(_info, in, this->_compact_rcvd_id);
+        }
+    }
     if (this->_timeout_negotiated) {
-        return this->_server._proto.template read_frame<request_frame_with_timeout<MsgType>>(_info, in);
+        if (this->_trace_negotiated) {
+            return this->_server._proto.template read_frame<request_frame_with_timeout<MsgType, trace_frame>>(_info, in);
+        } else {
+            return this->_server._proto.template read_frame<request_frame_with_timeout<MsgType>>(_info, in);
+        }
+    } else if (this->_trace_negotiated) {
+        return this->_server._proto.template read_frame<trace_frame>(_info, in);
     } else {
         return this->_server._proto.template read_frame<request_frame<MsgType>>(_info, in);
     }
@@ -826,8 +1216,28 @@ protocol<Serializer, MsgType>::server::connection::read_request_frame(input_stre
 template <typename Serializer, typename MsgType>
 future<std::experimental::optional<uint64_t>, MsgType, int64_t, std::experimental::optional<temporary_buffer<char>>>
 protocol<Serializer, MsgType>::server::connection::read_request_frame_compressed(input_stream<char>& in) {
+    using trace_frame = request_frame_with_trace<MsgType>;
+    if (this->_compact_negotiated) {
+        if (this->_timeout_negotiated) {
+            if (this->_trace_negotiated) {
+                return this->_server._proto.template read_compact_frame_compressed<request_frame_with_timeout<MsgType, trace_frame>>(_info, this->_compressor, in, this->_compact_rcvd_id);
+            } else {
+                return this->_server._proto.template read_compact_frame_compressed<request_frame_with_timeout<MsgType>>(_info, this->_compressor, in, this->_compact_rcvd_id);
+            }
+        } else if (this->_trace_negotiated) {
+            return this->_server._proto.template read_compact_frame_compressed<trace_frame>(_info, this->_compressor, in, this->_compact_rcvd_id);
+        } else {
+            return this->_server._proto.template read_compact_frame_compressed<request_frame<MsgType>>(_info, this->_compressor, in, this->_compact_rcvd_id);
+        }
+    }
     if (this->_timeout_negotiated) {
-        return this->_server._proto.template read_frame_compressed<request_frame_with_timeout<MsgType>>(_info, this->_compressor, in);
+        if (this->_trace_negotiated) {
+            return this->_server._proto.template read_frame_compressed<request_frame_with_timeout<MsgType, trace_frame>>(_info, this->_compressor, in);
+        } else {
+            return this->_server._proto.template read_frame_compressed<request_frame_with_timeout<MsgType>>(_info, this->_compressor, in);
+        }
+    } else if (this->_trace_negotiated) {
+        return this->_server._proto.template read_frame_compressed<trace_frame>(_info, this->_compressor, in);
     } else {
         return this->_server._proto.template read_frame_compressed<request_frame<MsgType>>(_info, this->_compressor, in);
     }
@@ -849,11 +1259,31 @@ protocol<Serializer, MsgType>::client::negotiate(feature_map provided) {
         case protocol_features::TIMEOUT:
             this->_timeout_negotiated = true;
             break;
+        case protocol_features::STREAM:
+            this->_stream_negotiated = true;
+            break;
+        case protocol_features::COMPACT:
+            this->_compact_negotiated = true;
+            break;
+        case protocol_features::TRACE:
+            this->_trace_negotiated = true;
+            break;
         default:
             // nothing to do
             ;
         }
     }
+    if (!this->_stream_negotiated) {
+        // the peer does not support streaming; fail any stream that was
+        // opened before negotiation completed and any opened later
+        _stream_rejected = true;
+        for (auto&& s : _streams) {
+            s.second->done = true;
+            s.second->closed.set_exception(std::make_exception_ptr(closed_error()));
+            s.second->credits.broken();
+        }
+        _streams.clear();
+    }
 }
 
 template<typename Serializer, typename MsgType>
@@ -870,11 +1300,16 @@ future<> protocol<Serializer, MsgType>::server::connection::process() {
                     if (expire && *expire) {
                         timeout = steady_clock_type::now() + std::chrono::milliseconds(*expire);
                     }
+                    if (msg_id < 0 && this->_stream_negotiated) {
+                        // requests use positive ids only; a negative id
+                        // marks a stream frame
+                        return this->handle_stream_frame(type, -msg_id, timeout, std::move(data.value()));
+                    }
                     auto it = _server._proto._handlers.find(type);
                     if (it != _server._proto._handlers.end()) {
                         return it->second(this->shared_from_this(), timeout, msg_id, std::move(data.value()));
                     } else {
-                        return this->wait_for_resources(28).then([this, timeout, msg_id, type] {
+                        return this->wait_for_resources(28, timeout).then([this, timeout, msg_id, type] {
                             // send unknown_verb exception back
                             auto data = temporary_buffer<char>(28);
                             auto p = data.get_write() + 12;
@@ -908,6 +1343,84 @@ future<> protocol<Serializer, MsgType>::server::connection::process() {
     });
 }
 
+template<typename Serializer, typename MsgType>
+void
+protocol<Serializer, MsgType>::server::connection::grant_credits(int64_t stream_id, uint32_t credits, std::experimental::optional<steady_clock_type::time_point> timeout) {
+    // credits ride the response path with the stream's negated id; a
+    // zero-length payload acknowledges the stream's close instead
+    temporary_buffer<char> data(credits ? 16 : 12);
+    if (credits) {
+        write_le<uint32_t>(data.get_write() + 12, credits);
+    }
+    // credits are latency critical: the sender may be stalled on them
+    this->respond(-stream_id, std::move(data), timeout, lane::urgent).ignore_ready_future();
+}
+
+template<typename Serializer, typename MsgType>
+future<>
+protocol<Serializer, MsgType>::server::connection::handle_stream_frame(MsgType type, int64_t stream_id, std::experimental::optional<steady_clock_type::time_point> timeout, temporary_buffer<char> data) {
+    auto it = _streams.find(stream_id);
+    if (it == _streams.end()) {
+        // the opening frame of a stream; the type field carries the verb
+        // it is opened on
+        auto h = this->_server._proto._stream_handlers.find(type);
+        if (h == this->_server._proto._stream_handlers.end()) {
+            this->get_protocol().log(_info, stream_id, "stream opened on unregistered verb");
+            this->_error = true;
+            return make_ready_future<>();
+        }
+        stream_state state;
+        state.sink = h->second(_info);
+        _streams.emplace(stream_id, std::move(state));
+        grant_credits(stream_id, stream_initial_window, timeout);
+        return make_ready_future<>();
+    }
+    auto& state = it->second;
+    switch (stream_opcode(uint64_t(type))) {
+    case stream_opcode::data:
+        // Sink frames strictly in send order, without blocking the read
+        // loop on the sink; the credit window bounds the amount of data
+        // that can queue up behind a slow consumer.
+        state.order = state.order.then([conn = this->shared_from_this(), stream_id, timeout, data = std::move(data)] () mutable {
+            auto it = conn->_streams.find(stream_id);
+            if (it == conn->_streams.end()) {
+                return make_ready_future<>();
+            }
+            return it->second.sink(std::move(data)).then([conn, stream_id, timeout] {
+                // replenish the sender's window once half of it was consumed
+                auto it = conn->_streams.find(stream_id);
+                if (it != conn->_streams.end() && ++it->second.consumed >= stream_initial_window / 2) {
+                    it->second.consumed = 0;
+                    conn->grant_credits(stream_id, stream_initial_window / 2, timeout);
+                }
+            }).handle_exception([conn] (std::exception_ptr eptr) {
+                log_exception(*conn, "stream sink failed", eptr);
+                conn->_error = true;
+            });
+        });
+        break;
+    case stream_opcode::close:
+        state.order = state.order.then([conn = this->shared_from_this(), stream_id, timeout] {
+            auto it = conn->_streams.find(stream_id);
+            if (it == conn->_streams.end()) {
+                return make_ready_future<>();
+            }
+            return it->second.sink(std::experimental::nullopt).handle_exception([conn] (std::exception_ptr eptr) {
+                log_exception(*conn, "stream sink failed on close", eptr);
+            }).finally([conn, stream_id, timeout] {
+                // the zero-length grant doubles as the close acknowledgment
+                conn->grant_credits(stream_id, 0, timeout);
+                conn->_streams.erase(stream_id);
+            });
+        });
+        break;
+    default:
+        this->get_protocol().log(_info, stream_id, "unknown stream opcode");
+        this->_error = true;
+    }
+    return make_ready_future<>();
+}
+
 template<typename Serializer, typename MsgType>
 future<>
 protocol<Serializer, MsgType>::client::negotiate_protocol(input_stream<char>& in) {
@@ -933,6 +1446,11 @@ struct response_frame {
         auto size = read_le<uint32_t>(ptr + 8);
         return std::make_tuple(msgid, size);
     }
+    static constexpr unsigned nr_compact_fields = 2;
+    static header_type decode_compact(const uint64_t* f, int64_t& last_id) {
+        last_id += zigzag_decode(f[0]);
+        return std::make_tuple(last_id, uint32_t(f[1]));
+    }
     static uint32_t get_size(const header_type& t) {
         return std::get<1>(t);
     }
@@ -946,6 +1464,9 @@ template<typename Serializer, typename MsgType>
 inline
 future<int64_t, std::experimental::optional<temporary_buffer<char>>>
 protocol<Serializer, MsgType>::client::read_response_frame(input_stream<char>& in) {
+    if (this->_compact_negotiated) {
+        return this->_proto.template read_compact_frame<response_frame>(this->_server_addr, in, this->_compact_rcvd_id);
+    }
     return this->_proto.template read_frame<response_frame>(this->_server_addr, in);
 }
 
@@ -953,12 +1474,17 @@ template<typename Serializer, typename MsgType>
 inline
 future<int64_t, std::experimental::optional<temporary_buffer<char>>>
 protocol<Serializer, MsgType>::client::read_response_frame_compressed(input_stream<char>& in) {
+    if (this->_compact_negotiated) {
+        return this->_proto.template read_compact_frame_compressed<response_frame>(this->_server_addr, this->_compressor, in, this->_compact_rcvd_id);
+    }
     return this->_proto.template read_frame_compressed<response_frame>(this->_server_addr, this->_compressor, in);
 }
 
 template<typename Serializer, typename MsgType>
 protocol<Serializer, MsgType>::client::client(protocol& proto, client_options ops, seastar::socket socket, ipv4_addr addr, ipv4_addr local)
         : protocol<Serializer, MsgType>::connection(proto), _socket(std::move(socket)), _server_addr(addr), _options(ops) {
+    this->_batch_flush_delay = ops.batch_flush_delay;
+    this->_batch_flush_bytes = ops.batch_flush_bytes;
     _socket.connect(addr, local).then([this, ops = std::move(ops)] (connected_socket fd) {
         fd.set_nodelay(true);
         if (ops.keepalive) {
@@ -977,6 +1503,12 @@ protocol<Serializer, MsgType>::client::client(protocol& proto, client_options op
         if (_options.send_timeout_data) {
             features[protocol_features::TIMEOUT] = "";
         }
+        // a server that does not know a feature simply does not echo it back
+        features[protocol_features::STREAM] = "";
+        features[protocol_features::TRACE] = "";
+        if (_options.compact_frames) {
+            features[protocol_features::COMPACT] = "";
+        }
         send_negotiation_frame(*this, std::move(features));
 
         return this->negotiate_protocol(this->_read_buf).then([this] () {
@@ -990,6 +1522,8 @@ protocol<Serializer, MsgType>::client::client(protocol& proto, client_options op
                         auto handler = std::move(it->second);
                         _outstanding.erase(it);
                         (*handler)(*this, msg_id, std::move(data.value()));
+                    } else if (msg_id < 0 && handle_stream_response(-msg_id, data.value())) {
+                        // credit grant or close acknowledgment for one of our streams
                     } else if (msg_id < 0) {
                         try {
                             std::rethrow_exception(unmarshal_exception(data.value()));
@@ -1017,6 +1551,14 @@ protocol<Serializer, MsgType>::client::client(protocol& proto, client_options op
             f.ignore_ready_future();
             this->_stopped.set_value();
             this->_outstanding.clear();
+            for (auto&& s : this->_streams) {
+                s.second->credits.broken();
+                if (!s.second->done) {
+                    s.second->done = true;
+                    s.second->closed.set_exception(std::make_exception_ptr(closed_error()));
+                }
+            }
+            this->_streams.clear();
         });
     });
 }
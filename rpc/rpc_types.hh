@@ -24,6 +24,7 @@
 #include "net/api.hh"
 #include <stdexcept>
 #include <string>
+#include <cmath>
 #include <boost/any.hpp>
 #include <boost/type.hpp>
 #include <experimental/optional>
@@ -42,6 +43,8 @@ struct stats {
     counter_type sent_messages = 0;
     counter_type wait_reply = 0;
     counter_type timeout = 0;
+    counter_type queued = 0;  // requests that waited for admission (see resource_limits)
+    counter_type shed = 0;    // requests dropped because admission outlasted their deadline
 };
 
 
@@ -166,4 +169,55 @@ public:
     };
 };
 
+// Compressors skip frames smaller than this and send them stored instead
+// (marked with uncompressed size 0 on the wire): the per-frame overhead
+// dwarfs any saving on a 100-byte ack.
+static constexpr size_t min_compressible_frame_size = 512;
+
+// Returns true if a frame is worth trying to compress: skips tiny frames
+// outright and estimates the Shannon entropy of a sample to skip frames
+// that will not shrink (already-compressed or encrypted payloads).
+inline bool worth_compressing(const char* data, size_t size) {
+    if (size < min_compressible_frame_size) {
+        return false;
+    }
+    static constexpr size_t sample_size = 1024;
+    unsigned counts[256] = {};
+    auto stride = size <= sample_size ? 1 : size / sample_size;
+    size_t n = 0;
+    for (size_t i = 0; i < size; i += stride, n++) {
+        counts[uint8_t(data[i])]++;
+    }
+    double entropy = 0;
+    for (auto c : counts) {
+        if (c) {
+            auto p = double(c) / n;
+            entropy -= p * std::log2(p);
+        }
+    }
+    // 7.5 bits per byte leaves no room for a worthwhile ratio
+    return entropy < 7.5;
+}
+
+// Base-128 varints, with zigzag encoding for signed values, as used by
+// the compact frame mode (protocol_features::COMPACT).  p must have room
+// for up to 10 bytes; returns the encoded length.
+inline size_t write_varint(char* p, uint64_t v) {
+    size_t n = 0;
+    do {
+        uint8_t b = v & 0x7f;
+        v >>= 7;
+        p[n++] = b | (v ? 0x80 : 0);
+    } while (v);
+    return n;
+}
+
+inline uint64_t zigzag_encode(int64_t v) {
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t v) {
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
 } // namespace rpc
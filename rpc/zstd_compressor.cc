@@ -0,0 +1,89 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "zstd_compressor.hh"
+#include "core/byteorder.hh"
+
+namespace rpc {
+
+const sstring zstd_compressor::factory::_name = "ZSTD";
+
+// level 3 is the zstd default; it already beats lz4 on ratio while staying
+// cheap enough for the rpc path
+static constexpr int zstd_compression_level = 3;
+
+zstd_compressor::zstd_compressor(sstring dict)
+        : _dict(std::move(dict)), _cctx(ZSTD_createCCtx()), _dctx(ZSTD_createDCtx()) {
+    if (!_cctx || !_dctx) {
+        ZSTD_freeCCtx(_cctx);
+        ZSTD_freeDCtx(_dctx);
+        throw std::bad_alloc();
+    }
+}
+
+zstd_compressor::~zstd_compressor() {
+    ZSTD_freeCCtx(_cctx);
+    ZSTD_freeDCtx(_dctx);
+}
+
+temporary_buffer<char> zstd_compressor::compress(size_t head_space, temporary_buffer<char> data) {
+    head_space += 4;
+    if (worth_compressing(data.begin(), data.size())) {
+        temporary_buffer<char> dst(head_space + ZSTD_compressBound(data.size()));
+        auto size = ZSTD_compress_usingDict(_cctx, dst.get_write() + head_space, dst.size() - head_space,
+                data.begin(), data.size(), _dict.begin(), _dict.size(), zstd_compression_level);
+        if (ZSTD_isError(size)) {
+            throw std::runtime_error("RPC frame zstd compression failure");
+        }
+        if (size < data.size()) {
+            dst.trim(size + head_space);
+            write_le<uint32_t>(dst.get_write() + 4, data.size());
+            return dst;
+        }
+        // the frame grew; send it stored instead
+    }
+    // store uncompressed, marked with uncompressed size 0
+    temporary_buffer<char> dst(head_space + data.size());
+    write_le<uint32_t>(dst.get_write() + 4, 0);
+    std::copy_n(data.begin(), data.size(), dst.get_write() + head_space);
+    return dst;
+}
+
+temporary_buffer<char> zstd_compressor::decompress(temporary_buffer<char> data) {
+    if (data.size() < 4) {
+        return temporary_buffer<char>();
+    }
+    auto size = read_le<uint32_t>(data.begin());
+    if (!size) {
+        // frame was sent stored
+        data.trim_front(4);
+        return std::move(data);
+    }
+    temporary_buffer<char> dst(size);
+    auto ret = ZSTD_decompress_usingDict(_dctx, dst.get_write(), dst.size(),
+            data.begin() + 4, data.size() - 4, _dict.begin(), _dict.size());
+    if (ZSTD_isError(ret) || ret != size) {
+        throw std::runtime_error("RPC frame zstd decompression failure");
+    }
+    return dst;
+}
+
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include "core/sstring.hh"
+#include "rpc/rpc_types.hh"
+#include <zstd.h>
+
+namespace rpc {
+    // Zstd compression with optional dictionary support; a dictionary
+    // trained on representative messages recovers the ratio lost on small,
+    // highly redundant frames.  Both sides must be configured with the
+    // same dictionary, otherwise decompression fails.  The wire format
+    // matches lz4_compressor: a 4-byte uncompressed size (0 = frame sent
+    // stored) followed by the compressed data.
+    class zstd_compressor : public compressor {
+        sstring _dict;
+        ZSTD_CCtx* _cctx;
+        ZSTD_DCtx* _dctx;
+    public:
+        class factory: public rpc::compressor::factory {
+            static const sstring _name;
+            sstring _dict;
+        public:
+            factory() = default;
+            // dict is the raw content of a dictionary trained on
+            // representative messages (e.g. with "zstd --train")
+            explicit factory(sstring dict) : _dict(std::move(dict)) {}
+            virtual const sstring& supported() const override {
+                return _name;
+            }
+            virtual std::unique_ptr<rpc::compressor> negotiate(sstring feature, bool is_server) const override {
+                return feature == _name ? std::make_unique<rpc::zstd_compressor>(_dict) : nullptr;
+            }
+        };
+    public:
+        explicit zstd_compressor(sstring dict = {});
+        ~zstd_compressor();
+        // compress data, leaving head_space empty in returned buffer
+        temporary_buffer<char> compress(size_t head_space, temporary_buffer<char> data) override;
+        // decompress data
+        temporary_buffer<char> decompress(temporary_buffer<char> data) override;
+    };
+}
@@ -0,0 +1,172 @@
+#!/usr/bin/env python
+#
+# This file is open source software, licensed to you under the terms
+# of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+# distributed with this work for additional information regarding copyright
+# ownership.  You may not use this file except in compliance with the License.
+#
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+# Copyright (C) 2016 ScyllaDB
+#
+# Compares two result files written by the tests/perf/perf_tests binary
+# with --json-output.  For each benchmark present in both files it runs
+# Welch's t-test on the per-batch ns/op samples and reports the change
+# in the mean with its p-value; cycles/op and allocs/op are shown for
+# context (single numbers per run, no significance test possible).
+#
+# Exits non-zero if any benchmark got slower by more than --threshold
+# with p < --alpha, so it can gate a CI job:
+#
+#   perf_tests --json-output before.json        # on the baseline build
+#   perf_tests --json-output after.json         # on the candidate
+#   scripts/perf-compare.py before.json after.json
+#
+# Only the python standard library is used.
+
+from __future__ import print_function
+import argparse
+import json
+import math
+import sys
+
+
+def mean(xs):
+    return sum(xs) / len(xs)
+
+
+def variance(xs):
+    m = mean(xs)
+    return sum((x - m) ** 2 for x in xs) / (len(xs) - 1)
+
+
+def betacf(a, b, x):
+    # continued fraction for the incomplete beta function (Lentz's
+    # algorithm, as in Numerical Recipes)
+    MAXIT, EPS, FPMIN = 200, 3.0e-7, 1.0e-30
+    qab, qap, qam = a + b, a + 1.0, a - 1.0
+    c = 1.0
+    d = 1.0 - qab * x / qap
+    if abs(d) < FPMIN:
+        d = FPMIN
+    d = 1.0 / d
+    h = d
+    for m in range(1, MAXIT + 1):
+        m2 = 2 * m
+        aa = m * (b - m) * x / ((qam + m2) * (a + m2))
+        d = 1.0 + aa * d
+        if abs(d) < FPMIN:
+            d = FPMIN
+        c = 1.0 + aa / c
+        if abs(c) < FPMIN:
+            c = FPMIN
+        d = 1.0 / d
+        h *= d * c
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2))
+        d = 1.0 + aa * d
+        if abs(d) < FPMIN:
+            d = FPMIN
+        c = 1.0 + aa / c
+        if abs(c) < FPMIN:
+            c = FPMIN
+        d = 1.0 / d
+        de = d * c
+        h *= de
+        if abs(de - 1.0) < EPS:
+            break
+    return h
+
+
+def betai(a, b, x):
+    # regularized incomplete beta function I_x(a, b)
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    lbeta = math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b)
+    bt = math.exp(lbeta + a * math.log(x) + b * math.log(1.0 - x))
+    if x < (a + 1.0) / (a + b + 2.0):
+        return bt * betacf(a, b, x) / a
+    return 1.0 - bt * betacf(b, a, 1.0 - x) / b
+
+
+def welch_t_test(xs, ys):
+    '''Returns the two-sided p-value for mean(xs) != mean(ys).'''
+    vx, vy = variance(xs), variance(ys)
+    nx, ny = len(xs), len(ys)
+    sx, sy = vx / nx, vy / ny
+    if sx + sy == 0.0:
+        return 1.0
+    t = (mean(xs) - mean(ys)) / math.sqrt(sx + sy)
+    df = (sx + sy) ** 2 / (sx ** 2 / (nx - 1) + sy ** 2 / (ny - 1))
+    # two-sided p-value from the t distribution CDF
+    return betai(df / 2.0, 0.5, df / (df + t * t))
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    if data.get('format_version') != 1:
+        sys.exit('%s: unknown format_version %r' % (path, data.get('format_version')))
+    return dict((r['name'], r) for r in data['results'])
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Compare two perf_tests --json-output result files')
+    parser.add_argument('baseline', help='result file from the baseline build')
+    parser.add_argument('candidate', help='result file from the candidate build')
+    parser.add_argument('--threshold', type=float, default=0.05,
+                        help='fail on slowdowns beyond this fraction (default: 0.05)')
+    parser.add_argument('--alpha', type=float, default=0.05,
+                        help='significance level for the t-test (default: 0.05)')
+    args = parser.parse_args()
+
+    base = load(args.baseline)
+    cand = load(args.candidate)
+
+    names = sorted(set(base) & set(cand))
+    for name in sorted(set(base) ^ set(cand)):
+        where = args.candidate if name in base else args.baseline
+        print('# %s: missing from %s, skipped' % (name, where))
+
+    print('%-30s %12s %12s %8s %8s  %s'
+          % ('benchmark', 'base ns/op', 'cand ns/op', 'delta', 'p-value', 'verdict'))
+    regressions = []
+    for name in names:
+        b, c = base[name], cand[name]
+        delta = (c['mean_ns'] - b['mean_ns']) / b['mean_ns']
+        p = welch_t_test(b['batches_ns'], c['batches_ns'])
+        significant = p < args.alpha
+        if significant and delta > args.threshold:
+            verdict = 'REGRESSION'
+            regressions.append(name)
+        elif significant and delta < -args.threshold:
+            verdict = 'improved'
+        else:
+            verdict = '~'
+        print('%-30s %12.2f %12.2f %+7.1f%% %8.4f  %s'
+              % (name, b['mean_ns'], c['mean_ns'], delta * 100, p, verdict))
+        for metric, fmt in [('cycles_per_op', '%.1f'), ('allocs_per_op', '%.2f')]:
+            if b[metric] and abs(c[metric] - b[metric]) / b[metric] > args.threshold:
+                print('    %s: %s -> %s'
+                      % (metric, fmt % b[metric], fmt % c[metric]))
+
+    if regressions:
+        print('\nFAIL: %d benchmark(s) regressed beyond %.0f%%: %s'
+              % (len(regressions), args.threshold * 100, ', '.join(regressions)))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
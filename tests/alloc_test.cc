@@ -52,3 +52,41 @@ SEASTAR_TEST_CASE(test_live_objects_counter_with_cross_cpu_free) {
         BOOST_REQUIRE(memory::stats().live_objects() < std::numeric_limits<size_t>::max() / 2);
     });
 }
+
+SEASTAR_TEST_CASE(test_small_pool_counters_track_allocation) {
+#ifndef DEFAULT_ALLOCATOR
+    constexpr size_t object_size = 1024;
+    auto idx = 0u;
+    for (; idx != memory::nr_small_pools(); ++idx) {
+        if (memory::small_pool_stats(idx).object_size == object_size) {
+            break;
+        }
+    }
+    BOOST_REQUIRE(idx != memory::nr_small_pools());
+    auto before = memory::small_pool_stats(idx);
+    constexpr unsigned nr = 1000;
+    std::vector<void*> objs;
+    objs.reserve(nr);
+    for (unsigned i = 0; i != nr; ++i) {
+        objs.push_back(malloc(object_size));
+    }
+    for (auto obj : objs) {
+        free(obj);
+    }
+    auto after = memory::small_pool_stats(idx);
+    BOOST_REQUIRE(after.allocs - before.allocs >= nr);
+    BOOST_REQUIRE(after.frees - before.frees >= nr);
+#endif
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_fragmentation_statistics_are_sane) {
+#ifndef DEFAULT_ALLOCATOR
+    auto stats = memory::stats();
+    BOOST_REQUIRE(stats.largest_free_span() > 0);
+    BOOST_REQUIRE(stats.largest_free_span() <= stats.free_memory());
+    BOOST_REQUIRE(stats.fragmentation() >= 0.0);
+    BOOST_REQUIRE(stats.fragmentation() < 1.0);
+#endif
+    return make_ready_future<>();
+}
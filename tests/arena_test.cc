@@ -0,0 +1,103 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB Ltd.
+ */
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/arena.hh"
+#include <cstring>
+#include <vector>
+
+BOOST_AUTO_TEST_CASE(arena_basic) {
+    arena a;
+    auto p = static_cast<char*>(a.alloc(16));
+    BOOST_REQUIRE(p != nullptr);
+    std::memset(p, 'x', 16);
+    auto q = static_cast<char*>(a.alloc(16));
+    BOOST_REQUIRE(q != nullptr);
+    BOOST_REQUIRE(q != p);
+    // within the same chunk, allocations are adjacent (modulo alignment)
+    BOOST_REQUIRE_EQUAL(q, p + 16);
+    // earlier data is untouched
+    BOOST_REQUIRE_EQUAL(p[0], 'x');
+    BOOST_REQUIRE_EQUAL(p[15], 'x');
+}
+
+BOOST_AUTO_TEST_CASE(arena_alignment) {
+    arena a;
+    a.alloc(1, 1);
+    auto p = reinterpret_cast<uintptr_t>(a.alloc(8, 64));
+    BOOST_REQUIRE_EQUAL(p % 64, 0);
+    a.alloc(3, 1);
+    auto q = reinterpret_cast<uintptr_t>(a.alloc(8, 16));
+    BOOST_REQUIRE_EQUAL(q % 16, 0);
+}
+
+BOOST_AUTO_TEST_CASE(arena_many_chunks_and_reset) {
+    arena a;
+    // force a good number of chunk transitions
+    for (int pass = 0; pass < 3; ++pass) {
+        for (int i = 0; i < 10000; ++i) {
+            auto p = static_cast<char*>(a.alloc(100));
+            std::memset(p, i & 0xff, 100);
+        }
+        a.reset();
+    }
+    // after reset, the retained chunk is reused from the start
+    auto p = a.alloc(1);
+    a.reset();
+    auto q = a.alloc(1);
+    BOOST_REQUIRE_EQUAL(p, q);
+}
+
+BOOST_AUTO_TEST_CASE(arena_large_allocation) {
+    arena a;
+    // larger than a chunk; must still succeed, in its own chunk
+    auto p = static_cast<char*>(a.alloc(1 << 20));
+    std::memset(p, 'y', 1 << 20);
+    auto q = static_cast<char*>(a.alloc(16));
+    BOOST_REQUIRE(q != nullptr);
+    a.reset();
+}
+
+BOOST_AUTO_TEST_CASE(arena_std_container) {
+    arena a;
+    std::vector<int, arena_allocator<int>> v{arena_allocator<int>(a)};
+    for (int i = 0; i < 100000; ++i) {
+        v.push_back(i);
+    }
+    for (int i = 0; i < 100000; ++i) {
+        BOOST_REQUIRE_EQUAL(v[i], i);
+    }
+    v = std::vector<int, arena_allocator<int>>{arena_allocator<int>(a)};
+    a.reset();
+}
+
+BOOST_AUTO_TEST_CASE(arena_move) {
+    arena a;
+    auto p = a.alloc(16);
+    arena b = std::move(a);
+    // the chunk moved with the arena; further allocations follow p
+    auto q = b.alloc(16);
+    BOOST_REQUIRE_EQUAL(static_cast<char*>(q), static_cast<char*>(p) + 16);
+}
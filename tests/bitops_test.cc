@@ -0,0 +1,100 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/bitops.hh"
+#include <random>
+#include <vector>
+
+static void set_bit(std::vector<uint64_t>& bm, size_t i) {
+    bm[i / 64] |= uint64_t(1) << (i % 64);
+}
+
+BOOST_AUTO_TEST_CASE(test_find_first_set) {
+    std::vector<uint64_t> bm(4); // 256 bits
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 256), 256u);
+    set_bit(bm, 0);
+    set_bit(bm, 63);
+    set_bit(bm, 64);
+    set_bit(bm, 200);
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 256), 0u);
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 256, 1), 63u);
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 256, 64), 64u);
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 256, 65), 200u);
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 256, 201), 256u);
+    // nbits cuts the scan short even if later bits are set
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 200, 65), 200u);
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 256, 300), 256u);
+}
+
+BOOST_AUTO_TEST_CASE(test_find_first_clear) {
+    std::vector<uint64_t> bm(2, ~uint64_t(0)); // 128 bits, all set
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_clear(bm.data(), 128), 128u);
+    bm[0] &= ~(uint64_t(1) << 63);
+    bm[1] &= ~(uint64_t(1) << 10);
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_clear(bm.data(), 128), 63u);
+    BOOST_REQUIRE_EQUAL(bitmap_find_first_clear(bm.data(), 128, 64), 74u);
+}
+
+BOOST_AUTO_TEST_CASE(test_count_set) {
+    std::vector<uint64_t> bm(4);
+    set_bit(bm, 3);
+    set_bit(bm, 64);
+    set_bit(bm, 65);
+    set_bit(bm, 130);
+    BOOST_REQUIRE_EQUAL(bitmap_count_set(bm.data(), 0, 256), 4u);
+    BOOST_REQUIRE_EQUAL(bitmap_count_set(bm.data(), 0, 3), 0u);
+    BOOST_REQUIRE_EQUAL(bitmap_count_set(bm.data(), 3, 4), 1u);
+    BOOST_REQUIRE_EQUAL(bitmap_count_set(bm.data(), 4, 130), 2u);
+    BOOST_REQUIRE_EQUAL(bitmap_count_set(bm.data(), 4, 131), 3u);
+    BOOST_REQUIRE_EQUAL(bitmap_count_set(bm.data(), 64, 64), 0u);
+    BOOST_REQUIRE_EQUAL(bitmap_count_set(bm.data(), 64, 128), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(test_randomized_against_reference) {
+    std::default_random_engine rnd(42);
+    std::vector<uint64_t> bm(3);
+    std::vector<bool> ref(192);
+    std::uniform_int_distribution<size_t> pos(0, 191);
+    for (int i = 0; i < 60; i++) {
+        auto p = pos(rnd);
+        set_bit(bm, p);
+        ref[p] = true;
+    }
+    for (size_t from = 0; from < 192; from++) {
+        size_t expect = 192;
+        for (size_t i = from; i < 192; i++) {
+            if (ref[i]) {
+                expect = i;
+                break;
+            }
+        }
+        BOOST_REQUIRE_EQUAL(bitmap_find_first_set(bm.data(), 192, from), expect);
+        size_t cnt = 0;
+        for (size_t i = from; i < 192; i++) {
+            cnt += ref[i];
+        }
+        BOOST_REQUIRE_EQUAL(bitmap_count_set(bm.data(), from, 192), cnt);
+    }
+}
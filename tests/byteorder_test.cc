@@ -0,0 +1,96 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/byteorder.hh"
+#include <cstring>
+
+BOOST_AUTO_TEST_CASE(test_scalar_roundtrip) {
+    BOOST_REQUIRE_EQUAL(be_to_cpu(cpu_to_be(uint16_t(0x1234))), 0x1234);
+    BOOST_REQUIRE_EQUAL(be_to_cpu(cpu_to_be(uint32_t(0x12345678))), 0x12345678u);
+    BOOST_REQUIRE_EQUAL(le_to_cpu(cpu_to_le(uint64_t(0x123456789abcdef0))),
+            0x123456789abcdef0);
+    char buf[8];
+    write_be<uint32_t>(buf, 0x01020304);
+    BOOST_REQUIRE_EQUAL(buf[0], 1);
+    BOOST_REQUIRE_EQUAL(buf[3], 4);
+    BOOST_REQUIRE_EQUAL(read_be<uint32_t>(buf), 0x01020304u);
+}
+
+BOOST_AUTO_TEST_CASE(test_inplace_field_list) {
+    uint16_t a = 0x1122;
+    uint32_t b = 0x11223344;
+    uint64_t c = 0x1122334455667788;
+    cpu_to_be_inplace(a, b, c);
+    char buf[2];
+    std::memcpy(buf, &a, 2);
+    BOOST_REQUIRE_EQUAL(buf[0], 0x11);
+    BOOST_REQUIRE_EQUAL(buf[1], 0x22);
+    be_to_cpu_inplace(a, b, c);
+    BOOST_REQUIRE_EQUAL(a, 0x1122);
+    BOOST_REQUIRE_EQUAL(b, 0x11223344u);
+    BOOST_REQUIRE_EQUAL(c, 0x1122334455667788);
+}
+
+struct frame {
+    uint32_t magic;
+    uint16_t version;
+    uint64_t len;
+    template <typename Adjuster>
+    void adjust_endianness(Adjuster a) {
+        a(magic, version, len);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(test_struct_adjust_endianness) {
+    frame f;
+    f.magic = 0xcafebabe;
+    f.version = 3;
+    f.len = 0x0102030405060708;
+    auto wire = cpu_to_be(f);
+    auto back = be_to_cpu(wire);
+    BOOST_REQUIRE_EQUAL(back.magic, 0xcafebabeu);
+    BOOST_REQUIRE_EQUAL(back.version, 3);
+    BOOST_REQUIRE_EQUAL(back.len, 0x0102030405060708);
+    char first;
+    std::memcpy(&first, &wire.magic, 1);
+    BOOST_REQUIRE_EQUAL(uint8_t(first), 0xca);
+}
+
+BOOST_AUTO_TEST_CASE(test_array_conversion) {
+    uint32_t v[37];
+    uint32_t expected[37];
+    for (unsigned i = 0; i != 37; i++) {
+        v[i] = expected[i] = 0x01020304 * (i + 1);
+    }
+    cpu_to_be(v, 37);
+    char buf[4];
+    std::memcpy(buf, &v[0], 4);
+    BOOST_REQUIRE_EQUAL(buf[0], 1);
+    BOOST_REQUIRE_EQUAL(buf[3], 4);
+    be_to_cpu(v, 37);
+    for (unsigned i = 0; i != 37; i++) {
+        BOOST_REQUIRE_EQUAL(v[i], expected[i]);
+    }
+}
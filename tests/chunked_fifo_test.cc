@@ -209,6 +209,64 @@ BOOST_AUTO_TEST_CASE(chunked_fifo_construct_fail2) {
     BOOST_REQUIRE_EQUAL(fifo.empty(), true);
 }
 
+BOOST_AUTO_TEST_CASE(chunked_fifo_iterator) {
+    // Iterate a queue spanning several chunks, including a front chunk
+    // whose occupied region wrapped around inside the chunk.
+    chunked_fifo<int, 4> fifo;
+    BOOST_REQUIRE(fifo.begin() == fifo.end());
+    for (int i = 0; i < 10; i++) {
+        fifo.push_back(i);
+    }
+    for (int i = 0; i < 3; i++) {
+        fifo.pop_front();
+        fifo.push_back(10 + i);
+    }
+    int expected = 3;
+    for (auto& x : fifo) {
+        BOOST_REQUIRE_EQUAL(x, expected++);
+    }
+    BOOST_REQUIRE_EQUAL(expected, 13);
+    const auto& cfifo = fifo;
+    BOOST_REQUIRE_EQUAL(std::distance(cfifo.begin(), cfifo.end()),
+            ssize_t(cfifo.size()));
+}
+
+BOOST_AUTO_TEST_CASE(chunked_fifo_bulk_push) {
+    chunked_fifo<int, 4> fifo;
+    std::deque<int> src;
+    for (int i = 0; i < 1000; i++) {
+        src.push_back(i);
+    }
+    fifo.push_back(src.begin(), src.end());
+    BOOST_REQUIRE_EQUAL(fifo.size(), src.size());
+    for (int i = 0; i < 1000; i++) {
+        BOOST_REQUIRE_EQUAL(fifo.front(), i);
+        fifo.pop_front();
+    }
+    BOOST_REQUIRE(fifo.empty());
+}
+
+BOOST_AUTO_TEST_CASE(chunked_fifo_consume) {
+    chunked_fifo<int, 4> fifo;
+    for (int i = 0; i < 1000; i++) {
+        fifo.push_back(i);
+    }
+    int expected = 0;
+    auto n = fifo.consume([&] (int x) {
+        BOOST_REQUIRE_EQUAL(x, expected++);
+    }, 700);
+    BOOST_REQUIRE_EQUAL(n, 700u);
+    BOOST_REQUIRE_EQUAL(fifo.size(), 300u);
+    BOOST_REQUIRE_EQUAL(fifo.front(), 700);
+    // an unlimited consume() drains the rest
+    n = fifo.consume([&] (int x) {
+        BOOST_REQUIRE_EQUAL(x, expected++);
+    });
+    BOOST_REQUIRE_EQUAL(n, 300u);
+    BOOST_REQUIRE(fifo.empty());
+    BOOST_REQUIRE_EQUAL(fifo.consume([] (int) {}), 0u);
+}
+
 // Enable the following to run some benchmarks on different queue options
 #if 0
 // Unfortunately, C++ lacks the trivial feature of converting a type's name,
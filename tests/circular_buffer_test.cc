@@ -0,0 +1,92 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/circular_buffer.hh"
+#include <cstring>
+
+BOOST_AUTO_TEST_CASE(circular_buffer_reserve_back_contiguous) {
+    circular_buffer<char> buf;
+    auto s = buf.reserve_back(5);
+    BOOST_REQUIRE(s.size >= 5);
+    std::memcpy(s.data, "hello", 5);
+    buf.commit_back(5);
+    BOOST_REQUIRE_EQUAL(buf.size(), 5u);
+    for (int i = 0; i < 5; i++) {
+        BOOST_REQUIRE_EQUAL(buf[i], "hello"[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(circular_buffer_reserve_back_wraps) {
+    // Walk begin/end around the ring until a reservation must wrap,
+    // and check that the two spans cover it correctly.
+    circular_buffer<int> buf;
+    buf.reserve(8);
+    auto cap = buf.capacity();
+    for (size_t shift = 0; shift < cap; shift++) {
+        // shift the occupied region by one
+        buf.push_back(-1);
+        buf.pop_front();
+        auto spans = buf.reserve_back_spans(cap);
+        BOOST_REQUIRE_EQUAL(spans.first.size + spans.second.size, cap);
+        int v = 0;
+        for (size_t i = 0; i < spans.first.size; i++) {
+            spans.first.data[i] = v++;
+        }
+        for (size_t i = 0; i < spans.second.size; i++) {
+            spans.second.data[i] = v++;
+        }
+        buf.commit_back(cap);
+        BOOST_REQUIRE_EQUAL(buf.size(), cap);
+        for (size_t i = 0; i < cap; i++) {
+            BOOST_REQUIRE_EQUAL(buf.front(), int(i));
+            buf.pop_front();
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(circular_buffer_partial_commit) {
+    circular_buffer<int> buf;
+    auto s = buf.reserve_back(4);
+    s.data[0] = 17;
+    buf.commit_back(1);
+    BOOST_REQUIRE_EQUAL(buf.size(), 1u);
+    BOOST_REQUIRE_EQUAL(buf.front(), 17);
+}
+
+BOOST_AUTO_TEST_CASE(circular_buffer_reserve_back_grows) {
+    circular_buffer<int> buf;
+    for (int i = 0; i < 3; i++) {
+        buf.push_back(i);
+    }
+    auto old_cap = buf.capacity();
+    auto spans = buf.reserve_back_spans(1000);
+    BOOST_REQUIRE(buf.capacity() >= old_cap);
+    BOOST_REQUIRE(!(buf.capacity() & (buf.capacity() - 1)));
+    BOOST_REQUIRE_EQUAL(spans.first.size + spans.second.size, 1000u);
+    // the existing elements survived the growth
+    for (int i = 0; i < 3; i++) {
+        BOOST_REQUIRE_EQUAL(buf[i], i);
+    }
+}
@@ -120,6 +120,102 @@ future<> test_map_reduce() {
     });
 }
 
+future<> test_local_ref() {
+    return do_with_distributed<X>([] (distributed<X>& x) {
+        return x.start().then([&x] {
+            return x.invoke_on_all([&x] (X&) {
+                auto ref = x.make_local_ref();
+                auto id = int(engine().cpu_id());
+                if (ref->cpu_id_squared() != id * id) {
+                    throw std::runtime_error("local_ref dereference failed");
+                }
+            });
+        });
+    });
+}
+
+future<> test_map_reduce_tree() {
+    return do_with_distributed<X>([] (distributed<X>& x) {
+        return x.start().then([&x] {
+            return x.map_reduce_tree(std::mem_fn(&X::cpu_id_squared),
+                                     0,
+                                     std::plus<int>()).then([] (int result) {
+                int n = smp::count - 1;
+                if (result != (n * (n + 1) * (2*n + 1)) / 6) {
+                    throw std::runtime_error("map_reduce_tree failed");
+                }
+            });
+        });
+    });
+}
+
+future<> test_map_reduce_into() {
+    auto slots = make_shared<std::vector<int>>(smp::count);
+    return do_with_distributed<X>([slots] (distributed<X>& x) {
+        return x.start().then([&x, slots] {
+            return x.map_reduce_into(*slots,
+                                     std::mem_fn(&X::cpu_id_squared),
+                                     0,
+                                     std::plus<int>()).then([] (int result) {
+                int n = smp::count - 1;
+                if (result != (n * (n + 1) * (2*n + 1)) / 6) {
+                    throw std::runtime_error("map_reduce_into failed");
+                }
+            });
+        });
+    }).finally([slots] {});
+}
+
+future<> test_sharding_helpers() {
+    // keys moved by growing the bucket count must all land on the new
+    // bucket, and only about 1/(n+1) of them may move at all
+    for (unsigned buckets = 1; buckets < 16; buckets++) {
+        unsigned moved = 0;
+        for (uint64_t k = 0; k < 1000; k++) {
+            auto h = k * 0x9e3779b97f4a7c15ULL;
+            auto before = jump_consistent_hash(h, buckets);
+            auto after = jump_consistent_hash(h, buckets + 1);
+            if (before >= buckets || after >= buckets + 1) {
+                throw std::runtime_error("jump hash out of range");
+            }
+            if (before != after) {
+                if (after != buckets) {
+                    throw std::runtime_error("moved key not on new bucket");
+                }
+                moved++;
+            }
+        }
+        if (moved > 2 * 1000 / (buckets + 1) + 50) {
+            throw std::runtime_error("jump hash moved too many keys");
+        }
+    }
+
+    range_sharder rs(1000, 7);
+    unsigned last = 0;
+    for (uint64_t token = 0; token < 1000; token++) {
+        auto s = rs.shard_of(token);
+        if (s >= 7 || s < last) {
+            throw std::runtime_error("range sharder not monotonic");
+        }
+        last = s;
+    }
+    for (unsigned s = 0; s < 7; s++) {
+        if (rs.shard_of(rs.first_token_of(s)) != s) {
+            throw std::runtime_error("first_token_of not inverse of shard_of");
+        }
+    }
+
+    host_shard_router router({4, 8, 2});
+    std::vector<unsigned> shards{4, 8, 2};
+    for (uint64_t k = 0; k < 1000; k++) {
+        auto loc = router.route(k * 0x9e3779b97f4a7c15ULL);
+        if (loc.host >= 3 || loc.shard >= shards[loc.host]) {
+            throw std::runtime_error("router location out of range");
+        }
+    }
+    return make_ready_future<>();
+}
+
 future<> test_async() {
     return do_with_distributed<async>([] (distributed<async>& x) {
         return x.start().then([&x] {
@@ -139,6 +235,14 @@ int main(int argc, char** argv) {
             return test_constructor_argument_is_passed_to_each_core();
         }).then([] {
             return test_map_reduce();
+        }).then([] {
+            return test_local_ref();
+        }).then([] {
+            return test_map_reduce_tree();
+        }).then([] {
+            return test_map_reduce_into();
+        }).then([] {
+            return test_sharding_helpers();
         }).then([] {
             return test_async();
         });
@@ -328,3 +328,28 @@ SEASTAR_TEST_CASE(test_fair_queue_random_run) {
        return env->verify(sprint("random_run (%d msec)", reqs / 10), {1, 1}, expected_error);
     }).then([env] {});
 }
+
+// A class with an unattainable latency goal makes the queue withhold capacity,
+// shrinking the effective concurrency.
+SEASTAR_TEST_CASE(test_fair_queue_latency_goal_throttles) {
+    auto env = make_lw_shared<test_env>(10);
+
+    auto a = env->register_priority_class(10);
+    auto b = env->register_priority_class(10);
+    // The 100us operations can never meet a 1us goal, so the queue should
+    // respond by withholding part of its capacity.
+    fair_queue::set_latency_goal(env->classes[a], 1us);
+
+    auto count = make_lw_shared<int>(0);
+    return do_until([count] { return (*count)++ == 100; }, [env, a, b] {
+        env->do_op(a, 1);
+        env->do_op(b, 1);
+        return sleep(1ms);
+    }).then([env] {
+        return env->wait_on_pending();
+    }).then([env, a, b] {
+        BOOST_REQUIRE(env->fq.throttled_capacity() >= 1);
+        env->fq.unregister_priority_class(env->classes[a]);
+        env->fq.unregister_priority_class(env->classes[b]);
+    });
+}
@@ -24,6 +24,7 @@
 #include "core/semaphore.hh"
 #include "core/file.hh"
 #include "core/reactor.hh"
+#include "core/thread.hh"
 
 struct file_test {
     file_test(file&& f) : f(std::move(f)) {}
@@ -68,4 +69,61 @@ SEASTAR_TEST_CASE(test1) {
     });
 }
 
+SEASTAR_TEST_CASE(test_ranged_dma) {
+    return seastar::async([] {
+        auto f = open_file_dma("testfile.tmp",
+                open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        // Two pairs of adjacent ranges (which get merged into single
+        // requests) plus two isolated ones, passed out of order.
+        uint64_t offsets[] = { 4 * 4096, 0, 16 * 4096, 4096, 5 * 4096, 8 * 4096 };
+        auto nranges = sizeof(offsets) / sizeof(offsets[0]);
+        std::vector<std::unique_ptr<unsigned char[], free_deleter>> wbufs;
+        std::vector<dma_range> wranges;
+        for (size_t i = 0; i < nranges; ++i) {
+            auto buf = allocate_aligned_buffer<unsigned char>(4096, 4096);
+            std::fill(buf.get(), buf.get() + 4096, i + 1);
+            wranges.push_back(dma_range{offsets[i], iovec{buf.get(), 4096}});
+            wbufs.push_back(std::move(buf));
+        }
+        BOOST_REQUIRE_EQUAL(f.dma_write(std::move(wranges)).get0(), nranges * 4096);
+        std::vector<std::unique_ptr<unsigned char[], free_deleter>> rbufs;
+        std::vector<dma_range> rranges;
+        for (size_t i = 0; i < nranges; ++i) {
+            auto buf = allocate_aligned_buffer<unsigned char>(4096, 4096);
+            rranges.push_back(dma_range{offsets[i], iovec{buf.get(), 4096}});
+            rbufs.push_back(std::move(buf));
+        }
+        BOOST_REQUIRE_EQUAL(f.dma_read(std::move(rranges)).get0(), nranges * 4096);
+        for (size_t i = 0; i < nranges; ++i) {
+            BOOST_REQUIRE(std::equal(rbufs[i].get(), rbufs[i].get() + 4096, wbufs[i].get()));
+        }
+        f.flush().get();
+        f.close().get();
+    });
+}
 
+SEASTAR_TEST_CASE(test_walk_directory) {
+    return seastar::async([] {
+        touch_directory("walktest.tmp").get();
+        touch_directory("walktest.tmp/sub").get();
+        touch_directory("walktest.tmp/sub/deeper").get();
+        for (auto name : { "walktest.tmp/a", "walktest.tmp/sub/b", "walktest.tmp/sub/deeper/c" }) {
+            open_file_dma(name, open_flags::rw | open_flags::create | open_flags::truncate).get0().close().get();
+        }
+        std::unordered_map<sstring, std::experimental::optional<directory_entry_type>> found;
+        auto sub = walk_directory("walktest.tmp", [&found] (directory_entry de) {
+            found.emplace(de.name, de.type);
+            return make_ready_future<>();
+        });
+        sub.done().get();
+        BOOST_REQUIRE_EQUAL(found.size(), 5u);
+        for (auto name : { "a", "sub/b", "sub/deeper/c" }) {
+            BOOST_REQUIRE(found.count(name));
+            BOOST_REQUIRE(found[name] && *found[name] == directory_entry_type::regular);
+        }
+        for (auto name : { "sub", "sub/deeper" }) {
+            BOOST_REQUIRE(found.count(name));
+            BOOST_REQUIRE(found[name] && *found[name] == directory_entry_type::directory);
+        }
+    });
+}
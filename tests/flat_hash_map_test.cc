@@ -0,0 +1,169 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB Ltd.
+ */
+
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/flat_hash_map.hh"
+#include "core/sstring.hh"
+#include <unordered_map>
+#include <random>
+#include <string>
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_basic) {
+    flat_hash_map<int, int> m;
+    BOOST_REQUIRE(m.empty());
+    BOOST_REQUIRE(!m.find(1));
+    m.insert(1, 10);
+    BOOST_REQUIRE_EQUAL(m.size(), 1u);
+    BOOST_REQUIRE(m.find(1));
+    BOOST_REQUIRE_EQUAL(*m.find(1), 10);
+    // the cached second lookup must agree with the first
+    BOOST_REQUIRE_EQUAL(*m.find(1), 10);
+    m.erase(1);
+    BOOST_REQUIRE(!m.find(1));
+    BOOST_REQUIRE(m.empty());
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_erase_missing) {
+    flat_hash_map<int, int> m;
+    m.insert(5, 50);
+    m.erase(7); // not present; must not disturb other entries
+    BOOST_REQUIRE_EQUAL(*m.find(5), 50);
+    BOOST_REQUIRE_EQUAL(m.size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_growth) {
+    // Push the map through several incremental rehashes and check every
+    // entry stays reachable throughout, including mid-migration.
+    flat_hash_map<int, int> m;
+    constexpr int n = 100000;
+    for (int i = 0; i < n; i++) {
+        m.insert(i, i * 2);
+        if (i % 97 == 0) {
+            // probe entries both below and around the growth frontier
+            BOOST_REQUIRE_EQUAL(*m.find(0), 0);
+            BOOST_REQUIRE_EQUAL(*m.find(i / 2), i / 2 * 2);
+            BOOST_REQUIRE_EQUAL(*m.find(i), i * 2);
+        }
+    }
+    BOOST_REQUIRE_EQUAL(m.size(), size_t(n));
+    for (int i = 0; i < n; i++) {
+        BOOST_REQUIRE(m.find(i));
+        BOOST_REQUIRE_EQUAL(*m.find(i), i * 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_churn) {
+    // Interleave inserts and erases, as a busy connection table would,
+    // and compare against std::unordered_map at every step.
+    flat_hash_map<uint64_t, uint64_t> m;
+    std::unordered_map<uint64_t, uint64_t> ref;
+    std::default_random_engine rng(42);
+    std::uniform_int_distribution<uint64_t> keys(0, 4999);
+    for (int step = 0; step < 200000; step++) {
+        auto k = keys(rng);
+        auto i = ref.find(k);
+        if (i == ref.end()) {
+            m.insert(k, k + 1);
+            ref.emplace(k, k + 1);
+        } else {
+            BOOST_REQUIRE(m.find(k));
+            BOOST_REQUIRE_EQUAL(*m.find(k), i->second);
+            m.erase(k);
+            ref.erase(i);
+            BOOST_REQUIRE(!m.find(k));
+        }
+        if (step % 1000 == 0) {
+            BOOST_REQUIRE_EQUAL(m.size(), ref.size());
+        }
+    }
+    for (auto&& kv : ref) {
+        BOOST_REQUIRE(m.find(kv.first));
+        BOOST_REQUIRE_EQUAL(*m.find(kv.first), kv.second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_nontrivial_value) {
+    flat_hash_map<int, std::string> m;
+    for (int i = 0; i < 1000; i++) {
+        m.insert(i, std::string(100, 'a' + i % 26));
+    }
+    for (int i = 0; i < 1000; i++) {
+        BOOST_REQUIRE_EQUAL(*m.find(i), std::string(100, 'a' + i % 26));
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        m.erase(i);
+    }
+    for (int i = 0; i < 1000; i++) {
+        BOOST_REQUIRE_EQUAL(bool(m.find(i)), bool(i % 2));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_degenerate_hash) {
+    // std::hash<int> is typically the identity; sequential keys must
+    // still spread thanks to the internal mixer, and even a constant
+    // hash must stay correct (if slow).
+    struct constant_hash {
+        size_t operator()(int) const { return 42; }
+    };
+    flat_hash_map<int, int, constant_hash> m;
+    for (int i = 0; i < 500; i++) {
+        m.insert(i, i);
+    }
+    for (int i = 0; i < 500; i++) {
+        BOOST_REQUIRE_EQUAL(*m.find(i), i);
+    }
+    for (int i = 0; i < 500; i += 3) {
+        m.erase(i);
+    }
+    for (int i = 0; i < 500; i++) {
+        BOOST_REQUIRE_EQUAL(bool(m.find(i)), bool(i % 3));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_heterogeneous_string_lookup) {
+    flat_hash_map<sstring, int, string_hash, string_eq> m;
+    m.insert(sstring("alpha"), 1);
+    m.insert(sstring("beta"), 2);
+    // probe with a string_view and a C string; no sstring is built
+    auto v = std::experimental::string_view("alpha");
+    BOOST_REQUIRE(m.find(v));
+    BOOST_REQUIRE_EQUAL(*m.find(v), 1);
+    BOOST_REQUIRE_EQUAL(*m.find("beta"), 2);
+    BOOST_REQUIRE(!m.find("gamma"));
+    m.erase("alpha");
+    BOOST_REQUIRE(!m.find(v));
+    BOOST_REQUIRE_EQUAL(m.size(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(flat_hash_map_power_of_two_capacity) {
+    flat_hash_map<int, int> m;
+    for (int i = 0; i < 10000; i++) {
+        m.insert(i, i);
+        if (!m.rehashing()) {
+            auto n = m.bucket_count();
+            BOOST_REQUIRE(n >= 16 && !(n & (n - 1)));
+        }
+    }
+}
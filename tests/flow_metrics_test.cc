@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+
+#include "net/flow_metrics.hh"
+
+using namespace net;
+
+static flow_id make_flow(unsigned n) {
+    return flow_id{0x0a000001, 0x0a000002, uint16_t(10000 + n), 80};
+}
+
+static const flow_metrics::entry*
+find_flow(const flow_metrics& fm, const flow_id& id) {
+    for (auto& e : fm.entries()) {
+        if (e.id == id) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+BOOST_AUTO_TEST_CASE(test_disabled_tracker_accounts_nothing) {
+    flow_metrics fm;
+    fm.account_tx(make_flow(0), 1000);
+    fm.account_rx(make_flow(0), 1000);
+    BOOST_REQUIRE(fm.entries().empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_counters_accumulate_per_flow) {
+    flow_metrics fm;
+    fm.set_enabled(true);
+    fm.account_tx(make_flow(0), 100);
+    fm.account_tx(make_flow(0), 200);
+    fm.account_rx(make_flow(0), 50);
+    fm.account_retransmit(make_flow(0));
+    auto e = find_flow(fm, make_flow(0));
+    BOOST_REQUIRE(e);
+    BOOST_REQUIRE_EQUAL(e->tx_bytes, 300u);
+    BOOST_REQUIRE_EQUAL(e->tx_packets, 2u);
+    BOOST_REQUIRE_EQUAL(e->rx_bytes, 50u);
+    BOOST_REQUIRE_EQUAL(e->rx_packets, 1u);
+    BOOST_REQUIRE_EQUAL(e->retransmits, 1u);
+    BOOST_REQUIRE_EQUAL(e->error, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_retransmits_of_unknown_flows_are_dropped) {
+    flow_metrics fm;
+    fm.set_enabled(true);
+    fm.account_retransmit(make_flow(7), 3);
+    BOOST_REQUIRE(fm.entries().empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_eviction_keeps_elephants_and_bounds_error) {
+    flow_metrics fm;
+    fm.set_enabled(true);
+    // one elephant, then enough mice to overflow the table
+    auto elephant = make_flow(0);
+    fm.account_tx(elephant, 1u << 20);
+    for (unsigned n = 1; n <= flow_metrics::capacity + 10; ++n) {
+        fm.account_tx(make_flow(n), 10);
+    }
+    BOOST_REQUIRE_EQUAL(fm.entries().size(), size_t(flow_metrics::capacity));
+    // the elephant never fell out of the table
+    auto e = find_flow(fm, elephant);
+    BOOST_REQUIRE(e);
+    BOOST_REQUIRE_EQUAL(e->tx_bytes, uint64_t(1u << 20));
+    // newcomers inherited the evicted totals as their error bound
+    auto last = find_flow(fm, make_flow(flow_metrics::capacity + 10));
+    BOOST_REQUIRE(last);
+    BOOST_REQUIRE_EQUAL(last->tx_bytes, 10u);
+    BOOST_REQUIRE_EQUAL(last->error, 10u);
+}
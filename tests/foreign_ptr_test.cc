@@ -23,6 +23,7 @@
 
 #include "core/distributed.hh"
 #include "core/shared_ptr.hh"
+#include "core/foreign_buffer.hh"
 
 SEASTAR_TEST_CASE(make_foreign_ptr_from_lw_shared_ptr) {
     auto p = make_foreign(make_lw_shared<sstring>("foo"));
@@ -35,3 +36,36 @@ SEASTAR_TEST_CASE(make_foreign_ptr_from_shared_ptr) {
     BOOST_REQUIRE(p->size() == 3);
     return make_ready_future<>();
 }
+
+SEASTAR_TEST_CASE(foreign_buffer_moves_without_copying) {
+    auto buf = temporary_buffer<char>(5);
+    memcpy(buf.get_write(), "hello", 5);
+    auto data = buf.get();
+    auto fbuf = make_foreign_buffer(std::move(buf));
+    // the bytes themselves must not move
+    BOOST_REQUIRE(fbuf.get() == data);
+    BOOST_REQUIRE(memcmp(fbuf.get(), "hello", 5) == 0);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(foreign_buffer_runs_wrapped_deleter_on_origin) {
+    struct marker {
+        lw_shared_ptr<bool> flag;
+        ~marker() {
+            if (flag) {
+                *flag = true;
+            }
+        }
+        marker(lw_shared_ptr<bool> flag) : flag(std::move(flag)) {}
+        marker(marker&&) = default;
+    };
+    auto deleted = make_lw_shared<bool>(false);
+    static char storage[] = "abc";
+    auto buf = temporary_buffer<char>(storage, 3, make_object_deleter(marker(deleted)));
+    auto fbuf = make_foreign_buffer(std::move(buf));
+    BOOST_REQUIRE(!*deleted);
+    // dropped on its origin shard, the wrapped action runs in place
+    fbuf = temporary_buffer<char>();
+    BOOST_REQUIRE(*deleted);
+    return make_ready_future<>();
+}
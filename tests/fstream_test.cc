@@ -192,6 +192,40 @@ SEASTAR_TEST_CASE(test_consume_unaligned_file_large) {
     return test_consume_until_end((1 << 20) + 1);
 }
 
+SEASTAR_TEST_CASE(test_fstream_read_ahead) {
+    return seastar::async([] {
+        auto flen = uint64_t(256 * 1024 + 341);
+        auto rdist = std::uniform_int_distribution<char>();
+        auto reng = std::default_random_engine();
+        auto data = boost::copy_range<std::vector<uint8_t>>(
+                boost::irange<uint64_t>(0, flen)
+                | boost::adaptors::transformed([&] (int x) { return rdist(reng); }));
+        auto f = open_file_dma("file.tmp",
+                open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto out = make_file_output_stream(f);
+        out.write(reinterpret_cast<const char*>(data.data()), data.size()).get();
+        out.flush().get();
+        // Many small buffers, so the read-ahead window has room to ramp up
+        // to its maximum over the course of the scan.
+        auto opt = file_input_stream_options();
+        opt.buffer_size = 4096;
+        opt.read_ahead = 8;
+        auto in = make_file_input_stream(f, 0, flen, opt);
+        std::vector<uint8_t> readback;
+        auto more = true;
+        while (more) {
+            auto rdata = in.read().get0();
+            for (size_t i = 0; i < rdata.size(); ++i) {
+                readback.push_back(rdata.get()[i]);
+            }
+            more = !rdata.empty();
+        }
+        BOOST_REQUIRE_EQUAL(flen, readback.size());
+        BOOST_REQUIRE(std::equal(readback.begin(), readback.end(), data.begin()));
+        f.close().get();
+    });
+}
+
 SEASTAR_TEST_CASE(test_input_stream_esp_around_eof) {
     return seastar::async([] {
         auto flen = uint64_t(5341);
@@ -251,3 +285,35 @@ SEASTAR_TEST_CASE(test_input_stream_esp_around_eof) {
         f.close().get();
     });
 }
+
+SEASTAR_TEST_CASE(test_mmap_input_stream) {
+    return seastar::async([] {
+        auto flen = uint64_t(97830);
+        auto rdist = std::uniform_int_distribution<char>();
+        auto reng = std::default_random_engine();
+        auto data = boost::copy_range<std::vector<uint8_t>>(
+                boost::irange<uint64_t>(0, flen)
+                | boost::adaptors::transformed([&] (int x) { return rdist(reng); }));
+        auto f = open_file_dma("file.tmp",
+                open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto out = make_file_output_stream(f);
+        out.write(reinterpret_cast<const char*>(data.data()), data.size()).get();
+        out.flush().get();
+        f.close().get();
+        // Read back over a mapping, starting at an unaligned offset.
+        auto offset = uint64_t(4097);
+        auto fd = file_desc::open("file.tmp", O_RDONLY);
+        auto in = make_mmap_input_stream(fd, offset, flen - offset);
+        std::vector<uint8_t> readback;
+        auto more = true;
+        while (more) {
+            auto rdata = in.read().get0();
+            for (size_t i = 0; i < rdata.size(); ++i) {
+                readback.push_back(rdata.get()[i]);
+            }
+            more = !rdata.empty();
+        }
+        BOOST_REQUIRE_EQUAL(flen - offset, readback.size());
+        BOOST_REQUIRE(std::equal(readback.begin(), readback.end(), data.begin() + offset));
+    });
+}
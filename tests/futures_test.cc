@@ -403,6 +403,21 @@ SEASTAR_TEST_CASE(test_do_while_failing_in_the_second_step) {
     });
 }
 
+SEASTAR_TEST_CASE(test_do_for_each_batches_ready_iterations) {
+    // ready iterations run inline (no task per element, no recursion),
+    // suspending only on preemption, so a million-element loop must
+    // neither overflow the stack nor allocate a task per element
+    return do_with(size_t(0), [] (size_t& count) {
+        auto n = boost::counting_iterator<size_t>(1000000);
+        return do_for_each(boost::counting_iterator<size_t>(0), n, [&count] (size_t) {
+            ++count;
+            return make_ready_future<>();
+        }).then([&count] {
+            BOOST_REQUIRE_EQUAL(count, 1000000u);
+        });
+    });
+}
+
 SEASTAR_TEST_CASE(test_parallel_for_each_early_failure) {
     return do_with(0, [] (int& counter) {
         return parallel_for_each(boost::irange(0, 11000), [&counter] (int i) {
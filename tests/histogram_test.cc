@@ -0,0 +1,92 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/histogram.hh"
+#include <random>
+
+using namespace seastar;
+
+BOOST_AUTO_TEST_CASE(test_bucket_layout) {
+    // small values are exact
+    for (uint64_t v = 0; v < histogram::sub_buckets; v++) {
+        BOOST_REQUIRE_EQUAL(histogram::bucket_index(v), v);
+        BOOST_REQUIRE_EQUAL(histogram::bucket_upper_bound(v), v);
+    }
+    // upper bounds are the inverse of the index mapping: every value
+    // lands in the bucket whose bound is the first one >= the value
+    uint64_t prev_bound = 0;
+    for (unsigned idx = 1; idx < histogram::n_buckets; idx++) {
+        auto bound = histogram::bucket_upper_bound(idx);
+        BOOST_REQUIRE(bound > prev_bound);
+        BOOST_REQUIRE_EQUAL(histogram::bucket_index(bound), idx);
+        BOOST_REQUIRE_EQUAL(histogram::bucket_index(prev_bound + 1), idx);
+        prev_bound = bound;
+    }
+    BOOST_REQUIRE_EQUAL(histogram::bucket_upper_bound(histogram::n_buckets - 1),
+            std::numeric_limits<uint64_t>::max());
+}
+
+BOOST_AUTO_TEST_CASE(test_relative_error) {
+    // a bucket bound overestimates the values in it by less than
+    // 1/sub_buckets
+    std::default_random_engine rnd(42);
+    std::uniform_int_distribution<uint64_t> dist(histogram::sub_buckets,
+            uint64_t(1) << 62);
+    for (int i = 0; i < 10000; i++) {
+        auto v = dist(rnd);
+        auto bound = histogram::bucket_upper_bound(histogram::bucket_index(v));
+        BOOST_REQUIRE(bound >= v);
+        BOOST_REQUIRE(bound - v < v / histogram::sub_buckets + 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_record) {
+    histogram h;
+    BOOST_REQUIRE_EQUAL(h.count(), 0u);
+    h.record(0);
+    h.record(3);
+    h.record(1000);
+    h.record(1000);
+    BOOST_REQUIRE_EQUAL(h.count(), 4u);
+    BOOST_REQUIRE_EQUAL(h.sum(), 2003u);
+    BOOST_REQUIRE_EQUAL(h.bucket(0), 1u);
+    BOOST_REQUIRE_EQUAL(h.bucket(3), 1u);
+    BOOST_REQUIRE_EQUAL(h.bucket(histogram::bucket_index(1000)), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(test_merge) {
+    histogram a;
+    histogram b;
+    a.record(5);
+    a.record(100);
+    b.record(100);
+    b.record(1 << 20);
+    a += b;
+    BOOST_REQUIRE_EQUAL(a.count(), 4u);
+    BOOST_REQUIRE_EQUAL(a.sum(), 5u + 100 + 100 + (1 << 20));
+    BOOST_REQUIRE_EQUAL(a.bucket(histogram::bucket_index(100)), 2u);
+    BOOST_REQUIRE_EQUAL(a.bucket(histogram::bucket_index(5)), 1u);
+    BOOST_REQUIRE_EQUAL(a.bucket(histogram::bucket_index(1 << 20)), 1u);
+}
@@ -3,6 +3,8 @@
  */
 
 #include "http/httpd.hh"
+#include "http/request_fast_parser.hh"
+#include "http/websocket.hh"
 #include "http/handlers.hh"
 #include "http/matcher.hh"
 #include "http/matchrules.hh"
@@ -96,6 +98,28 @@ SEASTAR_TEST_CASE(test_formatter)
     return make_ready_future<>();
 }
 
+SEASTAR_TEST_CASE(test_json_writer)
+{
+    // strings get escaped, including past the 16-byte vectorized scan
+    BOOST_REQUIRE_EQUAL(json::formatter::to_json(sstring("a\"b\\c\nd")),
+            "\"a\\\"b\\\\c\\nd\"");
+    BOOST_REQUIRE_EQUAL(json::formatter::to_json(sstring("\x01")),
+            "\"\\u0001\"");
+    sstring long_str = "aaaaaaaaaaaaaaaaaaaa\"tail";
+    BOOST_REQUIRE_EQUAL(json::formatter::to_json(long_str),
+            "\"aaaaaaaaaaaaaaaaaaaa\\\"tail\"");
+    // integer fast paths, including the edges
+    BOOST_REQUIRE_EQUAL(json::formatter::to_json(
+            std::numeric_limits<long>::min()), "-9223372036854775808");
+    BOOST_REQUIRE_EQUAL(json::formatter::to_json(
+            std::numeric_limits<unsigned long>::max()),
+            "18446744073709551615");
+    BOOST_REQUIRE_EQUAL(json::formatter::to_json(2.5), "2.5");
+    std::vector<int> v = { 1, 2, 3 };
+    BOOST_REQUIRE_EQUAL(json::formatter::to_json(v), "[1,2,3]");
+    return make_ready_future<>();
+}
+
 SEASTAR_TEST_CASE(test_decode_url) {
     request req;
     req._url = "/a?q=%23%24%23";
@@ -165,3 +189,181 @@ SEASTAR_TEST_CASE(test_transformer) {
     BOOST_REQUIRE_EQUAL(content, "hello-http-xyz-localhost");
     return make_ready_future<>();
 }
+
+SEASTAR_TEST_CASE(test_fast_request_parser) {
+    sstring head = "GET /hello?q=1 HTTP/1.1\r\nHost: localhost\r\nAccept:  text/html \r\n\r\n";
+    request req;
+    auto consumed = internal::parse_http_request_fast(head.begin(), head.size(), req);
+    BOOST_REQUIRE_EQUAL(consumed, head.size());
+    BOOST_REQUIRE_EQUAL(req._method, "GET");
+    BOOST_REQUIRE_EQUAL(req._url, "/hello?q=1");
+    BOOST_REQUIRE_EQUAL(req._version, "1.1");
+    BOOST_REQUIRE_EQUAL(req.get_header("Host"), "localhost");
+    BOOST_REQUIRE_EQUAL(req.get_header("Accept"), "text/html ");
+    // a body after the head is not consumed
+    sstring with_body = head + "payload";
+    request req2;
+    BOOST_REQUIRE_EQUAL(internal::parse_http_request_fast(with_body.begin(), with_body.size(), req2), head.size());
+    // incomplete heads and obs-folded headers fall back to the machine
+    request req3;
+    BOOST_REQUIRE_EQUAL(internal::parse_http_request_fast(head.begin(), head.size() - 1, req3), 0u);
+    sstring folded = "GET / HTTP/1.0\r\nA: b\r\n c\r\n\r\n";
+    BOOST_REQUIRE_EQUAL(internal::parse_http_request_fast(folded.begin(), folded.size(), req3), 0u);
+    return make_ready_future<>();
+}
+
+struct collect_sink_impl : public data_sink_impl {
+    sstring& _out;
+    explicit collect_sink_impl(sstring& out) : _out(out) {}
+    virtual future<> put(net::packet data) override {
+        for (unsigned i = 0; i < data.nr_frags(); i++) {
+            auto f = data.frag(i);
+            _out += sstring(f.base, f.size);
+        }
+        return make_ready_future<>();
+    }
+    virtual future<> close() override {
+        return make_ready_future<>();
+    }
+};
+
+SEASTAR_TEST_CASE(test_chunked_body_writer) {
+    return do_with(sstring(), [] (sstring& out) {
+        return do_with(output_stream<char>(data_sink(std::make_unique<collect_sink_impl>(out)), 4096), [&out] (output_stream<char>& inner) {
+            return do_with(output_stream<char>(data_sink(std::make_unique<http_chunked_data_sink_impl>(inner)), 4096), [&inner] (output_stream<char>& body) {
+                return body.write("hello world").then([&body] {
+                    return body.close();
+                }).then([&inner] {
+                    return inner.flush();
+                });
+            }).then([&out] {
+                BOOST_REQUIRE_EQUAL(out, "b\r\nhello world\r\n");
+            });
+        });
+    });
+}
+
+struct buf_source_impl : public data_source_impl {
+    temporary_buffer<char> _buf;
+    explicit buf_source_impl(const sstring& data)
+            : _buf(data.begin(), data.size()) {}
+    virtual future<temporary_buffer<char>> get() override {
+        return make_ready_future<temporary_buffer<char>>(std::move(_buf));
+    }
+};
+
+SEASTAR_TEST_CASE(test_websocket_frames) {
+    // a masked client text frame carrying "hello"
+    const char mask[4] = { 1, 2, 3, 4 };
+    const char* hello = "hello";
+    std::vector<char> wire = { '\x81', '\x85', 1, 2, 3, 4 };
+    for (int i = 0; i < 5; i++) {
+        wire.push_back(hello[i] ^ mask[i & 3]);
+    }
+    sstring data(wire.data(), wire.size());
+    return do_with(input_stream<char>(data_source(
+            std::make_unique<buf_source_impl>(data))), sstring(),
+            [] (input_stream<char>& in, sstring& out) {
+        return do_with(output_stream<char>(data_sink(
+                std::make_unique<collect_sink_impl>(out)), 4096),
+                [&in, &out] (output_stream<char>& os) {
+            return do_with(websocket::connection(in, os),
+                    [&out] (websocket::connection& ws) {
+                return ws.read().then([&ws] (websocket::message msg) {
+                    BOOST_REQUIRE(msg.op == websocket::opcode::text);
+                    BOOST_REQUIRE(msg.fin);
+                    BOOST_REQUIRE_EQUAL(
+                            sstring(msg.payload.get(), msg.payload.size()),
+                            "hello");
+                    // the payload was unmasked in place, no copy
+                    return ws.send(websocket::message(websocket::opcode::text,
+                            "bye"));
+                }).then([&ws] {
+                    return ws.close();
+                }).then([&ws] {
+                    return ws.do_writes();
+                }).then([&out] {
+                    // unmasked text frame, then the close frame
+                    BOOST_REQUIRE_EQUAL(out,
+                            sstring("\x81\x03" "bye" "\x88\x00", 7));
+                });
+            });
+        });
+    });
+}
+
+class repetitive_handl : public httpd::handler_base {
+public:
+    virtual future<std::unique_ptr<reply> > handle(const sstring& path,
+            std::unique_ptr<request> req, std::unique_ptr<reply> rep) {
+        sstring content;
+        for (int i = 0; i < 100; i++) {
+            content += "all work and no play makes jack a dull boy. ";
+        }
+        rep->set_status(reply::status_type::ok, content).done("txt");
+        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+    }
+};
+
+SEASTAR_TEST_CASE(test_content_compressor) {
+    auto compressor = new content_compressor(new repetitive_handl());
+    auto req = std::make_unique<request>();
+    req->_headers["Accept-Encoding"] = "deflate, gzip;q=0.8";
+    auto f1 = compressor->handle("/big", std::move(req),
+            std::make_unique<reply>()).then([] (std::unique_ptr<reply> rep) {
+        BOOST_REQUIRE_EQUAL(rep->_headers["Content-Encoding"], "gzip");
+        BOOST_REQUIRE_EQUAL(rep->_headers["Vary"], "Accept-Encoding");
+        // repetitive content compresses well
+        BOOST_REQUIRE(rep->_content.size() < 1000);
+    });
+    // an explicit q=0 disables a coding
+    req = std::make_unique<request>();
+    req->_headers["Accept-Encoding"] = "gzip;q=0, deflate;q=0.000";
+    auto f2 = compressor->handle("/big", std::move(req),
+            std::make_unique<reply>()).then([] (std::unique_ptr<reply> rep) {
+        BOOST_REQUIRE(!rep->_headers.count("Content-Encoding"));
+        BOOST_REQUIRE(rep->_content.size() > 4000);
+    });
+    // no Accept-Encoding, no compression
+    req = std::make_unique<request>();
+    auto f3 = compressor->handle("/big", std::move(req),
+            std::make_unique<reply>()).then([] (std::unique_ptr<reply> rep) {
+        BOOST_REQUIRE(!rep->_headers.count("Content-Encoding"));
+    });
+    return when_all(std::move(f1), std::move(f2), std::move(f3))
+            .then([] (std::tuple<future<>, future<>, future<>> fs) {
+        std::get<0>(fs).get();
+        std::get<1>(fs).get();
+        std::get<2>(fs).get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_route_trie) {
+    route_trie trie;
+    match_rule with_param(new handl());
+    with_param.add_str("/api/v1").add_param("id");
+    BOOST_REQUIRE(trie.add(with_param));
+    match_rule literal(new handl());
+    literal.add_str("/api/v1/special");
+    BOOST_REQUIRE(trie.add(literal));
+    match_rule rest(new handl());
+    rest.add_str("/files").add_param("path", true);
+    BOOST_REQUIRE(trie.add(rest));
+
+    parameters params;
+    BOOST_REQUIRE_EQUAL(trie.get("/api/v1/17", params), with_param.get_handler());
+    BOOST_REQUIRE_EQUAL(params["id"], "17");
+    params.clear();
+    // a literal segment wins over a parameter
+    BOOST_REQUIRE_EQUAL(trie.get("/api/v1/special", params), literal.get_handler());
+    BOOST_REQUIRE(!params.exists("id"));
+    BOOST_REQUIRE_EQUAL(trie.get("/files/etc/hosts", params), rest.get_handler());
+    BOOST_REQUIRE_EQUAL(params.path("path"), "/etc/hosts");
+    params.clear();
+    BOOST_REQUIRE_EQUAL(trie.get("/files", params), rest.get_handler());
+    BOOST_REQUIRE_EQUAL(params.path("path"), "");
+    handler_base* miss = nullptr;
+    BOOST_REQUIRE_EQUAL(trie.get("/api/v2/17", params), miss);
+    BOOST_REQUIRE_EQUAL(trie.get("/api", params), miss);
+    return make_ready_future<>();
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "tests/test-utils.hh"
+#include "core/instrumentation.hh"
+#include "core/reactor.hh"
+
+SEASTAR_TEST_CASE(test_registry_toggles_registered_groups) {
+    instrumentation::registry reg;
+    bool flag = false;
+    reg.add("test-group",
+        [&flag] (bool on) { flag = on; },
+        [&flag] { return flag; });
+    BOOST_REQUIRE(reg.set("test-group", true));
+    BOOST_REQUIRE(flag);
+    BOOST_REQUIRE(reg.set("test-group", false));
+    BOOST_REQUIRE(!flag);
+    BOOST_REQUIRE(!reg.set("no-such-group", true));
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_set_all_reaches_every_shard) {
+    static thread_local bool flag = false;
+    return smp::invoke_on_all([] {
+        instrumentation::registry::local().add("test-shard-group",
+            [] (bool on) { flag = on; },
+            [] { return flag; });
+    }).then([] {
+        return instrumentation::registry::set_all("test-shard-group", true);
+    }).then([] (bool found) {
+        BOOST_REQUIRE(found);
+        return smp::invoke_on_all([] {
+            BOOST_REQUIRE(flag);
+        });
+    }).then([] {
+        return instrumentation::registry::set_all("missing-group", true);
+    }).then([] (bool found) {
+        BOOST_REQUIRE(!found);
+    });
+}
+
+SEASTAR_TEST_CASE(test_built_in_groups_are_registered) {
+    // reactor::configure() registered these on every shard
+    auto& reg = instrumentation::registry::local();
+    BOOST_REQUIRE(reg.list().find("net-flow-metrics") != sstring::npos);
+    BOOST_REQUIRE(reg.list().find("cpu-profiler") != sstring::npos);
+    return make_ready_future<>();
+}
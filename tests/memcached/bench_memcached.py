@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+#
+# This file is open source software, licensed to you under the terms
+# of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+# distributed with this work for additional information regarding copyright
+# ownership.  You may not use this file except in compliance with the License.
+#
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+# Copyright (C) 2016 ScyllaDB
+#
+# Workload generator for the memcached server. Unlike test_memcached.py,
+# which checks protocol correctness, this drives a configurable load shape
+# against a running server and reports latency percentiles:
+#
+#  - key popularity is zipfian (--zipf-skew; 0 means uniform), so a small
+#    set of keys soaks up most of the traffic, like production caches;
+#  - value sizes come from a distribution (fixed:N, uniform:MIN:MAX or
+#    zipf:MIN:MAX:SKEW);
+#  - the get/set mix is set by --get-ratio;
+#  - with --rate the generator is open-loop: requests are due on a fixed
+#    schedule regardless of responses, and a request's latency is counted
+#    from the moment it was *due*, so server slowdowns show up as queueing
+#    delay instead of silently throttling the offered load. Without
+#    --rate each connection runs closed-loop, as fast as replies arrive.
+#
+# Example:
+#   tests/memcached/bench_memcached.py --duration 30 --connections 16 \
+#       --rate 50000 --get-ratio 0.9 --key-count 100000 --zipf-skew 0.99
+#
+import argparse
+import bisect
+import random
+import socket
+import sys
+import threading
+import time
+
+
+def build_zipf_cdf(n, skew):
+    weights = [1.0 / ((i + 1) ** skew) for i in range(n)]
+    total = sum(weights)
+    cdf = []
+    acc = 0.0
+    for w in weights:
+        acc += w
+        cdf.append(acc / total)
+    return cdf
+
+
+class key_sampler(object):
+    def __init__(self, key_count, skew, rnd):
+        self.key_count = key_count
+        self.rnd = rnd
+        self.cdf = build_zipf_cdf(key_count, skew) if skew > 0.0 else None
+
+    def sample(self):
+        if self.cdf is None:
+            return self.rnd.randrange(self.key_count)
+        return bisect.bisect_left(self.cdf, self.rnd.random())
+
+
+class value_size_sampler(object):
+    def __init__(self, spec, rnd):
+        parts = spec.split(':')
+        self.rnd = rnd
+        if parts[0] == 'fixed':
+            self.min_size = self.max_size = int(parts[1])
+            self.cdf = None
+        elif parts[0] == 'uniform':
+            self.min_size, self.max_size = int(parts[1]), int(parts[2])
+            self.cdf = None
+        elif parts[0] == 'zipf':
+            # zipfian over the size range: small values common, big ones rare
+            self.min_size, self.max_size = int(parts[1]), int(parts[2])
+            self.cdf = build_zipf_cdf(self.max_size - self.min_size + 1, float(parts[3]))
+        else:
+            raise ValueError('bad value size spec: ' + spec)
+
+    def sample(self):
+        if self.cdf is not None:
+            return self.min_size + bisect.bisect_left(self.cdf, self.rnd.random())
+        return self.rnd.randint(self.min_size, self.max_size)
+
+
+class worker(threading.Thread):
+    def __init__(self, args, worker_id, start_time):
+        super(worker, self).__init__()
+        self.args = args
+        self.worker_id = worker_id
+        self.start_time = start_time
+        self.rnd = random.Random(args.seed + worker_id)
+        self.keys = key_sampler(args.key_count, args.zipf_skew, self.rnd)
+        self.sizes = value_size_sampler(args.value_size, self.rnd)
+        self.latencies = []
+        self.errors = 0
+        self.payload = b'x' * 1024 * 1024
+
+    def key(self, index):
+        return 'bench-%0*d' % (self.args.key_size - len('bench-'), index)
+
+    def one_op(self, call):
+        key = self.key(self.keys.sample())
+        if self.rnd.random() < self.args.get_ratio:
+            resp = call(('get %s\r\n' % key).encode(), expect_value=True)
+            ok = resp.endswith(b'END\r\n')
+        else:
+            value = self.payload[:self.sizes.sample()]
+            req = ('set %s 0 0 %d\r\n' % (key, len(value))).encode() + value + b'\r\n'
+            resp = call(req)
+            ok = resp == b'STORED\r\n'
+        if not ok:
+            self.errors += 1
+
+    def run(self):
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        s.settimeout(5)
+        s.connect(self.args.server_addr)
+
+        def call(req, expect_value=False):
+            s.sendall(req)
+            resp = b''
+            while True:
+                resp += s.recv(64 * 1024)
+                if not expect_value or resp.endswith(b'END\r\n'):
+                    if resp.endswith(b'\r\n'):
+                        break
+            return resp
+
+        end_time = self.start_time + self.args.duration
+        if self.args.rate:
+            # open-loop: this connection owns every rate/connections-th
+            # slot of the global schedule; latency counts from the slot
+            interval = float(self.args.connections) / self.args.rate
+            due = self.start_time + self.worker_id * (interval / self.args.connections)
+            while due < end_time:
+                now = time.time()
+                if now < due:
+                    time.sleep(due - now)
+                self.one_op(call)
+                self.latencies.append(time.time() - due)
+                due += interval
+        else:
+            while time.time() < end_time:
+                begin = time.time()
+                self.one_op(call)
+                self.latencies.append(time.time() - begin)
+        s.close()
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(p * len(sorted_values)))
+    return sorted_values[index]
+
+
+def preload(args):
+    rnd = random.Random(args.seed)
+    sizes = value_size_sampler(args.value_size, rnd)
+    payload = b'x' * 1024 * 1024
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    s.settimeout(5)
+    s.connect(args.server_addr)
+    for i in range(args.key_count):
+        key = 'bench-%0*d' % (args.key_size - len('bench-'), i)
+        value = payload[:sizes.sample()]
+        s.sendall(('set %s 0 0 %d\r\n' % (key, len(value))).encode() + value + b'\r\n')
+        if s.recv(1024) != b'STORED\r\n':
+            raise Exception('preload failed for key ' + key)
+    s.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='memcached workload generator')
+    parser.add_argument('--server', default='127.0.0.1:11211', help='server address (ip:port)')
+    parser.add_argument('--duration', type=float, default=10.0, help='measurement duration in seconds')
+    parser.add_argument('--connections', type=int, default=8, help='number of concurrent connections')
+    parser.add_argument('--rate', type=int, default=0,
+        help='total offered ops/sec, open-loop; 0 runs closed-loop')
+    parser.add_argument('--get-ratio', type=float, default=0.9, help='fraction of operations that are gets')
+    parser.add_argument('--key-count', type=int, default=100000, help='size of the key space')
+    parser.add_argument('--key-size', type=int, default=20, help='key length in bytes')
+    parser.add_argument('--zipf-skew', type=float, default=0.99,
+        help='zipfian key popularity skew; 0 for uniform')
+    parser.add_argument('--value-size', default='fixed:100',
+        help='value size distribution: fixed:N, uniform:MIN:MAX or zipf:MIN:MAX:SKEW')
+    parser.add_argument('--seed', type=int, default=42, help='random seed')
+    parser.add_argument('--no-preload', action='store_true', help='skip preloading the key space')
+    args = parser.parse_args()
+
+    host, port = args.server.split(':')
+    args.server_addr = (host, int(port))
+
+    if not args.no_preload:
+        print('Preloading %d keys...' % args.key_count)
+        preload(args)
+
+    start_time = time.time() + 0.5
+    workers = [worker(args, i, start_time) for i in range(args.connections)]
+    for w in workers:
+        w.start()
+    for w in workers:
+        w.join()
+
+    latencies = sorted(l for w in workers for l in w.latencies)
+    errors = sum(w.errors for w in workers)
+    if not latencies:
+        print('no operations completed')
+        sys.exit(1)
+
+    duration = args.duration
+    print('operations:  %d (%d errors)' % (len(latencies), errors))
+    print('throughput:  %.0f ops/sec' % (len(latencies) / duration))
+    print('latency (msec):')
+    print('  mean:      %.3f' % (sum(latencies) / len(latencies) * 1000))
+    for p in (0.5, 0.9, 0.95, 0.99, 0.999):
+        print('  p%-8s %.3f' % (('%g:' % (p * 100)), percentile(latencies, p) * 1000))
+    print('  max:       %.3f' % (latencies[-1] * 1000))
+    if errors:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
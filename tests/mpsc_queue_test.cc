@@ -0,0 +1,105 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "core/app-template.hh"
+#include "core/mpsc_queue.hh"
+#include "core/future-util.hh"
+#include "core/print.hh"
+
+static constexpr unsigned items_per_shard = 10000;
+
+// Every shard pushes its items into one queue owned by shard 0, which
+// drains concurrently; checks nothing is lost or duplicated.
+future<> test_all_shards_to_one() {
+    auto q = make_lw_shared<mpsc_queue<uint64_t>>(1024, &engine());
+    auto seen = make_lw_shared<std::vector<unsigned>>(smp::count * items_per_shard);
+    auto producers = smp::invoke_on_all([q = &*q] {
+        auto base = uint64_t(engine().cpu_id()) * items_per_shard;
+        auto range = boost::irange<unsigned>(0, items_per_shard);
+        return do_for_each(range.begin(), range.end(), [q, base] (unsigned i) {
+            return repeat([q, v = base + i] {
+                if (q->push(v)) {
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                // full; let the consumer run and retry
+                return later().then([] { return stop_iteration::no; });
+            });
+        });
+    });
+    auto consumer = repeat([q = &*q, seen = &*seen, consumed = make_lw_shared<size_t>(0)] {
+        *consumed += q->consume([seen] (uint64_t&& v) {
+            (*seen)[v]++;
+        });
+        if (*consumed == seen->size()) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        return later().then([] { return stop_iteration::no; });
+    });
+    return when_all(std::move(producers), std::move(consumer)).then(
+            [q, seen] (std::tuple<future<>, future<>> joined) {
+        std::get<0>(joined).get();
+        std::get<1>(joined).get();
+        for (auto count : *seen) {
+            if (count != 1) {
+                throw std::runtime_error("lost or duplicated item");
+            }
+        }
+        if (!q->empty()) {
+            throw std::runtime_error("queue not drained");
+        }
+        print("PASS: all shards to one\n");
+    });
+}
+
+future<> test_full_queue_rejects() {
+    auto q = make_lw_shared<mpsc_queue<int>>(4);
+    while (q->push(7)) {
+    }
+    if (q->capacity() != 4) {
+        throw std::runtime_error("bad capacity");
+    }
+    auto n = q->consume([] (int&& v) {
+        if (v != 7) {
+            throw std::runtime_error("bad item");
+        }
+    });
+    if (n != 4 || !q->empty() || !q->push(8)) {
+        throw std::runtime_error("full/drain cycle failed");
+    }
+    print("PASS: full queue rejects\n");
+    return make_ready_future<>().finally([q] {});
+}
+
+int main(int ac, char** av) {
+    return app_template().run_deprecated(ac, av, [] {
+        return test_full_queue_rejects().then([] {
+            return test_all_shards_to_one();
+        }).then_wrapped([] (future<> f) {
+            try {
+                f.get();
+                engine().exit(0);
+            } catch (std::exception& e) {
+                print("FAIL: %s\n", e.what());
+                engine().exit(1);
+            }
+        });
+    });
+}
@@ -0,0 +1,214 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Load generator half of the network benchmark pair; run it against
+// tests/netperf_server.cc.  Every connection keeps --depth messages of
+// --msg-size bytes pipelined against the echo server for --duration
+// seconds; --test selects defaults that put the pair in the small
+// message rate regime (rate: 64 byte messages, depth 16) or the bulk
+// bandwidth regime (bulk: 128k messages, depth 4), and any explicitly
+// given option overrides its preset.  The result is a single
+// machine-readable key=value line, so runs over the kernel stack and
+// over the native stack (--network-stack native on both halves) diff
+// directly.
+
+#include "core/app-template.hh"
+#include "core/future-util.hh"
+#include "core/distributed.hh"
+#include <chrono>
+#include <iostream>
+
+using namespace seastar;
+
+static std::string test_name = "rate";
+static unsigned msg_size = 64;
+static unsigned depth = 16;
+static unsigned duration_secs = 10;
+static std::string str_txbuf;
+
+class client;
+distributed<client> clients;
+
+class client {
+private:
+    unsigned _concurrent_connections;
+    ipv4_addr _server_addr;
+    lowres_clock::time_point _earliest_started;
+    lowres_clock::time_point _latest_finished;
+    uint64_t _total_messages = 0;
+    unsigned _num_reported = 0;
+public:
+    class connection {
+        connected_socket _fd;
+        input_stream<char> _read_buf;
+        output_stream<char> _write_buf;
+        uint64_t _messages = 0;
+        unsigned _outstanding = 0;
+    public:
+        connection(connected_socket&& fd)
+            : _fd(std::move(fd))
+            , _read_buf(_fd.input())
+            , _write_buf(_fd.output()) {}
+
+        // keep the pipeline full until the deadline, then drain it
+        future<uint64_t> run(lowres_clock::time_point deadline) {
+            return send_burst(depth).then([this, deadline] {
+                return repeat([this, deadline] {
+                    if (_outstanding == 0) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    return _read_buf.read_exactly(msg_size).then([this, deadline] (temporary_buffer<char> buf) {
+                        if (buf.size() != msg_size) {
+                            _outstanding = 0;
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        ++_messages;
+                        --_outstanding;
+                        if (lowres_clock::now() < deadline) {
+                            return send_burst(1).then([] {
+                                return stop_iteration::no;
+                            });
+                        }
+                        return make_ready_future<stop_iteration>(
+                                _outstanding ? stop_iteration::no : stop_iteration::yes);
+                    });
+                });
+            }).then([this] {
+                return _write_buf.close();
+            }).then([this] {
+                return make_ready_future<uint64_t>(_messages);
+            });
+        }
+
+        future<> send_burst(unsigned n) {
+            _outstanding += n;
+            return do_with(unsigned(n), [this] (unsigned& left) {
+                return repeat([this, &left] {
+                    if (left == 0) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    --left;
+                    return _write_buf.write(str_txbuf).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            }).then([this] {
+                return _write_buf.flush();
+            });
+        }
+    };
+
+    void report(lowres_clock::time_point started, lowres_clock::time_point finished, uint64_t messages) {
+        if (_earliest_started > started)
+            _earliest_started = started;
+        if (_latest_finished < finished)
+            _latest_finished = finished;
+        _total_messages += messages;
+        if (++_num_reported == _concurrent_connections) {
+            auto elapsed = _latest_finished - _earliest_started;
+            auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+            auto secs = static_cast<double>(usecs) / static_cast<double>(1000 * 1000);
+            // one key=value line so comparison scripts can diff runs
+            fprint(std::cout, "test=%s connections=%u msg_size=%u depth=%u duration_secs=%f"
+                    " messages=%d messages_per_sec=%f bandwidth_gbps=%f\n",
+                    test_name, _concurrent_connections, msg_size, depth, secs,
+                    _total_messages,
+                    static_cast<double>(_total_messages) / secs,
+                    static_cast<double>(_total_messages) * msg_size * 8 / (1000 * 1000 * 1000) / secs);
+            clients.stop().then([] {
+                engine().exit(0);
+            });
+        }
+    }
+
+    future<> start(ipv4_addr server_addr, unsigned ncon) {
+        _server_addr = server_addr;
+        _concurrent_connections = ncon * smp::count;
+        _earliest_started = lowres_clock::time_point::max();
+        auto deadline = lowres_clock::now() + std::chrono::seconds(duration_secs);
+
+        for (unsigned i = 0; i < ncon; i++) {
+            socket_address local = socket_address(::sockaddr_in{AF_INET, INADDR_ANY, {0}});
+            engine().net().connect(make_ipv4_address(server_addr), local).then([this, deadline] (connected_socket fd) {
+                auto conn = new connection(std::move(fd));
+                auto started = lowres_clock::now();
+                conn->run(deadline).then_wrapped([conn, started] (auto&& f) {
+                    delete conn;
+                    try {
+                        auto messages = f.get0();
+                        auto finished = lowres_clock::now();
+                        clients.invoke_on(0, &client::report, started, finished, messages);
+                    } catch (std::exception& ex) {
+                        fprint(std::cerr, "connection error: %s\n", ex.what());
+                    }
+                });
+            });
+        }
+        return make_ready_future();
+    }
+    future<> stop() {
+        return make_ready_future();
+    }
+};
+
+namespace bpo = boost::program_options;
+
+int main(int ac, char** av) {
+    app_template app;
+    app.add_options()
+        ("server", bpo::value<std::string>(), "server address")
+        ("test", bpo::value<std::string>()->default_value("rate"), "test preset (rate | bulk)")
+        ("msg-size", bpo::value<unsigned>(), "message size in bytes (preset: rate 64, bulk 131072)")
+        ("depth", bpo::value<unsigned>(), "pipelined messages per connection (preset: rate 16, bulk 4)")
+        ("conn", bpo::value<unsigned>()->default_value(16), "nr connections per cpu")
+        ("duration", bpo::value<unsigned>()->default_value(10), "test duration in seconds")
+        ;
+
+    return app.run_deprecated(ac, av, [&app] {
+        auto&& config = app.configuration();
+        auto server = config["server"].as<std::string>();
+        auto ncon = config["conn"].as<unsigned>();
+        test_name = config["test"].as<std::string>();
+        duration_secs = config["duration"].as<unsigned>();
+
+        if (test_name == "rate") {
+            msg_size = 64;
+            depth = 16;
+        } else if (test_name == "bulk") {
+            msg_size = 128 * 1024;
+            depth = 4;
+        } else {
+            fprint(std::cerr, "Error: --test=rate|bulk\n");
+            return engine().exit(1);
+        }
+        if (config.count("msg-size")) {
+            msg_size = config["msg-size"].as<unsigned>();
+        }
+        if (config.count("depth")) {
+            depth = config["depth"].as<unsigned>();
+        }
+        str_txbuf = std::string(msg_size, 'X');
+
+        clients.start().then([server, ncon] () {
+            clients.invoke_on_all(&client::start, ipv4_addr{server}, ncon);
+        });
+    });
+}
@@ -0,0 +1,124 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Server half of the network benchmark pair; the load generator and
+// the measurements live in tests/netperf_client.cc.  The server is a
+// plain echo: whatever arrives on a connection is written back and
+// flushed, so the same binary serves the message-rate and the bulk
+// bandwidth tests and the client alone decides message size and
+// pipeline depth.  Both halves run over the kernel stack by default
+// and over the native stack with --network-stack native, giving
+// comparable numbers for the dpdk and kernel paths.
+
+#include "core/reactor.hh"
+#include "core/app-template.hh"
+#include "core/future-util.hh"
+#include "core/distributed.hh"
+#include <vector>
+#include <iostream>
+
+using namespace seastar;
+
+class netperf_server {
+    std::vector<server_socket> _listeners;
+public:
+    future<> listen(ipv4_addr addr) {
+        listen_options lo;
+        lo.reuse_address = true;
+        _listeners.push_back(engine().listen(make_ipv4_address(addr), lo));
+        do_accepts();
+        return make_ready_future<>();
+    }
+
+    // FIXME: We should properly tear down the service here.
+    future<> stop() {
+        return make_ready_future<>();
+    }
+
+    void do_accepts() {
+        _listeners.back().accept().then([this] (connected_socket fd, socket_address addr) mutable {
+            auto conn = new connection(std::move(fd));
+            conn->process().then_wrapped([conn] (auto&& f) {
+                delete conn;
+                try {
+                    f.get();
+                } catch (std::exception& ex) {
+                    std::cout << "connection error " << ex.what() << "\n";
+                }
+            });
+            do_accepts();
+        }).then_wrapped([] (auto&& f) {
+            try {
+                f.get();
+            } catch (std::exception& ex) {
+                std::cout << "accept failed: " << ex.what() << "\n";
+            }
+        });
+    }
+
+    class connection {
+        connected_socket _fd;
+        input_stream<char> _read_buf;
+        output_stream<char> _write_buf;
+    public:
+        connection(connected_socket&& fd)
+            : _fd(std::move(fd))
+            , _read_buf(_fd.input())
+            , _write_buf(_fd.output()) {}
+        future<> process() {
+            return repeat([this] {
+                return _read_buf.read().then([this] (temporary_buffer<char> buf) {
+                    if (buf.size() == 0) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    return _write_buf.write(std::move(buf)).then([this] {
+                        return _write_buf.flush();
+                    }).then([] {
+                        return stop_iteration::no;
+                    });
+                });
+            }).then([this] {
+                return _write_buf.close();
+            });
+        }
+    };
+};
+
+namespace bpo = boost::program_options;
+
+int main(int ac, char** av) {
+    app_template app;
+    app.add_options()
+        ("port", bpo::value<uint16_t>()->default_value(10001), "server port") ;
+    return app.run_deprecated(ac, av, [&] {
+        auto&& config = app.configuration();
+        uint16_t port = config["port"].as<uint16_t>();
+        auto server = new distributed<netperf_server>;
+        server->start().then([server, port] () mutable {
+            engine().at_exit([server] {
+                return server->stop();
+            });
+            server->invoke_on_all(&netperf_server::listen, ipv4_addr{port});
+        }).then([port] {
+            std::cout << "netperf server listening on port " << port << " ...\n";
+        });
+    });
+}
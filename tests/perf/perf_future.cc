@@ -0,0 +1,69 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Baseline benchmarks for the future/promise machinery and the
+// allocator fast path; their figures bound what any continuation-based
+// code can achieve, and regressions here show up everywhere.
+
+#include "perf_tests.hh"
+#include "../../core/future-util.hh"
+
+PERF_TEST(future, ready_then) {
+    return make_ready_future<>().then([] {});
+}
+
+PERF_TEST(future, promise_and_future) {
+    promise<> p;
+    auto f = p.get_future();
+    p.set_value();
+    return f;
+}
+
+// unlike ready_then, the continuation is attached while the future is
+// still unready, so it is stored and later scheduled as a task
+PERF_TEST(future, then_unready) {
+    promise<> p;
+    auto f = p.get_future().then([] {});
+    p.set_value();
+    return f;
+}
+
+PERF_TEST(future, then_chain_4) {
+    return make_ready_future<>()
+        .then([] {})
+        .then([] {})
+        .then([] {})
+        .then([] {});
+}
+
+PERF_TEST(memory, alloc_free_64) {
+    auto p = malloc(64);
+    perf_tests::do_not_optimize(p);
+    free(p);
+    return make_ready_future<>();
+}
+
+PERF_TEST(memory, alloc_free_4k) {
+    auto p = malloc(4096);
+    perf_tests::do_not_optimize(p);
+    free(p);
+    return make_ready_future<>();
+}
@@ -0,0 +1,121 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Allocator performance scenarios beyond the fast-path baselines in
+// perf_future.cc: a sweep over the small size classes, cross-shard free
+// ping-pong, and operations against a deliberately aged heap.  The
+// aging fixture stands in for hours of mixed-size steady state: it
+// churns random-size objects through a fixed working set, leaving the
+// free lists and spans as scrambled as a long-running server's, and the
+// aged benchmarks then price allocation against that landscape.  For
+// comparisons against the system malloc, run the debug-mode build of
+// the same binary, which is compiled with -DDEFAULT_ALLOCATOR.
+
+#include "perf_tests.hh"
+#include "../../core/reactor.hh"
+#include "../../core/memory.hh"
+#include <random>
+#include <vector>
+
+PERF_TEST(memory, small_class_sweep) {
+    // one allocation in every power-of-two class the small pools serve
+    for (size_t size = 8; size <= 16384; size *= 2) {
+        auto p = malloc(size);
+        perf_tests::do_not_optimize(p);
+        free(p);
+    }
+    return make_ready_future<>();
+}
+
+// allocate here, free on another shard; prices the sender-side
+// batching in free_cross_cpu() and the wakeup of the owner's drain
+PERF_TEST(memory, cross_shard_free_ping_pong) {
+    constexpr unsigned batch = 64;
+    auto target = smp::count > 1 ? 1u : 0u;
+    auto objs = std::vector<void*>();
+    objs.reserve(batch);
+    for (unsigned i = 0; i != batch; ++i) {
+        objs.push_back(malloc(128));
+    }
+    return smp::submit_to(target, [objs = std::move(objs)] {
+        for (auto p : objs) {
+            free(p);
+        }
+    });
+}
+
+namespace {
+
+// a fixed working set churned with mixed sizes; ~30MB so it fits any
+// test configuration while spanning many spans per size class
+class aged_heap {
+    static constexpr size_t nr_objects = 10000;
+    std::vector<std::pair<void*, size_t>> _objs;
+    std::default_random_engine _eng{42};
+    size_t pick_size() {
+        static constexpr size_t sizes[] = {32, 200, 1024, 3000, 16384};
+        return sizes[_eng() % 5];
+    }
+public:
+    aged_heap() {
+        _objs.resize(nr_objects);
+        for (auto& o : _objs) {
+            o.second = pick_size();
+            o.first = malloc(o.second);
+        }
+        // several full turnovers leave little of the initial layout
+        for (unsigned i = 0; i != 4 * nr_objects; ++i) {
+            churn_one();
+        }
+    }
+    void churn_one() {
+        auto& o = _objs[_eng() % nr_objects];
+        free(o.first);
+        o.second = pick_size();
+        o.first = malloc(o.second);
+    }
+    static aged_heap& local() {
+        static thread_local aged_heap heap;
+        return heap;
+    }
+};
+
+}
+
+PERF_TEST(memory, aged_mixed_churn) {
+    auto& heap = aged_heap::local();
+    for (unsigned i = 0; i != 16; ++i) {
+        heap.churn_one();
+    }
+    return make_ready_future<>();
+}
+
+// large allocations walk the free span lists and may merge spans, so
+// their latency depends on how aged the heap is; this is also the path
+// --large-allocation-threshold instruments and the closest stand-in we
+// have for reclaim latency without actually exhausting memory
+PERF_TEST(memory, large_alloc_in_aged_heap) {
+    aged_heap::local();
+    auto p = malloc(2 * 1024 * 1024);
+    perf_tests::do_not_optimize(p);
+    free(p);
+    return make_ready_future<>();
+}
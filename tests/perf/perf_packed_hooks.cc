@@ -0,0 +1,158 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Measures the cache cost of intrusive hook placement, motivating
+// core/packed_hooks.hh.  Two versions of a memcached-like item are
+// linked into three indexes (hash chain, expiration bucket, LRU):
+// "scattered" declares the three hooks as members interleaved with
+// the payload, as grown code tends to; "packed" co-locates them in a
+// packed_hooks<> base.  Both objects have identical size.  We then
+// time the operations that touch only intrusive state: walking the
+// LRU list, and evicting (unlink from all three indexes).
+//
+// The walk chases one hook per item so the layouts score alike there;
+// eviction dereferences every hook's neighbors, so the scattered
+// layout touches ~3x the cache lines and times accordingly.
+
+#include "../../core/packed_hooks.hh"
+#include <boost/intrusive/list.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace bi = boost::intrusive;
+
+static constexpr size_t nr_items = 300000;
+static constexpr size_t pad_words = 14; // ~1/3 of a 3-line object each
+
+using auto_list_hook = bi::list_member_hook<bi::link_mode<bi::auto_unlink>>;
+
+struct scattered_item {
+    auto_list_hook hash_link;
+    uint64_t pad1[pad_words];
+    auto_list_hook timer_link;
+    uint64_t pad2[pad_words];
+    auto_list_hook lru_link;
+    uint64_t pad3[pad_words];
+};
+
+struct hash_tag {};
+struct timer_tag {};
+struct lru_tag {};
+
+struct packed_item : public packed_hooks<packed_list_hook<hash_tag>,
+                                         packed_list_hook<timer_tag>,
+                                         packed_list_hook<lru_tag>> {
+    uint64_t pad[3 * pad_words];
+};
+
+template <typename Item, typename HashList, typename TimerList, typename LruList,
+          typename Link, typename Unlink>
+void run(const char* name, Link link, Unlink unlink) {
+    // allocate in one block, but link in shuffled order so list
+    // neighbors are not memory neighbors, as in a real cache
+    auto items = std::vector<Item>(nr_items);
+    auto order = std::vector<size_t>(nr_items);
+    for (size_t i = 0; i < nr_items; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::default_random_engine(42));
+
+    HashList hash_chain;
+    TimerList timer_bucket;
+    LruList lru;
+    for (auto i : order) {
+        link(items[i], hash_chain, timer_bucket, lru);
+    }
+
+    using clock = std::chrono::high_resolution_clock;
+    auto t0 = clock::now();
+    size_t walked = 0;
+    for (int pass = 0; pass < 10; pass++) {
+        for (auto& it : lru) {
+            (void)it;
+            walked++;
+        }
+    }
+    auto t1 = clock::now();
+    // evict in yet another order (as hash-driven deletes would), so the
+    // three unlinks of an item touch unrelated neighbors in each index
+    std::shuffle(order.begin(), order.end(), std::default_random_engine(7));
+    size_t evicted = 0;
+    for (auto i : order) {
+        unlink(items[i]);
+        evicted++;
+    }
+    auto t2 = clock::now();
+
+    auto ns = [] (std::chrono::high_resolution_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+    std::printf("%-9s sizeof(item)=%3zu  lru walk %5.1f ns/item  evict-all %5.1f ns/item\n",
+            name, sizeof(Item),
+            double(ns(t1 - t0)) / walked,
+            double(ns(t2 - t1)) / evicted);
+}
+
+int main() {
+    {
+        using hash_list = bi::list<scattered_item,
+                bi::member_hook<scattered_item, auto_list_hook, &scattered_item::hash_link>,
+                bi::constant_time_size<false>>;
+        using timer_list = bi::list<scattered_item,
+                bi::member_hook<scattered_item, auto_list_hook, &scattered_item::timer_link>,
+                bi::constant_time_size<false>>;
+        using lru_list = bi::list<scattered_item,
+                bi::member_hook<scattered_item, auto_list_hook, &scattered_item::lru_link>,
+                bi::constant_time_size<false>>;
+        run<scattered_item, hash_list, timer_list, lru_list>("scattered",
+                [] (scattered_item& it, hash_list& h, timer_list& t, lru_list& l) {
+                    h.push_back(it);
+                    t.push_back(it);
+                    l.push_back(it);
+                },
+                [] (scattered_item& it) {
+                    it.hash_link.unlink();
+                    it.timer_link.unlink();
+                    it.lru_link.unlink();
+                });
+    }
+    {
+        using hash_list = bi::list<packed_item,
+                bi::base_hook<packed_list_hook<hash_tag>>, bi::constant_time_size<false>>;
+        using timer_list = bi::list<packed_item,
+                bi::base_hook<packed_list_hook<timer_tag>>, bi::constant_time_size<false>>;
+        using lru_list = bi::list<packed_item,
+                bi::base_hook<packed_list_hook<lru_tag>>, bi::constant_time_size<false>>;
+        run<packed_item, hash_list, timer_list, lru_list>("packed",
+                [] (packed_item& it, hash_list& h, timer_list& t, lru_list& l) {
+                    h.push_back(it);
+                    t.push_back(it);
+                    l.push_back(it);
+                },
+                [] (packed_item& it) {
+                    it.unlink_all();
+                });
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// Cross-shard messaging baselines: submit_to() round-trip latency and
+// smp_message_queue throughput at several concurrency levels, where
+// higher concurrency lets the queue amortize its wakeups and batch its
+// completions.  Run with at least -c2; on a single shard the "remote"
+// falls back to the local fast path and measures only that.
+
+#include "perf_tests.hh"
+#include "../../core/reactor.hh"
+#include "../../core/future-util.hh"
+#include <vector>
+
+static unsigned remote_shard() {
+    return smp::count > 1 ? 1u : 0u;
+}
+
+// one message in flight: pure round-trip latency
+PERF_TEST(smp, submit_to) {
+    return smp::submit_to(remote_shard(), [] {});
+}
+
+PERF_TEST(smp, submit_to_with_result) {
+    return smp::submit_to(remote_shard(), [] {
+        return 1;
+    }).then([] (int v) {
+        perf_tests::do_not_optimize(v);
+    });
+}
+
+// n messages in flight; the reported ns/op covers the whole batch, so
+// divide by the batch size for the per-message cost
+static future<> submit_batch(unsigned n) {
+    auto fs = std::vector<future<>>();
+    fs.reserve(n);
+    for (unsigned i = 0; i != n; ++i) {
+        fs.push_back(smp::submit_to(remote_shard(), [] {}));
+    }
+    return parallel_for_each(fs.begin(), fs.end(), [] (future<>& f) {
+        return std::move(f);
+    });
+}
+
+PERF_TEST(smp, submit_to_batch_4) {
+    return submit_batch(4);
+}
+
+PERF_TEST(smp, submit_to_batch_16) {
+    return submit_batch(16);
+}
+
+PERF_TEST(smp, submit_to_batch_64) {
+    return submit_batch(64);
+}
@@ -0,0 +1,230 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "perf_tests.hh"
+#include "../../core/app-template.hh"
+#include "../../core/reactor.hh"
+#include "../../core/future-util.hh"
+#include "../../core/memory.hh"
+#include "../../core/perf_counters.hh"
+#include "../../core/print.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+namespace perf_tests {
+namespace internal {
+
+// benchmarks run on shard 0 only; one shared counter group suffices
+static perf_counters pmu;
+
+static std::vector<std::unique_ptr<performance_test>>&
+all_tests() {
+    static std::vector<std::unique_ptr<performance_test>> tests;
+    return tests;
+}
+
+void register_test(std::unique_ptr<performance_test> test) {
+    all_tests().push_back(std::move(test));
+}
+
+future<>
+performance_test::run_batch(uint64_t n) {
+    return do_with(uint64_t(0), [this, n] (uint64_t& i) {
+        return repeat([this, n, &i] {
+            if (i == n) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            ++i;
+            return _func().then([] {
+                return stop_iteration::no;
+            });
+        });
+    });
+}
+
+struct measurement_state {
+    // per converged batch, so a batch dominates scheduling noise
+    static constexpr auto min_batch_duration = std::chrono::milliseconds(10);
+    static constexpr unsigned min_batches = 5;
+    static constexpr unsigned max_batches = 30;
+    static constexpr double target_precision = 0.02;
+    uint64_t batch_size = 100;
+    bool calibrated = false;
+    std::vector<double> ns_per_op;
+    uint64_t total_iterations = 0;
+    uint64_t total_cycles = 0;
+    uint64_t total_allocs = 0;
+    bool converged() const {
+        if (ns_per_op.size() < min_batches) {
+            return false;
+        }
+        if (ns_per_op.size() >= max_batches) {
+            return true;
+        }
+        return precision() < target_precision;
+    }
+    double mean() const {
+        double sum = 0;
+        for (auto v : ns_per_op) {
+            sum += v;
+        }
+        return sum / ns_per_op.size();
+    }
+    // half-width of the 95% confidence interval, relative to the mean
+    double precision() const {
+        auto m = mean();
+        double var = 0;
+        for (auto v : ns_per_op) {
+            var += (v - m) * (v - m);
+        }
+        var /= ns_per_op.size() - 1;
+        return 1.96 * std::sqrt(var / ns_per_op.size()) / m;
+    }
+};
+
+constexpr std::chrono::milliseconds measurement_state::min_batch_duration;
+constexpr unsigned measurement_state::min_batches;
+constexpr unsigned measurement_state::max_batches;
+constexpr double measurement_state::target_precision;
+
+future<result>
+performance_test::measure() {
+    return do_with(measurement_state{}, [this] (measurement_state& st) {
+        return repeat([this, &st] {
+            auto allocs_before = memory::stats().mallocs();
+            auto cycles_before = pmu.total(perf_counters::phase::tasks).cycles;
+            pmu.switch_phase(perf_counters::phase::tasks);
+            auto start = std::chrono::steady_clock::now();
+            return run_batch(st.batch_size).then([&st, start, allocs_before, cycles_before] {
+                auto duration = std::chrono::steady_clock::now() - start;
+                pmu.switch_phase(perf_counters::phase::idle);
+                if (!st.calibrated) {
+                    // grow until a batch is long enough to time, then
+                    // discard it as warmup
+                    if (duration < st.min_batch_duration) {
+                        auto min = std::chrono::duration_cast<std::chrono::nanoseconds>(st.min_batch_duration).count();
+                        auto took = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 1);
+                        st.batch_size = st.batch_size * ((min + took - 1) / took) * 2;
+                        return stop_iteration::no;
+                    }
+                    st.calibrated = true;
+                    return stop_iteration::no;
+                }
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+                st.ns_per_op.push_back(double(ns) / st.batch_size);
+                st.total_iterations += st.batch_size;
+                st.total_cycles += pmu.total(perf_counters::phase::tasks).cycles - cycles_before;
+                st.total_allocs += memory::stats().mallocs() - allocs_before;
+                return st.converged() ? stop_iteration::yes : stop_iteration::no;
+            });
+        }).then([this, &st] {
+            result r;
+            r.name = name();
+            r.mean_ns = st.mean();
+            r.precision = st.precision();
+            r.cycles_per_op = double(st.total_cycles) / st.total_iterations;
+            r.allocs_per_op = double(st.total_allocs) / st.total_iterations;
+            r.iterations = st.total_iterations;
+            std::sort(st.ns_per_op.begin(), st.ns_per_op.end());
+            r.median_ns = st.ns_per_op[st.ns_per_op.size() / 2];
+            r.batches_ns = std::move(st.ns_per_op);
+            return r;
+        });
+    });
+}
+
+// hand-rolled: the schema is flat and a test binary should not grow a
+// json library dependency.  scripts/perf-compare.py is the consumer.
+static void write_json(const std::string& path, const std::vector<result>& results) {
+    std::ofstream out(path);
+    out << "{\n  \"format_version\": 1,\n  \"results\": [";
+    bool first_result = true;
+    for (auto& r : results) {
+        out << (first_result ? "" : ",") << "\n    {";
+        first_result = false;
+        out << sprint("\"name\": \"%s\", ", r.name);
+        out << sprint("\"mean_ns\": %.3f, ", r.mean_ns);
+        out << sprint("\"median_ns\": %.3f, ", r.median_ns);
+        out << sprint("\"precision\": %.5f, ", r.precision);
+        out << sprint("\"cycles_per_op\": %.2f, ", r.cycles_per_op);
+        out << sprint("\"allocs_per_op\": %.4f, ", r.allocs_per_op);
+        out << sprint("\"iterations\": %d, ", r.iterations);
+        out << "\"batches_ns\": [";
+        bool first_batch = true;
+        for (auto v : r.batches_ns) {
+            out << sprint("%s%.3f", first_batch ? "" : ", ", v);
+            first_batch = false;
+        }
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+}
+}
+
+int main(int ac, char** av) {
+    using namespace perf_tests::internal;
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("only", bpo::value<std::string>()->default_value(""),
+                "run only benchmarks whose group.name contains this substring")
+        ("list", "list registered benchmarks and exit")
+        ("json-output", bpo::value<std::string>()->default_value(""),
+                "write results (including per-batch samples) to this file, for scripts/perf-compare.py")
+        ;
+    return app.run(ac, av, [&app] {
+        auto only = app.configuration()["only"].as<std::string>();
+        auto json_path = app.configuration()["json-output"].as<std::string>();
+        if (app.configuration().count("list")) {
+            for (auto& t : all_tests()) {
+                print("%s\n", t->name());
+            }
+            return make_ready_future<>();
+        }
+        if (!pmu.open()) {
+            print("# PMU unavailable (perf_event_paranoid?); cycles/op will read 0\n");
+        }
+        print("%-30s %12s %7s %12s %10s %12s\n",
+                "benchmark", "ns/op", "ci", "cycles/op", "allocs/op", "iterations");
+        return do_with(std::vector<result>(), [only, json_path] (std::vector<result>& results) {
+            return do_for_each(all_tests(), [only, &results] (std::unique_ptr<performance_test>& t) {
+                if (only != "" && t->name().find(sstring(only)) == sstring::npos) {
+                    return make_ready_future<>();
+                }
+                return t->measure().then([&results] (result r) {
+                    print("%-30s %12.2f %6.1f%% %12.1f %10.2f %12d\n",
+                            r.name, r.mean_ns, r.precision * 100,
+                            r.cycles_per_op, r.allocs_per_op, r.iterations);
+                    results.push_back(std::move(r));
+                });
+            }).then([&results, json_path] {
+                if (!json_path.empty()) {
+                    write_json(json_path, results);
+                }
+            });
+        });
+    });
+}
@@ -0,0 +1,107 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#pragma once
+
+#include <cstddef>
+#include "../../core/future.hh"
+#include "../../core/sstring.hh"
+#include <memory>
+#include <vector>
+
+/// \brief Microbenchmark framework; see tests/perf/perf_tests.cc.
+///
+/// A benchmark is a future-returning function measuring one operation:
+///
+///     PERF_TEST(future, ready_then) {
+///         return make_ready_future<>().then([] {});
+///     }
+///
+/// The runner (the tests/perf/perf_tests binary) calibrates a batch
+/// size, runs a warmup batch, then repeats batches until the 95%
+/// confidence interval of ns/op is within 2% of the mean (or a batch
+/// cap is hit), and reports ns/op, cycles/op (from the PMU, when the
+/// kernel allows opening it) and allocs/op (from the counters in
+/// core/memory.cc).  All figures include the framework's one
+/// continuation per iteration; benchmarks measuring something cheaper
+/// than that should loop internally.
+///
+/// New benchmarks land as another .cc in tests/perf listing only
+/// PERF_TEST bodies, added to the perf_tests target in configure.py.
+namespace perf_tests {
+
+/// Defeats dead-code elimination of a benchmark's result.
+template <typename T>
+inline void do_not_optimize(T&& v) {
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+namespace internal {
+
+using test_function = future<> (*)();
+
+/// One benchmark's converged measurement.  The runner prints one line
+/// per result and, with --json-output, writes them all to a file that
+/// scripts/perf-compare.py can diff against another run.
+struct result {
+    sstring name;
+    double mean_ns;
+    double median_ns;
+    double precision;       // relative 95% CI half-width of mean_ns
+    double cycles_per_op;
+    double allocs_per_op;
+    uint64_t iterations;
+    std::vector<double> batches_ns; // per-batch ns/op samples, sorted
+};
+
+class performance_test {
+    sstring _group;
+    sstring _name;
+    test_function _func;
+public:
+    performance_test(sstring group, sstring name, test_function func)
+        : _group(std::move(group)), _name(std::move(name)), _func(func) {}
+    sstring name() const { return _group + "." + _name; }
+    /// Runs one batch of \c n iterations.
+    future<> run_batch(uint64_t n);
+    /// Warms up, then runs batches to convergence.
+    future<result> measure();
+};
+
+void register_test(std::unique_ptr<performance_test>);
+
+struct registrar {
+    registrar(const char* group, const char* name, test_function func) {
+        register_test(std::make_unique<performance_test>(group, name, func));
+    }
+};
+
+}
+
+}
+
+/// Defines and registers a benchmark; the body follows the macro and
+/// must return a future<> performing one measured operation.
+#define PERF_TEST(group, name) \
+    static future<> perf_test_##group##_##name(); \
+    static ::perf_tests::internal::registrar \
+            perf_test_registrar_##group##_##name(#group, #name, perf_test_##group##_##name); \
+    static future<> perf_test_##group##_##name()
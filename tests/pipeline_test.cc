@@ -0,0 +1,88 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#include "core/app-template.hh"
+#include "core/pipeline.hh"
+#include "core/print.hh"
+
+#include <atomic>
+
+using namespace seastar;
+
+static constexpr unsigned nr_items = 10000;
+
+// doubler -> summer, each on every shard; checks that every item passes
+// through both stages exactly once and that the counters agree
+future<> test_two_stage_pipeline() {
+    auto all_shards = std::vector<unsigned>(smp::all_cpus().begin(), smp::all_cpus().end());
+    auto sum = make_lw_shared<std::atomic<uint64_t>>(0);
+    auto summer = make_pipeline_stage<unsigned>("summer", all_shards, 128,
+            [sum = &*sum] (unsigned x) {
+        sum->fetch_add(x, std::memory_order_relaxed);
+        return make_ready_future<>();
+    });
+    auto doubler = make_pipeline_stage<unsigned>("doubler", all_shards, 128,
+            [summer = &*summer] (unsigned x) {
+        return summer->offer(2 * x);
+    });
+    return summer->start().then([doubler] {
+        return doubler->start();
+    }).then([doubler] {
+        auto range = boost::irange<unsigned>(0, nr_items);
+        return do_for_each(range.begin(), range.end(), [doubler] (unsigned i) {
+            return doubler->offer(i);
+        });
+    }).then([doubler] {
+        return doubler->close();
+    }).then([summer] {
+        return summer->close();
+    }).then([doubler] {
+        return doubler->stats();
+    }).then([summer, sum] (pipeline_stage_stats stats) {
+        if (stats.received != nr_items || stats.processed != nr_items || stats.queued != 0) {
+            throw std::runtime_error("doubler stage counters wrong");
+        }
+        uint64_t expected = uint64_t(nr_items) * (nr_items - 1); // sum of 2*i
+        if (sum->load() != expected) {
+            throw std::runtime_error(sprint("wrong sum: %d != %d", sum->load(), expected));
+        }
+        return summer->stats();
+    }).then([] (pipeline_stage_stats stats) {
+        if (stats.processed != nr_items) {
+            throw std::runtime_error("summer stage counters wrong");
+        }
+        print("PASS: two stage pipeline\n");
+    }).finally([doubler, summer, sum] {});
+}
+
+int main(int ac, char** av) {
+    return app_template().run_deprecated(ac, av, [] {
+        return test_two_stage_pipeline().then_wrapped([] (future<> f) {
+            try {
+                f.get();
+                engine().exit(0);
+            } catch (std::exception& e) {
+                print("FAIL: %s\n", e.what());
+                engine().exit(1);
+            }
+        });
+    });
+}
@@ -0,0 +1,227 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+// RPC echo benchmark: measures calls/sec and round-trip latency
+// percentiles of an rpc::protocol echo call, across payload sizes and
+// with or without lz4 compression.  --transport=loopback runs over
+// tests/loopback_socket.hh, so only serialization and framing are
+// measured; --transport=tcp runs client and server over real TCP in
+// the same process, adding the network stack.  Diffing the two
+// quantifies rpc/rpc_impl.hh changes with and without the network.
+
+#include "core/reactor.hh"
+#include "core/app-template.hh"
+#include "core/future-util.hh"
+#include "core/print.hh"
+#include "loopback_socket.hh"
+#include "rpc/rpc.hh"
+#include "rpc/lz4_compressor.hh"
+#include <boost/range/irange.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+struct serializer {
+};
+
+template <typename T, typename Output>
+inline
+void write_arithmetic_type(Output& out, T v) {
+    static_assert(std::is_arithmetic<T>::value, "must be arithmetic type");
+    return out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <typename T, typename Input>
+inline
+T read_arithmetic_type(Input& in) {
+    static_assert(std::is_arithmetic<T>::value, "must be arithmetic type");
+    T v;
+    in.read(reinterpret_cast<char*>(&v), sizeof(T));
+    return v;
+}
+
+template <typename Output>
+inline void write(serializer, Output& output, int32_t v) { return write_arithmetic_type(output, v); }
+template <typename Output>
+inline void write(serializer, Output& output, uint32_t v) { return write_arithmetic_type(output, v); }
+template <typename Output>
+inline void write(serializer, Output& output, int64_t v) { return write_arithmetic_type(output, v); }
+template <typename Output>
+inline void write(serializer, Output& output, uint64_t v) { return write_arithmetic_type(output, v); }
+template <typename Output>
+inline void write(serializer, Output& output, double v) { return write_arithmetic_type(output, v); }
+template <typename Input>
+inline int32_t read(serializer, Input& input, rpc::type<int32_t>) { return read_arithmetic_type<int32_t>(input); }
+template <typename Input>
+inline uint32_t read(serializer, Input& input, rpc::type<uint32_t>) { return read_arithmetic_type<uint32_t>(input); }
+template <typename Input>
+inline uint64_t read(serializer, Input& input, rpc::type<uint64_t>) { return read_arithmetic_type<uint64_t>(input); }
+template <typename Input>
+inline uint64_t read(serializer, Input& input, rpc::type<int64_t>) { return read_arithmetic_type<int64_t>(input); }
+template <typename Input>
+inline double read(serializer, Input& input, rpc::type<double>) { return read_arithmetic_type<double>(input); }
+
+template <typename Output>
+inline void write(serializer, Output& out, const sstring& v) {
+    write_arithmetic_type(out, uint32_t(v.size()));
+    out.write(v.c_str(), v.size());
+}
+
+template <typename Input>
+inline sstring read(serializer, Input& in, rpc::type<sstring>) {
+    auto size = read_arithmetic_type<uint32_t>(in);
+    sstring ret(sstring::initialized_later(), size);
+    in.read(ret.begin(), size);
+    return ret;
+}
+
+using test_rpc_proto = rpc::protocol<serializer>;
+
+struct lz4_factory : rpc::compressor::factory {
+    const sstring& supported() const override {
+        static const sstring name = "LZ4";
+        return name;
+    }
+    std::unique_ptr<rpc::compressor> negotiate(sstring feature, bool is_server) const override {
+        return feature == supported() ? std::make_unique<rpc::lz4_compressor>() : nullptr;
+    }
+};
+
+static double percentile(std::vector<double>& sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto idx = std::min(sorted.size() - 1, size_t(std::ceil(q * sorted.size())) - 1);
+    return sorted[idx];
+}
+
+struct bench_env {
+    test_rpc_proto proto{serializer()};
+    loopback_connection_factory lcf;
+    lz4_factory compressor;
+    std::unique_ptr<test_rpc_proto::server> server;
+    std::unique_ptr<test_rpc_proto::client> client;
+};
+
+// one run: keep `concurrency` echo calls of `payload_size` bytes in
+// flight for `duration` seconds
+static future<> run_one(bench_env& env, sstring transport, bool compress,
+        size_t payload_size, unsigned concurrency, unsigned duration) {
+    struct state {
+        sstring payload;
+        std::vector<double> latencies; // microseconds
+        uint64_t calls = 0;
+        bool done = false;
+        timer<> stop_timer;
+    };
+    auto echo = env.proto.make_client<sstring (sstring)>(1);
+    return do_with(state(), [&env, echo, transport, compress, payload_size, concurrency, duration] (state& st) {
+        st.payload = sstring(payload_size, 'x');
+        st.stop_timer.set_callback([&st] { st.done = true; });
+        st.stop_timer.arm(std::chrono::seconds(duration));
+        auto started = steady_clock_type::now();
+        auto fibers = boost::irange(0u, concurrency);
+        return parallel_for_each(fibers.begin(), fibers.end(), [&env, echo, &st] (unsigned dummy) {
+            return do_until([&st] { return st.done; }, [&env, echo, &st] () mutable {
+                auto start = steady_clock_type::now();
+                return echo(*env.client, st.payload).then([&st, start] (sstring dummy) {
+                    st.latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                            steady_clock_type::now() - start).count());
+                    st.calls++;
+                });
+            });
+        }).then([&st, started, transport, compress, payload_size, concurrency] {
+            auto secs = std::chrono::duration_cast<std::chrono::duration<double>>(
+                    steady_clock_type::now() - started).count();
+            std::sort(st.latencies.begin(), st.latencies.end());
+            print("transport=%s compression=%s payload=%d concurrency=%d duration_secs=%.2f"
+                    " calls=%d calls_per_sec=%.0f lat_us_p50=%.0f lat_us_p95=%.0f lat_us_p99=%.0f lat_us_max=%.0f\n",
+                    transport, compress ? "lz4" : "off", payload_size, concurrency, secs,
+                    st.calls, st.calls / secs,
+                    percentile(st.latencies, 0.5), percentile(st.latencies, 0.95),
+                    percentile(st.latencies, 0.99),
+                    st.latencies.empty() ? 0.0 : st.latencies.back());
+        });
+    });
+}
+
+namespace bpo = boost::program_options;
+
+int main(int ac, char** av) {
+    app_template app;
+    app.add_options()
+        ("transport", bpo::value<std::string>()->default_value("loopback"), "loopback (serialization+framing only) | tcp (client and server over real TCP in this process)")
+        ("payloads", bpo::value<std::string>()->default_value("64,4096,65536"), "comma-separated payload sizes in bytes")
+        ("compression", "negotiate lz4 compression on the connection")
+        ("concurrency", bpo::value<unsigned>()->default_value(100), "calls kept in flight")
+        ("duration", bpo::value<unsigned>()->default_value(10), "seconds per payload size")
+        ("port", bpo::value<uint16_t>()->default_value(10002), "server port for --transport=tcp")
+        ;
+    return app.run(ac, av, [&app] () -> future<int> {
+        auto& config = app.configuration();
+        auto transport = config["transport"].as<std::string>();
+        auto compress = bool(config.count("compression"));
+        auto concurrency = config["concurrency"].as<unsigned>();
+        auto duration = config["duration"].as<unsigned>();
+        auto port = config["port"].as<uint16_t>();
+
+        std::vector<std::string> strs;
+        boost::split(strs, config["payloads"].as<std::string>(), boost::is_any_of(","));
+        std::vector<size_t> payloads(strs.size(), 0);
+        std::transform(strs.begin(), strs.end(), payloads.begin(), [] (const std::string& s) { return boost::lexical_cast<size_t>(s); });
+
+        if (transport != "loopback" && transport != "tcp") {
+            print("Error: --transport=loopback|tcp\n");
+            return make_ready_future<int>(1);
+        }
+
+        return do_with(bench_env(), std::move(payloads), [transport = sstring(transport), compress, concurrency, duration, port] (bench_env& env, std::vector<size_t>& payloads) {
+            env.proto.register_handler(1, [] (sstring payload) {
+                return make_ready_future<sstring>(std::move(payload));
+            });
+            rpc::server_options so;
+            rpc::client_options co;
+            if (compress) {
+                so.compressor_factory = &env.compressor;
+                co.compressor_factory = &env.compressor;
+            }
+            if (transport == "loopback") {
+                env.server = std::make_unique<test_rpc_proto::server>(env.proto, so, env.lcf.get_server_socket());
+                env.client = std::make_unique<test_rpc_proto::client>(env.proto, co,
+                        seastar::socket(std::make_unique<loopback_socket_impl>(env.lcf)), ipv4_addr());
+            } else {
+                env.server = std::make_unique<test_rpc_proto::server>(env.proto, so, ipv4_addr{"127.0.0.1", port});
+                env.client = std::make_unique<test_rpc_proto::client>(env.proto, co, ipv4_addr{"127.0.0.1", port});
+            }
+            return do_for_each(payloads, [&env, transport, compress, concurrency, duration] (size_t payload_size) {
+                return run_one(env, transport, compress, payload_size, concurrency, duration);
+            }).finally([&env] {
+                return env.client->stop().finally([&env] {
+                    return env.server->stop();
+                });
+            }).then([] {
+                return 0;
+            });
+        });
+    });
+}
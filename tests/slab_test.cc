@@ -114,10 +114,50 @@ static void test_allocation_with_lru(const double growth_factor, const unsigned
     std::cout << __FUNCTION__ << " done!\n";
 }
 
+static void test_second_chance_eviction(const double growth_factor, const unsigned slab_limit_size) {
+    bi::list<item, bi::member_hook<item, bi::list_member_hook<>, &item::_cache_link>> _cache;
+    std::vector<item *> evicted;
+
+    slab_allocator<item> slab(growth_factor, slab_limit_size, max_object_size,
+        [&](item& item_ref) { _cache.erase(_cache.iterator_to(item_ref)); evicted.push_back(&item_ref); });
+    size_t size = max_object_size;
+
+    auto max = slab_limit_size / max_object_size;
+    std::vector<item *> items;
+    for (auto i = 0u; i < max; i++) {
+        auto item = slab.create(size);
+        assert(item != nullptr);
+        _cache.push_front(*item);
+        items.push_back(item);
+    }
+
+    // the oldest item is the eviction candidate; a touch grants it a
+    // second chance, so the next-oldest gets evicted instead
+    slab.touch(items[0]);
+    auto item = slab.create(size);
+    assert(item != nullptr);
+    _cache.push_front(*item);
+    assert(evicted.size() == 1);
+    assert(evicted[0] == items[1]);
+
+    // the second chance was spent rotating items[0] to the front, so the
+    // following eviction takes the next unreferenced item in LRU order
+    item = slab.create(size);
+    assert(item != nullptr);
+    _cache.push_front(*item);
+    assert(evicted.size() == 2);
+    assert(evicted[1] == items[2]);
+
+    _cache.clear();
+
+    std::cout << __FUNCTION__ << " done!\n";
+}
+
 int main(int ac, char** av) {
     test_allocation_1(1.25, 5*1024*1024);
     test_allocation_2(1.07, 5*1024*1024); // 1.07 is the growth factor used by facebook.
     test_allocation_with_lru(1.25, 5*1024*1024);
+    test_second_chance_eviction(1.25, 5*1024*1024);
 
     return 0;
 }
@@ -0,0 +1,128 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/small_vector.hh"
+#include <string>
+
+using namespace seastar;
+
+BOOST_AUTO_TEST_CASE(test_stays_inline_within_n) {
+    small_vector<int, 4> v;
+    for (int i = 0; i < 4; i++) {
+        v.push_back(i);
+    }
+    BOOST_REQUIRE_EQUAL(v.size(), 4u);
+    BOOST_REQUIRE_EQUAL(v.capacity(), 4u);
+    // inline storage lives inside the object itself
+    auto p = reinterpret_cast<const char*>(v.data());
+    auto o = reinterpret_cast<const char*>(&v);
+    BOOST_REQUIRE(p >= o && p < o + sizeof(v));
+    for (int i = 0; i < 4; i++) {
+        BOOST_REQUIRE_EQUAL(v[i], i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_spills_to_heap) {
+    small_vector<int, 4> v;
+    for (int i = 0; i < 100; i++) {
+        v.push_back(i);
+    }
+    BOOST_REQUIRE_EQUAL(v.size(), 100u);
+    auto p = reinterpret_cast<const char*>(v.data());
+    auto o = reinterpret_cast<const char*>(&v);
+    BOOST_REQUIRE(!(p >= o && p < o + sizeof(v)));
+    for (int i = 0; i < 100; i++) {
+        BOOST_REQUIRE_EQUAL(v[i], i);
+    }
+}
+
+struct counted {
+    static int live;
+    int value;
+    counted(int v = 0) : value(v) { live++; }
+    counted(const counted& x) : value(x.value) { live++; }
+    counted(counted&& x) : value(x.value) { live++; }
+    ~counted() { live--; }
+    counted& operator=(const counted&) = default;
+};
+int counted::live = 0;
+
+BOOST_AUTO_TEST_CASE(test_object_lifetimes) {
+    {
+        small_vector<counted, 2> v;
+        for (int i = 0; i < 10; i++) {
+            v.emplace_back(i);
+        }
+        BOOST_REQUIRE_EQUAL(counted::live, 10);
+        v.pop_back();
+        BOOST_REQUIRE_EQUAL(counted::live, 9);
+        v.resize(3);
+        BOOST_REQUIRE_EQUAL(counted::live, 3);
+        BOOST_REQUIRE_EQUAL(v[2].value, 2);
+        v.clear();
+        BOOST_REQUIRE_EQUAL(counted::live, 0);
+    }
+    BOOST_REQUIRE_EQUAL(counted::live, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_move_inline_and_spilled) {
+    small_vector<std::string, 2> inl;
+    inl.push_back("a");
+    inl.push_back("b");
+    auto inl2 = std::move(inl);
+    BOOST_REQUIRE_EQUAL(inl2.size(), 2u);
+    BOOST_REQUIRE_EQUAL(inl2[1], "b");
+    BOOST_REQUIRE(inl.empty());
+
+    small_vector<std::string, 2> big;
+    for (int i = 0; i < 20; i++) {
+        big.push_back(std::to_string(i));
+    }
+    auto stolen = big.data();
+    auto big2 = std::move(big);
+    BOOST_REQUIRE_EQUAL(big2.size(), 20u);
+    BOOST_REQUIRE(big2.data() == stolen); // heap buffer moves by pointer
+    BOOST_REQUIRE(big.empty());
+    big.push_back("reuse after move");
+    BOOST_REQUIRE_EQUAL(big.size(), 1u);
+
+    big = std::move(big2);
+    BOOST_REQUIRE_EQUAL(big.size(), 20u);
+    BOOST_REQUIRE_EQUAL(big[19], "19");
+}
+
+BOOST_AUTO_TEST_CASE(test_copy) {
+    small_vector<std::string, 2> v;
+    for (int i = 0; i < 8; i++) {
+        v.push_back(std::to_string(i));
+    }
+    auto c = v;
+    BOOST_REQUIRE_EQUAL(c.size(), 8u);
+    BOOST_REQUIRE_EQUAL(v.size(), 8u);
+    c[0] = "changed";
+    BOOST_REQUIRE_EQUAL(v[0], "0");
+    v = c;
+    BOOST_REQUIRE_EQUAL(v[0], "changed");
+}
@@ -22,6 +22,17 @@
 #include "core/reactor.hh"
 #include "core/app-template.hh"
 #include "core/print.hh"
+#include "core/shard_published.hh"
+
+future<bool> test_smp_local_call() {
+    // same-shard submissions run inline, but must still look like a
+    // regular submit_to() to the caller
+    return smp::submit_to(engine().cpu_id(), [] {
+        return make_ready_future<int>(3);
+    }).then([] (int ret) {
+        return make_ready_future<bool>(ret == 3);
+    });
+}
 
 future<bool> test_smp_call() {
     return smp::submit_to(1, [] {
@@ -55,6 +66,24 @@ future<bool> test_smp_exception() {
     });
 }
 
+struct load_report {
+    unsigned shard;
+    uint64_t requests;
+};
+
+future<bool> test_shard_published() {
+    auto published = new shard_published<load_report>;
+    return smp::submit_to(1, [published] {
+        published->publish({engine().cpu_id(), 42});
+    }).then([published] {
+        // read shard 1's slot without a round trip
+        auto snap = published->peek(1);
+        bool ok = snap.shard == 1 && snap.requests == 42;
+        delete published;
+        return make_ready_future<bool>(ok);
+    });
+}
+
 int tests, fails;
 
 future<>
@@ -69,7 +98,11 @@ report(sstring msg, future<bool>&& result) {
 int main(int ac, char** av) {
     return app_template().run_deprecated(ac, av, [] {
        return report("smp call", test_smp_call()).then([] {
+           return report("smp local call", test_smp_local_call());
+       }).then([] {
            return report("smp exception", test_smp_exception());
+       }).then([] {
+           return report("shard published", test_shard_published());
        }).then([] {
            print("\n%d tests / %d failures\n", tests, fails);
            engine().exit(fails ? 1 : 0);
@@ -128,3 +128,36 @@ BOOST_AUTO_TEST_CASE(test_ctor_iterator) {
     sstring s(data.begin(), data.end());
     BOOST_REQUIRE_EQUAL(s, "abc");
 }
+
+BOOST_AUTO_TEST_CASE(test_sstring32_stays_internal) {
+    // 24 characters overflow sstring's buffer but not sstring32's
+    sstring32 s("abcdefghijklmnopqrstuvwx");
+    BOOST_REQUIRE_EQUAL(s.size(), 24u);
+    BOOST_REQUIRE(s.begin() >= reinterpret_cast<const char*>(&s)
+            && s.begin() < reinterpret_cast<const char*>(&s + 1));
+}
+
+BOOST_AUTO_TEST_CASE(test_interop_between_instantiations) {
+    sstring a("hello");
+    sstring32 b(a);
+    BOOST_REQUIRE(a == b);
+    BOOST_REQUIRE(b == a);
+    BOOST_REQUIRE(!(a != b));
+    BOOST_REQUIRE(a < sstring32("hellp"));
+    BOOST_REQUIRE(sstring32("helln") < a);
+    BOOST_REQUIRE_EQUAL(std::hash<sstring>()(a), std::hash<sstring32>()(b));
+    BOOST_REQUIRE_EQUAL(sstring(b), a);
+}
+
+BOOST_AUTO_TEST_CASE(test_non_null_terminated) {
+    using bytes15 = basic_sstring<char, uint32_t, 15, false>;
+    bytes15 b("abc\0def", 7);
+    BOOST_REQUIRE_EQUAL(b.size(), 7u);
+    BOOST_REQUIRE(b == bytes15("abc\0def", 7));
+    BOOST_REQUIRE(b != bytes15("abc", 3));
+    // one more character fits internally than in the terminated flavor
+    bytes15 full("abcdefghijklmno", 15);
+    BOOST_REQUIRE(full.begin() >= reinterpret_cast<const char*>(&full)
+            && full.begin() < reinterpret_cast<const char*>(&full + 1));
+    BOOST_REQUIRE_EQUAL(sstring(full), sstring("abcdefghijklmno"));
+}
@@ -0,0 +1,168 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "core/timer-wheel.hh"
+#include <chrono>
+#include <random>
+#include <vector>
+
+// Drives the wheel with an inert timer, so expiry can be stepped
+// through synthetic time without a reactor.
+struct fake_timer {
+    using clock = std::chrono::steady_clock;
+    using duration = clock::duration;
+    using time_point = clock::time_point;
+    bi::list_member_hook<> _link;
+    time_point _timeout;
+    time_point get_timeout() { return _timeout; }
+    void cancel() { abort(); } // destructor-only; tests drain first
+};
+
+using wheel_t = seastar::timer_wheel<fake_timer, &fake_timer::_link>;
+
+static fake_timer::time_point at(int64_t ns) {
+    return fake_timer::time_point(std::chrono::nanoseconds(ns));
+}
+
+BOOST_AUTO_TEST_CASE(test_insert_expire_levels) {
+    wheel_t wheel;
+    // deltas spanning every level, including past the ~19h horizon
+    std::vector<int64_t> timeouts = { 1, 1000, 100000, 50000000,
+            3000000000, 600000000000, 100000000000000 };
+    std::vector<fake_timer> timers(timeouts.size());
+    for (size_t i = 0; i < timers.size(); i++) {
+        timers[i]._timeout = at(timeouts[i]);
+        wheel.insert(timers[i]);
+    }
+    BOOST_REQUIRE_EQUAL(wheel.size(), timers.size());
+    size_t fired = 0;
+    auto last_fired = at(0);
+    int rounds = 0;
+    while (!wheel.empty()) {
+        BOOST_REQUIRE(++rounds < 1000); // wakeups must make progress
+        auto now = wheel.get_next_timeout();
+        auto exp = wheel.expire(now);
+        while (!exp.empty()) {
+            auto& t = *exp.begin();
+            exp.pop_front();
+            BOOST_REQUIRE(t.get_timeout() <= now);
+            BOOST_REQUIRE(t.get_timeout() >= last_fired);
+            last_fired = t.get_timeout();
+            fired++;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(fired, timers.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_expire_is_exact) {
+    wheel_t wheel;
+    fake_timer early, late;
+    early._timeout = at(1000000);
+    late._timeout = at(1000001);
+    wheel.insert(early);
+    wheel.insert(late);
+    auto exp = wheel.expire(at(1000000));
+    BOOST_REQUIRE_EQUAL(exp.size(), 1u);
+    BOOST_REQUIRE(&*exp.begin() == &early);
+    exp.clear();
+    // the sub-tick survivor must still be delivered
+    BOOST_REQUIRE(wheel.get_next_timeout() <= late.get_timeout());
+    exp = wheel.expire(at(1000001));
+    BOOST_REQUIRE_EQUAL(exp.size(), 1u);
+    BOOST_REQUIRE(&*exp.begin() == &late);
+    exp.clear();
+    BOOST_REQUIRE(wheel.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_remove_at_every_level) {
+    wheel_t wheel;
+    std::vector<int64_t> timeouts = { 1, 1000, 100000, 50000000,
+            3000000000, 600000000000, 100000000000000 };
+    std::vector<fake_timer> timers(timeouts.size());
+    for (size_t i = 0; i < timers.size(); i++) {
+        timers[i]._timeout = at(timeouts[i]);
+        wheel.insert(timers[i]);
+    }
+    // also exercise removal after the wheel has turned a bit
+    auto exp = wheel.expire(at(2));
+    BOOST_REQUIRE_EQUAL(exp.size(), 1u);
+    exp.clear();
+    for (size_t i = 1; i < timers.size(); i++) {
+        wheel.remove(timers[i]);
+    }
+    BOOST_REQUIRE(wheel.empty());
+    BOOST_REQUIRE_EQUAL(wheel.size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_randomized_against_sort) {
+    wheel_t wheel;
+    std::default_random_engine rnd(42);
+    std::uniform_int_distribution<int64_t> dist(1, 3600000000000); // up to 1h
+    constexpr int n = 2000;
+    std::vector<fake_timer> timers(n);
+    for (auto& t : timers) {
+        t._timeout = at(dist(rnd));
+        wheel.insert(t);
+    }
+    // cancel a random half, as a timeout-heavy workload would
+    size_t remaining = n;
+    for (int i = 0; i < n; i += 2) {
+        wheel.remove(timers[i]);
+        remaining--;
+    }
+    size_t fired = 0;
+    auto last_fired = at(0);
+    int rounds = 0;
+    while (!wheel.empty()) {
+        BOOST_REQUIRE(++rounds < 100000);
+        auto now = wheel.get_next_timeout();
+        auto exp = wheel.expire(now);
+        while (!exp.empty()) {
+            auto& t = *exp.begin();
+            exp.pop_front();
+            BOOST_REQUIRE(t.get_timeout() <= now);
+            BOOST_REQUIRE(t.get_timeout() >= last_fired);
+            last_fired = t.get_timeout();
+            fired++;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(fired, remaining);
+}
+
+BOOST_AUTO_TEST_CASE(test_slack_coalesces_wakeups) {
+    wheel_t wheel;
+    wheel.set_slack(std::chrono::microseconds(100));
+    fake_timer a, b;
+    a._timeout = at(1000010);
+    b._timeout = at(1000020);
+    wheel.insert(a);
+    wheel.insert(b);
+    // both wakeups align to the same slack boundary
+    BOOST_REQUIRE(wheel.get_next_timeout() == at(1100000));
+    auto exp = wheel.expire(wheel.get_next_timeout());
+    BOOST_REQUIRE_EQUAL(exp.size(), 2u);
+    exp.clear();
+    BOOST_REQUIRE(wheel.empty());
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2016 ScyllaDB
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+
+#include "core/tracing.hh"
+
+BOOST_AUTO_TEST_CASE(test_untraced_span_is_a_no_op) {
+    tracing::set_current({});
+    tracer::local().clear();
+    {
+        trace_span s("should-not-record");
+    }
+    BOOST_REQUIRE(tracer::local().spans().empty());
+    BOOST_REQUIRE(!tracing::current());
+}
+
+BOOST_AUTO_TEST_CASE(test_nested_spans_record_parentage) {
+    tracer::local().clear();
+    auto root = tracer::local().next_id();
+    tracing::set_current({root, root});
+    {
+        trace_span outer("outer");
+        auto outer_ctx = tracing::current();
+        BOOST_REQUIRE_EQUAL(outer_ctx.trace_id, root);
+        BOOST_REQUIRE(outer_ctx.span_id != root);
+        {
+            trace_span inner("inner");
+            BOOST_REQUIRE_EQUAL(tracing::current().trace_id, root);
+            BOOST_REQUIRE(tracing::current().span_id != outer_ctx.span_id);
+        }
+        // the inner span must have restored the outer context
+        BOOST_REQUIRE_EQUAL(tracing::current().span_id, outer_ctx.span_id);
+    }
+    BOOST_REQUIRE_EQUAL(tracing::current().span_id, root);
+    auto& spans = tracer::local().spans();
+    BOOST_REQUIRE_EQUAL(spans.size(), 2u);
+    // spans complete innermost first
+    BOOST_REQUIRE_EQUAL(std::string(spans[0].name), "inner");
+    BOOST_REQUIRE_EQUAL(std::string(spans[1].name), "outer");
+    BOOST_REQUIRE_EQUAL(spans[0].parent_id, spans[1].span_id);
+    BOOST_REQUIRE_EQUAL(spans[1].parent_id, root);
+    BOOST_REQUIRE_EQUAL(spans[0].trace_id, root);
+    BOOST_REQUIRE_EQUAL(spans[1].trace_id, root);
+    tracing::set_current({});
+}
+
+BOOST_AUTO_TEST_CASE(test_new_trace_sampling) {
+    // the first call samples, then exactly one in every sample_rate
+    BOOST_REQUIRE(bool(tracer::local().new_trace()));
+    for (unsigned round = 0; round < 3; round++) {
+        for (unsigned i = 0; i < tracer::sample_rate - 1; i++) {
+            BOOST_REQUIRE(!tracer::local().new_trace());
+        }
+        auto ctx = tracer::local().new_trace();
+        BOOST_REQUIRE(bool(ctx));
+        BOOST_REQUIRE_EQUAL(ctx.trace_id, ctx.span_id);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_full_ring_counts_drops) {
+    tracer::local().clear();
+    auto root = tracer::local().next_id();
+    tracing::set_current({root, root});
+    for (size_t i = 0; i < tracer::ring_capacity + 10; i++) {
+        trace_span s("filler");
+    }
+    BOOST_REQUIRE_EQUAL(tracer::local().spans().size(), tracer::ring_capacity);
+    BOOST_REQUIRE_EQUAL(tracer::local().dropped(), 10u);
+    // dropped spans still restore the context
+    BOOST_REQUIRE_EQUAL(tracing::current().span_id, root);
+    tracing::set_current({});
+    tracer::local().clear();
+}
@@ -20,6 +20,7 @@
  */
 #include "log.hh"
 #include "core/array_map.hh"
+#include "core/circular_buffer.hh"
 #include "core/reactor.hh"
 #include <cxxabi.h>
 #include <system_error>
@@ -80,6 +81,81 @@ logger::~logger() {
     logger_registry().unregister_logger(this);
 }
 
+// Formatting a message and writing it out are decoupled: the logging
+// call formats into a fixed stack buffer and appends the entry to a
+// bounded per-thread ring; a single scheduled task then writes every
+// accumulated entry with one stream operation.  A burst of warnings
+// thus costs the reactor thread only the formatting, and if the burst
+// outruns the flusher the ring drops new entries and counts them
+// instead of growing without bound.
+struct log_ring {
+    struct entry {
+        log_level level;
+        int syslog_offset;
+        sstring msg;
+    };
+    static constexpr size_t capacity = 1024;
+    circular_buffer<entry> entries;
+    uint64_t dropped = 0;
+    bool flush_scheduled = false;
+    ~log_ring();
+};
+
+static thread_local log_ring g_log_ring;
+
+// Formats through a caller-provided fixed buffer, so the hot path does
+// not pay for ostringstream's allocations and locale machinery.  On
+// overflow the stream goes bad and the message is truncated.
+class bounded_streambuf final : public std::streambuf {
+public:
+    bounded_streambuf(char* buf, size_t size) {
+        setp(buf, buf + size);
+    }
+    size_t size() const {
+        return pptr() - pbase();
+    }
+};
+
+static void flush_log_ring() {
+    auto& ring = g_log_ring;
+    ring.flush_scheduled = false;
+    std::string batch;
+    static array_map<int, 20> syslog_level_map = {
+            { int(log_level::debug), LOG_DEBUG },
+            { int(log_level::info), LOG_INFO },
+            { int(log_level::trace), LOG_DEBUG },  // no LOG_TRACE
+            { int(log_level::warn), LOG_WARNING },
+            { int(log_level::error), LOG_ERR },
+    };
+    bool stdout_enabled = logger::is_stdout_enabled();
+    bool syslog_enabled = logger::is_syslog_enabled();
+    while (!ring.entries.empty()) {
+        auto e = std::move(ring.entries.front());
+        ring.entries.pop_front();
+        if (stdout_enabled) {
+            batch.append(e.msg.begin(), e.msg.end());
+        }
+        if (syslog_enabled) {
+            // NOTE: syslog() can block, which will stall this flush (but
+            //       no longer the logging call site).
+            // syslog() interprets % characters, so send msg as a parameter
+            syslog(syslog_level_map[int(e.level)], "%s", e.msg.c_str() + e.syslog_offset);
+        }
+    }
+    if (ring.dropped) {
+        batch += sprint("WARN  logger - dropped %lu log messages due to backlog\n", ring.dropped);
+        ring.dropped = 0;
+    }
+    if (!batch.empty()) {
+        std::cout.write(batch.data(), batch.size());
+    }
+}
+
+log_ring::~log_ring() {
+    // whatever is still buffered at thread exit goes out synchronously
+    flush_log_ring();
+}
+
 void
 logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n) {
     bool is_stdout_enabled = _stdout.load(std::memory_order_relaxed);
@@ -87,8 +163,16 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
     if(!is_stdout_enabled && !is_syslog_enabled) {
       return;
     }
+    auto& ring = g_log_ring;
+    if (ring.entries.size() >= log_ring::capacity) {
+        // overloaded; dropping is better than stalling the reactor
+        ++ring.dropped;
+        return;
+    }
     int syslog_offset = 0;
-    std::ostringstream out;
+    char buf[1024];
+    bounded_streambuf sb(buf, sizeof(buf) - 1);   // reserve room for '\n'
+    std::ostream out(&sb);
     static array_map<sstring, 20> level_map = {
             { int(log_level::debug), "DEBUG" },
             { int(log_level::info),  "INFO "  },
@@ -98,7 +182,7 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
     };
     out << level_map[int(level)];
     syslog_offset += 5;
-    if (_stdout.load(std::memory_order_relaxed)) {
+    if (is_stdout_enabled) {
         auto now = std::chrono::system_clock::now();
         auto residual_millis =
                 std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
@@ -132,26 +216,18 @@ logger::really_do_log(log_level level, const char* fmt, stringer** s, size_t n)
             out << *p++;
         }
     }
-    out << "\n";
-    auto msg = out.str();
-    if (is_stdout_enabled) {
-        std::cout << msg;
-    }
-    if (is_syslog_enabled) {
-        static array_map<int, 20> level_map = {
-                { int(log_level::debug), LOG_DEBUG },
-                { int(log_level::info), LOG_INFO },
-                { int(log_level::trace), LOG_DEBUG },  // no LOG_TRACE
-                { int(log_level::warn), LOG_WARNING },
-                { int(log_level::error), LOG_ERR },
-        };
-        // NOTE: syslog() can block, which will stall the reactor thread.
-        //       this should be rare (will have to fill the pipe buffer
-        //       before syslogd can clear it) but can happen.  If it does,
-        //       we'll have to implement some internal buffering (which
-        //       still means the problem can happen, just less frequently).
-        // syslog() interprets % characters, so send msg as a parameter
-        syslog(level_map[int(level)], "%s", msg.c_str() + syslog_offset);
+    auto size = sb.size();
+    buf[size++] = '\n';
+    ring.entries.push_back({level, syslog_offset, sstring(buf, size)});
+    if (local_engine) {
+        if (!ring.flush_scheduled) {
+            ring.flush_scheduled = true;
+            engine().add_task(make_task([] { flush_log_ring(); }));
+        }
+    } else {
+        // no reactor on this thread (early startup, helper threads):
+        // write synchronously as before
+        flush_log_ring();
     }
 }
 
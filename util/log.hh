@@ -199,6 +199,14 @@ public:
     /// Also output to stdout. default is true
     static void set_stdout_enabled(bool enabled);
 
+    static bool is_stdout_enabled() {
+        return _stdout.load(std::memory_order_relaxed);
+    }
+
+    static bool is_syslog_enabled() {
+        return _syslog.load(std::memory_order_relaxed);
+    }
+
     /// Also output to syslog. default is false
     ///
     /// NOTE: syslog() can block, which will stall the reactor thread.